@@ -27,6 +27,17 @@
 #define SNAPSHOT_SERVER_SOCKET_SNDBUF_SIZE          ( 1024 * 1024 )
 #define SNAPSHOT_SERVER_SOCKET_RCVBUF_SIZE          ( 1024 * 1024 )
 
+#define SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE                       32
+#define SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE                       64
+#define SNAPSHOT_SERVER_SEND_BATCH_SIZE                          64
+
+#define SNAPSHOT_CLIENT_IO_THREAD_QUEUE_SIZE                    256
+#define SNAPSHOT_SERVER_IO_THREAD_QUEUE_SIZE                   1024
+#define SNAPSHOT_SERVER_HANDSHAKE_QUEUE_SIZE                    256
+#define SNAPSHOT_SERVER_RATE_LIMIT_ENTRIES                     4096
+#define SNAPSHOT_SERVER_RATE_LIMIT_BURST                         32
+#define SNAPSHOT_SERVER_CHALLENGE_WINDOW_BITS                  2048
+
 #define SNAPSHOT_NUM_DISCONNECT_PACKETS                          10
 
 #if !defined(SNAPSHOT_DEVELOPMENT)
@@ -54,8 +65,15 @@
 #define SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES                       24
 #define SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES                    512
 
-#define SNAPSHOT_VERSION_INFO ( (uint8_t*) "SNAPSHOT" )
-#define SNAPSHOT_VERSION_INFO_BYTES                               9
+#define SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305                    0
+#define SNAPSHOT_CIPHER_SUITE_AES256GCM                           1
+#define SNAPSHOT_NUM_CIPHER_SUITES                                2
+
+// version 2 added the cipher suite to connect tokens and connection requests.
+// version 3 sends connection responses in the clear, with the challenge token sequence and a mac keyed by the client to server key
+
+#define SNAPSHOT_VERSION_INFO ( (uint8_t*) "SNAPSHOT3" )
+#define SNAPSHOT_VERSION_INFO_BYTES                              10
 
 #define SNAPSHOT_BOOL                                           int
 #define SNAPSHOT_TRUE                                             1
@@ -204,6 +222,8 @@ void snapshot_printf( int level, const char * format, ... );
 
 // -----------------------------------------
 
+// pass NULL for both functions to go back to malloc and free
+
 void snapshot_allocator( void * (*malloc_function)( void * context, size_t bytes ), void (*free_function)( void * context, void * p ) );
 
 void * snapshot_malloc( void * context, size_t bytes );
@@ -31,6 +31,8 @@ const char * snapshot_address_to_string_without_port( const struct snapshot_addr
 
 SNAPSHOT_BOOL snapshot_address_equal( const struct snapshot_address_t * a, const struct snapshot_address_t * b );
 
+uint32_t snapshot_address_hash( const struct snapshot_address_t * address );
+
 void snapshot_address_anonymize( struct snapshot_address_t * address );
 
 #endif // #ifndef SNAPSHOT_ADDRESS_H
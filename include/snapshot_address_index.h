@@ -0,0 +1,40 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#ifndef SNAPSHOT_ADDRESS_INDEX_H
+#define SNAPSHOT_ADDRESS_INDEX_H
+
+#include "snapshot.h"
+#include "snapshot_address.h"
+
+// open addressing hash index from address to an index into an array of addresses owned by the caller.
+// the index only stores key indices, so the caller must remove an entry before changing or clearing its address.
+
+struct snapshot_address_index_t
+{
+    int num_slots;
+    int num_entries;
+    int * slots;
+    const struct snapshot_address_t * keys;
+};
+
+void snapshot_address_index_init( struct snapshot_address_index_t * index, int * slots, int num_slots, const struct snapshot_address_t * keys );
+
+void snapshot_address_index_clear( struct snapshot_address_index_t * index );
+
+void snapshot_address_index_insert( struct snapshot_address_index_t * index, int key_index );
+
+SNAPSHOT_BOOL snapshot_address_index_remove( struct snapshot_address_index_t * index, int key_index );
+
+int snapshot_address_index_find( const struct snapshot_address_index_t * index, const struct snapshot_address_t * address );
+
+int snapshot_address_index_find_next( const struct snapshot_address_index_t * index, const struct snapshot_address_t * address, int * iterator );
+
+#endif // #ifndef SNAPSHOT_ADDRESS_INDEX_H
@@ -0,0 +1,16 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#ifndef SNAPSHOT_BENCH_H
+#define SNAPSHOT_BENCH_H
+
+void snapshot_run_benchmarks();
+
+#endif // #ifndef SNAPSHOT_BENCH_H
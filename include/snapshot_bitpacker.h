@@ -35,6 +35,11 @@ extern void snapshot_bitwriter_write_align( struct snapshot_bitwriter_t * writer
 
 extern void snapshot_bitwriter_write_bytes( struct snapshot_bitwriter_t * writer, const uint8_t * data, int bytes );
 
+// writes count values of the same width, for example an array of 12 bit positions. whole blocks of 32 values
+// are packed into exactly "bits" words by unrolled kernels with every shift known at compile time
+
+extern void snapshot_bitwriter_write_array( struct snapshot_bitwriter_t * writer, const uint32_t * values, int count, int bits );
+
 extern void snapshot_bitwriter_flush_bits( struct snapshot_bitwriter_t * writer );
 
 extern int snapshot_bitwriter_get_align_bits( struct snapshot_bitwriter_t * writer );
@@ -67,6 +72,11 @@ extern SNAPSHOT_BOOL snapshot_bitreader_read_align( struct snapshot_bitreader_t
 
 extern void snapshot_bitreader_read_bytes( struct snapshot_bitreader_t * reader, uint8_t * data, int bytes );
 
+// reads count values of the same width written by snapshot_bitwriter_write_array. check snapshot_bitreader_would_read_past_end
+// with count * bits first, just like snapshot_bitreader_read_bits
+
+extern void snapshot_bitreader_read_array( struct snapshot_bitreader_t * reader, uint32_t * values, int count, int bits );
+
 extern int snapshot_bitreader_get_read_align_bits( struct snapshot_bitreader_t * reader );
 
 // -------------------------------------------------------------------------------------------------------------------------
@@ -12,15 +12,33 @@
 #define SNAPSHOT_CHALLENGE_TOKEN_H
 
 #include "snapshot.h"
+#include "snapshot_address.h"
 
-#define SNAPSHOT_CHALLENGE_TOKEN_BYTES 300
+#define SNAPSHOT_CHALLENGE_TOKEN_BYTES 384
+
+// the challenge token carries everything the server needs to finish the handshake, so a server running a
+// stateless handshake can create the encryption mapping from the connection response alone
+
+struct snapshot_connect_token_private_t;
 
 struct snapshot_challenge_token_t
 {
     uint64_t client_id;
     uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    uint8_t client_to_server_key[SNAPSHOT_KEY_BYTES];
+    uint8_t server_to_client_key[SNAPSHOT_KEY_BYTES];
+    int timeout_seconds;
+    int cipher_suite;
+    struct snapshot_address_t address;
+    uint64_t expire_timestamp;
 };
 
+void snapshot_generate_challenge_token( struct snapshot_challenge_token_t * challenge_token, 
+                                        const struct snapshot_connect_token_private_t * connect_token, 
+                                        const struct snapshot_address_t * address, 
+                                        int cipher_suite, 
+                                        uint64_t expire_timestamp );
+
 void snapshot_write_challenge_token( struct snapshot_challenge_token_t * challenge_token, uint8_t * buffer, int buffer_length );
 
 int snapshot_encrypt_challenge_token( uint8_t * buffer, int buffer_length, uint64_t sequence, uint8_t * key );
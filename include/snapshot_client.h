@@ -49,10 +49,16 @@
 #define SNAPSHOT_CLIENT_COUNTER_PACKETS_SENT                            22
 #define SNAPSHOT_CLIENT_COUNTER_PACKETS_SENT_LOOPBACK                   23
 #define SNAPSHOT_CLIENT_COUNTER_PACKETS_SENT_SIMULATOR                  24
+#define SNAPSHOT_CLIENT_COUNTER_IO_RECEIVE_QUEUE_DEPTH                  25
+#define SNAPSHOT_CLIENT_COUNTER_IO_SEND_QUEUE_DEPTH                     26
+#define SNAPSHOT_CLIENT_COUNTER_IO_RECEIVE_QUEUE_DROPS                  27
+#define SNAPSHOT_CLIENT_COUNTER_IO_SEND_QUEUE_DROPS                     28
+#define SNAPSHOT_CLIENT_COUNTER_CRYPTO_ISA                              29
 
-#define SNAPSHOT_CLIENT_NUM_COUNTERS                                    25
+#define SNAPSHOT_CLIENT_NUM_COUNTERS                                    30
 
 struct snapshot_address_t;
+struct snapshot_range_model_t;
 
 struct snapshot_client_config_t
 {
@@ -60,6 +66,14 @@ struct snapshot_client_config_t
     void (*state_change_callback)(void*,int,int);
     void (*send_loopback_packet_callback)(void*,const struct snapshot_address_t*,uint8_t*,int);
     void (*process_passthrough_callback)(void*,const uint8_t*,int);
+    SNAPSHOT_BOOL io_thread;
+    SNAPSHOT_BOOL packet_pool;
+    int ack_bits;
+    int replay_protection_window_bits;
+    int snapshot_bytes;
+    int snapshot_history;
+    int snapshot_range_coder;
+    const struct snapshot_range_model_t * snapshot_range_model;
 #if SNAPSHOT_DEVELOPMENT
     struct snapshot_network_simulator_t * network_simulator;
 #endif // #if SNAPSHOT_DEVELOPMENT
@@ -103,6 +117,10 @@ const char * snapshot_client_state_name( int client_state );
 void snapshot_client_set_development_flags( struct snapshot_client_t * client, uint64_t flags );
 #endif // #if SNAPSHOT_DEVELOPMENT
 
+const uint8_t * snapshot_client_snapshot( struct snapshot_client_t * client, uint16_t * sequence );
+
 const uint64_t * snapshot_client_counters( struct snapshot_client_t * client );
 
+const uint64_t * snapshot_client_packet_pool_counters( struct snapshot_client_t * client );
+
 #endif // #ifndef SNAPSHOT_CLIENT_H
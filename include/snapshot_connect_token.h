@@ -29,6 +29,7 @@ struct snapshot_connect_token_t
     struct snapshot_address_t server_addresses[SNAPSHOT_MAX_SERVERS_PER_CONNECT];
     uint8_t client_to_server_key[SNAPSHOT_KEY_BYTES];
     uint8_t server_to_client_key[SNAPSHOT_KEY_BYTES];
+    uint8_t cipher_suite;
 };
 
 int snapshot_generate_connect_token( int num_server_addresses, 
@@ -41,6 +42,17 @@ int snapshot_generate_connect_token( int num_server_addresses,
                                      uint8_t * user_data, 
                                      uint8_t * output_buffer );
 
+int snapshot_generate_connect_token_with_cipher_suite( int num_server_addresses, 
+                                                       const char ** server_addresses, 
+                                                       int expire_seconds, 
+                                                       int timeout_seconds,
+                                                       uint64_t client_id, 
+                                                       uint64_t protocol_id, 
+                                                       const uint8_t * private_key, 
+                                                       uint8_t * user_data, 
+                                                       int cipher_suite,
+                                                       uint8_t * output_buffer );
+
 void snapshot_write_connect_token( struct snapshot_connect_token_t * connect_token, uint8_t * buffer, int buffer_length );
 
 int snapshot_read_connect_token( const uint8_t * buffer, int buffer_length, struct snapshot_connect_token_t * connect_token );
@@ -55,6 +67,7 @@ struct snapshot_connect_token_private_t
     struct snapshot_address_t server_addresses[SNAPSHOT_MAX_SERVERS_PER_CONNECT];
     uint8_t client_to_server_key[SNAPSHOT_KEY_BYTES];
     uint8_t server_to_client_key[SNAPSHOT_KEY_BYTES];
+    uint8_t cipher_suite;
     uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
 };
 
@@ -0,0 +1,53 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#ifndef SNAPSHOT_CONNECT_TOKEN_TABLE_H
+#define SNAPSHOT_CONNECT_TOKEN_TABLE_H
+
+#include "snapshot.h"
+#include "snapshot_address.h"
+
+#define SNAPSHOT_CONNECT_TOKEN_ENTRIES_PER_CLIENT 4
+
+// remembers the mac of each connect token the server has accepted and the address it came from, so a token
+// can't be replayed from a different address. entries are found through an open addressing hash on the mac and
+// kept on an intrusive lru list, so when the table is full the entry used least recently is evicted.
+
+struct snapshot_connect_token_entry_t
+{
+    uint8_t mac[SNAPSHOT_MAC_BYTES];
+    struct snapshot_address_t address;
+    int prev;
+    int next;
+};
+
+struct snapshot_connect_token_table_t
+{
+    void * context;
+    int max_entries;
+    int num_entries;
+    int num_slots;
+    int lru_head;
+    int lru_tail;
+    int * slots;
+    struct snapshot_connect_token_entry_t * entries;
+};
+
+struct snapshot_connect_token_table_t * snapshot_connect_token_table_create( void * context, int max_entries );
+
+void snapshot_connect_token_table_destroy( struct snapshot_connect_token_table_t * table );
+
+size_t snapshot_connect_token_table_memory_bytes( const struct snapshot_connect_token_table_t * table );
+
+void snapshot_connect_token_table_reset( struct snapshot_connect_token_table_t * table );
+
+SNAPSHOT_BOOL snapshot_connect_token_table_find_or_add( struct snapshot_connect_token_table_t * table, const struct snapshot_address_t * address, const uint8_t * mac );
+
+#endif // #ifndef SNAPSHOT_CONNECT_TOKEN_TABLE_H
@@ -40,8 +40,18 @@
 #define SNAPSHOT_CRYPTO_AEAD_CHACHA20POLY1305_IETF_KEYBYTES     32
 #define SNAPSHOT_CRYPTO_AEAD_CHACHA20POLY1305_IETF_NPUBBYTES    12
 
+#define SNAPSHOT_CRYPTO_AEAD_BATCH_LANES                         8
+
+#define SNAPSHOT_CRYPTO_ISA_REF                                  0
+#define SNAPSHOT_CRYPTO_ISA_SSSE3                                1
+#define SNAPSHOT_CRYPTO_ISA_AVX2                                 2
+
 int snapshot_crypto_init();
 
+int snapshot_crypto_isa();
+
+const char * snapshot_crypto_isa_string( int isa );
+
 void snapshot_crypto_random_bytes( uint8_t * buffer, int bytes );
 
 int snapshot_crypto_generichash( unsigned char * out, size_t outlen, const unsigned char * in, unsigned long long inlen, const unsigned char * key, size_t keylen );
@@ -115,4 +125,43 @@ int snapshot_crypto_decrypt_aead_bignonce( uint8_t * message, uint64_t message_l
                                            uint8_t * nonce,
                                            uint8_t * key );
 
+struct snapshot_crypto_aead_batch_item_t
+{
+    uint8_t * message;
+    uint64_t message_length;
+    const uint8_t * additional;
+    uint64_t additional_length;
+    const uint8_t * nonce;
+    const uint8_t * key;
+    int result;
+};
+
+void snapshot_crypto_encrypt_aead_batch( struct snapshot_crypto_aead_batch_item_t * items, int num_items );
+
+void snapshot_crypto_decrypt_aead_batch( struct snapshot_crypto_aead_batch_item_t * items, int num_items );
+
+SNAPSHOT_BOOL snapshot_crypto_aes256gcm_available();
+
+int snapshot_crypto_encrypt_aead_aes256gcm( uint8_t * message, uint64_t message_length, 
+                                            const uint8_t * additional, uint64_t additional_length,
+                                            const uint8_t * nonce,
+                                            const uint8_t * key );
+
+int snapshot_crypto_decrypt_aead_aes256gcm( uint8_t * message, uint64_t message_length, 
+                                            const uint8_t * additional, uint64_t additional_length,
+                                            const uint8_t * nonce,
+                                            const uint8_t * key );
+
+int snapshot_crypto_select_cipher_suite( int requested_cipher_suite );
+
+const char * snapshot_cipher_suite_string( int cipher_suite );
+
+#if SNAPSHOT_DEVELOPMENT
+
+void snapshot_crypto_force_batch_isa( int isa );
+
+void snapshot_crypto_force_aes256gcm_available( SNAPSHOT_BOOL available );
+
+#endif // #if SNAPSHOT_DEVELOPMENT
+
 #endif // #ifndef SNAPSHOT_CRYPTO_H
@@ -0,0 +1,65 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+
+#ifndef SNAPSHOT_DELTA_H
+#define SNAPSHOT_DELTA_H
+
+#include "snapshot.h"
+
+#define SNAPSHOT_DELTA_DEFAULT_HISTORY                                     32
+
+#define SNAPSHOT_DELTA_ENCODING_RAW                                         0
+#define SNAPSHOT_DELTA_ENCODING_KEYFRAME                                    1
+#define SNAPSHOT_DELTA_ENCODING_DELTA                                       2
+
+// delta compression of fixed size snapshots against the most recent snapshot the other side acked.
+//
+// snapshots are treated as arrays of 32 bit little endian fields. the encoder keeps a history of the snapshots
+// it sent keyed by endpoint sequence, and when one of them is acked it becomes the baseline for the next write.
+// each group of 32 fields has a changed bit, followed by a changed mask when any field in the group changed, and
+// each changed field is sent as either an arithmetic or xor delta against the baseline, whichever needs fewer bits,
+// in 4, 8, 16 or 32 bits. without an acked baseline the snapshot is sent as a keyframe, which is the same encoding
+// against a zero baseline, and if a delta would be larger than the snapshot itself the raw bytes are sent instead.
+//
+// the decoder keeps a history of the snapshots it decoded keyed by the same sequence, so any snapshot it acked is
+// available as a baseline for as long as the encoder can still pick it.
+
+struct snapshot_delta_encoder_t;
+
+struct snapshot_delta_decoder_t;
+
+int snapshot_delta_max_bytes( int snapshot_bytes );
+
+struct snapshot_delta_encoder_t * snapshot_delta_encoder_create( void * context, int snapshot_bytes, int history_size );
+
+void snapshot_delta_encoder_destroy( struct snapshot_delta_encoder_t * encoder );
+
+void snapshot_delta_encoder_reset( struct snapshot_delta_encoder_t * encoder );
+
+size_t snapshot_delta_encoder_memory_bytes( const struct snapshot_delta_encoder_t * encoder );
+
+void snapshot_delta_encoder_process_acks( struct snapshot_delta_encoder_t * encoder, const uint16_t * acks, int num_acks );
+
+const uint8_t * snapshot_delta_encoder_write( struct snapshot_delta_encoder_t * encoder, uint16_t sequence, const uint8_t * snapshot_data, int * out_bytes, int * out_encoding );
+
+struct snapshot_delta_decoder_t * snapshot_delta_decoder_create( void * context, int snapshot_bytes, int history_size );
+
+void snapshot_delta_decoder_destroy( struct snapshot_delta_decoder_t * decoder );
+
+void snapshot_delta_decoder_reset( struct snapshot_delta_decoder_t * decoder );
+
+size_t snapshot_delta_decoder_memory_bytes( const struct snapshot_delta_decoder_t * decoder );
+
+int snapshot_delta_decoder_read( struct snapshot_delta_decoder_t * decoder, uint16_t sequence, const uint8_t * data, int bytes );
+
+const uint8_t * snapshot_delta_decoder_find( struct snapshot_delta_decoder_t * decoder, uint16_t sequence );
+
+#endif // #ifndef SNAPSHOT_DELTA_H
@@ -13,21 +13,34 @@
 
 #include "snapshot.h"
 #include "snapshot_address.h"
+#include "snapshot_address_index.h"
 
-#define SNAPSHOT_MAX_ENCRYPTION_MAPPINGS ( SNAPSHOT_MAX_CLIENTS * 4 )
+#define SNAPSHOT_ENCRYPTION_MAPPINGS_PER_CLIENT 4
 
 struct snapshot_encryption_manager_t
 {
+    void * context;
+    int max_encryption_mappings;
     int num_encryption_mappings;
-    int timeout[SNAPSHOT_MAX_ENCRYPTION_MAPPINGS];
-    double expire_time[SNAPSHOT_MAX_ENCRYPTION_MAPPINGS];
-    double last_access_time[SNAPSHOT_MAX_ENCRYPTION_MAPPINGS];
-    struct snapshot_address_t address[SNAPSHOT_MAX_ENCRYPTION_MAPPINGS];
-    int client_index[SNAPSHOT_MAX_ENCRYPTION_MAPPINGS];
-    uint8_t send_key[SNAPSHOT_KEY_BYTES*SNAPSHOT_MAX_ENCRYPTION_MAPPINGS];
-    uint8_t receive_key[SNAPSHOT_KEY_BYTES*SNAPSHOT_MAX_ENCRYPTION_MAPPINGS];
+    int * timeout;
+    double * expire_time;
+    double * last_access_time;
+    struct snapshot_address_t * address;
+    int * client_index;
+    uint8_t * send_key;
+    uint8_t * receive_key;
+    int * cipher_suite;
+    int num_address_index_slots;
+    int * address_index_slots;
+    struct snapshot_address_index_t address_index;
 };
 
+struct snapshot_encryption_manager_t * snapshot_encryption_manager_create( void * context, int max_encryption_mappings );
+
+void snapshot_encryption_manager_destroy( struct snapshot_encryption_manager_t * encryption_manager );
+
+size_t snapshot_encryption_manager_memory_bytes( const struct snapshot_encryption_manager_t * encryption_manager );
+
 void snapshot_encryption_manager_reset( struct snapshot_encryption_manager_t * encryption_manager );
 
 int snapshot_encryption_manager_entry_expired( struct snapshot_encryption_manager_t * encryption_manager, int index, double time );
@@ -48,10 +61,14 @@ int snapshot_encryption_manager_touch( struct snapshot_encryption_manager_t * en
 
 void snapshot_encryption_manager_set_expire_time( struct snapshot_encryption_manager_t * encryption_manager, int index, double expire_time );
 
+void snapshot_encryption_manager_set_cipher_suite( struct snapshot_encryption_manager_t * encryption_manager, int index, int cipher_suite );
+
 uint8_t * snapshot_encryption_manager_get_send_key( struct snapshot_encryption_manager_t * encryption_manager, int index );
 
 uint8_t * snapshot_encryption_manager_get_receive_key( struct snapshot_encryption_manager_t * encryption_manager, int index );
 
 int snapshot_encryption_manager_get_timeout( struct snapshot_encryption_manager_t * encryption_manager, int index );
 
+int snapshot_encryption_manager_get_cipher_suite( struct snapshot_encryption_manager_t * encryption_manager, int index );
+
 #endif // #ifndef SNAPSHOT_ENCRYPTION_MANAGER_H
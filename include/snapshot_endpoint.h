@@ -33,6 +33,28 @@
 #define SNAPSHOT_ENDPOINT_COUNTER_NUM_FRAGMENTS_INVALID                     9
 #define SNAPSHOT_ENDPOINT_NUM_COUNTERS                                     10
 
+struct snapshot_packet_pool_t;
+
+struct snapshot_endpoint_fragment_t
+{
+    uint8_t * payload_data;
+    int payload_bytes;
+    int header_bytes;
+    uint8_t header[SNAPSHOT_FRAGMENT_HEADER_BYTES + SNAPSHOT_MAX_PACKET_HEADER_BYTES];
+    uint8_t trailer[SNAPSHOT_MAC_BYTES];
+};
+
+struct snapshot_endpoint_payload_t
+{
+    uint8_t * data;
+    int bytes;
+    uint16_t sequence;
+    uint16_t ack;
+    uint32_t ack_bits[SNAPSHOT_MAX_ACK_WORDS];
+    int num_ack_words;
+    uint8_t * reassembly_buffer;
+};
+
 struct snapshot_endpoint_config_t
 {
     void * context;
@@ -42,6 +64,7 @@ struct snapshot_endpoint_config_t
     int max_fragments;
     int fragment_size;
     int ack_buffer_size;
+    int ack_bits;
     int sent_packets_buffer_size;
     int received_packets_buffer_size;
     int fragment_reassembly_buffer_size;
@@ -49,10 +72,33 @@ struct snapshot_endpoint_config_t
     float packet_loss_smoothing_factor;
     float bandwidth_smoothing_factor;
     int packet_header_size;
+    struct snapshot_packet_pool_t * packet_pool;
 };
 
 void snapshot_endpoint_default_config( struct snapshot_endpoint_config_t * config );
 
+static inline SNAPSHOT_BOOL snapshot_endpoint_valid_ack_bits( int ack_bits )
+{
+    return ( ack_bits == 32 || ack_bits == 64 || ack_bits == 128 ) ? SNAPSHOT_TRUE : SNAPSHOT_FALSE;
+}
+
+// running sums over the older half of a sent or received packets sequence buffer. the window slides forward
+// as packets are inserted, adding samples that enter it and removing samples that leave, so the endpoint
+// update reads packet loss and bandwidth in constant time regardless of the buffer size.
+// oldest sequence is the sample start time was taken from. no sample in the window is older than it.
+
+struct snapshot_endpoint_window_t
+{
+    uint16_t start_sequence;
+    uint16_t oldest_sequence;
+    int num_packets;
+    int num_acked;
+    uint64_t bytes;
+    uint64_t acked_bytes;
+    double start_time;
+    double finish_time;
+};
+
 struct snapshot_endpoint_t
 {
     void * context;
@@ -66,9 +112,12 @@ struct snapshot_endpoint_t
     int num_acks;
     uint16_t * acks;
     uint16_t sequence;
-    struct snapshot_sequence_buffer_t * sent_packets;
-    struct snapshot_sequence_buffer_t * received_packets;
-    struct snapshot_sequence_buffer_t * fragment_reassembly;
+    struct snapshot_packed_sequence_buffer_t * sent_packets;
+    struct snapshot_packed_sequence_buffer_t * received_packets;
+    struct snapshot_packed_sequence_buffer_t * fragment_reassembly;
+    struct snapshot_endpoint_window_t sent_window;
+    struct snapshot_endpoint_window_t received_window;
+    uint32_t received_ack_bits[SNAPSHOT_MAX_ACK_WORDS];
     uint64_t counters[SNAPSHOT_ENDPOINT_NUM_COUNTERS];
 };
 
@@ -76,14 +125,28 @@ struct snapshot_endpoint_t * snapshot_endpoint_create( struct snapshot_endpoint_
 
 void snapshot_endpoint_destroy( struct snapshot_endpoint_t * endpoint );
 
+size_t snapshot_endpoint_memory_bytes( const struct snapshot_endpoint_t * endpoint );
+
 uint16_t snapshot_endpoint_sequence( struct snapshot_endpoint_t * endpoint );
 
 void snapshot_endpoint_write_packets( struct snapshot_endpoint_t * endpoint, uint8_t * payload_data, int payload_bytes, int * num_packets, uint8_t ** packet_data, int * packet_bytes );
 
+void snapshot_endpoint_write_fragments( struct snapshot_endpoint_t * endpoint, uint8_t * payload_data, int payload_bytes, int * num_fragments, struct snapshot_endpoint_fragment_t * fragments );
+
+uint8_t * snapshot_endpoint_fragment_begin( struct snapshot_endpoint_fragment_t * fragment, int * packet_bytes );
+
+void snapshot_endpoint_fragment_end( struct snapshot_endpoint_fragment_t * fragment );
+
+void snapshot_endpoint_receive_packet( struct snapshot_endpoint_t * endpoint, uint8_t * packet_data, int packet_bytes, struct snapshot_endpoint_payload_t * payload );
+
+void snapshot_endpoint_release_payload( struct snapshot_endpoint_t * endpoint, struct snapshot_endpoint_payload_t * payload );
+
 void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, uint8_t * packet_data, int packet_bytes, uint8_t * payload_buffer, uint8_t ** out_payload_data, int * out_payload_bytes, uint16_t * out_packet_sequence, uint16_t * out_packet_ack, uint32_t * out_packet_ack_bits );
 
 void snapshot_endpoint_mark_payload_processed( struct snapshot_endpoint_t * endpoint, uint16_t sequence, uint16_t ack, uint32_t ack_bits, int payload_bytes );
 
+void snapshot_endpoint_mark_payload_processed_ack_words( struct snapshot_endpoint_t * endpoint, uint16_t sequence, uint16_t ack, const uint32_t * ack_bits, int num_ack_words, int payload_bytes );
+
 uint16_t * snapshot_endpoint_get_acks( struct snapshot_endpoint_t * endpoint, int * num_acks );
 
 void snapshot_endpoint_clear_acks( struct snapshot_endpoint_t * endpoint );
@@ -0,0 +1,89 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#ifndef SNAPSHOT_HANDSHAKE_H
+#define SNAPSHOT_HANDSHAKE_H
+
+#include "snapshot.h"
+#include "snapshot_address.h"
+#include "snapshot_connect_token.h"
+#include "snapshot_challenge_token.h"
+#include "snapshot_packets.h"
+
+#define SNAPSHOT_HANDSHAKE_CONNECTION_REQUEST                            0
+#define SNAPSHOT_HANDSHAKE_CONNECTION_RESPONSE                           1
+
+#define SNAPSHOT_HANDSHAKE_COUNTER_JOBS_QUEUED                           0
+#define SNAPSHOT_HANDSHAKE_COUNTER_JOBS_COMPLETED                        1
+#define SNAPSHOT_HANDSHAKE_COUNTER_JOBS_FAILED                           2
+#define SNAPSHOT_HANDSHAKE_COUNTER_QUEUE_DROPS                           3
+#define SNAPSHOT_HANDSHAKE_COUNTER_QUEUE_MAX_DEPTH                       4
+
+#define SNAPSHOT_HANDSHAKE_NUM_COUNTERS                                  5
+
+#define SNAPSHOT_HANDSHAKE_MAX_THREADS                                  16
+
+#define SNAPSHOT_HANDSHAKE_MAX_PACKET_BYTES SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES
+
+// a handshake pool runs the expensive, stateless part of the connection handshake on worker threads: decrypting and
+// reading the connect token in connection requests and encrypting the challenge token sent back, and opening the
+// challenge token and checking the mac in connection responses. the server queues jobs from its update and applies finished jobs on its
+// own thread, where all the stateful checks happen. each worker has a bounded single producer, single consumer ring
+// and sleeps on a condition until the server commits a job to it. a job holds its slot until the server takes the
+// result, so when a ring is full new jobs are dropped and counted.
+
+struct snapshot_handshake_t
+{
+    // set by the server when the job is queued. for a connection response the worker sets challenge_token_sequence from the packet
+
+    int type;
+    struct snapshot_address_t from;
+    uint64_t current_timestamp;
+    uint64_t challenge_token_sequence;
+    int packet_bytes;
+    uint8_t packet_data[SNAPSHOT_HANDSHAKE_MAX_PACKET_BYTES];
+
+    // filled in by the worker
+
+    int result;
+    int cipher_suite;
+    uint64_t connect_token_expire_timestamp;
+    uint8_t connect_token_mac[SNAPSHOT_MAC_BYTES];
+    struct snapshot_connect_token_private_t connect_token;
+    uint8_t challenge_token_data[SNAPSHOT_CHALLENGE_TOKEN_BYTES];
+    struct snapshot_challenge_token_t challenge_token;
+};
+
+struct snapshot_handshake_pool_t * snapshot_handshake_pool_create( void * context,
+                                                                   int num_threads,
+                                                                   int queue_size,
+                                                                   uint64_t protocol_id,
+                                                                   const uint8_t * private_key,
+                                                                   const uint8_t * challenge_key );
+
+void snapshot_handshake_pool_destroy( struct snapshot_handshake_pool_t * pool );
+
+struct snapshot_handshake_t * snapshot_handshake_pool_begin_job( struct snapshot_handshake_pool_t * pool );
+
+void snapshot_handshake_pool_commit_job( struct snapshot_handshake_pool_t * pool );
+
+struct snapshot_handshake_t * snapshot_handshake_pool_next_completed_job( struct snapshot_handshake_pool_t * pool );
+
+void snapshot_handshake_pool_release_job( struct snapshot_handshake_pool_t * pool );
+
+int snapshot_handshake_pool_queue_depth( struct snapshot_handshake_pool_t * pool );
+
+size_t snapshot_handshake_pool_memory_bytes( struct snapshot_handshake_pool_t * pool );
+
+void snapshot_handshake_pool_counters( struct snapshot_handshake_pool_t * pool, uint64_t * counters );
+
+void snapshot_handshake_process( struct snapshot_handshake_t * handshake, uint64_t protocol_id, uint8_t * private_key, uint8_t * challenge_key );
+
+#endif // #ifndef SNAPSHOT_HANDSHAKE_H
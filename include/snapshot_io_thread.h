@@ -0,0 +1,60 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#ifndef SNAPSHOT_IO_THREAD_H
+#define SNAPSHOT_IO_THREAD_H
+
+#include "snapshot.h"
+
+#define SNAPSHOT_IO_THREAD_COUNTER_PACKETS_RECEIVED                     0
+#define SNAPSHOT_IO_THREAD_COUNTER_PACKETS_SENT                         1
+#define SNAPSHOT_IO_THREAD_COUNTER_RECEIVE_QUEUE_DROPS                  2
+#define SNAPSHOT_IO_THREAD_COUNTER_SEND_QUEUE_DROPS                     3
+#define SNAPSHOT_IO_THREAD_COUNTER_RECEIVE_QUEUE_MAX_DEPTH              4
+#define SNAPSHOT_IO_THREAD_COUNTER_SEND_QUEUE_MAX_DEPTH                 5
+
+#define SNAPSHOT_IO_THREAD_NUM_COUNTERS                                 6
+
+#define SNAPSHOT_IO_THREAD_BATCH_SIZE                                  64
+
+// how long the io thread blocks in receive before it checks whether it should quit
+
+#define SNAPSHOT_IO_THREAD_RECEIVE_TIMEOUT                          0.001f
+
+// an io thread owns all socket calls for a client or server. received packets are pushed into a single producer,
+// single consumer ring that the game thread drains in update, and packets sent by the game thread flow the other way.
+// ring indices are published with acquire and release atomics, so no lock is taken per packet. receives and sends
+// each run on their own thread, so a queued packet is sent right away instead of waiting for a blocking receive to
+// return. the send thread only sleeps on a condition when its ring is empty. packets cross the rings still encrypted,
+// decryption and replay checks stay with the game thread. the socket must be created blocking with a receive timeout,
+// and stays owned by the caller. destroy the io thread first.
+
+struct snapshot_address_t;
+struct snapshot_platform_socket_t;
+
+struct snapshot_io_thread_t * snapshot_io_thread_create( void * context, struct snapshot_platform_socket_t * socket, int queue_size );
+
+void snapshot_io_thread_destroy( struct snapshot_io_thread_t * io_thread );
+
+int snapshot_io_thread_receive_packets( struct snapshot_io_thread_t * io_thread, struct snapshot_address_t * from, uint8_t ** packet_data, int * packet_bytes, int max_packets );
+
+void snapshot_io_thread_release_packets( struct snapshot_io_thread_t * io_thread, int num_packets );
+
+SNAPSHOT_BOOL snapshot_io_thread_send_packet( struct snapshot_io_thread_t * io_thread, const struct snapshot_address_t * to, const uint8_t * packet_data, int packet_bytes );
+
+int snapshot_io_thread_receive_queue_depth( struct snapshot_io_thread_t * io_thread );
+
+int snapshot_io_thread_send_queue_depth( struct snapshot_io_thread_t * io_thread );
+
+size_t snapshot_io_thread_memory_bytes( struct snapshot_io_thread_t * io_thread );
+
+void snapshot_io_thread_counters( struct snapshot_io_thread_t * io_thread, uint64_t * counters );
+
+#endif // #ifndef SNAPSHOT_IO_THREAD_H
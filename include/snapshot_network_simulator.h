@@ -17,7 +17,7 @@
 
 struct snapshot_address_t;
 
-struct snapshot_network_simulator_t * snapshot_network_simulator_create( void * context );
+struct snapshot_network_simulator_t * snapshot_network_simulator_create( void * context, int max_clients );
 
 void snapshot_network_simulator_set( struct snapshot_network_simulator_t * network_simulator, 
                                      float latency_milliseconds, 
@@ -0,0 +1,67 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+
+#ifndef SNAPSHOT_PACKED_SEQUENCE_BUFFER_H
+#define SNAPSHOT_PACKED_SEQUENCE_BUFFER_H
+
+#include "snapshot.h"
+
+// a sequence buffer specialized for power of two sizes. slots are found by masking the sequence instead of a modulo,
+// each slot keeps its 16 bit sequence tag right after the entry data so a lookup touches one cache line, and an
+// occupancy bitmap lets the buffer clear a range of slots a word at a time when the sequence moves forward.
+
+struct snapshot_packed_sequence_buffer_t
+{
+    void * context;
+    uint16_t sequence;
+    int num_entries;
+    int entry_mask;
+    int entry_stride;
+    int slot_stride;
+    uint64_t * occupied;
+    uint8_t * slot_data;
+};
+
+struct snapshot_packed_sequence_buffer_t * snapshot_packed_sequence_buffer_create( void * context, int num_entries, int entry_stride );
+
+void snapshot_packed_sequence_buffer_destroy( struct snapshot_packed_sequence_buffer_t * sequence_buffer );
+
+void snapshot_packed_sequence_buffer_reset( struct snapshot_packed_sequence_buffer_t * sequence_buffer );
+
+void snapshot_packed_sequence_buffer_remove_entries( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t start_sequence, uint16_t finish_sequence, void (*cleanup_function)(void*,void*) );
+
+int snapshot_packed_sequence_buffer_test_insert( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence );
+
+void * snapshot_packed_sequence_buffer_insert( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence );
+
+void snapshot_packed_sequence_buffer_advance( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence );
+
+void * snapshot_packed_sequence_buffer_insert_with_cleanup( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence, void (*cleanup_function)(void*,void*) );
+
+void snapshot_packed_sequence_buffer_advance_with_cleanup( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence, void (*cleanup_function)(void*,void*) );
+
+void snapshot_packed_sequence_buffer_remove( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence );
+
+void snapshot_packed_sequence_buffer_remove_with_cleanup( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence, void (*cleanup_function)(void*,void*) );
+
+int snapshot_packed_sequence_buffer_available( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence );
+
+int snapshot_packed_sequence_buffer_exists( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence );
+
+void * snapshot_packed_sequence_buffer_find( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence );
+
+void * snapshot_packed_sequence_buffer_at_index( struct snapshot_packed_sequence_buffer_t * sequence_buffer, int index );
+
+void snapshot_packed_sequence_buffer_generate_ack_bits( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t * ack, uint32_t * ack_bits );
+
+size_t snapshot_packed_sequence_buffer_memory_bytes( int num_entries, int entry_stride );
+
+#endif // #ifndef SNAPSHOT_PACKED_SEQUENCE_BUFFER_H
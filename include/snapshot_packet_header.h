@@ -13,10 +13,20 @@
 
 #include "snapshot.h"
 
-#define SNAPSHOT_MAX_PACKET_HEADER_BYTES 9
+#define SNAPSHOT_MAX_ACK_BITS 128
+
+#define SNAPSHOT_MAX_ACK_WORDS ( SNAPSHOT_MAX_ACK_BITS / 32 )
+
+// ack bits past the first 32 follow the regular header as a word count, then per word a byte mask and the bytes that aren't 0xFF
+
+#define SNAPSHOT_MAX_PACKET_HEADER_BYTES ( 9 + 1 + ( SNAPSHOT_MAX_ACK_WORDS - 1 ) * 5 )
 
 int snapshot_write_packet_header( uint8_t * packet_data, uint16_t sequence, uint16_t ack, uint32_t ack_bits );
 
+int snapshot_write_packet_header_ack_words( uint8_t * packet_data, uint16_t sequence, uint16_t ack, const uint32_t * ack_bits, int num_ack_words );
+
 int snapshot_read_packet_header( const char * name, const uint8_t * packet_data, int packet_bytes, uint16_t * sequence, uint16_t * ack, uint32_t * ack_bits );
 
+int snapshot_read_packet_header_ack_words( const char * name, const uint8_t * packet_data, int packet_bytes, uint16_t * sequence, uint16_t * ack, uint32_t * ack_bits, int * num_ack_words );
+
 #endif // #ifndef SNAPSHOT_PACKET_HEADER_H
\ No newline at end of file
@@ -0,0 +1,58 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#ifndef SNAPSHOT_PACKET_POOL_H
+#define SNAPSHOT_PACKET_POOL_H
+
+#include "snapshot.h"
+
+#define SNAPSHOT_PACKET_POOL_MIN_SIZE_CLASS_BITS                        7
+#define SNAPSHOT_PACKET_POOL_MAX_SIZE_CLASS_BITS                       14
+#define SNAPSHOT_PACKET_POOL_NUM_SIZE_CLASSES                           ( SNAPSHOT_PACKET_POOL_MAX_SIZE_CLASS_BITS - SNAPSHOT_PACKET_POOL_MIN_SIZE_CLASS_BITS + 1 )
+
+#define SNAPSHOT_PACKET_POOL_COUNTER_HITS                               0
+#define SNAPSHOT_PACKET_POOL_COUNTER_MISSES                             1
+#define SNAPSHOT_PACKET_POOL_COUNTER_OVERSIZE                           2
+#define SNAPSHOT_PACKET_POOL_COUNTER_IN_USE                             3
+#define SNAPSHOT_PACKET_POOL_COUNTER_HIGH_WATER                         4
+#define SNAPSHOT_PACKET_POOL_COUNTER_BYTES_ALLOCATED                    5
+
+#define SNAPSHOT_PACKET_POOL_NUM_COUNTERS                               6
+
+// every packet buffer starts with a small block header ahead of the packet prefix, so snapshot_destroy_packet
+// can hand pooled buffers back to the pool they came from, and free everything else with the allocator
+
+#define SNAPSHOT_PACKET_BLOCK_HEADER_BYTES                             32
+
+struct snapshot_packet_block_t
+{
+    struct snapshot_packet_pool_t * pool;
+    struct snapshot_packet_block_t * next;
+    int size_class;
+};
+
+// a packet pool keeps freed packet buffers on per size class free lists, so steady state traffic doesn't touch the allocator.
+// pools are not thread safe. each client, server and network simulator owns its own.
+
+struct snapshot_packet_pool_t * snapshot_packet_pool_create( void * context );
+
+void snapshot_packet_pool_destroy( struct snapshot_packet_pool_t * pool );
+
+uint8_t * snapshot_packet_pool_create_packet( struct snapshot_packet_pool_t * pool, int packet_bytes );
+
+void snapshot_packet_pool_release_block( struct snapshot_packet_pool_t * pool, struct snapshot_packet_block_t * block );
+
+const uint64_t * snapshot_packet_pool_counters( struct snapshot_packet_pool_t * pool );
+
+// pools grow on demand and never shrink, so this is the pool struct plus every block it has allocated so far
+
+size_t snapshot_packet_pool_memory_bytes( const struct snapshot_packet_pool_t * pool );
+
+#endif // #ifndef SNAPSHOT_PACKET_POOL_H
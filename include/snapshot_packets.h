@@ -31,7 +31,12 @@
 #define SNAPSHOT_DISCONNECT_PACKET                   7
 #define SNAPSHOT_NUM_PACKETS                         8
 
+#define SNAPSHOT_PACKET_ADDITIONAL_DATA_BYTES      ( SNAPSHOT_VERSION_INFO_BYTES + 8 + 1 )
+#define SNAPSHOT_PACKET_NONCE_BYTES                 12
+
 struct snapshot_replay_protection_t;
+struct snapshot_packet_pool_t;
+struct snapshot_crypto_aead_batch_item_t;
 
 static inline int snapshot_sequence_number_bytes_required( uint64_t sequence )
 {
@@ -46,6 +51,8 @@ static inline int snapshot_sequence_number_bytes_required( uint64_t sequence )
     return 8 - i;
 }
 
+#define SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES ( 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES + 1 + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES )
+
 struct snapshot_connection_request_packet_t
 {
     uint8_t packet_type;
@@ -53,6 +60,7 @@ struct snapshot_connection_request_packet_t
     uint64_t protocol_id;
     uint64_t connect_token_expire_timestamp;
     uint8_t connect_token_nonce[SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES];
+    uint8_t cipher_suite;
     uint8_t connect_token_data[SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES];
 };
 
@@ -68,11 +76,18 @@ struct snapshot_connection_challenge_packet_t
     uint8_t challenge_token_data[SNAPSHOT_CHALLENGE_TOKEN_BYTES];
 };
 
+// connection responses are sent in the clear, like connection requests, so a server without an encryption mapping
+// for the client can still read them. the challenge token is sealed by the server and the mac is keyed by the
+// client to server key, so only the client that decrypted the connection challenge can write a valid response
+
+#define SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES ( 1 + 8 + SNAPSHOT_CHALLENGE_TOKEN_BYTES + SNAPSHOT_MAC_BYTES )
+
 struct snapshot_connection_response_packet_t
 {
     uint8_t packet_type;
     uint64_t challenge_token_sequence;
     uint8_t challenge_token_data[SNAPSHOT_CHALLENGE_TOKEN_BYTES];
+    uint8_t mac[SNAPSHOT_MAC_BYTES];
 };
 
 struct snapshot_keep_alive_packet_t
@@ -82,6 +97,9 @@ struct snapshot_keep_alive_packet_t
     int max_clients;
 };
 
+// payload packets are wrapped in place in front of their data, which can start at any byte offset. the struct only
+// gives the layout. read and write them with snapshot_wrap_payload_packet and the snapshot_payload_packet_* functions
+
 struct snapshot_payload_packet_t
 {
     uint8_t packet_type;
@@ -101,20 +119,42 @@ struct snapshot_disconnect_packet_t
     uint8_t packet_type;
 };
 
+struct snapshot_packet_crypto_t
+{
+    uint8_t additional_data[SNAPSHOT_PACKET_ADDITIONAL_DATA_BYTES];
+    uint8_t nonce[SNAPSHOT_PACKET_NONCE_BYTES];
+    uint8_t key[SNAPSHOT_KEY_BYTES];
+};
+
 uint8_t * snapshot_create_packet( void * context, int packet_bytes );
 
+uint8_t * snapshot_create_pooled_packet( void * context, struct snapshot_packet_pool_t * pool, int packet_bytes );
+
 void snapshot_destroy_packet( void * context, uint8_t * packet );
 
-struct snapshot_payload_packet_t * snapshot_wrap_payload_packet( uint8_t * payload_data, int payload_bytes );
+void * snapshot_wrap_payload_packet( uint8_t * payload_data, int payload_bytes );
+
+uint8_t * snapshot_payload_packet_data( void * packet );
+
+int snapshot_payload_packet_bytes( const void * packet );
 
 struct snapshot_passthrough_packet_t * snapshot_wrap_passthrough_packet( uint8_t * passthrough_data, int passthrough_bytes );
 
-uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_length, uint64_t sequence, uint8_t * write_packet_key, uint64_t protocol_id, int * out_bytes );
+int snapshot_packet_encrypt( int cipher_suite, uint8_t * message, uint64_t message_length, uint8_t * additional, uint64_t additional_length, uint8_t * nonce, uint8_t * key );
+
+int snapshot_packet_decrypt( int cipher_suite, uint8_t * message, uint64_t message_length, uint8_t * additional, uint64_t additional_length, uint8_t * nonce, uint8_t * key );
+
+uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_length, uint64_t sequence, uint8_t * write_packet_key, int cipher_suite, uint64_t protocol_id, int * out_bytes );
+
+int snapshot_packet_crypto_setup( uint8_t * packet_data, int packet_bytes, const uint8_t * key, uint64_t protocol_id, int encrypt, struct snapshot_packet_crypto_t * crypto, struct snapshot_crypto_aead_batch_item_t * item );
+
+SNAPSHOT_BOOL snapshot_packet_prefix_valid( const uint8_t * packet_data, int packet_bytes, const uint8_t * allowed_packets );
 
 void * snapshot_read_packet( uint8_t * buffer, 
                              int buffer_length, 
                              uint64_t * sequence, 
                              uint8_t * read_packet_key, 
+                             int cipher_suite, 
                              uint64_t protocol_id, 
                              uint64_t current_timestamp, 
                              uint8_t * private_key, 
@@ -122,6 +162,13 @@ void * snapshot_read_packet( uint8_t * buffer,
                              uint8_t * out_packet_buffer,
                              struct snapshot_replay_protection_t * replay_protection );
 
+int snapshot_open_connection_response_packet( struct snapshot_connection_response_packet_t * packet, 
+                                              const struct snapshot_address_t * from, 
+                                              uint64_t protocol_id, 
+                                              uint64_t current_timestamp, 
+                                              uint8_t * challenge_key, 
+                                              struct snapshot_challenge_token_t * challenge_token );
+
 #if SNAPSHOT_DEVELOPMENT
 
 #include "stdlib.h"
@@ -14,6 +14,8 @@
 #define SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING       0
 #define SNAPSHOT_PLATFORM_SOCKET_BLOCKING           1
 
+#define SNAPSHOT_PLATFORM_SOCKET_REUSE_PORT    ( 1 << 8 )       // or into socket type to share the port across sockets (SO_REUSEPORT)
+
 #define SNAPSHOT_MUTEX_BYTES                      256
 
 struct snapshot_address_t;
@@ -58,10 +60,18 @@ struct snapshot_platform_socket_t * snapshot_platform_socket_create( void * cont
 
 void snapshot_platform_socket_destroy( struct snapshot_platform_socket_t * socket );
 
+SNAPSHOT_BOOL snapshot_platform_socket_enable_gso( struct snapshot_platform_socket_t * socket );
+
+SNAPSHOT_BOOL snapshot_platform_socket_enable_gro( struct snapshot_platform_socket_t * socket );
+
 void snapshot_platform_socket_send_packet( struct snapshot_platform_socket_t * socket, const struct snapshot_address_t * to, const void * packet_data, int packet_bytes );
 
+void snapshot_platform_socket_send_packets( struct snapshot_platform_socket_t * socket, const struct snapshot_address_t * to, uint8_t ** packet_data, int * packet_bytes, int num_packets );
+
 int snapshot_platform_socket_receive_packet( struct snapshot_platform_socket_t * socket, struct snapshot_address_t * from, void * packet_data, int max_packet_size );
 
+int snapshot_platform_socket_receive_packets( struct snapshot_platform_socket_t * socket, struct snapshot_address_t * from, uint8_t ** packet_data, int * packet_bytes, int max_packet_size, int max_packets );
+
 // ----------------------------------------------------------------
 
 struct snapshot_platform_thread_t * snapshot_platform_thread_create( void * context, snapshot_platform_thread_func_t func, void * arg );
@@ -80,6 +90,18 @@ void snapshot_platform_mutex_acquire( struct snapshot_platform_mutex_t * mutex )
 
 void snapshot_platform_mutex_release( struct snapshot_platform_mutex_t * mutex );
 
+// ----------------------------------------------------------------
+
+int snapshot_platform_condition_create( struct snapshot_platform_condition_t * condition );
+
+void snapshot_platform_condition_destroy( struct snapshot_platform_condition_t * condition );
+
+// call with the mutex acquired. it is released while waiting and acquired again before returning. wakeups can be spurious, so wait in a loop on the state the mutex protects
+
+void snapshot_platform_condition_wait( struct snapshot_platform_condition_t * condition, struct snapshot_platform_mutex_t * mutex );
+
+void snapshot_platform_condition_signal( struct snapshot_platform_condition_t * condition );
+
 #ifdef __cplusplus
 
 struct snapshot_platform_mutex_helper_t
@@ -15,10 +15,17 @@
 
 #if SNAPSHOT_PLATFORM == SNAPSHOT_PLATFORM_LINUX
 
+#include "snapshot_address.h"
+
 #include <pthread.h>
 #include <unistd.h>
 #include <sched.h>
 
+#define SNAPSHOT_PLATFORM_MAX_GSO_SEGMENTS                   64
+#define SNAPSHOT_PLATFORM_MAX_GSO_BYTES                   60000
+#define SNAPSHOT_PLATFORM_GRO_BUFFER_BYTES                65536
+#define SNAPSHOT_PLATFORM_GRO_BUFFERS                         8
+
 // -------------------------------------
 
 typedef int snapshot_platform_socket_handle_t;
@@ -28,6 +35,15 @@ struct snapshot_platform_socket_t
     void * context;
     int type;
     snapshot_platform_socket_handle_t handle;
+    SNAPSHOT_BOOL gso;
+    SNAPSHOT_BOOL gro;
+    uint8_t * gro_buffer;
+    int gro_num_buffers;
+    int gro_buffer_index;
+    int gro_buffer_offset;
+    int gro_buffer_bytes[SNAPSHOT_PLATFORM_GRO_BUFFERS];
+    int gro_segment_bytes[SNAPSHOT_PLATFORM_GRO_BUFFERS];
+    struct snapshot_address_t gro_from[SNAPSHOT_PLATFORM_GRO_BUFFERS];
 };
 
 // -------------------------------------
@@ -48,6 +64,44 @@ struct snapshot_platform_mutex_t
 
 // -------------------------------------
 
+struct snapshot_platform_condition_t
+{
+    bool ok;
+    pthread_cond_t handle;
+};
+
+// -------------------------------------
+
+// loads acquire and stores release, so a single writer can publish ring indices without a lock.
+// exchange is sequentially consistent. the 64 bit versions are relaxed and only suit counters
+
+static inline uint32_t snapshot_platform_atomic_load_uint32( const uint32_t * value )
+{
+    return __atomic_load_n( value, __ATOMIC_ACQUIRE );
+}
+
+static inline void snapshot_platform_atomic_store_uint32( uint32_t * value, uint32_t new_value )
+{
+    __atomic_store_n( value, new_value, __ATOMIC_RELEASE );
+}
+
+static inline uint32_t snapshot_platform_atomic_exchange_uint32( uint32_t * value, uint32_t new_value )
+{
+    return __atomic_exchange_n( value, new_value, __ATOMIC_SEQ_CST );
+}
+
+static inline uint64_t snapshot_platform_atomic_load_uint64( const uint64_t * value )
+{
+    return __atomic_load_n( value, __ATOMIC_RELAXED );
+}
+
+static inline void snapshot_platform_atomic_store_uint64( uint64_t * value, uint64_t new_value )
+{
+    __atomic_store_n( value, new_value, __ATOMIC_RELAXED );
+}
+
+// -------------------------------------
+
 #endif // #if SNAPSHOT_PLATFORM == SNAPSHOT_PLATFORM_LINUX
 
 #endif // #ifndef SNAPSHOT_LINUX_H
@@ -46,6 +46,44 @@ struct snapshot_platform_mutex_t
 
 // -------------------------------------
 
+struct snapshot_platform_condition_t
+{
+    SNAPSHOT_BOOL ok;
+    pthread_cond_t handle;
+};
+
+// -------------------------------------
+
+// loads acquire and stores release, so a single writer can publish ring indices without a lock.
+// exchange is sequentially consistent. the 64 bit versions are relaxed and only suit counters
+
+static inline uint32_t snapshot_platform_atomic_load_uint32( const uint32_t * value )
+{
+    return __atomic_load_n( value, __ATOMIC_ACQUIRE );
+}
+
+static inline void snapshot_platform_atomic_store_uint32( uint32_t * value, uint32_t new_value )
+{
+    __atomic_store_n( value, new_value, __ATOMIC_RELEASE );
+}
+
+static inline uint32_t snapshot_platform_atomic_exchange_uint32( uint32_t * value, uint32_t new_value )
+{
+    return __atomic_exchange_n( value, new_value, __ATOMIC_SEQ_CST );
+}
+
+static inline uint64_t snapshot_platform_atomic_load_uint64( const uint64_t * value )
+{
+    return __atomic_load_n( value, __ATOMIC_RELAXED );
+}
+
+static inline void snapshot_platform_atomic_store_uint64( uint64_t * value, uint64_t new_value )
+{
+    __atomic_store_n( value, new_value, __ATOMIC_RELAXED );
+}
+
+// -------------------------------------
+
 #endif // #if SNAPSHOT_PLATFORM == SNAPSHOT_PLATFORM_MAC
 
 #endif // #ifndef SNAPSHOT_PLATFORM_MAC_H
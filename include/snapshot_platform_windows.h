@@ -62,6 +62,56 @@ struct snapshot_platform_mutex_t
 
 // -------------------------------------
 
+struct snapshot_platform_condition_t
+{
+    bool ok;
+    CONDITION_VARIABLE handle;
+};
+
+// -------------------------------------
+
+// loads acquire and stores release, so a single writer can publish ring indices without a lock. msvc gives volatile
+// accesses these semantics on x86 and x64, and the compiler barrier keeps it from moving other accesses across them.
+// exchange is sequentially consistent. the 64 bit versions are relaxed and only suit counters
+
+static inline uint32_t snapshot_platform_atomic_load_uint32( const uint32_t * value )
+{
+    const uint32_t result = *( (volatile const uint32_t*) value );
+    _ReadWriteBarrier();
+    return result;
+}
+
+static inline void snapshot_platform_atomic_store_uint32( uint32_t * value, uint32_t new_value )
+{
+    _ReadWriteBarrier();
+    *( (volatile uint32_t*) value ) = new_value;
+}
+
+static inline uint32_t snapshot_platform_atomic_exchange_uint32( uint32_t * value, uint32_t new_value )
+{
+    return (uint32_t) InterlockedExchange( (volatile LONG*) value, (LONG) new_value );
+}
+
+static inline uint64_t snapshot_platform_atomic_load_uint64( const uint64_t * value )
+{
+#if _WIN64
+    return *( (volatile const uint64_t*) value );
+#else // #if _WIN64
+    return (uint64_t) InterlockedCompareExchange64( (volatile LONG64*) value, 0, 0 );
+#endif // #if _WIN64
+}
+
+static inline void snapshot_platform_atomic_store_uint64( uint64_t * value, uint64_t new_value )
+{
+#if _WIN64
+    *( (volatile uint64_t*) value ) = new_value;
+#else // #if _WIN64
+    InterlockedExchange64( (volatile LONG64*) value, (LONG64) new_value );
+#endif // #if _WIN64
+}
+
+// -------------------------------------
+
 #if SNAPSHOT_UNREAL_ENGINE
 #include "Windows/PostWindowsApi.h"
 #include "Windows/HideWindowsPlatformTypes.h"
@@ -0,0 +1,75 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+
+#ifndef SNAPSHOT_RANGE_CODER_H
+#define SNAPSHOT_RANGE_CODER_H
+
+#include "snapshot.h"
+
+#define SNAPSHOT_RANGE_CODER_NONE                                           0
+#define SNAPSHOT_RANGE_CODER_STATIC                                         1
+#define SNAPSHOT_RANGE_CODER_ADAPTIVE                                       2
+
+#define SNAPSHOT_RANGE_MODEL_PROBABILITY_BITS                              11
+#define SNAPSHOT_RANGE_MODEL_ADAPT_SHIFT                                    5
+
+// entropy coding of payloads with an adaptive binary range coder.
+//
+// each byte is coded as eight binary decisions down a bit tree, so the model is 256 probabilities, and every
+// decision moves its probability a little towards what was seen. a packet always starts from a model both sides
+// already agree on and adapts as it goes:
+//
+//  * static: every packet starts from the same shared model, for example one trained on recorded payloads.
+//  * adaptive: every packet starts from the model left at the end of the newest packet the other side acked.
+//
+// models only carry over through acked packets, so packet loss never leaves the two sides with different models.
+// the encoder and decoder keep the end of packet model for each sequence in a history, the same way the delta
+// encoder keeps snapshots, and the encoder names the packet it started from in the header. if coding does not
+// save anything the bytes are sent as they are, and the model still adapts over them on both sides.
+
+struct snapshot_range_model_t
+{
+    uint16_t probabilities[256];
+};
+
+void snapshot_range_model_init( struct snapshot_range_model_t * model );
+
+void snapshot_range_model_train( struct snapshot_range_model_t * model, const uint8_t * data, int bytes );
+
+struct snapshot_range_encoder_t;
+
+struct snapshot_range_decoder_t;
+
+int snapshot_range_coder_max_bytes( int bytes );
+
+struct snapshot_range_encoder_t * snapshot_range_encoder_create( void * context, int max_bytes, int mode, const struct snapshot_range_model_t * static_model, int history_size );
+
+void snapshot_range_encoder_destroy( struct snapshot_range_encoder_t * encoder );
+
+void snapshot_range_encoder_reset( struct snapshot_range_encoder_t * encoder );
+
+size_t snapshot_range_encoder_memory_bytes( const struct snapshot_range_encoder_t * encoder );
+
+void snapshot_range_encoder_process_acks( struct snapshot_range_encoder_t * encoder, const uint16_t * acks, int num_acks );
+
+const uint8_t * snapshot_range_encoder_write( struct snapshot_range_encoder_t * encoder, uint16_t sequence, const uint8_t * data, int bytes, int * out_bytes );
+
+struct snapshot_range_decoder_t * snapshot_range_decoder_create( void * context, int max_bytes, int mode, const struct snapshot_range_model_t * static_model, int history_size );
+
+void snapshot_range_decoder_destroy( struct snapshot_range_decoder_t * decoder );
+
+void snapshot_range_decoder_reset( struct snapshot_range_decoder_t * decoder );
+
+size_t snapshot_range_decoder_memory_bytes( const struct snapshot_range_decoder_t * decoder );
+
+const uint8_t * snapshot_range_decoder_read( struct snapshot_range_decoder_t * decoder, uint16_t sequence, const uint8_t * data, int bytes, int * out_bytes );
+
+#endif // #ifndef SNAPSHOT_RANGE_CODER_H
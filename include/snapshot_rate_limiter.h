@@ -0,0 +1,50 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#ifndef SNAPSHOT_RATE_LIMITER_H
+#define SNAPSHOT_RATE_LIMITER_H
+
+#include "snapshot.h"
+#include "snapshot_address.h"
+
+#define SNAPSHOT_RATE_LIMITER_MAX_PROBES 8
+
+// a token bucket per source ip, ignoring the port, held in a fixed size open addressing table. lookups probe at most
+// SNAPSHOT_RATE_LIMITER_MAX_PROBES slots from the home slot. when none of them match and none are free, the bucket
+// seen least recently is taken over, so the table never grows and a flood of spoofed addresses costs a bounded amount.
+
+struct snapshot_rate_limiter_entry_t
+{
+    struct snapshot_address_t address;
+    double tokens;
+    double last_time;
+};
+
+struct snapshot_rate_limiter_t
+{
+    void * context;
+    int num_slots;
+    int num_entries;
+    double packets_per_second;
+    double burst;
+    struct snapshot_rate_limiter_entry_t * entries;
+};
+
+struct snapshot_rate_limiter_t * snapshot_rate_limiter_create( void * context, int max_entries, double packets_per_second, double burst );
+
+void snapshot_rate_limiter_destroy( struct snapshot_rate_limiter_t * limiter );
+
+size_t snapshot_rate_limiter_memory_bytes( const struct snapshot_rate_limiter_t * limiter );
+
+void snapshot_rate_limiter_reset( struct snapshot_rate_limiter_t * limiter );
+
+SNAPSHOT_BOOL snapshot_rate_limiter_allow( struct snapshot_rate_limiter_t * limiter, const struct snapshot_address_t * address, double time );
+
+#endif // #ifndef SNAPSHOT_RATE_LIMITER_H
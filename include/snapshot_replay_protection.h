@@ -15,32 +15,89 @@
 
 #define SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE 256
 
+#define SNAPSHOT_REPLAY_PROTECTION_DEFAULT_WINDOW_BITS 1024
+
+#define SNAPSHOT_REPLAY_PROTECTION_MAX_BYTES ( sizeof( struct snapshot_replay_protection_t ) + SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE * sizeof( uint64_t ) )
+
+// replay protection runs in one of two modes, picked by window bits when it is initialized:
+//
+//  * SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE keeps the most recent sequence seen in each of 256 slots (2KB).
+//
+//  * 1024 or 2048 keeps one bit per sequence in a ring of 64 bit words. the ring advances a word at a time,
+//    so packets reordered up to window bits - 64 behind the most recent are always accepted once, and the
+//    whole window is 128 or 256 bytes.
+//
+// the words follow the struct in memory, so allocate snapshot_replay_protection_bytes( window_bits ) for each one.
+
 struct snapshot_replay_protection_t
 {
     uint64_t most_recent_sequence;
-    uint64_t received_packet[SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE];
+    int window_bits;
+    int window_words;
 };
 
+static inline SNAPSHOT_BOOL snapshot_replay_protection_valid_window_bits( int window_bits )
+{
+    return ( window_bits == SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE || window_bits == 1024 || window_bits == 2048 ) ? SNAPSHOT_TRUE : SNAPSHOT_FALSE;
+}
+
+static inline size_t snapshot_replay_protection_bytes( int window_bits )
+{
+    snapshot_assert( snapshot_replay_protection_valid_window_bits( window_bits ) );
+    const int window_words = ( window_bits == SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE ) ? SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE : window_bits / 64;
+    return sizeof( struct snapshot_replay_protection_t ) + window_words * sizeof( uint64_t );
+}
+
+static inline uint64_t * snapshot_replay_protection_words( struct snapshot_replay_protection_t * replay_protection )
+{
+    return (uint64_t*) ( replay_protection + 1 );
+}
+
 static inline void snapshot_replay_protection_reset( struct snapshot_replay_protection_t * replay_protection )
 {
     snapshot_assert( replay_protection );
     replay_protection->most_recent_sequence = 0;
-    memset( replay_protection->received_packet, 0xFF, sizeof( replay_protection->received_packet ) );
+    const int value = ( replay_protection->window_bits == SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE ) ? 0xFF : 0;
+    memset( snapshot_replay_protection_words( replay_protection ), value, replay_protection->window_words * sizeof( uint64_t ) );
+}
+
+static inline void snapshot_replay_protection_init( struct snapshot_replay_protection_t * replay_protection, int window_bits )
+{
+    snapshot_assert( replay_protection );
+    snapshot_assert( snapshot_replay_protection_valid_window_bits( window_bits ) );
+    replay_protection->window_bits = window_bits;
+    replay_protection->window_words = ( window_bits == SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE ) ? SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE : window_bits / 64;
+    snapshot_replay_protection_reset( replay_protection );
 }
 
 static inline int snapshot_replay_protection_already_received( struct snapshot_replay_protection_t * replay_protection, uint64_t sequence )
 {
     snapshot_assert( replay_protection );
 
+    const uint64_t * words = snapshot_replay_protection_words( replay_protection );
+
+    if ( replay_protection->window_bits != SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE )
+    {
+        if ( sequence > replay_protection->most_recent_sequence )
+            return 0;
+
+        if ( ( replay_protection->most_recent_sequence >> 6 ) - ( sequence >> 6 ) >= (uint64_t) replay_protection->window_words )
+            return 1;
+
+        const uint64_t word = words[( sequence >> 6 ) & ( replay_protection->window_words - 1 )];
+
+        return (int) ( ( word >> ( sequence & 63 ) ) & 1 );
+    }
+
     if ( sequence + SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE <= replay_protection->most_recent_sequence )
         return 1;
     
     int index = (int) ( sequence % SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE );
 
-    if ( replay_protection->received_packet[index] == UINT64_MAX )
+    if ( words[index] == UINT64_MAX )
         return 0;
 
-    if ( replay_protection->received_packet[index] >= sequence )
+    if ( words[index] >= sequence )
         return 1;
 
     return 0;
@@ -50,12 +107,45 @@ static inline void snapshot_replay_protection_advance_sequence( struct snapshot_
 {
     snapshot_assert( replay_protection );
 
+    uint64_t * words = snapshot_replay_protection_words( replay_protection );
+
+    if ( replay_protection->window_bits != SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE )
+    {
+        const uint64_t word_mask = (uint64_t) ( replay_protection->window_words - 1 );
+
+        if ( sequence > replay_protection->most_recent_sequence )
+        {
+            // clear the words the window slides onto
+
+            const uint64_t most_recent_word = replay_protection->most_recent_sequence >> 6;
+            const uint64_t word_advance = ( sequence >> 6 ) - most_recent_word;
+
+            if ( word_advance >= (uint64_t) replay_protection->window_words )
+            {
+                memset( words, 0, replay_protection->window_words * sizeof( uint64_t ) );
+            }
+            else
+            {
+                for ( uint64_t i = 1; i <= word_advance; ++i )
+                {
+                    words[( most_recent_word + i ) & word_mask] = 0;
+                }
+            }
+
+            replay_protection->most_recent_sequence = sequence;
+        }
+
+        words[( sequence >> 6 ) & word_mask] |= 1ULL << ( sequence & 63 );
+
+        return;
+    }
+
     if ( sequence > replay_protection->most_recent_sequence )
         replay_protection->most_recent_sequence = sequence;
 
     int index = (int) ( sequence % SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE );
 
-    replay_protection->received_packet[index] = sequence;
+    words[index] = sequence;
 }
 
 #endif // #ifndef SNAPSHOT_REPLAY_PROTECTION_H
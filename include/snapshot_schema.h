@@ -0,0 +1,352 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+
+#ifndef SNAPSHOT_SCHEMA_H
+#define SNAPSHOT_SCHEMA_H
+
+#include "snapshot.h"
+#include "snapshot_read_write.h"
+#include <math.h>
+
+// schema driven serialization. a schema is an x-macro listing fields, each with a kind, a name and its parameters:
+//
+//     #define PLAYER_SCHEMA( FIELD, OPTIONAL )
+//         FIELD( INT, health, ( 0, 100 ) )
+//         FIELD( FLOAT, position_x, ( -1000.0f, 1000.0f, 0.01f ) )
+//         FIELD( QUATERNION, orientation, ( 9 ) )
+//         FIELD( BOOL, crouching, () )
+//         OPTIONAL( INT, weapon, ( 0, 15 ) )
+//
+//     SNAPSHOT_SCHEMA_STRUCT( player, PLAYER_SCHEMA )
+//     SNAPSHOT_SCHEMA_FUNCTIONS( player, PLAYER_SCHEMA )
+//
+// which declares struct player_t, player_max_bits, player_max_bytes and player_buffer_bytes, and player_write and
+// player_read.
+//
+//  * INT( min, max ) is an int32_t sent in the bits needed for max - min.
+//  * FLOAT( min, max, resolution ) is a float clamped to [min,max] and quantized to resolution.
+//  * QUATERNION( bits ) is a float[4] unit quaternion sent as the smallest three components with bits each.
+//  * BOOL() is a single bit.
+//  * OPTIONAL fields add a has_<name> member and cost one bit when absent.
+//
+// every bit width is a compile time constant, and the writer and reader are local to the generated functions,
+// so once they are inlined the compiler knows where each word boundary falls and emits straight line stores
+// and loads with no per field bit bookkeeping. only optional fields introduce a branch.
+//
+// write needs a buffer of at least <name>_max_bytes, for example an endpoint payload buffer, and returns the bytes
+// written, or SNAPSHOT_ERROR without writing anything if the buffer is smaller, so it never writes past the buffer
+// size given. <name>_buffer_bytes is <name>_max_bytes rounded up to whole words, and is the size to use for a local
+// buffer. read checks every value is in range and never reads past the bytes given, and returns SNAPSHOT_OK or
+// SNAPSHOT_ERROR.
+
+// -------------------------------------------------------------------------------------------------------------------------
+
+#define SNAPSHOT_SCHEMA_BITS_REQUIRED( range )                                                                          \
+    ( (uint32_t)(range) == 0 ? 0 :                                                                                      \
+      (uint32_t)(range) < 0x2 ? 1 : (uint32_t)(range) < 0x4 ? 2 : (uint32_t)(range) < 0x8 ? 3 :                        \
+      (uint32_t)(range) < 0x10 ? 4 : (uint32_t)(range) < 0x20 ? 5 : (uint32_t)(range) < 0x40 ? 6 :                     \
+      (uint32_t)(range) < 0x80 ? 7 : (uint32_t)(range) < 0x100 ? 8 : (uint32_t)(range) < 0x200 ? 9 :                   \
+      (uint32_t)(range) < 0x400 ? 10 : (uint32_t)(range) < 0x800 ? 11 : (uint32_t)(range) < 0x1000 ? 12 :               \
+      (uint32_t)(range) < 0x2000 ? 13 : (uint32_t)(range) < 0x4000 ? 14 : (uint32_t)(range) < 0x8000 ? 15 :             \
+      (uint32_t)(range) < 0x10000 ? 16 : (uint32_t)(range) < 0x20000 ? 17 : (uint32_t)(range) < 0x40000 ? 18 :          \
+      (uint32_t)(range) < 0x80000 ? 19 : (uint32_t)(range) < 0x100000 ? 20 : (uint32_t)(range) < 0x200000 ? 21 :        \
+      (uint32_t)(range) < 0x400000 ? 22 : (uint32_t)(range) < 0x800000 ? 23 : (uint32_t)(range) < 0x1000000 ? 24 :      \
+      (uint32_t)(range) < 0x2000000 ? 25 : (uint32_t)(range) < 0x4000000 ? 26 : (uint32_t)(range) < 0x8000000 ? 27 :    \
+      (uint32_t)(range) < 0x10000000 ? 28 : (uint32_t)(range) < 0x20000000 ? 29 : (uint32_t)(range) < 0x40000000 ? 30 : \
+      (uint32_t)(range) < 0x80000000 ? 31 : 32 )
+
+#define SNAPSHOT_SCHEMA_FLOAT_STEPS( min, max, resolution ) ( (uint32_t) ( ( (max) - (min) ) / (resolution) + 0.5f ) )
+
+#define SNAPSHOT_SCHEMA_QUATERNION_MIN_COMPONENT                              -0.707107f
+#define SNAPSHOT_SCHEMA_QUATERNION_MAX_COMPONENT                               0.707107f
+
+// -------------------------------------------------------------------------------------------------------------------------
+
+struct snapshot_schema_writer_t
+{
+    uint8_t * data;
+    uint64_t scratch;
+    int scratch_bits;
+    int bytes_written;
+    int data_bytes;
+};
+
+static inline void snapshot_schema_writer_init( struct snapshot_schema_writer_t * writer, uint8_t * data, int data_bytes )
+{
+    writer->data = data;
+    writer->data_bytes = data_bytes;
+    writer->scratch = 0;
+    writer->scratch_bits = 0;
+    writer->bytes_written = 0;
+}
+
+static inline void snapshot_schema_write_bits( struct snapshot_schema_writer_t * writer, uint32_t value, int bits )
+{
+    snapshot_assert( bits >= 0 );
+    snapshot_assert( bits <= 32 );
+    snapshot_assert( (uint64_t) value <= ( ( 1ULL << bits ) - 1 ) );
+
+    writer->scratch |= (uint64_t) value << writer->scratch_bits;
+    writer->scratch_bits += bits;
+
+    if ( writer->scratch_bits >= 32 )
+    {
+        snapshot_assert( writer->bytes_written + 4 <= writer->data_bytes );
+        uint8_t * p = writer->data + writer->bytes_written;
+        snapshot_write_uint32( &p, (uint32_t) writer->scratch );
+        writer->bytes_written += 4;
+        writer->scratch >>= 32;
+        writer->scratch_bits -= 32;
+    }
+}
+
+static inline int snapshot_schema_writer_finish( struct snapshot_schema_writer_t * writer )
+{
+    snapshot_assert( writer->bytes_written + ( writer->scratch_bits + 7 ) / 8 <= writer->data_bytes );
+    uint8_t * p = writer->data + writer->bytes_written;
+    uint8_t * end = writer->data + writer->data_bytes;
+    uint64_t scratch = writer->scratch;
+    for ( int bits = writer->scratch_bits; bits > 0 && p < end; bits -= 8 )
+    {
+        snapshot_write_uint8( &p, (uint8_t) scratch );
+        scratch >>= 8;
+    }
+    return (int) ( p - writer->data );
+}
+
+struct snapshot_schema_reader_t
+{
+    const uint8_t * data;
+    uint64_t scratch;
+    int scratch_bits;
+    int bytes_read;
+};
+
+static inline void snapshot_schema_reader_init( struct snapshot_schema_reader_t * reader, const uint8_t * data )
+{
+    reader->data = data;
+    reader->scratch = 0;
+    reader->scratch_bits = 0;
+    reader->bytes_read = 0;
+}
+
+static inline uint32_t snapshot_schema_read_bits( struct snapshot_schema_reader_t * reader, int bits )
+{
+    snapshot_assert( bits >= 0 );
+    snapshot_assert( bits <= 32 );
+
+    if ( reader->scratch_bits < bits )
+    {
+        const uint8_t * p = reader->data + reader->bytes_read;
+        reader->scratch |= (uint64_t) snapshot_read_uint32( &p ) << reader->scratch_bits;
+        reader->scratch_bits += 32;
+        reader->bytes_read += 4;
+    }
+
+    const uint32_t value = (uint32_t) ( reader->scratch & ( ( 1ULL << bits ) - 1 ) );
+    reader->scratch >>= bits;
+    reader->scratch_bits -= bits;
+    return value;
+}
+
+static inline int snapshot_schema_reader_bits_read( const struct snapshot_schema_reader_t * reader )
+{
+    return reader->bytes_read * 8 - reader->scratch_bits;
+}
+
+// -------------------------------------------------------------------------------------------------------------------------
+
+static inline uint32_t snapshot_schema_quantize_float( float value, float min, float max, float resolution, uint32_t steps )
+{
+    value = ( value < min ) ? min : value;
+    value = ( value > max ) ? max : value;
+    const uint32_t integer = (uint32_t) ( ( value - min ) / resolution + 0.5f );
+    return ( integer > steps ) ? steps : integer;
+}
+
+static inline void snapshot_schema_write_quaternion( struct snapshot_schema_writer_t * writer, const float * q, int bits )
+{
+    // smallest three: drop the largest component and negate the quaternion so it is positive, which leaves it
+    // recoverable from the other three. the other three are then all within +/- 1/sqrt(2)
+
+    int largest = 0;
+    float largest_abs = fabsf( q[0] );
+    for ( int i = 1; i < 4; i++ )
+    {
+        const float a = fabsf( q[i] );
+        largest = ( a > largest_abs ) ? i : largest;
+        largest_abs = ( a > largest_abs ) ? a : largest_abs;
+    }
+
+    const float sign = ( q[largest] < 0.0f ) ? -1.0f : 1.0f;
+
+    const uint32_t steps = ( 1U << bits ) - 1;
+    const float resolution = ( SNAPSHOT_SCHEMA_QUATERNION_MAX_COMPONENT - SNAPSHOT_SCHEMA_QUATERNION_MIN_COMPONENT ) / steps;
+
+    snapshot_schema_write_bits( writer, (uint32_t) largest, 2 );
+
+    for ( int i = 0; i < 4; i++ )
+    {
+        if ( i == largest )
+            continue;
+        snapshot_schema_write_bits( writer, snapshot_schema_quantize_float( q[i] * sign, SNAPSHOT_SCHEMA_QUATERNION_MIN_COMPONENT, SNAPSHOT_SCHEMA_QUATERNION_MAX_COMPONENT, resolution, steps ), bits );
+    }
+}
+
+static inline void snapshot_schema_read_quaternion( struct snapshot_schema_reader_t * reader, float * q, int bits )
+{
+    const uint32_t steps = ( 1U << bits ) - 1;
+    const float resolution = ( SNAPSHOT_SCHEMA_QUATERNION_MAX_COMPONENT - SNAPSHOT_SCHEMA_QUATERNION_MIN_COMPONENT ) / steps;
+
+    const int largest = (int) snapshot_schema_read_bits( reader, 2 );
+
+    float sum = 0.0f;
+    for ( int i = 0; i < 4; i++ )
+    {
+        if ( i == largest )
+            continue;
+        q[i] = SNAPSHOT_SCHEMA_QUATERNION_MIN_COMPONENT + snapshot_schema_read_bits( reader, bits ) * resolution;
+        sum += q[i] * q[i];
+    }
+
+    q[largest] = sqrtf( ( sum < 1.0f ) ? ( 1.0f - sum ) : 0.0f );
+}
+
+// -------------------------------------------------------------------------------------------------------------------------
+
+#define SNAPSHOT_SCHEMA_UNPACK( ... ) __VA_ARGS__
+
+#define SNAPSHOT_SCHEMA_APPLY( macro, ... ) macro( __VA_ARGS__ )
+
+// members
+
+#define SNAPSHOT_SCHEMA_MEMBER_INT( name, ... ) int32_t name;
+#define SNAPSHOT_SCHEMA_MEMBER_FLOAT( name, ... ) float name;
+#define SNAPSHOT_SCHEMA_MEMBER_QUATERNION( name, ... ) float name[4];
+#define SNAPSHOT_SCHEMA_MEMBER_BOOL( name, ... ) SNAPSHOT_BOOL name;
+
+#define SNAPSHOT_SCHEMA_MEMBER( kind, name, args ) SNAPSHOT_SCHEMA_APPLY( SNAPSHOT_SCHEMA_MEMBER_##kind, name, SNAPSHOT_SCHEMA_UNPACK args )
+#define SNAPSHOT_SCHEMA_OPTIONAL_MEMBER( kind, name, args ) SNAPSHOT_BOOL has_##name; SNAPSHOT_SCHEMA_MEMBER( kind, name, args )
+
+// bits
+
+#define SNAPSHOT_SCHEMA_BITS_INT( name, min, max ) SNAPSHOT_SCHEMA_BITS_REQUIRED( (int64_t)(max) - (int64_t)(min) )
+#define SNAPSHOT_SCHEMA_BITS_FLOAT( name, min, max, resolution ) SNAPSHOT_SCHEMA_BITS_REQUIRED( SNAPSHOT_SCHEMA_FLOAT_STEPS( min, max, resolution ) )
+#define SNAPSHOT_SCHEMA_BITS_QUATERNION( name, bits ) ( 2 + 3 * (bits) )
+#define SNAPSHOT_SCHEMA_BITS_BOOL( name, ... ) 1
+
+#define SNAPSHOT_SCHEMA_BITS( kind, name, args ) SNAPSHOT_SCHEMA_APPLY( SNAPSHOT_SCHEMA_BITS_##kind, name, SNAPSHOT_SCHEMA_UNPACK args )
+#define SNAPSHOT_SCHEMA_FIELD_BITS( kind, name, args ) + SNAPSHOT_SCHEMA_BITS( kind, name, args )
+#define SNAPSHOT_SCHEMA_OPTIONAL_BITS( kind, name, args ) + 1 + SNAPSHOT_SCHEMA_BITS( kind, name, args )
+
+// write
+
+#define SNAPSHOT_SCHEMA_WRITE_INT( name, min, max )                                                                     \
+    snapshot_assert( object->name >= (min) && object->name <= (max) );                                                  \
+    snapshot_schema_write_bits( &writer, (uint32_t) ( (int64_t) object->name - (int64_t)(min) ), SNAPSHOT_SCHEMA_BITS_INT( name, min, max ) );
+
+#define SNAPSHOT_SCHEMA_WRITE_FLOAT( name, min, max, resolution )                                                       \
+    snapshot_schema_write_bits( &writer, snapshot_schema_quantize_float( object->name, (min), (max), (resolution), SNAPSHOT_SCHEMA_FLOAT_STEPS( min, max, resolution ) ), SNAPSHOT_SCHEMA_BITS_FLOAT( name, min, max, resolution ) );
+
+#define SNAPSHOT_SCHEMA_WRITE_QUATERNION( name, bits )                                                                  \
+    snapshot_schema_write_quaternion( &writer, object->name, (bits) );
+
+#define SNAPSHOT_SCHEMA_WRITE_BOOL( name, ... )                                                                         \
+    snapshot_schema_write_bits( &writer, object->name ? 1 : 0, 1 );
+
+#define SNAPSHOT_SCHEMA_WRITE( kind, name, args ) SNAPSHOT_SCHEMA_APPLY( SNAPSHOT_SCHEMA_WRITE_##kind, name, SNAPSHOT_SCHEMA_UNPACK args )
+
+#define SNAPSHOT_SCHEMA_OPTIONAL_WRITE( kind, name, args )                                                              \
+    snapshot_schema_write_bits( &writer, object->has_##name ? 1 : 0, 1 );                                               \
+    if ( object->has_##name )                                                                                           \
+    {                                                                                                                   \
+        SNAPSHOT_SCHEMA_WRITE( kind, name, args )                                                                       \
+    }
+
+// read
+
+#define SNAPSHOT_SCHEMA_READ_INT( name, min, max )                                                                      \
+    {                                                                                                                   \
+        const uint32_t value = snapshot_schema_read_bits( &reader, SNAPSHOT_SCHEMA_BITS_INT( name, min, max ) );        \
+        error |= ( value > (uint32_t) ( (int64_t)(max) - (int64_t)(min) ) );                                            \
+        object->name = (int32_t) ( (int64_t) value + (int64_t)(min) );                                                  \
+    }
+
+#define SNAPSHOT_SCHEMA_READ_FLOAT( name, min, max, resolution )                                                        \
+    {                                                                                                                   \
+        const uint32_t value = snapshot_schema_read_bits( &reader, SNAPSHOT_SCHEMA_BITS_FLOAT( name, min, max, resolution ) ); \
+        error |= ( value > SNAPSHOT_SCHEMA_FLOAT_STEPS( min, max, resolution ) );                                       \
+        object->name = (min) + value * (resolution);                                                                    \
+    }
+
+#define SNAPSHOT_SCHEMA_READ_QUATERNION( name, bits )                                                                   \
+    snapshot_schema_read_quaternion( &reader, object->name, (bits) );
+
+#define SNAPSHOT_SCHEMA_READ_BOOL( name, ... )                                                                          \
+    object->name = (SNAPSHOT_BOOL) snapshot_schema_read_bits( &reader, 1 );
+
+#define SNAPSHOT_SCHEMA_READ( kind, name, args ) SNAPSHOT_SCHEMA_APPLY( SNAPSHOT_SCHEMA_READ_##kind, name, SNAPSHOT_SCHEMA_UNPACK args )
+
+#define SNAPSHOT_SCHEMA_OPTIONAL_READ( kind, name, args )                                                               \
+    object->has_##name = (SNAPSHOT_BOOL) snapshot_schema_read_bits( &reader, 1 );                                       \
+    if ( object->has_##name )                                                                                           \
+    {                                                                                                                   \
+        SNAPSHOT_SCHEMA_READ( kind, name, args )                                                                        \
+    }
+
+// generators
+
+#define SNAPSHOT_SCHEMA_STRUCT( name, schema )                                                                          \
+    struct name##_t                                                                                                     \
+    {                                                                                                                   \
+        schema( SNAPSHOT_SCHEMA_MEMBER, SNAPSHOT_SCHEMA_OPTIONAL_MEMBER )                                               \
+    };
+
+#define SNAPSHOT_SCHEMA_FUNCTIONS( name, schema )                                                                       \
+                                                                                                                        \
+    enum                                                                                                                \
+    {                                                                                                                   \
+        name##_max_bits = 0 schema( SNAPSHOT_SCHEMA_FIELD_BITS, SNAPSHOT_SCHEMA_OPTIONAL_BITS ),                        \
+        name##_max_bytes = ( name##_max_bits + 7 ) / 8,                                                                 \
+        name##_buffer_bytes = ( ( name##_max_bytes + 3 ) / 4 ) * 4                                                      \
+    };                                                                                                                  \
+                                                                                                                        \
+    static inline int name##_write( const struct name##_t * object, uint8_t * buffer, int buffer_bytes )                \
+    {                                                                                                                   \
+        snapshot_assert( object );                                                                                      \
+        snapshot_assert( buffer );                                                                                      \
+        if ( buffer_bytes < name##_max_bytes )                                                                          \
+            return SNAPSHOT_ERROR;                                                                                      \
+        struct snapshot_schema_writer_t writer;                                                                         \
+        snapshot_schema_writer_init( &writer, buffer, buffer_bytes );                                                   \
+        schema( SNAPSHOT_SCHEMA_WRITE, SNAPSHOT_SCHEMA_OPTIONAL_WRITE )                                                 \
+        return snapshot_schema_writer_finish( &writer );                                                                \
+    }                                                                                                                   \
+                                                                                                                        \
+    static inline int name##_read( struct name##_t * object, const uint8_t * buffer, int buffer_bytes )                 \
+    {                                                                                                                   \
+        snapshot_assert( object );                                                                                      \
+        snapshot_assert( buffer );                                                                                      \
+        if ( buffer_bytes < 0 || buffer_bytes > name##_max_bytes )                                                      \
+            return SNAPSHOT_ERROR;                                                                                      \
+        /* read from a zero padded copy, so whole words can be loaded without checking the length on every read */     \
+        uint8_t data[( ( name##_max_bytes + 3 ) / 4 + 1 ) * 4];                                                         \
+        memcpy( data, buffer, buffer_bytes );                                                                           \
+        memset( data + buffer_bytes, 0, sizeof(data) - buffer_bytes );                                                 \
+        struct snapshot_schema_reader_t reader;                                                                         \
+        snapshot_schema_reader_init( &reader, data );                                                                   \
+        uint32_t error = 0;                                                                                             \
+        schema( SNAPSHOT_SCHEMA_READ, SNAPSHOT_SCHEMA_OPTIONAL_READ )                                                   \
+        error |= ( snapshot_schema_reader_bits_read( &reader ) > buffer_bytes * 8 );                                    \
+        return error ? SNAPSHOT_ERROR : SNAPSHOT_OK;                                                                    \
+    }
+
+#endif // #ifndef SNAPSHOT_SCHEMA_H
@@ -43,18 +43,55 @@
 #define SNAPSHOT_SERVER_COUNTER_PACKETS_SENT                                        24
 #define SNAPSHOT_SERVER_COUNTER_PACKETS_SENT_LOOPBACK                               25
 #define SNAPSHOT_SERVER_COUNTER_PACKETS_SENT_SIMULATOR                              26
-
-#define SNAPSHOT_SERVER_NUM_COUNTERS                                                27
+#define SNAPSHOT_SERVER_COUNTER_SEND_BATCHES                                        27
+#define SNAPSHOT_SERVER_COUNTER_IO_RECEIVE_QUEUE_DEPTH                              28
+#define SNAPSHOT_SERVER_COUNTER_IO_SEND_QUEUE_DEPTH                                 29
+#define SNAPSHOT_SERVER_COUNTER_IO_RECEIVE_QUEUE_DROPS                              30
+#define SNAPSHOT_SERVER_COUNTER_IO_SEND_QUEUE_DROPS                                 31
+#define SNAPSHOT_SERVER_COUNTER_PACKETS_DECRYPTED_BATCH                             32
+#define SNAPSHOT_SERVER_COUNTER_PACKETS_ENCRYPTED_BATCH                             33
+#define SNAPSHOT_SERVER_COUNTER_CRYPTO_ISA                                          34
+#define SNAPSHOT_SERVER_COUNTER_HANDSHAKE_QUEUE_DEPTH                               35
+#define SNAPSHOT_SERVER_COUNTER_HANDSHAKE_QUEUE_DROPS                               36
+#define SNAPSHOT_SERVER_COUNTER_HANDSHAKE_JOBS_FAILED                               37
+#define SNAPSHOT_SERVER_COUNTER_ENCRYPTION_MAPPINGS_ADDED                           38
+#define SNAPSHOT_SERVER_COUNTER_PACKETS_DROPPED_INVALID                             39
+#define SNAPSHOT_SERVER_COUNTER_PACKETS_DROPPED_RATE_LIMITED                        40
+#define SNAPSHOT_SERVER_COUNTER_SNAPSHOT_KEYFRAMES_SENT                             41
+#define SNAPSHOT_SERVER_COUNTER_SNAPSHOT_DELTAS_SENT                                42
+#define SNAPSHOT_SERVER_COUNTER_SNAPSHOT_RANGE_CODER_BYTES_SAVED                    43
+
+#define SNAPSHOT_SERVER_NUM_COUNTERS                                                44
+
+#define SNAPSHOT_SERVER_MAX_SHARDS                                                  64
 
 struct snapshot_address_t;
+struct snapshot_range_model_t;
 
 struct snapshot_server_config_t
 {
     void * context;
     int max_clients;
+    int num_shards;
     uint64_t protocol_id;
     uint8_t private_key[SNAPSHOT_KEY_BYTES];
     struct snapshot_network_simulator_t * network_simulator;
+    SNAPSHOT_BOOL enable_gso;
+    SNAPSHOT_BOOL enable_gro;
+    SNAPSHOT_BOOL reuse_port;
+    SNAPSHOT_BOOL io_thread;
+    SNAPSHOT_BOOL packet_pool;
+    int handshake_threads;
+    int max_connect_token_entries;
+    SNAPSHOT_BOOL stateless_handshake;
+    int rate_limit_packets_per_second;
+    int rate_limit_burst;
+    int ack_bits;
+    int replay_protection_window_bits;
+    int snapshot_bytes;
+    int snapshot_history;
+    int snapshot_range_coder;
+    const struct snapshot_range_model_t * snapshot_range_model;
     void (*connect_disconnect_callback)(void*,int,int);
     void (*send_loopback_packet_callback)(void*,const struct snapshot_address_t*,uint8_t*,int);
     void (*process_passthrough_callback)(void*,const struct snapshot_address_t*,int,const uint8_t*,int);
@@ -62,6 +99,11 @@ struct snapshot_server_config_t
 
 void snapshot_default_server_config( struct snapshot_server_config_t * config );
 
+// with num_shards > 1 the server splits its client slots across shards bound to the same port with SO_REUSEPORT, and the kernel keeps
+// each client address on one shard. snapshot_server_update updates every shard in parallel on its own thread and returns when they are
+// all done. client indices are global, and shards share one connect token table. callbacks run on the shard threads and are serialized
+// across shards. don't call the server from inside a callback.
+
 struct snapshot_server_t * snapshot_server_create( const char * server_address, const struct snapshot_server_config_t * config, double time );
 
 void snapshot_server_destroy( struct snapshot_server_t * server );
@@ -72,6 +114,16 @@ int snapshot_server_connected_clients( struct snapshot_server_t * server );
 
 int snapshot_server_max_clients( struct snapshot_server_t * server );
 
+// memory bytes is everything the server holds, including the packet pool as it stands now. per client is what one client slot
+// costs (state, endpoint, encoders, its share of the address index and token tables), and fixed is the rest: the server
+// struct with its send queue and receive buffers, io thread rings, packet pool, handshake pool and rate limiter
+
+size_t snapshot_server_memory_bytes( struct snapshot_server_t * server );
+
+size_t snapshot_server_memory_bytes_per_client( struct snapshot_server_t * server );
+
+size_t snapshot_server_memory_bytes_fixed( struct snapshot_server_t * server );
+
 SNAPSHOT_BOOL snapshot_server_process_packet( struct snapshot_server_t * server, const struct snapshot_address_t * from, uint8_t * packet_data, int packet_bytes );
 
 int snapshot_server_client_connected( struct snapshot_server_t * server, int client_index );
@@ -102,10 +154,14 @@ uint16_t snapshot_server_port( struct snapshot_server_t * server );
 
 void snapshot_server_set_flags( struct snapshot_server_t * server, uint64_t flags );
 
+void snapshot_server_set_snapshot( struct snapshot_server_t * server, const uint8_t * snapshot_data, int snapshot_bytes );
+
 #if SNAPSHOT_DEVELOPMENT
 void snapshot_server_set_development_flags( struct snapshot_server_t * server, uint64_t flags );
 #endif // #if SNAPSHOT_DEVELOPMENT
 
 const uint64_t * snapshot_server_counters( struct snapshot_server_t * server );
 
+const uint64_t * snapshot_server_packet_pool_counters( struct snapshot_server_t * server );
+
 #endif // #ifndef SNAPSHOT_SERVER_H
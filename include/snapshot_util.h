@@ -48,6 +48,22 @@ static inline int snapshot_bits_required( uint32_t min, uint32_t max )
 #endif // #ifdef __GNUC__
 }
 
+inline int snapshot_trailing_zeros_uint64( uint64_t x )
+{
+    snapshot_assert( x != 0 );
+#ifdef __GNUC__
+    return __builtin_ctzll( x );
+#else // #ifdef __GNUC__
+    int n = 0;
+    while ( ( x & 1 ) == 0 )
+    {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif // #ifdef __GNUC__
+}
+
 inline uint64_t snapshot_bswap_uint64( uint64_t value )
 {
 #ifdef __GNUC__
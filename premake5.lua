@@ -1,6 +1,6 @@
 
 solution "snapshot"
-	platforms { "portable", "x86", "x64", "avx", "avx2" }
+	platforms { "portable", "x86", "x64" }
 	configurations { "Debug", "Release" }
 	targetdir "bin/"
 	rtti "Off"
@@ -19,7 +19,7 @@ solution "snapshot"
 		location ("visualstudio")
 	filter "platforms:*x86"
 		architecture "x86"
-	filter "platforms:*x64 or *avx or *avx2"
+	filter "platforms:*x64"
 		architecture "x86_64"
 
 project "snapshot"
@@ -44,7 +44,7 @@ project "sodium"
 		"sodium/**.c",
 		"sodium/**.h",
 	}
-  	filter { "system:not windows", "platforms:*x64 or *avx or *avx2" }
+  	filter { "system:not windows", "platforms:*x64" }
 		files {
 			"sodium/**.S"
 		}
@@ -54,14 +54,6 @@ project "sodium"
 	filter "platforms:*x64"
 		architecture "x86_64"
 		defines { "SNAPSHOT_X64=1", "SNAPSHOT_CRYPTO_LOGS=1" }
-	filter "platforms:*avx"
-		architecture "x86_64"
-		vectorextensions "AVX"
-		defines { "SNAPSHOT_X64=1", "SNAPSHOT_AVX=1", "SNAPSHOT_CRYPTO_LOGS=1" }
-	filter "platforms:*avx2"
-		architecture "x86_64"
-		vectorextensions "AVX2"
-		defines { "SNAPSHOT_X64=1", "SNAPSHOT_AVX=1", "SNAPSHOT_AVX2=1", "SNAPSHOT_CRYPTO_LOGS=1" }
 	filter "system:windows"
 		disablewarnings { "4221", "4244", "4715", "4197", "4146", "4324", "4456", "4100", "4459", "4245" }
 		linkoptions { "/ignore:4221" }
@@ -80,6 +72,18 @@ project "test"
 	filter "system:macosx"
 		linkoptions { "-framework SystemConfiguration -framework CoreFoundation" }
 
+project "bench"
+	kind "ConsoleApp"
+	links { "snapshot", "sodium" }
+	files { "bench.c" }
+	includedirs { "include", "source" }
+	filter "system:windows"
+		disablewarnings { "4324" }
+	filter "system:not windows"
+		links { "pthread" }
+	filter "system:macosx"
+		linkoptions { "-framework SystemConfiguration -framework CoreFoundation" }
+
 project "client"
 	kind "ConsoleApp"
 	links { "snapshot", "sodium" }
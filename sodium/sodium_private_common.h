@@ -14,6 +14,10 @@
 
 #define COMPILER_ASSERT(X) (void) sizeof(char[(X) ? 1 : -1])
 
+#if SNAPSHOT_X64 && ( defined(__clang__) || defined(__GNUC__) ) && defined(__SIZEOF_INT128__)
+# define HAVE_TI_MODE 1
+#endif
+
 #ifdef HAVE_TI_MODE
 # if defined(__SIZEOF_INT128__)
 typedef unsigned __int128 uint128_t;
@@ -221,21 +225,10 @@ xor_buf(unsigned char *out, const unsigned char *in, size_t n)
 
 #if defined(__clang__) || defined(__GNUC__)
 
-    #if SNAPSHOT_AVX2
-
-        # define HAVE_MMINTRIN_H  1
-        # define HAVE_EMMINTRIN_H 1
-        # define HAVE_PMMINTRIN_H 1
-        # define HAVE_TMMINTRIN_H 1
-        # define HAVE_SMMINTRIN_H 1
-        # define HAVE_AVXINTRIN_H 1
-        # define HAVE_WMMINTRIN_H 1
-        # define HAVE_AVX2INTRIN_H 1
-        # define HAVE_AVX_ASM 1
-        # define HAVE_AMD64_ASM 1
-        # define HAVE_CPUID 1
+    // the simd kernels are built with per-file target pragmas and selected with cpuid at sodium_init,
+    // so a single x64 build carries the ref, ssse3 and avx2 implementations side by side
 
-    #elif SNAPSHOT_AVX
+    #if SNAPSHOT_X64
 
         # define HAVE_MMINTRIN_H  1
         # define HAVE_EMMINTRIN_H 1
@@ -244,31 +237,11 @@ xor_buf(unsigned char *out, const unsigned char *in, size_t n)
         # define HAVE_SMMINTRIN_H 1
         # define HAVE_AVXINTRIN_H 1
         # define HAVE_WMMINTRIN_H 1
+        # define HAVE_AVX2INTRIN_H 1
         # define HAVE_AVX_ASM 1
         # define HAVE_AMD64_ASM 1
         # define HAVE_CPUID 1
 
-    #elif SNAPSHOT_X64
-
-        # define HAVE_MMINTRIN_H  1
-        # define HAVE_EMMINTRIN_H 1
-        # define HAVE_PMMINTRIN_H 1
-        # define HAVE_TMMINTRIN_H 1
-        # define HAVE_SMMINTRIN_H 1
-        # define HAVE_WMMINTRIN_H 1
-        # define HAVE_AMD64_ASM 1
-        # define HAVE_CPUID 1
-
-    #elif SNAPSHOT_X64
-
-        # define HAVE_MMINTRIN_H  1
-        # define HAVE_EMMINTRIN_H 1
-        # define HAVE_PMMINTRIN_H 1
-        # define HAVE_TMMINTRIN_H 1
-        # define HAVE_SMMINTRIN_H 1
-        # define HAVE_WMMINTRIN_H 1
-        # define HAVE_CPUID 1
-
     #endif
 
 #endif
@@ -284,19 +257,15 @@ xor_buf(unsigned char *out, const unsigned char *in, size_t n)
 # define HAVE_TMMINTRIN_H 1
 # define HAVE_SMMINTRIN_H 1
 
-#if SNAPSHOT_AVX
 # define HAVE_AVXINTRIN_H 1
-#endif
 
 # if _MSC_VER >= 1600
 #  define HAVE_WMMINTRIN_H 1
 # endif
 
-#if SNAPSHOT_AVX2
 # if _MSC_VER >= 1700 && defined(_M_X64)
 #  define HAVE_AVX2INTRIN_H 1
 # endif
-#endif
 
 #elif defined(HAVE_INTRIN_H)
 
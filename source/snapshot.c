@@ -67,10 +67,9 @@ static void (*snapshot_free_function)( void * context, void * p ) = snapshot_def
 
 void snapshot_allocator( void * (*malloc_function)( void * context, size_t bytes ), void (*free_function)( void * context, void * p ) )
 {
-    snapshot_assert( malloc_function );
-    snapshot_assert( free_function );
-    snapshot_malloc_function = malloc_function;
-    snapshot_free_function = free_function;
+    snapshot_assert( ( malloc_function == NULL ) == ( free_function == NULL ) );
+    snapshot_malloc_function = malloc_function ? malloc_function : snapshot_default_malloc_function;
+    snapshot_free_function = free_function ? free_function : snapshot_default_free_function;
 }
 
 void * snapshot_malloc( void * context, size_t bytes )
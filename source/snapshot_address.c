@@ -246,6 +246,46 @@ SNAPSHOT_BOOL snapshot_address_equal( const struct snapshot_address_t * a, const
     return SNAPSHOT_TRUE;
 }
 
+uint32_t snapshot_address_hash( const struct snapshot_address_t * address )
+{
+    snapshot_assert( address );
+
+    // fnv-1a over the same fields snapshot_address_equal compares, so equal addresses always hash the same
+
+    uint32_t hash = 0x811C9DC5;
+
+    hash = ( hash ^ address->type ) * 0x01000193;
+
+    if ( address->type == SNAPSHOT_ADDRESS_IPV4 )
+    {
+        for ( int i = 0; i < 4; ++i )
+        {
+            hash = ( hash ^ address->data.ipv4[i] ) * 0x01000193;
+        }
+    }
+    else if ( address->type == SNAPSHOT_ADDRESS_IPV6 )
+    {
+        for ( int i = 0; i < 8; ++i )
+        {
+            hash = ( hash ^ ( address->data.ipv6[i] & 0xFF ) ) * 0x01000193;
+            hash = ( hash ^ ( address->data.ipv6[i] >> 8 ) ) * 0x01000193;
+        }
+    }
+    else
+    {
+        return hash;
+    }
+
+    hash = ( hash ^ ( address->port & 0xFF ) ) * 0x01000193;
+    hash = ( hash ^ ( address->port >> 8 ) ) * 0x01000193;
+
+    // fold the high bits down, since callers mask off the low bits
+
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
 void snapshot_address_anonymize( struct snapshot_address_t * address )
 {
     snapshot_assert( address );
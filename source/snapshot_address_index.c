@@ -0,0 +1,152 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#include "snapshot_address_index.h"
+
+void snapshot_address_index_init( struct snapshot_address_index_t * index, int * slots, int num_slots, const struct snapshot_address_t * keys )
+{
+    snapshot_assert( index );
+    snapshot_assert( slots );
+    snapshot_assert( keys );
+    snapshot_assert( num_slots > 0 );
+    snapshot_assert( ( num_slots & ( num_slots - 1 ) ) == 0 );
+
+    index->num_slots = num_slots;
+    index->slots = slots;
+    index->keys = keys;
+
+    snapshot_address_index_clear( index );
+}
+
+void snapshot_address_index_clear( struct snapshot_address_index_t * index )
+{
+    snapshot_assert( index );
+
+    index->num_entries = 0;
+
+    for ( int i = 0; i < index->num_slots; ++i )
+    {
+        index->slots[i] = -1;
+    }
+}
+
+void snapshot_address_index_insert( struct snapshot_address_index_t * index, int key_index )
+{
+    snapshot_assert( index );
+    snapshot_assert( key_index >= 0 );
+    snapshot_assert( index->keys[key_index].type != SNAPSHOT_ADDRESS_NONE );
+    snapshot_assert( index->num_entries + 1 < index->num_slots );
+
+    const int mask = index->num_slots - 1;
+
+    int slot = (int) ( snapshot_address_hash( &index->keys[key_index] ) & mask );
+
+    while ( index->slots[slot] != -1 )
+    {
+        snapshot_assert( index->slots[slot] != key_index );
+        slot = ( slot + 1 ) & mask;
+    }
+
+    index->slots[slot] = key_index;
+
+    index->num_entries++;
+}
+
+SNAPSHOT_BOOL snapshot_address_index_remove( struct snapshot_address_index_t * index, int key_index )
+{
+    snapshot_assert( index );
+    snapshot_assert( key_index >= 0 );
+
+    const int mask = index->num_slots - 1;
+
+    int slot = (int) ( snapshot_address_hash( &index->keys[key_index] ) & mask );
+
+    while ( index->slots[slot] != key_index )
+    {
+        if ( index->slots[slot] == -1 )
+            return SNAPSHOT_FALSE;
+        slot = ( slot + 1 ) & mask;
+    }
+
+    // backward shift deletion: pull later entries in the probe chain back into the hole, so lookups never need tombstones
+
+    int hole = slot;
+    int next = slot;
+
+    while ( 1 )
+    {
+        next = ( next + 1 ) & mask;
+
+        if ( index->slots[next] == -1 )
+            break;
+
+        const int home = (int) ( snapshot_address_hash( &index->keys[index->slots[next]] ) & mask );
+
+        // move the entry back only if its home slot is not cyclically in ( hole, next ]
+
+        const SNAPSHOT_BOOL stays = ( hole <= next ) ? ( home > hole && home <= next ) : ( home > hole || home <= next );
+
+        if ( !stays )
+        {
+            index->slots[hole] = index->slots[next];
+            hole = next;
+        }
+    }
+
+    index->slots[hole] = -1;
+
+    index->num_entries--;
+
+    snapshot_assert( index->num_entries >= 0 );
+
+    return SNAPSHOT_TRUE;
+}
+
+int snapshot_address_index_find( const struct snapshot_address_index_t * index, const struct snapshot_address_t * address )
+{
+    int iterator = -1;
+    return snapshot_address_index_find_next( index, address, &iterator );
+}
+
+int snapshot_address_index_find_next( const struct snapshot_address_index_t * index, const struct snapshot_address_t * address, int * iterator )
+{
+    snapshot_assert( index );
+    snapshot_assert( address );
+    snapshot_assert( iterator );
+
+    if ( address->type == SNAPSHOT_ADDRESS_NONE )
+        return -1;
+
+    const int mask = index->num_slots - 1;
+
+    // there is always at least one empty slot, so the probe sequence is guaranteed to terminate
+
+    int slot = ( *iterator < 0 ) ? (int) ( snapshot_address_hash( address ) & mask ) : ( ( *iterator + 1 ) & mask );
+
+    while ( 1 )
+    {
+        const int key_index = index->slots[slot];
+
+        if ( key_index == -1 )
+            break;
+
+        if ( snapshot_address_equal( &index->keys[key_index], address ) )
+        {
+            *iterator = slot;
+            return key_index;
+        }
+
+        slot = ( slot + 1 ) & mask;
+    }
+
+    *iterator = slot;
+
+    return -1;
+}
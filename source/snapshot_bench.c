@@ -0,0 +1,1345 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#include "snapshot_bench.h"
+
+#if SNAPSHOT_DEVELOPMENT
+
+#include "snapshot_platform.h"
+#include "snapshot_address.h"
+#include "snapshot_address_index.h"
+#include "snapshot_read_write.h"
+#include "snapshot_connect_token_table.h"
+#include "snapshot_server.h"
+#include "snapshot_packets.h"
+#include "snapshot_crypto.h"
+#include "snapshot_endpoint.h"
+#include "snapshot_sequence_buffer.h"
+#include "snapshot_packed_sequence_buffer.h"
+#include "snapshot_replay_protection.h"
+#include "snapshot_delta.h"
+#include "snapshot_range_coder.h"
+#include "snapshot_schema.h"
+#include "snapshot_bitpacker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_SOCKET_BUFFER_SIZE                    ( 4 * 1024 * 1024 )
+#define BENCH_SOCKET_PACKET_BYTES                                  100
+#define BENCH_SOCKET_BURST_PACKETS                                 128
+#define BENCH_SOCKET_ITERATIONS                                   2000
+#define BENCH_SOCKET_MAX_BATCH_SIZE                                 64
+
+static void bench_socket_receive( const char * name, int batch_size )
+{
+    struct snapshot_address_t receive_address;
+    struct snapshot_address_t send_address;
+    snapshot_address_parse( &receive_address, "127.0.0.1" );
+    snapshot_address_parse( &send_address, "127.0.0.1" );
+
+    struct snapshot_platform_socket_t * receive_socket = snapshot_platform_socket_create( NULL, &receive_address, SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING, 0.0f, BENCH_SOCKET_BUFFER_SIZE, BENCH_SOCKET_BUFFER_SIZE );
+    struct snapshot_platform_socket_t * send_socket = snapshot_platform_socket_create( NULL, &send_address, SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING, 0.0f, BENCH_SOCKET_BUFFER_SIZE, BENCH_SOCKET_BUFFER_SIZE );
+
+    if ( !receive_socket || !send_socket )
+    {
+        printf( "    %-36s could not create sockets\n", name );
+        if ( receive_socket )
+            snapshot_platform_socket_destroy( receive_socket );
+        if ( send_socket )
+            snapshot_platform_socket_destroy( send_socket );
+        return;
+    }
+
+    static uint8_t buffer[BENCH_SOCKET_MAX_BATCH_SIZE][SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+    uint8_t * packet_data[BENCH_SOCKET_MAX_BATCH_SIZE];
+    int packet_bytes[BENCH_SOCKET_MAX_BATCH_SIZE];
+    struct snapshot_address_t from[BENCH_SOCKET_MAX_BATCH_SIZE];
+
+    for ( int i = 0; i < BENCH_SOCKET_MAX_BATCH_SIZE; i++ )
+    {
+        packet_data[i] = buffer[i] + SNAPSHOT_PACKET_PREFIX_BYTES;
+    }
+
+    uint8_t send_packet_data[BENCH_SOCKET_PACKET_BYTES];
+    memset( send_packet_data, 0xFF, sizeof(send_packet_data) );
+
+    uint64_t packets_received = 0;
+    double receive_time = 0.0;
+
+    for ( int iteration = 0; iteration < BENCH_SOCKET_ITERATIONS; iteration++ )
+    {
+        for ( int i = 0; i < BENCH_SOCKET_BURST_PACKETS; i++ )
+        {
+            snapshot_platform_socket_send_packet( send_socket, &receive_address, send_packet_data, BENCH_SOCKET_PACKET_BYTES );
+        }
+
+        const double start_time = snapshot_platform_time();
+
+        if ( batch_size == 0 )
+        {
+            while ( snapshot_platform_socket_receive_packet( receive_socket, &from[0], packet_data[0], SNAPSHOT_MAX_PACKET_BYTES ) > 0 )
+            {
+                packets_received++;
+            }
+        }
+        else
+        {
+            while ( 1 )
+            {
+                int num_packets = snapshot_platform_socket_receive_packets( receive_socket, from, packet_data, packet_bytes, SNAPSHOT_MAX_PACKET_BYTES, batch_size );
+                packets_received += num_packets;
+                if ( num_packets < batch_size )
+                    break;
+            }
+        }
+
+        receive_time += snapshot_platform_time() - start_time;
+    }
+
+    const double packets_per_second = ( receive_time > 0.0 ) ? packets_received / receive_time : 0.0;
+
+    printf( "    %-36s %8.2fM packets per second (%" PRId64 " packets)\n", name, packets_per_second / 1000000.0, packets_received );
+
+    snapshot_platform_socket_destroy( send_socket );
+    snapshot_platform_socket_destroy( receive_socket );
+}
+
+static void bench_socket_send( const char * name, int batch_size )
+{
+    struct snapshot_address_t receive_address;
+    struct snapshot_address_t send_address;
+    snapshot_address_parse( &receive_address, "127.0.0.1" );
+    snapshot_address_parse( &send_address, "127.0.0.1" );
+
+    struct snapshot_platform_socket_t * receive_socket = snapshot_platform_socket_create( NULL, &receive_address, SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING, 0.0f, BENCH_SOCKET_BUFFER_SIZE, BENCH_SOCKET_BUFFER_SIZE );
+    struct snapshot_platform_socket_t * send_socket = snapshot_platform_socket_create( NULL, &send_address, SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING, 0.0f, BENCH_SOCKET_BUFFER_SIZE, BENCH_SOCKET_BUFFER_SIZE );
+
+    if ( !receive_socket || !send_socket )
+    {
+        printf( "    %-36s could not create sockets\n", name );
+        if ( receive_socket )
+            snapshot_platform_socket_destroy( receive_socket );
+        if ( send_socket )
+            snapshot_platform_socket_destroy( send_socket );
+        return;
+    }
+
+    static uint8_t buffer[BENCH_SOCKET_MAX_BATCH_SIZE][SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+    uint8_t * packet_data[BENCH_SOCKET_MAX_BATCH_SIZE];
+    int packet_bytes[BENCH_SOCKET_MAX_BATCH_SIZE];
+    struct snapshot_address_t to[BENCH_SOCKET_MAX_BATCH_SIZE];
+
+    for ( int i = 0; i < BENCH_SOCKET_MAX_BATCH_SIZE; i++ )
+    {
+        packet_data[i] = buffer[i] + SNAPSHOT_PACKET_PREFIX_BYTES;
+        memset( packet_data[i], 0xFF, BENCH_SOCKET_PACKET_BYTES );
+        packet_bytes[i] = BENCH_SOCKET_PACKET_BYTES;
+        to[i] = receive_address;
+    }
+
+    uint64_t packets_sent = 0;
+    double send_time = 0.0;
+
+    for ( int iteration = 0; iteration < BENCH_SOCKET_ITERATIONS; iteration++ )
+    {
+        const double start_time = snapshot_platform_time();
+
+        if ( batch_size == 0 )
+        {
+            for ( int i = 0; i < BENCH_SOCKET_BURST_PACKETS; i++ )
+            {
+                snapshot_platform_socket_send_packet( send_socket, &receive_address, packet_data[0], BENCH_SOCKET_PACKET_BYTES );
+            }
+        }
+        else
+        {
+            for ( int i = 0; i < BENCH_SOCKET_BURST_PACKETS; i += batch_size )
+            {
+                snapshot_platform_socket_send_packets( send_socket, to, packet_data, packet_bytes, batch_size );
+            }
+        }
+
+        send_time += snapshot_platform_time() - start_time;
+
+        packets_sent += BENCH_SOCKET_BURST_PACKETS;
+
+        while ( 1 )
+        {
+            int num_packets = snapshot_platform_socket_receive_packets( receive_socket, to, packet_data, packet_bytes, SNAPSHOT_MAX_PACKET_BYTES, BENCH_SOCKET_MAX_BATCH_SIZE );
+            if ( num_packets < BENCH_SOCKET_MAX_BATCH_SIZE )
+                break;
+        }
+
+        for ( int i = 0; i < BENCH_SOCKET_MAX_BATCH_SIZE; i++ )
+        {
+            packet_bytes[i] = BENCH_SOCKET_PACKET_BYTES;
+            to[i] = receive_address;
+        }
+    }
+
+    const double packets_per_second = ( send_time > 0.0 ) ? packets_sent / send_time : 0.0;
+
+    printf( "    %-36s %8.2fM packets per second (%" PRId64 " packets)\n", name, packets_per_second / 1000000.0, packets_sent );
+
+    snapshot_platform_socket_destroy( send_socket );
+    snapshot_platform_socket_destroy( receive_socket );
+}
+
+void bench_socket()
+{
+    bench_socket_receive( "receive packet (one per call)", 0 );
+    bench_socket_receive( "receive packets (batch 1)", 1 );
+    bench_socket_receive( "receive packets (batch 32)", 32 );
+    bench_socket_receive( "receive packets (batch 64)", 64 );
+    bench_socket_send( "send packet (one per call)", 0 );
+    bench_socket_send( "send packets (batch 32)", 32 );
+    bench_socket_send( "send packets (batch 64)", 64 );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_ADDRESS_LOOKUPS                                 1000000
+
+static void bench_address_lookup_entries( int num_entries )
+{
+    struct snapshot_address_t * keys = (struct snapshot_address_t*) malloc( sizeof( struct snapshot_address_t ) * num_entries );
+    int num_slots = 1;
+    while ( num_slots < num_entries * 2 )
+        num_slots *= 2;
+    int * slots = (int*) malloc( sizeof(int) * num_slots );
+
+    memset( keys, 0, sizeof( struct snapshot_address_t ) * num_entries );
+
+    struct snapshot_address_index_t index;
+    snapshot_address_index_init( &index, slots, num_slots, keys );
+
+    for ( int i = 0; i < num_entries; i++ )
+    {
+        keys[i].type = SNAPSHOT_ADDRESS_IPV4;
+        keys[i].data.ipv4[0] = 10;
+        keys[i].data.ipv4[1] = (uint8_t) ( i >> 8 );
+        keys[i].data.ipv4[2] = (uint8_t) i;
+        keys[i].data.ipv4[3] = 1;
+        keys[i].port = 50000;
+        snapshot_address_index_insert( &index, i );
+    }
+
+    uint64_t found = 0;
+
+    // lookups are spread across all entries, so the linear scan averages half the table
+
+    double start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < BENCH_ADDRESS_LOOKUPS; i++ )
+    {
+        const struct snapshot_address_t * address = &keys[ ( (uint64_t) i * 7919 ) % num_entries ];
+        for ( int j = 0; j < num_entries; j++ )
+        {
+            if ( snapshot_address_equal( &keys[j], address ) )
+            {
+                found++;
+                break;
+            }
+        }
+    }
+
+    const double linear_time = snapshot_platform_time() - start_time;
+
+    start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < BENCH_ADDRESS_LOOKUPS; i++ )
+    {
+        const struct snapshot_address_t * address = &keys[ ( (uint64_t) i * 7919 ) % num_entries ];
+        if ( snapshot_address_index_find( &index, address ) != -1 )
+        {
+            found++;
+        }
+    }
+
+    const double index_time = snapshot_platform_time() - start_time;
+
+    char name[64];
+    snprintf( name, sizeof(name), "linear scan (%d entries)", num_entries );
+    printf( "    %-36s %8.2fns per lookup\n", name, linear_time / BENCH_ADDRESS_LOOKUPS * 1000000000.0 );
+    snprintf( name, sizeof(name), "address index (%d entries)", num_entries );
+    printf( "    %-36s %8.2fns per lookup\n", name, index_time / BENCH_ADDRESS_LOOKUPS * 1000000000.0 );
+
+    if ( found != 2 * (uint64_t) BENCH_ADDRESS_LOOKUPS )
+    {
+        printf( "    error: lookups failed\n" );
+    }
+
+    free( slots );
+    free( keys );
+}
+
+void bench_address_lookup()
+{
+    bench_address_lookup_entries( 256 );
+    bench_address_lookup_entries( 1024 );
+    bench_address_lookup_entries( 4096 );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_CONNECT_TOKEN_REQUESTS                          1000000
+#define BENCH_CONNECT_TOKEN_SCAN_WORK                      1000000000
+
+struct bench_connect_token_entry_t
+{
+    double time;
+    uint8_t mac[SNAPSHOT_MAC_BYTES];
+    struct snapshot_address_t address;
+};
+
+// the linear scan the server used before the connect token table: check every entry, replace the oldest
+
+static int bench_connect_token_scan_find_or_add( struct bench_connect_token_entry_t * entries, int num_entries, const struct snapshot_address_t * address, const uint8_t * mac, double time )
+{
+    int matching_index = -1;
+    int oldest_index = -1;
+    double oldest_time = 0.0;
+
+    for ( int i = 0; i < num_entries; ++i )
+    {
+        if ( memcmp( mac, entries[i].mac, SNAPSHOT_MAC_BYTES ) == 0 )
+            matching_index = i;
+
+        if ( oldest_index == -1 || entries[i].time < oldest_time )
+        {
+            oldest_time = entries[i].time;
+            oldest_index = i;
+        }
+    }
+
+    if ( matching_index == -1 )
+    {
+        entries[oldest_index].time = time;
+        entries[oldest_index].address = *address;
+        memcpy( entries[oldest_index].mac, mac, SNAPSHOT_MAC_BYTES );
+        return 1;
+    }
+
+    return snapshot_address_equal( &entries[matching_index].address, address );
+}
+
+static void bench_connect_token_entries( int num_entries )
+{
+    // a reconnect storm: every request carries a new token, so each one misses and evicts once the table is full
+
+    const int num_macs = num_entries * 2;
+
+    uint8_t (*macs)[SNAPSHOT_MAC_BYTES] = (uint8_t(*)[SNAPSHOT_MAC_BYTES]) malloc( num_macs * SNAPSHOT_MAC_BYTES );
+    snapshot_crypto_random_bytes( (uint8_t*) macs, num_macs * SNAPSHOT_MAC_BYTES );
+
+    struct snapshot_address_t address;
+    snapshot_address_parse( &address, "10.0.0.1:50000" );
+
+    // the scan is o(n) per request, so it gets a fixed amount of work instead of a fixed number of requests
+
+    int scan_requests = BENCH_CONNECT_TOKEN_SCAN_WORK / num_entries;
+    if ( scan_requests > BENCH_CONNECT_TOKEN_REQUESTS )
+        scan_requests = BENCH_CONNECT_TOKEN_REQUESTS;
+
+    struct bench_connect_token_entry_t * entries = (struct bench_connect_token_entry_t*) malloc( num_entries * sizeof( struct bench_connect_token_entry_t ) );
+    for ( int i = 0; i < num_entries; i++ )
+    {
+        entries[i].time = -1000.0;
+        memset( entries[i].mac, 0, SNAPSHOT_MAC_BYTES );
+        memset( &entries[i].address, 0, sizeof( struct snapshot_address_t ) );
+    }
+
+    uint64_t accepted = 0;
+
+    double start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < scan_requests; i++ )
+    {
+        accepted += bench_connect_token_scan_find_or_add( entries, num_entries, &address, macs[i % num_macs], (double) i );
+    }
+
+    const double scan_time = snapshot_platform_time() - start_time;
+
+    struct snapshot_connect_token_table_t * table = snapshot_connect_token_table_create( NULL, num_entries );
+
+    start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < BENCH_CONNECT_TOKEN_REQUESTS; i++ )
+    {
+        accepted += snapshot_connect_token_table_find_or_add( table, &address, macs[i % num_macs] );
+    }
+
+    const double table_time = snapshot_platform_time() - start_time;
+
+    char name[64];
+    snprintf( name, sizeof(name), "linear scan (%d entries)", num_entries );
+    printf( "    %-36s %12.0f requests per second\n", name, scan_requests / scan_time );
+    snprintf( name, sizeof(name), "token table (%d entries)", num_entries );
+    printf( "    %-36s %12.0f requests per second\n", name, BENCH_CONNECT_TOKEN_REQUESTS / table_time );
+
+    if ( accepted != (uint64_t) scan_requests + BENCH_CONNECT_TOKEN_REQUESTS )
+    {
+        printf( "    error: requests rejected\n" );
+    }
+
+    snapshot_connect_token_table_destroy( table );
+
+    free( entries );
+    free( macs );
+}
+
+void bench_connect_token_table()
+{
+    bench_connect_token_entries( 1000 );
+    bench_connect_token_entries( 10000 );
+    bench_connect_token_entries( 100000 );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_AEAD_BATCH_SIZE                                       64
+#define BENCH_AEAD_BYTES_PER_SIZE                  ( 64 * 1024 * 1024 )
+
+static void bench_aead_packet_size( int packet_bytes )
+{
+    uint8_t * buffer = (uint8_t*) malloc( BENCH_AEAD_BATCH_SIZE * ( packet_bytes + SNAPSHOT_MAC_BYTES ) );
+    uint8_t keys[BENCH_AEAD_BATCH_SIZE][SNAPSHOT_KEY_BYTES];
+    uint8_t nonces[BENCH_AEAD_BATCH_SIZE][SNAPSHOT_PACKET_NONCE_BYTES];
+    uint8_t additional_data[SNAPSHOT_PACKET_ADDITIONAL_DATA_BYTES];
+
+    memset( buffer, 0, BENCH_AEAD_BATCH_SIZE * ( packet_bytes + SNAPSHOT_MAC_BYTES ) );
+    memset( additional_data, 0, sizeof( additional_data ) );
+
+    struct snapshot_crypto_aead_batch_item_t items[BENCH_AEAD_BATCH_SIZE];
+
+    for ( int i = 0; i < BENCH_AEAD_BATCH_SIZE; i++ )
+    {
+        snapshot_crypto_random_bytes( keys[i], SNAPSHOT_KEY_BYTES );
+        snapshot_crypto_random_bytes( nonces[i], SNAPSHOT_PACKET_NONCE_BYTES );
+        items[i].message = buffer + i * ( packet_bytes + SNAPSHOT_MAC_BYTES );
+        items[i].message_length = packet_bytes;
+        items[i].additional = additional_data;
+        items[i].additional_length = sizeof( additional_data );
+        items[i].nonce = nonces[i];
+        items[i].key = keys[i];
+    }
+
+    int iterations = BENCH_AEAD_BYTES_PER_SIZE / ( BENCH_AEAD_BATCH_SIZE * packet_bytes );
+    if ( iterations < 1 )
+        iterations = 1;
+
+    const int num_packets = iterations * BENCH_AEAD_BATCH_SIZE;
+
+    // one packet at a time, the way packets were encrypted before
+
+    double start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < iterations; i++ )
+    {
+        for ( int j = 0; j < BENCH_AEAD_BATCH_SIZE; j++ )
+        {
+            snapshot_crypto_encrypt_aead( items[j].message, packet_bytes, additional_data, sizeof( additional_data ), nonces[j], keys[j] );
+        }
+    }
+
+    const double single_time = snapshot_platform_time() - start_time;
+
+    start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < iterations; i++ )
+    {
+        snapshot_crypto_encrypt_aead_batch( items, BENCH_AEAD_BATCH_SIZE );
+    }
+
+    const double batch_time = snapshot_platform_time() - start_time;
+
+    // the aes256gcm cipher suite, one packet at a time
+
+    double aes256gcm_time = 0.0;
+
+    if ( snapshot_crypto_aes256gcm_available() )
+    {
+        start_time = snapshot_platform_time();
+
+        for ( int i = 0; i < iterations; i++ )
+        {
+            for ( int j = 0; j < BENCH_AEAD_BATCH_SIZE; j++ )
+            {
+                snapshot_crypto_encrypt_aead_aes256gcm( items[j].message, packet_bytes, additional_data, sizeof( additional_data ), nonces[j], keys[j] );
+            }
+        }
+
+        aes256gcm_time = snapshot_platform_time() - start_time;
+    }
+
+    const double megabytes = (double) num_packets * packet_bytes / ( 1024.0 * 1024.0 );
+
+    char name[64];
+    snprintf( name, sizeof(name), "encrypt (%d bytes)", packet_bytes );
+    printf( "    %-36s %8.2fns per packet %10.2fMB/sec\n", name, single_time / num_packets * 1000000000.0, megabytes / single_time );
+    snprintf( name, sizeof(name), "encrypt batch (%d bytes)", packet_bytes );
+    printf( "    %-36s %8.2fns per packet %10.2fMB/sec\n", name, batch_time / num_packets * 1000000000.0, megabytes / batch_time );
+    if ( aes256gcm_time > 0.0 )
+    {
+        snprintf( name, sizeof(name), "encrypt aes256gcm (%d bytes)", packet_bytes );
+        printf( "    %-36s %8.2fns per packet %10.2fMB/sec\n", name, aes256gcm_time / num_packets * 1000000000.0, megabytes / aes256gcm_time );
+    }
+
+    free( buffer );
+}
+
+void bench_aead()
+{
+    bench_aead_packet_size( 16 );
+    bench_aead_packet_size( 64 );
+    bench_aead_packet_size( 256 );
+    bench_aead_packet_size( 1024 );
+    bench_aead_packet_size( 4096 );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_ADMISSION_PACKETS                                100000
+
+static void bench_server_admission_packets( const char * name, int rate_limit_packets_per_second, uint8_t * packet_data, int packet_bytes )
+{
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.protocol_id = 0x1122334455667788ULL;
+    server_config.max_clients = 64;
+    server_config.rate_limit_packets_per_second = rate_limit_packets_per_second;
+    snapshot_crypto_random_bytes( server_config.private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:0", &server_config, 0.0 );
+    if ( !server )
+    {
+        printf( "    error: could not create server\n" );
+        return;
+    }
+
+    // the flood comes from a single ip with a different port on every packet
+
+    struct snapshot_address_t from;
+    snapshot_address_parse( &from, "10.0.0.1:50000" );
+
+    const double start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < BENCH_ADMISSION_PACKETS; i++ )
+    {
+        from.port = (uint16_t) ( 1024 + ( i & 0x7FFF ) );
+        snapshot_server_process_packet( server, &from, packet_data, packet_bytes );
+    }
+
+    const double time = snapshot_platform_time() - start_time;
+
+    printf( "    %-36s %8.2fns per packet\n", name, time / BENCH_ADMISSION_PACKETS * 1000000000.0 );
+
+    snapshot_server_destroy( server );
+}
+
+void bench_server_admission()
+{
+    // a well formed connection request with a connect token that doesn't decrypt, the most expensive packet to reject
+
+    uint8_t request_data[SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES];
+    snapshot_crypto_random_bytes( request_data, sizeof( request_data ) );
+
+    uint8_t * p = request_data;
+    snapshot_write_uint8( &p, SNAPSHOT_CONNECTION_REQUEST_PACKET );
+    snapshot_write_bytes( &p, SNAPSHOT_VERSION_INFO, SNAPSHOT_VERSION_INFO_BYTES );
+    snapshot_write_uint64( &p, 0x1122334455667788ULL );
+    snapshot_write_uint64( &p, 0xFFFFFFFFFFFFFFFFULL );
+    p += SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES;
+    snapshot_write_uint8( &p, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 );
+
+    uint8_t junk_data[100];
+    snapshot_crypto_random_bytes( junk_data, sizeof( junk_data ) );
+    junk_data[0] = SNAPSHOT_PAYLOAD_PACKET;
+
+    bench_server_admission_packets( "junk (bad prefix)", 0, junk_data, sizeof( junk_data ) );
+    bench_server_admission_packets( "request flood (no rate limit)", 0, request_data, sizeof( request_data ) );
+    bench_server_admission_packets( "request flood (rate limited)", 100, request_data, sizeof( request_data ) );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_ENDPOINT_UPDATES                                 1000000
+#define BENCH_ENDPOINT_SCAN_WORK                             100000000
+#define BENCH_ENDPOINT_PAYLOAD_BYTES                               100
+
+static void bench_endpoint_update_buffer_size( int buffer_size )
+{
+    struct snapshot_endpoint_config_t config;
+    snapshot_endpoint_default_config( &config );
+    config.sent_packets_buffer_size = buffer_size;
+    config.received_packets_buffer_size = buffer_size;
+
+    double time = 100.0;
+
+    struct snapshot_endpoint_t * endpoint = snapshot_endpoint_create( &config, time );
+    if ( !endpoint )
+    {
+        printf( "    error: could not create endpoint\n" );
+        return;
+    }
+
+    uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + BENCH_ENDPOINT_PAYLOAD_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+    uint8_t * payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+    memset( payload_data, 0, BENCH_ENDPOINT_PAYLOAD_BYTES );
+
+    // fill both buffers with packets, acking three out of four, and time the per packet bookkeeping as we go
+
+    const double fill_start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < buffer_size; i++ )
+    {
+        int num_packets = 0;
+        uint8_t * packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        snapshot_endpoint_write_packets( endpoint, payload_data, BENCH_ENDPOINT_PAYLOAD_BYTES, &num_packets, &packet_data[0], &packet_bytes[0] );
+        const uint32_t ack_bits = ( i % 4 ) ? 0xFFFFFFFFU : 0xFFFFFFFEU;
+        snapshot_endpoint_mark_payload_processed( endpoint, (uint16_t) i, (uint16_t) i, ack_bits, BENCH_ENDPOINT_PAYLOAD_BYTES );
+        snapshot_endpoint_clear_acks( endpoint );
+        time += 0.01;
+        endpoint->time = time;
+    }
+
+    const double fill_time = snapshot_platform_time() - fill_start_time;
+
+    // incremental update
+
+    const double update_start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < BENCH_ENDPOINT_UPDATES; i++ )
+    {
+        snapshot_endpoint_update( endpoint, time );
+    }
+
+    const double update_time = snapshot_platform_time() - update_start_time;
+
+    // the four sequence buffer passes the update used to make over the older half of each buffer
+
+    const int scan_iterations = BENCH_ENDPOINT_SCAN_WORK / ( buffer_size * 2 ) + 1;
+
+    int num_found = 0;
+
+    const double scan_start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < scan_iterations; i++ )
+    {
+        for ( int pass = 0; pass < 4; pass++ )
+        {
+            struct snapshot_packed_sequence_buffer_t * buffer = ( pass == 2 ) ? endpoint->received_packets : endpoint->sent_packets;
+            const uint16_t base_sequence = (uint16_t) ( buffer->sequence - buffer_size + 1 );
+            for ( int j = 0; j < buffer_size / 2; j++ )
+            {
+                if ( snapshot_packed_sequence_buffer_find( buffer, (uint16_t) ( base_sequence + j ) ) )
+                {
+                    num_found++;
+                }
+            }
+        }
+    }
+
+    const double scan_time = snapshot_platform_time() - scan_start_time;
+
+    char name[64];
+    snprintf( name, sizeof(name), "update (%d entries)", buffer_size );
+    printf( "    %-36s %10.2fns per update\n", name, update_time / BENCH_ENDPOINT_UPDATES * 1000000000.0 );
+    snprintf( name, sizeof(name), "full scan (%d entries)", buffer_size );
+    printf( "    %-36s %10.2fns per update\n", name, scan_time / scan_iterations * 1000000000.0 );
+    snprintf( name, sizeof(name), "send and ack (%d entries)", buffer_size );
+    printf( "    %-36s %10.2fns per packet\n", name, fill_time / buffer_size * 1000000000.0 );
+
+    if ( num_found != scan_iterations * 2 * buffer_size )
+    {
+        printf( "    error: samples missing from buffers\n" );
+    }
+
+    snapshot_endpoint_destroy( endpoint );
+}
+
+void bench_endpoint_update()
+{
+    bench_endpoint_update_buffer_size( 256 );
+    bench_endpoint_update_buffer_size( 1024 );
+    bench_endpoint_update_buffer_size( 4096 );
+    bench_endpoint_update_buffer_size( 16384 );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_SEQUENCE_BUFFER_ITERATIONS                        200000
+#define BENCH_SEQUENCE_BUFFER_FINDS                                 32
+#define BENCH_SEQUENCE_BUFFER_ENTRY_BYTES                           16
+
+static void bench_sequence_buffer_size( int num_entries )
+{
+    // each iteration inserts the next sequence, looks up the 32 before it like an ack scan does, and every 16th
+    // iteration jumps ahead by half the buffer so the range of slots being reused gets cleared
+
+    struct snapshot_sequence_buffer_t * sequence_buffer = snapshot_sequence_buffer_create( NULL, num_entries, BENCH_SEQUENCE_BUFFER_ENTRY_BYTES );
+
+    uint64_t found = 0;
+    uint16_t sequence = 0;
+
+    double start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < BENCH_SEQUENCE_BUFFER_ITERATIONS; i++ )
+    {
+        if ( ( i % 16 ) == 0 )
+        {
+            sequence += (uint16_t) ( num_entries / 2 );
+            snapshot_sequence_buffer_advance( sequence_buffer, sequence );
+        }
+        uint8_t * entry = (uint8_t*) snapshot_sequence_buffer_insert( sequence_buffer, sequence );
+        entry[0] = 1;
+        for ( int j = 0; j < BENCH_SEQUENCE_BUFFER_FINDS; j++ )
+        {
+            found += snapshot_sequence_buffer_find( sequence_buffer, (uint16_t) ( sequence - j ) ) != NULL;
+        }
+        sequence++;
+    }
+
+    const double sequence_buffer_time = snapshot_platform_time() - start_time;
+
+    snapshot_sequence_buffer_destroy( sequence_buffer );
+
+    struct snapshot_packed_sequence_buffer_t * packed_sequence_buffer = snapshot_packed_sequence_buffer_create( NULL, num_entries, BENCH_SEQUENCE_BUFFER_ENTRY_BYTES );
+
+    uint64_t packed_found = 0;
+    sequence = 0;
+
+    start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < BENCH_SEQUENCE_BUFFER_ITERATIONS; i++ )
+    {
+        if ( ( i % 16 ) == 0 )
+        {
+            sequence += (uint16_t) ( num_entries / 2 );
+            snapshot_packed_sequence_buffer_advance( packed_sequence_buffer, sequence );
+        }
+        uint8_t * entry = (uint8_t*) snapshot_packed_sequence_buffer_insert( packed_sequence_buffer, sequence );
+        entry[0] = 1;
+        for ( int j = 0; j < BENCH_SEQUENCE_BUFFER_FINDS; j++ )
+        {
+            packed_found += snapshot_packed_sequence_buffer_find( packed_sequence_buffer, (uint16_t) ( sequence - j ) ) != NULL;
+        }
+        sequence++;
+    }
+
+    const double packed_sequence_buffer_time = snapshot_platform_time() - start_time;
+
+    snapshot_packed_sequence_buffer_destroy( packed_sequence_buffer );
+
+    char name[64];
+    snprintf( name, sizeof(name), "regular buffer (%d entries)", num_entries );
+    printf( "    %-36s %8.2fns per packet\n", name, sequence_buffer_time / BENCH_SEQUENCE_BUFFER_ITERATIONS * 1000000000.0 );
+    snprintf( name, sizeof(name), "packed buffer (%d entries)", num_entries );
+    printf( "    %-36s %8.2fns per packet\n", name, packed_sequence_buffer_time / BENCH_SEQUENCE_BUFFER_ITERATIONS * 1000000000.0 );
+
+    if ( found != packed_found )
+    {
+        printf( "    error: buffers disagree\n" );
+    }
+}
+
+void bench_sequence_buffer()
+{
+    bench_sequence_buffer_size( 256 );
+    bench_sequence_buffer_size( 1024 );
+    bench_sequence_buffer_size( 4096 );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_REPLAY_PROTECTION_PACKETS                        4000000
+#define BENCH_REPLAY_PROTECTION_REORDER                             32
+
+static void bench_replay_protection_window( int num_clients, int window_bits )
+{
+    // packets arrive for random clients, the way they come off the socket on a full server, each slightly
+    // reordered. every packet is checked and then advanced, the same as snapshot_read_packet does
+
+    const size_t bytes_per_client = snapshot_replay_protection_bytes( window_bits );
+
+    uint8_t * replay_protection = (uint8_t*) malloc( num_clients * bytes_per_client );
+    uint64_t * client_sequence = (uint64_t*) malloc( num_clients * sizeof(uint64_t) );
+    int * packet_client = (int*) malloc( BENCH_REPLAY_PROTECTION_PACKETS * sizeof(int) );
+    uint64_t * packet_sequence = (uint64_t*) malloc( BENCH_REPLAY_PROTECTION_PACKETS * sizeof(uint64_t) );
+
+    for ( int i = 0; i < num_clients; i++ )
+    {
+        snapshot_replay_protection_init( (struct snapshot_replay_protection_t*) ( replay_protection + i * bytes_per_client ), window_bits );
+        client_sequence[i] = BENCH_REPLAY_PROTECTION_REORDER;
+    }
+
+    for ( int i = 0; i < BENCH_REPLAY_PROTECTION_PACKETS; i++ )
+    {
+        const int client_index = rand() % num_clients;
+        packet_client[i] = client_index;
+        packet_sequence[i] = client_sequence[client_index] - ( rand() % BENCH_REPLAY_PROTECTION_REORDER );
+        client_sequence[client_index]++;
+    }
+
+    uint64_t accepted = 0;
+
+    const double start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < BENCH_REPLAY_PROTECTION_PACKETS; i++ )
+    {
+        struct snapshot_replay_protection_t * client_replay_protection = (struct snapshot_replay_protection_t*) ( replay_protection + packet_client[i] * bytes_per_client );
+        if ( !snapshot_replay_protection_already_received( client_replay_protection, packet_sequence[i] ) )
+        {
+            snapshot_replay_protection_advance_sequence( client_replay_protection, packet_sequence[i] );
+            accepted++;
+        }
+    }
+
+    const double finish_time = snapshot_platform_time();
+
+    char name[64];
+    if ( window_bits == SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE )
+    {
+        snprintf( name, sizeof(name), "%d clients, %d entry buffer", num_clients, window_bits );
+    }
+    else
+    {
+        snprintf( name, sizeof(name), "%d clients, %d bit window", num_clients, window_bits );
+    }
+    printf( "    %-36s %8.2fns per packet, %6d bytes per client, %.1f%% accepted\n", name, ( finish_time - start_time ) / BENCH_REPLAY_PROTECTION_PACKETS * 1000000000.0, (int) bytes_per_client, 100.0 * accepted / BENCH_REPLAY_PROTECTION_PACKETS );
+
+    free( packet_sequence );
+    free( packet_client );
+    free( client_sequence );
+    free( replay_protection );
+}
+
+void bench_replay_protection()
+{
+    const int num_clients[] = { SNAPSHOT_MAX_CLIENTS, SNAPSHOT_MAX_CLIENTS * 16 };
+
+    for ( int i = 0; i < (int) ( sizeof(num_clients) / sizeof(int) ); i++ )
+    {
+        bench_replay_protection_window( num_clients[i], SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE );
+        bench_replay_protection_window( num_clients[i], 1024 );
+        bench_replay_protection_window( num_clients[i], 2048 );
+    }
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_DELTA_SNAPSHOTS                                     100000
+#define BENCH_DELTA_HISTORY                                           32
+#define BENCH_DELTA_ACK_LATENCY                                        3
+
+static void bench_delta_snapshot_size( int snapshot_bytes, int changed_fields )
+{
+    // each tick changes a few fields by a small amount and every snapshot is acked a few ticks after it is sent,
+    // like a client with some latency. measures encoded size against the raw snapshot and encode plus decode time
+
+    struct snapshot_delta_encoder_t * encoder = snapshot_delta_encoder_create( NULL, snapshot_bytes, BENCH_DELTA_HISTORY );
+    struct snapshot_delta_decoder_t * decoder = snapshot_delta_decoder_create( NULL, snapshot_bytes, BENCH_DELTA_HISTORY );
+
+    const int num_fields = snapshot_bytes / 4;
+
+    uint32_t * fields = (uint32_t*) malloc( snapshot_bytes );
+    uint8_t * snapshot_data = (uint8_t*) malloc( snapshot_bytes );
+    for ( int i = 0; i < num_fields; i++ )
+    {
+        fields[i] = (uint32_t) rand();
+    }
+
+    uint64_t total_bytes = 0;
+    int failures = 0;
+
+    const double start_time = snapshot_platform_time();
+
+    for ( int i = 0; i < BENCH_DELTA_SNAPSHOTS; i++ )
+    {
+        for ( int j = 0; j < changed_fields; j++ )
+        {
+            fields[rand() % num_fields] += (uint32_t) ( rand() % 64 ) - 32;
+        }
+
+        uint8_t * p = snapshot_data;
+        for ( int j = 0; j < num_fields; j++ )
+        {
+            snapshot_write_uint32( &p, fields[j] );
+        }
+
+        if ( i >= BENCH_DELTA_ACK_LATENCY )
+        {
+            const uint16_t ack = (uint16_t) ( i - BENCH_DELTA_ACK_LATENCY );
+            snapshot_delta_encoder_process_acks( encoder, &ack, 1 );
+        }
+
+        int bytes = 0;
+        const uint8_t * data = snapshot_delta_encoder_write( encoder, (uint16_t) i, snapshot_data, &bytes, NULL );
+
+        if ( snapshot_delta_decoder_read( decoder, (uint16_t) i, data, bytes ) != SNAPSHOT_OK )
+        {
+            failures++;
+        }
+
+        total_bytes += bytes;
+    }
+
+    const double finish_time = snapshot_platform_time();
+
+    char name[64];
+    snprintf( name, sizeof(name), "%d bytes, %d changed fields", snapshot_bytes, changed_fields );
+    printf( "    %-36s %8.1f bytes per snapshot (%.1fx smaller), %8.2fns encode + decode\n", name, total_bytes / (double) BENCH_DELTA_SNAPSHOTS, snapshot_bytes / ( total_bytes / (double) BENCH_DELTA_SNAPSHOTS ), ( finish_time - start_time ) / BENCH_DELTA_SNAPSHOTS * 1000000000.0 );
+
+    if ( failures )
+    {
+        printf( "    error: %d snapshots failed to decode\n", failures );
+    }
+
+    free( snapshot_data );
+    free( fields );
+
+    snapshot_delta_decoder_destroy( decoder );
+    snapshot_delta_encoder_destroy( encoder );
+}
+
+void bench_delta()
+{
+    bench_delta_snapshot_size( 256, 4 );
+    bench_delta_snapshot_size( 1024, 16 );
+    bench_delta_snapshot_size( 4000, 64 );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_BITPACKER_VALUES                                      4096
+#define BENCH_BITPACKER_ITERATIONS                                  2000
+
+static void bench_bitpacker_width( int bits, int lead_bits )
+{
+    // packs an array of same width values with one write_bits call per value, then with write_array, starting
+    // lead_bits into the buffer so the unaligned path is measured too
+
+    const int buffer_bytes = ( BENCH_BITPACKER_VALUES * bits + lead_bits + 31 ) / 32 * 4;
+
+    uint32_t * values = (uint32_t*) malloc( BENCH_BITPACKER_VALUES * sizeof(uint32_t) );
+    uint32_t * output = (uint32_t*) malloc( BENCH_BITPACKER_VALUES * sizeof(uint32_t) );
+    uint8_t * buffer = (uint8_t*) malloc( buffer_bytes );
+
+    for ( int i = 0; i < BENCH_BITPACKER_VALUES; i++ )
+    {
+        values[i] = ( (uint32_t) rand() ^ ( (uint32_t) rand() << 16 ) ) & (uint32_t) ( ( 1ULL << bits ) - 1 );
+    }
+
+    double write_time[2] = { 0.0, 0.0 };
+    double read_time[2] = { 0.0, 0.0 };
+    int failures = 0;
+
+    for ( int iteration = 0; iteration < BENCH_BITPACKER_ITERATIONS; iteration++ )
+    {
+        for ( int array = 0; array < 2; array++ )
+        {
+            struct snapshot_bitwriter_t writer;
+            snapshot_bitwriter_init( &writer, buffer, buffer_bytes );
+            if ( lead_bits )
+            {
+                snapshot_bitwriter_write_bits( &writer, 0, lead_bits );
+            }
+
+            const double start_time = snapshot_platform_time();
+
+            if ( array )
+            {
+                snapshot_bitwriter_write_array( &writer, values, BENCH_BITPACKER_VALUES, bits );
+            }
+            else
+            {
+                for ( int i = 0; i < BENCH_BITPACKER_VALUES; i++ )
+                {
+                    snapshot_bitwriter_write_bits( &writer, values[i], bits );
+                }
+            }
+
+            snapshot_bitwriter_flush_bits( &writer );
+
+            const double middle_time = snapshot_platform_time();
+
+            struct snapshot_bitreader_t reader;
+            snapshot_bitreader_init( &reader, buffer, snapshot_bitwriter_get_bytes_written( &writer ) );
+            if ( lead_bits )
+            {
+                snapshot_bitreader_read_bits( &reader, lead_bits );
+            }
+
+            const double read_start_time = snapshot_platform_time();
+
+            if ( array )
+            {
+                snapshot_bitreader_read_array( &reader, output, BENCH_BITPACKER_VALUES, bits );
+            }
+            else
+            {
+                for ( int i = 0; i < BENCH_BITPACKER_VALUES; i++ )
+                {
+                    output[i] = snapshot_bitreader_read_bits( &reader, bits );
+                }
+            }
+
+            const double finish_time = snapshot_platform_time();
+
+            write_time[array] += middle_time - start_time;
+            read_time[array] += finish_time - read_start_time;
+
+            failures += memcmp( values, output, BENCH_BITPACKER_VALUES * sizeof(uint32_t) ) != 0;
+        }
+    }
+
+    const double total_bits = (double) BENCH_BITPACKER_VALUES * bits * BENCH_BITPACKER_ITERATIONS;
+
+    char name[64];
+    snprintf( name, sizeof(name), "%d bits%s", bits, lead_bits ? " (unaligned)" : "" );
+    printf( "    %-36s write %6.2f -> %6.2f bits/ns, read %6.2f -> %6.2f bits/ns\n", name,
+        total_bits / ( write_time[0] * 1000000000.0 ), total_bits / ( write_time[1] * 1000000000.0 ),
+        total_bits / ( read_time[0] * 1000000000.0 ), total_bits / ( read_time[1] * 1000000000.0 ) );
+
+    if ( failures )
+    {
+        printf( "    error: %d arrays did not read back\n", failures );
+    }
+
+    free( buffer );
+    free( output );
+    free( values );
+}
+
+void bench_bitpacker()
+{
+    bench_bitpacker_width( 3, 0 );
+    bench_bitpacker_width( 8, 0 );
+    bench_bitpacker_width( 12, 0 );
+    bench_bitpacker_width( 12, 5 );
+    bench_bitpacker_width( 17, 0 );
+    bench_bitpacker_width( 32, 0 );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_SCHEMA_ENTITIES                                       1024
+#define BENCH_SCHEMA_ITERATIONS                                     1000
+
+#define BENCH_SCHEMA_ENTITY( FIELD, OPTIONAL )                                                  \
+    FIELD( INT, type, ( 0, 63 ) )                                                               \
+    FIELD( FLOAT, position_x, ( -1000.0f, 1000.0f, 0.01f ) )                                    \
+    FIELD( FLOAT, position_y, ( -1000.0f, 1000.0f, 0.01f ) )                                    \
+    FIELD( FLOAT, position_z, ( -100.0f, 100.0f, 0.01f ) )                                      \
+    FIELD( QUATERNION, orientation, ( 9 ) )                                                     \
+    FIELD( INT, health, ( 0, 100 ) )                                                            \
+    FIELD( BOOL, active, () )                                                                   \
+    OPTIONAL( INT, owner, ( 0, 1023 ) )
+
+SNAPSHOT_SCHEMA_STRUCT( bench_schema_entity, BENCH_SCHEMA_ENTITY )
+SNAPSHOT_SCHEMA_FUNCTIONS( bench_schema_entity, BENCH_SCHEMA_ENTITY )
+
+// the same fields sent with the general purpose bitpacker, with bit widths worked out at runtime, a bounds check
+// per read and all four quaternion components, the way serialization code is usually written by hand
+
+static int bench_schema_bitpacker_write( const struct bench_schema_entity_t * entity, uint8_t * buffer, int buffer_bytes )
+{
+    struct snapshot_bitwriter_t writer;
+    snapshot_bitwriter_init( &writer, buffer, buffer_bytes );
+    snapshot_bitwriter_write_bits( &writer, (uint32_t) entity->type, snapshot_bits_required( 0, 63 ) );
+    snapshot_bitwriter_write_bits( &writer, snapshot_schema_quantize_float( entity->position_x, -1000.0f, 1000.0f, 0.01f, 200000 ), snapshot_bits_required( 0, 200000 ) );
+    snapshot_bitwriter_write_bits( &writer, snapshot_schema_quantize_float( entity->position_y, -1000.0f, 1000.0f, 0.01f, 200000 ), snapshot_bits_required( 0, 200000 ) );
+    snapshot_bitwriter_write_bits( &writer, snapshot_schema_quantize_float( entity->position_z, -100.0f, 100.0f, 0.01f, 20000 ), snapshot_bits_required( 0, 20000 ) );
+    for ( int i = 0; i < 4; i++ )
+    {
+        snapshot_bitwriter_write_bits( &writer, snapshot_schema_quantize_float( entity->orientation[i], -1.0f, 1.0f, 2.0f / 511, 511 ), 9 );
+    }
+    snapshot_bitwriter_write_bits( &writer, (uint32_t) entity->health, snapshot_bits_required( 0, 100 ) );
+    snapshot_bitwriter_write_bits( &writer, entity->active ? 1 : 0, 1 );
+    snapshot_bitwriter_write_bits( &writer, entity->has_owner ? 1 : 0, 1 );
+    if ( entity->has_owner )
+    {
+        snapshot_bitwriter_write_bits( &writer, (uint32_t) entity->owner, snapshot_bits_required( 0, 1023 ) );
+    }
+    snapshot_bitwriter_flush_bits( &writer );
+    return snapshot_bitwriter_get_bytes_written( &writer );
+}
+
+static uint32_t bench_schema_bitpacker_read_bits( struct snapshot_bitreader_t * reader, int bits, int * error )
+{
+    if ( snapshot_bitreader_would_read_past_end( reader, bits ) )
+    {
+        *error = 1;
+        return 0;
+    }
+    return snapshot_bitreader_read_bits( reader, bits );
+}
+
+static int bench_schema_bitpacker_read( struct bench_schema_entity_t * entity, uint8_t * buffer, int buffer_bytes )
+{
+    struct snapshot_bitreader_t reader;
+    snapshot_bitreader_init( &reader, buffer, buffer_bytes );
+    int error = 0;
+    entity->type = (int32_t) bench_schema_bitpacker_read_bits( &reader, snapshot_bits_required( 0, 63 ), &error );
+    entity->position_x = -1000.0f + bench_schema_bitpacker_read_bits( &reader, snapshot_bits_required( 0, 200000 ), &error ) * 0.01f;
+    entity->position_y = -1000.0f + bench_schema_bitpacker_read_bits( &reader, snapshot_bits_required( 0, 200000 ), &error ) * 0.01f;
+    entity->position_z = -100.0f + bench_schema_bitpacker_read_bits( &reader, snapshot_bits_required( 0, 20000 ), &error ) * 0.01f;
+    for ( int i = 0; i < 4; i++ )
+    {
+        entity->orientation[i] = -1.0f + bench_schema_bitpacker_read_bits( &reader, 9, &error ) * ( 2.0f / 511 );
+    }
+    entity->health = (int32_t) bench_schema_bitpacker_read_bits( &reader, snapshot_bits_required( 0, 100 ), &error );
+    entity->active = (SNAPSHOT_BOOL) bench_schema_bitpacker_read_bits( &reader, 1, &error );
+    entity->has_owner = (SNAPSHOT_BOOL) bench_schema_bitpacker_read_bits( &reader, 1, &error );
+    if ( entity->has_owner )
+    {
+        entity->owner = (int32_t) bench_schema_bitpacker_read_bits( &reader, snapshot_bits_required( 0, 1023 ), &error );
+    }
+    return error ? SNAPSHOT_ERROR : SNAPSHOT_OK;
+}
+
+void bench_schema()
+{
+    struct bench_schema_entity_t * entities = (struct bench_schema_entity_t*) malloc( BENCH_SCHEMA_ENTITIES * sizeof(struct bench_schema_entity_t) );
+    struct bench_schema_entity_t * output = (struct bench_schema_entity_t*) malloc( BENCH_SCHEMA_ENTITIES * sizeof(struct bench_schema_entity_t) );
+
+    for ( int i = 0; i < BENCH_SCHEMA_ENTITIES; i++ )
+    {
+        struct bench_schema_entity_t * entity = entities + i;
+        memset( entity, 0, sizeof(struct bench_schema_entity_t) );
+        entity->type = rand() % 64;
+        entity->position_x = ( rand() % 200000 - 100000 ) * 0.01f;
+        entity->position_y = ( rand() % 200000 - 100000 ) * 0.01f;
+        entity->position_z = ( rand() % 20000 - 10000 ) * 0.01f;
+        entity->orientation[0] = 0.5f;
+        entity->orientation[1] = -0.5f;
+        entity->orientation[2] = 0.5f;
+        entity->orientation[3] = -0.5f;
+        entity->health = rand() % 101;
+        entity->active = rand() % 2;
+        entity->has_owner = rand() % 2;
+        entity->owner = entity->has_owner ? rand() % 1024 : 0;
+    }
+
+    // bitpacker buffers must be a multiple of four bytes
+
+    const int buffer_bytes = bench_schema_entity_buffer_bytes;
+
+    uint8_t * buffer = (uint8_t*) malloc( BENCH_SCHEMA_ENTITIES * buffer_bytes );
+    int * bytes = (int*) malloc( BENCH_SCHEMA_ENTITIES * sizeof(int) );
+
+    for ( int pass = 0; pass < 2; pass++ )
+    {
+        const SNAPSHOT_BOOL schema = ( pass == 0 );
+
+        uint64_t total_bytes = 0;
+        int failures = 0;
+
+        double write_time = 0.0;
+        double read_time = 0.0;
+
+        for ( int iteration = 0; iteration < BENCH_SCHEMA_ITERATIONS; iteration++ )
+        {
+            const double start_time = snapshot_platform_time();
+
+            for ( int i = 0; i < BENCH_SCHEMA_ENTITIES; i++ )
+            {
+                uint8_t * entity_buffer = buffer + i * buffer_bytes;
+                bytes[i] = schema ? bench_schema_entity_write( entities + i, entity_buffer, buffer_bytes ) : bench_schema_bitpacker_write( entities + i, entity_buffer, buffer_bytes );
+                total_bytes += bytes[i];
+            }
+
+            const double middle_time = snapshot_platform_time();
+
+            for ( int i = 0; i < BENCH_SCHEMA_ENTITIES; i++ )
+            {
+                uint8_t * entity_buffer = buffer + i * buffer_bytes;
+                const int result = schema ? bench_schema_entity_read( output + i, entity_buffer, bytes[i] ) : bench_schema_bitpacker_read( output + i, entity_buffer, bytes[i] );
+                failures += ( result != SNAPSHOT_OK );
+            }
+
+            const double finish_time = snapshot_platform_time();
+
+            write_time += middle_time - start_time;
+            read_time += finish_time - middle_time;
+        }
+
+        const double entities_processed = (double) BENCH_SCHEMA_ENTITIES * BENCH_SCHEMA_ITERATIONS;
+
+        printf( "    %-36s %8.2fns write, %8.2fns read, %5.1f bytes per entity\n", schema ? "schema" : "bitpacker", write_time / entities_processed * 1000000000.0, read_time / entities_processed * 1000000000.0, total_bytes / entities_processed );
+
+        if ( failures )
+        {
+            printf( "    error: %d entities failed to read\n", failures );
+        }
+    }
+
+    free( bytes );
+    free( buffer );
+    free( output );
+    free( entities );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define BENCH_RANGE_CODER_PACKETS                                  20000
+#define BENCH_RANGE_CODER_HISTORY                                     32
+#define BENCH_RANGE_CODER_ACK_LATENCY                                  3
+
+static void bench_range_coder_payloads( const char * payload_name, int snapshot_bytes, int mode )
+{
+    // codes a stream of payloads acked a few packets after they are sent. "delta" payloads are the output of the
+    // delta encoder for snapshots with a few fields changing each tick, "fields" payloads are byte aligned 32 bit
+    // fields holding mostly small values, like uncompressed game state
+
+    struct snapshot_delta_encoder_t * delta_encoder = snapshot_delta_encoder_create( NULL, snapshot_bytes, BENCH_RANGE_CODER_HISTORY );
+    struct snapshot_range_encoder_t * encoder = snapshot_range_encoder_create( NULL, snapshot_delta_max_bytes( snapshot_bytes ), mode, NULL, BENCH_RANGE_CODER_HISTORY );
+    struct snapshot_range_decoder_t * decoder = snapshot_range_decoder_create( NULL, snapshot_delta_max_bytes( snapshot_bytes ), mode, NULL, BENCH_RANGE_CODER_HISTORY );
+
+    const int num_fields = snapshot_bytes / 4;
+    const SNAPSHOT_BOOL delta = strcmp( payload_name, "delta" ) == 0;
+
+    uint32_t * fields = (uint32_t*) malloc( snapshot_bytes );
+    uint8_t * snapshot_data = (uint8_t*) malloc( snapshot_bytes );
+    for ( int i = 0; i < num_fields; i++ )
+    {
+        fields[i] = (uint32_t) ( rand() % 1000 );
+    }
+
+    uint64_t payload_bytes = 0;
+    uint64_t coded_bytes = 0;
+    int failures = 0;
+    double time = 0.0;
+
+    for ( int i = 0; i < BENCH_RANGE_CODER_PACKETS; i++ )
+    {
+        for ( int j = 0; j < num_fields / 16; j++ )
+        {
+            fields[rand() % num_fields] += (uint32_t) ( rand() % 64 ) - 32;
+        }
+
+        uint8_t * p = snapshot_data;
+        for ( int j = 0; j < num_fields; j++ )
+        {
+            snapshot_write_uint32( &p, fields[j] );
+        }
+
+        if ( i >= BENCH_RANGE_CODER_ACK_LATENCY )
+        {
+            const uint16_t ack = (uint16_t) ( i - BENCH_RANGE_CODER_ACK_LATENCY );
+            snapshot_delta_encoder_process_acks( delta_encoder, &ack, 1 );
+            snapshot_range_encoder_process_acks( encoder, &ack, 1 );
+        }
+
+        const uint8_t * payload_data = snapshot_data;
+        int bytes = snapshot_bytes;
+        if ( delta )
+        {
+            payload_data = snapshot_delta_encoder_write( delta_encoder, (uint16_t) i, snapshot_data, &bytes, NULL );
+        }
+
+        const double start_time = snapshot_platform_time();
+
+        int encoded_bytes = 0;
+        const uint8_t * encoded_data = snapshot_range_encoder_write( encoder, (uint16_t) i, payload_data, bytes, &encoded_bytes );
+
+        int decoded_bytes = 0;
+        const uint8_t * decoded_data = snapshot_range_decoder_read( decoder, (uint16_t) i, encoded_data, encoded_bytes, &decoded_bytes );
+
+        time += snapshot_platform_time() - start_time;
+
+        if ( !decoded_data || decoded_bytes != bytes || memcmp( decoded_data, payload_data, bytes ) != 0 )
+        {
+            failures++;
+        }
+
+        payload_bytes += bytes;
+        coded_bytes += encoded_bytes;
+    }
+
+    char name[64];
+    snprintf( name, sizeof(name), "%d byte %s, %s", snapshot_bytes, payload_name, mode == SNAPSHOT_RANGE_CODER_STATIC ? "static" : "adaptive" );
+    printf( "    %-36s %8.1f -> %8.1f bytes (%4.1f%% smaller), %6.2fns per byte encode + decode\n", name, payload_bytes / (double) BENCH_RANGE_CODER_PACKETS, coded_bytes / (double) BENCH_RANGE_CODER_PACKETS, 100.0 - 100.0 * coded_bytes / payload_bytes, time / payload_bytes * 1000000000.0 );
+
+    if ( failures )
+    {
+        printf( "    error: %d payloads failed to decode\n", failures );
+    }
+
+    free( snapshot_data );
+    free( fields );
+
+    snapshot_range_decoder_destroy( decoder );
+    snapshot_range_encoder_destroy( encoder );
+    snapshot_delta_encoder_destroy( delta_encoder );
+}
+
+void bench_range_coder()
+{
+    bench_range_coder_payloads( "fields", 256, SNAPSHOT_RANGE_CODER_STATIC );
+    bench_range_coder_payloads( "fields", 256, SNAPSHOT_RANGE_CODER_ADAPTIVE );
+    bench_range_coder_payloads( "delta", 1024, SNAPSHOT_RANGE_CODER_STATIC );
+    bench_range_coder_payloads( "delta", 1024, SNAPSHOT_RANGE_CODER_ADAPTIVE );
+    bench_range_coder_payloads( "delta", 4000, SNAPSHOT_RANGE_CODER_STATIC );
+    bench_range_coder_payloads( "delta", 4000, SNAPSHOT_RANGE_CODER_ADAPTIVE );
+}
+
+// ------------------------------------------------------------------------------------------
+
+#define RUN_BENCH( bench_function )                                         \
+    do                                                                      \
+    {                                                                       \
+        printf( #bench_function "\n\n" );                                   \
+        fflush( stdout );                                                   \
+        bench_function();                                                   \
+        printf( "\n" );                                                     \
+        fflush( stdout );                                                   \
+    }                                                                       \
+    while (0)
+
+void snapshot_run_benchmarks()
+{
+    printf( "\n[bench]\n\n" );
+
+    snapshot_quiet( SNAPSHOT_TRUE );
+
+    RUN_BENCH( bench_socket );
+    RUN_BENCH( bench_address_lookup );
+    RUN_BENCH( bench_connect_token_table );
+    RUN_BENCH( bench_aead );
+    RUN_BENCH( bench_server_admission );
+    RUN_BENCH( bench_endpoint_update );
+    RUN_BENCH( bench_sequence_buffer );
+    RUN_BENCH( bench_replay_protection );
+    RUN_BENCH( bench_delta );
+    RUN_BENCH( bench_schema );
+    RUN_BENCH( bench_bitpacker );
+    RUN_BENCH( bench_range_coder );
+
+    fflush( stdout );
+}
+
+#else // #if SNAPSHOT_DEVELOPMENT
+
+#include <stdio.h>
+
+void snapshot_run_benchmarks()
+{
+    printf( "\n[benchmarks are not included in this build]\n\n" );
+}
+
+#endif // #if SNAPSHOT_DEVELOPMENT
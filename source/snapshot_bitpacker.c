@@ -12,6 +12,92 @@
 
 // -----------------------------------------------------------------------------------------------------------------------
 
+// 32 values of n bits fill exactly n words, so every block of 32 values starts and ends on a word boundary. there is
+// one pack and one unpack kernel per width, so the word index and shift of each value are compile time constants.
+
+#define SNAPSHOT_BITPACKER_BLOCK_VALUES 32
+
+#define SNAPSHOT_BITPACKER_REPEAT_BLOCK( macro )                                                                        \
+    macro(0)  macro(1)  macro(2)  macro(3)  macro(4)  macro(5)  macro(6)  macro(7)                                      \
+    macro(8)  macro(9)  macro(10) macro(11) macro(12) macro(13) macro(14) macro(15)                                     \
+    macro(16) macro(17) macro(18) macro(19) macro(20) macro(21) macro(22) macro(23)                                     \
+    macro(24) macro(25) macro(26) macro(27) macro(28) macro(29) macro(30) macro(31)
+
+#define SNAPSHOT_BITPACKER_REPEAT_WIDTHS( macro )                                                                       \
+    macro(1)  macro(2)  macro(3)  macro(4)  macro(5)  macro(6)  macro(7)  macro(8)                                      \
+    macro(9)  macro(10) macro(11) macro(12) macro(13) macro(14) macro(15) macro(16)                                     \
+    macro(17) macro(18) macro(19) macro(20) macro(21) macro(22) macro(23) macro(24)                                     \
+    macro(25) macro(26) macro(27) macro(28) macro(29) macro(30) macro(31) macro(32)
+
+#define SNAPSHOT_BITPACKER_WORD( i ) ( ( (i) * bits ) >> 5 )
+
+#define SNAPSHOT_BITPACKER_SHIFT( i ) ( ( (i) * bits ) & 31 )
+
+#define SNAPSHOT_BITPACKER_PACK_VALUE( i )                                                                              \
+    scratch |= (uint64_t) values[i] << SNAPSHOT_BITPACKER_SHIFT( i );                                                   \
+    if ( SNAPSHOT_BITPACKER_SHIFT( i ) + bits >= 32 )                                                                   \
+    {                                                                                                                   \
+        words[SNAPSHOT_BITPACKER_WORD( i )] = (uint32_t) scratch;                                                       \
+        scratch >>= 32;                                                                                                 \
+    }
+
+#define SNAPSHOT_BITPACKER_UNPACK_VALUE( i )                                                                            \
+    values[i] = (uint32_t) ( ( ( SNAPSHOT_BITPACKER_SHIFT( i ) + bits > 32 ) ?                                          \
+        ( (uint64_t) words[SNAPSHOT_BITPACKER_WORD( i )] | ( (uint64_t) words[SNAPSHOT_BITPACKER_WORD( i ) + 1] << 32 ) ) : \
+        (uint64_t) words[SNAPSHOT_BITPACKER_WORD( i )] ) >> SNAPSHOT_BITPACKER_SHIFT( i ) ) & mask;
+
+#define SNAPSHOT_BITPACKER_KERNELS( n )                                                                                 \
+    static void snapshot_bitpacker_pack_##n( uint32_t * words, const uint32_t * values )                                \
+    {                                                                                                                   \
+        const int bits = n;                                                                                             \
+        uint64_t scratch = 0;                                                                                           \
+        SNAPSHOT_BITPACKER_REPEAT_BLOCK( SNAPSHOT_BITPACKER_PACK_VALUE )                                                \
+    }                                                                                                                   \
+    static void snapshot_bitpacker_unpack_##n( uint32_t * values, const uint32_t * words )                              \
+    {                                                                                                                   \
+        const int bits = n;                                                                                             \
+        const uint64_t mask = ( 1ULL << bits ) - 1;                                                                     \
+        SNAPSHOT_BITPACKER_REPEAT_BLOCK( SNAPSHOT_BITPACKER_UNPACK_VALUE )                                              \
+    }
+
+SNAPSHOT_BITPACKER_REPEAT_WIDTHS( SNAPSHOT_BITPACKER_KERNELS )
+
+typedef void (*snapshot_bitpacker_pack_function_t)( uint32_t * words, const uint32_t * values );
+
+typedef void (*snapshot_bitpacker_unpack_function_t)( uint32_t * values, const uint32_t * words );
+
+#define SNAPSHOT_BITPACKER_PACK_FUNCTION( n ) snapshot_bitpacker_pack_##n,
+
+#define SNAPSHOT_BITPACKER_UNPACK_FUNCTION( n ) snapshot_bitpacker_unpack_##n,
+
+static const snapshot_bitpacker_pack_function_t snapshot_bitpacker_pack_functions[] = { NULL, SNAPSHOT_BITPACKER_REPEAT_WIDTHS( SNAPSHOT_BITPACKER_PACK_FUNCTION ) };
+
+static const snapshot_bitpacker_unpack_function_t snapshot_bitpacker_unpack_functions[] = { NULL, SNAPSHOT_BITPACKER_REPEAT_WIDTHS( SNAPSHOT_BITPACKER_UNPACK_FUNCTION ) };
+
+// the unaligned head and tail of a byte run are less than a word, so they go through the scratch in one write
+
+static inline uint32_t snapshot_bitpacker_load_bytes( const uint8_t * data, int bytes )
+{
+    snapshot_assert( bytes > 0 && bytes < 4 );
+    uint32_t value = 0;
+    for ( int i = 0; i < bytes; i++ )
+    {
+        value |= (uint32_t) data[i] << ( i * 8 );
+    }
+    return value;
+}
+
+static inline void snapshot_bitpacker_store_bytes( uint8_t * data, uint32_t value, int bytes )
+{
+    snapshot_assert( bytes > 0 && bytes < 4 );
+    for ( int i = 0; i < bytes; i++ )
+    {
+        data[i] = (uint8_t) ( value >> ( i * 8 ) );
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------
+
 void snapshot_bitwriter_init( struct snapshot_bitwriter_t * writer, void * data, int bytes )
 {
     snapshot_assert( writer );
@@ -76,8 +162,8 @@ void snapshot_bitwriter_write_bytes( struct snapshot_bitwriter_t * writer, const
     int head_bytes = ( 4 - ( writer->bits_written % 32 ) / 8 ) % 4;
     if ( head_bytes > bytes )
         head_bytes = bytes;
-    for ( int i = 0; i < head_bytes; ++i )
-        snapshot_bitwriter_write_bits( writer, data[i], 8 );
+    if ( head_bytes > 0 )
+        snapshot_bitwriter_write_bits( writer, snapshot_bitpacker_load_bytes( data, head_bytes ), head_bytes * 8 );
     if ( head_bytes == bytes )
         return;
 
@@ -100,14 +186,86 @@ void snapshot_bitwriter_write_bytes( struct snapshot_bitwriter_t * writer, const
     int tail_start = head_bytes + num_words * 4;
     int tail_bytes = bytes - tail_start;
     snapshot_assert( tail_bytes >= 0 && tail_bytes < 4 );
-    for ( int i = 0; i < tail_bytes; ++i )
-        snapshot_bitwriter_write_bits( writer, data[tail_start+i], 8 );
+    if ( tail_bytes > 0 )
+        snapshot_bitwriter_write_bits( writer, snapshot_bitpacker_load_bytes( data + tail_start, tail_bytes ), tail_bytes * 8 );
 
     snapshot_assert( snapshot_bitwriter_get_align_bits( writer ) == 0 );
 
     snapshot_assert( head_bytes + num_words * 4 + tail_bytes == bytes );
 }
 
+void snapshot_bitwriter_write_array( struct snapshot_bitwriter_t * writer, const uint32_t * values, int count, int bits )
+{
+    snapshot_assert( writer );
+    snapshot_assert( values || count == 0 );
+    snapshot_assert( count >= 0 );
+    snapshot_assert( bits > 0 );
+    snapshot_assert( bits <= 32 );
+    snapshot_assert( writer->bits_written + (int64_t) count * bits <= writer->num_bits );
+
+#if SNAPSHOT_ASSERTS
+    for ( int i = 0; i < count; i++ )
+    {
+        snapshot_assert( (uint64_t)values[i] <= ( ( 1ULL << bits ) - 1 ) );
+    }
+#endif // #if SNAPSHOT_ASSERTS
+
+    int index = 0;
+
+#if SNAPSHOT_LITTLE_ENDIAN
+
+    const int num_blocks = count / SNAPSHOT_BITPACKER_BLOCK_VALUES;
+
+    if ( num_blocks > 0 )
+    {
+        snapshot_bitpacker_pack_function_t pack = snapshot_bitpacker_pack_functions[bits];
+
+        const int shift = writer->scratch_bits;
+
+        snapshot_assert( shift >= 0 );
+        snapshot_assert( shift < 32 );
+
+        if ( shift == 0 )
+        {
+            for ( int i = 0; i < num_blocks; i++ )
+            {
+                pack( writer->data + writer->word_index, values + index );
+                writer->word_index += bits;
+                index += SNAPSHOT_BITPACKER_BLOCK_VALUES;
+            }
+        }
+        else
+        {
+            // the writer is part way through a word, so pack each block on its own and shift it into place
+
+            uint32_t block[SNAPSHOT_BITPACKER_BLOCK_VALUES];
+            uint32_t carry = (uint32_t) writer->scratch;
+            for ( int i = 0; i < num_blocks; i++ )
+            {
+                pack( block, values + index );
+                for ( int j = 0; j < bits; j++ )
+                {
+                    writer->data[writer->word_index++] = ( block[j] << shift ) | carry;
+                    carry = block[j] >> ( 32 - shift );
+                }
+                index += SNAPSHOT_BITPACKER_BLOCK_VALUES;
+            }
+            writer->scratch = carry;
+        }
+
+        writer->bits_written += num_blocks * SNAPSHOT_BITPACKER_BLOCK_VALUES * bits;
+
+        snapshot_assert( writer->word_index <= writer->num_words );
+    }
+
+#endif // #if SNAPSHOT_LITTLE_ENDIAN
+
+    for ( ; index < count; index++ )
+    {
+        snapshot_bitwriter_write_bits( writer, values[index], bits );
+    }
+}
+
 void snapshot_bitwriter_flush_bits( struct snapshot_bitwriter_t * writer )
 {
     snapshot_assert( writer );
@@ -227,8 +385,8 @@ void snapshot_bitreader_read_bytes( struct snapshot_bitreader_t * reader, uint8_
     int head_bytes = ( 4 - ( reader->bits_read % 32 ) / 8 ) % 4;
     if ( head_bytes > bytes )
         head_bytes = bytes;
-    for ( int i = 0; i < head_bytes; ++i )
-        data[i] = (uint8_t) snapshot_bitreader_read_bits( reader, 8 );
+    if ( head_bytes > 0 )
+        snapshot_bitpacker_store_bytes( data, snapshot_bitreader_read_bits( reader, head_bytes * 8 ), head_bytes );
     if ( head_bytes == bytes )
         return;
 
@@ -249,12 +407,89 @@ void snapshot_bitreader_read_bytes( struct snapshot_bitreader_t * reader, uint8_
     int tail_start = head_bytes + num_words * 4;
     int tail_bytes = bytes - tail_start;
     snapshot_assert( tail_bytes >= 0 && tail_bytes < 4 );
-    for ( int i = 0; i < tail_bytes; ++i )
-        data[tail_start+i] = (uint8_t) snapshot_bitreader_read_bits( reader, 8 );
+    if ( tail_bytes > 0 )
+        snapshot_bitpacker_store_bytes( data + tail_start, snapshot_bitreader_read_bits( reader, tail_bytes * 8 ), tail_bytes );
 
     snapshot_assert( snapshot_bitreader_get_align_bits( reader ) == 0 );
 
     snapshot_assert( head_bytes + num_words * 4 + tail_bytes == bytes );
 }
 
+void snapshot_bitreader_read_array( struct snapshot_bitreader_t * reader, uint32_t * values, int count, int bits )
+{
+    snapshot_assert( reader );
+    snapshot_assert( values || count == 0 );
+    snapshot_assert( count >= 0 );
+    snapshot_assert( bits > 0 );
+    snapshot_assert( bits <= 32 );
+    snapshot_assert( reader->bits_read + (int64_t) count * bits <= reader->num_bits );
+
+    int index = 0;
+
+#if SNAPSHOT_LITTLE_ENDIAN
+
+    const int num_blocks = count / SNAPSHOT_BITPACKER_BLOCK_VALUES;
+
+    if ( num_blocks > 0 )
+    {
+        snapshot_bitpacker_unpack_function_t unpack = snapshot_bitpacker_unpack_functions[bits];
+
+        // the scratch holds the unread end of the word before word_index, so work out where the next bit is
+
+        snapshot_assert( reader->scratch_bits >= 0 );
+        snapshot_assert( reader->scratch_bits < 32 );
+
+        const int bit_index = reader->word_index * 32 - reader->scratch_bits;
+        const int shift = bit_index & 31;
+        int word_index = bit_index >> 5;
+
+        if ( shift == 0 )
+        {
+            for ( int i = 0; i < num_blocks; i++ )
+            {
+                unpack( values + index, reader->data + word_index );
+                word_index += bits;
+                index += SNAPSHOT_BITPACKER_BLOCK_VALUES;
+            }
+        }
+        else
+        {
+            // the block starts part way through a word, so shift it down into place before unpacking it
+
+            uint32_t block[SNAPSHOT_BITPACKER_BLOCK_VALUES];
+            for ( int i = 0; i < num_blocks; i++ )
+            {
+                for ( int j = 0; j < bits; j++ )
+                {
+                    block[j] = ( reader->data[word_index+j] >> shift ) | ( reader->data[word_index+j+1] << ( 32 - shift ) );
+                }
+                unpack( values + index, block );
+                word_index += bits;
+                index += SNAPSHOT_BITPACKER_BLOCK_VALUES;
+            }
+        }
+
+        // blocks are whole words, so the reader ends up at the same shift it started from
+
+        reader->bits_read += num_blocks * SNAPSHOT_BITPACKER_BLOCK_VALUES * bits;
+        reader->word_index = word_index;
+        reader->scratch = 0;
+        reader->scratch_bits = 0;
+        if ( shift != 0 )
+        {
+            snapshot_assert( reader->word_index < reader->num_words );
+            reader->scratch = reader->data[reader->word_index] >> shift;
+            reader->scratch_bits = 32 - shift;
+            reader->word_index++;
+        }
+    }
+
+#endif // #if SNAPSHOT_LITTLE_ENDIAN
+
+    for ( ; index < count; index++ )
+    {
+        values[index] = snapshot_bitreader_read_bits( reader, bits );
+    }
+}
+
 // -----------------------------------------------------------------------------------------------------------------------
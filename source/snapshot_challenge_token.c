@@ -11,6 +11,27 @@
 #include "snapshot_challenge_token.h"
 #include "snapshot_read_write.h"
 #include "snapshot_crypto.h"
+#include "snapshot_connect_token.h"
+
+void snapshot_generate_challenge_token( struct snapshot_challenge_token_t * challenge_token, 
+                                        const struct snapshot_connect_token_private_t * connect_token, 
+                                        const struct snapshot_address_t * address, 
+                                        int cipher_suite, 
+                                        uint64_t expire_timestamp )
+{
+    snapshot_assert( challenge_token );
+    snapshot_assert( connect_token );
+    snapshot_assert( address );
+
+    challenge_token->client_id = connect_token->client_id;
+    memcpy( challenge_token->user_data, connect_token->user_data, SNAPSHOT_USER_DATA_BYTES );
+    memcpy( challenge_token->client_to_server_key, connect_token->client_to_server_key, SNAPSHOT_KEY_BYTES );
+    memcpy( challenge_token->server_to_client_key, connect_token->server_to_client_key, SNAPSHOT_KEY_BYTES );
+    challenge_token->timeout_seconds = connect_token->timeout_seconds;
+    challenge_token->cipher_suite = cipher_suite;
+    challenge_token->address = *address;
+    challenge_token->expire_timestamp = expire_timestamp;
+}
 
 void snapshot_write_challenge_token( struct snapshot_challenge_token_t * challenge_token, uint8_t * buffer, int buffer_length )
 {
@@ -30,6 +51,18 @@ void snapshot_write_challenge_token( struct snapshot_challenge_token_t * challen
 
     snapshot_write_bytes( &buffer, challenge_token->user_data, SNAPSHOT_USER_DATA_BYTES ); 
 
+    snapshot_write_bytes( &buffer, challenge_token->client_to_server_key, SNAPSHOT_KEY_BYTES );
+
+    snapshot_write_bytes( &buffer, challenge_token->server_to_client_key, SNAPSHOT_KEY_BYTES );
+
+    snapshot_write_uint32( &buffer, (uint32_t) challenge_token->timeout_seconds );
+
+    snapshot_write_uint8( &buffer, (uint8_t) challenge_token->cipher_suite );
+
+    snapshot_write_address( &buffer, &challenge_token->address );
+
+    snapshot_write_uint64( &buffer, challenge_token->expire_timestamp );
+
     snapshot_assert( buffer - start <= SNAPSHOT_CHALLENGE_TOKEN_BYTES - SNAPSHOT_MAC_BYTES );
 }
 
@@ -85,7 +118,25 @@ int snapshot_read_challenge_token( const uint8_t * buffer, int buffer_length, st
 
     snapshot_read_bytes( &buffer, challenge_token->user_data, SNAPSHOT_USER_DATA_BYTES );
 
-    snapshot_assert( buffer - start == 8 + SNAPSHOT_USER_DATA_BYTES );
+    snapshot_read_bytes( &buffer, challenge_token->client_to_server_key, SNAPSHOT_KEY_BYTES );
+
+    snapshot_read_bytes( &buffer, challenge_token->server_to_client_key, SNAPSHOT_KEY_BYTES );
+
+    challenge_token->timeout_seconds = (int) snapshot_read_uint32( &buffer );
+
+    challenge_token->cipher_suite = snapshot_read_uint8( &buffer );
+
+    if ( challenge_token->cipher_suite >= SNAPSHOT_NUM_CIPHER_SUITES )
+        return SNAPSHOT_ERROR;
+
+    snapshot_read_address( &buffer, &challenge_token->address );
+
+    if ( challenge_token->address.type != SNAPSHOT_ADDRESS_IPV4 && challenge_token->address.type != SNAPSHOT_ADDRESS_IPV6 )
+        return SNAPSHOT_ERROR;
+
+    challenge_token->expire_timestamp = snapshot_read_uint64( &buffer );
+
+    snapshot_assert( buffer - start <= SNAPSHOT_CHALLENGE_TOKEN_BYTES - SNAPSHOT_MAC_BYTES );
 
     return SNAPSHOT_OK;
 }
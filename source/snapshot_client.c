@@ -11,12 +11,18 @@
 #include "snapshot_client.h"
 #include "snapshot_address.h"
 #include "snapshot_platform.h"
+#include "snapshot_crypto.h"
 #include "snapshot_connect_token.h"
 #include "snapshot_challenge_token.h"
 #include "snapshot_replay_protection.h"
+#include "snapshot_delta.h"
+#include "snapshot_range_coder.h"
+#include "snapshot_util.h"
 #include "snapshot_packets.h"
 #include "snapshot_network_simulator.h"
 #include "snapshot_endpoint.h"
+#include "snapshot_io_thread.h"
+#include "snapshot_packet_pool.h"
 #include <time.h>
 
 #define SNAPSHOT_CLIENT_MAX_SIM_RECEIVE_PACKETS 256
@@ -65,14 +71,26 @@ struct snapshot_client_t
     struct snapshot_address_t server_address;
     struct snapshot_connect_token_t connect_token;
     struct snapshot_platform_socket_t * socket;
+    struct snapshot_io_thread_t * io_thread;
+    struct snapshot_packet_pool_t * packet_pool;
     struct snapshot_endpoint_t * endpoint;
-    struct snapshot_replay_protection_t replay_protection;
+    struct snapshot_replay_protection_t * replay_protection;
+    struct snapshot_delta_decoder_t * delta_decoder;
+    struct snapshot_range_decoder_t * range_decoder;
+    SNAPSHOT_BOOL has_snapshot;
+    SNAPSHOT_BOOL snapshot_pending_ack;
+    uint16_t snapshot_sequence;
     uint64_t challenge_token_sequence;
     uint8_t challenge_token_data[SNAPSHOT_CHALLENGE_TOKEN_BYTES];
     uint8_t read_packet_key[SNAPSHOT_KEY_BYTES];
     uint8_t write_packet_key[SNAPSHOT_KEY_BYTES];
+    int cipher_suite;
     uint8_t allowed_packets[SNAPSHOT_NUM_PACKETS];
     int loopback;
+    uint8_t * receive_packet_data[SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE];
+    int receive_packet_bytes[SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE];
+    struct snapshot_address_t receive_from[SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE];
+    uint8_t receive_buffer[SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE][SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
 #if SNAPSHOT_DEVELOPMENT
     uint64_t development_flags;
     uint8_t * sim_receive_packet_data[SNAPSHOT_CLIENT_MAX_SIM_RECEIVE_PACKETS];
@@ -110,7 +128,11 @@ struct snapshot_client_t * snapshot_client_create( const char * bind_address_str
     else
 #endif // #if SNAPSHOT_DEVELOPMENT
     {
-        socket = snapshot_platform_socket_create( config->context, &bind_address, SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING, 0.0f, SNAPSHOT_CLIENT_SOCKET_SNDBUF_SIZE, SNAPSHOT_CLIENT_SOCKET_RCVBUF_SIZE );
+        const int socket_type = config->io_thread ? SNAPSHOT_PLATFORM_SOCKET_BLOCKING : SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING;
+
+        const float timeout_seconds = config->io_thread ? SNAPSHOT_IO_THREAD_RECEIVE_TIMEOUT : 0.0f;
+
+        socket = snapshot_platform_socket_create( config->context, &bind_address, socket_type, timeout_seconds, SNAPSHOT_CLIENT_SOCKET_SNDBUF_SIZE, SNAPSHOT_CLIENT_SOCKET_RCVBUF_SIZE );
 
         if ( socket == NULL )
         {
@@ -144,6 +166,8 @@ struct snapshot_client_t * snapshot_client_create( const char * bind_address_str
     }
 
     client->config = *config;
+
+    client->counters[SNAPSHOT_CLIENT_COUNTER_CRYPTO_ISA] = (uint64_t) snapshot_crypto_isa();
     client->socket = socket;
     client->bind_address = bind_address;
     client->state = SNAPSHOT_CLIENT_STATE_DISCONNECTED;
@@ -163,7 +187,74 @@ struct snapshot_client_t * snapshot_client_create( const char * bind_address_str
     memset( &client->connect_token, 0, sizeof( struct snapshot_connect_token_t ) );
     memset( client->challenge_token_data, 0, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
 
-    snapshot_replay_protection_reset( &client->replay_protection );
+    if ( config->replay_protection_window_bits && !snapshot_replay_protection_valid_window_bits( config->replay_protection_window_bits ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "client replay protection window bits must be 256, 1024 or 2048" );
+        snapshot_client_destroy( client );
+        return NULL;
+    }
+
+    const int replay_protection_window_bits = config->replay_protection_window_bits ? config->replay_protection_window_bits : SNAPSHOT_REPLAY_PROTECTION_DEFAULT_WINDOW_BITS;
+
+    if ( config->ack_bits && !snapshot_endpoint_valid_ack_bits( config->ack_bits ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "client ack bits must be 32, 64 or 128" );
+        snapshot_client_destroy( client );
+        return NULL;
+    }
+
+    client->replay_protection = (struct snapshot_replay_protection_t*) snapshot_malloc( config->context, snapshot_replay_protection_bytes( replay_protection_window_bits ) );
+    if ( !client->replay_protection )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to allocate client replay protection" );
+        snapshot_client_destroy( client );
+        return NULL;
+    }
+
+    snapshot_replay_protection_init( client->replay_protection, replay_protection_window_bits );
+
+    if ( config->snapshot_bytes > 0 )
+    {
+        const int snapshot_history = config->snapshot_history ? config->snapshot_history : SNAPSHOT_DELTA_DEFAULT_HISTORY;
+
+        if ( ( config->snapshot_bytes % 4 ) != 0 || snapshot_delta_max_bytes( config->snapshot_bytes ) > SNAPSHOT_MAX_PAYLOAD_BYTES || snapshot_history < 0 || ( snapshot_history & ( snapshot_history - 1 ) ) != 0 )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "client snapshot bytes must be a multiple of 4 and at most %d, and snapshot history must be a power of two", SNAPSHOT_MAX_PAYLOAD_BYTES - 4 );
+            snapshot_client_destroy( client );
+            return NULL;
+        }
+
+        client->delta_decoder = snapshot_delta_decoder_create( config->context, config->snapshot_bytes, snapshot_history );
+        if ( !client->delta_decoder )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create client delta decoder" );
+            snapshot_client_destroy( client );
+            return NULL;
+        }
+
+        if ( config->snapshot_range_coder < SNAPSHOT_RANGE_CODER_NONE || config->snapshot_range_coder > SNAPSHOT_RANGE_CODER_ADAPTIVE )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "client snapshot range coder must be none, static or adaptive" );
+            snapshot_client_destroy( client );
+            return NULL;
+        }
+
+        if ( config->snapshot_range_coder != SNAPSHOT_RANGE_CODER_NONE )
+        {
+            client->range_decoder = snapshot_range_decoder_create( config->context, snapshot_delta_max_bytes( config->snapshot_bytes ), config->snapshot_range_coder, config->snapshot_range_model, snapshot_history );
+            if ( !client->range_decoder )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create client range decoder" );
+                snapshot_client_destroy( client );
+                return NULL;
+            }
+        }
+    }
+
+    for ( int i = 0; i < SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE; ++i )
+    {
+        client->receive_packet_data[i] = client->receive_buffer[i] + SNAPSHOT_PACKET_PREFIX_BYTES;
+    }
 
     client->allowed_packets[SNAPSHOT_CONNECTION_DENIED_PACKET] = 1;
     client->allowed_packets[SNAPSHOT_CONNECTION_CHALLENGE_PACKET] = 1;
@@ -172,10 +263,23 @@ struct snapshot_client_t * snapshot_client_create( const char * bind_address_str
     client->allowed_packets[SNAPSHOT_PASSTHROUGH_PACKET] = 1;
     client->allowed_packets[SNAPSHOT_DISCONNECT_PACKET] = 1;
 
+    if ( config->packet_pool )
+    {
+        client->packet_pool = snapshot_packet_pool_create( config->context );
+        if ( !client->packet_pool )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create client packet pool" );
+            snapshot_client_destroy( client );
+            return NULL;
+        }
+    }
+
     struct snapshot_endpoint_config_t endpoint_config;
     snapshot_endpoint_default_config( &endpoint_config );
     snapshot_copy_string( endpoint_config.name, "client", sizeof(endpoint_config.name) );
     endpoint_config.context = config->context;
+    endpoint_config.packet_pool = client->packet_pool;
+    endpoint_config.ack_bits = config->ack_bits ? config->ack_bits : endpoint_config.ack_bits;
     
     client->endpoint = snapshot_endpoint_create( &endpoint_config, time );
 
@@ -186,6 +290,17 @@ struct snapshot_client_t * snapshot_client_create( const char * bind_address_str
         return NULL;
     }
 
+    if ( config->io_thread && socket )
+    {
+        client->io_thread = snapshot_io_thread_create( config->context, socket, SNAPSHOT_CLIENT_IO_THREAD_QUEUE_SIZE );
+        if ( !client->io_thread )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create client io thread" );
+            snapshot_client_destroy( client );
+            return NULL;
+        }
+    }
+
     return client;
 }
 
@@ -207,11 +322,36 @@ void snapshot_client_destroy( struct snapshot_client_t * client )
         snapshot_endpoint_destroy( client->endpoint );
     }
     
+    if ( client->packet_pool )
+    {
+        snapshot_packet_pool_destroy( client->packet_pool );
+    }
+
+    if ( client->io_thread )
+    {
+        snapshot_io_thread_destroy( client->io_thread );
+    }
+
     if ( client->socket )
     {
         snapshot_platform_socket_destroy( client->socket );
     }
 
+    if ( client->replay_protection )
+    {
+        snapshot_free( client->config.context, client->replay_protection );
+    }
+
+    if ( client->delta_decoder )
+    {
+        snapshot_delta_decoder_destroy( client->delta_decoder );
+    }
+
+    if ( client->range_decoder )
+    {
+        snapshot_range_decoder_destroy( client->range_decoder );
+    }
+
     snapshot_free( client->config.context, client );
 }
 
@@ -238,7 +378,24 @@ void snapshot_client_reset_before_next_connect( struct snapshot_client_t * clien
 
     memset( client->challenge_token_data, 0, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
 
-    snapshot_replay_protection_reset( &client->replay_protection );
+    if ( client->replay_protection )
+    {
+        snapshot_replay_protection_reset( client->replay_protection );
+    }
+
+    if ( client->delta_decoder )
+    {
+        snapshot_delta_decoder_reset( client->delta_decoder );
+    }
+
+    if ( client->range_decoder )
+    {
+        snapshot_range_decoder_reset( client->range_decoder );
+    }
+
+    client->has_snapshot = SNAPSHOT_FALSE;
+    client->snapshot_pending_ack = SNAPSHOT_FALSE;
+    client->snapshot_sequence = 0;
 
     snapshot_endpoint_reset( client->endpoint );
 }
@@ -295,12 +452,25 @@ void snapshot_client_connect( struct snapshot_client_t * client, uint8_t * conne
     memcpy( client->read_packet_key, client->connect_token.server_to_client_key, SNAPSHOT_KEY_BYTES );
     memcpy( client->write_packet_key, client->connect_token.client_to_server_key, SNAPSHOT_KEY_BYTES );
 
+    // use the cipher suite from the connect token when this cpu supports it, otherwise fall back to chacha20-poly1305
+
+    client->cipher_suite = snapshot_crypto_select_cipher_suite( client->connect_token.cipher_suite );
+
+    if ( client->cipher_suite != client->connect_token.cipher_suite )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "client cipher suite %s is not available. falling back to %s", snapshot_cipher_suite_string( client->connect_token.cipher_suite ), snapshot_cipher_suite_string( client->cipher_suite ) );
+    }
+    else
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "client cipher suite is %s", snapshot_cipher_suite_string( client->cipher_suite ) );
+    }
+
     snapshot_client_reset_before_next_connect( client );
 
     snapshot_client_set_state( client, SNAPSHOT_CLIENT_STATE_SENDING_CONNECTION_REQUEST );
 }
 
-int snapshot_client_process_payload( struct snapshot_client_t * client, uint8_t * payload_data, int payload_bytes )
+int snapshot_client_process_payload( struct snapshot_client_t * client, uint16_t payload_sequence, uint8_t * payload_data, int payload_bytes )
 {
     snapshot_assert( client );
     snapshot_assert( payload_data );
@@ -318,11 +488,41 @@ int snapshot_client_process_payload( struct snapshot_client_t * client, uint8_t
         return SNAPSHOT_OK;
     }
 
-#endif // #if SNAPSHOT_DEVELOPME SNAPSHOT_OKNT
+#endif // #if SNAPSHOT_DEVELOPMENT
 
-    (void) client;
+    if ( !client->delta_decoder )
+        return SNAPSHOT_OK;
+
+    // a snapshot that fails to decode is not acked, so the server never picks it as a baseline
 
-    // todo: process real payload
+    const uint8_t * snapshot_data = payload_data;
+    int snapshot_bytes = payload_bytes;
+
+    if ( client->range_decoder )
+    {
+        snapshot_data = snapshot_range_decoder_read( client->range_decoder, payload_sequence, payload_data, payload_bytes, &snapshot_bytes );
+        if ( !snapshot_data )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "client failed to range decode snapshot %d", payload_sequence );
+            return SNAPSHOT_ERROR;
+        }
+    }
+
+    if ( snapshot_delta_decoder_read( client->delta_decoder, payload_sequence, snapshot_data, snapshot_bytes ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "client failed to decode snapshot %d", payload_sequence );
+        return SNAPSHOT_ERROR;
+    }
+
+    if ( !client->has_snapshot || snapshot_sequence_greater_than( payload_sequence, client->snapshot_sequence ) )
+    {
+        client->has_snapshot = SNAPSHOT_TRUE;
+        client->snapshot_sequence = payload_sequence;
+    }
+
+    client->snapshot_pending_ack = SNAPSHOT_TRUE;
+
+    client->counters[SNAPSHOT_CLIENT_COUNTER_PAYLOADS_RECEIVED]++;
 
     return SNAPSHOT_OK;
 }
@@ -358,12 +558,13 @@ SNAPSHOT_BOOL snapshot_client_process_packet( struct snapshot_client_t * client,
                                           packet_bytes, 
                                           &sequence, 
                                           client->read_packet_key, 
+                                          client->cipher_suite, 
                                           client->connect_token.protocol_id, 
                                           current_timestamp, 
                                           NULL, 
                                           client->allowed_packets, 
                                           out_packet_buffer,
-                                          &client->replay_protection );
+                                          client->replay_protection );
 
     if ( !packet )
     {
@@ -456,28 +657,21 @@ SNAPSHOT_BOOL snapshot_client_process_packet( struct snapshot_client_t * client,
             {
                 snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "client received payload packet from server" );
 
-                struct snapshot_payload_packet_t * payload_packet = (struct snapshot_payload_packet_t*) packet;
-
-                uint8_t * payload_packet_data = payload_packet->payload_data;
-                int payload_packet_bytes = payload_packet->payload_bytes;
-
-                uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+                uint8_t * payload_packet_data = snapshot_payload_packet_data( packet );
+                int payload_packet_bytes = snapshot_payload_packet_bytes( packet );
 
-                uint8_t * payload_data = NULL;
-                int payload_bytes = 0;
+                struct snapshot_endpoint_payload_t payload;
 
-                uint16_t payload_sequence = 0;
-                uint16_t payload_ack = 0;
-                uint32_t payload_ack_bits = 0;
+                snapshot_endpoint_receive_packet( client->endpoint, payload_packet_data, payload_packet_bytes, &payload );
 
-                snapshot_endpoint_process_packet( client->endpoint, payload_packet_data, payload_packet_bytes, buffer, &payload_data, &payload_bytes, &payload_sequence, &payload_ack, &payload_ack_bits );
-
-                if ( payload_data )
+                if ( payload.data )
                 {
-                    if ( snapshot_client_process_payload( client, payload_data, payload_bytes ) == SNAPSHOT_OK )
+                    if ( snapshot_client_process_payload( client, payload.sequence, payload.data, payload.bytes ) == SNAPSHOT_OK )
                     {
-                        snapshot_endpoint_mark_payload_processed( client->endpoint, payload_sequence, payload_ack, payload_ack_bits, payload_bytes );
+                        snapshot_endpoint_mark_payload_processed_ack_words( client->endpoint, payload.sequence, payload.ack, payload.ack_bits, payload.num_ack_words, payload.bytes );
                     }
+
+                    snapshot_endpoint_release_payload( client->endpoint, &payload );
                 }
 
                 client->last_packet_receive_time = client->time;
@@ -561,21 +755,61 @@ void snapshot_client_receive_packets( struct snapshot_client_t * client )
     }
     else
 #endif // #if SNAPSHOT_DEVELOPMENT
+    if ( client->io_thread )
+    {
+        // process packets the io thread has already received
+
+        const int queue_depth = snapshot_io_thread_receive_queue_depth( client->io_thread );
+
+        client->counters[SNAPSHOT_CLIENT_COUNTER_IO_RECEIVE_QUEUE_DEPTH] = queue_depth;
+
+        int num_packets_remaining = queue_depth;
+
+        while ( num_packets_remaining > 0 )
+        {
+            const int max_packets = ( num_packets_remaining < SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE ) ? num_packets_remaining : SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE;
+
+            uint8_t * packet_data[SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE];
+
+            const int num_packets = snapshot_io_thread_receive_packets( client->io_thread, client->receive_from, packet_data, client->receive_packet_bytes, max_packets );
+
+            for ( int i = 0; i < num_packets; ++i )
+            {
+                client->counters[SNAPSHOT_CLIENT_COUNTER_PACKETS_RECEIVED]++;
+
+                snapshot_client_process_packet( client, &client->receive_from[i], packet_data[i], client->receive_packet_bytes[i] );
+            }
+
+            snapshot_io_thread_release_packets( client->io_thread, num_packets );
+
+            num_packets_remaining -= num_packets;
+        }
+    }
+    else
     {
-        // process packets received from socket
+        // process packets received from socket, draining it in batches
 
         while ( 1 )
         {
-            struct snapshot_address_t from;
-            uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
-            uint8_t * packet_data = buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
-            int packet_bytes = snapshot_platform_socket_receive_packet( client->socket, &from, packet_data, SNAPSHOT_MAX_PACKET_BYTES );
-            if ( packet_bytes == 0 )
-                break;
+            int num_packets = snapshot_platform_socket_receive_packets( client->socket, 
+                                                                        client->receive_from, 
+                                                                        client->receive_packet_data, 
+                                                                        client->receive_packet_bytes, 
+                                                                        SNAPSHOT_MAX_PACKET_BYTES, 
+                                                                        SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE );
+
+            for ( int i = 0; i < num_packets; ++i )
+            {
+                if ( client->receive_packet_bytes[i] == 0 )
+                    continue;
+
+                client->counters[SNAPSHOT_CLIENT_COUNTER_PACKETS_RECEIVED]++;
 
-            client->counters[SNAPSHOT_CLIENT_COUNTER_PACKETS_RECEIVED]++;
+                snapshot_client_process_packet( client, &client->receive_from[i], client->receive_packet_data[i], client->receive_packet_bytes[i] );
+            }
 
-            snapshot_client_process_packet( client, &from, packet_data, packet_bytes );
+            if ( num_packets < SNAPSHOT_CLIENT_RECEIVE_BATCH_SIZE )
+                break;
         }
     }
 }
@@ -593,6 +827,7 @@ void snapshot_client_send_packet_to_server( struct snapshot_client_t * client, v
                                                    SNAPSHOT_MAX_PACKET_BYTES, 
                                                    client->sequence++, 
                                                    !client->loopback ? client->write_packet_key : NULL,
+                                                   client->cipher_suite,
                                                    client->connect_token.protocol_id,
                                                    &packet_bytes );
 
@@ -610,7 +845,14 @@ void snapshot_client_send_packet_to_server( struct snapshot_client_t * client, v
         else
 #endif // #if SNAPSHOT_DEVELOPMENT
         {
-            snapshot_platform_socket_send_packet( client->socket, &client->server_address, packet_data, packet_bytes );
+            if ( client->io_thread )
+            {
+                snapshot_io_thread_send_packet( client->io_thread, &client->server_address, packet_data, packet_bytes );
+            }
+            else
+            {
+                snapshot_platform_socket_send_packet( client->socket, &client->server_address, packet_data, packet_bytes );
+            }
             client->counters[SNAPSHOT_CLIENT_COUNTER_PACKETS_SENT]++;
         }
     }
@@ -645,6 +887,7 @@ void snapshot_client_send_internal_packets( struct snapshot_client_t * client )
             packet.protocol_id = client->connect_token.protocol_id;
             packet.connect_token_expire_timestamp = client->connect_token.expire_timestamp;
             memcpy( packet.connect_token_nonce, client->connect_token.nonce, SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES );
+            packet.cipher_suite = (uint8_t) client->cipher_suite;
             memcpy( packet.connect_token_data, client->connect_token.private_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
 
             snapshot_client_send_packet_to_server( client, &packet );
@@ -802,6 +1045,34 @@ void snapshot_client_update_state_machine( struct snapshot_client_t * client )
     }
 }
 
+static void snapshot_client_send_payload_fragments( struct snapshot_client_t * client, uint8_t * payload_data, int payload_bytes )
+{
+    // fragments are written and encrypted in place inside the payload, one after the other, so without an io thread
+    // they go to the socket without another copy. the io thread ring copies each one as it is queued
+
+    int num_fragments = 0;
+    struct snapshot_endpoint_fragment_t fragments[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+    snapshot_endpoint_write_fragments( client->endpoint, payload_data, payload_bytes, &num_fragments, &fragments[0] );
+
+    for ( int i = 0; i < num_fragments; i++ )
+    {
+        int packet_bytes = 0;
+
+        uint8_t * packet_data = snapshot_endpoint_fragment_begin( &fragments[i], &packet_bytes );
+
+        void * packet = snapshot_wrap_payload_packet( packet_data, packet_bytes );
+
+        snapshot_client_send_packet_to_server( client, packet );
+
+        snapshot_endpoint_fragment_end( &fragments[i] );
+
+        client->counters[SNAPSHOT_CLIENT_COUNTER_PAYLOAD_PACKETS_SENT]++;
+    }
+
+    client->counters[SNAPSHOT_CLIENT_COUNTER_PAYLOADS_SENT]++;
+}
+
 void snapshot_client_send_payload( struct snapshot_client_t * client )
 {
     snapshot_assert( client );
@@ -815,53 +1086,37 @@ void snapshot_client_send_payload( struct snapshot_client_t * client )
 
     if ( client->development_flags & SNAPSHOT_DEVELOPMENT_FLAG_VALIDATE_PAYLOAD )
     {
-        uint8_t * payload_data = snapshot_create_packet( client->config.context, SNAPSHOT_MAX_PAYLOAD_BYTES );
+        uint8_t * payload_data = snapshot_create_pooled_packet( client->config.context, client->packet_pool, SNAPSHOT_MAX_PAYLOAD_BYTES );
 
         int payload_bytes = 0;
 
         snapshot_generate_packet_data( payload_data, &payload_bytes, SNAPSHOT_MAX_PAYLOAD_BYTES );
 
-        int num_packets = 0;
-        uint8_t * packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
-        int packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
-
-        snapshot_endpoint_write_packets( client->endpoint, payload_data, payload_bytes, &num_packets, &packet_data[0], &packet_bytes[0] );
+        snapshot_client_send_payload_fragments( client, payload_data, payload_bytes );
 
-        if ( num_packets == 1 )
-        {
-            // send whole packet
-
-            struct snapshot_payload_packet_t * packet = snapshot_wrap_payload_packet( packet_data[0], packet_bytes[0] );
+        snapshot_destroy_packet( client->config.context, payload_data );
 
-            snapshot_client_send_packet_to_server( client, packet );
+        return;
+    }
+#endif // #if SNAPSHOT_DEVELOPMENT
 
-            client->counters[SNAPSHOT_CLIENT_COUNTER_PAYLOAD_PACKETS_SENT]++;
-        }
-        else
-        {
-            // send fragments
+    // todo: generate real payload
 
-            for ( int i = 0; i < num_packets; i++ )
-            {
-                struct snapshot_payload_packet_t * packet = snapshot_wrap_payload_packet( packet_data[i], packet_bytes[i] );
+    // acks only travel in payload packet headers, so when nothing else is sent, send a one byte payload
+    // to ack the snapshots received since the last send. the server needs these acks to pick a baseline
 
-                snapshot_client_send_packet_to_server( client, packet );
+    if ( client->snapshot_pending_ack )
+    {
+        uint8_t * payload_data = snapshot_create_pooled_packet( client->config.context, client->packet_pool, 1 );
 
-                client->counters[SNAPSHOT_CLIENT_COUNTER_PAYLOAD_PACKETS_SENT]++;
+        payload_data[0] = 0;
 
-                snapshot_destroy_packet( client->config.context, packet_data[i] );
-            }
-        }
+        snapshot_client_send_payload_fragments( client, payload_data, 1 );
 
         snapshot_destroy_packet( client->config.context, payload_data );
 
-        client->counters[SNAPSHOT_CLIENT_COUNTER_PAYLOADS_SENT]++;
-
-        return;
+        client->snapshot_pending_ack = SNAPSHOT_FALSE;
     }
-#endif // #if SNAPSHOT_DEVELOPMENT
-
-    // todo: generate real payload
 }
 
 void snapshot_client_update( struct snapshot_client_t * client, double time )
@@ -877,6 +1132,15 @@ void snapshot_client_update( struct snapshot_client_t * client, double time )
     snapshot_client_send_internal_packets( client );
 
     snapshot_client_update_state_machine( client );
+
+    if ( client->io_thread )
+    {
+        uint64_t io_counters[SNAPSHOT_IO_THREAD_NUM_COUNTERS];
+        snapshot_io_thread_counters( client->io_thread, io_counters );
+        client->counters[SNAPSHOT_CLIENT_COUNTER_IO_SEND_QUEUE_DEPTH] = snapshot_io_thread_send_queue_depth( client->io_thread );
+        client->counters[SNAPSHOT_CLIENT_COUNTER_IO_RECEIVE_QUEUE_DROPS] = io_counters[SNAPSHOT_IO_THREAD_COUNTER_RECEIVE_QUEUE_DROPS];
+        client->counters[SNAPSHOT_CLIENT_COUNTER_IO_SEND_QUEUE_DROPS] = io_counters[SNAPSHOT_IO_THREAD_COUNTER_SEND_QUEUE_DROPS];
+    }
 }
 
 void snapshot_client_disconnect( struct snapshot_client_t * client )
@@ -1016,8 +1280,29 @@ void snapshot_client_set_development_flags( struct snapshot_client_t * client, u
 
 #endif // #if SNAPSHOT_DEVELOPMENT
 
+const uint8_t * snapshot_client_snapshot( struct snapshot_client_t * client, uint16_t * sequence )
+{
+    snapshot_assert( client );
+
+    if ( !client->has_snapshot )
+        return NULL;
+
+    if ( sequence )
+    {
+        *sequence = client->snapshot_sequence;
+    }
+
+    return snapshot_delta_decoder_find( client->delta_decoder, client->snapshot_sequence );
+}
+
 const uint64_t * snapshot_client_counters( struct snapshot_client_t * client )
 {
     snapshot_assert( client );
     return client->counters;
 }
+
+const uint64_t * snapshot_client_packet_pool_counters( struct snapshot_client_t * client )
+{
+    snapshot_assert( client );
+    return client->packet_pool ? snapshot_packet_pool_counters( client->packet_pool ) : NULL;
+}
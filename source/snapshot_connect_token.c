@@ -22,12 +22,37 @@ int snapshot_generate_connect_token( int num_server_addresses,
                                      const uint8_t * private_key, 
                                      uint8_t * user_data, 
                                      uint8_t * output_buffer )
+{
+    return snapshot_generate_connect_token_with_cipher_suite( num_server_addresses, 
+                                                              server_addresses, 
+                                                              expire_seconds, 
+                                                              timeout_seconds, 
+                                                              client_id, 
+                                                              protocol_id, 
+                                                              private_key, 
+                                                              user_data, 
+                                                              SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, 
+                                                              output_buffer );
+}
+
+int snapshot_generate_connect_token_with_cipher_suite( int num_server_addresses, 
+                                                       const char ** server_addresses, 
+                                                       int expire_seconds, 
+                                                       int timeout_seconds,
+                                                       uint64_t client_id, 
+                                                       uint64_t protocol_id, 
+                                                       const uint8_t * private_key, 
+                                                       uint8_t * user_data, 
+                                                       int cipher_suite,
+                                                       uint8_t * output_buffer )
 {
     snapshot_assert( num_server_addresses > 0 );
     snapshot_assert( num_server_addresses <= SNAPSHOT_MAX_SERVERS_PER_CONNECT );
     snapshot_assert( server_addresses );
     snapshot_assert( private_key );
     snapshot_assert( user_data );
+    snapshot_assert( cipher_suite >= 0 );
+    snapshot_assert( cipher_suite < SNAPSHOT_NUM_CIPHER_SUITES );
     snapshot_assert( output_buffer );
 
     // parse server addresses
@@ -49,6 +74,7 @@ int snapshot_generate_connect_token( int num_server_addresses,
 
     struct snapshot_connect_token_private_t connect_token_private;
     snapshot_generate_connect_token_private( &connect_token_private, client_id, timeout_seconds, num_server_addresses, parsed_server_addresses, user_data );
+    connect_token_private.cipher_suite = (uint8_t) cipher_suite;
 
     // write it to a buffer
 
@@ -76,6 +102,7 @@ int snapshot_generate_connect_token( int num_server_addresses,
         connect_token.server_addresses[i] = parsed_server_addresses[i];
     memcpy( connect_token.client_to_server_key, connect_token_private.client_to_server_key, SNAPSHOT_KEY_BYTES );
     memcpy( connect_token.server_to_client_key, connect_token_private.server_to_client_key, SNAPSHOT_KEY_BYTES );
+    connect_token.cipher_suite = (uint8_t) cipher_suite;
     connect_token.timeout_seconds = timeout_seconds;
 
     // write the connect token to the output buffer
@@ -144,6 +171,8 @@ void snapshot_write_connect_token( struct snapshot_connect_token_t * connect_tok
 
     snapshot_write_bytes( &buffer, connect_token->server_to_client_key, SNAPSHOT_KEY_BYTES );
 
+    snapshot_write_uint8( &buffer, connect_token->cipher_suite );
+
     snapshot_assert( buffer - start <= SNAPSHOT_CONNECT_TOKEN_BYTES );
 
     memset( buffer, 0, SNAPSHOT_CONNECT_TOKEN_BYTES - ( buffer - start ) );
@@ -169,9 +198,10 @@ int snapshot_read_connect_token( const uint8_t * buffer, int buffer_length, stru
          connect_token->version_info[5] != 'H' ||
          connect_token->version_info[6] != 'O' ||
          connect_token->version_info[7] != 'T' ||
-         connect_token->version_info[8] != '\0' )
+         connect_token->version_info[8] != '3' ||
+         connect_token->version_info[9] != '\0' )
     {
-        connect_token->version_info[8] = '\0';
+        connect_token->version_info[9] = '\0';
         snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "read connect data has bad version info (got %s, expected %s)", connect_token->version_info, SNAPSHOT_VERSION_INFO );
         return SNAPSHOT_ERROR;
     }
@@ -231,6 +261,14 @@ int snapshot_read_connect_token( const uint8_t * buffer, int buffer_length, stru
     snapshot_read_bytes( &buffer, connect_token->client_to_server_key, SNAPSHOT_KEY_BYTES );
 
     snapshot_read_bytes( &buffer, connect_token->server_to_client_key, SNAPSHOT_KEY_BYTES );
+
+    connect_token->cipher_suite = snapshot_read_uint8( &buffer );
+
+    if ( connect_token->cipher_suite >= SNAPSHOT_NUM_CIPHER_SUITES )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "read connect data has bad cipher suite (%d)", connect_token->cipher_suite );
+        return SNAPSHOT_ERROR;
+    }
     
     return SNAPSHOT_OK;
 }
@@ -261,6 +299,8 @@ void snapshot_generate_connect_token_private( struct snapshot_connect_token_priv
     snapshot_crypto_random_bytes( connect_token->client_to_server_key, SNAPSHOT_KEY_BYTES );
     snapshot_crypto_random_bytes( connect_token->server_to_client_key, SNAPSHOT_KEY_BYTES );
 
+    connect_token->cipher_suite = SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305;
+
     if ( user_data != NULL )
     {
         memcpy( connect_token->user_data, user_data, SNAPSHOT_USER_DATA_BYTES );
@@ -323,6 +363,8 @@ void snapshot_write_connect_token_private( struct snapshot_connect_token_private
 
     snapshot_write_bytes( &buffer, connect_token->server_to_client_key, SNAPSHOT_KEY_BYTES );
 
+    snapshot_write_uint8( &buffer, connect_token->cipher_suite );
+
     snapshot_write_bytes( &buffer, connect_token->user_data, SNAPSHOT_USER_DATA_BYTES );
 
     snapshot_assert( buffer - start <= SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES - SNAPSHOT_MAC_BYTES );
@@ -431,6 +473,11 @@ int snapshot_read_connect_token_private( const uint8_t * buffer, int buffer_leng
 
     snapshot_read_bytes( &buffer, connect_token->server_to_client_key, SNAPSHOT_KEY_BYTES );
 
+    connect_token->cipher_suite = snapshot_read_uint8( &buffer );
+
+    if ( connect_token->cipher_suite >= SNAPSHOT_NUM_CIPHER_SUITES )
+        return SNAPSHOT_ERROR;
+
     snapshot_read_bytes( &buffer, connect_token->user_data, SNAPSHOT_USER_DATA_BYTES );
 
     return SNAPSHOT_OK;
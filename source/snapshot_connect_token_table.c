@@ -0,0 +1,242 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#include "snapshot_connect_token_table.h"
+
+// ------------------------------------------------------------------------------------------
+
+struct snapshot_connect_token_table_t * snapshot_connect_token_table_create( void * context, int max_entries )
+{
+    snapshot_assert( max_entries > 0 );
+
+    struct snapshot_connect_token_table_t * table = (struct snapshot_connect_token_table_t*) snapshot_malloc( context, sizeof( struct snapshot_connect_token_table_t ) );
+    if ( !table )
+        return NULL;
+
+    memset( table, 0, sizeof( struct snapshot_connect_token_table_t ) );
+
+    table->context = context;
+    table->max_entries = max_entries;
+
+    table->num_slots = 1;
+    while ( table->num_slots < max_entries * 2 )
+    {
+        table->num_slots *= 2;
+    }
+
+    table->slots = (int*) snapshot_malloc( context, table->num_slots * sizeof(int) );
+    table->entries = (struct snapshot_connect_token_entry_t*) snapshot_malloc( context, max_entries * sizeof(struct snapshot_connect_token_entry_t) );
+
+    if ( !table->slots || !table->entries )
+    {
+        snapshot_connect_token_table_destroy( table );
+        return NULL;
+    }
+
+    snapshot_connect_token_table_reset( table );
+
+    return table;
+}
+
+void snapshot_connect_token_table_destroy( struct snapshot_connect_token_table_t * table )
+{
+    snapshot_assert( table );
+
+    void * context = table->context;
+
+    if ( table->slots ) snapshot_free( context, table->slots );
+    if ( table->entries ) snapshot_free( context, table->entries );
+
+    snapshot_free( context, table );
+}
+
+size_t snapshot_connect_token_table_memory_bytes( const struct snapshot_connect_token_table_t * table )
+{
+    snapshot_assert( table );
+
+    return sizeof( struct snapshot_connect_token_table_t ) + 
+           table->max_entries * sizeof( struct snapshot_connect_token_entry_t ) + 
+           table->num_slots * sizeof(int);
+}
+
+void snapshot_connect_token_table_reset( struct snapshot_connect_token_table_t * table )
+{
+    snapshot_assert( table );
+
+    table->num_entries = 0;
+    table->lru_head = -1;
+    table->lru_tail = -1;
+
+    for ( int i = 0; i < table->num_slots; ++i )
+    {
+        table->slots[i] = -1;
+    }
+
+    memset( table->entries, 0, table->max_entries * sizeof( struct snapshot_connect_token_entry_t ) );
+}
+
+// only connect tokens that decrypted with the server private key reach the table, so their macs are uniformly
+// distributed and can't be chosen by an attacker. the first eight bytes of the mac are used as the hash directly.
+
+static int snapshot_connect_token_table_home_slot( const struct snapshot_connect_token_table_t * table, const uint8_t * mac )
+{
+    uint64_t hash;
+    memcpy( &hash, mac, sizeof(hash) );
+    return (int) ( hash & (uint64_t) ( table->num_slots - 1 ) );
+}
+
+static int snapshot_connect_token_table_find( const struct snapshot_connect_token_table_t * table, const uint8_t * mac )
+{
+    const int mask = table->num_slots - 1;
+
+    // there is always at least one empty slot, so the probe sequence is guaranteed to terminate
+
+    int slot = snapshot_connect_token_table_home_slot( table, mac );
+
+    while ( 1 )
+    {
+        const int entry_index = table->slots[slot];
+
+        if ( entry_index == -1 )
+            return -1;
+
+        if ( memcmp( table->entries[entry_index].mac, mac, SNAPSHOT_MAC_BYTES ) == 0 )
+            return entry_index;
+
+        slot = ( slot + 1 ) & mask;
+    }
+}
+
+static void snapshot_connect_token_table_insert( struct snapshot_connect_token_table_t * table, int entry_index )
+{
+    const int mask = table->num_slots - 1;
+
+    int slot = snapshot_connect_token_table_home_slot( table, table->entries[entry_index].mac );
+
+    while ( table->slots[slot] != -1 )
+    {
+        slot = ( slot + 1 ) & mask;
+    }
+
+    table->slots[slot] = entry_index;
+}
+
+static void snapshot_connect_token_table_remove( struct snapshot_connect_token_table_t * table, int entry_index )
+{
+    const int mask = table->num_slots - 1;
+
+    int slot = snapshot_connect_token_table_home_slot( table, table->entries[entry_index].mac );
+
+    while ( table->slots[slot] != entry_index )
+    {
+        snapshot_assert( table->slots[slot] != -1 );
+        slot = ( slot + 1 ) & mask;
+    }
+
+    // backward shift deletion, same as the address index, so lookups never need tombstones
+
+    int hole = slot;
+    int next = slot;
+
+    while ( 1 )
+    {
+        next = ( next + 1 ) & mask;
+
+        if ( table->slots[next] == -1 )
+            break;
+
+        const int home = snapshot_connect_token_table_home_slot( table, table->entries[table->slots[next]].mac );
+
+        const SNAPSHOT_BOOL stays = ( hole <= next ) ? ( home > hole && home <= next ) : ( home > hole || home <= next );
+
+        if ( !stays )
+        {
+            table->slots[hole] = table->slots[next];
+            hole = next;
+        }
+    }
+
+    table->slots[hole] = -1;
+}
+
+static void snapshot_connect_token_table_unlink( struct snapshot_connect_token_table_t * table, int entry_index )
+{
+    struct snapshot_connect_token_entry_t * entry = &table->entries[entry_index];
+
+    if ( entry->prev != -1 )
+        table->entries[entry->prev].next = entry->next;
+    else
+        table->lru_head = entry->next;
+
+    if ( entry->next != -1 )
+        table->entries[entry->next].prev = entry->prev;
+    else
+        table->lru_tail = entry->prev;
+}
+
+static void snapshot_connect_token_table_link_head( struct snapshot_connect_token_table_t * table, int entry_index )
+{
+    struct snapshot_connect_token_entry_t * entry = &table->entries[entry_index];
+
+    entry->prev = -1;
+    entry->next = table->lru_head;
+
+    if ( table->lru_head != -1 )
+        table->entries[table->lru_head].prev = entry_index;
+    else
+        table->lru_tail = entry_index;
+
+    table->lru_head = entry_index;
+}
+
+SNAPSHOT_BOOL snapshot_connect_token_table_find_or_add( struct snapshot_connect_token_table_t * table, const struct snapshot_address_t * address, const uint8_t * mac )
+{
+    snapshot_assert( table );
+    snapshot_assert( address );
+    snapshot_assert( mac );
+
+    int entry_index = snapshot_connect_token_table_find( table, mac );
+
+    if ( entry_index != -1 )
+    {
+        // allow connect tokens we have already seen from the same address, never from a different one
+
+        if ( !snapshot_address_equal( &table->entries[entry_index].address, address ) )
+            return SNAPSHOT_FALSE;
+
+        snapshot_connect_token_table_unlink( table, entry_index );
+        snapshot_connect_token_table_link_head( table, entry_index );
+
+        return SNAPSHOT_TRUE;
+    }
+
+    // this is a new connect token. take a free entry, or evict the least recently used one when the table is full
+
+    if ( table->num_entries < table->max_entries )
+    {
+        entry_index = table->num_entries++;
+    }
+    else
+    {
+        entry_index = table->lru_tail;
+        snapshot_assert( entry_index != -1 );
+        snapshot_connect_token_table_remove( table, entry_index );
+        snapshot_connect_token_table_unlink( table, entry_index );
+    }
+
+    struct snapshot_connect_token_entry_t * entry = &table->entries[entry_index];
+    memcpy( entry->mac, mac, SNAPSHOT_MAC_BYTES );
+    entry->address = *address;
+
+    snapshot_connect_token_table_insert( table, entry_index );
+    snapshot_connect_token_table_link_head( table, entry_index );
+
+    return SNAPSHOT_TRUE;
+}
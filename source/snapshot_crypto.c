@@ -9,6 +9,20 @@
 */
 
 #include "snapshot_crypto.h"
+#include "snapshot_read_write.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SNAPSHOT_CRYPTO_X64 1
+#include <immintrin.h>
+#endif // #if defined(__x86_64__) || defined(_M_X64)
+
+#if SNAPSHOT_CRYPTO_X64 && ( defined(__GNUC__) || defined(__clang__) )
+#define SNAPSHOT_CRYPTO_TARGET_AVX2 __attribute__((target("avx2")))
+#define SNAPSHOT_CRYPTO_TARGET_AESNI __attribute__((target("aes,pclmul,ssse3")))
+#else
+#define SNAPSHOT_CRYPTO_TARGET_AVX2
+#define SNAPSHOT_CRYPTO_TARGET_AESNI
+#endif
 
 #ifdef _MSC_VER
 #pragma warning(disable:4996)
@@ -26,9 +40,58 @@
 #pragma warning(pop)
 #endif
 
+static int crypto_isa = SNAPSHOT_CRYPTO_ISA_REF;
+
+static SNAPSHOT_BOOL crypto_aes256gcm_available;
+
+static void snapshot_crypto_select_batch_kernel( int isa );
+
 int snapshot_crypto_init()
 {
-    return sodium_init();
+    if ( sodium_init() < 0 )
+        return SNAPSHOT_ERROR;
+
+    // sodium has already probed cpuid and pointed its chacha20, poly1305 and blake2b at the best kernels it has.
+    // mirror that choice here, so our own batch kernel follows along and we can report what we ended up with
+
+    if ( sodium_runtime_has_avx2() )
+    {
+        crypto_isa = SNAPSHOT_CRYPTO_ISA_AVX2;
+    }
+    else if ( sodium_runtime_has_ssse3() )
+    {
+        crypto_isa = SNAPSHOT_CRYPTO_ISA_SSSE3;
+    }
+    else
+    {
+        crypto_isa = SNAPSHOT_CRYPTO_ISA_REF;
+    }
+
+    snapshot_crypto_select_batch_kernel( crypto_isa );
+
+#if SNAPSHOT_CRYPTO_X64
+    crypto_aes256gcm_available = sodium_runtime_has_aesni() && sodium_runtime_has_pclmul() && sodium_runtime_has_ssse3();
+#endif // #if SNAPSHOT_CRYPTO_X64
+
+    snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "crypto isa is %s%s", snapshot_crypto_isa_string( crypto_isa ), crypto_aes256gcm_available ? " (aes-ni)" : "" );
+
+    return SNAPSHOT_OK;
+}
+
+int snapshot_crypto_isa()
+{
+    return crypto_isa;
+}
+
+const char * snapshot_crypto_isa_string( int isa )
+{
+    switch ( isa )
+    {
+        case SNAPSHOT_CRYPTO_ISA_REF:       return "ref";
+        case SNAPSHOT_CRYPTO_ISA_SSSE3:     return "ssse3";
+        case SNAPSHOT_CRYPTO_ISA_AVX2:      return "avx2";
+        default:                            return "???";
+    }
 }
 
 void snapshot_crypto_random_bytes( uint8_t * buffer, int bytes )
@@ -232,3 +295,748 @@ int snapshot_crypto_decrypt_aead_bignonce( uint8_t * message, uint64_t message_l
 
     return SNAPSHOT_OK;
 }
+
+// ------------------------------------------------------------------------------------------
+
+// batch aead. chacha20 blocks from many independent (key, nonce, counter) streams are computed side by side, one lane each,
+// so short packets that only need one or two blocks still fill the whole vector. poly1305 runs per packet through sodium.
+
+#define SNAPSHOT_CRYPTO_AEAD_BATCH_MAX_ITEMS                    64
+#define SNAPSHOT_CRYPTO_AEAD_BATCH_STREAM_BYTES                256
+
+struct snapshot_crypto_chacha20_lanes_t
+{
+    int num_lanes;
+    uint32_t input[16][SNAPSHOT_CRYPTO_AEAD_BATCH_LANES];
+    uint8_t * output[SNAPSHOT_CRYPTO_AEAD_BATCH_LANES];
+    int output_bytes[SNAPSHOT_CRYPTO_AEAD_BATCH_LANES];
+    uint8_t output_xor[SNAPSHOT_CRYPTO_AEAD_BATCH_LANES];
+};
+
+#if SNAPSHOT_CRYPTO_X64
+
+SNAPSHOT_CRYPTO_TARGET_AVX2 static inline __m256i snapshot_crypto_rotl_avx2( __m256i x, int bits )
+{
+    return _mm256_or_si256( _mm256_slli_epi32( x, bits ), _mm256_srli_epi32( x, 32 - bits ) );
+}
+
+#define SNAPSHOT_CHACHA20_QUARTER_ROUND_AVX2( a, b, c, d )                                     \
+    x[a] = _mm256_add_epi32( x[a], x[b] ); x[d] = _mm256_shuffle_epi8( _mm256_xor_si256( x[d], x[a] ), rot16 );   \
+    x[c] = _mm256_add_epi32( x[c], x[d] ); x[b] = snapshot_crypto_rotl_avx2( _mm256_xor_si256( x[b], x[c] ), 12 ); \
+    x[a] = _mm256_add_epi32( x[a], x[b] ); x[d] = _mm256_shuffle_epi8( _mm256_xor_si256( x[d], x[a] ), rot8 );    \
+    x[c] = _mm256_add_epi32( x[c], x[d] ); x[b] = snapshot_crypto_rotl_avx2( _mm256_xor_si256( x[b], x[c] ), 7 );
+
+SNAPSHOT_CRYPTO_TARGET_AVX2 static inline void snapshot_crypto_transpose_avx2( const __m256i * x, uint8_t keystream[SNAPSHOT_CRYPTO_AEAD_BATCH_LANES][64], int offset )
+{
+    // 8x8 transpose, so each lane's words end up next to each other, ready to store as keystream bytes
+
+    const __m256i t0 = _mm256_unpacklo_epi32( x[0], x[1] );
+    const __m256i t1 = _mm256_unpackhi_epi32( x[0], x[1] );
+    const __m256i t2 = _mm256_unpacklo_epi32( x[2], x[3] );
+    const __m256i t3 = _mm256_unpackhi_epi32( x[2], x[3] );
+    const __m256i t4 = _mm256_unpacklo_epi32( x[4], x[5] );
+    const __m256i t5 = _mm256_unpackhi_epi32( x[4], x[5] );
+    const __m256i t6 = _mm256_unpacklo_epi32( x[6], x[7] );
+    const __m256i t7 = _mm256_unpackhi_epi32( x[6], x[7] );
+
+    const __m256i u0 = _mm256_unpacklo_epi64( t0, t2 );
+    const __m256i u1 = _mm256_unpackhi_epi64( t0, t2 );
+    const __m256i u2 = _mm256_unpacklo_epi64( t1, t3 );
+    const __m256i u3 = _mm256_unpackhi_epi64( t1, t3 );
+    const __m256i u4 = _mm256_unpacklo_epi64( t4, t6 );
+    const __m256i u5 = _mm256_unpackhi_epi64( t4, t6 );
+    const __m256i u6 = _mm256_unpacklo_epi64( t5, t7 );
+    const __m256i u7 = _mm256_unpackhi_epi64( t5, t7 );
+
+    _mm256_storeu_si256( (__m256i*) ( keystream[0] + offset ), _mm256_permute2x128_si256( u0, u4, 0x20 ) );
+    _mm256_storeu_si256( (__m256i*) ( keystream[1] + offset ), _mm256_permute2x128_si256( u1, u5, 0x20 ) );
+    _mm256_storeu_si256( (__m256i*) ( keystream[2] + offset ), _mm256_permute2x128_si256( u2, u6, 0x20 ) );
+    _mm256_storeu_si256( (__m256i*) ( keystream[3] + offset ), _mm256_permute2x128_si256( u3, u7, 0x20 ) );
+    _mm256_storeu_si256( (__m256i*) ( keystream[4] + offset ), _mm256_permute2x128_si256( u0, u4, 0x31 ) );
+    _mm256_storeu_si256( (__m256i*) ( keystream[5] + offset ), _mm256_permute2x128_si256( u1, u5, 0x31 ) );
+    _mm256_storeu_si256( (__m256i*) ( keystream[6] + offset ), _mm256_permute2x128_si256( u2, u6, 0x31 ) );
+    _mm256_storeu_si256( (__m256i*) ( keystream[7] + offset ), _mm256_permute2x128_si256( u3, u7, 0x31 ) );
+}
+
+SNAPSHOT_CRYPTO_TARGET_AVX2 static void snapshot_crypto_chacha20_lanes_blocks_avx2( const uint32_t input[16][SNAPSHOT_CRYPTO_AEAD_BATCH_LANES], uint8_t keystream[SNAPSHOT_CRYPTO_AEAD_BATCH_LANES][64] )
+{
+    const __m256i rot16 = _mm256_set_epi8( 13,12,15,14, 9,8,11,10, 5,4,7,6, 1,0,3,2, 13,12,15,14, 9,8,11,10, 5,4,7,6, 1,0,3,2 );
+    const __m256i rot8 = _mm256_set_epi8( 14,13,12,15, 10,9,8,11, 6,5,4,7, 2,1,0,3, 14,13,12,15, 10,9,8,11, 6,5,4,7, 2,1,0,3 );
+
+    __m256i x[16];
+    for ( int i = 0; i < 16; i++ )
+    {
+        x[i] = _mm256_loadu_si256( (const __m256i*) input[i] );
+    }
+
+    for ( int i = 0; i < 10; i++ )
+    {
+        SNAPSHOT_CHACHA20_QUARTER_ROUND_AVX2( 0, 4,  8, 12 );
+        SNAPSHOT_CHACHA20_QUARTER_ROUND_AVX2( 1, 5,  9, 13 );
+        SNAPSHOT_CHACHA20_QUARTER_ROUND_AVX2( 2, 6, 10, 14 );
+        SNAPSHOT_CHACHA20_QUARTER_ROUND_AVX2( 3, 7, 11, 15 );
+        SNAPSHOT_CHACHA20_QUARTER_ROUND_AVX2( 0, 5, 10, 15 );
+        SNAPSHOT_CHACHA20_QUARTER_ROUND_AVX2( 1, 6, 11, 12 );
+        SNAPSHOT_CHACHA20_QUARTER_ROUND_AVX2( 2, 7,  8, 13 );
+        SNAPSHOT_CHACHA20_QUARTER_ROUND_AVX2( 3, 4,  9, 14 );
+    }
+
+    for ( int i = 0; i < 16; i++ )
+    {
+        x[i] = _mm256_add_epi32( x[i], _mm256_loadu_si256( (const __m256i*) input[i] ) );
+    }
+
+    snapshot_crypto_transpose_avx2( x, keystream, 0 );
+    snapshot_crypto_transpose_avx2( x + 8, keystream, 32 );
+}
+
+#endif // #if SNAPSHOT_CRYPTO_X64
+
+// portable version. every step is a loop across the lanes, which compilers turn into vector code for whatever isa they target
+
+static inline void snapshot_crypto_chacha20_lanes_quarter_round( uint32_t * a, uint32_t * b, uint32_t * c, uint32_t * d )
+{
+    for ( int i = 0; i < SNAPSHOT_CRYPTO_AEAD_BATCH_LANES; i++ )
+    {
+        a[i] += b[i]; d[i] ^= a[i]; d[i] = ( d[i] << 16 ) | ( d[i] >> 16 );
+        c[i] += d[i]; b[i] ^= c[i]; b[i] = ( b[i] << 12 ) | ( b[i] >> 20 );
+        a[i] += b[i]; d[i] ^= a[i]; d[i] = ( d[i] << 8 ) | ( d[i] >> 24 );
+        c[i] += d[i]; b[i] ^= c[i]; b[i] = ( b[i] << 7 ) | ( b[i] >> 25 );
+    }
+}
+
+static void snapshot_crypto_chacha20_lanes_blocks_ref( const uint32_t input[16][SNAPSHOT_CRYPTO_AEAD_BATCH_LANES], uint8_t keystream[SNAPSHOT_CRYPTO_AEAD_BATCH_LANES][64] )
+{
+    uint32_t output[16][SNAPSHOT_CRYPTO_AEAD_BATCH_LANES];
+
+    memcpy( output, input, sizeof( output ) );
+
+    for ( int i = 0; i < 10; i++ )
+    {
+        snapshot_crypto_chacha20_lanes_quarter_round( output[0], output[4], output[8],  output[12] );
+        snapshot_crypto_chacha20_lanes_quarter_round( output[1], output[5], output[9],  output[13] );
+        snapshot_crypto_chacha20_lanes_quarter_round( output[2], output[6], output[10], output[14] );
+        snapshot_crypto_chacha20_lanes_quarter_round( output[3], output[7], output[11], output[15] );
+        snapshot_crypto_chacha20_lanes_quarter_round( output[0], output[5], output[10], output[15] );
+        snapshot_crypto_chacha20_lanes_quarter_round( output[1], output[6], output[11], output[12] );
+        snapshot_crypto_chacha20_lanes_quarter_round( output[2], output[7], output[8],  output[13] );
+        snapshot_crypto_chacha20_lanes_quarter_round( output[3], output[4], output[9],  output[14] );
+    }
+
+    for ( int i = 0; i < SNAPSHOT_CRYPTO_AEAD_BATCH_LANES; i++ )
+    {
+        uint8_t * p = keystream[i];
+        for ( int j = 0; j < 16; j++ )
+        {
+            snapshot_write_uint32( &p, output[j][i] + input[j][i] );
+        }
+    }
+}
+
+static void (*snapshot_crypto_chacha20_lanes_blocks)( const uint32_t input[16][SNAPSHOT_CRYPTO_AEAD_BATCH_LANES], uint8_t keystream[SNAPSHOT_CRYPTO_AEAD_BATCH_LANES][64] ) = snapshot_crypto_chacha20_lanes_blocks_ref;
+
+static void snapshot_crypto_select_batch_kernel( int isa )
+{
+    snapshot_crypto_chacha20_lanes_blocks = snapshot_crypto_chacha20_lanes_blocks_ref;
+
+#if SNAPSHOT_CRYPTO_X64
+    if ( isa == SNAPSHOT_CRYPTO_ISA_AVX2 )
+    {
+        snapshot_crypto_chacha20_lanes_blocks = snapshot_crypto_chacha20_lanes_blocks_avx2;
+    }
+#else // #if SNAPSHOT_CRYPTO_X64
+    (void) isa;
+#endif // #if SNAPSHOT_CRYPTO_X64
+}
+
+#if SNAPSHOT_DEVELOPMENT
+
+void snapshot_crypto_force_batch_isa( int isa )
+{
+    snapshot_assert( isa >= SNAPSHOT_CRYPTO_ISA_REF );
+    snapshot_assert( isa <= crypto_isa );
+    snapshot_crypto_select_batch_kernel( isa );
+}
+
+void snapshot_crypto_force_aes256gcm_available( SNAPSHOT_BOOL available )
+{
+    snapshot_assert( !available || ( sodium_runtime_has_aesni() && sodium_runtime_has_pclmul() && sodium_runtime_has_ssse3() ) );
+    crypto_aes256gcm_available = available;
+}
+
+#endif // #if SNAPSHOT_DEVELOPMENT
+
+static void snapshot_crypto_chacha20_lanes_flush( struct snapshot_crypto_chacha20_lanes_t * lanes )
+{
+    if ( lanes->num_lanes == 0 )
+        return;
+
+    uint8_t keystream[SNAPSHOT_CRYPTO_AEAD_BATCH_LANES][64];
+
+    snapshot_crypto_chacha20_lanes_blocks( lanes->input, keystream );
+
+    for ( int i = 0; i < lanes->num_lanes; i++ )
+    {
+        uint8_t * output = lanes->output[i];
+        const int output_bytes = lanes->output_bytes[i];
+
+        if ( lanes->output_xor[i] )
+        {
+            int j = 0;
+            for ( ; j + 8 <= output_bytes; j += 8 )
+            {
+                uint64_t a, b;
+                memcpy( &a, output + j, 8 );
+                memcpy( &b, keystream[i] + j, 8 );
+                a ^= b;
+                memcpy( output + j, &a, 8 );
+            }
+            for ( ; j < output_bytes; j++ )
+            {
+                output[j] ^= keystream[i][j];
+            }
+        }
+        else
+        {
+            memcpy( output, keystream[i], output_bytes );
+        }
+    }
+
+    sodium_memzero( keystream, sizeof( keystream ) );
+
+    lanes->num_lanes = 0;
+}
+
+static void snapshot_crypto_chacha20_lanes_add( struct snapshot_crypto_chacha20_lanes_t * lanes, const uint8_t * key, const uint8_t * nonce, uint32_t counter, uint8_t * output, int output_bytes, uint8_t output_xor )
+{
+    snapshot_assert( output_bytes > 0 );
+    snapshot_assert( output_bytes <= 64 );
+
+    const int lane = lanes->num_lanes++;
+
+    const uint8_t * k = key;
+    const uint8_t * n = nonce;
+
+    lanes->input[0][lane] = 0x61707865;
+    lanes->input[1][lane] = 0x3320646e;
+    lanes->input[2][lane] = 0x79622d32;
+    lanes->input[3][lane] = 0x6b206574;
+    for ( int i = 4; i < 12; i++ )
+    {
+        lanes->input[i][lane] = snapshot_read_uint32( &k );
+    }
+    lanes->input[12][lane] = counter;
+    for ( int i = 13; i < 16; i++ )
+    {
+        lanes->input[i][lane] = snapshot_read_uint32( &n );
+    }
+
+    lanes->output[lane] = output;
+    lanes->output_bytes[lane] = output_bytes;
+    lanes->output_xor[lane] = output_xor;
+
+    if ( lanes->num_lanes == SNAPSHOT_CRYPTO_AEAD_BATCH_LANES )
+    {
+        snapshot_crypto_chacha20_lanes_flush( lanes );
+    }
+}
+
+static void snapshot_crypto_chacha20_lanes_xor( struct snapshot_crypto_chacha20_lanes_t * lanes, const uint8_t * key, const uint8_t * nonce, uint8_t * data, uint64_t data_bytes )
+{
+    // ietf aead: block 0 is the poly1305 key, data starts at block 1
+
+    if ( data_bytes > SNAPSHOT_CRYPTO_AEAD_BATCH_STREAM_BYTES && crypto_isa != SNAPSHOT_CRYPTO_ISA_REF )
+    {
+        // long enough to fill sodium's simd kernel on its own, so going across lanes buys nothing
+        crypto_stream_chacha20_ietf_xor_ic( data, data, data_bytes, nonce, 1, key );
+        return;
+    }
+
+    uint32_t counter = 1;
+
+    while ( data_bytes > 0 )
+    {
+        const int block_bytes = data_bytes < 64 ? (int) data_bytes : 64;
+        snapshot_crypto_chacha20_lanes_add( lanes, key, nonce, counter++, data, block_bytes, 1 );
+        data += block_bytes;
+        data_bytes -= block_bytes;
+    }
+}
+
+static void snapshot_crypto_aead_batch_mac( const struct snapshot_crypto_aead_batch_item_t * item, const uint8_t * poly1305_key, const uint8_t * ciphertext, uint64_t ciphertext_length, uint8_t * mac )
+{
+    static const uint8_t zero[16] = { 0 };
+
+    crypto_onetimeauth_poly1305_state state;
+    crypto_onetimeauth_poly1305_init( &state, poly1305_key );
+    crypto_onetimeauth_poly1305_update( &state, item->additional, item->additional_length );
+    crypto_onetimeauth_poly1305_update( &state, zero, ( 0x10 - item->additional_length ) & 0xF );
+    crypto_onetimeauth_poly1305_update( &state, ciphertext, ciphertext_length );
+    crypto_onetimeauth_poly1305_update( &state, zero, ( 0x10 - ciphertext_length ) & 0xF );
+
+    uint8_t lengths[16];
+    uint8_t * p = lengths;
+    snapshot_write_uint64( &p, item->additional_length );
+    snapshot_write_uint64( &p, ciphertext_length );
+    crypto_onetimeauth_poly1305_update( &state, lengths, sizeof( lengths ) );
+
+    crypto_onetimeauth_poly1305_final( &state, mac );
+
+    sodium_memzero( &state, sizeof( state ) );
+}
+
+void snapshot_crypto_encrypt_aead_batch( struct snapshot_crypto_aead_batch_item_t * items, int num_items )
+{
+    snapshot_assert( items || num_items == 0 );
+
+    uint8_t poly1305_key[SNAPSHOT_CRYPTO_AEAD_BATCH_MAX_ITEMS][32];
+
+    struct snapshot_crypto_chacha20_lanes_t lanes;
+    lanes.num_lanes = 0;
+
+    for ( int base = 0; base < num_items; base += SNAPSHOT_CRYPTO_AEAD_BATCH_MAX_ITEMS )
+    {
+        const int count = ( num_items - base < SNAPSHOT_CRYPTO_AEAD_BATCH_MAX_ITEMS ) ? num_items - base : SNAPSHOT_CRYPTO_AEAD_BATCH_MAX_ITEMS;
+
+        struct snapshot_crypto_aead_batch_item_t * batch = items + base;
+
+        // poly1305 keys and keystream for every packet, all going through the same lanes
+
+        for ( int i = 0; i < count; i++ )
+        {
+            snapshot_crypto_chacha20_lanes_add( &lanes, batch[i].key, batch[i].nonce, 0, poly1305_key[i], 32, 0 );
+            snapshot_crypto_chacha20_lanes_xor( &lanes, batch[i].key, batch[i].nonce, batch[i].message, batch[i].message_length );
+        }
+
+        snapshot_crypto_chacha20_lanes_flush( &lanes );
+
+        // mac goes right after the ciphertext, same as snapshot_crypto_encrypt_aead
+
+        for ( int i = 0; i < count; i++ )
+        {
+            snapshot_crypto_aead_batch_mac( &batch[i], poly1305_key[i], batch[i].message, batch[i].message_length, batch[i].message + batch[i].message_length );
+            batch[i].result = SNAPSHOT_OK;
+        }
+    }
+
+    sodium_memzero( poly1305_key, sizeof( poly1305_key ) );
+    sodium_memzero( &lanes, sizeof( lanes ) );
+}
+
+void snapshot_crypto_decrypt_aead_batch( struct snapshot_crypto_aead_batch_item_t * items, int num_items )
+{
+    snapshot_assert( items || num_items == 0 );
+
+    uint8_t poly1305_key[SNAPSHOT_CRYPTO_AEAD_BATCH_MAX_ITEMS][32];
+
+    struct snapshot_crypto_chacha20_lanes_t lanes;
+    lanes.num_lanes = 0;
+
+    for ( int base = 0; base < num_items; base += SNAPSHOT_CRYPTO_AEAD_BATCH_MAX_ITEMS )
+    {
+        const int count = ( num_items - base < SNAPSHOT_CRYPTO_AEAD_BATCH_MAX_ITEMS ) ? num_items - base : SNAPSHOT_CRYPTO_AEAD_BATCH_MAX_ITEMS;
+
+        struct snapshot_crypto_aead_batch_item_t * batch = items + base;
+
+        // poly1305 keys first. packets are only decrypted once their mac checks out, and are left untouched if it doesn't
+
+        for ( int i = 0; i < count; i++ )
+        {
+            snapshot_crypto_chacha20_lanes_add( &lanes, batch[i].key, batch[i].nonce, 0, poly1305_key[i], 32, 0 );
+        }
+
+        snapshot_crypto_chacha20_lanes_flush( &lanes );
+
+        for ( int i = 0; i < count; i++ )
+        {
+            batch[i].result = SNAPSHOT_ERROR;
+
+            if ( batch[i].message_length < SNAPSHOT_MAC_BYTES )
+                continue;
+
+            const uint64_t ciphertext_length = batch[i].message_length - SNAPSHOT_MAC_BYTES;
+
+            uint8_t mac[SNAPSHOT_MAC_BYTES];
+
+            snapshot_crypto_aead_batch_mac( &batch[i], poly1305_key[i], batch[i].message, ciphertext_length, mac );
+
+            if ( crypto_verify_16( mac, batch[i].message + ciphertext_length ) != 0 )
+                continue;
+
+            batch[i].result = SNAPSHOT_OK;
+
+            snapshot_crypto_chacha20_lanes_xor( &lanes, batch[i].key, batch[i].nonce, batch[i].message, ciphertext_length );
+        }
+
+        snapshot_crypto_chacha20_lanes_flush( &lanes );
+    }
+
+    sodium_memzero( poly1305_key, sizeof( poly1305_key ) );
+    sodium_memzero( &lanes, sizeof( lanes ) );
+}
+
+// ------------------------------------------------------------------------------------------
+
+// aes-256-gcm. aes-ni for the block cipher and pclmulqdq for ghash, so it is only offered on cpus that have both.
+// ghash runs on byte reflected blocks, which also puts the 32 bit ctr counter in the low lane where it is a plain add.
+
+SNAPSHOT_BOOL snapshot_crypto_aes256gcm_available()
+{
+    return crypto_aes256gcm_available;
+}
+
+#if SNAPSHOT_CRYPTO_X64
+
+struct snapshot_crypto_aes256gcm_t
+{
+    __m128i round_key[15];
+    __m128i h[4];
+    __m128i counter;
+    __m128i tag_mask;
+};
+
+#define SNAPSHOT_AES256_EXPAND_EVEN( index, rcon )                                                         \
+    {                                                                                                       \
+        __m128i t = _mm_shuffle_epi32( _mm_aeskeygenassist_si128( key[index-1], rcon ), 0xFF );            \
+        __m128i k = key[index-2];                                                                           \
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 4 ) );                                                     \
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 8 ) );                                                     \
+        key[index] = _mm_xor_si128( k, t );                                                                 \
+    }
+
+#define SNAPSHOT_AES256_EXPAND_ODD( index )                                                                 \
+    {                                                                                                       \
+        __m128i t = _mm_shuffle_epi32( _mm_aeskeygenassist_si128( key[index-1], 0x00 ), 0xAA );            \
+        __m128i k = key[index-2];                                                                           \
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 4 ) );                                                     \
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 8 ) );                                                     \
+        key[index] = _mm_xor_si128( k, t );                                                                 \
+    }
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static inline __m128i snapshot_crypto_aes256_encrypt_block( const __m128i * key, __m128i block )
+{
+    block = _mm_xor_si128( block, key[0] );
+    for ( int i = 1; i < 14; i++ )
+    {
+        block = _mm_aesenc_si128( block, key[i] );
+    }
+    return _mm_aesenclast_si128( block, key[14] );
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static inline void snapshot_crypto_ghash_multiply( __m128i a, __m128i b, __m128i * lo, __m128i * hi )
+{
+    // 256 bit carry-less product, accumulated into lo/hi so several products can share one reduction
+
+    const __m128i t0 = _mm_clmulepi64_si128( a, b, 0x00 );
+    const __m128i t1 = _mm_xor_si128( _mm_clmulepi64_si128( a, b, 0x10 ), _mm_clmulepi64_si128( a, b, 0x01 ) );
+    const __m128i t2 = _mm_clmulepi64_si128( a, b, 0x11 );
+
+    *lo = _mm_xor_si128( *lo, _mm_xor_si128( t0, _mm_slli_si128( t1, 8 ) ) );
+    *hi = _mm_xor_si128( *hi, _mm_xor_si128( t2, _mm_srli_si128( t1, 8 ) ) );
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static inline __m128i snapshot_crypto_ghash_reduce( __m128i lo, __m128i hi )
+{
+    // shift left by one for the reflected representation, then reduce modulo x^128 + x^7 + x^2 + x + 1
+
+    __m128i a = _mm_srli_epi32( lo, 31 );
+    __m128i b = _mm_srli_epi32( hi, 31 );
+    lo = _mm_slli_epi32( lo, 1 );
+    hi = _mm_slli_epi32( hi, 1 );
+    const __m128i c = _mm_srli_si128( a, 12 );
+    b = _mm_slli_si128( b, 4 );
+    a = _mm_slli_si128( a, 4 );
+    lo = _mm_or_si128( lo, a );
+    hi = _mm_or_si128( _mm_or_si128( hi, b ), c );
+
+    a = _mm_xor_si128( _mm_xor_si128( _mm_slli_epi32( lo, 31 ), _mm_slli_epi32( lo, 30 ) ), _mm_slli_epi32( lo, 25 ) );
+    b = _mm_srli_si128( a, 4 );
+    lo = _mm_xor_si128( lo, _mm_slli_si128( a, 12 ) );
+
+    __m128i d = _mm_xor_si128( _mm_xor_si128( _mm_srli_epi32( lo, 1 ), _mm_srli_epi32( lo, 2 ) ), _mm_srli_epi32( lo, 7 ) );
+    d = _mm_xor_si128( d, b );
+    lo = _mm_xor_si128( lo, d );
+
+    return _mm_xor_si128( hi, lo );
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static inline __m128i snapshot_crypto_ghash_block( const struct snapshot_crypto_aes256gcm_t * gcm, __m128i x, __m128i block )
+{
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    snapshot_crypto_ghash_multiply( _mm_xor_si128( x, block ), gcm->h[0], &lo, &hi );
+    return snapshot_crypto_ghash_reduce( lo, hi );
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static inline __m128i snapshot_crypto_ghash_blocks4( const struct snapshot_crypto_aes256gcm_t * gcm, __m128i x, const __m128i * block )
+{
+    // x = ( x + b0 ) * h^4 + b1 * h^3 + b2 * h^2 + b3 * h, with a single reduction at the end
+
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    snapshot_crypto_ghash_multiply( _mm_xor_si128( x, block[0] ), gcm->h[3], &lo, &hi );
+    snapshot_crypto_ghash_multiply( block[1], gcm->h[2], &lo, &hi );
+    snapshot_crypto_ghash_multiply( block[2], gcm->h[1], &lo, &hi );
+    snapshot_crypto_ghash_multiply( block[3], gcm->h[0], &lo, &hi );
+    return snapshot_crypto_ghash_reduce( lo, hi );
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static inline __m128i snapshot_crypto_ghash_bytes( const struct snapshot_crypto_aes256gcm_t * gcm, __m128i x, const uint8_t * data, uint64_t bytes )
+{
+    const __m128i reflect = _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+
+    while ( bytes >= 64 )
+    {
+        __m128i block[4];
+        for ( int i = 0; i < 4; i++ )
+        {
+            block[i] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*) ( data + i * 16 ) ), reflect );
+        }
+        x = snapshot_crypto_ghash_blocks4( gcm, x, block );
+        data += 64;
+        bytes -= 64;
+    }
+
+    while ( bytes > 0 )
+    {
+        uint8_t buffer[16];
+        const int block_bytes = bytes < 16 ? (int) bytes : 16;
+        memset( buffer, 0, sizeof( buffer ) );
+        memcpy( buffer, data, block_bytes );
+        x = snapshot_crypto_ghash_block( gcm, x, _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*) buffer ), reflect ) );
+        data += block_bytes;
+        bytes -= block_bytes;
+    }
+
+    return x;
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static void snapshot_crypto_aes256gcm_init( struct snapshot_crypto_aes256gcm_t * gcm, const uint8_t * nonce, const uint8_t * key_data )
+{
+    const __m128i reflect = _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+
+    __m128i * key = gcm->round_key;
+
+    key[0] = _mm_loadu_si128( (const __m128i*) key_data );
+    key[1] = _mm_loadu_si128( (const __m128i*) ( key_data + 16 ) );
+
+    SNAPSHOT_AES256_EXPAND_EVEN( 2, 0x01 );
+    SNAPSHOT_AES256_EXPAND_ODD( 3 );
+    SNAPSHOT_AES256_EXPAND_EVEN( 4, 0x02 );
+    SNAPSHOT_AES256_EXPAND_ODD( 5 );
+    SNAPSHOT_AES256_EXPAND_EVEN( 6, 0x04 );
+    SNAPSHOT_AES256_EXPAND_ODD( 7 );
+    SNAPSHOT_AES256_EXPAND_EVEN( 8, 0x08 );
+    SNAPSHOT_AES256_EXPAND_ODD( 9 );
+    SNAPSHOT_AES256_EXPAND_EVEN( 10, 0x10 );
+    SNAPSHOT_AES256_EXPAND_ODD( 11 );
+    SNAPSHOT_AES256_EXPAND_EVEN( 12, 0x20 );
+    SNAPSHOT_AES256_EXPAND_ODD( 13 );
+    SNAPSHOT_AES256_EXPAND_EVEN( 14, 0x40 );
+
+    // h = E(0), and its powers up to h^4 for the four block ghash
+
+    gcm->h[0] = _mm_shuffle_epi8( snapshot_crypto_aes256_encrypt_block( key, _mm_setzero_si128() ), reflect );
+    for ( int i = 1; i < 4; i++ )
+    {
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        snapshot_crypto_ghash_multiply( gcm->h[i-1], gcm->h[0], &lo, &hi );
+        gcm->h[i] = snapshot_crypto_ghash_reduce( lo, hi );
+    }
+
+    // j0 = nonce || 1. E(j0) masks the tag and the data counter starts at j0 + 1
+
+    uint8_t j0[16];
+    memcpy( j0, nonce, 12 );
+    j0[12] = 0;
+    j0[13] = 0;
+    j0[14] = 0;
+    j0[15] = 1;
+
+    const __m128i j0_block = _mm_loadu_si128( (const __m128i*) j0 );
+
+    gcm->tag_mask = snapshot_crypto_aes256_encrypt_block( key, j0_block );
+    gcm->counter = _mm_add_epi32( _mm_shuffle_epi8( j0_block, reflect ), _mm_set_epi32( 0, 0, 0, 1 ) );
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static void snapshot_crypto_aes256gcm_ctr( struct snapshot_crypto_aes256gcm_t * gcm, uint8_t * data, uint64_t bytes, __m128i * ghash, SNAPSHOT_BOOL encrypt )
+{
+    // ctr mode in place, four blocks at a time so the aes rounds pipeline. when encrypting, ghash follows along over the ciphertext
+
+    const __m128i reflect = _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+    const __m128i one = _mm_set_epi32( 0, 0, 0, 1 );
+    const __m128i * key = gcm->round_key;
+
+    __m128i x = *ghash;
+
+    while ( bytes >= 64 )
+    {
+        __m128i block[4];
+        for ( int i = 0; i < 4; i++ )
+        {
+            block[i] = _mm_xor_si128( _mm_shuffle_epi8( gcm->counter, reflect ), key[0] );
+            gcm->counter = _mm_add_epi32( gcm->counter, one );
+        }
+        for ( int r = 1; r < 14; r++ )
+        {
+            for ( int i = 0; i < 4; i++ )
+            {
+                block[i] = _mm_aesenc_si128( block[i], key[r] );
+            }
+        }
+        for ( int i = 0; i < 4; i++ )
+        {
+            block[i] = _mm_xor_si128( _mm_aesenclast_si128( block[i], key[14] ), _mm_loadu_si128( (const __m128i*) ( data + i * 16 ) ) );
+            _mm_storeu_si128( (__m128i*) ( data + i * 16 ), block[i] );
+        }
+        if ( encrypt )
+        {
+            for ( int i = 0; i < 4; i++ )
+            {
+                block[i] = _mm_shuffle_epi8( block[i], reflect );
+            }
+            x = snapshot_crypto_ghash_blocks4( gcm, x, block );
+        }
+        data += 64;
+        bytes -= 64;
+    }
+
+    while ( bytes > 0 )
+    {
+        const int block_bytes = bytes < 16 ? (int) bytes : 16;
+        uint8_t buffer[16];
+        memset( buffer, 0, sizeof( buffer ) );
+        memcpy( buffer, data, block_bytes );
+        __m128i block = snapshot_crypto_aes256_encrypt_block( key, _mm_shuffle_epi8( gcm->counter, reflect ) );
+        gcm->counter = _mm_add_epi32( gcm->counter, one );
+        block = _mm_xor_si128( block, _mm_loadu_si128( (const __m128i*) buffer ) );
+        _mm_storeu_si128( (__m128i*) buffer, block );
+        memcpy( data, buffer, block_bytes );
+        if ( encrypt )
+        {
+            // the bytes past the end of a partial block must be zero for ghash
+            memset( buffer + block_bytes, 0, 16 - block_bytes );
+            x = snapshot_crypto_ghash_block( gcm, x, _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*) buffer ), reflect ) );
+        }
+        data += block_bytes;
+        bytes -= block_bytes;
+    }
+
+    *ghash = x;
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static void snapshot_crypto_aes256gcm_tag( struct snapshot_crypto_aes256gcm_t * gcm, __m128i x, uint64_t additional_length, uint64_t message_length, uint8_t * tag )
+{
+    const __m128i reflect = _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+    const __m128i lengths = _mm_set_epi64x( (long long) ( additional_length * 8 ), (long long) ( message_length * 8 ) );
+    x = snapshot_crypto_ghash_block( gcm, x, lengths );
+    _mm_storeu_si128( (__m128i*) tag, _mm_xor_si128( _mm_shuffle_epi8( x, reflect ), gcm->tag_mask ) );
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static int snapshot_crypto_aes256gcm_encrypt( uint8_t * message, uint64_t message_length, const uint8_t * additional, uint64_t additional_length, const uint8_t * nonce, const uint8_t * key )
+{
+    struct snapshot_crypto_aes256gcm_t gcm;
+    snapshot_crypto_aes256gcm_init( &gcm, nonce, key );
+
+    __m128i x = snapshot_crypto_ghash_bytes( &gcm, _mm_setzero_si128(), additional, additional_length );
+
+    snapshot_crypto_aes256gcm_ctr( &gcm, message, message_length, &x, SNAPSHOT_TRUE );
+
+    snapshot_crypto_aes256gcm_tag( &gcm, x, additional_length, message_length, message + message_length );
+
+    sodium_memzero( &gcm, sizeof( gcm ) );
+
+    return SNAPSHOT_OK;
+}
+
+SNAPSHOT_CRYPTO_TARGET_AESNI static int snapshot_crypto_aes256gcm_decrypt( uint8_t * message, uint64_t message_length, const uint8_t * additional, uint64_t additional_length, const uint8_t * nonce, const uint8_t * key )
+{
+    if ( message_length < SNAPSHOT_MAC_BYTES )
+        return SNAPSHOT_ERROR;
+
+    const uint64_t ciphertext_length = message_length - SNAPSHOT_MAC_BYTES;
+
+    struct snapshot_crypto_aes256gcm_t gcm;
+    snapshot_crypto_aes256gcm_init( &gcm, nonce, key );
+
+    // verify first, so a packet that fails is left exactly as it came in
+
+    __m128i x = snapshot_crypto_ghash_bytes( &gcm, _mm_setzero_si128(), additional, additional_length );
+    x = snapshot_crypto_ghash_bytes( &gcm, x, message, ciphertext_length );
+
+    uint8_t tag[SNAPSHOT_MAC_BYTES];
+    snapshot_crypto_aes256gcm_tag( &gcm, x, additional_length, ciphertext_length, tag );
+
+    int result = SNAPSHOT_ERROR;
+
+    if ( crypto_verify_16( tag, message + ciphertext_length ) == 0 )
+    {
+        snapshot_crypto_aes256gcm_ctr( &gcm, message, ciphertext_length, &x, SNAPSHOT_FALSE );
+        result = SNAPSHOT_OK;
+    }
+
+    sodium_memzero( &gcm, sizeof( gcm ) );
+
+    return result;
+}
+
+#endif // #if SNAPSHOT_CRYPTO_X64
+
+int snapshot_crypto_encrypt_aead_aes256gcm( uint8_t * message, uint64_t message_length, 
+                                            const uint8_t * additional, uint64_t additional_length,
+                                            const uint8_t * nonce,
+                                            const uint8_t * key )
+{
+    snapshot_assert( message );
+    snapshot_assert( additional || additional_length == 0 );
+    snapshot_assert( nonce );
+    snapshot_assert( key );
+
+#if SNAPSHOT_CRYPTO_X64
+    if ( crypto_aes256gcm_available )
+    {
+        return snapshot_crypto_aes256gcm_encrypt( message, message_length, additional, additional_length, nonce, key );
+    }
+#endif // #if SNAPSHOT_CRYPTO_X64
+
+    return SNAPSHOT_ERROR;
+}
+
+int snapshot_crypto_decrypt_aead_aes256gcm( uint8_t * message, uint64_t message_length, 
+                                            const uint8_t * additional, uint64_t additional_length,
+                                            const uint8_t * nonce,
+                                            const uint8_t * key )
+{
+    snapshot_assert( message );
+    snapshot_assert( additional || additional_length == 0 );
+    snapshot_assert( nonce );
+    snapshot_assert( key );
+
+#if SNAPSHOT_CRYPTO_X64
+    if ( crypto_aes256gcm_available )
+    {
+        return snapshot_crypto_aes256gcm_decrypt( message, message_length, additional, additional_length, nonce, key );
+    }
+#endif // #if SNAPSHOT_CRYPTO_X64
+
+    return SNAPSHOT_ERROR;
+}
+
+int snapshot_crypto_select_cipher_suite( int requested_cipher_suite )
+{
+    if ( requested_cipher_suite == SNAPSHOT_CIPHER_SUITE_AES256GCM && crypto_aes256gcm_available )
+        return SNAPSHOT_CIPHER_SUITE_AES256GCM;
+
+    return SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305;
+}
+
+const char * snapshot_cipher_suite_string( int cipher_suite )
+{
+    switch ( cipher_suite )
+    {
+        case SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305:    return "chacha20poly1305";
+        case SNAPSHOT_CIPHER_SUITE_AES256GCM:           return "aes256gcm";
+        default:                                        return "???";
+    }
+}
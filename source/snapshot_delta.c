@@ -0,0 +1,505 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+
+#include "snapshot_delta.h"
+#include "snapshot_bitpacker.h"
+#include "snapshot_read_write.h"
+#include "snapshot_packed_sequence_buffer.h"
+#include "snapshot_util.h"
+
+// -----------------------------------------------------------------------------------------
+
+#define SNAPSHOT_DELTA_FIELDS_PER_GROUP                                    32
+
+static const int snapshot_delta_class_bits[] = { 4, 8, 16, 32 };
+
+static int snapshot_delta_num_fields( int snapshot_bytes )
+{
+    return snapshot_bytes / 4;
+}
+
+static int snapshot_delta_num_groups( int snapshot_bytes )
+{
+    return ( snapshot_delta_num_fields( snapshot_bytes ) + SNAPSHOT_DELTA_FIELDS_PER_GROUP - 1 ) / SNAPSHOT_DELTA_FIELDS_PER_GROUP;
+}
+
+static int snapshot_delta_scratch_bytes( int snapshot_bytes )
+{
+    // worst case for a delta: encoding and baseline sequence, every group changed, every field changed and 32 bits wide
+
+    const int bits = 2 + 16 + snapshot_delta_num_groups( snapshot_bytes ) * ( 1 + SNAPSHOT_DELTA_FIELDS_PER_GROUP ) + snapshot_delta_num_fields( snapshot_bytes ) * ( 1 + 2 + 32 );
+    return ( ( bits + 31 ) / 32 ) * 4;
+}
+
+static uint32_t snapshot_delta_read_field( const uint8_t * snapshot_data, int index )
+{
+    const uint8_t * p = snapshot_data + index * 4;
+    return snapshot_read_uint32( &p );
+}
+
+static void snapshot_delta_write_field( uint8_t * snapshot_data, int index, uint32_t value )
+{
+    uint8_t * p = snapshot_data + index * 4;
+    snapshot_write_uint32( &p, value );
+}
+
+int snapshot_delta_max_bytes( int snapshot_bytes )
+{
+    // the encoder never sends more than a byte for the encoding followed by the raw snapshot
+
+    return 1 + snapshot_bytes;
+}
+
+// -----------------------------------------------------------------------------------------
+
+struct snapshot_delta_encoder_t
+{
+    void * context;
+    int snapshot_bytes;
+    int scratch_bytes;
+    SNAPSHOT_BOOL has_baseline;
+    uint16_t baseline_sequence;
+    struct snapshot_packed_sequence_buffer_t * history;
+    uint8_t * zero_snapshot;
+    uint32_t * scratch;
+};
+
+struct snapshot_delta_encoder_t * snapshot_delta_encoder_create( void * context, int snapshot_bytes, int history_size )
+{
+    snapshot_assert( snapshot_bytes > 0 );
+    snapshot_assert( ( snapshot_bytes % 4 ) == 0 );
+    snapshot_assert( history_size > 0 );
+    snapshot_assert( ( history_size & ( history_size - 1 ) ) == 0 );
+
+    struct snapshot_delta_encoder_t * encoder = (struct snapshot_delta_encoder_t*) snapshot_malloc( context, sizeof( struct snapshot_delta_encoder_t ) );
+    if ( !encoder )
+        return NULL;
+
+    memset( encoder, 0, sizeof( struct snapshot_delta_encoder_t ) );
+
+    encoder->context = context;
+    encoder->snapshot_bytes = snapshot_bytes;
+    encoder->scratch_bytes = snapshot_delta_scratch_bytes( snapshot_bytes );
+    encoder->history = snapshot_packed_sequence_buffer_create( context, history_size, snapshot_bytes );
+    encoder->zero_snapshot = (uint8_t*) snapshot_malloc( context, snapshot_bytes );
+    encoder->scratch = (uint32_t*) snapshot_malloc( context, encoder->scratch_bytes );
+
+    if ( !encoder->history || !encoder->zero_snapshot || !encoder->scratch )
+    {
+        snapshot_delta_encoder_destroy( encoder );
+        return NULL;
+    }
+
+    memset( encoder->zero_snapshot, 0, snapshot_bytes );
+
+    return encoder;
+}
+
+void snapshot_delta_encoder_destroy( struct snapshot_delta_encoder_t * encoder )
+{
+    snapshot_assert( encoder );
+
+    if ( encoder->history )
+    {
+        snapshot_packed_sequence_buffer_destroy( encoder->history );
+    }
+
+    if ( encoder->zero_snapshot )
+    {
+        snapshot_free( encoder->context, encoder->zero_snapshot );
+    }
+
+    if ( encoder->scratch )
+    {
+        snapshot_free( encoder->context, encoder->scratch );
+    }
+
+    snapshot_free( encoder->context, encoder );
+}
+
+void snapshot_delta_encoder_reset( struct snapshot_delta_encoder_t * encoder )
+{
+    snapshot_assert( encoder );
+    encoder->has_baseline = SNAPSHOT_FALSE;
+    encoder->baseline_sequence = 0;
+    snapshot_packed_sequence_buffer_reset( encoder->history );
+}
+
+size_t snapshot_delta_encoder_memory_bytes( const struct snapshot_delta_encoder_t * encoder )
+{
+    snapshot_assert( encoder );
+    return sizeof( struct snapshot_delta_encoder_t ) + 
+           snapshot_packed_sequence_buffer_memory_bytes( encoder->history->num_entries, encoder->snapshot_bytes ) + 
+           encoder->snapshot_bytes + 
+           encoder->scratch_bytes;
+}
+
+void snapshot_delta_encoder_process_acks( struct snapshot_delta_encoder_t * encoder, const uint16_t * acks, int num_acks )
+{
+    snapshot_assert( encoder );
+    snapshot_assert( acks || num_acks == 0 );
+
+    for ( int i = 0; i < num_acks; i++ )
+    {
+        if ( !snapshot_packed_sequence_buffer_exists( encoder->history, acks[i] ) )
+            continue;
+
+        if ( !encoder->has_baseline || snapshot_sequence_greater_than( acks[i], encoder->baseline_sequence ) )
+        {
+            encoder->has_baseline = SNAPSHOT_TRUE;
+            encoder->baseline_sequence = acks[i];
+        }
+    }
+}
+
+static void snapshot_delta_write_fields( struct snapshot_bitwriter_t * writer, int snapshot_bytes, const uint8_t * baseline_data, const uint8_t * snapshot_data )
+{
+    const int num_fields = snapshot_delta_num_fields( snapshot_bytes );
+
+    for ( int group_start = 0; group_start < num_fields; group_start += SNAPSHOT_DELTA_FIELDS_PER_GROUP )
+    {
+        int group_end = group_start + SNAPSHOT_DELTA_FIELDS_PER_GROUP;
+        if ( group_end > num_fields )
+            group_end = num_fields;
+
+        const int group_offset = group_start * 4;
+        const int group_bytes = ( group_end - group_start ) * 4;
+
+        if ( memcmp( baseline_data + group_offset, snapshot_data + group_offset, group_bytes ) == 0 )
+        {
+            snapshot_bitwriter_write_bits( writer, 0, 1 );
+            continue;
+        }
+
+        snapshot_bitwriter_write_bits( writer, 1, 1 );
+
+        // write the changed mask for the whole group at once, then only visit the fields that changed
+
+        uint32_t changed_mask = 0;
+        for ( int i = group_start; i < group_end; i++ )
+        {
+            if ( snapshot_delta_read_field( baseline_data, i ) != snapshot_delta_read_field( snapshot_data, i ) )
+            {
+                changed_mask |= 1U << ( i - group_start );
+            }
+        }
+
+        snapshot_bitwriter_write_bits( writer, changed_mask, group_end - group_start );
+
+        while ( changed_mask )
+        {
+            const int i = group_start + snapshot_trailing_zeros_uint64( changed_mask );
+            changed_mask &= changed_mask - 1;
+
+            const uint32_t baseline = snapshot_delta_read_field( baseline_data, i );
+            const uint32_t current = snapshot_delta_read_field( snapshot_data, i );
+
+            // counters and positions move by small amounts, flags and bit fields flip a few bits. send whichever is smaller
+
+            const int32_t difference = (int32_t) ( current - baseline );
+            const uint32_t arithmetic = ( (uint32_t) difference << 1 ) ^ (uint32_t) ( difference >> 31 );
+            const uint32_t exclusive = current ^ baseline;
+
+            const int arithmetic_bits = snapshot_bits_required( 0, arithmetic );
+            const int exclusive_bits = snapshot_bits_required( 0, exclusive );
+
+            const uint32_t use_xor = ( exclusive_bits < arithmetic_bits ) ? 1 : 0;
+            const uint32_t value = use_xor ? exclusive : arithmetic;
+            const int value_bits = use_xor ? exclusive_bits : arithmetic_bits;
+
+            uint32_t value_class = 0;
+            while ( snapshot_delta_class_bits[value_class] < value_bits )
+            {
+                value_class++;
+            }
+
+            // xor flag in the low bit, then the value class
+
+            snapshot_bitwriter_write_bits( writer, use_xor | ( value_class << 1 ), 3 );
+            snapshot_bitwriter_write_bits( writer, value, snapshot_delta_class_bits[value_class] );
+        }
+    }
+}
+
+const uint8_t * snapshot_delta_encoder_write( struct snapshot_delta_encoder_t * encoder, uint16_t sequence, const uint8_t * snapshot_data, int * out_bytes, int * out_encoding )
+{
+    snapshot_assert( encoder );
+    snapshot_assert( snapshot_data );
+    snapshot_assert( out_bytes );
+
+    const uint8_t * baseline_data = encoder->has_baseline ? (const uint8_t*) snapshot_packed_sequence_buffer_find( encoder->history, encoder->baseline_sequence ) : NULL;
+
+    int encoding = baseline_data ? SNAPSHOT_DELTA_ENCODING_DELTA : SNAPSHOT_DELTA_ENCODING_KEYFRAME;
+
+    struct snapshot_bitwriter_t writer;
+    snapshot_bitwriter_init( &writer, encoder->scratch, encoder->scratch_bytes );
+
+    snapshot_bitwriter_write_bits( &writer, encoding, 2 );
+
+    if ( encoding == SNAPSHOT_DELTA_ENCODING_DELTA )
+    {
+        snapshot_bitwriter_write_bits( &writer, encoder->baseline_sequence, 16 );
+    }
+    else
+    {
+        baseline_data = encoder->zero_snapshot;
+    }
+
+    snapshot_delta_write_fields( &writer, encoder->snapshot_bytes, baseline_data, snapshot_data );
+
+    snapshot_bitwriter_flush_bits( &writer );
+
+    if ( snapshot_bitwriter_get_bytes_written( &writer ) > snapshot_delta_max_bytes( encoder->snapshot_bytes ) )
+    {
+        encoding = SNAPSHOT_DELTA_ENCODING_RAW;
+        snapshot_bitwriter_init( &writer, encoder->scratch, encoder->scratch_bytes );
+        snapshot_bitwriter_write_bits( &writer, encoding, 2 );
+        snapshot_bitwriter_write_align( &writer );
+        snapshot_bitwriter_write_bytes( &writer, snapshot_data, encoder->snapshot_bytes );
+        snapshot_bitwriter_flush_bits( &writer );
+    }
+
+    // remember what was sent, so it can become the baseline once it is acked
+
+    uint8_t * entry = (uint8_t*) snapshot_packed_sequence_buffer_insert( encoder->history, sequence );
+    if ( entry )
+    {
+        memcpy( entry, snapshot_data, encoder->snapshot_bytes );
+    }
+
+    *out_bytes = snapshot_bitwriter_get_bytes_written( &writer );
+
+    if ( out_encoding )
+    {
+        *out_encoding = encoding;
+    }
+
+    return (const uint8_t*) encoder->scratch;
+}
+
+// -----------------------------------------------------------------------------------------
+
+struct snapshot_delta_decoder_t
+{
+    void * context;
+    int snapshot_bytes;
+    int scratch_bytes;
+    struct snapshot_packed_sequence_buffer_t * history;
+    uint8_t * zero_snapshot;
+    uint8_t * snapshot;
+    uint32_t * scratch;
+};
+
+struct snapshot_delta_decoder_t * snapshot_delta_decoder_create( void * context, int snapshot_bytes, int history_size )
+{
+    snapshot_assert( snapshot_bytes > 0 );
+    snapshot_assert( ( snapshot_bytes % 4 ) == 0 );
+    snapshot_assert( history_size > 0 );
+    snapshot_assert( ( history_size & ( history_size - 1 ) ) == 0 );
+
+    struct snapshot_delta_decoder_t * decoder = (struct snapshot_delta_decoder_t*) snapshot_malloc( context, sizeof( struct snapshot_delta_decoder_t ) );
+    if ( !decoder )
+        return NULL;
+
+    memset( decoder, 0, sizeof( struct snapshot_delta_decoder_t ) );
+
+    decoder->context = context;
+    decoder->snapshot_bytes = snapshot_bytes;
+    decoder->scratch_bytes = snapshot_delta_scratch_bytes( snapshot_bytes );
+    decoder->history = snapshot_packed_sequence_buffer_create( context, history_size, snapshot_bytes );
+    decoder->zero_snapshot = (uint8_t*) snapshot_malloc( context, snapshot_bytes );
+    decoder->snapshot = (uint8_t*) snapshot_malloc( context, snapshot_bytes );
+    decoder->scratch = (uint32_t*) snapshot_malloc( context, decoder->scratch_bytes );
+
+    if ( !decoder->history || !decoder->zero_snapshot || !decoder->snapshot || !decoder->scratch )
+    {
+        snapshot_delta_decoder_destroy( decoder );
+        return NULL;
+    }
+
+    memset( decoder->zero_snapshot, 0, snapshot_bytes );
+
+    return decoder;
+}
+
+void snapshot_delta_decoder_destroy( struct snapshot_delta_decoder_t * decoder )
+{
+    snapshot_assert( decoder );
+
+    if ( decoder->history )
+    {
+        snapshot_packed_sequence_buffer_destroy( decoder->history );
+    }
+
+    if ( decoder->zero_snapshot )
+    {
+        snapshot_free( decoder->context, decoder->zero_snapshot );
+    }
+
+    if ( decoder->snapshot )
+    {
+        snapshot_free( decoder->context, decoder->snapshot );
+    }
+
+    if ( decoder->scratch )
+    {
+        snapshot_free( decoder->context, decoder->scratch );
+    }
+
+    snapshot_free( decoder->context, decoder );
+}
+
+void snapshot_delta_decoder_reset( struct snapshot_delta_decoder_t * decoder )
+{
+    snapshot_assert( decoder );
+    snapshot_packed_sequence_buffer_reset( decoder->history );
+}
+
+size_t snapshot_delta_decoder_memory_bytes( const struct snapshot_delta_decoder_t * decoder )
+{
+    snapshot_assert( decoder );
+    return sizeof( struct snapshot_delta_decoder_t ) + 
+           snapshot_packed_sequence_buffer_memory_bytes( decoder->history->num_entries, decoder->snapshot_bytes ) + 
+           decoder->snapshot_bytes * 2 + 
+           decoder->scratch_bytes;
+}
+
+static int snapshot_delta_read_fields( struct snapshot_bitreader_t * reader, int snapshot_bytes, const uint8_t * baseline_data, uint8_t * snapshot_data )
+{
+    const int num_fields = snapshot_delta_num_fields( snapshot_bytes );
+
+    memcpy( snapshot_data, baseline_data, snapshot_bytes );
+
+    for ( int group_start = 0; group_start < num_fields; group_start += SNAPSHOT_DELTA_FIELDS_PER_GROUP )
+    {
+        int group_end = group_start + SNAPSHOT_DELTA_FIELDS_PER_GROUP;
+        if ( group_end > num_fields )
+            group_end = num_fields;
+
+        if ( snapshot_bitreader_would_read_past_end( reader, 1 ) )
+            return SNAPSHOT_ERROR;
+
+        if ( !snapshot_bitreader_read_bits( reader, 1 ) )
+            continue;
+
+        if ( snapshot_bitreader_would_read_past_end( reader, group_end - group_start ) )
+            return SNAPSHOT_ERROR;
+
+        uint32_t changed_mask = snapshot_bitreader_read_bits( reader, group_end - group_start );
+
+        while ( changed_mask )
+        {
+            const int i = group_start + snapshot_trailing_zeros_uint64( changed_mask );
+            changed_mask &= changed_mask - 1;
+
+            if ( snapshot_bitreader_would_read_past_end( reader, 3 ) )
+                return SNAPSHOT_ERROR;
+
+            const uint32_t field_header = snapshot_bitreader_read_bits( reader, 3 );
+            const uint32_t use_xor = field_header & 1;
+            const int value_bits = snapshot_delta_class_bits[field_header >> 1];
+
+            if ( snapshot_bitreader_would_read_past_end( reader, value_bits ) )
+                return SNAPSHOT_ERROR;
+
+            const uint32_t value = snapshot_bitreader_read_bits( reader, value_bits );
+
+            const uint32_t baseline = snapshot_delta_read_field( baseline_data, i );
+
+            uint32_t current;
+            if ( use_xor )
+            {
+                current = baseline ^ value;
+            }
+            else
+            {
+                const uint32_t difference = ( value >> 1 ) ^ ( 0 - ( value & 1 ) );
+                current = baseline + difference;
+            }
+
+            snapshot_delta_write_field( snapshot_data, i, current );
+        }
+    }
+
+    return SNAPSHOT_OK;
+}
+
+int snapshot_delta_decoder_read( struct snapshot_delta_decoder_t * decoder, uint16_t sequence, const uint8_t * data, int bytes )
+{
+    snapshot_assert( decoder );
+    snapshot_assert( data );
+
+    if ( bytes <= 0 || bytes > decoder->scratch_bytes )
+        return SNAPSHOT_ERROR;
+
+    // the bit reader reads whole words, so read from a padded copy
+
+    memcpy( decoder->scratch, data, bytes );
+    memset( ( (uint8_t*) decoder->scratch ) + bytes, 0, decoder->scratch_bytes - bytes );
+
+    struct snapshot_bitreader_t reader;
+    snapshot_bitreader_init( &reader, decoder->scratch, bytes );
+
+    if ( snapshot_bitreader_would_read_past_end( &reader, 2 ) )
+        return SNAPSHOT_ERROR;
+
+    const int encoding = (int) snapshot_bitreader_read_bits( &reader, 2 );
+
+    if ( encoding == SNAPSHOT_DELTA_ENCODING_RAW )
+    {
+        if ( !snapshot_bitreader_read_align( &reader ) )
+            return SNAPSHOT_ERROR;
+
+        if ( snapshot_bitreader_would_read_past_end( &reader, decoder->snapshot_bytes * 8 ) )
+            return SNAPSHOT_ERROR;
+
+        snapshot_bitreader_read_bytes( &reader, decoder->snapshot, decoder->snapshot_bytes );
+    }
+    else if ( encoding == SNAPSHOT_DELTA_ENCODING_KEYFRAME || encoding == SNAPSHOT_DELTA_ENCODING_DELTA )
+    {
+        const uint8_t * baseline_data = decoder->zero_snapshot;
+
+        if ( encoding == SNAPSHOT_DELTA_ENCODING_DELTA )
+        {
+            if ( snapshot_bitreader_would_read_past_end( &reader, 16 ) )
+                return SNAPSHOT_ERROR;
+
+            const uint16_t baseline_sequence = (uint16_t) snapshot_bitreader_read_bits( &reader, 16 );
+
+            baseline_data = (const uint8_t*) snapshot_packed_sequence_buffer_find( decoder->history, baseline_sequence );
+            if ( !baseline_data )
+                return SNAPSHOT_ERROR;
+        }
+
+        if ( snapshot_delta_read_fields( &reader, decoder->snapshot_bytes, baseline_data, decoder->snapshot ) != SNAPSHOT_OK )
+            return SNAPSHOT_ERROR;
+    }
+    else
+    {
+        return SNAPSHOT_ERROR;
+    }
+
+    // decode first and store after, so a snapshot can replace the baseline it was decoded against
+
+    uint8_t * entry = (uint8_t*) snapshot_packed_sequence_buffer_insert( decoder->history, sequence );
+    if ( !entry )
+        return SNAPSHOT_ERROR;
+
+    memcpy( entry, decoder->snapshot, decoder->snapshot_bytes );
+
+    return SNAPSHOT_OK;
+}
+
+const uint8_t * snapshot_delta_decoder_find( struct snapshot_delta_decoder_t * decoder, uint16_t sequence )
+{
+    snapshot_assert( decoder );
+    return (const uint8_t*) snapshot_packed_sequence_buffer_find( decoder->history, sequence );
+}
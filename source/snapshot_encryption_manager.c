@@ -10,6 +10,84 @@
 
 #include "snapshot_encryption_manager.h"
 
+struct snapshot_encryption_manager_t * snapshot_encryption_manager_create( void * context, int max_encryption_mappings )
+{
+    snapshot_assert( max_encryption_mappings > 0 );
+
+    struct snapshot_encryption_manager_t * encryption_manager = (struct snapshot_encryption_manager_t*) snapshot_malloc( context, sizeof( struct snapshot_encryption_manager_t ) );
+    if ( !encryption_manager )
+        return NULL;
+
+    memset( encryption_manager, 0, sizeof( struct snapshot_encryption_manager_t ) );
+
+    encryption_manager->context = context;
+    encryption_manager->max_encryption_mappings = max_encryption_mappings;
+
+    encryption_manager->num_address_index_slots = 1;
+    while ( encryption_manager->num_address_index_slots < max_encryption_mappings * 2 )
+    {
+        encryption_manager->num_address_index_slots *= 2;
+    }
+
+    encryption_manager->timeout = (int*) snapshot_malloc( context, max_encryption_mappings * sizeof(int) );
+    encryption_manager->expire_time = (double*) snapshot_malloc( context, max_encryption_mappings * sizeof(double) );
+    encryption_manager->last_access_time = (double*) snapshot_malloc( context, max_encryption_mappings * sizeof(double) );
+    encryption_manager->address = (struct snapshot_address_t*) snapshot_malloc( context, max_encryption_mappings * sizeof(struct snapshot_address_t) );
+    encryption_manager->client_index = (int*) snapshot_malloc( context, max_encryption_mappings * sizeof(int) );
+    encryption_manager->send_key = (uint8_t*) snapshot_malloc( context, max_encryption_mappings * SNAPSHOT_KEY_BYTES );
+    encryption_manager->receive_key = (uint8_t*) snapshot_malloc( context, max_encryption_mappings * SNAPSHOT_KEY_BYTES );
+    encryption_manager->cipher_suite = (int*) snapshot_malloc( context, max_encryption_mappings * sizeof(int) );
+    encryption_manager->address_index_slots = (int*) snapshot_malloc( context, encryption_manager->num_address_index_slots * sizeof(int) );
+
+    if ( !encryption_manager->timeout || 
+         !encryption_manager->expire_time || 
+         !encryption_manager->last_access_time || 
+         !encryption_manager->address || 
+         !encryption_manager->client_index || 
+         !encryption_manager->send_key || 
+         !encryption_manager->receive_key || 
+         !encryption_manager->cipher_suite || 
+         !encryption_manager->address_index_slots )
+    {
+        snapshot_encryption_manager_destroy( encryption_manager );
+        return NULL;
+    }
+
+    snapshot_encryption_manager_reset( encryption_manager );
+
+    return encryption_manager;
+}
+
+void snapshot_encryption_manager_destroy( struct snapshot_encryption_manager_t * encryption_manager )
+{
+    snapshot_assert( encryption_manager );
+
+    void * context = encryption_manager->context;
+
+    if ( encryption_manager->timeout ) snapshot_free( context, encryption_manager->timeout );
+    if ( encryption_manager->expire_time ) snapshot_free( context, encryption_manager->expire_time );
+    if ( encryption_manager->last_access_time ) snapshot_free( context, encryption_manager->last_access_time );
+    if ( encryption_manager->address ) snapshot_free( context, encryption_manager->address );
+    if ( encryption_manager->client_index ) snapshot_free( context, encryption_manager->client_index );
+    if ( encryption_manager->send_key ) snapshot_free( context, encryption_manager->send_key );
+    if ( encryption_manager->receive_key ) snapshot_free( context, encryption_manager->receive_key );
+    if ( encryption_manager->cipher_suite ) snapshot_free( context, encryption_manager->cipher_suite );
+    if ( encryption_manager->address_index_slots ) snapshot_free( context, encryption_manager->address_index_slots );
+
+    snapshot_free( context, encryption_manager );
+}
+
+size_t snapshot_encryption_manager_memory_bytes( const struct snapshot_encryption_manager_t * encryption_manager )
+{
+    snapshot_assert( encryption_manager );
+
+    const size_t bytes_per_mapping = sizeof(int) + sizeof(double) + sizeof(double) + sizeof(struct snapshot_address_t) + sizeof(int) + SNAPSHOT_KEY_BYTES * 2 + sizeof(int);
+
+    return sizeof( struct snapshot_encryption_manager_t ) + 
+           encryption_manager->max_encryption_mappings * bytes_per_mapping + 
+           encryption_manager->num_address_index_slots * sizeof(int);
+}
+
 void snapshot_encryption_manager_reset( struct snapshot_encryption_manager_t * encryption_manager )
 {
     snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "reset encryption manager" );
@@ -19,17 +97,20 @@ void snapshot_encryption_manager_reset( struct snapshot_encryption_manager_t * e
     encryption_manager->num_encryption_mappings = 0;
     
     int i;
-    for ( i = 0; i < SNAPSHOT_MAX_ENCRYPTION_MAPPINGS; ++i )
+    for ( i = 0; i < encryption_manager->max_encryption_mappings; ++i )
     {
         encryption_manager->client_index[i] = -1;
         encryption_manager->expire_time[i] = -1.0;
         encryption_manager->last_access_time[i] = -1000.0;
+        encryption_manager->cipher_suite[i] = SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305;
         memset( &encryption_manager->address[i], 0, sizeof( struct snapshot_address_t ) );
     }
 
-    memset( encryption_manager->timeout, 0, sizeof( encryption_manager->timeout ) );    
-    memset( encryption_manager->send_key, 0, sizeof( encryption_manager->send_key ) );
-    memset( encryption_manager->receive_key, 0, sizeof( encryption_manager->receive_key ) );
+    memset( encryption_manager->timeout, 0, encryption_manager->max_encryption_mappings * sizeof(int) );    
+    memset( encryption_manager->send_key, 0, encryption_manager->max_encryption_mappings * SNAPSHOT_KEY_BYTES );
+    memset( encryption_manager->receive_key, 0, encryption_manager->max_encryption_mappings * SNAPSHOT_KEY_BYTES );
+
+    snapshot_address_index_init( &encryption_manager->address_index, encryption_manager->address_index_slots, encryption_manager->num_address_index_slots, encryption_manager->address );
 }
 
 int snapshot_encryption_manager_entry_expired( struct snapshot_encryption_manager_t * encryption_manager, int index, double time )
@@ -38,6 +119,26 @@ int snapshot_encryption_manager_entry_expired( struct snapshot_encryption_manage
            ( encryption_manager->expire_time[index] >= 0.0 && encryption_manager->expire_time[index] < time );
 }
 
+static int snapshot_encryption_manager_find_index( struct snapshot_encryption_manager_t * encryption_manager, const struct snapshot_address_t * address, double time, SNAPSHOT_BOOL include_expired )
+{
+    // expired entries may linger with the same address as a live one, so pick the lowest index just like a linear scan would
+
+    int result = -1;
+    int iterator = -1;
+    int index;
+    while ( ( index = snapshot_address_index_find_next( &encryption_manager->address_index, address, &iterator ) ) != -1 )
+    {
+        if ( index >= encryption_manager->num_encryption_mappings )
+            continue;
+        if ( result != -1 && index > result )
+            continue;
+        if ( !include_expired && snapshot_encryption_manager_entry_expired( encryption_manager, index, time ) )
+            continue;
+        result = index;
+    }
+    return result;
+}
+
 int snapshot_encryption_manager_add_encryption_mapping( struct snapshot_encryption_manager_t * encryption_manager, 
                                                         const struct snapshot_address_t * address, 
                                                         uint8_t * send_key, 
@@ -46,31 +147,35 @@ int snapshot_encryption_manager_add_encryption_mapping( struct snapshot_encrypti
                                                         double expire_time,
                                                         int timeout )
 {
-    int i;
-    for ( i = 0; i < encryption_manager->num_encryption_mappings; ++i )
+    int i = snapshot_encryption_manager_find_index( encryption_manager, address, time, SNAPSHOT_FALSE );
+    if ( i != -1 )
     {
-        if ( snapshot_address_equal( &encryption_manager->address[i], address ) && !snapshot_encryption_manager_entry_expired( encryption_manager, i, time ) )
-        {
-            encryption_manager->timeout[i] = timeout;
-            encryption_manager->expire_time[i] = expire_time;
-            encryption_manager->last_access_time[i] = time;
-            memcpy( encryption_manager->send_key + i * SNAPSHOT_KEY_BYTES, send_key, SNAPSHOT_KEY_BYTES );
-            memcpy( encryption_manager->receive_key + i * SNAPSHOT_KEY_BYTES, receive_key, SNAPSHOT_KEY_BYTES );
-            return 1;
-        }
+        encryption_manager->timeout[i] = timeout;
+        encryption_manager->expire_time[i] = expire_time;
+        encryption_manager->last_access_time[i] = time;
+        memcpy( encryption_manager->send_key + i * SNAPSHOT_KEY_BYTES, send_key, SNAPSHOT_KEY_BYTES );
+        memcpy( encryption_manager->receive_key + i * SNAPSHOT_KEY_BYTES, receive_key, SNAPSHOT_KEY_BYTES );
+        encryption_manager->cipher_suite[i] = SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305;
+        return 1;
     }
 
-    for ( i = 0; i < SNAPSHOT_MAX_ENCRYPTION_MAPPINGS; ++i )
+    for ( i = 0; i < encryption_manager->max_encryption_mappings; ++i )
     {
         if ( encryption_manager->address[i].type == SNAPSHOT_ADDRESS_NONE || 
             ( snapshot_encryption_manager_entry_expired( encryption_manager, i, time ) && encryption_manager->client_index[i] == -1 ) )
         {
+            if ( encryption_manager->address[i].type != SNAPSHOT_ADDRESS_NONE )
+            {
+                snapshot_address_index_remove( &encryption_manager->address_index, i );
+            }
             encryption_manager->timeout[i] = timeout;
             encryption_manager->address[i] = *address;
+            snapshot_address_index_insert( &encryption_manager->address_index, i );
             encryption_manager->expire_time[i] = expire_time;
             encryption_manager->last_access_time[i] = time;
             memcpy( encryption_manager->send_key + i * SNAPSHOT_KEY_BYTES, send_key, SNAPSHOT_KEY_BYTES );
             memcpy( encryption_manager->receive_key + i * SNAPSHOT_KEY_BYTES, receive_key, SNAPSHOT_KEY_BYTES );
+            encryption_manager->cipher_suite[i] = SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305;
             if ( i + 1 > encryption_manager->num_encryption_mappings )
                 encryption_manager->num_encryption_mappings = i + 1;
             return 1;
@@ -85,34 +190,37 @@ int snapshot_encryption_manager_remove_encryption_mapping( struct snapshot_encry
     snapshot_assert( encryption_manager );
     snapshot_assert( address );
 
-    int i;
-    for ( i = 0; i < encryption_manager->num_encryption_mappings; ++i )
+    int i = snapshot_encryption_manager_find_index( encryption_manager, address, time, SNAPSHOT_TRUE );
+    if ( i != -1 )
     {
-        if ( snapshot_address_equal( &encryption_manager->address[i], address ) )
-        {
-            encryption_manager->expire_time[i] = -1.0;
-            encryption_manager->last_access_time[i] = -1000.0;
-            memset( &encryption_manager->address[i], 0, sizeof( struct snapshot_address_t ) );
-            memset( encryption_manager->send_key + i * SNAPSHOT_KEY_BYTES, 0, SNAPSHOT_KEY_BYTES );
-            memset( encryption_manager->receive_key + i * SNAPSHOT_KEY_BYTES, 0, SNAPSHOT_KEY_BYTES );
+        snapshot_address_index_remove( &encryption_manager->address_index, i );
+        encryption_manager->expire_time[i] = -1.0;
+        encryption_manager->last_access_time[i] = -1000.0;
+        memset( &encryption_manager->address[i], 0, sizeof( struct snapshot_address_t ) );
+        memset( encryption_manager->send_key + i * SNAPSHOT_KEY_BYTES, 0, SNAPSHOT_KEY_BYTES );
+        memset( encryption_manager->receive_key + i * SNAPSHOT_KEY_BYTES, 0, SNAPSHOT_KEY_BYTES );
+        encryption_manager->cipher_suite[i] = SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305;
 
-            if ( i + 1 == encryption_manager->num_encryption_mappings )
+        if ( i + 1 == encryption_manager->num_encryption_mappings )
+        {
+            int index = i - 1;
+            while ( index >= 0 )
             {
-                int index = i - 1;
-                while ( index >= 0 )
+                if ( !snapshot_encryption_manager_entry_expired( encryption_manager, index, time ) || encryption_manager->client_index[index] != -1 )
+                {
+                    break;
+                }
+                if ( encryption_manager->address[index].type != SNAPSHOT_ADDRESS_NONE )
                 {
-                    if ( !snapshot_encryption_manager_entry_expired( encryption_manager, index, time ) || encryption_manager->client_index[index] != -1 )
-                    {
-                        break;
-                    }
-                    encryption_manager->address[index].type = SNAPSHOT_ADDRESS_NONE;
-                    index--;
+                    snapshot_address_index_remove( &encryption_manager->address_index, index );
                 }
-                encryption_manager->num_encryption_mappings = index + 1;
+                encryption_manager->address[index].type = SNAPSHOT_ADDRESS_NONE;
+                index--;
             }
-
-            return 1;
+            encryption_manager->num_encryption_mappings = index + 1;
         }
+
+        return 1;
     }
 
     return 0;
@@ -120,16 +228,12 @@ int snapshot_encryption_manager_remove_encryption_mapping( struct snapshot_encry
 
 int snapshot_encryption_manager_find_encryption_mapping( struct snapshot_encryption_manager_t * encryption_manager, const struct snapshot_address_t * address, double time )
 {
-    int i;
-    for ( i = 0; i < encryption_manager->num_encryption_mappings; ++i )
+    int i = snapshot_encryption_manager_find_index( encryption_manager, address, time, SNAPSHOT_FALSE );
+    if ( i != -1 )
     {
-        if ( snapshot_address_equal( &encryption_manager->address[i], address ) && !snapshot_encryption_manager_entry_expired( encryption_manager, i, time ) )
-        {
-            encryption_manager->last_access_time[i] = time;
-            return i;
-        }
+        encryption_manager->last_access_time[i] = time;
     }
-    return -1;
+    return i;
 }
 
 int snapshot_encryption_manager_touch( struct snapshot_encryption_manager_t * encryption_manager, int index, const struct snapshot_address_t * address, double time )
@@ -149,6 +253,15 @@ void snapshot_encryption_manager_set_expire_time( struct snapshot_encryption_man
     encryption_manager->expire_time[index] = expire_time;
 }
 
+void snapshot_encryption_manager_set_cipher_suite( struct snapshot_encryption_manager_t * encryption_manager, int index, int cipher_suite )
+{
+    snapshot_assert( index >= 0 );
+    snapshot_assert( index < encryption_manager->num_encryption_mappings );
+    snapshot_assert( cipher_suite >= 0 );
+    snapshot_assert( cipher_suite < SNAPSHOT_NUM_CIPHER_SUITES );
+    encryption_manager->cipher_suite[index] = cipher_suite;
+}
+
 
 uint8_t * snapshot_encryption_manager_get_send_key( struct snapshot_encryption_manager_t * encryption_manager, int index )
 {
@@ -179,3 +292,13 @@ int snapshot_encryption_manager_get_timeout( struct snapshot_encryption_manager_
     snapshot_assert( index < encryption_manager->num_encryption_mappings );
     return encryption_manager->timeout[index];
 }
+
+int snapshot_encryption_manager_get_cipher_suite( struct snapshot_encryption_manager_t * encryption_manager, int index )
+{
+    snapshot_assert( encryption_manager );
+    if ( index == -1 )
+        return SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305;
+    snapshot_assert( index >= 0 );
+    snapshot_assert( index < encryption_manager->num_encryption_mappings );
+    return encryption_manager->cipher_suite[index];
+}
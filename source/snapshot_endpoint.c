@@ -12,10 +12,10 @@
 #include "snapshot_packets.h"
 #include "snapshot_read_write.h"
 #include "snapshot_packet_header.h"
-#include "snapshot_sequence_buffer.h"
+#include "snapshot_packed_sequence_buffer.h"
+#include "snapshot_util.h"
 
 #include <math.h>
-#include <float.h>
 
 // -----------------------------------------------------------------------------------------
 
@@ -38,7 +38,8 @@ struct snapshot_endpoint_fragment_reassembly_data_t
     int num_fragments_total;
     uint16_t payload_sequence;
     uint16_t payload_ack;
-    uint32_t payload_ack_bits;
+    uint32_t payload_ack_bits[SNAPSHOT_MAX_ACK_WORDS];
+    int payload_num_ack_words;
     uint8_t * payload_data;
     int payload_bytes;
     uint8_t fragment_received[SNAPSHOT_MAX_FRAGMENTS];
@@ -54,6 +55,208 @@ void snapshot_fragment_reassembly_data_cleanup( void * context, void * data )
     }
 }
 
+// -----------------------------------------------------------------------------------------
+
+static SNAPSHOT_BOOL snapshot_endpoint_window_sample( struct snapshot_packed_sequence_buffer_t * buffer, SNAPSHOT_BOOL sent, uint16_t sequence, double * time, int * packet_bytes, SNAPSHOT_BOOL * acked )
+{
+    if ( sent )
+    {
+        struct snapshot_endpoint_sent_packet_data_t * sent_packet_data = (struct snapshot_endpoint_sent_packet_data_t*) snapshot_packed_sequence_buffer_find( buffer, sequence );
+        if ( !sent_packet_data )
+            return SNAPSHOT_FALSE;
+        *time = sent_packet_data->time;
+        *packet_bytes = sent_packet_data->packet_bytes;
+        *acked = sent_packet_data->acked ? SNAPSHOT_TRUE : SNAPSHOT_FALSE;
+    }
+    else
+    {
+        struct snapshot_endpoint_received_packet_data_t * received_packet_data = (struct snapshot_endpoint_received_packet_data_t*) snapshot_packed_sequence_buffer_find( buffer, sequence );
+        if ( !received_packet_data )
+            return SNAPSHOT_FALSE;
+        *time = received_packet_data->time;
+        *packet_bytes = received_packet_data->packet_bytes;
+        *acked = SNAPSHOT_FALSE;
+    }
+    return SNAPSHOT_TRUE;
+}
+
+static void snapshot_endpoint_window_reset( struct snapshot_endpoint_window_t * window, struct snapshot_packed_sequence_buffer_t * buffer )
+{
+    memset( window, 0, sizeof( struct snapshot_endpoint_window_t ) );
+    window->start_sequence = (uint16_t) ( buffer->sequence - buffer->num_entries + 1 );
+    window->oldest_sequence = window->start_sequence;
+}
+
+static SNAPSHOT_BOOL snapshot_endpoint_window_contains( struct snapshot_endpoint_window_t * window, struct snapshot_packed_sequence_buffer_t * buffer, uint16_t sequence )
+{
+    return ( (uint16_t) ( sequence - window->start_sequence ) ) < buffer->num_entries / 2;
+}
+
+static void snapshot_endpoint_window_add( struct snapshot_endpoint_window_t * window, double time, int packet_bytes, SNAPSHOT_BOOL acked )
+{
+    if ( window->num_packets == 0 )
+    {
+        window->start_time = time;
+        window->finish_time = time;
+    }
+    else
+    {
+        if ( time < window->start_time )
+            window->start_time = time;
+        if ( time > window->finish_time )
+            window->finish_time = time;
+    }
+    window->num_packets++;
+    window->bytes += packet_bytes;
+    if ( acked )
+    {
+        window->num_acked++;
+        window->acked_bytes += packet_bytes;
+    }
+}
+
+static void snapshot_endpoint_window_remove( struct snapshot_endpoint_window_t * window, int packet_bytes, SNAPSHOT_BOOL acked )
+{
+    snapshot_assert( window->num_packets > 0 );
+    window->num_packets--;
+    window->bytes -= packet_bytes;
+    if ( acked )
+    {
+        snapshot_assert( window->num_acked > 0 );
+        window->num_acked--;
+        window->acked_bytes -= packet_bytes;
+    }
+}
+
+static void snapshot_endpoint_window_slide( struct snapshot_endpoint_window_t * window, struct snapshot_packed_sequence_buffer_t * buffer, SNAPSHOT_BOOL sent, uint16_t sequence )
+{
+    // must be called before the buffer is advanced to sequence, so samples leaving the window can still be found
+
+    if ( !snapshot_sequence_greater_than( sequence + 1, buffer->sequence ) )
+        return;
+
+    const int window_size = buffer->num_entries / 2;
+
+    const uint16_t start_sequence = (uint16_t) ( sequence + 1 - buffer->num_entries + 1 );
+
+    const int delta = (uint16_t) ( start_sequence - window->start_sequence );
+
+    double time;
+    int packet_bytes;
+    SNAPSHOT_BOOL acked;
+
+    if ( delta >= window_size )
+    {
+        // the window jumped past everything it held, so rebuild it. this costs no more than sliding over the same distance
+
+        memset( window, 0, sizeof( struct snapshot_endpoint_window_t ) );
+        window->start_sequence = start_sequence;
+        window->oldest_sequence = start_sequence;
+        for ( int i = 0; i < window_size; ++i )
+        {
+            if ( snapshot_endpoint_window_sample( buffer, sent, (uint16_t) ( start_sequence + i ), &time, &packet_bytes, &acked ) )
+            {
+                if ( window->num_packets == 0 )
+                {
+                    window->oldest_sequence = (uint16_t) ( start_sequence + i );
+                }
+                snapshot_endpoint_window_add( window, time, packet_bytes, acked );
+            }
+        }
+        return;
+    }
+
+    for ( int i = 0; i < delta; ++i )
+    {
+        if ( snapshot_endpoint_window_sample( buffer, sent, (uint16_t) ( window->start_sequence + i ), &time, &packet_bytes, &acked ) )
+        {
+            snapshot_endpoint_window_remove( window, packet_bytes, acked );
+        }
+
+        if ( snapshot_endpoint_window_sample( buffer, sent, (uint16_t) ( window->start_sequence + window_size + i ), &time, &packet_bytes, &acked ) )
+        {
+            snapshot_endpoint_window_add( window, time, packet_bytes, acked );
+        }
+    }
+
+    window->start_sequence = start_sequence;
+
+    // the start time must move with the window even when the start slot is empty (eg. a run of lost packets),
+    // otherwise it keeps the time of a packet that has already left the window. nothing in the window is older
+    // than the oldest sequence, so the next oldest sample is only searched for once that one leaves, and the
+    // search starts past it. each slot is searched at most once as the window passes, so this is amortised
+    // constant time per packet, even through a long run of losses
+
+    if ( window->num_packets == 0 )
+    {
+        window->oldest_sequence = start_sequence;
+    }
+    else if ( snapshot_sequence_less_than( window->oldest_sequence, start_sequence ) )
+    {
+        for ( int i = 0; i < window_size; ++i )
+        {
+            if ( snapshot_endpoint_window_sample( buffer, sent, (uint16_t) ( start_sequence + i ), &time, &packet_bytes, &acked ) )
+            {
+                window->oldest_sequence = (uint16_t) ( start_sequence + i );
+                window->start_time = time;
+                break;
+            }
+        }
+    }
+}
+
+static void snapshot_endpoint_advance_received_ack_bits( struct snapshot_endpoint_t * endpoint, uint16_t sequence )
+{
+    // bit n of the received ack bits is set when packet n behind the most recent received sequence has been received.
+    // called before the received packets buffer advances to sequence, the bits shift up by however far it moves
+
+    struct snapshot_packed_sequence_buffer_t * buffer = endpoint->received_packets;
+
+    if ( !snapshot_sequence_greater_than( sequence + 1, buffer->sequence ) )
+        return;
+
+    const int shift = (uint16_t) ( sequence + 1 - buffer->sequence );
+
+    uint32_t * ack_bits = endpoint->received_ack_bits;
+
+    if ( shift >= SNAPSHOT_MAX_ACK_BITS )
+    {
+        memset( ack_bits, 0, sizeof( endpoint->received_ack_bits ) );
+        return;
+    }
+
+    const int word_shift = shift / 32;
+    const int bit_shift = shift % 32;
+
+    for ( int i = SNAPSHOT_MAX_ACK_WORDS - 1; i >= 0; --i )
+    {
+        uint32_t word = 0;
+        if ( i - word_shift >= 0 )
+        {
+            word = ack_bits[i - word_shift] << bit_shift;
+            if ( bit_shift != 0 && i - word_shift - 1 >= 0 )
+            {
+                word |= ack_bits[i - word_shift - 1] >> ( 32 - bit_shift );
+            }
+        }
+        ack_bits[i] = word;
+    }
+}
+
+static void snapshot_endpoint_smooth( float * value, float sample, float smoothing_factor )
+{
+    if ( fabs( *value - sample ) > 0.00001 )
+    {
+        *value += ( sample - *value ) * smoothing_factor;
+    }
+    else
+    {
+        *value = sample;
+    }
+}
+
+// -----------------------------------------------------------------------------------------
+
 int snapshot_read_fragment_header( char * name, 
                                    const uint8_t * packet_data, 
                                    int packet_bytes, 
@@ -64,7 +267,8 @@ int snapshot_read_fragment_header( char * name,
                                    int * fragment_bytes, 
                                    uint16_t * sequence, 
                                    uint16_t * ack, 
-                                   uint32_t * ack_bits )
+                                   uint32_t * ack_bits,
+                                   int * num_ack_words )
 {
     if ( packet_bytes < SNAPSHOT_FRAGMENT_HEADER_BYTES )
     {
@@ -103,14 +307,14 @@ int snapshot_read_fragment_header( char * name,
     {
         uint16_t packet_sequence = 0;
         uint16_t packet_ack = 0;
-        uint32_t packet_ack_bits = 0;
 
-        int packet_header_bytes = snapshot_read_packet_header( name, 
-                                                               packet_data + SNAPSHOT_FRAGMENT_HEADER_BYTES, 
-                                                               packet_bytes, 
-                                                               &packet_sequence, 
-                                                               &packet_ack, 
-                                                               &packet_ack_bits );
+        int packet_header_bytes = snapshot_read_packet_header_ack_words( name, 
+                                                                         packet_data + SNAPSHOT_FRAGMENT_HEADER_BYTES, 
+                                                                         packet_bytes, 
+                                                                         &packet_sequence, 
+                                                                         &packet_ack, 
+                                                                         ack_bits,
+                                                                         num_ack_words );
 
         if ( packet_header_bytes < 0 )
         {
@@ -125,7 +329,6 @@ int snapshot_read_fragment_header( char * name,
         }
 
         *ack = packet_ack;
-        *ack_bits = packet_ack_bits;
         *fragment_bytes -= packet_header_bytes;
 
         p += packet_header_bytes;
@@ -133,7 +336,8 @@ int snapshot_read_fragment_header( char * name,
     else
     {
         *ack = 0;
-        *ack_bits = 0;
+        ack_bits[0] = 0;
+        *num_ack_words = 1;
     }
 
     if ( *fragment_bytes > fragment_size )
@@ -158,7 +362,8 @@ void snapshot_store_fragment_data( struct snapshot_endpoint_fragment_reassembly_
                                    int fragment_bytes,
                                    uint16_t payload_sequence,
                                    uint16_t payload_ack,
-                                   uint32_t payload_ack_bits )
+                                   const uint32_t * payload_ack_bits,
+                                   int payload_num_ack_words )
 {
     snapshot_assert( reassembly_data );
     snapshot_assert( fragment_id >= 0 );
@@ -174,7 +379,8 @@ void snapshot_store_fragment_data( struct snapshot_endpoint_fragment_reassembly_
     {
         reassembly_data->payload_sequence = payload_sequence;
         reassembly_data->payload_ack = payload_ack;
-        reassembly_data->payload_ack_bits = payload_ack_bits;
+        memcpy( reassembly_data->payload_ack_bits, payload_ack_bits, payload_num_ack_words * sizeof( uint32_t ) );
+        reassembly_data->payload_num_ack_words = payload_num_ack_words;
     }
 
     if ( fragment_id == reassembly_data->num_fragments_total - 1 )
@@ -202,6 +408,7 @@ void snapshot_endpoint_default_config( struct snapshot_endpoint_config_t * confi
     config->max_fragments = 16;
     config->fragment_size = 1024;
     config->ack_buffer_size = 256;
+    config->ack_bits = 32;
     config->sent_packets_buffer_size = 256;
     config->received_packets_buffer_size = 256;
     config->fragment_reassembly_buffer_size = 64;
@@ -211,6 +418,11 @@ void snapshot_endpoint_default_config( struct snapshot_endpoint_config_t * confi
     config->packet_header_size = 28;                        // note: UDP over IPv4 = 20 + 8 bytes, UDP over IPv6 = 40 + 8 bytes
 }
 
+static SNAPSHOT_BOOL snapshot_endpoint_valid_buffer_size( int buffer_size )
+{
+    return ( buffer_size > 0 && buffer_size <= 32768 && ( buffer_size & ( buffer_size - 1 ) ) == 0 ) ? SNAPSHOT_TRUE : SNAPSHOT_FALSE;
+}
+
 struct snapshot_endpoint_t * snapshot_endpoint_create( struct snapshot_endpoint_config_t * config, double time )
 {
     snapshot_assert( config );
@@ -220,8 +432,38 @@ struct snapshot_endpoint_t * snapshot_endpoint_create( struct snapshot_endpoint_
     snapshot_assert( config->max_fragments <= SNAPSHOT_MAX_FRAGMENTS );
     snapshot_assert( config->fragment_size > 0 );
     snapshot_assert( config->ack_buffer_size > 0 );
-    snapshot_assert( config->sent_packets_buffer_size > 0 );
-    snapshot_assert( config->received_packets_buffer_size > 0 );
+
+    // sequence buffers index with a mask, so sizes that aren't a power of two would silently alias entries. reject them here rather than only asserting
+
+    if ( !snapshot_endpoint_valid_buffer_size( config->sent_packets_buffer_size ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "[%s] sent packets buffer size %d must be a power of two up to 32768", config->name, config->sent_packets_buffer_size );
+        return NULL;
+    }
+
+    if ( !snapshot_endpoint_valid_buffer_size( config->received_packets_buffer_size ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "[%s] received packets buffer size %d must be a power of two up to 32768", config->name, config->received_packets_buffer_size );
+        return NULL;
+    }
+
+    if ( !snapshot_endpoint_valid_buffer_size( config->fragment_reassembly_buffer_size ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "[%s] fragment reassembly buffer size %d must be a power of two up to 32768", config->name, config->fragment_reassembly_buffer_size );
+        return NULL;
+    }
+
+    if ( !snapshot_endpoint_valid_ack_bits( config->ack_bits ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "[%s] ack bits %d must be 32, 64 or 128", config->name, config->ack_bits );
+        return NULL;
+    }
+
+    if ( config->received_packets_buffer_size < config->ack_bits )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "[%s] received packets buffer size %d is smaller than ack bits %d", config->name, config->received_packets_buffer_size, config->ack_bits );
+        return NULL;
+    }
 
     struct snapshot_endpoint_t * endpoint = (struct snapshot_endpoint_t*) snapshot_malloc( config->context, sizeof( struct snapshot_endpoint_t ) );
 
@@ -235,14 +477,17 @@ struct snapshot_endpoint_t * snapshot_endpoint_create( struct snapshot_endpoint_
 
     endpoint->acks = (uint16_t*) snapshot_malloc( config->context, config->ack_buffer_size * sizeof( uint16_t ) );
     
-    endpoint->sent_packets = snapshot_sequence_buffer_create( config->context, config->sent_packets_buffer_size, sizeof( struct snapshot_endpoint_sent_packet_data_t ) );
+    endpoint->sent_packets = snapshot_packed_sequence_buffer_create( config->context, config->sent_packets_buffer_size, sizeof( struct snapshot_endpoint_sent_packet_data_t ) );
 
-    endpoint->received_packets = snapshot_sequence_buffer_create( config->context, config->received_packets_buffer_size, sizeof( struct snapshot_endpoint_received_packet_data_t ) );
+    endpoint->received_packets = snapshot_packed_sequence_buffer_create( config->context, config->received_packets_buffer_size, sizeof( struct snapshot_endpoint_received_packet_data_t ) );
 
-    endpoint->fragment_reassembly = snapshot_sequence_buffer_create( config->context, config->fragment_reassembly_buffer_size, sizeof( struct snapshot_endpoint_fragment_reassembly_data_t ) );
+    endpoint->fragment_reassembly = snapshot_packed_sequence_buffer_create( config->context, config->fragment_reassembly_buffer_size, sizeof( struct snapshot_endpoint_fragment_reassembly_data_t ) );
 
     memset( endpoint->acks, 0, config->ack_buffer_size * sizeof( uint16_t ) );
 
+    snapshot_endpoint_window_reset( &endpoint->sent_window, endpoint->sent_packets );
+    snapshot_endpoint_window_reset( &endpoint->received_window, endpoint->received_packets );
+
     return endpoint;
 }
 
@@ -255,7 +500,7 @@ void snapshot_endpoint_destroy( struct snapshot_endpoint_t * endpoint )
 
     for ( int i = 0; i < endpoint->config.fragment_reassembly_buffer_size; ++i )
     {
-        struct snapshot_endpoint_fragment_reassembly_data_t * reassembly_data = (struct snapshot_endpoint_fragment_reassembly_data_t*) snapshot_sequence_buffer_at_index( endpoint->fragment_reassembly, i );
+        struct snapshot_endpoint_fragment_reassembly_data_t * reassembly_data = (struct snapshot_endpoint_fragment_reassembly_data_t*) snapshot_packed_sequence_buffer_at_index( endpoint->fragment_reassembly, i );
 
         if ( reassembly_data && reassembly_data->payload_data )
         {
@@ -266,28 +511,44 @@ void snapshot_endpoint_destroy( struct snapshot_endpoint_t * endpoint )
 
     snapshot_free( endpoint->context, endpoint->acks );
 
-    snapshot_sequence_buffer_destroy( endpoint->sent_packets );
-    snapshot_sequence_buffer_destroy( endpoint->received_packets );
-    snapshot_sequence_buffer_destroy( endpoint->fragment_reassembly );
+    snapshot_packed_sequence_buffer_destroy( endpoint->sent_packets );
+    snapshot_packed_sequence_buffer_destroy( endpoint->received_packets );
+    snapshot_packed_sequence_buffer_destroy( endpoint->fragment_reassembly );
 
     snapshot_free( endpoint->context, endpoint );
 }
 
+size_t snapshot_endpoint_memory_bytes( const struct snapshot_endpoint_t * endpoint )
+{
+    snapshot_assert( endpoint );
+
+    // fixed allocations only. reassembly payloads come and go with traffic and are not counted
+
+    const struct snapshot_endpoint_config_t * config = &endpoint->config;
+
+    return sizeof( struct snapshot_endpoint_t ) + 
+           config->ack_buffer_size * sizeof( uint16_t ) + 
+           snapshot_packed_sequence_buffer_memory_bytes( config->sent_packets_buffer_size, sizeof( struct snapshot_endpoint_sent_packet_data_t ) ) + 
+           snapshot_packed_sequence_buffer_memory_bytes( config->received_packets_buffer_size, sizeof( struct snapshot_endpoint_received_packet_data_t ) ) + 
+           snapshot_packed_sequence_buffer_memory_bytes( config->fragment_reassembly_buffer_size, sizeof( struct snapshot_endpoint_fragment_reassembly_data_t ) );
+}
+
 uint16_t snapshot_endpoint_sequence( struct snapshot_endpoint_t * endpoint )
 {
     snapshot_assert( endpoint );
     return endpoint->sequence;
 }
 
-void snapshot_endpoint_write_packets( struct snapshot_endpoint_t * endpoint, uint8_t * payload_data, int payload_bytes, int * num_packets, uint8_t ** packet_data, int * packet_bytes )
+void snapshot_endpoint_write_fragments( struct snapshot_endpoint_t * endpoint, uint8_t * payload_data, int payload_bytes, int * num_fragments, struct snapshot_endpoint_fragment_t * fragments )
 {
     snapshot_assert( endpoint );
     snapshot_assert( payload_data );
     snapshot_assert( payload_bytes > 0 );
     snapshot_assert( payload_bytes <= SNAPSHOT_MAX_PAYLOAD_BYTES );
-    snapshot_assert( num_packets );
-    snapshot_assert( packet_data );
-    snapshot_assert( packet_bytes );
+    snapshot_assert( num_fragments );
+    snapshot_assert( fragments );
+
+    *num_fragments = 0;
 
     if ( payload_bytes > SNAPSHOT_MAX_PAYLOAD_BYTES )
     {
@@ -297,12 +558,13 @@ void snapshot_endpoint_write_packets( struct snapshot_endpoint_t * endpoint, uin
     }
 
     uint16_t sequence = endpoint->sequence++;
-    uint16_t ack;
-    uint32_t ack_bits;
+    uint16_t ack = endpoint->received_packets->sequence - 1;
+    const uint32_t * ack_bits = endpoint->received_ack_bits;
+    const int num_ack_words = endpoint->config.ack_bits / 32;
 
-    snapshot_sequence_buffer_generate_ack_bits( endpoint->received_packets, &ack, &ack_bits );
+    snapshot_endpoint_window_slide( &endpoint->sent_window, endpoint->sent_packets, SNAPSHOT_TRUE, sequence );
 
-    struct snapshot_endpoint_sent_packet_data_t * sent_packet_data = (struct snapshot_endpoint_sent_packet_data_t*) snapshot_sequence_buffer_insert( endpoint->sent_packets, sequence );
+    struct snapshot_endpoint_sent_packet_data_t * sent_packet_data = (struct snapshot_endpoint_sent_packet_data_t*) snapshot_packed_sequence_buffer_insert( endpoint->sent_packets, sequence );
 
     snapshot_assert( sent_packet_data );
 
@@ -316,94 +578,143 @@ void snapshot_endpoint_write_packets( struct snapshot_endpoint_t * endpoint, uin
 
         snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] sending payload %d without fragmentation", endpoint->config.name, sequence );
 
-        uint8_t header[SNAPSHOT_MAX_PACKET_HEADER_BYTES];
+        struct snapshot_endpoint_fragment_t * fragment = &fragments[0];
 
-        memset( header, 0, SNAPSHOT_MAX_PACKET_HEADER_BYTES );
+        fragment->payload_data = payload_data;
+        fragment->payload_bytes = payload_bytes;
+        fragment->header_bytes = snapshot_write_packet_header_ack_words( fragment->header, sequence, ack, ack_bits, num_ack_words );
 
-        int header_bytes = snapshot_write_packet_header( header, sequence, ack, ack_bits );
-
-        *num_packets = 1;
-        packet_data[0] = payload_data - header_bytes;
-        packet_bytes[0] = payload_bytes + header_bytes;
-
-        memcpy( packet_data[0], header, header_bytes );
+        *num_fragments = 1;
     }
     else
     {
         // fragmented packet
 
-        int num_fragments = ( payload_bytes / endpoint->config.fragment_size ) + ( ( payload_bytes % endpoint->config.fragment_size ) != 0 ? 1 : 0 );
+        int fragment_count = ( payload_bytes / endpoint->config.fragment_size ) + ( ( payload_bytes % endpoint->config.fragment_size ) != 0 ? 1 : 0 );
 
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] sending packet %d as %d fragments", endpoint->config.name, sequence, num_fragments );
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] sending packet %d as %d fragments", endpoint->config.name, sequence, fragment_count );
 
-        snapshot_assert( num_fragments >= 1 );
-        snapshot_assert( num_fragments <= endpoint->config.max_fragments );
-
-        int fragment_buffer_size = SNAPSHOT_FRAGMENT_HEADER_BYTES + SNAPSHOT_MAX_PACKET_HEADER_BYTES + endpoint->config.fragment_size;
+        snapshot_assert( fragment_count >= 1 );
+        snapshot_assert( fragment_count <= endpoint->config.max_fragments );
 
         uint8_t * q = payload_data;
 
         uint8_t * end = q + payload_bytes;
 
-        for ( int fragment_id = 0; fragment_id < num_fragments; ++fragment_id )
+        for ( int fragment_id = 0; fragment_id < fragment_count; ++fragment_id )
         {
-            uint8_t * fragment_packet_data = snapshot_create_packet( endpoint->context, fragment_buffer_size );
+            struct snapshot_endpoint_fragment_t * fragment = &fragments[fragment_id];
 
-            uint8_t * p = fragment_packet_data;
+            uint8_t * p = fragment->header;
 
             snapshot_write_uint8( &p, 1 ); // fragment
             snapshot_write_uint16( &p, sequence );
             snapshot_write_uint8( &p, (uint8_t) fragment_id );
-            snapshot_write_uint8( &p, (uint8_t) ( num_fragments - 1 ) );
+            snapshot_write_uint8( &p, (uint8_t) ( fragment_count - 1 ) );
 
             if ( fragment_id == 0 )
             {
-                uint8_t header[SNAPSHOT_MAX_PACKET_HEADER_BYTES];
-                memset( header, 0, SNAPSHOT_MAX_PACKET_HEADER_BYTES );
-                int header_bytes = snapshot_write_packet_header( header, sequence, ack, ack_bits );
-                memcpy( p, header, header_bytes );
-                p += header_bytes;
+                p += snapshot_write_packet_header_ack_words( p, sequence, ack, ack_bits, num_ack_words );
             }
 
-            int bytes_to_copy = endpoint->config.fragment_size;
-            if ( q + bytes_to_copy > end )
+            int slice_bytes = endpoint->config.fragment_size;
+            if ( q + slice_bytes > end )
             {
-                bytes_to_copy = (int) ( end - q );
+                slice_bytes = (int) ( end - q );
             }
 
-            memcpy( p, q, bytes_to_copy );
+            fragment->header_bytes = (int) ( p - fragment->header );
+            fragment->payload_data = q;
+            fragment->payload_bytes = slice_bytes;
 
-            p += bytes_to_copy;
-            q += bytes_to_copy;
-
-            int fragment_packet_bytes = (int) ( p - fragment_packet_data );
-
-            packet_data[fragment_id] = fragment_packet_data;
-            packet_bytes[fragment_id] = fragment_packet_bytes;
+            q += slice_bytes;
 
             endpoint->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_FRAGMENTS_SENT]++;
         }
 
-        *num_packets = num_fragments;
+        *num_fragments = fragment_count;
     }
 
     endpoint->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_PACKETS_SENT]++;
 }
 
-void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, uint8_t * packet_data, int packet_bytes, uint8_t * payload_buffer, uint8_t ** out_payload_data, int * out_payload_bytes, uint16_t * out_payload_sequence, uint16_t * out_payload_ack, uint32_t * out_payload_ack_bits )
+uint8_t * snapshot_endpoint_fragment_begin( struct snapshot_endpoint_fragment_t * fragment, int * packet_bytes )
+{
+    snapshot_assert( fragment );
+    snapshot_assert( fragment->payload_data );
+    snapshot_assert( packet_bytes );
+
+    // the header goes in front of the slice. for the first fragment this is the payload prefix, for the rest it is the tail of the previous slice, which has already been sent
+
+    uint8_t * packet_data = fragment->payload_data - fragment->header_bytes;
+
+    memcpy( packet_data, fragment->header, fragment->header_bytes );
+
+    // encryption writes the mac just past the end of the slice, over the start of the next one. save those bytes so they can be put back once this fragment is sent
+
+    memcpy( fragment->trailer, fragment->payload_data + fragment->payload_bytes, SNAPSHOT_MAC_BYTES );
+
+    *packet_bytes = fragment->header_bytes + fragment->payload_bytes;
+
+    return packet_data;
+}
+
+void snapshot_endpoint_fragment_end( struct snapshot_endpoint_fragment_t * fragment )
+{
+    snapshot_assert( fragment );
+    snapshot_assert( fragment->payload_data );
+
+    memcpy( fragment->payload_data + fragment->payload_bytes, fragment->trailer, SNAPSHOT_MAC_BYTES );
+}
+
+void snapshot_endpoint_write_packets( struct snapshot_endpoint_t * endpoint, uint8_t * payload_data, int payload_bytes, int * num_packets, uint8_t ** packet_data, int * packet_bytes )
+{
+    snapshot_assert( endpoint );
+    snapshot_assert( num_packets );
+    snapshot_assert( packet_data );
+    snapshot_assert( packet_bytes );
+
+    struct snapshot_endpoint_fragment_t fragments[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+    int num_fragments = 0;
+
+    snapshot_endpoint_write_fragments( endpoint, payload_data, payload_bytes, &num_fragments, fragments );
+
+    if ( num_fragments == 1 )
+    {
+        // regular packet is written in place, in front of the payload
+
+        packet_data[0] = snapshot_endpoint_fragment_begin( &fragments[0], &packet_bytes[0] );
+    }
+    else
+    {
+        // fragments are copied out to their own buffers, so they can be held and sent in any order
+
+        int fragment_buffer_size = SNAPSHOT_FRAGMENT_HEADER_BYTES + SNAPSHOT_MAX_PACKET_HEADER_BYTES + endpoint->config.fragment_size;
+
+        for ( int i = 0; i < num_fragments; ++i )
+        {
+            uint8_t * fragment_packet_data = snapshot_create_pooled_packet( endpoint->context, endpoint->config.packet_pool, fragment_buffer_size );
+
+            memcpy( fragment_packet_data, fragments[i].header, fragments[i].header_bytes );
+            memcpy( fragment_packet_data + fragments[i].header_bytes, fragments[i].payload_data, fragments[i].payload_bytes );
+
+            packet_data[i] = fragment_packet_data;
+            packet_bytes[i] = fragments[i].header_bytes + fragments[i].payload_bytes;
+        }
+    }
+
+    *num_packets = num_fragments;
+}
+
+void snapshot_endpoint_receive_packet( struct snapshot_endpoint_t * endpoint, uint8_t * packet_data, int packet_bytes, struct snapshot_endpoint_payload_t * payload )
 {
     snapshot_assert( endpoint );
     snapshot_assert( packet_data );
     snapshot_assert( packet_bytes > 0 );
-    snapshot_assert( payload_buffer );
-    snapshot_assert( out_payload_data );
-    snapshot_assert( out_payload_sequence );
-    snapshot_assert( out_payload_ack );
-    snapshot_assert( out_payload_ack_bits );
+    snapshot_assert( payload );
 
-    *out_payload_data = NULL;
-    *out_payload_bytes = 0;
-    *out_payload_sequence = 0;
+    memset( payload, 0, sizeof( struct snapshot_endpoint_payload_t ) );
 
     if ( packet_bytes > SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_MAX_PACKET_HEADER_BYTES + SNAPSHOT_FRAGMENT_HEADER_BYTES )
     {
@@ -422,9 +733,10 @@ void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, ui
 
         uint16_t sequence;
         uint16_t ack;
-        uint32_t ack_bits;
+        uint32_t ack_bits[SNAPSHOT_MAX_ACK_WORDS];
+        int num_ack_words;
 
-        int packet_header_bytes = snapshot_read_packet_header( endpoint->config.name, packet_data, packet_bytes, &sequence, &ack, &ack_bits );
+        int packet_header_bytes = snapshot_read_packet_header_ack_words( endpoint->config.name, packet_data, packet_bytes, &sequence, &ack, ack_bits, &num_ack_words );
         if ( packet_header_bytes < 0 )
         {
             snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] ignoring invalid packet. could not read packet header", endpoint->config.name );
@@ -443,18 +755,19 @@ void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, ui
             return;
         }
 
-        if ( !snapshot_sequence_buffer_test_insert( endpoint->received_packets, sequence ) )
+        if ( !snapshot_packed_sequence_buffer_test_insert( endpoint->received_packets, sequence ) )
         {
             snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] ignoring stale packet %d", endpoint->config.name, sequence );
             endpoint->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_PACKETS_STALE]++;
             return;
         }
 
-        *out_payload_data = packet_data + packet_header_bytes;
-        *out_payload_bytes = packet_bytes - packet_header_bytes;
-        *out_payload_sequence = sequence;
-        *out_payload_ack = ack;
-        *out_payload_ack_bits = ack_bits;
+        payload->data = packet_data + packet_header_bytes;
+        payload->bytes = packet_bytes - packet_header_bytes;
+        payload->sequence = sequence;
+        payload->ack = ack;
+        memcpy( payload->ack_bits, ack_bits, num_ack_words * sizeof( uint32_t ) );
+        payload->num_ack_words = num_ack_words;
     }
     else
     {
@@ -466,7 +779,8 @@ void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, ui
 
         uint16_t sequence;
         uint16_t ack;
-        uint32_t ack_bits;
+        uint32_t ack_bits[SNAPSHOT_MAX_ACK_WORDS];
+        int num_ack_words;
 
         int fragment_header_bytes = snapshot_read_fragment_header( endpoint->config.name, 
                                                                    packet_data, 
@@ -478,7 +792,8 @@ void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, ui
                                                                    &fragment_bytes, 
                                                                    &sequence, 
                                                                    &ack, 
-                                                                   &ack_bits );
+                                                                   ack_bits,
+                                                                   &num_ack_words );
 
         if ( fragment_header_bytes < 0 )
         {
@@ -487,11 +802,11 @@ void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, ui
             return;
         }
 
-        struct snapshot_endpoint_fragment_reassembly_data_t * reassembly_data = (struct snapshot_endpoint_fragment_reassembly_data_t*)  snapshot_sequence_buffer_find( endpoint->fragment_reassembly, sequence );
+        struct snapshot_endpoint_fragment_reassembly_data_t * reassembly_data = (struct snapshot_endpoint_fragment_reassembly_data_t*)  snapshot_packed_sequence_buffer_find( endpoint->fragment_reassembly, sequence );
 
         if ( !reassembly_data )
         {
-            reassembly_data = (struct snapshot_endpoint_fragment_reassembly_data_t*) snapshot_sequence_buffer_insert_with_cleanup( endpoint->fragment_reassembly, sequence, snapshot_fragment_reassembly_data_cleanup );
+            reassembly_data = (struct snapshot_endpoint_fragment_reassembly_data_t*) snapshot_packed_sequence_buffer_insert_with_cleanup( endpoint->fragment_reassembly, sequence, snapshot_fragment_reassembly_data_cleanup );
 
             if ( !reassembly_data )
             {
@@ -500,13 +815,17 @@ void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, ui
                 return;
             }
 
-            snapshot_sequence_buffer_advance( endpoint->received_packets, sequence );
+            snapshot_endpoint_window_slide( &endpoint->received_window, endpoint->received_packets, SNAPSHOT_FALSE, sequence );
+
+            snapshot_endpoint_advance_received_ack_bits( endpoint, sequence );
+
+            snapshot_packed_sequence_buffer_advance( endpoint->received_packets, sequence );
 
             int payload_buffer_size = num_fragments * endpoint->config.fragment_size;
 
             reassembly_data->num_fragments_received = 0;
             reassembly_data->num_fragments_total = num_fragments;
-            reassembly_data->payload_data = snapshot_create_packet( endpoint->context, payload_buffer_size );
+            reassembly_data->payload_data = snapshot_create_pooled_packet( endpoint->context, endpoint->config.packet_pool, payload_buffer_size );
             reassembly_data->payload_bytes = 0;
             memset( reassembly_data->fragment_received, 0, sizeof( reassembly_data->fragment_received ) );
         }
@@ -536,7 +855,8 @@ void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, ui
                                       packet_bytes - fragment_header_bytes,
                                       sequence, 
                                       ack, 
-                                      ack_bits );
+                                      ack_bits,
+                                      num_ack_words );
 
         endpoint->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_FRAGMENTS_RECEIVED]++;
 
@@ -555,71 +875,173 @@ void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, ui
                 return;
             }
 
-            memcpy( payload_buffer, reassembly_data->payload_data, payload_bytes );
+            // the reassembly buffer is handed over to the caller as the payload, instead of being copied out
 
-            snapshot_sequence_buffer_remove_with_cleanup( endpoint->fragment_reassembly, sequence, snapshot_fragment_reassembly_data_cleanup );
+            uint8_t * reassembly_buffer = reassembly_data->payload_data;
+            uint16_t payload_sequence = reassembly_data->payload_sequence;
+            uint16_t payload_ack = reassembly_data->payload_ack;
+            uint32_t payload_ack_bits[SNAPSHOT_MAX_ACK_WORDS];
+            int payload_num_ack_words = reassembly_data->payload_num_ack_words;
+            memcpy( payload_ack_bits, reassembly_data->payload_ack_bits, payload_num_ack_words * sizeof( uint32_t ) );
 
-            if ( !snapshot_sequence_buffer_test_insert( endpoint->received_packets, sequence ) )
+            reassembly_data->payload_data = NULL;
+
+            snapshot_packed_sequence_buffer_remove_with_cleanup( endpoint->fragment_reassembly, sequence, snapshot_fragment_reassembly_data_cleanup );
+
+            if ( !snapshot_packed_sequence_buffer_test_insert( endpoint->received_packets, sequence ) )
             {
                 snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] ignoring stale packet %d", endpoint->config.name, sequence );
                 endpoint->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_PACKETS_STALE]++;
+                snapshot_destroy_packet( endpoint->context, reassembly_buffer );
                 return;
             }
 
-            *out_payload_data = payload_buffer;
-            *out_payload_bytes = payload_bytes;
-            *out_payload_sequence = reassembly_data->payload_sequence;
-            *out_payload_ack = reassembly_data->payload_ack;
-            *out_payload_ack_bits = reassembly_data->payload_ack_bits;
+            payload->data = reassembly_buffer;
+            payload->bytes = payload_bytes;
+            payload->sequence = payload_sequence;
+            payload->ack = payload_ack;
+            memcpy( payload->ack_bits, payload_ack_bits, payload_num_ack_words * sizeof( uint32_t ) );
+            payload->num_ack_words = payload_num_ack_words;
+            payload->reassembly_buffer = reassembly_buffer;
 
             endpoint->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_PACKETS_RECEIVED]++;
         }
     }
 }
 
+void snapshot_endpoint_release_payload( struct snapshot_endpoint_t * endpoint, struct snapshot_endpoint_payload_t * payload )
+{
+    snapshot_assert( endpoint );
+    snapshot_assert( payload );
+
+    if ( payload->reassembly_buffer )
+    {
+        snapshot_destroy_packet( endpoint->context, payload->reassembly_buffer );
+    }
+
+    memset( payload, 0, sizeof( struct snapshot_endpoint_payload_t ) );
+}
+
+void snapshot_endpoint_process_packet( struct snapshot_endpoint_t * endpoint, uint8_t * packet_data, int packet_bytes, uint8_t * payload_buffer, uint8_t ** out_payload_data, int * out_payload_bytes, uint16_t * out_payload_sequence, uint16_t * out_payload_ack, uint32_t * out_payload_ack_bits )
+{
+    snapshot_assert( endpoint );
+    snapshot_assert( payload_buffer );
+    snapshot_assert( out_payload_data );
+    snapshot_assert( out_payload_bytes );
+    snapshot_assert( out_payload_sequence );
+    snapshot_assert( out_payload_ack );
+    snapshot_assert( out_payload_ack_bits );
+
+    struct snapshot_endpoint_payload_t payload;
+
+    snapshot_endpoint_receive_packet( endpoint, packet_data, packet_bytes, &payload );
+
+    *out_payload_data = payload.data;
+    *out_payload_bytes = payload.bytes;
+    *out_payload_sequence = payload.sequence;
+    *out_payload_ack = payload.ack;
+    *out_payload_ack_bits = payload.ack_bits[0];
+
+    if ( payload.reassembly_buffer )
+    {
+        memcpy( payload_buffer, payload.data, payload.bytes );
+        *out_payload_data = payload_buffer;
+        snapshot_endpoint_release_payload( endpoint, &payload );
+    }
+}
+
 void snapshot_endpoint_mark_payload_processed( struct snapshot_endpoint_t * endpoint, uint16_t sequence, uint16_t ack, uint32_t ack_bits, int payload_bytes )
+{
+    snapshot_endpoint_mark_payload_processed_ack_words( endpoint, sequence, ack, &ack_bits, 1, payload_bytes );
+}
+
+void snapshot_endpoint_mark_payload_processed_ack_words( struct snapshot_endpoint_t * endpoint, uint16_t sequence, uint16_t ack, const uint32_t * ack_bits, int num_ack_words, int payload_bytes )
 {
     snapshot_assert( endpoint );
+    snapshot_assert( ack_bits );
+    snapshot_assert( num_ack_words >= 1 );
+    snapshot_assert( num_ack_words <= SNAPSHOT_MAX_ACK_WORDS );
 
     snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] marking packet %d as processed", endpoint->config.name, sequence );
 
-    struct snapshot_endpoint_received_packet_data_t * received_packet_data = (struct snapshot_endpoint_received_packet_data_t*) snapshot_sequence_buffer_insert( endpoint->received_packets, sequence );
+    snapshot_endpoint_window_slide( &endpoint->received_window, endpoint->received_packets, SNAPSHOT_FALSE, sequence );
+
+    // a packet that arrives late can land inside the window. replace any sample already counted for it
+
+    const SNAPSHOT_BOOL in_window = snapshot_endpoint_window_contains( &endpoint->received_window, endpoint->received_packets, sequence );
+
+    if ( in_window )
+    {
+        double previous_time;
+        int previous_packet_bytes;
+        SNAPSHOT_BOOL previous_acked;
+        if ( snapshot_endpoint_window_sample( endpoint->received_packets, SNAPSHOT_FALSE, sequence, &previous_time, &previous_packet_bytes, &previous_acked ) )
+        {
+            snapshot_endpoint_window_remove( &endpoint->received_window, previous_packet_bytes, previous_acked );
+        }
+    }
+
+    snapshot_endpoint_advance_received_ack_bits( endpoint, sequence );
+
+    struct snapshot_endpoint_received_packet_data_t * received_packet_data = (struct snapshot_endpoint_received_packet_data_t*) snapshot_packed_sequence_buffer_insert( endpoint->received_packets, sequence );
 
     snapshot_assert( received_packet_data );
 
+    const int ack_index = (uint16_t) ( endpoint->received_packets->sequence - 1 - sequence );
+    if ( ack_index < SNAPSHOT_MAX_ACK_BITS )
+    {
+        endpoint->received_ack_bits[ack_index/32] |= 1U << ( ack_index % 32 );
+    }
+
     received_packet_data->time = endpoint->time;
     received_packet_data->packet_bytes = endpoint->config.packet_header_size + payload_bytes;
 
-    snapshot_sequence_buffer_advance_with_cleanup( endpoint->fragment_reassembly, sequence, snapshot_fragment_reassembly_data_cleanup );
+    if ( in_window )
+    {
+        snapshot_endpoint_window_add( &endpoint->received_window, received_packet_data->time, received_packet_data->packet_bytes, SNAPSHOT_FALSE );
+    }
 
-    for ( int i = 0; i < 32; ++i )
+    snapshot_packed_sequence_buffer_advance_with_cleanup( endpoint->fragment_reassembly, sequence, snapshot_fragment_reassembly_data_cleanup );
+
+    for ( int word = 0; word < num_ack_words; ++word )
     {
-        if ( ack_bits & 1 )
-        {                    
-            uint16_t ack_sequence = ack - ((uint16_t)i);
+        uint32_t word_ack_bits = ack_bits[word];
+
+        for ( int i = 0; i < 32; ++i )
+        {
+            if ( word_ack_bits & 1 )
+            {                    
+                uint16_t ack_sequence = ack - ((uint16_t)( word * 32 + i ));
             
-            struct snapshot_endpoint_sent_packet_data_t * sent_packet_data = (struct snapshot_endpoint_sent_packet_data_t*) snapshot_sequence_buffer_find( endpoint->sent_packets, ack_sequence );
+                struct snapshot_endpoint_sent_packet_data_t * sent_packet_data = (struct snapshot_endpoint_sent_packet_data_t*) snapshot_packed_sequence_buffer_find( endpoint->sent_packets, ack_sequence );
 
-            if ( sent_packet_data && !sent_packet_data->acked && endpoint->num_acks < endpoint->config.ack_buffer_size )
-            {
-                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] acked packet %d", endpoint->config.name, ack_sequence );
-                endpoint->acks[endpoint->num_acks++] = ack_sequence;
-                endpoint->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_PACKETS_ACKED]++;
-                sent_packet_data->acked = 1;
-
-                float rtt = (float) ( endpoint->time - sent_packet_data->time ) * 1000.0f;
-                snapshot_assert( rtt >= 0.0 );
-                if ( ( endpoint->rtt == 0.0f && rtt > 0.0f ) || fabs( endpoint->rtt - rtt ) < 0.00001 )
-                {
-                    endpoint->rtt = rtt;
-                }
-                else
+                if ( sent_packet_data && !sent_packet_data->acked && endpoint->num_acks < endpoint->config.ack_buffer_size )
                 {
-                    endpoint->rtt += ( rtt - endpoint->rtt ) * endpoint->config.rtt_smoothing_factor;
+                    snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] acked packet %d", endpoint->config.name, ack_sequence );
+                    endpoint->acks[endpoint->num_acks++] = ack_sequence;
+                    endpoint->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_PACKETS_ACKED]++;
+                    sent_packet_data->acked = 1;
+
+                    if ( snapshot_endpoint_window_contains( &endpoint->sent_window, endpoint->sent_packets, ack_sequence ) )
+                    {
+                        endpoint->sent_window.num_acked++;
+                        endpoint->sent_window.acked_bytes += sent_packet_data->packet_bytes;
+                    }
+
+                    float rtt = (float) ( endpoint->time - sent_packet_data->time ) * 1000.0f;
+                    snapshot_assert( rtt >= 0.0 );
+                    if ( ( endpoint->rtt == 0.0f && rtt > 0.0f ) || fabs( endpoint->rtt - rtt ) < 0.00001 )
+                    {
+                        endpoint->rtt = rtt;
+                    }
+                    else
+                    {
+                        endpoint->rtt += ( rtt - endpoint->rtt ) * endpoint->config.rtt_smoothing_factor;
+                    }
                 }
             }
+            word_ack_bits >>= 1;
         }
-        ack_bits >>= 1;
     }
 }
 
@@ -649,7 +1071,7 @@ void snapshot_endpoint_reset( struct snapshot_endpoint_t * endpoint )
 
     for ( int i = 0; i < endpoint->config.fragment_reassembly_buffer_size; ++i )
     {
-        struct snapshot_endpoint_fragment_reassembly_data_t * reassembly_data = (struct snapshot_endpoint_fragment_reassembly_data_t*) snapshot_sequence_buffer_at_index( endpoint->fragment_reassembly, i );
+        struct snapshot_endpoint_fragment_reassembly_data_t * reassembly_data = (struct snapshot_endpoint_fragment_reassembly_data_t*) snapshot_packed_sequence_buffer_at_index( endpoint->fragment_reassembly, i );
 
         if ( reassembly_data && reassembly_data->payload_data )
         {
@@ -658,9 +1080,14 @@ void snapshot_endpoint_reset( struct snapshot_endpoint_t * endpoint )
         }
     }
 
-    snapshot_sequence_buffer_reset( endpoint->sent_packets );
-    snapshot_sequence_buffer_reset( endpoint->received_packets );
-    snapshot_sequence_buffer_reset( endpoint->fragment_reassembly );
+    snapshot_packed_sequence_buffer_reset( endpoint->sent_packets );
+    snapshot_packed_sequence_buffer_reset( endpoint->received_packets );
+    snapshot_packed_sequence_buffer_reset( endpoint->fragment_reassembly );
+
+    snapshot_endpoint_window_reset( &endpoint->sent_window, endpoint->sent_packets );
+    snapshot_endpoint_window_reset( &endpoint->received_window, endpoint->received_packets );
+
+    memset( endpoint->received_ack_bits, 0, sizeof( endpoint->received_ack_bits ) );
 }
 
 void snapshot_endpoint_update( struct snapshot_endpoint_t * endpoint, double time )
@@ -669,146 +1096,39 @@ void snapshot_endpoint_update( struct snapshot_endpoint_t * endpoint, double tim
 
     endpoint->time = time;
     
+    // packet loss and bandwidth come from windowed sums over the older half of the sent and received packets
+    // buffers, maintained as packets are sent, received and acked. see snapshot_endpoint_window_slide
+
+    struct snapshot_endpoint_window_t * sent_window = &endpoint->sent_window;
+    struct snapshot_endpoint_window_t * received_window = &endpoint->received_window;
+
     // calculate packet loss
     {
-        uint32_t base_sequence = ( endpoint->sent_packets->sequence - endpoint->config.sent_packets_buffer_size + 1 ) + 0xFFFF;
-        int num_dropped = 0;
-        int num_samples = endpoint->config.sent_packets_buffer_size / 2;
-        for ( int i = 0; i < num_samples; ++i )
-        {
-            uint16_t sequence = (uint16_t) ( base_sequence + i );
-            struct snapshot_endpoint_sent_packet_data_t * sent_packet_data = (struct snapshot_endpoint_sent_packet_data_t*) snapshot_sequence_buffer_find( endpoint->sent_packets, sequence );
-            if ( sent_packet_data && !sent_packet_data->acked )
-            {
-                num_dropped++;
-            }
-        }
+        const int num_samples = endpoint->config.sent_packets_buffer_size / 2;
+        const int num_dropped = sent_window->num_packets - sent_window->num_acked;
         float packet_loss = ( (float) num_dropped ) / ( (float) num_samples ) * 100.0f;
-        if ( fabs( endpoint->packet_loss - packet_loss ) > 0.00001 )
-        {
-            endpoint->packet_loss += ( packet_loss - endpoint->packet_loss ) * endpoint->config.packet_loss_smoothing_factor;
-        }
-        else
-        {
-            endpoint->packet_loss = packet_loss;
-        }
+        snapshot_endpoint_smooth( &endpoint->packet_loss, packet_loss, endpoint->config.packet_loss_smoothing_factor );
     }
 
     // calculate sent bandwidth
+    if ( sent_window->num_packets > 0 && sent_window->finish_time > sent_window->start_time )
     {
-        uint32_t base_sequence = ( endpoint->sent_packets->sequence - endpoint->config.sent_packets_buffer_size + 1 ) + 0xFFFF;
-        int bytes_sent = 0;
-        double start_time = FLT_MAX;
-        double finish_time = 0.0;
-        int num_samples = endpoint->config.sent_packets_buffer_size / 2;
-        for ( int i = 0; i < num_samples; ++i )
-        {
-            uint16_t sequence = (uint16_t) ( base_sequence + i );
-            struct snapshot_endpoint_sent_packet_data_t * sent_packet_data = (struct snapshot_endpoint_sent_packet_data_t*) snapshot_sequence_buffer_find( endpoint->sent_packets, sequence );
-            if ( !sent_packet_data )
-            {
-                continue;
-            }
-            bytes_sent += sent_packet_data->packet_bytes;
-            if ( sent_packet_data->time < start_time )
-            {
-                start_time = sent_packet_data->time;
-            }
-            if ( sent_packet_data->time > finish_time )
-            {
-                finish_time = sent_packet_data->time;
-            }
-        }
-        if ( start_time != FLT_MAX && finish_time != 0.0 )
-        {
-            float sent_bandwidth_kbps = (float) ( ( (double) bytes_sent ) / ( finish_time - start_time ) * 8.0f / 1000.0f );
-            if ( fabs( endpoint->sent_bandwidth_kbps - sent_bandwidth_kbps ) > 0.00001 )
-            {
-                endpoint->sent_bandwidth_kbps += ( sent_bandwidth_kbps - endpoint->sent_bandwidth_kbps ) * endpoint->config.bandwidth_smoothing_factor;
-            }
-            else
-            {
-                endpoint->sent_bandwidth_kbps = sent_bandwidth_kbps;
-            }
-        }
+        float sent_bandwidth_kbps = (float) ( ( (double) sent_window->bytes ) / ( sent_window->finish_time - sent_window->start_time ) * 8.0f / 1000.0f );
+        snapshot_endpoint_smooth( &endpoint->sent_bandwidth_kbps, sent_bandwidth_kbps, endpoint->config.bandwidth_smoothing_factor );
     }
 
     // calculate received bandwidth
+    if ( received_window->num_packets > 0 && received_window->finish_time > received_window->start_time )
     {
-        uint32_t base_sequence = ( endpoint->received_packets->sequence - endpoint->config.received_packets_buffer_size + 1 ) + 0xFFFF;
-        int bytes_sent = 0;
-        double start_time = FLT_MAX;
-        double finish_time = 0.0;
-        int num_samples = endpoint->config.received_packets_buffer_size / 2;
-        for ( int i = 0; i < num_samples; ++i )
-        {
-            uint16_t sequence = (uint16_t) ( base_sequence + i );
-            struct snapshot_endpoint_received_packet_data_t * received_packet_data = (struct snapshot_endpoint_received_packet_data_t*) snapshot_sequence_buffer_find( endpoint->received_packets, sequence );
-            if ( !received_packet_data )
-            {
-                continue;
-            }
-            bytes_sent += received_packet_data->packet_bytes;
-            if ( received_packet_data->time < start_time )
-            {
-                start_time = received_packet_data->time;
-            }
-            if ( received_packet_data->time > finish_time )
-            {
-                finish_time = received_packet_data->time;
-            }
-        }
-        if ( start_time != FLT_MAX && finish_time != 0.0 )
-        {
-            float received_bandwidth_kbps = (float) ( ( (double) bytes_sent ) / ( finish_time - start_time ) * 8.0f / 1000.0f );
-            if ( fabs( endpoint->received_bandwidth_kbps - received_bandwidth_kbps ) > 0.00001 )
-            {
-                endpoint->received_bandwidth_kbps += ( received_bandwidth_kbps - endpoint->received_bandwidth_kbps ) * endpoint->config.bandwidth_smoothing_factor;
-            }
-            else
-            {
-                endpoint->received_bandwidth_kbps = received_bandwidth_kbps;
-            }
-        }
+        float received_bandwidth_kbps = (float) ( ( (double) received_window->bytes ) / ( received_window->finish_time - received_window->start_time ) * 8.0f / 1000.0f );
+        snapshot_endpoint_smooth( &endpoint->received_bandwidth_kbps, received_bandwidth_kbps, endpoint->config.bandwidth_smoothing_factor );
     }
 
-    // calculate acked bandwidth
+    // calculate acked bandwidth (acked bytes over the time the window's packets were sent)
+    if ( sent_window->num_acked > 0 && sent_window->finish_time > sent_window->start_time )
     {
-        uint32_t base_sequence = ( endpoint->sent_packets->sequence - endpoint->config.sent_packets_buffer_size + 1 ) + 0xFFFF;
-        int bytes_sent = 0;
-        double start_time = FLT_MAX;
-        double finish_time = 0.0;
-        int num_samples = endpoint->config.sent_packets_buffer_size / 2;
-        for ( int i = 0; i < num_samples; ++i )
-        {
-            uint16_t sequence = (uint16_t) ( base_sequence + i );
-            struct snapshot_endpoint_sent_packet_data_t * sent_packet_data = (struct snapshot_endpoint_sent_packet_data_t*) snapshot_sequence_buffer_find( endpoint->sent_packets, sequence );
-            if ( !sent_packet_data || !sent_packet_data->acked )
-            {
-                continue;
-            }
-            bytes_sent += sent_packet_data->packet_bytes;
-            if ( sent_packet_data->time < start_time )
-            {
-                start_time = sent_packet_data->time;
-            }
-            if ( sent_packet_data->time > finish_time )
-            {
-                finish_time = sent_packet_data->time;
-            }
-        }
-        if ( start_time != FLT_MAX && finish_time != 0.0 )
-        {
-            float acked_bandwidth_kbps = (float) ( ( (double) bytes_sent ) / ( finish_time - start_time ) * 8.0f / 1000.0f );
-            if ( fabs( endpoint->acked_bandwidth_kbps - acked_bandwidth_kbps ) > 0.00001 )
-            {
-                endpoint->acked_bandwidth_kbps += ( acked_bandwidth_kbps - endpoint->acked_bandwidth_kbps ) * endpoint->config.bandwidth_smoothing_factor;
-            }
-            else
-            {
-                endpoint->acked_bandwidth_kbps = acked_bandwidth_kbps;
-            }
-        }
+        float acked_bandwidth_kbps = (float) ( ( (double) sent_window->acked_bytes ) / ( sent_window->finish_time - sent_window->start_time ) * 8.0f / 1000.0f );
+        snapshot_endpoint_smooth( &endpoint->acked_bandwidth_kbps, acked_bandwidth_kbps, endpoint->config.bandwidth_smoothing_factor );
     }
 }
 
@@ -0,0 +1,443 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#include "snapshot_handshake.h"
+#include "snapshot_platform.h"
+#include "snapshot_packets.h"
+#include "snapshot_crypto.h"
+
+// ------------------------------------------------------------------------------------------
+
+void snapshot_handshake_process( struct snapshot_handshake_t * handshake, uint64_t protocol_id, uint8_t * private_key, uint8_t * challenge_key )
+{
+    snapshot_assert( handshake );
+    snapshot_assert( private_key );
+    snapshot_assert( challenge_key );
+
+    handshake->result = SNAPSHOT_ERROR;
+
+    if ( handshake->type == SNAPSHOT_HANDSHAKE_CONNECTION_REQUEST )
+    {
+        // decrypt and read the connect token, then encrypt the challenge token the server will send back if it accepts the request
+
+        uint8_t allowed_packets[SNAPSHOT_NUM_PACKETS];
+        memset( allowed_packets, 0, sizeof( allowed_packets ) );
+        allowed_packets[SNAPSHOT_CONNECTION_REQUEST_PACKET] = 1;
+
+        uint8_t out_packet_data[sizeof( struct snapshot_connection_request_packet_t )];
+
+        uint64_t sequence = 0;
+
+        struct snapshot_connection_request_packet_t * packet = (struct snapshot_connection_request_packet_t*) snapshot_read_packet( handshake->packet_data, 
+                                                                                                                                    handshake->packet_bytes, 
+                                                                                                                                    &sequence, 
+                                                                                                                                    NULL, 
+                                                                                                                                    SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, 
+                                                                                                                                    protocol_id, 
+                                                                                                                                    handshake->current_timestamp, 
+                                                                                                                                    private_key, 
+                                                                                                                                    allowed_packets, 
+                                                                                                                                    out_packet_data, 
+                                                                                                                                    NULL );
+        if ( !packet )
+            return;
+
+        if ( snapshot_read_connect_token_private( packet->connect_token_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES, &handshake->connect_token ) != SNAPSHOT_OK )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "handshake ignored connection request. failed to read connect token" );
+            return;
+        }
+
+        handshake->cipher_suite = packet->cipher_suite;
+        handshake->connect_token_expire_timestamp = packet->connect_token_expire_timestamp;
+
+        memcpy( handshake->connect_token_mac, packet->connect_token_data + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES - SNAPSHOT_MAC_BYTES, SNAPSHOT_MAC_BYTES );
+
+        struct snapshot_challenge_token_t challenge_token;
+        snapshot_generate_challenge_token( &challenge_token, &handshake->connect_token, &handshake->from, packet->cipher_suite, packet->connect_token_expire_timestamp );
+
+        snapshot_write_challenge_token( &challenge_token, handshake->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+
+        if ( snapshot_encrypt_challenge_token( handshake->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES, handshake->challenge_token_sequence, challenge_key ) != SNAPSHOT_OK )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "handshake ignored connection request. failed to encrypt challenge token" );
+            return;
+        }
+
+        handshake->result = SNAPSHOT_OK;
+    }
+    else
+    {
+        // open the challenge token the client echoed back in its connection response and check the response mac
+
+        snapshot_assert( handshake->type == SNAPSHOT_HANDSHAKE_CONNECTION_RESPONSE );
+
+        uint8_t allowed_packets[SNAPSHOT_NUM_PACKETS];
+        memset( allowed_packets, 0, sizeof( allowed_packets ) );
+        allowed_packets[SNAPSHOT_CONNECTION_RESPONSE_PACKET] = 1;
+
+        uint8_t out_packet_data[sizeof( struct snapshot_connection_response_packet_t )];
+
+        uint64_t sequence = 0;
+
+        struct snapshot_connection_response_packet_t * packet = (struct snapshot_connection_response_packet_t*) snapshot_read_packet( handshake->packet_data, 
+                                                                                                                                      handshake->packet_bytes, 
+                                                                                                                                      &sequence, 
+                                                                                                                                      NULL, 
+                                                                                                                                      SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, 
+                                                                                                                                      protocol_id, 
+                                                                                                                                      handshake->current_timestamp, 
+                                                                                                                                      NULL, 
+                                                                                                                                      allowed_packets, 
+                                                                                                                                      out_packet_data, 
+                                                                                                                                      NULL );
+        if ( !packet )
+            return;
+
+        if ( snapshot_open_connection_response_packet( packet, &handshake->from, protocol_id, handshake->current_timestamp, challenge_key, &handshake->challenge_token ) != SNAPSHOT_OK )
+            return;
+
+        handshake->challenge_token_sequence = packet->challenge_token_sequence;
+
+        handshake->result = SNAPSHOT_OK;
+    }
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct snapshot_handshake_worker_t
+{
+    // jobs in [done_index,write_index) are waiting for the worker, jobs in [read_index,done_index) are waiting for the server.
+    // write_index is only changed by the server and done_index only by the worker, each with the mutex held. the server
+    // keeps the last done_index it saw, so it only takes the mutex once it has caught up with it
+
+    struct snapshot_platform_mutex_t mutex;
+    struct snapshot_platform_condition_t condition;
+    SNAPSHOT_BOOL quit;
+    uint32_t write_index;
+    uint32_t done_index;
+    uint32_t read_index;
+    uint32_t done_index_seen;
+    uint64_t jobs_completed;
+    uint64_t jobs_failed;
+    struct snapshot_handshake_pool_t * pool;
+    struct snapshot_handshake_t * jobs;
+    struct snapshot_platform_thread_t * thread;
+};
+
+struct snapshot_handshake_pool_t
+{
+    void * context;
+    int num_threads;
+    uint32_t queue_size;
+    uint32_t mask;
+    uint64_t protocol_id;
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    uint8_t challenge_key[SNAPSHOT_KEY_BYTES];
+    size_t memory_bytes;
+    int next_worker;
+    int begin_worker;
+    int completed_worker;
+    uint64_t jobs_queued;
+    uint64_t queue_drops;
+    uint64_t queue_max_depth;
+    struct snapshot_handshake_worker_t workers[SNAPSHOT_HANDSHAKE_MAX_THREADS];
+};
+
+static void snapshot_handshake_worker_function( void * arg )
+{
+    struct snapshot_handshake_worker_t * worker = (struct snapshot_handshake_worker_t*) arg;
+
+    snapshot_assert( worker );
+
+    struct snapshot_handshake_pool_t * pool = worker->pool;
+
+    snapshot_platform_mutex_acquire( &worker->mutex );
+
+    while ( 1 )
+    {
+        while ( !worker->quit && worker->done_index == worker->write_index )
+        {
+            snapshot_platform_condition_wait( &worker->condition, &worker->mutex );
+        }
+
+        if ( worker->quit )
+            break;
+
+        const uint32_t done_index = worker->done_index;
+
+        snapshot_platform_mutex_release( &worker->mutex );
+
+        struct snapshot_handshake_t * job = &worker->jobs[done_index & pool->mask];
+
+        snapshot_handshake_process( job, pool->protocol_id, pool->private_key, pool->challenge_key );
+
+        snapshot_platform_mutex_acquire( &worker->mutex );
+
+        if ( job->result == SNAPSHOT_OK )
+        {
+            worker->jobs_completed++;
+        }
+        else
+        {
+            worker->jobs_failed++;
+        }
+
+        worker->done_index = done_index + 1;
+    }
+
+    snapshot_platform_mutex_release( &worker->mutex );
+}
+
+struct snapshot_handshake_pool_t * snapshot_handshake_pool_create( void * context,
+                                                                   int num_threads,
+                                                                   int queue_size,
+                                                                   uint64_t protocol_id,
+                                                                   const uint8_t * private_key,
+                                                                   const uint8_t * challenge_key )
+{
+    snapshot_assert( private_key );
+    snapshot_assert( challenge_key );
+
+    if ( num_threads <= 0 || num_threads > SNAPSHOT_HANDSHAKE_MAX_THREADS )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "handshake threads must be in [1,%d]", SNAPSHOT_HANDSHAKE_MAX_THREADS );
+        return NULL;
+    }
+
+    if ( queue_size <= 0 || ( queue_size & ( queue_size - 1 ) ) != 0 )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "handshake queue size must be a power of two" );
+        return NULL;
+    }
+
+    struct snapshot_handshake_pool_t * pool = (struct snapshot_handshake_pool_t*) snapshot_malloc( context, sizeof( struct snapshot_handshake_pool_t ) );
+    if ( !pool )
+        return NULL;
+
+    memset( pool, 0, sizeof( struct snapshot_handshake_pool_t ) );
+
+    pool->context = context;
+    pool->num_threads = num_threads;
+    pool->queue_size = (uint32_t) queue_size;
+    pool->mask = (uint32_t) queue_size - 1;
+    pool->protocol_id = protocol_id;
+    memcpy( pool->private_key, private_key, SNAPSHOT_KEY_BYTES );
+    memcpy( pool->challenge_key, challenge_key, SNAPSHOT_KEY_BYTES );
+    pool->memory_bytes = sizeof( struct snapshot_handshake_pool_t ) + (size_t) num_threads * queue_size * sizeof( struct snapshot_handshake_t );
+
+    for ( int i = 0; i < num_threads; i++ )
+    {
+        struct snapshot_handshake_worker_t * worker = &pool->workers[i];
+
+        worker->pool = pool;
+        worker->quit = SNAPSHOT_FALSE;
+        worker->write_index = 0;
+        worker->done_index = 0;
+        worker->read_index = 0;
+        worker->done_index_seen = 0;
+        worker->jobs_completed = 0;
+        worker->jobs_failed = 0;
+
+        if ( snapshot_platform_mutex_create( &worker->mutex ) != SNAPSHOT_OK || snapshot_platform_condition_create( &worker->condition ) != SNAPSHOT_OK )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create handshake worker mutex" );
+            snapshot_handshake_pool_destroy( pool );
+            return NULL;
+        }
+
+        worker->jobs = (struct snapshot_handshake_t*) snapshot_malloc( context, (size_t) queue_size * sizeof( struct snapshot_handshake_t ) );
+        if ( !worker->jobs )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to allocate handshake queue" );
+            snapshot_handshake_pool_destroy( pool );
+            return NULL;
+        }
+    }
+
+    for ( int i = 0; i < num_threads; i++ )
+    {
+        pool->workers[i].thread = snapshot_platform_thread_create( context, snapshot_handshake_worker_function, &pool->workers[i] );
+        if ( !pool->workers[i].thread )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create handshake thread" );
+            snapshot_handshake_pool_destroy( pool );
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void snapshot_handshake_pool_destroy( struct snapshot_handshake_pool_t * pool )
+{
+    snapshot_assert( pool );
+
+    for ( int i = 0; i < pool->num_threads; i++ )
+    {
+        struct snapshot_handshake_worker_t * worker = &pool->workers[i];
+
+        if ( worker->thread )
+        {
+            snapshot_platform_mutex_acquire( &worker->mutex );
+            worker->quit = SNAPSHOT_TRUE;
+            snapshot_platform_condition_signal( &worker->condition );
+            snapshot_platform_mutex_release( &worker->mutex );
+
+            snapshot_platform_thread_join( worker->thread );
+            snapshot_platform_thread_destroy( worker->thread );
+        }
+    }
+
+    for ( int i = 0; i < pool->num_threads; i++ )
+    {
+        struct snapshot_handshake_worker_t * worker = &pool->workers[i];
+
+        if ( worker->jobs )
+        {
+            snapshot_free( pool->context, worker->jobs );
+        }
+
+        snapshot_platform_condition_destroy( &worker->condition );
+        snapshot_platform_mutex_destroy( &worker->mutex );
+    }
+
+    snapshot_free( pool->context, pool );
+}
+
+struct snapshot_handshake_t * snapshot_handshake_pool_begin_job( struct snapshot_handshake_pool_t * pool )
+{
+    snapshot_assert( pool );
+
+    // round robin across workers, skipping any whose ring is full. a job is only dropped when every ring is full.
+    // write_index and read_index are only changed on this thread, so they are read without the mutex
+
+    for ( int i = 0; i < pool->num_threads; i++ )
+    {
+        const int worker_index = ( pool->next_worker + i ) % pool->num_threads;
+
+        struct snapshot_handshake_worker_t * worker = &pool->workers[worker_index];
+
+        if ( worker->write_index - worker->read_index < pool->queue_size )
+        {
+            pool->begin_worker = worker_index;
+            struct snapshot_handshake_t * job = &worker->jobs[worker->write_index & pool->mask];
+            job->result = SNAPSHOT_ERROR;
+            return job;
+        }
+    }
+
+    pool->queue_drops++;
+
+    return NULL;
+}
+
+void snapshot_handshake_pool_commit_job( struct snapshot_handshake_pool_t * pool )
+{
+    snapshot_assert( pool );
+
+    struct snapshot_handshake_worker_t * worker = &pool->workers[pool->begin_worker];
+
+    snapshot_assert( worker->write_index - worker->read_index < pool->queue_size );
+
+    snapshot_platform_mutex_acquire( &worker->mutex );
+    worker->write_index++;
+    snapshot_platform_condition_signal( &worker->condition );
+    snapshot_platform_mutex_release( &worker->mutex );
+
+    pool->next_worker = ( pool->begin_worker + 1 ) % pool->num_threads;
+
+    pool->jobs_queued++;
+
+    const uint64_t depth = (uint64_t) snapshot_handshake_pool_queue_depth( pool );
+    if ( depth > pool->queue_max_depth )
+    {
+        pool->queue_max_depth = depth;
+    }
+}
+
+struct snapshot_handshake_t * snapshot_handshake_pool_next_completed_job( struct snapshot_handshake_pool_t * pool )
+{
+    snapshot_assert( pool );
+
+    for ( int i = 0; i < pool->num_threads; i++ )
+    {
+        const int worker_index = ( pool->completed_worker + i ) % pool->num_threads;
+
+        struct snapshot_handshake_worker_t * worker = &pool->workers[worker_index];
+
+        if ( worker->done_index_seen == worker->read_index && worker->write_index != worker->read_index )
+        {
+            snapshot_platform_mutex_acquire( &worker->mutex );
+            worker->done_index_seen = worker->done_index;
+            snapshot_platform_mutex_release( &worker->mutex );
+        }
+
+        if ( worker->done_index_seen != worker->read_index )
+        {
+            pool->completed_worker = worker_index;
+            return &worker->jobs[worker->read_index & pool->mask];
+        }
+    }
+
+    return NULL;
+}
+
+void snapshot_handshake_pool_release_job( struct snapshot_handshake_pool_t * pool )
+{
+    snapshot_assert( pool );
+
+    struct snapshot_handshake_worker_t * worker = &pool->workers[pool->completed_worker];
+
+    snapshot_assert( worker->read_index != worker->done_index_seen );
+
+    worker->read_index++;
+
+    pool->completed_worker = ( pool->completed_worker + 1 ) % pool->num_threads;
+}
+
+int snapshot_handshake_pool_queue_depth( struct snapshot_handshake_pool_t * pool )
+{
+    snapshot_assert( pool );
+
+    int depth = 0;
+    for ( int i = 0; i < pool->num_threads; i++ )
+    {
+        depth += (int) ( pool->workers[i].write_index - pool->workers[i].read_index );
+    }
+    return depth;
+}
+
+size_t snapshot_handshake_pool_memory_bytes( struct snapshot_handshake_pool_t * pool )
+{
+    snapshot_assert( pool );
+    return pool->memory_bytes;
+}
+
+void snapshot_handshake_pool_counters( struct snapshot_handshake_pool_t * pool, uint64_t * counters )
+{
+    snapshot_assert( pool );
+    snapshot_assert( counters );
+
+    memset( counters, 0, SNAPSHOT_HANDSHAKE_NUM_COUNTERS * sizeof(uint64_t) );
+
+    counters[SNAPSHOT_HANDSHAKE_COUNTER_JOBS_QUEUED] = pool->jobs_queued;
+    counters[SNAPSHOT_HANDSHAKE_COUNTER_QUEUE_DROPS] = pool->queue_drops;
+    counters[SNAPSHOT_HANDSHAKE_COUNTER_QUEUE_MAX_DEPTH] = pool->queue_max_depth;
+
+    for ( int i = 0; i < pool->num_threads; i++ )
+    {
+        struct snapshot_handshake_worker_t * worker = &pool->workers[i];
+        snapshot_platform_mutex_acquire( &worker->mutex );
+        counters[SNAPSHOT_HANDSHAKE_COUNTER_JOBS_COMPLETED] += worker->jobs_completed;
+        counters[SNAPSHOT_HANDSHAKE_COUNTER_JOBS_FAILED] += worker->jobs_failed;
+        snapshot_platform_mutex_release( &worker->mutex );
+    }
+}
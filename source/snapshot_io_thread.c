@@ -0,0 +1,467 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#include "snapshot_io_thread.h"
+#include "snapshot_address.h"
+#include "snapshot_platform.h"
+#include "snapshot_packets.h"
+
+// ------------------------------------------------------------------------------------------
+
+#define SNAPSHOT_IO_THREAD_PACKET_STRIDE ( SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES )
+
+// each ring index has a single writer. the writer reads its own index directly and publishes it with a release store,
+// and the other side reads it with an acquire load, so pushing and popping packets never takes a lock
+
+struct snapshot_packet_ring_t
+{
+    uint32_t write_index;
+    uint8_t write_index_padding[64 - sizeof(uint32_t)];
+    uint32_t read_index;
+    uint8_t read_index_padding[64 - sizeof(uint32_t)];
+    uint32_t num_entries;
+    uint32_t mask;
+    struct snapshot_address_t * address;
+    int * packet_bytes;
+    uint8_t * packet_buffer;
+};
+
+static int snapshot_packet_ring_create( void * context, struct snapshot_packet_ring_t * ring, int num_entries )
+{
+    snapshot_assert( ring );
+    snapshot_assert( num_entries > 0 );
+    snapshot_assert( ( num_entries & ( num_entries - 1 ) ) == 0 );
+
+    ring->write_index = 0;
+    ring->read_index = 0;
+    ring->num_entries = (uint32_t) num_entries;
+    ring->mask = (uint32_t) num_entries - 1;
+    ring->address = (struct snapshot_address_t*) snapshot_malloc( context, num_entries * sizeof(struct snapshot_address_t) );
+    ring->packet_bytes = (int*) snapshot_malloc( context, num_entries * sizeof(int) );
+    ring->packet_buffer = (uint8_t*) snapshot_malloc( context, (size_t) num_entries * SNAPSHOT_IO_THREAD_PACKET_STRIDE );
+
+    if ( !ring->address || !ring->packet_bytes || !ring->packet_buffer )
+        return SNAPSHOT_ERROR;
+
+    return SNAPSHOT_OK;
+}
+
+static void snapshot_packet_ring_destroy( void * context, struct snapshot_packet_ring_t * ring )
+{
+    snapshot_assert( ring );
+    snapshot_free( context, ring->address );
+    snapshot_free( context, ring->packet_bytes );
+    snapshot_free( context, ring->packet_buffer );
+    ring->address = NULL;
+    ring->packet_bytes = NULL;
+    ring->packet_buffer = NULL;
+}
+
+static inline uint8_t * snapshot_packet_ring_packet_data( struct snapshot_packet_ring_t * ring, uint32_t index )
+{
+    return ring->packet_buffer + (size_t) ( index & ring->mask ) * SNAPSHOT_IO_THREAD_PACKET_STRIDE + SNAPSHOT_PACKET_PREFIX_BYTES;
+}
+
+static inline int snapshot_packet_ring_depth( struct snapshot_packet_ring_t * ring )
+{
+    const uint32_t read_index = snapshot_platform_atomic_load_uint32( &ring->read_index );
+    const uint32_t write_index = snapshot_platform_atomic_load_uint32( &ring->write_index );
+    return (int) ( write_index - read_index );
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct snapshot_io_thread_t
+{
+    void * context;
+    struct snapshot_platform_socket_t * socket;
+    struct snapshot_platform_thread_t * receive_thread;
+    struct snapshot_platform_thread_t * send_thread;
+    struct snapshot_platform_mutex_t send_mutex;
+    struct snapshot_platform_condition_t send_condition;
+    uint32_t send_waiting;
+    uint32_t quit;
+    size_t memory_bytes;
+    struct snapshot_packet_ring_t receive_ring;
+    struct snapshot_packet_ring_t send_ring;
+    uint64_t counters[SNAPSHOT_IO_THREAD_NUM_COUNTERS];
+    uint8_t * drop_packet_data[SNAPSHOT_IO_THREAD_BATCH_SIZE];
+    uint8_t drop_buffer[SNAPSHOT_IO_THREAD_BATCH_SIZE][SNAPSHOT_MAX_PACKET_BYTES];
+};
+
+// each counter has a single writer, so a relaxed load and store is enough and avoids a locked add per packet
+
+static inline void snapshot_io_thread_counter_add( struct snapshot_io_thread_t * io_thread, int index, uint64_t value )
+{
+    snapshot_platform_atomic_store_uint64( &io_thread->counters[index], snapshot_platform_atomic_load_uint64( &io_thread->counters[index] ) + value );
+}
+
+static inline void snapshot_io_thread_counter_max( struct snapshot_io_thread_t * io_thread, int index, uint64_t value )
+{
+    if ( value > snapshot_platform_atomic_load_uint64( &io_thread->counters[index] ) )
+    {
+        snapshot_platform_atomic_store_uint64( &io_thread->counters[index], value );
+    }
+}
+
+static void snapshot_io_thread_receive( struct snapshot_io_thread_t * io_thread )
+{
+    struct snapshot_packet_ring_t * ring = &io_thread->receive_ring;
+
+    const uint32_t write_index = ring->write_index;
+    const uint32_t read_index = snapshot_platform_atomic_load_uint32( &ring->read_index );
+
+    int max_packets = (int) ( ring->num_entries - ( write_index - read_index ) );
+    if ( max_packets > SNAPSHOT_IO_THREAD_BATCH_SIZE )
+    {
+        max_packets = SNAPSHOT_IO_THREAD_BATCH_SIZE;
+    }
+
+    struct snapshot_address_t from[SNAPSHOT_IO_THREAD_BATCH_SIZE];
+    int packet_bytes[SNAPSHOT_IO_THREAD_BATCH_SIZE];
+
+    if ( max_packets == 0 )
+    {
+        // the game thread has fallen behind. keep draining the socket so we block on it, but drop what we read
+
+        const int num_packets = snapshot_platform_socket_receive_packets( io_thread->socket, from, io_thread->drop_packet_data, packet_bytes, SNAPSHOT_MAX_PACKET_BYTES, SNAPSHOT_IO_THREAD_BATCH_SIZE );
+        if ( num_packets > 0 )
+        {
+            snapshot_io_thread_counter_add( io_thread, SNAPSHOT_IO_THREAD_COUNTER_RECEIVE_QUEUE_DROPS, num_packets );
+        }
+        return;
+    }
+
+    // receive straight into ring slots, so packets are not copied again on the way to the game thread
+
+    uint8_t * packet_data[SNAPSHOT_IO_THREAD_BATCH_SIZE];
+    for ( int i = 0; i < max_packets; i++ )
+    {
+        packet_data[i] = snapshot_packet_ring_packet_data( ring, write_index + i );
+    }
+
+    const int num_packets = snapshot_platform_socket_receive_packets( io_thread->socket, from, packet_data, packet_bytes, SNAPSHOT_MAX_PACKET_BYTES, max_packets );
+
+    int num_queued = 0;
+    for ( int i = 0; i < num_packets; i++ )
+    {
+        if ( packet_bytes[i] == 0 )
+            continue;
+
+        const uint32_t index = write_index + num_queued;
+
+        if ( num_queued != i )
+        {
+            memmove( snapshot_packet_ring_packet_data( ring, index ), packet_data[i], packet_bytes[i] );
+        }
+
+        ring->address[index & ring->mask] = from[i];
+        ring->packet_bytes[index & ring->mask] = packet_bytes[i];
+
+        num_queued++;
+    }
+
+    if ( num_queued == 0 )
+        return;
+
+    snapshot_platform_atomic_store_uint32( &ring->write_index, write_index + num_queued );
+
+    snapshot_io_thread_counter_add( io_thread, SNAPSHOT_IO_THREAD_COUNTER_PACKETS_RECEIVED, num_queued );
+    snapshot_io_thread_counter_max( io_thread, SNAPSHOT_IO_THREAD_COUNTER_RECEIVE_QUEUE_MAX_DEPTH, write_index + num_queued - read_index );
+}
+
+static void snapshot_io_thread_receive_function( void * arg )
+{
+    struct snapshot_io_thread_t * io_thread = (struct snapshot_io_thread_t*) arg;
+
+    snapshot_assert( io_thread );
+
+    while ( !snapshot_platform_atomic_load_uint32( &io_thread->quit ) )
+    {
+        snapshot_io_thread_receive( io_thread );
+    }
+}
+
+static void snapshot_io_thread_wait_for_send( struct snapshot_io_thread_t * io_thread )
+{
+    // only an idle send thread takes the mutex. it flags that it is waiting before it checks the ring one last time,
+    // and the game thread clears the flag after every push, so either the push is seen here or the game thread signals
+
+    struct snapshot_packet_ring_t * ring = &io_thread->send_ring;
+
+    snapshot_platform_mutex_acquire( &io_thread->send_mutex );
+
+    while ( 1 )
+    {
+        snapshot_platform_atomic_exchange_uint32( &io_thread->send_waiting, 1 );
+
+        if ( snapshot_platform_atomic_load_uint32( &io_thread->quit ) || snapshot_platform_atomic_load_uint32( &ring->write_index ) != ring->read_index )
+            break;
+
+        snapshot_platform_condition_wait( &io_thread->send_condition, &io_thread->send_mutex );
+    }
+
+    snapshot_platform_mutex_release( &io_thread->send_mutex );
+}
+
+static void snapshot_io_thread_send_function( void * arg )
+{
+    struct snapshot_io_thread_t * io_thread = (struct snapshot_io_thread_t*) arg;
+
+    snapshot_assert( io_thread );
+
+    // sends run on their own thread, woken as soon as the game thread queues a packet, so they never wait behind a
+    // blocking receive. on quit, anything still queued is flushed first, eg. disconnect packets
+
+    struct snapshot_packet_ring_t * ring = &io_thread->send_ring;
+
+    while ( 1 )
+    {
+        // read quit before the write index, so packets queued before destroy are always seen
+
+        const uint32_t quit = snapshot_platform_atomic_load_uint32( &io_thread->quit );
+        const uint32_t read_index = ring->read_index;
+        const uint32_t write_index = snapshot_platform_atomic_load_uint32( &ring->write_index );
+
+        if ( read_index == write_index )
+        {
+            if ( quit )
+                break;
+
+            snapshot_io_thread_wait_for_send( io_thread );
+
+            continue;
+        }
+
+        int num_packets = (int) ( write_index - read_index );
+        if ( num_packets > SNAPSHOT_IO_THREAD_BATCH_SIZE )
+        {
+            num_packets = SNAPSHOT_IO_THREAD_BATCH_SIZE;
+        }
+
+        struct snapshot_address_t to[SNAPSHOT_IO_THREAD_BATCH_SIZE];
+        uint8_t * packet_data[SNAPSHOT_IO_THREAD_BATCH_SIZE];
+        int packet_bytes[SNAPSHOT_IO_THREAD_BATCH_SIZE];
+
+        for ( int i = 0; i < num_packets; i++ )
+        {
+            const uint32_t index = read_index + i;
+            to[i] = ring->address[index & ring->mask];
+            packet_data[i] = snapshot_packet_ring_packet_data( ring, index );
+            packet_bytes[i] = ring->packet_bytes[index & ring->mask];
+        }
+
+        snapshot_platform_socket_send_packets( io_thread->socket, to, packet_data, packet_bytes, num_packets );
+
+        snapshot_platform_atomic_store_uint32( &ring->read_index, read_index + num_packets );
+
+        snapshot_io_thread_counter_add( io_thread, SNAPSHOT_IO_THREAD_COUNTER_PACKETS_SENT, num_packets );
+    }
+}
+
+struct snapshot_io_thread_t * snapshot_io_thread_create( void * context, struct snapshot_platform_socket_t * socket, int queue_size )
+{
+    snapshot_assert( socket );
+
+    if ( queue_size <= 0 || ( queue_size & ( queue_size - 1 ) ) != 0 )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "io thread queue size must be a power of two" );
+        return NULL;
+    }
+
+    struct snapshot_io_thread_t * io_thread = (struct snapshot_io_thread_t*) snapshot_malloc( context, sizeof( struct snapshot_io_thread_t ) );
+    if ( !io_thread )
+        return NULL;
+
+    memset( io_thread, 0, sizeof( struct snapshot_io_thread_t ) );
+
+    io_thread->context = context;
+    io_thread->socket = socket;
+    io_thread->memory_bytes = sizeof( struct snapshot_io_thread_t ) + 2 * (size_t) queue_size * ( SNAPSHOT_IO_THREAD_PACKET_STRIDE + sizeof(struct snapshot_address_t) + sizeof(int) );
+
+    for ( int i = 0; i < SNAPSHOT_IO_THREAD_BATCH_SIZE; i++ )
+    {
+        io_thread->drop_packet_data[i] = io_thread->drop_buffer[i];
+    }
+
+    if ( snapshot_platform_mutex_create( &io_thread->send_mutex ) != SNAPSHOT_OK || 
+         snapshot_platform_condition_create( &io_thread->send_condition ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create io thread mutex" );
+        snapshot_io_thread_destroy( io_thread );
+        return NULL;
+    }
+
+    if ( snapshot_packet_ring_create( context, &io_thread->receive_ring, queue_size ) != SNAPSHOT_OK || 
+         snapshot_packet_ring_create( context, &io_thread->send_ring, queue_size ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to allocate io thread queues" );
+        snapshot_io_thread_destroy( io_thread );
+        return NULL;
+    }
+
+    io_thread->receive_thread = snapshot_platform_thread_create( context, snapshot_io_thread_receive_function, io_thread );
+    io_thread->send_thread = snapshot_platform_thread_create( context, snapshot_io_thread_send_function, io_thread );
+    if ( !io_thread->receive_thread || !io_thread->send_thread )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create io thread" );
+        snapshot_io_thread_destroy( io_thread );
+        return NULL;
+    }
+
+    return io_thread;
+}
+
+void snapshot_io_thread_destroy( struct snapshot_io_thread_t * io_thread )
+{
+    snapshot_assert( io_thread );
+
+    if ( io_thread->receive_thread || io_thread->send_thread )
+    {
+        snapshot_platform_atomic_store_uint32( &io_thread->quit, 1 );
+        snapshot_platform_mutex_acquire( &io_thread->send_mutex );
+        snapshot_platform_condition_signal( &io_thread->send_condition );
+        snapshot_platform_mutex_release( &io_thread->send_mutex );
+    }
+
+    if ( io_thread->receive_thread )
+    {
+        snapshot_platform_thread_join( io_thread->receive_thread );
+        snapshot_platform_thread_destroy( io_thread->receive_thread );
+    }
+
+    if ( io_thread->send_thread )
+    {
+        snapshot_platform_thread_join( io_thread->send_thread );
+        snapshot_platform_thread_destroy( io_thread->send_thread );
+    }
+
+    snapshot_platform_condition_destroy( &io_thread->send_condition );
+    snapshot_platform_mutex_destroy( &io_thread->send_mutex );
+
+    snapshot_packet_ring_destroy( io_thread->context, &io_thread->receive_ring );
+    snapshot_packet_ring_destroy( io_thread->context, &io_thread->send_ring );
+
+    snapshot_free( io_thread->context, io_thread );
+}
+
+int snapshot_io_thread_receive_packets( struct snapshot_io_thread_t * io_thread, struct snapshot_address_t * from, uint8_t ** packet_data, int * packet_bytes, int max_packets )
+{
+    snapshot_assert( io_thread );
+    snapshot_assert( from );
+    snapshot_assert( packet_data );
+    snapshot_assert( packet_bytes );
+    snapshot_assert( max_packets > 0 );
+
+    struct snapshot_packet_ring_t * ring = &io_thread->receive_ring;
+
+    const uint32_t read_index = ring->read_index;
+    const uint32_t write_index = snapshot_platform_atomic_load_uint32( &ring->write_index );
+
+    int num_packets = (int) ( write_index - read_index );
+    if ( num_packets > max_packets )
+    {
+        num_packets = max_packets;
+    }
+
+    // packet data points into the ring and stays valid until the packets are released
+
+    for ( int i = 0; i < num_packets; i++ )
+    {
+        const uint32_t index = read_index + i;
+        from[i] = ring->address[index & ring->mask];
+        packet_data[i] = snapshot_packet_ring_packet_data( ring, index );
+        packet_bytes[i] = ring->packet_bytes[index & ring->mask];
+    }
+
+    return num_packets;
+}
+
+void snapshot_io_thread_release_packets( struct snapshot_io_thread_t * io_thread, int num_packets )
+{
+    snapshot_assert( io_thread );
+    snapshot_assert( num_packets >= 0 );
+
+    struct snapshot_packet_ring_t * ring = &io_thread->receive_ring;
+
+    snapshot_assert( num_packets <= (int) ( snapshot_platform_atomic_load_uint32( &ring->write_index ) - ring->read_index ) );
+
+    snapshot_platform_atomic_store_uint32( &ring->read_index, ring->read_index + num_packets );
+}
+
+SNAPSHOT_BOOL snapshot_io_thread_send_packet( struct snapshot_io_thread_t * io_thread, const struct snapshot_address_t * to, const uint8_t * packet_data, int packet_bytes )
+{
+    snapshot_assert( io_thread );
+    snapshot_assert( to );
+    snapshot_assert( packet_data );
+    snapshot_assert( packet_bytes > 0 );
+    snapshot_assert( packet_bytes <= SNAPSHOT_MAX_PACKET_BYTES );
+
+    struct snapshot_packet_ring_t * ring = &io_thread->send_ring;
+
+    const uint32_t write_index = ring->write_index;
+    const uint32_t depth = write_index - snapshot_platform_atomic_load_uint32( &ring->read_index );
+
+    if ( depth == ring->num_entries )
+    {
+        snapshot_io_thread_counter_add( io_thread, SNAPSHOT_IO_THREAD_COUNTER_SEND_QUEUE_DROPS, 1 );
+        return SNAPSHOT_FALSE;
+    }
+
+    // the slot is free, and the send thread won't touch it until the write index moves past it
+
+    memcpy( snapshot_packet_ring_packet_data( ring, write_index ), packet_data, packet_bytes );
+    ring->address[write_index & ring->mask] = *to;
+    ring->packet_bytes[write_index & ring->mask] = packet_bytes;
+
+    snapshot_platform_atomic_store_uint32( &ring->write_index, write_index + 1 );
+
+    snapshot_io_thread_counter_max( io_thread, SNAPSHOT_IO_THREAD_COUNTER_SEND_QUEUE_MAX_DEPTH, depth + 1 );
+
+    // the lock is only taken when the send thread has gone idle. see snapshot_io_thread_wait_for_send
+
+    if ( snapshot_platform_atomic_exchange_uint32( &io_thread->send_waiting, 0 ) )
+    {
+        snapshot_platform_mutex_acquire( &io_thread->send_mutex );
+        snapshot_platform_condition_signal( &io_thread->send_condition );
+        snapshot_platform_mutex_release( &io_thread->send_mutex );
+    }
+
+    return SNAPSHOT_TRUE;
+}
+
+int snapshot_io_thread_receive_queue_depth( struct snapshot_io_thread_t * io_thread )
+{
+    snapshot_assert( io_thread );
+    return snapshot_packet_ring_depth( &io_thread->receive_ring );
+}
+
+int snapshot_io_thread_send_queue_depth( struct snapshot_io_thread_t * io_thread )
+{
+    snapshot_assert( io_thread );
+    return snapshot_packet_ring_depth( &io_thread->send_ring );
+}
+
+size_t snapshot_io_thread_memory_bytes( struct snapshot_io_thread_t * io_thread )
+{
+    snapshot_assert( io_thread );
+    return io_thread->memory_bytes;
+}
+
+void snapshot_io_thread_counters( struct snapshot_io_thread_t * io_thread, uint64_t * counters )
+{
+    snapshot_assert( io_thread );
+    snapshot_assert( counters );
+
+    for ( int i = 0; i < SNAPSHOT_IO_THREAD_NUM_COUNTERS; i++ )
+    {
+        counters[i] = snapshot_platform_atomic_load_uint64( &io_thread->counters[i] );
+    }
+}
@@ -0,0 +1,301 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+
+#include "snapshot_packed_sequence_buffer.h"
+#include "snapshot_util.h"
+
+// -----------------------------------------------------------------------------------------
+
+static int snapshot_packed_sequence_buffer_slot_stride( int entry_stride )
+{
+    // entry data first, then the sequence tag in the last two bytes of the slot. slots are 8 byte aligned so entries holding doubles stay aligned
+
+    const int slot_bytes = entry_stride + (int) sizeof( uint16_t );
+    return ( slot_bytes + 7 ) & ~7;
+}
+
+static uint8_t * snapshot_packed_sequence_buffer_slot( struct snapshot_packed_sequence_buffer_t * sequence_buffer, int index )
+{
+    return sequence_buffer->slot_data + index * sequence_buffer->slot_stride;
+}
+
+static uint16_t * snapshot_packed_sequence_buffer_slot_tag( struct snapshot_packed_sequence_buffer_t * sequence_buffer, int index )
+{
+    return (uint16_t*) ( sequence_buffer->slot_data + ( index + 1 ) * sequence_buffer->slot_stride - sizeof( uint16_t ) );
+}
+
+static int snapshot_packed_sequence_buffer_occupied( struct snapshot_packed_sequence_buffer_t * sequence_buffer, int index )
+{
+    return (int) ( ( sequence_buffer->occupied[index>>6] >> ( index & 63 ) ) & 1 );
+}
+
+static void snapshot_packed_sequence_buffer_clear_slots( struct snapshot_packed_sequence_buffer_t * sequence_buffer, int index, int count, void (*cleanup_function)(void*,void*) )
+{
+    snapshot_assert( count <= sequence_buffer->num_entries );
+
+    while ( count > 0 )
+    {
+        const int word = index >> 6;
+        const int bit = index & 63;
+
+        int n = 64 - bit;
+        if ( n > count )
+            n = count;
+        if ( n > sequence_buffer->num_entries - index )
+            n = sequence_buffer->num_entries - index;
+
+        const uint64_t mask = ( ( n == 64 ) ? ~0ULL : ( ( 1ULL << n ) - 1 ) ) << bit;
+
+        if ( cleanup_function )
+        {
+            uint64_t cleared = sequence_buffer->occupied[word] & mask;
+            while ( cleared )
+            {
+                const int i = snapshot_trailing_zeros_uint64( cleared );
+                cleanup_function( sequence_buffer->context, snapshot_packed_sequence_buffer_slot( sequence_buffer, word * 64 + i ) );
+                cleared &= cleared - 1;
+            }
+        }
+
+        sequence_buffer->occupied[word] &= ~mask;
+
+        index = ( index + n ) & sequence_buffer->entry_mask;
+        count -= n;
+    }
+}
+
+// -----------------------------------------------------------------------------------------
+
+struct snapshot_packed_sequence_buffer_t * snapshot_packed_sequence_buffer_create( void * context, int num_entries, int entry_stride )
+{
+    snapshot_assert( num_entries > 0 );
+    snapshot_assert( num_entries <= 32768 );
+    snapshot_assert( ( num_entries & ( num_entries - 1 ) ) == 0 );
+    snapshot_assert( entry_stride > 0 );
+
+    struct snapshot_packed_sequence_buffer_t * sequence_buffer = (struct snapshot_packed_sequence_buffer_t*) snapshot_malloc( context, sizeof( struct snapshot_packed_sequence_buffer_t ) );
+
+    const int num_words = ( num_entries + 63 ) / 64;
+
+    sequence_buffer->context = context;
+    sequence_buffer->sequence = 0;
+    sequence_buffer->num_entries = num_entries;
+    sequence_buffer->entry_mask = num_entries - 1;
+    sequence_buffer->entry_stride = entry_stride;
+    sequence_buffer->slot_stride = snapshot_packed_sequence_buffer_slot_stride( entry_stride );
+    sequence_buffer->occupied = (uint64_t*) snapshot_malloc( context, num_words * sizeof( uint64_t ) );
+    sequence_buffer->slot_data = (uint8_t*) snapshot_malloc( context, num_entries * sequence_buffer->slot_stride );
+    snapshot_assert( sequence_buffer->occupied );
+    snapshot_assert( sequence_buffer->slot_data );
+    memset( sequence_buffer->occupied, 0, num_words * sizeof( uint64_t ) );
+    memset( sequence_buffer->slot_data, 0, num_entries * sequence_buffer->slot_stride );
+
+    return sequence_buffer;
+}
+
+void snapshot_packed_sequence_buffer_destroy( struct snapshot_packed_sequence_buffer_t * sequence_buffer )
+{
+    snapshot_assert( sequence_buffer );
+    snapshot_free( sequence_buffer->context, sequence_buffer->occupied );
+    snapshot_free( sequence_buffer->context, sequence_buffer->slot_data );
+    snapshot_free( sequence_buffer->context, sequence_buffer );
+}
+
+size_t snapshot_packed_sequence_buffer_memory_bytes( int num_entries, int entry_stride )
+{
+    return sizeof( struct snapshot_packed_sequence_buffer_t ) + 
+           ( ( num_entries + 63 ) / 64 ) * sizeof( uint64_t ) + 
+           num_entries * snapshot_packed_sequence_buffer_slot_stride( entry_stride );
+}
+
+void snapshot_packed_sequence_buffer_reset( struct snapshot_packed_sequence_buffer_t * sequence_buffer )
+{
+    snapshot_assert( sequence_buffer );
+    sequence_buffer->sequence = 0;
+    memset( sequence_buffer->occupied, 0, ( ( sequence_buffer->num_entries + 63 ) / 64 ) * sizeof( uint64_t ) );
+}
+
+void snapshot_packed_sequence_buffer_remove_entries( struct snapshot_packed_sequence_buffer_t * sequence_buffer, 
+                                                     uint16_t start_sequence, 
+                                                     uint16_t finish_sequence, 
+                                                     void (*cleanup_function)(void*,void*) )
+{
+    snapshot_assert( sequence_buffer );
+
+    const int count = ( (uint16_t) ( finish_sequence - start_sequence ) ) + 1;
+
+    if ( count < sequence_buffer->num_entries )
+    {
+        snapshot_packed_sequence_buffer_clear_slots( sequence_buffer, start_sequence & sequence_buffer->entry_mask, count, cleanup_function );
+    }
+    else
+    {
+        snapshot_packed_sequence_buffer_clear_slots( sequence_buffer, 0, sequence_buffer->num_entries, cleanup_function );
+    }
+}
+
+int snapshot_packed_sequence_buffer_test_insert( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence )
+{
+    return snapshot_sequence_less_than( sequence, sequence_buffer->sequence - ((uint16_t)sequence_buffer->num_entries) ) ? 0 : 1;
+}
+
+void * snapshot_packed_sequence_buffer_insert( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence )
+{
+    snapshot_assert( sequence_buffer );
+
+    if ( snapshot_sequence_less_than( sequence, sequence_buffer->sequence - ((uint16_t)sequence_buffer->num_entries) ) )
+    {
+        return NULL;
+    }
+
+    if ( snapshot_sequence_greater_than( sequence + 1, sequence_buffer->sequence ) )
+    {
+        snapshot_packed_sequence_buffer_remove_entries( sequence_buffer, sequence_buffer->sequence, sequence, NULL );
+        sequence_buffer->sequence = sequence + 1;
+    }
+
+    const int index = sequence & sequence_buffer->entry_mask;
+
+    sequence_buffer->occupied[index>>6] |= 1ULL << ( index & 63 );
+
+    *snapshot_packed_sequence_buffer_slot_tag( sequence_buffer, index ) = sequence;
+
+    return snapshot_packed_sequence_buffer_slot( sequence_buffer, index );
+}
+
+void snapshot_packed_sequence_buffer_advance( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence )
+{
+    snapshot_assert( sequence_buffer );
+
+    if ( snapshot_sequence_greater_than( sequence + 1, sequence_buffer->sequence ) )
+    {
+        snapshot_packed_sequence_buffer_remove_entries( sequence_buffer, sequence_buffer->sequence, sequence, NULL );
+        sequence_buffer->sequence = sequence + 1;
+    }
+}
+
+void * snapshot_packed_sequence_buffer_insert_with_cleanup( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence, void (*cleanup_function)(void*,void*) )
+{
+    snapshot_assert( sequence_buffer );
+
+    if ( snapshot_sequence_greater_than( sequence + 1, sequence_buffer->sequence ) )
+    {
+        snapshot_packed_sequence_buffer_remove_entries( sequence_buffer, sequence_buffer->sequence, sequence, cleanup_function );
+        sequence_buffer->sequence = sequence + 1;
+    }
+    else if ( snapshot_sequence_less_than( sequence, sequence_buffer->sequence - ((uint16_t)sequence_buffer->num_entries) ) )
+    {
+        return NULL;
+    }
+
+    const int index = sequence & sequence_buffer->entry_mask;
+
+    if ( snapshot_packed_sequence_buffer_occupied( sequence_buffer, index ) )
+    {
+        cleanup_function( sequence_buffer->context, snapshot_packed_sequence_buffer_slot( sequence_buffer, index ) );
+    }
+
+    sequence_buffer->occupied[index>>6] |= 1ULL << ( index & 63 );
+
+    *snapshot_packed_sequence_buffer_slot_tag( sequence_buffer, index ) = sequence;
+
+    return snapshot_packed_sequence_buffer_slot( sequence_buffer, index );
+}
+
+void snapshot_packed_sequence_buffer_advance_with_cleanup( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence, void (*cleanup_function)(void*,void*) )
+{
+    snapshot_assert( sequence_buffer );
+
+    if ( snapshot_sequence_greater_than( sequence + 1, sequence_buffer->sequence ) )
+    {
+        snapshot_packed_sequence_buffer_remove_entries( sequence_buffer, sequence_buffer->sequence, sequence, cleanup_function );
+        sequence_buffer->sequence = sequence + 1;
+    }
+}
+
+void snapshot_packed_sequence_buffer_remove( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence )
+{
+    snapshot_assert( sequence_buffer );
+    const int index = sequence & sequence_buffer->entry_mask;
+    sequence_buffer->occupied[index>>6] &= ~( 1ULL << ( index & 63 ) );
+}
+
+void snapshot_packed_sequence_buffer_remove_with_cleanup( struct snapshot_packed_sequence_buffer_t * sequence_buffer, 
+                                                          uint16_t sequence, 
+                                                          void (*cleanup_function)(void*,void*) )
+{
+    snapshot_assert( sequence_buffer );
+
+    const int index = sequence & sequence_buffer->entry_mask;
+
+    if ( snapshot_packed_sequence_buffer_occupied( sequence_buffer, index ) )
+    {
+        sequence_buffer->occupied[index>>6] &= ~( 1ULL << ( index & 63 ) );
+        cleanup_function( sequence_buffer->context, snapshot_packed_sequence_buffer_slot( sequence_buffer, index ) );
+    }
+}
+
+int snapshot_packed_sequence_buffer_available( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence )
+{
+    snapshot_assert( sequence_buffer );
+    return !snapshot_packed_sequence_buffer_occupied( sequence_buffer, sequence & sequence_buffer->entry_mask );
+}
+
+int snapshot_packed_sequence_buffer_exists( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence )
+{
+    snapshot_assert( sequence_buffer );
+
+    const int index = sequence & sequence_buffer->entry_mask;
+
+    return snapshot_packed_sequence_buffer_occupied( sequence_buffer, index ) && *snapshot_packed_sequence_buffer_slot_tag( sequence_buffer, index ) == sequence;
+}
+
+void * snapshot_packed_sequence_buffer_find( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t sequence )
+{
+    snapshot_assert( sequence_buffer );
+
+    const int index = sequence & sequence_buffer->entry_mask;
+
+    if ( !snapshot_packed_sequence_buffer_occupied( sequence_buffer, index ) || *snapshot_packed_sequence_buffer_slot_tag( sequence_buffer, index ) != sequence )
+    {
+        return NULL;
+    }
+
+    return snapshot_packed_sequence_buffer_slot( sequence_buffer, index );
+}
+
+void * snapshot_packed_sequence_buffer_at_index( struct snapshot_packed_sequence_buffer_t * sequence_buffer, int index )
+{
+    snapshot_assert( sequence_buffer );
+    snapshot_assert( index >= 0 );
+    snapshot_assert( index < sequence_buffer->num_entries );
+
+    return snapshot_packed_sequence_buffer_occupied( sequence_buffer, index ) ? snapshot_packed_sequence_buffer_slot( sequence_buffer, index ) : NULL;
+}
+
+void snapshot_packed_sequence_buffer_generate_ack_bits( struct snapshot_packed_sequence_buffer_t * sequence_buffer, uint16_t * ack, uint32_t * ack_bits )
+{
+    snapshot_assert( sequence_buffer );
+    snapshot_assert( ack );
+    snapshot_assert( ack_bits );
+
+    *ack = sequence_buffer->sequence - 1;
+    *ack_bits = 0;
+    uint32_t mask = 1;
+    
+    for ( int i = 0; i < 32; ++i )
+    {
+        uint16_t sequence = *ack - ((uint16_t)i);
+        if ( snapshot_packed_sequence_buffer_exists( sequence_buffer, sequence ) )
+            *ack_bits |= mask;
+        mask <<= 1;
+    }
+}
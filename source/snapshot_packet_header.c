@@ -11,31 +11,90 @@
 #include "snapshot_packet_header.h"
 #include "snapshot_read_write.h"
 
-int snapshot_write_packet_header( uint8_t * packet_data, uint16_t sequence, uint16_t ack, uint32_t ack_bits )
+static uint8_t snapshot_ack_word_mask( uint32_t ack_bits )
 {
-    uint8_t * p = packet_data;
-
-    uint8_t prefix_byte = 0;
+    uint8_t mask = 0;
 
     if ( ( ack_bits & 0x000000FF ) != 0x000000FF )
     {
-        prefix_byte |= (1<<1);
+        mask |= (1<<0);
     }
 
     if ( ( ack_bits & 0x0000FF00 ) != 0x0000FF00 )
     {
-        prefix_byte |= (1<<2);
+        mask |= (1<<1);
     }
 
     if ( ( ack_bits & 0x00FF0000 ) != 0x00FF0000 )
     {
-        prefix_byte |= (1<<3);
+        mask |= (1<<2);
     }
 
     if ( ( ack_bits & 0xFF000000 ) != 0xFF000000 )
     {
-        prefix_byte |= (1<<4);
+        mask |= (1<<3);
+    }
+
+    return mask;
+}
+
+static void snapshot_write_ack_word( uint8_t ** p, uint32_t ack_bits, uint8_t mask )
+{
+    for ( int i = 0; i < 4; ++i )
+    {
+        if ( mask & (1<<i) )
+        {
+            snapshot_write_uint8( p, (uint8_t) ( ( ack_bits >> ( i * 8 ) ) & 0xFF ) );
+        }
+    }
+}
+
+static uint32_t snapshot_read_ack_word( const uint8_t ** p, uint8_t mask )
+{
+    uint32_t ack_bits = 0xFFFFFFFF;
+
+    for ( int i = 0; i < 4; ++i )
+    {
+        if ( mask & (1<<i) )
+        {
+            ack_bits &= ~( 0xFFU << ( i * 8 ) );
+            ack_bits |= ( (uint32_t) snapshot_read_uint8( p ) ) << ( i * 8 );
+        }
+    }
+
+    return ack_bits;
+}
+
+static int snapshot_ack_word_bytes( uint8_t mask )
+{
+    int bytes = 0;
+    for ( int i = 0; i < 4; ++i )
+    {
+        if ( mask & (1<<i) )
+        {
+            bytes++;
+        }
     }
+    return bytes;
+}
+
+int snapshot_write_packet_header( uint8_t * packet_data, uint16_t sequence, uint16_t ack, uint32_t ack_bits )
+{
+    return snapshot_write_packet_header_ack_words( packet_data, sequence, ack, &ack_bits, 1 );
+}
+
+int snapshot_write_packet_header_ack_words( uint8_t * packet_data, uint16_t sequence, uint16_t ack, const uint32_t * ack_bits, int num_ack_words )
+{
+    snapshot_assert( ack_bits );
+    snapshot_assert( num_ack_words >= 1 );
+    snapshot_assert( num_ack_words <= SNAPSHOT_MAX_ACK_WORDS );
+    snapshot_assert( ( num_ack_words & ( num_ack_words - 1 ) ) == 0 );
+
+    uint8_t * p = packet_data;
+
+    const uint8_t ack_mask = snapshot_ack_word_mask( ack_bits[0] );
+
+    uint8_t prefix_byte = (uint8_t) ( ack_mask << 1 );
 
     int sequence_difference = sequence - ack;
     if ( sequence_difference < 0 )
@@ -43,6 +102,9 @@ int snapshot_write_packet_header( uint8_t * packet_data, uint16_t sequence, uint
     if ( sequence_difference <= 255 )
         prefix_byte |= (1<<5);
 
+    if ( num_ack_words > 1 )
+        prefix_byte |= (1<<6);
+
     snapshot_write_uint8( &p, prefix_byte );
 
     snapshot_write_uint16( &p, sequence );
@@ -56,24 +118,18 @@ int snapshot_write_packet_header( uint8_t * packet_data, uint16_t sequence, uint
         snapshot_write_uint16( &p, ack );
     }
 
-    if ( ( ack_bits & 0x000000FF ) != 0x000000FF )
-    {
-        snapshot_write_uint8( &p, (uint8_t) ( ack_bits & 0x000000FF ) );
-    }
-
-    if ( ( ack_bits & 0x0000FF00 ) != 0x0000FF00 )
-    {
-        snapshot_write_uint8( &p, (uint8_t) ( ( ack_bits & 0x0000FF00 ) >> 8 ) );
-    }
+    snapshot_write_ack_word( &p, ack_bits[0], ack_mask );
 
-    if ( ( ack_bits & 0x00FF0000 ) != 0x00FF0000 )
+    if ( num_ack_words > 1 )
     {
-        snapshot_write_uint8( &p, (uint8_t) ( ( ack_bits & 0x00FF0000 ) >> 16 ) );
-    }
+        snapshot_write_uint8( &p, (uint8_t) ( num_ack_words - 1 ) );
 
-    if ( ( ack_bits & 0xFF000000 ) != 0xFF000000 )
-    {
-        snapshot_write_uint8( &p, (uint8_t) ( ( ack_bits & 0xFF000000 ) >> 24 ) );
+        for ( int i = 1; i < num_ack_words; ++i )
+        {
+            const uint8_t mask = snapshot_ack_word_mask( ack_bits[i] );
+            snapshot_write_uint8( &p, mask );
+            snapshot_write_ack_word( &p, ack_bits[i], mask );
+        }
     }
 
     snapshot_assert( p - packet_data <= SNAPSHOT_MAX_PACKET_HEADER_BYTES );
@@ -82,6 +138,23 @@ int snapshot_write_packet_header( uint8_t * packet_data, uint16_t sequence, uint
 }
 
 int snapshot_read_packet_header( const char * name, const uint8_t * packet_data, int packet_bytes, uint16_t * sequence, uint16_t * ack, uint32_t * ack_bits )
+{
+    // wide ack bits are read, but only the most recent 32 are returned
+
+    uint32_t ack_words[SNAPSHOT_MAX_ACK_WORDS];
+    int num_ack_words = 0;
+
+    int header_bytes = snapshot_read_packet_header_ack_words( name, packet_data, packet_bytes, sequence, ack, ack_words, &num_ack_words );
+
+    if ( header_bytes >= 0 )
+    {
+        *ack_bits = ack_words[0];
+    }
+
+    return header_bytes;
+}
+
+int snapshot_read_packet_header_ack_words( const char * name, const uint8_t * packet_data, int packet_bytes, uint16_t * sequence, uint16_t * ack, uint32_t * ack_bits, int * num_ack_words )
 {
     if ( packet_bytes < 3 )
     {
@@ -99,6 +172,12 @@ int snapshot_read_packet_header( const char * name, const uint8_t * packet_data,
         return -1;
     }
 
+    if ( prefix_byte & (1<<7) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] invalid prefix byte in packet header\n", name );
+        return -1;
+    }
+
     *sequence = snapshot_read_uint16( &p );
 
     if ( prefix_byte & (1<<5) )
@@ -121,45 +200,64 @@ int snapshot_read_packet_header( const char * name, const uint8_t * packet_data,
         *ack = snapshot_read_uint16( &p );
     }
 
-    int expected_bytes = 0;
-    int i;
-    for ( i = 1; i <= 4; ++i )
-    {
-        if ( prefix_byte & (1<<i) )
-        {
-            expected_bytes++;
-        }
-    }
-    if ( packet_bytes < ( p - packet_data ) + expected_bytes )
+    const uint8_t ack_mask = (uint8_t) ( ( prefix_byte >> 1 ) & 0xF );
+
+    if ( packet_bytes < ( p - packet_data ) + snapshot_ack_word_bytes( ack_mask ) )
     {
         snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] packet too small for packet header (4)\n", name );
         return -1;
     }
 
-    *ack_bits = 0xFFFFFFFF;
+    ack_bits[0] = snapshot_read_ack_word( &p, ack_mask );
 
-    if ( prefix_byte & (1<<1) )
-    {
-        *ack_bits &= 0xFFFFFF00;
-        *ack_bits |= (uint32_t) ( snapshot_read_uint8( &p ) );
-    }
+    *num_ack_words = 1;
 
-    if ( prefix_byte & (1<<2) )
+    if ( prefix_byte & (1<<6) )
     {
-        *ack_bits &= 0xFFFF00FF;
-        *ack_bits |= (uint32_t) ( snapshot_read_uint8( &p ) ) << 8;
-    }
+        if ( packet_bytes < ( p - packet_data ) + 1 )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] packet too small for packet header (5)\n", name );
+            return -1;
+        }
 
-    if ( prefix_byte & (1<<3) )
-    {
-        *ack_bits &= 0xFF00FFFF;
-        *ack_bits |= (uint32_t) ( snapshot_read_uint8( &p ) ) << 16;
-    }
+        const int num_extra_words = snapshot_read_uint8( &p );
 
-    if ( prefix_byte & (1<<4) )
-    {
-        *ack_bits &= 0x00FFFFFF;
-        *ack_bits |= (uint32_t) ( snapshot_read_uint8( &p ) ) << 24;
+        // ack bits are 32, 64 or 128, so the total number of words must be a power of two
+
+        const int num_words = 1 + num_extra_words;
+
+        if ( num_extra_words < 1 || num_words > SNAPSHOT_MAX_ACK_WORDS || ( num_words & ( num_words - 1 ) ) != 0 )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] invalid number of ack words in packet header\n", name );
+            return -1;
+        }
+
+        for ( int i = 1; i <= num_extra_words; ++i )
+        {
+            if ( packet_bytes < ( p - packet_data ) + 1 )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] packet too small for packet header (6)\n", name );
+                return -1;
+            }
+
+            const uint8_t mask = snapshot_read_uint8( &p );
+
+            if ( mask & 0xF0 )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] invalid ack word mask in packet header\n", name );
+                return -1;
+            }
+
+            if ( packet_bytes < ( p - packet_data ) + snapshot_ack_word_bytes( mask ) )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "[%s] packet too small for packet header (7)\n", name );
+                return -1;
+            }
+
+            ack_bits[i] = snapshot_read_ack_word( &p, mask );
+        }
+
+        *num_ack_words = 1 + num_extra_words;
     }
 
     return (int) ( p - packet_data );
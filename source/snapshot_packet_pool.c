@@ -0,0 +1,141 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#include "snapshot_packet_pool.h"
+#include "snapshot_packets.h"
+
+struct snapshot_packet_pool_t
+{
+    void * context;
+    struct snapshot_packet_block_t * free_list[SNAPSHOT_PACKET_POOL_NUM_SIZE_CLASSES];
+    uint64_t counters[SNAPSHOT_PACKET_POOL_NUM_COUNTERS];
+};
+
+static inline int snapshot_packet_pool_size_class( int packet_bytes )
+{
+    int size_class = 0;
+    while ( ( 1 << ( SNAPSHOT_PACKET_POOL_MIN_SIZE_CLASS_BITS + size_class ) ) < packet_bytes )
+    {
+        size_class++;
+    }
+    return size_class;
+}
+
+static inline size_t snapshot_packet_pool_block_bytes( int size_class )
+{
+    return SNAPSHOT_PACKET_BLOCK_HEADER_BYTES + SNAPSHOT_PACKET_PREFIX_BYTES + ( 1 << ( SNAPSHOT_PACKET_POOL_MIN_SIZE_CLASS_BITS + size_class ) ) + SNAPSHOT_PACKET_POSTFIX_BYTES;
+}
+
+struct snapshot_packet_pool_t * snapshot_packet_pool_create( void * context )
+{
+    snapshot_assert( sizeof( struct snapshot_packet_block_t ) <= SNAPSHOT_PACKET_BLOCK_HEADER_BYTES );
+
+    struct snapshot_packet_pool_t * pool = (struct snapshot_packet_pool_t*) snapshot_malloc( context, sizeof( struct snapshot_packet_pool_t ) );
+    if ( !pool )
+        return NULL;
+
+    memset( pool, 0, sizeof( struct snapshot_packet_pool_t ) );
+
+    pool->context = context;
+
+    return pool;
+}
+
+void snapshot_packet_pool_destroy( struct snapshot_packet_pool_t * pool )
+{
+    snapshot_assert( pool );
+
+    // packets still out when the pool goes away would be handed back to freed memory
+
+    snapshot_assert( pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == 0 );
+
+    for ( int i = 0; i < SNAPSHOT_PACKET_POOL_NUM_SIZE_CLASSES; i++ )
+    {
+        struct snapshot_packet_block_t * block = pool->free_list[i];
+        while ( block )
+        {
+            struct snapshot_packet_block_t * next = block->next;
+            snapshot_free( pool->context, block );
+            block = next;
+        }
+    }
+
+    snapshot_free( pool->context, pool );
+}
+
+uint8_t * snapshot_packet_pool_create_packet( struct snapshot_packet_pool_t * pool, int packet_bytes )
+{
+    snapshot_assert( pool );
+    snapshot_assert( packet_bytes > 0 );
+
+    if ( packet_bytes > ( 1 << SNAPSHOT_PACKET_POOL_MAX_SIZE_CLASS_BITS ) )
+    {
+        pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_OVERSIZE]++;
+        return snapshot_create_packet( pool->context, packet_bytes );
+    }
+
+    const int size_class = snapshot_packet_pool_size_class( packet_bytes );
+
+    struct snapshot_packet_block_t * block = pool->free_list[size_class];
+
+    if ( block )
+    {
+        pool->free_list[size_class] = block->next;
+        pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_HITS]++;
+    }
+    else
+    {
+        const size_t block_bytes = snapshot_packet_pool_block_bytes( size_class );
+        block = (struct snapshot_packet_block_t*) snapshot_malloc( pool->context, block_bytes );
+        if ( !block )
+            return NULL;
+        block->pool = pool;
+        block->size_class = size_class;
+        pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_MISSES]++;
+        pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_BYTES_ALLOCATED] += block_bytes;
+    }
+
+    block->next = NULL;
+
+    const uint64_t in_use = ++pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE];
+    if ( in_use > pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_HIGH_WATER] )
+    {
+        pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_HIGH_WATER] = in_use;
+    }
+
+    return ( (uint8_t*) block ) + SNAPSHOT_PACKET_BLOCK_HEADER_BYTES + SNAPSHOT_PACKET_PREFIX_BYTES;
+}
+
+void snapshot_packet_pool_release_block( struct snapshot_packet_pool_t * pool, struct snapshot_packet_block_t * block )
+{
+    snapshot_assert( pool );
+    snapshot_assert( block );
+    snapshot_assert( block->pool == pool );
+    snapshot_assert( block->size_class >= 0 );
+    snapshot_assert( block->size_class < SNAPSHOT_PACKET_POOL_NUM_SIZE_CLASSES );
+    snapshot_assert( pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] > 0 );
+
+    block->next = pool->free_list[block->size_class];
+    pool->free_list[block->size_class] = block;
+
+    pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE]--;
+}
+
+const uint64_t * snapshot_packet_pool_counters( struct snapshot_packet_pool_t * pool )
+{
+    snapshot_assert( pool );
+    return pool->counters;
+}
+
+size_t snapshot_packet_pool_memory_bytes( const struct snapshot_packet_pool_t * pool )
+{
+    snapshot_assert( pool );
+    return sizeof( struct snapshot_packet_pool_t ) + (size_t) pool->counters[SNAPSHOT_PACKET_POOL_COUNTER_BYTES_ALLOCATED];
+}
@@ -14,42 +14,77 @@
 #include "snapshot_read_write.h"
 #include "snapshot_replay_protection.h"
 #include "snapshot_crypto.h"
+#include "snapshot_packet_pool.h"
 
 uint8_t * snapshot_create_packet( void * context, int packet_bytes )
 {
     snapshot_assert( packet_bytes > 0 );
-    uint8_t * buffer = (uint8_t*) snapshot_malloc( context, SNAPSHOT_PACKET_PREFIX_BYTES + packet_bytes + SNAPSHOT_PACKET_POSTFIX_BYTES );
+    uint8_t * buffer = (uint8_t*) snapshot_malloc( context, SNAPSHOT_PACKET_BLOCK_HEADER_BYTES + SNAPSHOT_PACKET_PREFIX_BYTES + packet_bytes + SNAPSHOT_PACKET_POSTFIX_BYTES );
     if ( !buffer )
     {
         return NULL;
     }
-    return buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+    struct snapshot_packet_block_t * block = (struct snapshot_packet_block_t*) buffer;
+    block->pool = NULL;
+    block->next = NULL;
+    block->size_class = -1;
+    return buffer + SNAPSHOT_PACKET_BLOCK_HEADER_BYTES + SNAPSHOT_PACKET_PREFIX_BYTES;
+}
+
+uint8_t * snapshot_create_pooled_packet( void * context, struct snapshot_packet_pool_t * pool, int packet_bytes )
+{
+    if ( pool )
+    {
+        return snapshot_packet_pool_create_packet( pool, packet_bytes );
+    }
+    return snapshot_create_packet( context, packet_bytes );
 }
 
 void snapshot_destroy_packet( void * context, uint8_t * packet )
 {
     snapshot_assert( packet );
-    uint8_t * buffer = packet - SNAPSHOT_PACKET_PREFIX_BYTES;
-    snapshot_free( context, buffer );
+    struct snapshot_packet_block_t * block = (struct snapshot_packet_block_t*) ( packet - SNAPSHOT_PACKET_PREFIX_BYTES - SNAPSHOT_PACKET_BLOCK_HEADER_BYTES );
+    if ( block->pool )
+    {
+        snapshot_packet_pool_release_block( block->pool, block );
+        return;
+    }
+    snapshot_free( context, block );
 }
 
-struct snapshot_payload_packet_t * snapshot_wrap_payload_packet( uint8_t * payload_data, int payload_bytes )
+void * snapshot_wrap_payload_packet( uint8_t * payload_data, int payload_bytes )
 {
+    snapshot_assert( payload_data );
     snapshot_assert( payload_bytes > 0 );
     snapshot_assert( payload_bytes <= SNAPSHOT_MAX_PAYLOAD_BYTES );
 
-    size_t offset = offsetof(struct snapshot_payload_packet_t, payload_data);
+    // payload data is written in place behind a packet header, so it can start at any byte offset. write the fields
+    // byte by byte in the struct layout instead of through the struct, which would be misaligned
 
-    uint8_t * buffer = payload_data - offset;
+    uint8_t * packet = payload_data - offsetof(struct snapshot_payload_packet_t, payload_data);
 
-    struct snapshot_payload_packet_t * packet = (struct snapshot_payload_packet_t*) buffer;
+    uint8_t * p = packet;
+    snapshot_write_uint8( &p, SNAPSHOT_PAYLOAD_PACKET );
 
-    packet->packet_type = SNAPSHOT_PAYLOAD_PACKET;
-    packet->payload_bytes = payload_bytes;
+    p = packet + offsetof(struct snapshot_payload_packet_t, payload_bytes);
+    snapshot_write_uint32( &p, (uint32_t) payload_bytes );
 
     return packet;
 }
 
+uint8_t * snapshot_payload_packet_data( void * packet )
+{
+    snapshot_assert( packet );
+    return ( (uint8_t*) packet ) + offsetof(struct snapshot_payload_packet_t, payload_data);
+}
+
+int snapshot_payload_packet_bytes( const void * packet )
+{
+    snapshot_assert( packet );
+    const uint8_t * p = ( (const uint8_t*) packet ) + offsetof(struct snapshot_payload_packet_t, payload_bytes);
+    return (int) snapshot_read_uint32( &p );
+}
+
 struct snapshot_passthrough_packet_t * snapshot_wrap_passthrough_packet( uint8_t * passthrough_data, int passthrough_bytes )
 {
     snapshot_assert( passthrough_bytes > 0 );
@@ -67,7 +102,61 @@ struct snapshot_passthrough_packet_t * snapshot_wrap_passthrough_packet( uint8_t
     return packet;
 }
 
-uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_length, uint64_t sequence, uint8_t * write_packet_key, uint64_t protocol_id, int * out_bytes )
+static void snapshot_packet_additional_data( uint8_t * additional_data, uint64_t protocol_id, uint8_t prefix_byte )
+{
+    uint8_t * q = additional_data;
+    snapshot_write_bytes( &q, SNAPSHOT_VERSION_INFO, SNAPSHOT_VERSION_INFO_BYTES );
+    snapshot_write_uint64( &q, protocol_id );
+    snapshot_write_uint8( &q, prefix_byte );
+}
+
+static void snapshot_packet_nonce( uint8_t * nonce, uint64_t sequence )
+{
+    uint8_t * q = nonce;
+    snapshot_write_uint32( &q, 0 );
+    snapshot_write_uint64( &q, sequence );
+}
+
+static int snapshot_connection_response_mac( struct snapshot_connection_response_packet_t * packet, uint64_t protocol_id, uint8_t * key, uint8_t * mac, int verify )
+{
+    // the mac is an aead over an empty message, with everything else in the packet as the associated data
+
+    uint8_t additional_data[SNAPSHOT_PACKET_ADDITIONAL_DATA_BYTES + 8 + SNAPSHOT_CHALLENGE_TOKEN_BYTES];
+    snapshot_packet_additional_data( additional_data, protocol_id, SNAPSHOT_CONNECTION_RESPONSE_PACKET );
+    uint8_t * q = additional_data + SNAPSHOT_PACKET_ADDITIONAL_DATA_BYTES;
+    snapshot_write_uint64( &q, packet->challenge_token_sequence );
+    snapshot_write_bytes( &q, packet->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+
+    uint8_t nonce[SNAPSHOT_PACKET_NONCE_BYTES];
+    snapshot_packet_nonce( nonce, packet->challenge_token_sequence );
+
+    if ( verify )
+        return snapshot_crypto_decrypt_aead( mac, SNAPSHOT_MAC_BYTES, additional_data, sizeof( additional_data ), nonce, key );
+    else
+        return snapshot_crypto_encrypt_aead( mac, 0, additional_data, sizeof( additional_data ), nonce, key );
+}
+
+int snapshot_packet_encrypt( int cipher_suite, uint8_t * message, uint64_t message_length, uint8_t * additional, uint64_t additional_length, uint8_t * nonce, uint8_t * key )
+{
+    if ( cipher_suite == SNAPSHOT_CIPHER_SUITE_AES256GCM )
+        return snapshot_crypto_encrypt_aead_aes256gcm( message, message_length, additional, additional_length, nonce, key );
+
+    snapshot_assert( cipher_suite == SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 );
+
+    return snapshot_crypto_encrypt_aead( message, message_length, additional, additional_length, nonce, key );
+}
+
+int snapshot_packet_decrypt( int cipher_suite, uint8_t * message, uint64_t message_length, uint8_t * additional, uint64_t additional_length, uint8_t * nonce, uint8_t * key )
+{
+    if ( cipher_suite == SNAPSHOT_CIPHER_SUITE_AES256GCM )
+        return snapshot_crypto_decrypt_aead_aes256gcm( message, message_length, additional, additional_length, nonce, key );
+
+    snapshot_assert( cipher_suite == SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 );
+
+    return snapshot_crypto_decrypt_aead( message, message_length, additional, additional_length, nonce, key );
+}
+
+uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_length, uint64_t sequence, uint8_t * write_packet_key, int cipher_suite, uint64_t protocol_id, int * out_bytes )
 {
     snapshot_assert( packet );
     snapshot_assert( buffer );
@@ -80,7 +169,7 @@ uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_len
     {
         // connection request packet: first byte is zero
 
-        snapshot_assert( buffer_length >= 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
+        snapshot_assert( buffer_length >= 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES + 1 + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
 
         struct snapshot_connection_request_packet_t * connection_request_packet = (struct snapshot_connection_request_packet_t*) packet;
 
@@ -91,9 +180,36 @@ uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_len
         snapshot_write_uint64( &buffer, connection_request_packet->protocol_id );
         snapshot_write_uint64( &buffer, connection_request_packet->connect_token_expire_timestamp );
         snapshot_write_bytes( &buffer, connection_request_packet->connect_token_nonce, SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES );
+        snapshot_write_uint8( &buffer, connection_request_packet->cipher_suite );
         snapshot_write_bytes( &buffer, connection_request_packet->connect_token_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
 
-        snapshot_assert( buffer - start == 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
+        snapshot_assert( buffer - start == 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES + 1 + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
+
+        *out_bytes = (int) ( buffer - start );
+
+        return start;
+    }
+    else if ( packet_type == SNAPSHOT_CONNECTION_RESPONSE_PACKET )
+    {
+        // connection response packet: first byte is the packet type with no sequence bytes
+
+        snapshot_assert( buffer_length >= SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES );
+
+        struct snapshot_connection_response_packet_t * connection_response_packet = (struct snapshot_connection_response_packet_t*) packet;
+
+        memset( connection_response_packet->mac, 0, SNAPSHOT_MAC_BYTES );
+
+        if ( write_packet_key && snapshot_connection_response_mac( connection_response_packet, protocol_id, write_packet_key, connection_response_packet->mac, 0 ) != SNAPSHOT_OK )
+            return NULL;
+
+        uint8_t * start = buffer;
+
+        snapshot_write_uint8( &buffer, SNAPSHOT_CONNECTION_RESPONSE_PACKET );
+        snapshot_write_uint64( &buffer, connection_response_packet->challenge_token_sequence );
+        snapshot_write_bytes( &buffer, connection_response_packet->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+        snapshot_write_bytes( &buffer, connection_response_packet->mac, SNAPSHOT_MAC_BYTES );
+
+        snapshot_assert( buffer - start == SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES );
 
         *out_bytes = (int) ( buffer - start );
 
@@ -151,14 +267,6 @@ uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_len
             }
             break;
 
-            case SNAPSHOT_CONNECTION_RESPONSE_PACKET:
-            {
-                struct snapshot_connection_response_packet_t * connection_response_packet = (struct snapshot_connection_response_packet_t*) packet;
-                snapshot_write_uint64( &p, connection_response_packet->challenge_token_sequence );
-                snapshot_write_bytes( &p, connection_response_packet->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
-            }
-            break;
-
             case SNAPSHOT_KEEP_ALIVE_PACKET:
             {
                 struct snapshot_keep_alive_packet_t * keep_alive_packet = (struct snapshot_keep_alive_packet_t*) packet;
@@ -170,12 +278,11 @@ uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_len
             case SNAPSHOT_PAYLOAD_PACKET:
             {
                 // zero copy
-                struct snapshot_payload_packet_t * payload_packet = (struct snapshot_payload_packet_t*) packet;
-                snapshot_assert( payload_packet->payload_bytes <= SNAPSHOT_MAX_PAYLOAD_BYTES );
-                int payload_bytes = payload_packet->payload_bytes;
+                int payload_bytes = snapshot_payload_packet_bytes( packet );
+                snapshot_assert( payload_bytes <= SNAPSHOT_MAX_PAYLOAD_BYTES );
                 size_t header_bytes = p - start;
                 uint8_t * header = start;
-                start = ( (uint8_t*) packet ) + offsetof(struct snapshot_payload_packet_t, payload_data) - header_bytes;
+                start = snapshot_payload_packet_data( packet ) - header_bytes;
                 encrypted_start = start + header_bytes;
                 memcpy( start, header, header_bytes );
                 p = start + header_bytes + payload_bytes;
@@ -215,25 +322,17 @@ uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_len
 
         if ( write_packet_key )
         {
-            uint8_t additional_data[SNAPSHOT_VERSION_INFO_BYTES+8+1];
-            {
-                uint8_t * q = additional_data;
-                snapshot_write_bytes( &q, SNAPSHOT_VERSION_INFO, SNAPSHOT_VERSION_INFO_BYTES );
-                snapshot_write_uint64( &q, protocol_id );
-                snapshot_write_uint8( &q, prefix_byte );
-            }
+            uint8_t additional_data[SNAPSHOT_PACKET_ADDITIONAL_DATA_BYTES];
+            snapshot_packet_additional_data( additional_data, protocol_id, prefix_byte );
 
-            uint8_t nonce[12];
-            {
-                uint8_t * q = nonce;
-                snapshot_write_uint32( &q, 0 );
-                snapshot_write_uint64( &q, sequence );
-            }
+            uint8_t nonce[SNAPSHOT_PACKET_NONCE_BYTES];
+            snapshot_packet_nonce( nonce, sequence );
 
-            if ( snapshot_crypto_encrypt_aead( encrypted_start, 
-                                               encrypted_finish - encrypted_start, 
-                                               additional_data, sizeof( additional_data ), 
-                                               nonce, write_packet_key ) != SNAPSHOT_OK )
+            if ( snapshot_packet_encrypt( cipher_suite, 
+                                          encrypted_start, 
+                                          encrypted_finish - encrypted_start, 
+                                          additional_data, sizeof( additional_data ), 
+                                          nonce, write_packet_key ) != SNAPSHOT_OK )
             {
                 return NULL;
             }
@@ -249,10 +348,114 @@ uint8_t * snapshot_write_packet( void * packet, uint8_t * buffer, int buffer_len
     }
 }
 
+int snapshot_packet_crypto_setup( uint8_t * packet_data, int packet_bytes, const uint8_t * key, uint64_t protocol_id, int encrypt, struct snapshot_packet_crypto_t * crypto, struct snapshot_crypto_aead_batch_item_t * item )
+{
+    snapshot_assert( packet_data );
+    snapshot_assert( key );
+    snapshot_assert( crypto );
+    snapshot_assert( item );
+
+    // works on a packet as it goes over the wire: prefix byte, sequence, encrypted data and mac. 
+    // for encrypt the packet was written without a key, so the mac space is there but not filled in yet
+
+    if ( packet_bytes < 1 + 1 + SNAPSHOT_MAC_BYTES )
+        return SNAPSHOT_ERROR;
+
+    const uint8_t prefix_byte = packet_data[0];
+
+    if ( prefix_byte == SNAPSHOT_CONNECTION_REQUEST_PACKET )
+        return SNAPSHOT_ERROR;
+
+    const int sequence_bytes = prefix_byte >> 4;
+
+    if ( sequence_bytes < 1 || sequence_bytes > 8 || packet_bytes < 1 + sequence_bytes + SNAPSHOT_MAC_BYTES )
+        return SNAPSHOT_ERROR;
+
+    uint64_t sequence = 0;
+    for ( int i = 0; i < sequence_bytes; ++i )
+    {
+        sequence |= ( (uint64_t) packet_data[1+i] ) << ( 8 * i );
+    }
+
+    snapshot_packet_additional_data( crypto->additional_data, protocol_id, prefix_byte );
+    snapshot_packet_nonce( crypto->nonce, sequence );
+    memcpy( crypto->key, key, SNAPSHOT_KEY_BYTES );
+
+    const int encrypted_bytes = packet_bytes - ( 1 + sequence_bytes );
+
+    item->message = packet_data + 1 + sequence_bytes;
+    item->message_length = encrypt ? encrypted_bytes - SNAPSHOT_MAC_BYTES : encrypted_bytes;
+    item->additional = crypto->additional_data;
+    item->additional_length = SNAPSHOT_PACKET_ADDITIONAL_DATA_BYTES;
+    item->nonce = crypto->nonce;
+    item->key = crypto->key;
+    item->result = SNAPSHOT_ERROR;
+
+    return SNAPSHOT_OK;
+}
+
+// the range of encrypted body sizes each packet type can have, between the sequence bytes and the mac. connection
+// requests and responses are sent in the clear with a fixed size, so they have no valid encrypted form
+
+static const int snapshot_packet_min_body_bytes[SNAPSHOT_NUM_PACKETS] = 
+{
+    -1,                                         // connection request
+    0,                                          // connection denied
+    8 + SNAPSHOT_CHALLENGE_TOKEN_BYTES,         // connection challenge
+    -1,                                         // connection response
+    8,                                          // keep alive
+    1,                                          // payload
+    1,                                          // passthrough
+    0,                                          // disconnect
+};
+
+static const int snapshot_packet_max_body_bytes[SNAPSHOT_NUM_PACKETS] = 
+{
+    -1,                                         // connection request
+    0,                                          // connection denied
+    8 + SNAPSHOT_CHALLENGE_TOKEN_BYTES,         // connection challenge
+    -1,                                         // connection response
+    8,                                          // keep alive
+    SNAPSHOT_MAX_PAYLOAD_BYTES,                 // payload
+    SNAPSHOT_MAX_PASSTHROUGH_BYTES,             // passthrough
+    0,                                          // disconnect
+};
+
+SNAPSHOT_BOOL snapshot_packet_prefix_valid( const uint8_t * packet_data, int packet_bytes, const uint8_t * allowed_packets )
+{
+    snapshot_assert( packet_data );
+    snapshot_assert( allowed_packets );
+
+    // checks only the prefix byte and length, with no lookups or crypto, so garbage can be dropped as soon as it arrives.
+    // anything that passes here may still fail in snapshot_read_packet, but nothing rejected here could have been read
+
+    if ( packet_bytes < 1 )
+        return SNAPSHOT_FALSE;
+
+    const uint8_t prefix_byte = packet_data[0];
+
+    if ( prefix_byte == SNAPSHOT_CONNECTION_REQUEST_PACKET )
+        return allowed_packets[SNAPSHOT_CONNECTION_REQUEST_PACKET] && packet_bytes == SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES;
+
+    if ( prefix_byte == SNAPSHOT_CONNECTION_RESPONSE_PACKET )
+        return allowed_packets[SNAPSHOT_CONNECTION_RESPONSE_PACKET] && packet_bytes == SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES;
+
+    const int packet_type = prefix_byte & 0xF;
+    const int sequence_bytes = prefix_byte >> 4;
+
+    if ( packet_type >= SNAPSHOT_NUM_PACKETS || !allowed_packets[packet_type] || sequence_bytes < 1 || sequence_bytes > 8 )
+        return SNAPSHOT_FALSE;
+
+    const int body_bytes = packet_bytes - ( 1 + sequence_bytes + SNAPSHOT_MAC_BYTES );
+
+    return body_bytes >= snapshot_packet_min_body_bytes[packet_type] && body_bytes <= snapshot_packet_max_body_bytes[packet_type];
+}
+
 void * snapshot_read_packet( uint8_t * buffer, 
                              int buffer_length, 
                              uint64_t * sequence, 
                              uint8_t * read_packet_key, 
+                             int cipher_suite, 
                              uint64_t protocol_id, 
                              uint64_t current_timestamp, 
                              uint8_t * private_key, 
@@ -287,9 +490,9 @@ void * snapshot_read_packet( uint8_t * buffer,
             return NULL;
         }
 
-        if ( buffer_length != 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES )
+        if ( buffer_length != SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES )
         {
-            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection request packet. bad packet length (expected %d, got %d)", 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES, buffer_length );
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection request packet. bad packet length (expected %d, got %d)", SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES, buffer_length );
             return NULL;
         }
 
@@ -309,7 +512,8 @@ void * snapshot_read_packet( uint8_t * buffer,
              version_info[5] != 'H' ||
              version_info[6] != 'O' ||
              version_info[7] != 'T' || 
-             version_info[8] != '\0' )
+             version_info[8] != '3' ||
+             version_info[9] != '\0' )
         {
             snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection request packet. bad version info" );
             return NULL;
@@ -332,7 +536,14 @@ void * snapshot_read_packet( uint8_t * buffer,
         uint8_t packet_connect_token_nonce[SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES];
         snapshot_read_bytes( &p, packet_connect_token_nonce, sizeof(packet_connect_token_nonce) );
 
-        snapshot_assert( p - start == 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES );
+        uint8_t packet_cipher_suite = snapshot_read_uint8( &p );
+        if ( packet_cipher_suite >= SNAPSHOT_NUM_CIPHER_SUITES )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection request packet. bad cipher suite (%d)", packet_cipher_suite );
+            return NULL;
+        }
+
+        snapshot_assert( p - start == 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES + 1 );
 
         if ( snapshot_decrypt_connect_token_private( (uint8_t*)p, 
                                                      SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES, 
@@ -359,9 +570,39 @@ void * snapshot_read_packet( uint8_t * buffer,
         packet->protocol_id = packet_protocol_id;
         packet->connect_token_expire_timestamp = packet_connect_token_expire_timestamp;
         memcpy( packet->connect_token_nonce, packet_connect_token_nonce, SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES );
+        packet->cipher_suite = packet_cipher_suite;
         snapshot_read_bytes( &p, packet->connect_token_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
 
-        snapshot_assert( p - start == 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
+        snapshot_assert( p - start == 1 + SNAPSHOT_VERSION_INFO_BYTES + 8 + 8 + SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES + 1 + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
+
+        return packet;
+    }
+    else if ( prefix_byte == SNAPSHOT_CONNECTION_RESPONSE_PACKET )
+    {
+        // connection response packet: first byte is the packet type with no sequence bytes. the mac is checked once the challenge token is open
+
+        if ( !allowed_packets[SNAPSHOT_CONNECTION_RESPONSE_PACKET] )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection response packet. packet type is not allowed" );
+            return NULL;
+        }
+
+        if ( buffer_length != SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection response packet. bad packet length (expected %d, got %d)", SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES, buffer_length );
+            return NULL;
+        }
+
+        struct snapshot_connection_response_packet_t * packet = (struct snapshot_connection_response_packet_t*) out_packet_buffer;
+
+        packet->packet_type = SNAPSHOT_CONNECTION_RESPONSE_PACKET;
+        packet->challenge_token_sequence = snapshot_read_uint64( &p );
+        snapshot_read_bytes( &p, packet->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+        snapshot_read_bytes( &p, packet->mac, SNAPSHOT_MAC_BYTES );
+
+        snapshot_assert( p - start == SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES );
+
+        *sequence = packet->challenge_token_sequence;
 
         return packet;
     }
@@ -433,20 +674,11 @@ void * snapshot_read_packet( uint8_t * buffer,
 
         if ( read_packet_key )
         {
-            uint8_t additional_data[SNAPSHOT_VERSION_INFO_BYTES+8+1];
-            {
-                uint8_t * q = additional_data;
-                snapshot_write_bytes( &q, SNAPSHOT_VERSION_INFO, SNAPSHOT_VERSION_INFO_BYTES );
-                snapshot_write_uint64( &q, protocol_id );
-                snapshot_write_uint8( &q, prefix_byte );
-            }
+            uint8_t additional_data[SNAPSHOT_PACKET_ADDITIONAL_DATA_BYTES];
+            snapshot_packet_additional_data( additional_data, protocol_id, prefix_byte );
 
-            uint8_t nonce[12];
-            {
-                uint8_t * q = nonce;
-                snapshot_write_uint32( &q, 0 );
-                snapshot_write_uint64( &q, *sequence );
-            }
+            uint8_t nonce[SNAPSHOT_PACKET_NONCE_BYTES];
+            snapshot_packet_nonce( nonce, *sequence );
 
             if ( encrypted_bytes < SNAPSHOT_MAC_BYTES )
             {
@@ -454,7 +686,7 @@ void * snapshot_read_packet( uint8_t * buffer,
                 return NULL;
             }
 
-            if ( snapshot_crypto_decrypt_aead( (uint8_t*)p, encrypted_bytes, additional_data, sizeof( additional_data ), nonce, read_packet_key ) != SNAPSHOT_OK )
+            if ( snapshot_packet_decrypt( cipher_suite, (uint8_t*)p, encrypted_bytes, additional_data, sizeof( additional_data ), nonce, read_packet_key ) != SNAPSHOT_OK )
             {
                 snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored encrypted packet. failed to decrypt" );
                 return NULL;
@@ -506,24 +738,6 @@ void * snapshot_read_packet( uint8_t * buffer,
             }
             break;
 
-            case SNAPSHOT_CONNECTION_RESPONSE_PACKET:
-            {
-                if ( decrypted_bytes != 8 + SNAPSHOT_CHALLENGE_TOKEN_BYTES )
-                {
-                    snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection response packet. decrypted packet data is wrong size" );
-                    return NULL;
-                }
-
-                struct snapshot_connection_response_packet_t * packet = (struct snapshot_connection_response_packet_t*) out_packet_buffer;
-
-                packet->packet_type = SNAPSHOT_CONNECTION_RESPONSE_PACKET;
-                packet->challenge_token_sequence = snapshot_read_uint64( &p );
-                snapshot_read_bytes( &p, packet->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
-                
-                return packet;
-            }
-            break;
-
             case SNAPSHOT_KEEP_ALIVE_PACKET:
             {
                 if ( decrypted_bytes != 8 )
@@ -599,3 +813,53 @@ void * snapshot_read_packet( uint8_t * buffer,
         }
     }
 }
+
+int snapshot_open_connection_response_packet( struct snapshot_connection_response_packet_t * packet, 
+                                              const struct snapshot_address_t * from, 
+                                              uint64_t protocol_id, 
+                                              uint64_t current_timestamp, 
+                                              uint8_t * challenge_key, 
+                                              struct snapshot_challenge_token_t * challenge_token )
+{
+    snapshot_assert( packet );
+    snapshot_assert( from );
+    snapshot_assert( challenge_key );
+    snapshot_assert( challenge_token );
+
+    // decrypt a copy of the challenge token, because the mac covers the sealed token as it was sent
+
+    uint8_t challenge_token_data[SNAPSHOT_CHALLENGE_TOKEN_BYTES];
+    memcpy( challenge_token_data, packet->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+
+    if ( snapshot_decrypt_challenge_token( challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES, packet->challenge_token_sequence, challenge_key ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection response. failed to decrypt challenge token" );
+        return SNAPSHOT_ERROR;
+    }
+
+    if ( snapshot_read_challenge_token( challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES, challenge_token ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection response. failed to read challenge token" );
+        return SNAPSHOT_ERROR;
+    }
+
+    if ( challenge_token->expire_timestamp <= current_timestamp )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection response. challenge token expired" );
+        return SNAPSHOT_ERROR;
+    }
+
+    if ( !snapshot_address_equal( &challenge_token->address, from ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection response. challenge token was sent to a different address" );
+        return SNAPSHOT_ERROR;
+    }
+
+    if ( snapshot_connection_response_mac( packet, protocol_id, challenge_token->client_to_server_key, packet->mac, 1 ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "ignored connection response. bad mac" );
+        return SNAPSHOT_ERROR;
+    }
+
+    return SNAPSHOT_OK;
+}
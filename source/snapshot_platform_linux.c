@@ -19,6 +19,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <ifaddrs.h>
 #include <fcntl.h>
 #include <netdb.h>
@@ -35,6 +36,18 @@
 #include <math.h>
 #include <alloca.h>
 
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif // #ifndef SOL_UDP
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif // #ifndef UDP_SEGMENT
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif // #ifndef UDP_GRO
+
 // ---------------------------------------------------
 
 static double time_start;
@@ -165,8 +178,14 @@ snapshot_platform_socket_t * snapshot_platform_socket_create( void * context, sn
 
     snapshot_assert( socket );
 
+    memset( socket, 0, sizeof( snapshot_platform_socket_t ) );
+
     socket->context = context;
 
+    const SNAPSHOT_BOOL reuse_port = ( socket_type & SNAPSHOT_PLATFORM_SOCKET_REUSE_PORT ) != 0;
+
+    socket_type &= ~SNAPSHOT_PLATFORM_SOCKET_REUSE_PORT;
+
     // create socket
 
     socket->type = socket_type;
@@ -193,6 +212,19 @@ snapshot_platform_socket_t * snapshot_platform_socket_create( void * context, sn
         }
     }
 
+    // let multiple sockets bind to the same port. the kernel hashes each sender's address to one of them
+
+    if ( reuse_port )
+    {
+        int yes = 1;
+        if ( setsockopt( socket->handle, SOL_SOCKET, SO_REUSEPORT, (char*)( &yes ), sizeof( yes ) ) != 0 )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to set socket reuse port" );
+            snapshot_platform_socket_destroy( socket );
+            return NULL;
+        }
+    }
+
     // increase socket send and receive buffer sizes
 
     if ( setsockopt( socket->handle, SOL_SOCKET, SO_SNDBUF, (char*)( &send_buffer_size ), sizeof( int ) ) != 0 )
@@ -317,9 +349,61 @@ void snapshot_platform_socket_destroy( snapshot_platform_socket_t * socket )
     {
         close( socket->handle );
     }
+    if ( socket->gro_buffer )
+    {
+        snapshot_free( socket->context, socket->gro_buffer );
+    }
     snapshot_free( socket->context, socket );
 }
 
+SNAPSHOT_BOOL snapshot_platform_socket_enable_gso( snapshot_platform_socket_t * socket )
+{
+    snapshot_assert( socket );
+
+    // probe for UDP_SEGMENT support. a segment size of zero leaves sends unchanged unless a per-send segment size is given
+
+    int segment_size = 0;
+    if ( setsockopt( socket->handle, SOL_UDP, UDP_SEGMENT, &segment_size, sizeof( segment_size ) ) != 0 )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "udp gso is not supported: %s", strerror( errno ) );
+        return SNAPSHOT_FALSE;
+    }
+
+    socket->gso = SNAPSHOT_TRUE;
+
+    return SNAPSHOT_TRUE;
+}
+
+SNAPSHOT_BOOL snapshot_platform_socket_enable_gro( snapshot_platform_socket_t * socket )
+{
+    snapshot_assert( socket );
+
+    if ( socket->gro )
+        return SNAPSHOT_TRUE;
+
+    int yes = 1;
+    if ( setsockopt( socket->handle, SOL_UDP, UDP_GRO, &yes, sizeof( yes ) ) != 0 )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "udp gro is not supported: %s", strerror( errno ) );
+        return SNAPSHOT_FALSE;
+    }
+
+    socket->gro_buffer = (uint8_t*) snapshot_malloc( socket->context, SNAPSHOT_PLATFORM_GRO_BUFFERS * SNAPSHOT_PLATFORM_GRO_BUFFER_BYTES );
+    if ( !socket->gro_buffer )
+    {
+        int no = 0;
+        setsockopt( socket->handle, SOL_UDP, UDP_GRO, &no, sizeof( no ) );
+        return SNAPSHOT_FALSE;
+    }
+
+    socket->gro = SNAPSHOT_TRUE;
+    socket->gro_num_buffers = 0;
+    socket->gro_buffer_index = 0;
+    socket->gro_buffer_offset = 0;
+
+    return SNAPSHOT_TRUE;
+}
+
 void snapshot_platform_socket_send_packet( snapshot_platform_socket_t * socket, const snapshot_address_t * to, const void * packet_data, int packet_bytes )
 {
     snapshot_assert( socket );
@@ -370,7 +454,37 @@ void snapshot_platform_socket_send_packet( snapshot_platform_socket_t * socket,
     }
 }
 
-void snapshot_platform_socket_send_packets( snapshot_platform_socket_t * socket, const snapshot_address_t * to, void ** packet_data, int * packet_bytes, int num_packets )
+static socklen_t snapshot_platform_sockaddr_from_address( sockaddr_storage * socket_address, const snapshot_address_t * address )
+{
+    memset( socket_address, 0, sizeof(sockaddr_storage) );
+
+    if ( address->type == SNAPSHOT_ADDRESS_IPV6 )
+    {
+        sockaddr_in6 * addr_ipv6 = (sockaddr_in6*) socket_address;
+        addr_ipv6->sin6_family = AF_INET6;
+        for ( int i = 0; i < 8; ++i )
+        {
+            ( (uint16_t*) &addr_ipv6->sin6_addr ) [i] = snapshot_platform_htons( address->data.ipv6[i] );
+        }
+        addr_ipv6->sin6_port = snapshot_platform_htons( address->port );
+        return sizeof(sockaddr_in6);
+    }
+    else if ( address->type == SNAPSHOT_ADDRESS_IPV4 )
+    {
+        sockaddr_in * addr_ipv4 = (sockaddr_in*) socket_address;
+        addr_ipv4->sin_family = AF_INET;
+        addr_ipv4->sin_addr.s_addr = ( ( (uint32_t) address->data.ipv4[0] ) )        | 
+                                     ( ( (uint32_t) address->data.ipv4[1] ) << 8 )   | 
+                                     ( ( (uint32_t) address->data.ipv4[2] ) << 16 )  | 
+                                     ( ( (uint32_t) address->data.ipv4[3] ) << 24 );
+        addr_ipv4->sin_port = snapshot_platform_htons( address->port );
+        return sizeof(sockaddr_in);
+    }
+
+    return 0;
+}
+
+void snapshot_platform_socket_send_packets( snapshot_platform_socket_t * socket, const snapshot_address_t * to, uint8_t ** packet_data, int * packet_bytes, int num_packets )
 {
     snapshot_assert( socket );
     snapshot_assert( to );
@@ -383,42 +497,159 @@ void snapshot_platform_socket_send_packets( snapshot_platform_socket_t * socket,
 
     iovec * msg = (iovec*) alloca( sizeof(iovec) * num_packets );
 
+    sockaddr_storage * socket_address = (sockaddr_storage*) alloca( sizeof(sockaddr_storage) * num_packets );
+
+    mmsghdr * packet_array = (mmsghdr*) alloca( sizeof(mmsghdr) * num_packets );
+
+    int * message_start = (int*) alloca( sizeof(int) * num_packets );
+
+    int * message_packets = (int*) alloca( sizeof(int) * num_packets );
+
+    const int control_bytes = CMSG_SPACE( sizeof(uint16_t) );
+
+    uint8_t * control = (uint8_t*) alloca( control_bytes * num_packets );
+
+    memset( packet_array, 0, sizeof(mmsghdr) * num_packets );
+
+    memset( control, 0, control_bytes * num_packets );
+
     for ( int i = 0; i < num_packets; ++i )
     {
+        snapshot_assert( to[i].type == SNAPSHOT_ADDRESS_IPV6 || to[i].type == SNAPSHOT_ADDRESS_IPV4 );
+        snapshot_assert( packet_data[i] );
+        snapshot_assert( packet_bytes[i] > 0 );
         msg[i].iov_base = packet_data[i];
         msg[i].iov_len = packet_bytes[i];
     }
 
-    sockaddr_in * socket_address = (sockaddr_in*) alloca( sizeof(sockaddr_in) * num_packets );
+    // with gso, consecutive packets to the same address are sent as one message and split by the kernel.
+    // every segment must be the same size, except the last one which may be smaller.
 
-    for ( int i = 0; i < num_packets; ++i )
+    int num_messages = 0;
+
+    int i = 0;
+
+    while ( i < num_packets )
     {
-        snapshot_assert( to[i].type == SNAPSHOT_ADDRESS_IPV4 );                 // note: ipv6 not supported
-        memset( &socket_address[i], 0, sizeof(sockaddr_in) );
-        socket_address[i].sin_family = AF_INET;
-        socket_address[i].sin_addr.s_addr = ( ( (uint32_t) to[i].data.ipv4[0] ) )        | 
-                                            ( ( (uint32_t) to[i].data.ipv4[1] ) << 8 )   | 
-                                            ( ( (uint32_t) to[i].data.ipv4[2] ) << 16 )  | 
-                                            ( ( (uint32_t) to[i].data.ipv4[3] ) << 24 );
-        socket_address[i].sin_port = snapshot_platform_htons( to->port );
+        int j = i + 1;
+
+        if ( socket->gso )
+        {
+            int run_bytes = packet_bytes[i];
+
+            while ( j < num_packets && 
+                    j - i < SNAPSHOT_PLATFORM_MAX_GSO_SEGMENTS &&
+                    packet_bytes[j-1] == packet_bytes[i] &&
+                    packet_bytes[j] <= packet_bytes[i] &&
+                    run_bytes + packet_bytes[j] <= SNAPSHOT_PLATFORM_MAX_GSO_BYTES &&
+                    snapshot_address_equal( &to[j], &to[i] ) )
+            {
+                run_bytes += packet_bytes[j];
+                j++;
+            }
+        }
+
+        mmsghdr * message = &packet_array[num_messages];
+
+        message->msg_hdr.msg_name = &socket_address[num_messages];
+        message->msg_hdr.msg_namelen = snapshot_platform_sockaddr_from_address( &socket_address[num_messages], &to[i] );
+        message->msg_hdr.msg_iov = &msg[i];
+        message->msg_hdr.msg_iovlen = j - i;
+
+        if ( j - i > 1 )
+        {
+            message->msg_hdr.msg_control = control + control_bytes * num_messages;
+            message->msg_hdr.msg_controllen = control_bytes;
+            cmsghdr * cmsg = CMSG_FIRSTHDR( &message->msg_hdr );
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN( sizeof(uint16_t) );
+            uint16_t segment_size = (uint16_t) packet_bytes[i];
+            memcpy( CMSG_DATA( cmsg ), &segment_size, sizeof(uint16_t) );
+        }
+
+        message_start[num_messages] = i;
+        message_packets[num_messages] = j - i;
+
+        num_messages++;
+
+        i = j;
     }
 
-    mmsghdr * packet_array = (mmsghdr*) alloca( sizeof(mmsghdr) * num_packets );
+    // note: sendmmsg stops at the first message that fails to send. skip over that message and keep going with the rest,
+    // unless the send buffer is full. then every retry would fail the same way, so drop the rest of the batch with one log line
 
-    for ( int i = 0; i < num_packets; ++i )
+    int messages_sent = 0;
+
+    while ( messages_sent < num_messages )
     {
-        packet_array[i].msg_hdr.msg_name = &socket_address[i];
-        packet_array[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
-        packet_array[i].msg_hdr.msg_iov = &msg[i];
-        packet_array[i].msg_hdr.msg_iovlen = 1;
+        int result = sendmmsg( socket->handle, packet_array + messages_sent, num_messages - messages_sent, 0 );
+
+        if ( result <= 0 )
+        {
+            const int start = message_start[messages_sent];
+            const int count = message_packets[messages_sent];
+
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "socket send buffer is full. dropped %d packets", num_packets - start );
+                break;
+            }
+
+            if ( count > 1 && errno == EIO )
+            {
+                // the egress device can't segment this packet. turn off gso and send the packets individually
+
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "udp gso send failed. falling back to regular sends" );
+
+                socket->gso = SNAPSHOT_FALSE;
+
+                for ( int k = 0; k < count; ++k )
+                {
+                    snapshot_platform_socket_send_packet( socket, &to[start+k], packet_data[start+k], packet_bytes[start+k] );
+                }
+            }
+            else
+            {
+                char address_string[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
+                snapshot_address_to_string( &to[start], address_string );
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "sendmmsg (%s) failed: %s", address_string, strerror( errno ) );
+            }
+
+            messages_sent++;
+
+            continue;
+        }
+
+        messages_sent += result;
     }
+}
 
-    int result = sendmmsg( socket->handle, packet_array, num_packets, 0 );
-    
-    if ( result == -1 )
+static int snapshot_platform_address_from_sockaddr( struct snapshot_address_t * address, const sockaddr_storage * sockaddr_from )
+{
+    if ( sockaddr_from->ss_family == AF_INET6 )
+    {
+        const sockaddr_in6 * addr_ipv6 = (const sockaddr_in6*) sockaddr_from;
+        address->type = SNAPSHOT_ADDRESS_IPV6;
+        for ( int i = 0; i < 8; ++i )
+        {
+            address->data.ipv6[i] = snapshot_platform_ntohs( ( (const uint16_t*) &addr_ipv6->sin6_addr ) [i] );
+        }
+        address->port = snapshot_platform_ntohs( addr_ipv6->sin6_port );
+        return SNAPSHOT_OK;
+    }
+    else if ( sockaddr_from->ss_family == AF_INET )
     {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "sendmmsg failed to send packets" );
+        const sockaddr_in * addr_ipv4 = (const sockaddr_in*) sockaddr_from;
+        address->type = SNAPSHOT_ADDRESS_IPV4;
+        address->data.ipv4[0] = (uint8_t) ( ( addr_ipv4->sin_addr.s_addr & 0x000000FF ) );
+        address->data.ipv4[1] = (uint8_t) ( ( addr_ipv4->sin_addr.s_addr & 0x0000FF00 ) >> 8 );
+        address->data.ipv4[2] = (uint8_t) ( ( addr_ipv4->sin_addr.s_addr & 0x00FF0000 ) >> 16 );
+        address->data.ipv4[3] = (uint8_t) ( ( addr_ipv4->sin_addr.s_addr & 0xFF000000 ) >> 24 );
+        address->port = snapshot_platform_ntohs( addr_ipv4->sin_port );
+        return SNAPSHOT_OK;
     }
+    return SNAPSHOT_ERROR;
 }
 
 int snapshot_platform_socket_receive_packet( snapshot_platform_socket_t * socket, snapshot_address_t * from, void * packet_data, int max_packet_size )
@@ -445,33 +676,209 @@ int snapshot_platform_socket_receive_packet( snapshot_platform_socket_t * socket
         return 0;
     }
 
-    if ( sockaddr_from.ss_family == AF_INET6 )
+    if ( snapshot_platform_address_from_sockaddr( from, &sockaddr_from ) != SNAPSHOT_OK )
     {
-        sockaddr_in6 * addr_ipv6 = (sockaddr_in6*) &sockaddr_from;
-        from->type = SNAPSHOT_ADDRESS_IPV6;
-        for ( int i = 0; i < 8; ++i )
+        snapshot_assert( 0 );
+        return 0;
+    }
+  
+    snapshot_assert( result >= 0 );
+
+    return result;
+}
+
+static int snapshot_platform_socket_receive_packets_gro( snapshot_platform_socket_t * socket, snapshot_address_t * from, uint8_t ** packet_data, int * packet_bytes, int max_packet_size, int max_packets )
+{
+    snapshot_assert( socket->gro );
+    snapshot_assert( socket->gro_buffer );
+
+    // with gro the kernel hands us several packets from the same sender coalesced into one buffer, split at the segment size.
+    // fill up to SNAPSHOT_PLATFORM_GRO_BUFFERS buffers with one recvmmsg, copy the segments out one by one, and only go back
+    // to the socket once every buffer is used up.
+
+    int num_packets = 0;
+
+    while ( num_packets < max_packets )
+    {
+        if ( socket->gro_buffer_index < socket->gro_num_buffers )
+        {
+            const int buffer_index = socket->gro_buffer_index;
+            const int buffer_bytes = socket->gro_buffer_bytes[buffer_index];
+
+            if ( socket->gro_buffer_offset >= buffer_bytes )
+            {
+                socket->gro_buffer_index++;
+                socket->gro_buffer_offset = 0;
+                continue;
+            }
+
+            int segment_bytes = socket->gro_segment_bytes[buffer_index];
+            if ( socket->gro_buffer_offset + segment_bytes > buffer_bytes )
+            {
+                segment_bytes = buffer_bytes - socket->gro_buffer_offset;
+            }
+
+            if ( segment_bytes <= max_packet_size )
+            {
+                memcpy( packet_data[num_packets], socket->gro_buffer + buffer_index * SNAPSHOT_PLATFORM_GRO_BUFFER_BYTES + socket->gro_buffer_offset, segment_bytes );
+                packet_bytes[num_packets] = segment_bytes;
+                from[num_packets] = socket->gro_from[buffer_index];
+                num_packets++;
+            }
+            else
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "dropped %d byte gro segment. larger than max packet size", segment_bytes );
+            }
+
+            socket->gro_buffer_offset += segment_bytes;
+
+            continue;
+        }
+
+        sockaddr_storage sockaddr_from[SNAPSHOT_PLATFORM_GRO_BUFFERS];
+        iovec msg[SNAPSHOT_PLATFORM_GRO_BUFFERS];
+        uint8_t control[SNAPSHOT_PLATFORM_GRO_BUFFERS][CMSG_SPACE( sizeof(int) )];
+        mmsghdr message_array[SNAPSHOT_PLATFORM_GRO_BUFFERS];
+
+        memset( control, 0, sizeof(control) );
+        memset( message_array, 0, sizeof(message_array) );
+
+        for ( int i = 0; i < SNAPSHOT_PLATFORM_GRO_BUFFERS; ++i )
+        {
+            msg[i].iov_base = socket->gro_buffer + i * SNAPSHOT_PLATFORM_GRO_BUFFER_BYTES;
+            msg[i].iov_len = SNAPSHOT_PLATFORM_GRO_BUFFER_BYTES;
+            message_array[i].msg_hdr.msg_name = &sockaddr_from[i];
+            message_array[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+            message_array[i].msg_hdr.msg_iov = &msg[i];
+            message_array[i].msg_hdr.msg_iovlen = 1;
+            message_array[i].msg_hdr.msg_control = control[i];
+            message_array[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+
+        // note: blocking sockets wait for the first buffer only, and never once this call has packets to return
+
+        int flags = MSG_DONTWAIT;
+        if ( socket->type != SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING && num_packets == 0 )
         {
-            from->data.ipv6[i] = snapshot_platform_ntohs( ( (uint16_t*) &addr_ipv6->sin6_addr ) [i] );
+            flags = MSG_WAITFORONE;
         }
-        from->port = snapshot_platform_ntohs( addr_ipv6->sin6_port );
+
+        int result = recvmmsg( socket->handle, message_array, SNAPSHOT_PLATFORM_GRO_BUFFERS, flags, NULL );
+
+        if ( result <= 0 )
+        {
+            if ( result < 0 && errno != EAGAIN && errno != EINTR )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "recvmmsg failed with error %d", errno );
+            }
+            break;
+        }
+
+        // buffers that can't be used are left empty, so the loop above skips them
+
+        for ( int i = 0; i < result; ++i )
+        {
+            const msghdr * message = &message_array[i].msg_hdr;
+
+            int buffer_bytes = int( message_array[i].msg_len );
+            int segment_bytes = buffer_bytes;
+
+            if ( message->msg_flags & MSG_TRUNC )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "dropped truncated gro buffer" );
+                buffer_bytes = 0;
+            }
+
+            if ( snapshot_platform_address_from_sockaddr( &socket->gro_from[i], &sockaddr_from[i] ) != SNAPSHOT_OK )
+            {
+                buffer_bytes = 0;
+            }
+
+            for ( cmsghdr * cmsg = CMSG_FIRSTHDR( message ); cmsg != NULL; cmsg = CMSG_NXTHDR( (msghdr*) message, cmsg ) )
+            {
+                if ( cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO )
+                {
+                    int gro_size = 0;
+                    memcpy( &gro_size, CMSG_DATA( cmsg ), sizeof(int) );
+                    if ( gro_size > 0 )
+                    {
+                        segment_bytes = gro_size;
+                    }
+                }
+            }
+
+            socket->gro_buffer_bytes[i] = buffer_bytes;
+            socket->gro_segment_bytes[i] = segment_bytes;
+        }
+
+        socket->gro_num_buffers = result;
+        socket->gro_buffer_index = 0;
+        socket->gro_buffer_offset = 0;
     }
-    else if ( sockaddr_from.ss_family == AF_INET )
+
+    return num_packets;
+}
+
+int snapshot_platform_socket_receive_packets( snapshot_platform_socket_t * socket, snapshot_address_t * from, uint8_t ** packet_data, int * packet_bytes, int max_packet_size, int max_packets )
+{
+    snapshot_assert( socket );
+    snapshot_assert( from );
+    snapshot_assert( packet_data );
+    snapshot_assert( packet_bytes );
+    snapshot_assert( max_packet_size > 0 );
+    snapshot_assert( max_packets > 0 );
+
+    if ( socket->gro )
     {
-        sockaddr_in * addr_ipv4 = (sockaddr_in*) &sockaddr_from;
-        from->type = SNAPSHOT_ADDRESS_IPV4;
-        from->data.ipv4[0] = (uint8_t) ( ( addr_ipv4->sin_addr.s_addr & 0x000000FF ) );
-        from->data.ipv4[1] = (uint8_t) ( ( addr_ipv4->sin_addr.s_addr & 0x0000FF00 ) >> 8 );
-        from->data.ipv4[2] = (uint8_t) ( ( addr_ipv4->sin_addr.s_addr & 0x00FF0000 ) >> 16 );
-        from->data.ipv4[3] = (uint8_t) ( ( addr_ipv4->sin_addr.s_addr & 0xFF000000 ) >> 24 );
-        from->port = snapshot_platform_ntohs( addr_ipv4->sin_port );
+        return snapshot_platform_socket_receive_packets_gro( socket, from, packet_data, packet_bytes, max_packet_size, max_packets );
     }
-    else
+
+    iovec * msg = (iovec*) alloca( sizeof(iovec) * max_packets );
+
+    sockaddr_storage * sockaddr_from = (sockaddr_storage*) alloca( sizeof(sockaddr_storage) * max_packets );
+
+    mmsghdr * packet_array = (mmsghdr*) alloca( sizeof(mmsghdr) * max_packets );
+
+    memset( packet_array, 0, sizeof(mmsghdr) * max_packets );
+
+    for ( int i = 0; i < max_packets; ++i )
     {
-        snapshot_assert( 0 );
+        msg[i].iov_base = packet_data[i];
+        msg[i].iov_len = max_packet_size;
+        packet_array[i].msg_hdr.msg_name = &sockaddr_from[i];
+        packet_array[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        packet_array[i].msg_hdr.msg_iov = &msg[i];
+        packet_array[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // note: blocking sockets wait for the first packet only, then return whatever else is already queued
+
+    int result = recvmmsg( socket->handle, packet_array, max_packets, socket->type == SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING ? MSG_DONTWAIT : MSG_WAITFORONE, NULL );
+
+    if ( result <= 0 )
+    {
+        if ( errno == EAGAIN || errno == EINTR )
+        {
+            return 0;
+        }
+
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "recvmmsg failed with error %d", errno );
+
         return 0;
     }
-  
-    snapshot_assert( result >= 0 );
+
+    // note: entries that could not be read are returned with zero packet bytes so the caller can skip them
+
+    for ( int i = 0; i < result; ++i )
+    {
+        packet_bytes[i] = int( packet_array[i].msg_len );
+
+        if ( snapshot_platform_address_from_sockaddr( &from[i], &sockaddr_from[i] ) != SNAPSHOT_OK )
+        {
+            memset( &from[i], 0, sizeof(snapshot_address_t) );
+            packet_bytes[i] = 0;
+        }
+    }
 
     return result;
 }
@@ -590,6 +997,48 @@ void snapshot_platform_mutex_destroy( snapshot_platform_mutex_t * mutex )
         memset( mutex, 0, sizeof(snapshot_platform_mutex_t) );
     }
 }
+
+// ---------------------------------------------------
+
+int snapshot_platform_condition_create( snapshot_platform_condition_t * condition )
+{
+    snapshot_assert( condition );
+
+    memset( condition, 0, sizeof(snapshot_platform_condition_t) );
+
+    if ( pthread_cond_init( &condition->handle, NULL ) != 0 )
+        return SNAPSHOT_ERROR;
+
+    condition->ok = true;
+
+    return SNAPSHOT_OK;
+}
+
+void snapshot_platform_condition_wait( snapshot_platform_condition_t * condition, snapshot_platform_mutex_t * mutex )
+{
+    snapshot_assert( condition );
+    snapshot_assert( condition->ok );
+    snapshot_assert( mutex );
+    snapshot_assert( mutex->ok );
+    pthread_cond_wait( &condition->handle, &mutex->handle );
+}
+
+void snapshot_platform_condition_signal( snapshot_platform_condition_t * condition )
+{
+    snapshot_assert( condition );
+    snapshot_assert( condition->ok );
+    pthread_cond_signal( &condition->handle );
+}
+
+void snapshot_platform_condition_destroy( snapshot_platform_condition_t * condition )
+{
+    snapshot_assert( condition );
+    if ( condition->ok )
+    {
+        pthread_cond_destroy( &condition->handle );
+        memset( condition, 0, sizeof(snapshot_platform_condition_t) );
+    }
+}
 // ---------------------------------------------------
 
 #else // #if SNAPSHOT_PLATFORM == SNAPSHOT_PLATFORM_LINUX
@@ -168,6 +168,15 @@ struct snapshot_platform_socket_t * snapshot_platform_socket_create( void * cont
 
     s->context = context;
 
+    // SO_REUSEPORT on mac does not spread incoming udp packets across sockets, so sharing a port is not supported
+
+    if ( socket_type & SNAPSHOT_PLATFORM_SOCKET_REUSE_PORT )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "socket reuse port is not supported on this platform" );
+        snapshot_free( context, s );
+        return NULL;
+    }
+
     // create socket
 
     s->handle = socket( ( address->type == SNAPSHOT_ADDRESS_IPV6 ) ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP );
@@ -322,6 +331,18 @@ void snapshot_platform_socket_destroy( struct snapshot_platform_socket_t * socke
     snapshot_free( socket->context, socket );
 }
 
+SNAPSHOT_BOOL snapshot_platform_socket_enable_gso( struct snapshot_platform_socket_t * socket )
+{
+    (void) socket;
+    return SNAPSHOT_FALSE;
+}
+
+SNAPSHOT_BOOL snapshot_platform_socket_enable_gro( struct snapshot_platform_socket_t * socket )
+{
+    (void) socket;
+    return SNAPSHOT_FALSE;
+}
+
 void snapshot_platform_socket_send_packet( struct snapshot_platform_socket_t * socket, const struct snapshot_address_t * to, const void * packet_data, int packet_bytes )
 {
     snapshot_assert( socket );
@@ -372,6 +393,22 @@ void snapshot_platform_socket_send_packet( struct snapshot_platform_socket_t * s
     }
 }
 
+void snapshot_platform_socket_send_packets( struct snapshot_platform_socket_t * socket, const struct snapshot_address_t * to, uint8_t ** packet_data, int * packet_bytes, int num_packets )
+{
+    snapshot_assert( socket );
+    snapshot_assert( to );
+    snapshot_assert( packet_data );
+    snapshot_assert( packet_bytes );
+    snapshot_assert( num_packets >= 0 );
+
+    // note: no batched send on this platform
+
+    for ( int i = 0; i < num_packets; ++i )
+    {
+        snapshot_platform_socket_send_packet( socket, &to[i], packet_data[i], packet_bytes[i] );
+    }
+}
+
 int snapshot_platform_socket_receive_packet( struct snapshot_platform_socket_t * socket, struct snapshot_address_t * from, void * packet_data, int max_packet_size )
 {
     snapshot_assert( socket );
@@ -427,6 +464,29 @@ int snapshot_platform_socket_receive_packet( struct snapshot_platform_socket_t *
     return result;
 }
 
+int snapshot_platform_socket_receive_packets( struct snapshot_platform_socket_t * socket, struct snapshot_address_t * from, uint8_t ** packet_data, int * packet_bytes, int max_packet_size, int max_packets )
+{
+    snapshot_assert( socket );
+    snapshot_assert( from );
+    snapshot_assert( packet_data );
+    snapshot_assert( packet_bytes );
+    snapshot_assert( max_packet_size > 0 );
+    snapshot_assert( max_packets > 0 );
+
+    // note: no batched receive on this platform. drain the socket one packet at a time
+
+    int num_packets = 0;
+    while ( num_packets < max_packets )
+    {
+        packet_bytes[num_packets] = snapshot_platform_socket_receive_packet( socket, &from[num_packets], packet_data[num_packets], max_packet_size );
+        if ( packet_bytes[num_packets] == 0 )
+            break;
+        num_packets++;
+    }
+
+    return num_packets;
+}
+
 // ---------------------------------------------------
 
 struct thread_shim_data_t
@@ -546,6 +606,48 @@ void snapshot_platform_mutex_destroy( struct snapshot_platform_mutex_t * mutex )
 
 // ---------------------------------------------------
 
+int snapshot_platform_condition_create( struct snapshot_platform_condition_t * condition )
+{
+    snapshot_assert( condition );
+
+    memset( condition, 0, sizeof(struct snapshot_platform_condition_t) );
+
+    if ( pthread_cond_init( &condition->handle, NULL ) != 0 )
+        return SNAPSHOT_ERROR;
+
+    condition->ok = true;
+
+    return SNAPSHOT_OK;
+}
+
+void snapshot_platform_condition_wait( struct snapshot_platform_condition_t * condition, struct snapshot_platform_mutex_t * mutex )
+{
+    snapshot_assert( condition );
+    snapshot_assert( condition->ok );
+    snapshot_assert( mutex );
+    snapshot_assert( mutex->ok );
+    pthread_cond_wait( &condition->handle, &mutex->handle );
+}
+
+void snapshot_platform_condition_signal( struct snapshot_platform_condition_t * condition )
+{
+    snapshot_assert( condition );
+    snapshot_assert( condition->ok );
+    pthread_cond_signal( &condition->handle );
+}
+
+void snapshot_platform_condition_destroy( struct snapshot_platform_condition_t * condition )
+{
+    snapshot_assert( condition );
+    if ( condition->ok )
+    {
+        pthread_cond_destroy( &condition->handle );
+        memset( condition, 0, sizeof(struct snapshot_platform_condition_t) );
+    }
+}
+
+// ---------------------------------------------------
+
 #else // #if SNAPSHOT_PLATFORM == SNAPSHOT_PLATFORM_MAC
 
 int snapshot_platform_mac_dummy_symbol = 0;
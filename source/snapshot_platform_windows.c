@@ -187,6 +187,46 @@ void snapshot_platform_mutex_destroy( snapshot_platform_mutex_t * mutex )
     }
 }
 
+int snapshot_platform_condition_create( snapshot_platform_condition_t * condition )
+{
+    snapshot_assert( condition );
+
+    memset( condition, 0, sizeof(snapshot_platform_condition_t) );
+
+    InitializeConditionVariable( &condition->handle );
+
+    condition->ok = true;
+
+    return SNAPSHOT_OK;
+}
+
+void snapshot_platform_condition_wait( snapshot_platform_condition_t * condition, snapshot_platform_mutex_t * mutex )
+{
+    snapshot_assert( condition );
+    snapshot_assert( condition->ok );
+    snapshot_assert( mutex );
+    snapshot_assert( mutex->ok );
+    SleepConditionVariableCS( &condition->handle, (LPCRITICAL_SECTION)&mutex->handle, INFINITE );
+}
+
+void snapshot_platform_condition_signal( snapshot_platform_condition_t * condition )
+{
+    snapshot_assert( condition );
+    snapshot_assert( condition->ok );
+    WakeConditionVariable( &condition->handle );
+}
+
+void snapshot_platform_condition_destroy( snapshot_platform_condition_t * condition )
+{
+    snapshot_assert( condition );
+    if ( condition->ok )
+    {
+        // windows condition variables hold no resources
+
+        memset( condition, 0, sizeof(snapshot_platform_condition_t) );
+    }
+}
+
 // time
 
 void snapshot_platform_sleep( double time )
@@ -295,6 +335,13 @@ snapshot_platform_socket_t * snapshot_platform_socket_create( void * context, sn
     snapshot_assert( address );
     snapshot_assert( address->type != SNAPSHOT_ADDRESS_NONE );
 
+    if ( socket_type & SNAPSHOT_PLATFORM_SOCKET_REUSE_PORT )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "socket reuse port is not supported on this platform" );
+        snapshot_free( context, s );
+        return NULL;
+    }
+
     // create socket
 
     s->handle = socket( ( address->type == SNAPSHOT_ADDRESS_IPV6 ) ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP );
@@ -448,6 +495,18 @@ void snapshot_platform_socket_destroy( snapshot_platform_socket_t * socket )
     snapshot_free( socket->context, socket );
 }
 
+SNAPSHOT_BOOL snapshot_platform_socket_enable_gso( snapshot_platform_socket_t * socket )
+{
+    (void) socket;
+    return SNAPSHOT_FALSE;
+}
+
+SNAPSHOT_BOOL snapshot_platform_socket_enable_gro( snapshot_platform_socket_t * socket )
+{
+    (void) socket;
+    return SNAPSHOT_FALSE;
+}
+
 void snapshot_platform_socket_send_packet( snapshot_platform_socket_t * socket, const snapshot_address_t * to, const void * packet_data, int packet_bytes )
 {
     snapshot_assert( socket );
@@ -502,6 +561,22 @@ void snapshot_platform_socket_send_packet( snapshot_platform_socket_t * socket,
     }
 }
 
+void snapshot_platform_socket_send_packets( snapshot_platform_socket_t * socket, const snapshot_address_t * to, uint8_t ** packet_data, int * packet_bytes, int num_packets )
+{
+    snapshot_assert( socket );
+    snapshot_assert( to );
+    snapshot_assert( packet_data );
+    snapshot_assert( packet_bytes );
+    snapshot_assert( num_packets >= 0 );
+
+    // note: no batched send on this platform
+
+    for ( int i = 0; i < num_packets; ++i )
+    {
+        snapshot_platform_socket_send_packet( socket, &to[i], packet_data[i], packet_bytes[i] );
+    }
+}
+
 int snapshot_platform_socket_receive_packet( snapshot_platform_socket_t * socket, snapshot_address_t * from, void * packet_data, int max_packet_size )
 {
     snapshot_assert( socket );
@@ -559,6 +634,29 @@ int snapshot_platform_socket_receive_packet( snapshot_platform_socket_t * socket
     return result;
 }
 
+int snapshot_platform_socket_receive_packets( snapshot_platform_socket_t * socket, snapshot_address_t * from, uint8_t ** packet_data, int * packet_bytes, int max_packet_size, int max_packets )
+{
+    snapshot_assert( socket );
+    snapshot_assert( from );
+    snapshot_assert( packet_data );
+    snapshot_assert( packet_bytes );
+    snapshot_assert( max_packet_size > 0 );
+    snapshot_assert( max_packets > 0 );
+
+    // note: no batched receive on this platform. drain the socket one packet at a time
+
+    int num_packets = 0;
+    while ( num_packets < max_packets )
+    {
+        packet_bytes[num_packets] = snapshot_platform_socket_receive_packet( socket, &from[num_packets], packet_data[num_packets], max_packet_size );
+        if ( packet_bytes[num_packets] == 0 )
+            break;
+        num_packets++;
+    }
+
+    return num_packets;
+}
+
 #if SNAPSHOT_UNREAL_ENGINE
 #include "Windows/PostWindowsApi.h"
 #include "Windows/HideWindowsPlatformTypes.h"
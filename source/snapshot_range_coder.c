@@ -0,0 +1,598 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+
+#include "snapshot_range_coder.h"
+#include "snapshot_read_write.h"
+#include "snapshot_packed_sequence_buffer.h"
+#include "snapshot_util.h"
+
+// -----------------------------------------------------------------------------------------
+
+#define SNAPSHOT_RANGE_CODER_FLAG_CODED                                     1
+#define SNAPSHOT_RANGE_CODER_FLAG_BASELINE                                  2
+
+#define SNAPSHOT_RANGE_CODER_TOP                                  ( 1U << 24 )
+
+#define SNAPSHOT_RANGE_MODEL_ONE                 ( 1U << SNAPSHOT_RANGE_MODEL_PROBABILITY_BITS )
+
+int snapshot_range_coder_max_bytes( int bytes )
+{
+    // flags and baseline sequence, followed by the bytes as they are when coding does not help
+
+    return 3 + bytes;
+}
+
+void snapshot_range_model_init( struct snapshot_range_model_t * model )
+{
+    snapshot_assert( model );
+    for ( int i = 0; i < 256; i++ )
+    {
+        model->probabilities[i] = SNAPSHOT_RANGE_MODEL_ONE / 2;
+    }
+}
+
+static inline void snapshot_range_model_update( uint16_t * probability, uint32_t bit )
+{
+    // move towards one for a zero bit and towards zero for a one bit, without a branch on the bit
+
+    const uint32_t mask = 0 - bit;
+    const uint32_t value = *probability;
+    *probability = (uint16_t) ( value + ( ( ( SNAPSHOT_RANGE_MODEL_ONE - value ) & ~mask ) >> SNAPSHOT_RANGE_MODEL_ADAPT_SHIFT ) - ( ( value & mask ) >> SNAPSHOT_RANGE_MODEL_ADAPT_SHIFT ) );
+}
+
+void snapshot_range_model_train( struct snapshot_range_model_t * model, const uint8_t * data, int bytes )
+{
+    snapshot_assert( model );
+    snapshot_assert( data || bytes == 0 );
+
+    for ( int i = 0; i < bytes; i++ )
+    {
+        uint32_t node = 1;
+        for ( int j = 7; j >= 0; j-- )
+        {
+            const uint32_t bit = ( data[i] >> j ) & 1;
+            snapshot_range_model_update( &model->probabilities[node], bit );
+            node = ( node << 1 ) | bit;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------
+
+// carry propagating range coder with 32 bit range and 11 bit probabilities. the first byte out of the classic
+// formulation is always zero so it is never stored, and since the decoder reads zeros past the end of its input,
+// trailing zero bytes are dropped too.
+
+struct snapshot_range_writer_t
+{
+    uint8_t * data;
+    int bytes;
+    int max_bytes;
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    int cache_size;
+};
+
+static void snapshot_range_writer_init( struct snapshot_range_writer_t * writer, uint8_t * data, int max_bytes )
+{
+    writer->data = data;
+    writer->bytes = -1;
+    writer->max_bytes = max_bytes;
+    writer->low = 0;
+    writer->range = 0xFFFFFFFF;
+    writer->cache = 0;
+    writer->cache_size = 1;
+}
+
+static inline void snapshot_range_writer_put( struct snapshot_range_writer_t * writer, uint8_t value )
+{
+    // keep going past the end so the model still sees every byte. the caller sends the bytes uncoded instead
+
+    snapshot_assert( writer->bytes >= 0 || value == 0 );
+    if ( writer->bytes >= 0 && writer->bytes < writer->max_bytes )
+    {
+        writer->data[writer->bytes] = value;
+    }
+    writer->bytes++;
+}
+
+static inline void snapshot_range_writer_shift_low( struct snapshot_range_writer_t * writer )
+{
+    if ( (uint32_t) writer->low < 0xFF000000 || ( writer->low >> 32 ) != 0 )
+    {
+        const uint8_t carry = (uint8_t) ( writer->low >> 32 );
+        uint8_t value = writer->cache;
+        do
+        {
+            snapshot_range_writer_put( writer, (uint8_t) ( value + carry ) );
+            value = 0xFF;
+        }
+        while ( --writer->cache_size != 0 );
+        writer->cache = (uint8_t) ( writer->low >> 24 );
+    }
+    writer->cache_size++;
+    writer->low = ( writer->low & 0x00FFFFFF ) << 8;
+}
+
+static inline void snapshot_range_writer_bit( struct snapshot_range_writer_t * writer, uint16_t * probability, uint32_t bit )
+{
+    const uint32_t bound = ( writer->range >> SNAPSHOT_RANGE_MODEL_PROBABILITY_BITS ) * *probability;
+    const uint32_t mask = 0 - bit;
+    writer->low += bound & mask;
+    writer->range = ( bound & ~mask ) | ( ( writer->range - bound ) & mask );
+    snapshot_range_model_update( probability, bit );
+    while ( writer->range < SNAPSHOT_RANGE_CODER_TOP )
+    {
+        writer->range <<= 8;
+        snapshot_range_writer_shift_low( writer );
+    }
+}
+
+static int snapshot_range_writer_finish( struct snapshot_range_writer_t * writer )
+{
+    for ( int i = 0; i < 5; i++ )
+    {
+        snapshot_range_writer_shift_low( writer );
+    }
+
+    if ( writer->bytes > writer->max_bytes )
+        return writer->bytes;
+
+    while ( writer->bytes > 0 && writer->data[writer->bytes-1] == 0 )
+    {
+        writer->bytes--;
+    }
+
+    return writer->bytes;
+}
+
+struct snapshot_range_reader_t
+{
+    const uint8_t * data;
+    int bytes;
+    int index;
+    uint32_t range;
+    uint32_t code;
+};
+
+static inline uint8_t snapshot_range_reader_next( struct snapshot_range_reader_t * reader )
+{
+    return ( reader->index < reader->bytes ) ? reader->data[reader->index++] : 0;
+}
+
+static void snapshot_range_reader_init( struct snapshot_range_reader_t * reader, const uint8_t * data, int bytes )
+{
+    reader->data = data;
+    reader->bytes = bytes;
+    reader->index = 0;
+    reader->range = 0xFFFFFFFF;
+    reader->code = 0;
+    for ( int i = 0; i < 4; i++ )
+    {
+        reader->code = ( reader->code << 8 ) | snapshot_range_reader_next( reader );
+    }
+}
+
+static inline uint32_t snapshot_range_reader_bit( struct snapshot_range_reader_t * reader, uint16_t * probability )
+{
+    const uint32_t bound = ( reader->range >> SNAPSHOT_RANGE_MODEL_PROBABILITY_BITS ) * *probability;
+    uint32_t bit;
+    if ( reader->code < bound )
+    {
+        reader->range = bound;
+        bit = 0;
+    }
+    else
+    {
+        reader->code -= bound;
+        reader->range -= bound;
+        bit = 1;
+    }
+    snapshot_range_model_update( probability, bit );
+    while ( reader->range < SNAPSHOT_RANGE_CODER_TOP )
+    {
+        reader->range <<= 8;
+        reader->code = ( reader->code << 8 ) | snapshot_range_reader_next( reader );
+    }
+    return bit;
+}
+
+// -----------------------------------------------------------------------------------------
+
+struct snapshot_range_encoder_t
+{
+    void * context;
+    int max_bytes;
+    int mode;
+    SNAPSHOT_BOOL has_baseline;
+    uint16_t baseline_sequence;
+    struct snapshot_packed_sequence_buffer_t * history;
+    struct snapshot_range_model_t static_model;
+    struct snapshot_range_model_t model;
+    uint8_t * scratch;
+};
+
+struct snapshot_range_encoder_t * snapshot_range_encoder_create( void * context, int max_bytes, int mode, const struct snapshot_range_model_t * static_model, int history_size )
+{
+    snapshot_assert( max_bytes > 0 );
+    snapshot_assert( max_bytes <= 32767 );
+    snapshot_assert( mode == SNAPSHOT_RANGE_CODER_STATIC || mode == SNAPSHOT_RANGE_CODER_ADAPTIVE );
+    snapshot_assert( mode != SNAPSHOT_RANGE_CODER_ADAPTIVE || ( history_size > 0 && ( history_size & ( history_size - 1 ) ) == 0 ) );
+
+    struct snapshot_range_encoder_t * encoder = (struct snapshot_range_encoder_t*) snapshot_malloc( context, sizeof( struct snapshot_range_encoder_t ) );
+    if ( !encoder )
+        return NULL;
+
+    memset( encoder, 0, sizeof( struct snapshot_range_encoder_t ) );
+
+    encoder->context = context;
+    encoder->max_bytes = max_bytes;
+    encoder->mode = mode;
+
+    if ( static_model )
+    {
+        memcpy( &encoder->static_model, static_model, sizeof( struct snapshot_range_model_t ) );
+    }
+    else
+    {
+        snapshot_range_model_init( &encoder->static_model );
+    }
+
+    if ( mode == SNAPSHOT_RANGE_CODER_ADAPTIVE )
+    {
+        encoder->history = snapshot_packed_sequence_buffer_create( context, history_size, sizeof( struct snapshot_range_model_t ) );
+        if ( !encoder->history )
+        {
+            snapshot_range_encoder_destroy( encoder );
+            return NULL;
+        }
+    }
+
+    encoder->scratch = (uint8_t*) snapshot_malloc( context, snapshot_range_coder_max_bytes( max_bytes ) );
+    if ( !encoder->scratch )
+    {
+        snapshot_range_encoder_destroy( encoder );
+        return NULL;
+    }
+
+    return encoder;
+}
+
+void snapshot_range_encoder_destroy( struct snapshot_range_encoder_t * encoder )
+{
+    snapshot_assert( encoder );
+
+    if ( encoder->history )
+    {
+        snapshot_packed_sequence_buffer_destroy( encoder->history );
+    }
+
+    if ( encoder->scratch )
+    {
+        snapshot_free( encoder->context, encoder->scratch );
+    }
+
+    snapshot_free( encoder->context, encoder );
+}
+
+void snapshot_range_encoder_reset( struct snapshot_range_encoder_t * encoder )
+{
+    snapshot_assert( encoder );
+    encoder->has_baseline = SNAPSHOT_FALSE;
+    encoder->baseline_sequence = 0;
+    if ( encoder->history )
+    {
+        snapshot_packed_sequence_buffer_reset( encoder->history );
+    }
+}
+
+size_t snapshot_range_encoder_memory_bytes( const struct snapshot_range_encoder_t * encoder )
+{
+    snapshot_assert( encoder );
+    return sizeof( struct snapshot_range_encoder_t ) + 
+           ( encoder->history ? snapshot_packed_sequence_buffer_memory_bytes( encoder->history->num_entries, sizeof( struct snapshot_range_model_t ) ) : 0 ) + 
+           snapshot_range_coder_max_bytes( encoder->max_bytes );
+}
+
+void snapshot_range_encoder_process_acks( struct snapshot_range_encoder_t * encoder, const uint16_t * acks, int num_acks )
+{
+    snapshot_assert( encoder );
+    snapshot_assert( acks || num_acks == 0 );
+
+    if ( !encoder->history )
+        return;
+
+    for ( int i = 0; i < num_acks; i++ )
+    {
+        if ( !snapshot_packed_sequence_buffer_exists( encoder->history, acks[i] ) )
+            continue;
+
+        if ( !encoder->has_baseline || snapshot_sequence_greater_than( acks[i], encoder->baseline_sequence ) )
+        {
+            encoder->has_baseline = SNAPSHOT_TRUE;
+            encoder->baseline_sequence = acks[i];
+        }
+    }
+}
+
+const uint8_t * snapshot_range_encoder_write( struct snapshot_range_encoder_t * encoder, uint16_t sequence, const uint8_t * data, int bytes, int * out_bytes )
+{
+    snapshot_assert( encoder );
+    snapshot_assert( data || bytes == 0 );
+    snapshot_assert( bytes >= 0 );
+    snapshot_assert( bytes <= encoder->max_bytes );
+    snapshot_assert( out_bytes );
+
+    // start from the model at the end of the newest acked packet, or the static model when there isn't one
+
+    const struct snapshot_range_model_t * baseline_model = NULL;
+    if ( encoder->has_baseline )
+    {
+        baseline_model = (const struct snapshot_range_model_t*) snapshot_packed_sequence_buffer_find( encoder->history, encoder->baseline_sequence );
+    }
+
+    memcpy( &encoder->model, baseline_model ? baseline_model : &encoder->static_model, sizeof( struct snapshot_range_model_t ) );
+
+    uint8_t * p = encoder->scratch;
+
+    uint8_t flags = baseline_model ? SNAPSHOT_RANGE_CODER_FLAG_BASELINE : 0;
+
+    snapshot_write_uint8( &p, flags );
+
+    if ( baseline_model )
+    {
+        snapshot_write_uint16( &p, encoder->baseline_sequence );
+    }
+
+    const int header_bytes = (int) ( p - encoder->scratch );
+
+    // coding only pays off when it beats the uncoded bytes including the length it adds
+
+    const int length_bytes = ( bytes < 128 ) ? 1 : 2;
+
+    struct snapshot_range_writer_t writer;
+    snapshot_range_writer_init( &writer, p + length_bytes, bytes - length_bytes - 1 );
+
+    for ( int i = 0; i < bytes; i++ )
+    {
+        uint32_t node = 1;
+        for ( int j = 7; j >= 0; j-- )
+        {
+            const uint32_t bit = ( data[i] >> j ) & 1;
+            snapshot_range_writer_bit( &writer, &encoder->model.probabilities[node], bit );
+            node = ( node << 1 ) | bit;
+        }
+    }
+
+    const int coded_bytes = snapshot_range_writer_finish( &writer );
+
+    if ( coded_bytes < bytes - length_bytes )
+    {
+        // the length takes one byte below 128 and two bytes otherwise
+
+        flags |= SNAPSHOT_RANGE_CODER_FLAG_CODED;
+        encoder->scratch[0] = flags;
+        if ( length_bytes == 1 )
+        {
+            snapshot_write_uint8( &p, (uint8_t) bytes );
+        }
+        else
+        {
+            snapshot_write_uint8( &p, (uint8_t) ( 0x80 | ( bytes & 0x7F ) ) );
+            snapshot_write_uint8( &p, (uint8_t) ( bytes >> 7 ) );
+        }
+        *out_bytes = header_bytes + length_bytes + coded_bytes;
+    }
+    else
+    {
+        memcpy( p, data, bytes );
+        *out_bytes = header_bytes + bytes;
+    }
+
+    snapshot_assert( *out_bytes <= snapshot_range_coder_max_bytes( bytes ) );
+
+    // remember the model at the end of this packet, so it can be the starting point once the packet is acked
+
+    if ( encoder->history )
+    {
+        struct snapshot_range_model_t * entry = (struct snapshot_range_model_t*) snapshot_packed_sequence_buffer_insert( encoder->history, sequence );
+        if ( entry )
+        {
+            memcpy( entry, &encoder->model, sizeof( struct snapshot_range_model_t ) );
+        }
+    }
+
+    return encoder->scratch;
+}
+
+// -----------------------------------------------------------------------------------------
+
+struct snapshot_range_decoder_t
+{
+    void * context;
+    int max_bytes;
+    int mode;
+    struct snapshot_packed_sequence_buffer_t * history;
+    struct snapshot_range_model_t static_model;
+    struct snapshot_range_model_t model;
+    uint8_t * data;
+};
+
+struct snapshot_range_decoder_t * snapshot_range_decoder_create( void * context, int max_bytes, int mode, const struct snapshot_range_model_t * static_model, int history_size )
+{
+    snapshot_assert( max_bytes > 0 );
+    snapshot_assert( max_bytes <= 32767 );
+    snapshot_assert( mode == SNAPSHOT_RANGE_CODER_STATIC || mode == SNAPSHOT_RANGE_CODER_ADAPTIVE );
+    snapshot_assert( mode != SNAPSHOT_RANGE_CODER_ADAPTIVE || ( history_size > 0 && ( history_size & ( history_size - 1 ) ) == 0 ) );
+
+    struct snapshot_range_decoder_t * decoder = (struct snapshot_range_decoder_t*) snapshot_malloc( context, sizeof( struct snapshot_range_decoder_t ) );
+    if ( !decoder )
+        return NULL;
+
+    memset( decoder, 0, sizeof( struct snapshot_range_decoder_t ) );
+
+    decoder->context = context;
+    decoder->max_bytes = max_bytes;
+    decoder->mode = mode;
+
+    if ( static_model )
+    {
+        memcpy( &decoder->static_model, static_model, sizeof( struct snapshot_range_model_t ) );
+    }
+    else
+    {
+        snapshot_range_model_init( &decoder->static_model );
+    }
+
+    if ( mode == SNAPSHOT_RANGE_CODER_ADAPTIVE )
+    {
+        decoder->history = snapshot_packed_sequence_buffer_create( context, history_size, sizeof( struct snapshot_range_model_t ) );
+        if ( !decoder->history )
+        {
+            snapshot_range_decoder_destroy( decoder );
+            return NULL;
+        }
+    }
+
+    decoder->data = (uint8_t*) snapshot_malloc( context, max_bytes );
+    if ( !decoder->data )
+    {
+        snapshot_range_decoder_destroy( decoder );
+        return NULL;
+    }
+
+    return decoder;
+}
+
+void snapshot_range_decoder_destroy( struct snapshot_range_decoder_t * decoder )
+{
+    snapshot_assert( decoder );
+
+    if ( decoder->history )
+    {
+        snapshot_packed_sequence_buffer_destroy( decoder->history );
+    }
+
+    if ( decoder->data )
+    {
+        snapshot_free( decoder->context, decoder->data );
+    }
+
+    snapshot_free( decoder->context, decoder );
+}
+
+void snapshot_range_decoder_reset( struct snapshot_range_decoder_t * decoder )
+{
+    snapshot_assert( decoder );
+    if ( decoder->history )
+    {
+        snapshot_packed_sequence_buffer_reset( decoder->history );
+    }
+}
+
+size_t snapshot_range_decoder_memory_bytes( const struct snapshot_range_decoder_t * decoder )
+{
+    snapshot_assert( decoder );
+    return sizeof( struct snapshot_range_decoder_t ) + 
+           ( decoder->history ? snapshot_packed_sequence_buffer_memory_bytes( decoder->history->num_entries, sizeof( struct snapshot_range_model_t ) ) : 0 ) + 
+           decoder->max_bytes;
+}
+
+const uint8_t * snapshot_range_decoder_read( struct snapshot_range_decoder_t * decoder, uint16_t sequence, const uint8_t * data, int bytes, int * out_bytes )
+{
+    snapshot_assert( decoder );
+    snapshot_assert( data );
+    snapshot_assert( out_bytes );
+
+    if ( bytes < 1 )
+        return NULL;
+
+    const uint8_t * p = data;
+    const uint8_t * end = data + bytes;
+
+    const uint8_t flags = snapshot_read_uint8( &p );
+
+    if ( flags & ~( SNAPSHOT_RANGE_CODER_FLAG_CODED | SNAPSHOT_RANGE_CODER_FLAG_BASELINE ) )
+        return NULL;
+
+    const struct snapshot_range_model_t * start_model = &decoder->static_model;
+
+    if ( flags & SNAPSHOT_RANGE_CODER_FLAG_BASELINE )
+    {
+        if ( !decoder->history || end - p < 2 )
+            return NULL;
+
+        const uint16_t baseline_sequence = snapshot_read_uint16( &p );
+
+        start_model = (const struct snapshot_range_model_t*) snapshot_packed_sequence_buffer_find( decoder->history, baseline_sequence );
+        if ( !start_model )
+            return NULL;
+    }
+
+    memcpy( &decoder->model, start_model, sizeof( struct snapshot_range_model_t ) );
+
+    int decoded_bytes = 0;
+
+    if ( flags & SNAPSHOT_RANGE_CODER_FLAG_CODED )
+    {
+        if ( end - p < 1 )
+            return NULL;
+
+        decoded_bytes = snapshot_read_uint8( &p );
+        if ( decoded_bytes & 0x80 )
+        {
+            if ( end - p < 1 )
+                return NULL;
+
+            decoded_bytes = ( decoded_bytes & 0x7F ) | ( snapshot_read_uint8( &p ) << 7 );
+        }
+
+        if ( decoded_bytes > decoder->max_bytes )
+            return NULL;
+
+        struct snapshot_range_reader_t reader;
+        snapshot_range_reader_init( &reader, p, (int) ( end - p ) );
+
+        for ( int i = 0; i < decoded_bytes; i++ )
+        {
+            uint32_t node = 1;
+            for ( int j = 0; j < 8; j++ )
+            {
+                node = ( node << 1 ) | snapshot_range_reader_bit( &reader, &decoder->model.probabilities[node] );
+            }
+            decoder->data[i] = (uint8_t) node;
+        }
+    }
+    else
+    {
+        decoded_bytes = (int) ( end - p );
+        if ( decoded_bytes > decoder->max_bytes )
+            return NULL;
+
+        memcpy( decoder->data, p, decoded_bytes );
+
+        snapshot_range_model_train( &decoder->model, decoder->data, decoded_bytes );
+    }
+
+    if ( decoder->history )
+    {
+        struct snapshot_range_model_t * entry = (struct snapshot_range_model_t*) snapshot_packed_sequence_buffer_insert( decoder->history, sequence );
+        if ( !entry )
+            return NULL;
+
+        memcpy( entry, &decoder->model, sizeof( struct snapshot_range_model_t ) );
+    }
+
+    *out_bytes = decoded_bytes;
+
+    return decoder->data;
+}
@@ -0,0 +1,150 @@
+/*
+    Snapshot 
+
+    Copyright © 2024 Más Bandwidth LLC. 
+
+    This source code is licensed under GPL version 3 or any later version.
+
+    Commercial licensing under different terms is available. Email licensing@mas-bandwidth.com for details
+*/
+
+#include "snapshot_rate_limiter.h"
+
+// ------------------------------------------------------------------------------------------
+
+struct snapshot_rate_limiter_t * snapshot_rate_limiter_create( void * context, int max_entries, double packets_per_second, double burst )
+{
+    snapshot_assert( max_entries > 0 );
+    snapshot_assert( packets_per_second > 0.0 );
+    snapshot_assert( burst >= 1.0 );
+
+    struct snapshot_rate_limiter_t * limiter = (struct snapshot_rate_limiter_t*) snapshot_malloc( context, sizeof( struct snapshot_rate_limiter_t ) );
+    if ( !limiter )
+        return NULL;
+
+    memset( limiter, 0, sizeof( struct snapshot_rate_limiter_t ) );
+
+    limiter->context = context;
+    limiter->packets_per_second = packets_per_second;
+    limiter->burst = burst;
+
+    limiter->num_slots = 1;
+    while ( limiter->num_slots < max_entries || limiter->num_slots < SNAPSHOT_RATE_LIMITER_MAX_PROBES )
+    {
+        limiter->num_slots *= 2;
+    }
+
+    limiter->entries = (struct snapshot_rate_limiter_entry_t*) snapshot_malloc( context, limiter->num_slots * sizeof( struct snapshot_rate_limiter_entry_t ) );
+    if ( !limiter->entries )
+    {
+        snapshot_rate_limiter_destroy( limiter );
+        return NULL;
+    }
+
+    snapshot_rate_limiter_reset( limiter );
+
+    return limiter;
+}
+
+void snapshot_rate_limiter_destroy( struct snapshot_rate_limiter_t * limiter )
+{
+    snapshot_assert( limiter );
+
+    void * context = limiter->context;
+
+    if ( limiter->entries ) snapshot_free( context, limiter->entries );
+
+    snapshot_free( context, limiter );
+}
+
+size_t snapshot_rate_limiter_memory_bytes( const struct snapshot_rate_limiter_t * limiter )
+{
+    snapshot_assert( limiter );
+
+    return sizeof( struct snapshot_rate_limiter_t ) + limiter->num_slots * sizeof( struct snapshot_rate_limiter_entry_t );
+}
+
+void snapshot_rate_limiter_reset( struct snapshot_rate_limiter_t * limiter )
+{
+    snapshot_assert( limiter );
+
+    limiter->num_entries = 0;
+
+    // an address type of zero marks a free slot
+
+    memset( limiter->entries, 0, limiter->num_slots * sizeof( struct snapshot_rate_limiter_entry_t ) );
+}
+
+SNAPSHOT_BOOL snapshot_rate_limiter_allow( struct snapshot_rate_limiter_t * limiter, const struct snapshot_address_t * address, double time )
+{
+    snapshot_assert( limiter );
+    snapshot_assert( address );
+
+    struct snapshot_address_t ip = *address;
+    ip.port = 0;
+
+    const int mask = limiter->num_slots - 1;
+
+    const int home = (int) ( snapshot_address_hash( &ip ) & mask );
+
+    struct snapshot_rate_limiter_entry_t * entry = NULL;
+    struct snapshot_rate_limiter_entry_t * free_entry = NULL;
+    struct snapshot_rate_limiter_entry_t * oldest_entry = NULL;
+
+    for ( int i = 0; i < SNAPSHOT_RATE_LIMITER_MAX_PROBES; ++i )
+    {
+        struct snapshot_rate_limiter_entry_t * candidate = &limiter->entries[( home + i ) & mask];
+
+        if ( candidate->address.type == SNAPSHOT_ADDRESS_NONE )
+        {
+            if ( !free_entry )
+                free_entry = candidate;
+            continue;
+        }
+
+        if ( snapshot_address_equal( &candidate->address, &ip ) )
+        {
+            entry = candidate;
+            break;
+        }
+
+        if ( !oldest_entry || candidate->last_time < oldest_entry->last_time )
+            oldest_entry = candidate;
+    }
+
+    if ( !entry )
+    {
+        // a new source starts with a full bucket
+
+        if ( free_entry )
+        {
+            entry = free_entry;
+            limiter->num_entries++;
+        }
+        else
+        {
+            entry = oldest_entry;
+        }
+
+        snapshot_assert( entry );
+
+        entry->address = ip;
+        entry->tokens = limiter->burst;
+        entry->last_time = time;
+    }
+
+    if ( time > entry->last_time )
+    {
+        entry->tokens += ( time - entry->last_time ) * limiter->packets_per_second;
+        if ( entry->tokens > limiter->burst )
+            entry->tokens = limiter->burst;
+        entry->last_time = time;
+    }
+
+    if ( entry->tokens < 1.0 )
+        return SNAPSHOT_FALSE;
+
+    entry->tokens -= 1.0;
+
+    return SNAPSHOT_TRUE;
+}
@@ -15,14 +15,21 @@
 #include "snapshot_packets.h"
 #include "snapshot_connect_token.h"
 #include "snapshot_replay_protection.h"
+#include "snapshot_delta.h"
+#include "snapshot_range_coder.h"
 #include "snapshot_encryption_manager.h"
+#include "snapshot_address_index.h"
 #include "snapshot_network_simulator.h"
 #include "snapshot_endpoint.h"
+#include "snapshot_io_thread.h"
+#include "snapshot_packet_pool.h"
+#include "snapshot_handshake.h"
+#include "snapshot_connect_token_table.h"
+#include "snapshot_rate_limiter.h"
 
 #include <time.h>
 
-#define SNAPSHOT_MAX_CONNECT_TOKEN_ENTRIES            ( SNAPSHOT_MAX_CLIENTS * 4 )
-#define SNAPSHOT_SERVER_MAX_SIM_RECEIVE_PACKETS     ( 256 * SNAPSHOT_MAX_CLIENTS )
+#define SNAPSHOT_SERVER_SIM_RECEIVE_PACKETS_PER_CLIENT              256
 
 // ------------------------------------------------------------------------------------------
 
@@ -31,9 +38,26 @@ void snapshot_default_server_config( struct snapshot_server_config_t * config )
     snapshot_assert( config );
     config->context = NULL;
     config->max_clients = SNAPSHOT_MAX_CLIENTS;
+    config->num_shards = 1;
     config->connect_disconnect_callback = NULL;
     config->send_loopback_packet_callback = NULL;
     config->process_passthrough_callback = NULL;
+    config->enable_gso = SNAPSHOT_FALSE;
+    config->enable_gro = SNAPSHOT_FALSE;
+    config->reuse_port = SNAPSHOT_FALSE;
+    config->io_thread = SNAPSHOT_FALSE;
+    config->packet_pool = SNAPSHOT_FALSE;
+    config->handshake_threads = 0;
+    config->max_connect_token_entries = 0;
+    config->stateless_handshake = SNAPSHOT_FALSE;
+    config->rate_limit_packets_per_second = 0;
+    config->rate_limit_burst = SNAPSHOT_SERVER_RATE_LIMIT_BURST;
+    config->ack_bits = 32;
+    config->replay_protection_window_bits = SNAPSHOT_REPLAY_PROTECTION_DEFAULT_WINDOW_BITS;
+    config->snapshot_bytes = 0;
+    config->snapshot_history = SNAPSHOT_DELTA_DEFAULT_HISTORY;
+    config->snapshot_range_coder = SNAPSHOT_RANGE_CODER_NONE;
+    config->snapshot_range_model = NULL;
 #if SNAPSHOT_DEVELOPMENT
     config->network_simulator = NULL;
 #endif // #if SNAPSHOT_DEVELOPMENT
@@ -41,268 +65,1164 @@ void snapshot_default_server_config( struct snapshot_server_config_t * config )
 
 // ------------------------------------------------------------------------------------------
 
-struct snapshot_connect_token_entry_t
+struct snapshot_server_shard_t
 {
-    double time;
-    uint8_t mac[SNAPSHOT_MAC_BYTES];
+    struct snapshot_server_t * parent;
+    struct snapshot_server_t * server;
+    struct snapshot_platform_thread_t * thread;
+    struct snapshot_platform_condition_t update_condition;
+    uint64_t update_generation;
+};
+
+struct snapshot_server_t
+{
+    struct snapshot_server_config_t config;
+    struct snapshot_platform_socket_t * socket;
+    struct snapshot_io_thread_t * io_thread;
+    struct snapshot_packet_pool_t * packet_pool;
+    struct snapshot_handshake_pool_t * handshake_pool;
     struct snapshot_address_t address;
+    SNAPSHOT_BOOL allow_any_address;
+    uint64_t flags;
+    double time;
+    int max_clients;
+    int num_connected_clients;
+    uint64_t global_sequence;
+    uint64_t challenge_sequence;
+    uint64_t challenge_replay_protection[( sizeof( struct snapshot_replay_protection_t ) + SNAPSHOT_SERVER_CHALLENGE_WINDOW_BITS / 8 ) / sizeof( uint64_t )];
+    uint8_t allowed_packets[SNAPSHOT_NUM_PACKETS];
+    uint8_t challenge_key[SNAPSHOT_KEY_BYTES];
+    size_t memory_bytes;
+    size_t client_memory_bytes;
+    struct snapshot_server_t * shard_parent;
+    int shard_client_index_offset;
+    int shard_max_clients;
+    int num_shards;
+    struct snapshot_server_shard_t * shards;
+    struct snapshot_platform_mutex_t shard_callback_mutex;
+    struct snapshot_platform_mutex_t shard_connect_token_mutex;
+    struct snapshot_platform_mutex_t shard_client_id_mutex;
+    struct snapshot_platform_mutex_t shard_update_mutex;
+    struct snapshot_platform_condition_t shard_update_condition;
+    uint64_t shard_update_generation;
+    double shard_update_time;
+    int shards_updating;
+    SNAPSHOT_BOOL shards_quit;
+    uint64_t shard_packet_pool_counters[SNAPSHOT_PACKET_POOL_NUM_COUNTERS];
+    int * client_connected;
+    int * client_timeout;
+    int * client_loopback;
+    int * client_confirmed;
+    int * client_encryption_index;
+    uint64_t * client_id;
+    uint64_t * client_sequence;
+    double * client_last_internal_packet_send_time;
+    double * client_last_packet_receive_time;
+    uint8_t (*client_user_data)[SNAPSHOT_USER_DATA_BYTES];
+    int client_replay_protection_bytes;
+    uint8_t * client_replay_protection;
+    struct snapshot_endpoint_t ** client_endpoint;
+    struct snapshot_delta_encoder_t ** client_delta_encoder;
+    struct snapshot_range_encoder_t ** client_range_encoder;
+    struct snapshot_address_t * client_address;
+    int num_client_address_index_slots;
+    int * client_address_index_slots;
+    struct snapshot_address_index_t client_address_index;
+    struct snapshot_connect_token_table_t * connect_token_table;
+    struct snapshot_rate_limiter_t * rate_limiter;
+    struct snapshot_encryption_manager_t * encryption_manager;
+    SNAPSHOT_BOOL has_snapshot;
+    uint8_t * snapshot_data;
+    uint8_t * receive_packet_data[SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE];
+    int receive_packet_bytes[SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE];
+    struct snapshot_address_t receive_from[SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE];
+    uint8_t receive_buffer[SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE][SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+    int send_queue_num_packets;
+    uint8_t * send_queue_packet_data[SNAPSHOT_SERVER_SEND_BATCH_SIZE];
+    int send_queue_packet_bytes[SNAPSHOT_SERVER_SEND_BATCH_SIZE];
+    struct snapshot_address_t send_queue_to[SNAPSHOT_SERVER_SEND_BATCH_SIZE];
+    uint8_t send_queue_buffer[SNAPSHOT_SERVER_SEND_BATCH_SIZE][SNAPSHOT_MAX_PACKET_BYTES];
+    uint8_t send_queue_encrypt[SNAPSHOT_SERVER_SEND_BATCH_SIZE];
+    struct snapshot_packet_crypto_t send_queue_crypto[SNAPSHOT_SERVER_SEND_BATCH_SIZE];
+    struct snapshot_crypto_aead_batch_item_t send_queue_crypto_items[SNAPSHOT_SERVER_SEND_BATCH_SIZE];
+    uint8_t receive_decrypted[SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE];
+    struct snapshot_packet_crypto_t receive_crypto[SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE];
+    struct snapshot_crypto_aead_batch_item_t receive_crypto_items[SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE];
+    int receive_crypto_packet_index[SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE];
+#if SNAPSHOT_DEVELOPMENT
+    uint64_t development_flags;
+    int max_sim_receive_packets;
+    uint8_t ** sim_receive_packet_data;
+    int * sim_receive_packet_bytes;
+    struct snapshot_address_t * sim_receive_from;
+#endif // #if SNAPSHOT_DEVELOPMENT
+    uint64_t counters[SNAPSHOT_SERVER_NUM_COUNTERS];
 };
 
-void snapshot_connect_token_entries_reset( struct snapshot_connect_token_entry_t * connect_token_entries )
+static void snapshot_server_flush_packets( struct snapshot_server_t * server )
+{
+    snapshot_assert( server );
+
+    if ( server->send_queue_num_packets == 0 )
+        return;
+
+    snapshot_assert( server->socket );
+    snapshot_assert( !server->io_thread );
+
+    // packets were queued unencrypted. encrypt them all in one batch now, right before they go out
+
+    int num_items = 0;
+
+    for ( int i = 0; i < server->send_queue_num_packets; ++i )
+    {
+        if ( server->send_queue_encrypt[i] )
+        {
+            snapshot_assert( server->send_queue_crypto_items[i].message );
+            server->send_queue_crypto_items[num_items++] = server->send_queue_crypto_items[i];
+        }
+    }
+
+    if ( num_items > 0 )
+    {
+        snapshot_crypto_encrypt_aead_batch( server->send_queue_crypto_items, num_items );
+
+        for ( int i = 0; i < num_items; ++i )
+        {
+            snapshot_assert( server->send_queue_crypto_items[i].result == SNAPSHOT_OK );
+        }
+
+        server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_ENCRYPTED_BATCH] += num_items;
+    }
+
+    snapshot_platform_socket_send_packets( server->socket, server->send_queue_to, server->send_queue_packet_data, server->send_queue_packet_bytes, server->send_queue_num_packets );
+
+    server->send_queue_num_packets = 0;
+
+    server->counters[SNAPSHOT_SERVER_COUNTER_SEND_BATCHES]++;
+}
+
+static void snapshot_server_reserve_packets( struct snapshot_server_t * server, int num_packets )
+{
+    snapshot_assert( server );
+    snapshot_assert( num_packets >= 0 );
+    snapshot_assert( num_packets <= SNAPSHOT_SERVER_SEND_BATCH_SIZE );
+
+    // flush early if needed, so packets that belong together (fragments, disconnect packets) go out in the same batch
+
+    if ( server->send_queue_num_packets + num_packets > SNAPSHOT_SERVER_SEND_BATCH_SIZE )
+    {
+        snapshot_server_flush_packets( server );
+    }
+}
+
+static void snapshot_server_queue_packet( struct snapshot_server_t * server, const struct snapshot_address_t * to, const uint8_t * packet_data, int packet_bytes, const uint8_t * encrypt_key )
+{
+    snapshot_assert( server );
+    snapshot_assert( to );
+    snapshot_assert( packet_data );
+    snapshot_assert( packet_bytes > 0 );
+    snapshot_assert( packet_bytes <= SNAPSHOT_MAX_PACKET_BYTES );
+
+    if ( server->io_thread )
+    {
+        // the io thread batches sends on its side, so hand the packet straight to its queue
+
+        snapshot_assert( !encrypt_key );
+        snapshot_io_thread_send_packet( server->io_thread, to, packet_data, packet_bytes );
+        return;
+    }
+
+    snapshot_server_reserve_packets( server, 1 );
+
+    const int index = server->send_queue_num_packets++;
+
+    memcpy( server->send_queue_packet_data[index], packet_data, packet_bytes );
+    server->send_queue_packet_bytes[index] = packet_bytes;
+    server->send_queue_to[index] = *to;
+    server->send_queue_encrypt[index] = 0;
+
+    if ( encrypt_key )
+    {
+        // encrypted later, together with everything else in the queue, when it is flushed
+
+        int result = snapshot_packet_crypto_setup( server->send_queue_packet_data[index], packet_bytes, encrypt_key, server->config.protocol_id, 1, &server->send_queue_crypto[index], &server->send_queue_crypto_items[index] );
+        snapshot_assert( result == SNAPSHOT_OK );
+        (void) result;
+        server->send_queue_encrypt[index] = 1;
+    }
+}
+
+static SNAPSHOT_BOOL snapshot_server_batch_encrypt( struct snapshot_server_t * server )
+{
+    snapshot_assert( server );
+
+    // only packets that go through the send queue are batch encrypted. the io thread and network simulator take packets ready to send
+
+#if SNAPSHOT_DEVELOPMENT
+    if ( server->config.network_simulator )
+        return SNAPSHOT_FALSE;
+#endif // #if SNAPSHOT_DEVELOPMENT
+
+    return server->io_thread == NULL;
+}
+
+static void * snapshot_server_malloc( struct snapshot_server_t * server, size_t bytes )
+{
+    snapshot_assert( server );
+
+    void * p = snapshot_malloc( server->config.context, bytes );
+    if ( p )
+    {
+        memset( p, 0, bytes );
+        server->memory_bytes += bytes;
+    }
+    return p;
+}
+
+// memory sized from max clients is tracked on its own, so it can be reported per client slot apart from fixed overhead
+
+static void snapshot_server_add_client_memory( struct snapshot_server_t * server, size_t bytes )
+{
+    snapshot_assert( server );
+
+    server->memory_bytes += bytes;
+    server->client_memory_bytes += bytes;
+}
+
+static void * snapshot_server_malloc_client( struct snapshot_server_t * server, size_t bytes )
+{
+    void * p = snapshot_server_malloc( server, bytes );
+    if ( p )
+    {
+        server->client_memory_bytes += bytes;
+    }
+    return p;
+}
+
+static struct snapshot_replay_protection_t * snapshot_server_client_replay_protection( struct snapshot_server_t * server, int client_index )
+{
+    snapshot_assert( server );
+    snapshot_assert( client_index >= 0 );
+    snapshot_assert( client_index < server->max_clients );
+
+    // replay protection is packed at the size of the configured window, not the size of the struct
+
+    return (struct snapshot_replay_protection_t*) ( server->client_replay_protection + client_index * server->client_replay_protection_bytes );
+}
+
+static void snapshot_server_connect_disconnect_callback( struct snapshot_server_t * server, int client_index, int connected )
+{
+    snapshot_assert( server );
+
+    if ( !server->config.connect_disconnect_callback )
+        return;
+
+    // when this server is one shard of a sharded server, report the global client index and serialize callbacks across shards
+
+    if ( server->shard_parent )
+    {
+        snapshot_platform_mutex_acquire( &server->shard_parent->shard_callback_mutex );
+    }
+
+    server->config.connect_disconnect_callback( server->config.context, server->shard_client_index_offset + client_index, connected );
+
+    if ( server->shard_parent )
+    {
+        snapshot_platform_mutex_release( &server->shard_parent->shard_callback_mutex );
+    }
+}
+
+static struct snapshot_server_t * snapshot_server_create_internal( const char * server_address_string, const struct snapshot_server_config_t * config, double time, struct snapshot_server_t * shard_parent, int shard_client_index_offset )
+{  
+    snapshot_assert( config );
+
+    if ( config->max_clients <= 0 )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "server max clients must be at least one" );
+        return NULL;
+    }
+
+    if ( !snapshot_replay_protection_valid_window_bits( config->replay_protection_window_bits ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "server replay protection window bits must be 256, 1024 or 2048" );
+        return NULL;
+    }
+
+    if ( !snapshot_endpoint_valid_ack_bits( config->ack_bits ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "server ack bits must be 32, 64 or 128" );
+        return NULL;
+    }
+
+    if ( config->snapshot_bytes < 0 || ( config->snapshot_bytes % 4 ) != 0 || snapshot_delta_max_bytes( config->snapshot_bytes ) > SNAPSHOT_MAX_PAYLOAD_BYTES )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "server snapshot bytes must be a multiple of 4 and at most %d", SNAPSHOT_MAX_PAYLOAD_BYTES - 4 );
+        return NULL;
+    }
+
+    if ( config->snapshot_bytes > 0 && ( config->snapshot_history <= 0 || ( config->snapshot_history & ( config->snapshot_history - 1 ) ) != 0 ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "server snapshot history must be a power of two" );
+        return NULL;
+    }
+
+    if ( config->snapshot_range_coder < SNAPSHOT_RANGE_CODER_NONE || config->snapshot_range_coder > SNAPSHOT_RANGE_CODER_ADAPTIVE )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "server snapshot range coder must be none, static or adaptive" );
+        return NULL;
+    }
+
+    if ( config->snapshot_range_coder != SNAPSHOT_RANGE_CODER_NONE && snapshot_range_coder_max_bytes( snapshot_delta_max_bytes( config->snapshot_bytes ) ) > SNAPSHOT_MAX_PAYLOAD_BYTES )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "server snapshot bytes must be at most %d with the range coder", SNAPSHOT_MAX_PAYLOAD_BYTES - 4 );
+        return NULL;
+    }
+
+    struct snapshot_address_t server_address;
+    memset( &server_address, 0, sizeof( server_address ) );
+    if ( snapshot_address_parse( &server_address, server_address_string ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to parse server public address" );
+        return NULL;
+    }
+
+
+    struct snapshot_platform_socket_t * socket = NULL;
+
+    if ( !config->network_simulator )
+    {
+        struct snapshot_address_t bind_address;
+        memset( &bind_address, 0, sizeof(bind_address) );
+        bind_address.type = server_address.type;
+        bind_address.port = server_address.port;
+
+        // with an io thread the socket blocks on receive, so the io thread sleeps in the kernel until packets arrive
+
+        int socket_type = config->io_thread ? SNAPSHOT_PLATFORM_SOCKET_BLOCKING : SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING;
+        if ( config->reuse_port )
+        {
+            socket_type |= SNAPSHOT_PLATFORM_SOCKET_REUSE_PORT;
+        }
+
+        const float timeout_seconds = config->io_thread ? SNAPSHOT_IO_THREAD_RECEIVE_TIMEOUT : 0.0f;
+
+        socket = snapshot_platform_socket_create( config->context, &bind_address, socket_type, timeout_seconds, SNAPSHOT_SERVER_SOCKET_SNDBUF_SIZE, SNAPSHOT_SERVER_SOCKET_RCVBUF_SIZE );
+
+        if ( socket == NULL )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server socket" );
+            return NULL;
+        }
+
+        if ( config->enable_gso && !snapshot_platform_socket_enable_gso( socket ) )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "udp gso not available. sending packets individually" );
+        }
+
+        if ( config->enable_gro && !snapshot_platform_socket_enable_gro( socket ) )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "udp gro not available. receiving packets individually" );
+        }
+
+        server_address.port = bind_address.port;
+    }
+    else
+    {
+        if ( server_address.port == 0 )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "must bind to a specific port when using network simulator" );
+            return NULL;
+        }
+    }
+
+    struct snapshot_server_t * server = (struct snapshot_server_t*) snapshot_malloc( config->context, sizeof( struct snapshot_server_t ) );
+    if ( !server )
+    {
+        if ( socket )
+        {
+            snapshot_platform_socket_destroy( socket );
+        }
+        return NULL;
+    }
+
+    memset( server, 0, sizeof(struct snapshot_server_t) );
+
+#if SNAPSHOT_DEVELOPMENT
+    if ( config->network_simulator )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server listening on %s with %d client slots (network simulator)", server_address_string, config->max_clients );
+    }
+    else
+#endif // #if SNAPSHOT_DEVELOPMENT
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server listening on %s with %d client slots", server_address_string, config->max_clients );
+    }
+
+    server->config = *config;
+
+    server->counters[SNAPSHOT_SERVER_COUNTER_CRYPTO_ISA] = (uint64_t) snapshot_crypto_isa();
+    server->socket = socket;
+    server->address = server_address;
+    server->time = time;
+    server->global_sequence = 1ULL << 63;
+
+    server->max_clients = config->max_clients;
+    server->memory_bytes = sizeof( struct snapshot_server_t );
+    server->num_shards = 1;
+    server->shard_parent = shard_parent;
+    server->shard_client_index_offset = shard_client_index_offset;
+    server->shard_max_clients = shard_parent ? shard_parent->max_clients : config->max_clients;
+
+    // per-client state is sized from config.max_clients, so small servers don't pay for the largest configuration
+
+    const int max_clients = config->max_clients;
+
+    server->num_client_address_index_slots = 1;
+    while ( server->num_client_address_index_slots < max_clients * 2 )
+    {
+        server->num_client_address_index_slots *= 2;
+    }
+
+    server->client_connected = (int*) snapshot_server_malloc_client( server, max_clients * sizeof(int) );
+    server->client_timeout = (int*) snapshot_server_malloc_client( server, max_clients * sizeof(int) );
+    server->client_loopback = (int*) snapshot_server_malloc_client( server, max_clients * sizeof(int) );
+    server->client_confirmed = (int*) snapshot_server_malloc_client( server, max_clients * sizeof(int) );
+    server->client_encryption_index = (int*) snapshot_server_malloc_client( server, max_clients * sizeof(int) );
+    server->client_id = (uint64_t*) snapshot_server_malloc_client( server, max_clients * sizeof(uint64_t) );
+    server->client_sequence = (uint64_t*) snapshot_server_malloc_client( server, max_clients * sizeof(uint64_t) );
+    server->client_last_internal_packet_send_time = (double*) snapshot_server_malloc_client( server, max_clients * sizeof(double) );
+    server->client_last_packet_receive_time = (double*) snapshot_server_malloc_client( server, max_clients * sizeof(double) );
+    server->client_user_data = (uint8_t(*)[SNAPSHOT_USER_DATA_BYTES]) snapshot_server_malloc_client( server, max_clients * SNAPSHOT_USER_DATA_BYTES );
+    server->client_replay_protection_bytes = (int) snapshot_replay_protection_bytes( config->replay_protection_window_bits );
+    server->client_replay_protection = (uint8_t*) snapshot_server_malloc_client( server, max_clients * server->client_replay_protection_bytes );
+    server->client_endpoint = (struct snapshot_endpoint_t**) snapshot_server_malloc_client( server, max_clients * sizeof(struct snapshot_endpoint_t*) );
+    server->client_address = (struct snapshot_address_t*) snapshot_server_malloc_client( server, max_clients * sizeof(struct snapshot_address_t) );
+    server->client_address_index_slots = (int*) snapshot_server_malloc_client( server, server->num_client_address_index_slots * sizeof(int) );
+
+    if ( !server->client_connected || 
+         !server->client_timeout || 
+         !server->client_loopback || 
+         !server->client_confirmed || 
+         !server->client_encryption_index || 
+         !server->client_id || 
+         !server->client_sequence || 
+         !server->client_last_internal_packet_send_time || 
+         !server->client_last_packet_receive_time || 
+         !server->client_user_data || 
+         !server->client_replay_protection || 
+         !server->client_endpoint || 
+         !server->client_address || 
+         !server->client_address_index_slots )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to allocate server client slots" );
+        snapshot_server_destroy( server );
+        return NULL;
+    }
+
+    server->encryption_manager = snapshot_encryption_manager_create( config->context, max_clients * SNAPSHOT_ENCRYPTION_MAPPINGS_PER_CLIENT );
+    if ( !server->encryption_manager )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server encryption manager" );
+        snapshot_server_destroy( server );
+        return NULL;
+    }
+
+    snapshot_server_add_client_memory( server, snapshot_encryption_manager_memory_bytes( server->encryption_manager ) );
+
+    if ( shard_parent )
+    {
+        server->connect_token_table = shard_parent->connect_token_table;
+    }
+    else
+    {
+        const int max_connect_token_entries = ( config->max_connect_token_entries > 0 ) ? config->max_connect_token_entries : max_clients * SNAPSHOT_CONNECT_TOKEN_ENTRIES_PER_CLIENT;
+
+        server->connect_token_table = snapshot_connect_token_table_create( config->context, max_connect_token_entries );
+        if ( !server->connect_token_table )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server connect token table" );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+
+        if ( config->max_connect_token_entries > 0 )
+        {
+            server->memory_bytes += snapshot_connect_token_table_memory_bytes( server->connect_token_table );
+        }
+        else
+        {
+            snapshot_server_add_client_memory( server, snapshot_connect_token_table_memory_bytes( server->connect_token_table ) );
+        }
+    }
+
+    if ( config->rate_limit_packets_per_second > 0 )
+    {
+        const int burst = ( config->rate_limit_burst > 0 ) ? config->rate_limit_burst : 1;
+
+        server->rate_limiter = snapshot_rate_limiter_create( config->context, SNAPSHOT_SERVER_RATE_LIMIT_ENTRIES, config->rate_limit_packets_per_second, burst );
+        if ( !server->rate_limiter )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server rate limiter" );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+
+        server->memory_bytes += snapshot_rate_limiter_memory_bytes( server->rate_limiter );
+    }
+
+    if ( config->io_thread && socket )
+    {
+        server->io_thread = snapshot_io_thread_create( config->context, socket, SNAPSHOT_SERVER_IO_THREAD_QUEUE_SIZE );
+        if ( !server->io_thread )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server io thread" );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+
+        server->memory_bytes += snapshot_io_thread_memory_bytes( server->io_thread );
+    }
+
+#if SNAPSHOT_DEVELOPMENT
+    if ( config->network_simulator )
+    {
+        server->max_sim_receive_packets = max_clients * SNAPSHOT_SERVER_SIM_RECEIVE_PACKETS_PER_CLIENT;
+        server->sim_receive_packet_data = (uint8_t**) snapshot_server_malloc_client( server, server->max_sim_receive_packets * sizeof(uint8_t*) );
+        server->sim_receive_packet_bytes = (int*) snapshot_server_malloc_client( server, server->max_sim_receive_packets * sizeof(int) );
+        server->sim_receive_from = (struct snapshot_address_t*) snapshot_server_malloc_client( server, server->max_sim_receive_packets * sizeof(struct snapshot_address_t) );
+        if ( !server->sim_receive_packet_data || !server->sim_receive_packet_bytes || !server->sim_receive_from )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to allocate server network simulator buffers" );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+    }
+#endif // #if SNAPSHOT_DEVELOPMENT
+
+    snapshot_address_index_init( &server->client_address_index, server->client_address_index_slots, server->num_client_address_index_slots, server->client_address );
+
+    for ( int i = 0; i < max_clients; ++i )
+    {
+        server->client_encryption_index[i] = -1;
+    }
+
+    for ( int i = 0; i < max_clients; ++i )
+    {
+        snapshot_replay_protection_init( snapshot_server_client_replay_protection( server, i ), config->replay_protection_window_bits );
+    }
+
+    snapshot_replay_protection_init( (struct snapshot_replay_protection_t*) server->challenge_replay_protection, SNAPSHOT_SERVER_CHALLENGE_WINDOW_BITS );
+
+    for ( int i = 0; i < SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE; ++i )
+    {
+        server->receive_packet_data[i] = server->receive_buffer[i] + SNAPSHOT_PACKET_PREFIX_BYTES;
+    }
+
+    for ( int i = 0; i < SNAPSHOT_SERVER_SEND_BATCH_SIZE; ++i )
+    {
+        server->send_queue_packet_data[i] = server->send_queue_buffer[i];
+    }
+
+    server->allowed_packets[SNAPSHOT_CONNECTION_REQUEST_PACKET] = 1;
+    server->allowed_packets[SNAPSHOT_CONNECTION_RESPONSE_PACKET] = 1;
+    server->allowed_packets[SNAPSHOT_KEEP_ALIVE_PACKET] = 1;
+    server->allowed_packets[SNAPSHOT_PAYLOAD_PACKET] = 1;
+    server->allowed_packets[SNAPSHOT_PASSTHROUGH_PACKET] = 1;
+    server->allowed_packets[SNAPSHOT_DISCONNECT_PACKET] = 1;
+
+    if ( config->packet_pool )
+    {
+        server->packet_pool = snapshot_packet_pool_create( config->context );
+        if ( !server->packet_pool )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server packet pool" );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+    }
+
+    for ( int i = 0; i < max_clients; i++ )
+    {
+        struct snapshot_endpoint_config_t endpoint_config;
+        snapshot_endpoint_default_config( &endpoint_config );
+        snprintf( endpoint_config.name, sizeof(endpoint_config.name), "server[%d]", i );
+        endpoint_config.context = config->context;
+        endpoint_config.packet_pool = server->packet_pool;
+        endpoint_config.ack_bits = config->ack_bits;
+        
+        server->client_endpoint[i] = snapshot_endpoint_create( &endpoint_config, time );
+
+        if ( !server->client_endpoint[i] )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create client endpoint #%d", i );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+
+        snapshot_server_add_client_memory( server, snapshot_endpoint_memory_bytes( server->client_endpoint[i] ) );
+    }
+
+    if ( config->snapshot_bytes > 0 )
+    {
+        server->snapshot_data = (uint8_t*) snapshot_server_malloc( server, config->snapshot_bytes );
+        server->client_delta_encoder = (struct snapshot_delta_encoder_t**) snapshot_server_malloc_client( server, max_clients * sizeof(struct snapshot_delta_encoder_t*) );
+        if ( !server->snapshot_data || !server->client_delta_encoder )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to allocate server snapshot" );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+
+        for ( int i = 0; i < max_clients; i++ )
+        {
+            server->client_delta_encoder[i] = snapshot_delta_encoder_create( config->context, config->snapshot_bytes, config->snapshot_history );
+            if ( !server->client_delta_encoder[i] )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create client delta encoder #%d", i );
+                snapshot_server_destroy( server );
+                return NULL;
+            }
+
+            snapshot_server_add_client_memory( server, snapshot_delta_encoder_memory_bytes( server->client_delta_encoder[i] ) );
+        }
+    }
+
+    if ( config->snapshot_bytes > 0 && config->snapshot_range_coder != SNAPSHOT_RANGE_CODER_NONE )
+    {
+        server->client_range_encoder = (struct snapshot_range_encoder_t**) snapshot_server_malloc_client( server, max_clients * sizeof(struct snapshot_range_encoder_t*) );
+        if ( !server->client_range_encoder )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to allocate server range encoders" );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+
+        for ( int i = 0; i < max_clients; i++ )
+        {
+            server->client_range_encoder[i] = snapshot_range_encoder_create( config->context, snapshot_delta_max_bytes( config->snapshot_bytes ), config->snapshot_range_coder, config->snapshot_range_model, config->snapshot_history );
+            if ( !server->client_range_encoder[i] )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create client range encoder #%d", i );
+                snapshot_server_destroy( server );
+                return NULL;
+            }
+
+            snapshot_server_add_client_memory( server, snapshot_range_encoder_memory_bytes( server->client_range_encoder[i] ) );
+        }
+    }
+
+    snapshot_crypto_random_bytes( server->challenge_key, SNAPSHOT_KEY_BYTES );
+
+    // with handshake threads, connect token and challenge token crypto runs off the server thread
+
+    if ( config->handshake_threads > 0 )
+    {
+        server->handshake_pool = snapshot_handshake_pool_create( config->context, 
+                                                                 config->handshake_threads, 
+                                                                 SNAPSHOT_SERVER_HANDSHAKE_QUEUE_SIZE, 
+                                                                 config->protocol_id, 
+                                                                 config->private_key, 
+                                                                 server->challenge_key );
+        if ( !server->handshake_pool )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server handshake pool" );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+
+        server->memory_bytes += snapshot_handshake_pool_memory_bytes( server->handshake_pool );
+    }
+
+    snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server allocated %.1fKB (%.1fKB fixed, %.1fKB per client slot)", server->memory_bytes / 1024.0, snapshot_server_memory_bytes_fixed( server ) / 1024.0, snapshot_server_memory_bytes_per_client( server ) / 1024.0 );
+
+    server->num_connected_clients = 0;
+    server->challenge_sequence = 0;    
+
+    if ( server_address.type == SNAPSHOT_ADDRESS_IPV4 && server_address.data.ipv4[0] == 0 && server_address.data.ipv4[1] == 0 && server_address.data.ipv4[2] == 0 && server_address.data.ipv4[3] == 0 )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server allowing any address to connect (ipv4)" );
+        server->allow_any_address = SNAPSHOT_TRUE;
+    }
+
+    if ( server_address.type == SNAPSHOT_ADDRESS_IPV6 )
+    {
+        uint8_t zero[16];
+        memset( zero, 0, sizeof(zero) );
+        if ( memcmp( server_address.data.ipv6, zero, 16 ) == 0 )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server allowing any address to connect (ipv6)" );
+            server->allow_any_address = SNAPSHOT_TRUE;
+        }
+    }
+
+    return server;
+}
+
+// shard threads sleep on their condition until snapshot_server_update bumps the update generation, update their shard once, then count themselves done
+
+static void snapshot_server_shard_thread( void * arg )
+{
+    struct snapshot_server_shard_t * shard = (struct snapshot_server_shard_t*) arg;
+
+    snapshot_assert( shard );
+    snapshot_assert( shard->parent );
+    snapshot_assert( shard->server );
+
+    struct snapshot_server_t * parent = shard->parent;
+
+    snapshot_platform_mutex_acquire( &parent->shard_update_mutex );
+
+    while ( 1 )
+    {
+        while ( !parent->shards_quit && shard->update_generation == parent->shard_update_generation )
+        {
+            snapshot_platform_condition_wait( &shard->update_condition, &parent->shard_update_mutex );
+        }
+
+        if ( parent->shards_quit )
+            break;
+
+        shard->update_generation = parent->shard_update_generation;
+
+        const double time = parent->shard_update_time;
+
+        snapshot_platform_mutex_release( &parent->shard_update_mutex );
+
+        snapshot_server_update( shard->server, time );
+
+        snapshot_platform_mutex_acquire( &parent->shard_update_mutex );
+
+        snapshot_assert( parent->shards_updating > 0 );
+
+        parent->shards_updating--;
+
+        if ( parent->shards_updating == 0 )
+        {
+            snapshot_platform_condition_signal( &parent->shard_update_condition );
+        }
+    }
+
+    snapshot_platform_mutex_release( &parent->shard_update_mutex );
+}
+
+static struct snapshot_server_t * snapshot_server_create_sharded( const char * server_address_string, const struct snapshot_server_config_t * config, double time )
+{
+    snapshot_assert( config );
+
+    const int num_shards = config->num_shards;
+    const int max_clients = config->max_clients;
+
+    if ( max_clients < num_shards )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "sharded server needs at least one client slot per shard" );
+        return NULL;
+    }
+
+    if ( config->network_simulator )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "sharded server can't use the network simulator" );
+        return NULL;
+    }
+
+    struct snapshot_address_t server_address;
+    memset( &server_address, 0, sizeof( server_address ) );
+    if ( snapshot_address_parse( &server_address, server_address_string ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to parse server public address" );
+        return NULL;
+    }
+
+    struct snapshot_server_t * server = (struct snapshot_server_t*) snapshot_malloc( config->context, sizeof( struct snapshot_server_t ) );
+    if ( !server )
+        return NULL;
+
+    memset( server, 0, sizeof(struct snapshot_server_t) );
+
+    server->config = *config;
+    server->counters[SNAPSHOT_SERVER_COUNTER_CRYPTO_ISA] = (uint64_t) snapshot_crypto_isa();
+    server->time = time;
+    server->max_clients = max_clients;
+    server->shard_max_clients = max_clients;
+    server->num_shards = num_shards;
+    server->memory_bytes = sizeof( struct snapshot_server_t );
+
+    server->shards = (struct snapshot_server_shard_t*) snapshot_server_malloc( server, num_shards * sizeof(struct snapshot_server_shard_t) );
+    if ( !server->shards )
+    {
+        snapshot_server_destroy( server );
+        return NULL;
+    }
+
+    memset( server->shards, 0, num_shards * sizeof(struct snapshot_server_shard_t) );
+
+    if ( snapshot_platform_mutex_create( &server->shard_callback_mutex ) != SNAPSHOT_OK ||
+         snapshot_platform_mutex_create( &server->shard_connect_token_mutex ) != SNAPSHOT_OK ||
+         snapshot_platform_mutex_create( &server->shard_client_id_mutex ) != SNAPSHOT_OK ||
+         snapshot_platform_mutex_create( &server->shard_update_mutex ) != SNAPSHOT_OK ||
+         snapshot_platform_condition_create( &server->shard_update_condition ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create sharded server mutexes" );
+        snapshot_server_destroy( server );
+        return NULL;
+    }
+
+    const int max_connect_token_entries = ( config->max_connect_token_entries > 0 ) ? config->max_connect_token_entries : max_clients * SNAPSHOT_CONNECT_TOKEN_ENTRIES_PER_CLIENT;
+
+    server->connect_token_table = snapshot_connect_token_table_create( config->context, max_connect_token_entries );
+    if ( !server->connect_token_table )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server connect token table" );
+        snapshot_server_destroy( server );
+        return NULL;
+    }
+
+    if ( config->max_connect_token_entries > 0 )
+    {
+        server->memory_bytes += snapshot_connect_token_table_memory_bytes( server->connect_token_table );
+    }
+    else
+    {
+        snapshot_server_add_client_memory( server, snapshot_connect_token_table_memory_bytes( server->connect_token_table ) );
+    }
+
+    // split client slots as evenly as possible. the first shards take one extra slot when it doesn't divide exactly.
+    // if the caller asked for any port, every shard after the first binds to the port the first shard got
+
+    int client_index_offset = 0;
+
+    for ( int i = 0; i < num_shards; i++ )
+    {
+        struct snapshot_server_shard_t * shard = &server->shards[i];
+
+        shard->parent = server;
+
+        if ( snapshot_platform_condition_create( &shard->update_condition ) != SNAPSHOT_OK )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create condition for server shard %d", i );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+
+        struct snapshot_server_config_t shard_config = *config;
+        shard_config.num_shards = 1;
+        shard_config.max_clients = max_clients / num_shards + ( ( i < max_clients % num_shards ) ? 1 : 0 );
+        shard_config.reuse_port = SNAPSHOT_TRUE;
+
+        char shard_address_string[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
+        snapshot_address_to_string( &server_address, shard_address_string );
+
+        shard->server = snapshot_server_create_internal( shard_address_string, &shard_config, time, server, client_index_offset );
+        if ( !shard->server )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server shard %d", i );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+
+        client_index_offset += shard_config.max_clients;
+
+        server_address.port = snapshot_server_port( shard->server );
+    }
+
+    snapshot_assert( client_index_offset == max_clients );
+
+    server->address = server_address;
+
+    for ( int i = 0; i < num_shards; i++ )
+    {
+        struct snapshot_server_shard_t * shard = &server->shards[i];
+
+        shard->thread = snapshot_platform_thread_create( config->context, snapshot_server_shard_thread, shard );
+        if ( !shard->thread )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create thread for server shard %d", i );
+            snapshot_server_destroy( server );
+            return NULL;
+        }
+    }
+
+    snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server running %d shards on port %d", num_shards, server_address.port );
+
+    return server;
+}
+
+struct snapshot_server_t * snapshot_server_create( const char * server_address_string, const struct snapshot_server_config_t * config, double time )
 {
-    int i;
-    for ( i = 0; i < SNAPSHOT_MAX_CONNECT_TOKEN_ENTRIES; ++i )
+    snapshot_assert( config );
+
+    if ( config->num_shards < 1 || config->num_shards > SNAPSHOT_SERVER_MAX_SHARDS )
     {
-        connect_token_entries[i].time = -1000.0;
-        memset( connect_token_entries[i].mac, 0, SNAPSHOT_MAC_BYTES );
-        memset( &connect_token_entries[i].address, 0, sizeof( struct snapshot_address_t ) );
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "server must have between 1 and %d shards", SNAPSHOT_SERVER_MAX_SHARDS );
+        return NULL;
     }
+
+    if ( config->num_shards > 1 )
+        return snapshot_server_create_sharded( server_address_string, config, time );
+
+    return snapshot_server_create_internal( server_address_string, config, time, NULL, 0 );
 }
 
-int snapshot_connect_token_entries_find_or_add( struct snapshot_connect_token_entry_t * connect_token_entries, 
-                                                const struct snapshot_address_t * address, 
-                                                uint8_t * mac, 
-                                                double time )
+static void snapshot_server_destroy_sharded( struct snapshot_server_t * server )
 {
-    snapshot_assert( connect_token_entries );
-    snapshot_assert( address );
-    snapshot_assert( mac );
-
-    // find the matching entry for the token mac and the oldest token entry. constant time worst case. This is intentional!
+    snapshot_assert( server );
+    snapshot_assert( server->num_shards > 1 );
 
-    int matching_token_index = -1;
-    int oldest_token_index = -1;
-    double oldest_token_time = 0.0;
+    void * context = server->config.context;
 
-    int i;
-    for ( i = 0; i < SNAPSHOT_MAX_CONNECT_TOKEN_ENTRIES; ++i )
+    if ( server->shards )
     {
-        if ( memcmp( mac, connect_token_entries[i].mac, SNAPSHOT_MAC_BYTES ) == 0 )
-            matching_token_index = i;
-        
-        if ( oldest_token_index == -1 || connect_token_entries[i].time < oldest_token_time )
+        if ( server->shards[0].thread )
         {
-            oldest_token_time = connect_token_entries[i].time;
-            oldest_token_index = i;
+            snapshot_platform_mutex_guard( &server->shard_update_mutex );
+
+            server->shards_quit = SNAPSHOT_TRUE;
+
+            for ( int i = 0; i < server->num_shards; i++ )
+            {
+                snapshot_platform_condition_signal( &server->shards[i].update_condition );
+            }
         }
-    }
 
-    // if no entry is found with the mac, this is a new connect token. replace the oldest token entry.
+        for ( int i = 0; i < server->num_shards; i++ )
+        {
+            struct snapshot_server_shard_t * shard = &server->shards[i];
+
+            if ( shard->thread )
+            {
+                snapshot_platform_thread_join( shard->thread );
+                snapshot_platform_thread_destroy( shard->thread );
+            }
+
+            if ( shard->server )
+            {
+                snapshot_server_destroy( shard->server );
+            }
 
-    snapshot_assert( oldest_token_index != -1 );
+            snapshot_platform_condition_destroy( &shard->update_condition );
+        }
 
-    if ( matching_token_index == -1 )
-    {
-        connect_token_entries[oldest_token_index].time = time;
-        connect_token_entries[oldest_token_index].address = *address;
-        memcpy( connect_token_entries[oldest_token_index].mac, mac, SNAPSHOT_MAC_BYTES );
-        return 1;
+        snapshot_free( context, server->shards );
     }
 
-    // allow connect tokens we have already seen from the same address
+    if ( server->connect_token_table )
+    {
+        snapshot_connect_token_table_destroy( server->connect_token_table );
+    }
 
-    snapshot_assert( matching_token_index >= 0 );
-    snapshot_assert( matching_token_index < SNAPSHOT_MAX_CONNECT_TOKEN_ENTRIES );
-    if ( snapshot_address_equal( &connect_token_entries[matching_token_index].address, address ) )
-        return 1;
+    snapshot_platform_condition_destroy( &server->shard_update_condition );
+    snapshot_platform_mutex_destroy( &server->shard_update_mutex );
+    snapshot_platform_mutex_destroy( &server->shard_connect_token_mutex );
+    snapshot_platform_mutex_destroy( &server->shard_client_id_mutex );
+    snapshot_platform_mutex_destroy( &server->shard_callback_mutex );
 
-    return 0;
+    snapshot_free( context, server );
 }
 
-// ------------------------------------------------------------------------------------------
+// on a sharded server client indices are global. this finds the shard that owns a client index and converts the index to that shard.
+// on an unsharded server it returns the server and leaves the index alone. an index outside the server returns NULL
 
-struct snapshot_server_t
+static struct snapshot_server_t * snapshot_server_find_shard( struct snapshot_server_t * server, int * client_index )
 {
-    struct snapshot_server_config_t config;
-    struct snapshot_platform_socket_t * socket;
-    struct snapshot_address_t address;
-    SNAPSHOT_BOOL allow_any_address;
-    uint64_t flags;
-    double time;
-    int max_clients;
-    int num_connected_clients;
-    uint64_t global_sequence;
-    uint64_t challenge_sequence;
-    uint8_t allowed_packets[SNAPSHOT_NUM_PACKETS];
-    uint8_t challenge_key[SNAPSHOT_KEY_BYTES];
-    int client_connected[SNAPSHOT_MAX_CLIENTS];
-    int client_timeout[SNAPSHOT_MAX_CLIENTS];
-    int client_loopback[SNAPSHOT_MAX_CLIENTS];
-    int client_confirmed[SNAPSHOT_MAX_CLIENTS];
-    int client_encryption_index[SNAPSHOT_MAX_CLIENTS];
-    uint64_t client_id[SNAPSHOT_MAX_CLIENTS];
-    uint64_t client_sequence[SNAPSHOT_MAX_CLIENTS];
-    double client_last_internal_packet_send_time[SNAPSHOT_MAX_CLIENTS];
-    double client_last_packet_receive_time[SNAPSHOT_MAX_CLIENTS];
-    uint8_t client_user_data[SNAPSHOT_MAX_CLIENTS][SNAPSHOT_USER_DATA_BYTES];
-    struct snapshot_replay_protection_t client_replay_protection[SNAPSHOT_MAX_CLIENTS];
-    struct snapshot_endpoint_t * client_endpoint[SNAPSHOT_MAX_CLIENTS];
-    struct snapshot_address_t client_address[SNAPSHOT_MAX_CLIENTS];
-    struct snapshot_connect_token_entry_t connect_token_entries[SNAPSHOT_MAX_CONNECT_TOKEN_ENTRIES];
-    struct snapshot_encryption_manager_t encryption_manager;
-#if SNAPSHOT_DEVELOPMENT
-    uint64_t development_flags;
-    uint8_t * sim_receive_packet_data[SNAPSHOT_SERVER_MAX_SIM_RECEIVE_PACKETS];
-    int sim_receive_packet_bytes[SNAPSHOT_SERVER_MAX_SIM_RECEIVE_PACKETS];
-    struct snapshot_address_t sim_receive_from[SNAPSHOT_SERVER_MAX_SIM_RECEIVE_PACKETS];
-#endif // #if SNAPSHOT_DEVELOPMENT
-    uint64_t counters[SNAPSHOT_SERVER_NUM_COUNTERS];
-};
+    snapshot_assert( server );
+    snapshot_assert( client_index );
 
-struct snapshot_server_t * snapshot_server_create( const char * server_address_string, const struct snapshot_server_config_t * config, double time )
-{  
-    snapshot_assert( config );
+    if ( !server->shards )
+        return server;
 
-    struct snapshot_address_t server_address;
-    memset( &server_address, 0, sizeof( server_address ) );
-    if ( snapshot_address_parse( &server_address, server_address_string ) != SNAPSHOT_OK )
-    {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to parse server public address" );
+    snapshot_assert( *client_index >= 0 );
+    snapshot_assert( *client_index < server->max_clients );
+
+    if ( *client_index < 0 )
         return NULL;
+
+    for ( int i = 0; i < server->num_shards; i++ )
+    {
+        struct snapshot_server_t * shard_server = server->shards[i].server;
+        if ( *client_index < shard_server->shard_client_index_offset + shard_server->max_clients )
+        {
+            *client_index -= shard_server->shard_client_index_offset;
+            return shard_server;
+        }
     }
 
+    return NULL;
+}
 
-    struct snapshot_platform_socket_t * socket = NULL;
+// shards connect clients in parallel, so a client id must be checked against every shard, not just the one the request landed on.
+// client connected and client id are only written under the parent's client id lock, which lets other shards read them mid update
 
-    if ( !config->network_simulator )
+static void snapshot_server_lock_client_ids( struct snapshot_server_t * server )
+{
+    if ( server->shard_parent )
     {
-        struct snapshot_address_t bind_address;
-        memset( &bind_address, 0, sizeof(bind_address) );
-        bind_address.type = server_address.type;
-        bind_address.port = server_address.port;
+        snapshot_platform_mutex_acquire( &server->shard_parent->shard_client_id_mutex );
+    }
+}
 
-        socket = snapshot_platform_socket_create( config->context, &bind_address, SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING, 0.0f, SNAPSHOT_SERVER_SOCKET_SNDBUF_SIZE, SNAPSHOT_SERVER_SOCKET_RCVBUF_SIZE );
+static void snapshot_server_unlock_client_ids( struct snapshot_server_t * server )
+{
+    if ( server->shard_parent )
+    {
+        snapshot_platform_mutex_release( &server->shard_parent->shard_client_id_mutex );
+    }
+}
 
-        if ( socket == NULL )
-        {
-            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create server socket" );
-            return NULL;
-        }
+static SNAPSHOT_BOOL snapshot_server_client_id_connected_locked( struct snapshot_server_t * server, uint64_t client_id )
+{
+    snapshot_assert( server );
 
-        server_address.port = bind_address.port;
-    }
-    else
+    if ( server->shard_parent )
     {
-        if ( server_address.port == 0 )
+        struct snapshot_server_t * parent = server->shard_parent;
+        for ( int i = 0; i < parent->num_shards; i++ )
         {
-            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "must bind to a specific port when using network simulator" );
-            return NULL;
+            struct snapshot_server_t * shard_server = parent->shards[i].server;
+            for ( int j = 0; j < shard_server->max_clients; j++ )
+            {
+                if ( shard_server->client_connected[j] && shard_server->client_id[j] == client_id )
+                    return SNAPSHOT_TRUE;
+            }
         }
+        return SNAPSHOT_FALSE;
     }
 
-    struct snapshot_server_t * server = (struct snapshot_server_t*) snapshot_malloc( config->context, sizeof( struct snapshot_server_t ) );
-    if ( !server )
+    for ( int i = 0; i < server->max_clients; i++ )
     {
-        if ( socket )
-        {
-            snapshot_platform_socket_destroy( socket );
-        }
-        return NULL;
+        if ( server->client_connected[i] && server->client_id[i] == client_id )
+            return SNAPSHOT_TRUE;
     }
 
-    memset( server, 0, sizeof(struct snapshot_server_t) );
+    return SNAPSHOT_FALSE;
+}
 
-#if SNAPSHOT_DEVELOPMENT
-    if ( config->network_simulator )
-    {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server listening on %s with %d client slots (network simulator)", server_address_string, config->max_clients );
-    }
-    else
-#endif // #if SNAPSHOT_DEVELOPMENT
-    {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server listening on %s with %d client slots", server_address_string, config->max_clients );
-    }
+static SNAPSHOT_BOOL snapshot_server_client_id_connected( struct snapshot_server_t * server, uint64_t client_id )
+{
+    snapshot_server_lock_client_ids( server );
+    const SNAPSHOT_BOOL connected = snapshot_server_client_id_connected_locked( server, client_id );
+    snapshot_server_unlock_client_ids( server );
+    return connected;
+}
 
-    server->config = *config;
-    server->socket = socket;
-    server->address = server_address;
-    server->time = time;
-    server->global_sequence = 1ULL << 63;
+// checking the client id and taking the slot happen under one lock, so two shards can't both pass the check for the same id
+
+static SNAPSHOT_BOOL snapshot_server_claim_client_slot( struct snapshot_server_t * server, int client_index, uint64_t client_id )
+{
+    snapshot_assert( server );
+    snapshot_assert( client_index >= 0 );
+    snapshot_assert( client_index < server->max_clients );
+    snapshot_assert( !server->client_connected[client_index] );
 
-    memset( server->client_connected, 0, sizeof( server->client_connected ) );
-    memset( server->client_loopback, 0, sizeof( server->client_loopback ) );
-    memset( server->client_confirmed, 0, sizeof( server->client_confirmed ) );
-    memset( server->client_id, 0, sizeof( server->client_id ) );
-    memset( server->client_sequence, 0, sizeof( server->client_sequence ) );
-    memset( server->client_last_internal_packet_send_time, 0, sizeof( server->client_last_internal_packet_send_time ) );
-    memset( server->client_last_packet_receive_time, 0, sizeof( server->client_last_packet_receive_time ) );
-    memset( server->client_address, 0, sizeof( server->client_address ) );
-    memset( server->client_user_data, 0, sizeof( server->client_user_data ) );
+    snapshot_server_lock_client_ids( server );
 
-    for ( int i = 0; i < SNAPSHOT_MAX_CLIENTS; ++i )
+    const SNAPSHOT_BOOL claimed = !snapshot_server_client_id_connected_locked( server, client_id );
+    if ( claimed )
     {
-        server->client_encryption_index[i] = -1;
+        server->client_connected[client_index] = 1;
+        server->client_id[client_index] = client_id;
     }
 
-    snapshot_connect_token_entries_reset( server->connect_token_entries );
+    snapshot_server_unlock_client_ids( server );
+
+    return claimed;
+}
+
+static void snapshot_server_release_client_slot( struct snapshot_server_t * server, int client_index )
+{
+    snapshot_assert( server );
+    snapshot_assert( client_index >= 0 );
+    snapshot_assert( client_index < server->max_clients );
+
+    snapshot_server_lock_client_ids( server );
+
+    server->client_connected[client_index] = 0;
+    server->client_id[client_index] = 0;
+
+    snapshot_server_unlock_client_ids( server );
+}
+
+static void snapshot_server_update_shards( struct snapshot_server_t * server, double time )
+{
+    snapshot_assert( server );
+    snapshot_assert( server->shards );
 
-    snapshot_encryption_manager_reset( &server->encryption_manager );
+    snapshot_platform_mutex_guard( &server->shard_update_mutex );
 
-    for ( int i = 0; i < SNAPSHOT_MAX_CLIENTS; ++i )
+    server->time = time;
+    server->shard_update_time = time;
+    server->shard_update_generation++;
+    server->shards_updating = server->num_shards;
+
+    for ( int i = 0; i < server->num_shards; i++ )
     {
-        snapshot_replay_protection_reset( &server->client_replay_protection[i] );
+        snapshot_platform_condition_signal( &server->shards[i].update_condition );
     }
 
-    server->allowed_packets[SNAPSHOT_CONNECTION_REQUEST_PACKET] = 1;
-    server->allowed_packets[SNAPSHOT_CONNECTION_RESPONSE_PACKET] = 1;
-    server->allowed_packets[SNAPSHOT_KEEP_ALIVE_PACKET] = 1;
-    server->allowed_packets[SNAPSHOT_PAYLOAD_PACKET] = 1;
-    server->allowed_packets[SNAPSHOT_PASSTHROUGH_PACKET] = 1;
-    server->allowed_packets[SNAPSHOT_DISCONNECT_PACKET] = 1;
+    while ( server->shards_updating > 0 )
+    {
+        snapshot_platform_condition_wait( &server->shard_update_condition, &server->shard_update_mutex );
+    }
+}
+
+void snapshot_server_destroy( struct snapshot_server_t * server )
+{
+    snapshot_assert( server );
 
-    for ( int i = 0; i < SNAPSHOT_MAX_CLIENTS; i++ )
+    if ( server->num_shards > 1 )
     {
-        struct snapshot_endpoint_config_t endpoint_config;
-        snapshot_endpoint_default_config( &endpoint_config );
-        snprintf( endpoint_config.name, sizeof(endpoint_config.name), "server[%d]", i );
-        endpoint_config.context = config->context;
-        
-        server->client_endpoint[i] = snapshot_endpoint_create( &endpoint_config, time );
+        snapshot_server_destroy_sharded( server );
+        return;
+    }
 
-        if ( !server->client_endpoint[i] )
+    if ( server->client_endpoint )
+    {
+        for ( int i = 0; i < server->max_clients; i++ )
         {
-            snapshot_printf( SNAPSHOT_LOG_LEVEL_ERROR, "failed to create client endpoint #%d", i );
-            snapshot_server_destroy( server );
-            return NULL;
+            if ( server->client_endpoint[i] )
+            {
+                snapshot_endpoint_destroy( server->client_endpoint[i] );
+            }
         }
     }
 
-    server->max_clients = config->max_clients;
-    server->num_connected_clients = 0;
-    server->challenge_sequence = 0;    
-
-    snapshot_crypto_random_bytes( server->challenge_key, SNAPSHOT_KEY_BYTES );
-
-    if ( server_address.type == SNAPSHOT_ADDRESS_IPV4 && server_address.data.ipv4[0] == 0 && server_address.data.ipv4[1] == 0 && server_address.data.ipv4[2] == 0 && server_address.data.ipv4[3] == 0 )
+    if ( server->client_delta_encoder )
     {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server allowing any address to connect (ipv4)" );
-        server->allow_any_address = SNAPSHOT_TRUE;
+        for ( int i = 0; i < server->max_clients; i++ )
+        {
+            if ( server->client_delta_encoder[i] )
+            {
+                snapshot_delta_encoder_destroy( server->client_delta_encoder[i] );
+            }
+        }
     }
 
-    if ( server_address.type == SNAPSHOT_ADDRESS_IPV6 )
+    if ( server->client_range_encoder )
     {
-        uint8_t zero[16];
-        memset( zero, 0, sizeof(zero) );
-        if ( memcmp( server_address.data.ipv6, zero, 16 ) == 0 )
+        for ( int i = 0; i < server->max_clients; i++ )
         {
-            snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server allowing any address to connect (ipv6)" );
-            server->allow_any_address = SNAPSHOT_TRUE;
+            if ( server->client_range_encoder[i] )
+            {
+                snapshot_range_encoder_destroy( server->client_range_encoder[i] );
+            }
         }
     }
 
-    return server;
-}
+    if ( server->handshake_pool )
+    {
+        snapshot_handshake_pool_destroy( server->handshake_pool );
+    }
 
-void snapshot_server_destroy( struct snapshot_server_t * server )
-{
-    snapshot_assert( server );
+    if ( server->packet_pool )
+    {
+        snapshot_packet_pool_destroy( server->packet_pool );
+    }
 
-    for ( int i = 0; i < SNAPSHOT_MAX_CLIENTS; i++ )
+    if ( server->io_thread )
     {
-        if ( server->client_endpoint[i] )
-        {
-            snapshot_endpoint_destroy( server->client_endpoint[i] );
-        }
+        snapshot_io_thread_destroy( server->io_thread );
+    }
+    else if ( server->socket )
+    {
+        snapshot_server_flush_packets( server );
     }
 
     if ( server->socket )
@@ -310,10 +1230,50 @@ void snapshot_server_destroy( struct snapshot_server_t * server )
         snapshot_platform_socket_destroy( server->socket );
     }
 
-    snapshot_free( server->config.context, server );
+    if ( server->encryption_manager )
+    {
+        snapshot_encryption_manager_destroy( server->encryption_manager );
+    }
+
+    if ( server->connect_token_table && !server->shard_parent )
+    {
+        snapshot_connect_token_table_destroy( server->connect_token_table );
+    }
+
+    if ( server->rate_limiter )
+    {
+        snapshot_rate_limiter_destroy( server->rate_limiter );
+    }
+
+    void * context = server->config.context;
+
+    if ( server->client_connected ) snapshot_free( context, server->client_connected );
+    if ( server->client_timeout ) snapshot_free( context, server->client_timeout );
+    if ( server->client_loopback ) snapshot_free( context, server->client_loopback );
+    if ( server->client_confirmed ) snapshot_free( context, server->client_confirmed );
+    if ( server->client_encryption_index ) snapshot_free( context, server->client_encryption_index );
+    if ( server->client_id ) snapshot_free( context, server->client_id );
+    if ( server->client_sequence ) snapshot_free( context, server->client_sequence );
+    if ( server->client_last_internal_packet_send_time ) snapshot_free( context, server->client_last_internal_packet_send_time );
+    if ( server->client_last_packet_receive_time ) snapshot_free( context, server->client_last_packet_receive_time );
+    if ( server->client_user_data ) snapshot_free( context, server->client_user_data );
+    if ( server->client_replay_protection ) snapshot_free( context, server->client_replay_protection );
+    if ( server->client_endpoint ) snapshot_free( context, server->client_endpoint );
+    if ( server->client_delta_encoder ) snapshot_free( context, server->client_delta_encoder );
+    if ( server->client_range_encoder ) snapshot_free( context, server->client_range_encoder );
+    if ( server->snapshot_data ) snapshot_free( context, server->snapshot_data );
+    if ( server->client_address ) snapshot_free( context, server->client_address );
+    if ( server->client_address_index_slots ) snapshot_free( context, server->client_address_index_slots );
+#if SNAPSHOT_DEVELOPMENT
+    if ( server->sim_receive_packet_data ) snapshot_free( context, server->sim_receive_packet_data );
+    if ( server->sim_receive_packet_bytes ) snapshot_free( context, server->sim_receive_packet_bytes );
+    if ( server->sim_receive_from ) snapshot_free( context, server->sim_receive_from );
+#endif // #if SNAPSHOT_DEVELOPMENT
+
+    snapshot_free( context, server );
 }
 
-void snapshot_server_send_global_packet( struct snapshot_server_t * server, void * packet, const struct snapshot_address_t * to, uint8_t * packet_key )
+void snapshot_server_send_global_packet( struct snapshot_server_t * server, void * packet, const struct snapshot_address_t * to, uint8_t * packet_key, int cipher_suite )
 {
     snapshot_assert( server );
     snapshot_assert( packet );
@@ -324,7 +1284,11 @@ void snapshot_server_send_global_packet( struct snapshot_server_t * server, void
 
     int packet_bytes = 0;
 
-    uint8_t * packet_data = snapshot_write_packet( packet, buffer, SNAPSHOT_MAX_PACKET_BYTES, server->global_sequence, packet_key, server->config.protocol_id, &packet_bytes );
+    // only chacha20-poly1305 packets are batch encrypted
+
+    const SNAPSHOT_BOOL batch_encrypt = cipher_suite == SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 && snapshot_server_batch_encrypt( server );
+
+    uint8_t * packet_data = snapshot_write_packet( packet, buffer, SNAPSHOT_MAX_PACKET_BYTES, server->global_sequence, batch_encrypt ? NULL : packet_key, cipher_suite, server->config.protocol_id, &packet_bytes );
 
     snapshot_assert( packet_bytes <= SNAPSHOT_MAX_PACKET_BYTES );
 
@@ -337,7 +1301,7 @@ void snapshot_server_send_global_packet( struct snapshot_server_t * server, void
     else
 #endif // #if SNAPSHOT_DEVELOPMENT
     {
-        snapshot_platform_socket_send_packet( server->socket, to, packet_data, packet_bytes );
+        snapshot_server_queue_packet( server, to, packet_data, packet_bytes, batch_encrypt ? packet_key : NULL );
         server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_SENT]++;
     }
 
@@ -354,9 +1318,11 @@ void snapshot_server_send_packet_to_client( struct snapshot_server_t * server, i
 
     uint8_t * packet_key = NULL;
 
+    int cipher_suite = SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305;
+
     if ( !server->client_loopback[client_index] )
     {
-        if ( !snapshot_encryption_manager_touch( &server->encryption_manager, 
+        if ( !snapshot_encryption_manager_touch( server->encryption_manager, 
                                                  server->client_encryption_index[client_index], 
                                                  &server->client_address[client_index], 
                                                  server->time ) )
@@ -365,14 +1331,18 @@ void snapshot_server_send_packet_to_client( struct snapshot_server_t * server, i
             return;
         }
 
-        packet_key = snapshot_encryption_manager_get_send_key( &server->encryption_manager, server->client_encryption_index[client_index] );
+        packet_key = snapshot_encryption_manager_get_send_key( server->encryption_manager, server->client_encryption_index[client_index] );
+
+        cipher_suite = snapshot_encryption_manager_get_cipher_suite( server->encryption_manager, server->client_encryption_index[client_index] );
     }
 
     uint8_t buffer[SNAPSHOT_MAX_PACKET_BYTES];
 
     int packet_bytes = 0;
 
-    uint8_t * packet_data = snapshot_write_packet( packet, buffer, SNAPSHOT_MAX_PACKET_BYTES, server->client_sequence[client_index], packet_key, server->config.protocol_id, &packet_bytes );
+    const SNAPSHOT_BOOL batch_encrypt = packet_key && cipher_suite == SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 && snapshot_server_batch_encrypt( server );
+
+    uint8_t * packet_data = snapshot_write_packet( packet, buffer, SNAPSHOT_MAX_PACKET_BYTES, server->client_sequence[client_index], batch_encrypt ? NULL : packet_key, cipher_suite, server->config.protocol_id, &packet_bytes );
 
     snapshot_assert( packet_bytes <= SNAPSHOT_MAX_PACKET_BYTES );
 
@@ -387,7 +1357,7 @@ void snapshot_server_send_packet_to_client( struct snapshot_server_t * server, i
         else
 #endif // #if SNAPSHOT_DEVELOPMENT
         {
-            snapshot_platform_socket_send_packet( server->socket, &server->client_address[client_index], packet_data, packet_bytes );
+            snapshot_server_queue_packet( server, &server->client_address[client_index], packet_data, packet_bytes, batch_encrypt ? packet_key : NULL );
             server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_SENT]++;
         }
     }
@@ -407,21 +1377,20 @@ void snapshot_server_disconnect_client_internal( struct snapshot_server_t * serv
     snapshot_assert( client_index < server->max_clients );
     snapshot_assert( server->client_connected[client_index] );
     snapshot_assert( !server->client_loopback[client_index] );
-    snapshot_assert( server->encryption_manager.client_index[server->client_encryption_index[client_index]] == client_index );
+    snapshot_assert( server->encryption_manager->client_index[server->client_encryption_index[client_index]] == client_index );
 
     char client_address_string[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
     snapshot_address_to_string( &server->client_address[client_index], client_address_string );
     snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server disconnected client %s [%.16" PRIx64 "] from slot %d", client_address_string, server->client_id[client_index], client_index );
 
-    if ( server->config.connect_disconnect_callback )
-    {
-        server->config.connect_disconnect_callback( server->config.context, client_index, 0 );
-    }
+    snapshot_server_connect_disconnect_callback( server, client_index, 0 );
 
     if ( send_disconnect_packets )
     {
         snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server sent disconnect packets to client %d", client_index );
 
+        snapshot_server_reserve_packets( server, SNAPSHOT_NUM_DISCONNECT_PACKETS );
+
         int i;
         for ( i = 0; i < SNAPSHOT_NUM_DISCONNECT_PACKETS; ++i )
         {
@@ -436,20 +1405,32 @@ void snapshot_server_disconnect_client_internal( struct snapshot_server_t * serv
         }
     }
 
-    snapshot_replay_protection_reset( &server->client_replay_protection[client_index] );
+    snapshot_replay_protection_reset( snapshot_server_client_replay_protection( server, client_index ) );
 
     if ( server->client_endpoint[client_index] )
     {
         snapshot_endpoint_reset( server->client_endpoint[client_index] );
     }
 
-    server->encryption_manager.client_index[server->client_encryption_index[client_index]] = -1;
+    if ( server->client_delta_encoder )
+    {
+        snapshot_delta_encoder_reset( server->client_delta_encoder[client_index] );
+    }
+
+    if ( server->client_range_encoder )
+    {
+        snapshot_range_encoder_reset( server->client_range_encoder[client_index] );
+    }
 
-    snapshot_encryption_manager_remove_encryption_mapping( &server->encryption_manager, &server->client_address[client_index], server->time );
+    server->encryption_manager->client_index[server->client_encryption_index[client_index]] = -1;
+
+    snapshot_encryption_manager_remove_encryption_mapping( server->encryption_manager, &server->client_address[client_index], server->time );
+
+    snapshot_address_index_remove( &server->client_address_index, client_index );
+
+    snapshot_server_release_client_slot( server, client_index );
 
-    server->client_connected[client_index] = 0;
     server->client_confirmed[client_index] = 0;
-    server->client_id[client_index] = 0;
     server->client_sequence[client_index] = 0;
     server->client_last_internal_packet_send_time[client_index] = 0.0;
     server->client_last_packet_receive_time[client_index] = 0.0;
@@ -468,6 +1449,8 @@ void snapshot_server_disconnect_client( struct snapshot_server_t * server, int c
 {
     snapshot_assert( server );
 
+    server = snapshot_server_find_shard( server, &client_index );
+
     snapshot_assert( client_index >= 0 );
     snapshot_assert( client_index < server->max_clients );
     snapshot_assert( server->client_loopback[client_index] == 0 );
@@ -479,34 +1462,33 @@ void snapshot_server_disconnect_client( struct snapshot_server_t * server, int c
         return;
 
     snapshot_server_disconnect_client_internal( server, client_index, 1 );
+
+    snapshot_server_flush_packets( server );
 }
 
 void snapshot_server_disconnect_all_clients( struct snapshot_server_t * server )
 {
     snapshot_assert( server );
 
-    int i;
-    for ( i = 0; i < server->max_clients; ++i )
+    if ( server->shards )
     {
-        if ( server->client_connected[i] && !server->client_loopback[i] )
+        for ( int i = 0; i < server->num_shards; i++ )
         {
-            snapshot_server_disconnect_client_internal( server, i, 1 );
+            snapshot_server_disconnect_all_clients( server->shards[i].server );
         }
+        return;
     }
-}
-
-int snapshot_server_find_client_index_by_id( struct snapshot_server_t * server, uint64_t client_id )
-{
-    snapshot_assert( server );
 
     int i;
     for ( i = 0; i < server->max_clients; ++i )
-    {   
-        if ( server->client_connected[i] && server->client_id[i] == client_id )
-            return i;
+    {
+        if ( server->client_connected[i] && !server->client_loopback[i] )
+        {
+            snapshot_server_disconnect_client_internal( server, i, 1 );
+        }
     }
 
-    return -1;
+    snapshot_server_flush_packets( server );
 }
 
 int snapshot_server_find_client_index_by_address( struct snapshot_server_t * server, const struct snapshot_address_t * address )
@@ -514,40 +1496,67 @@ int snapshot_server_find_client_index_by_address( struct snapshot_server_t * ser
     snapshot_assert( server );
     snapshot_assert( address );
 
+    if ( server->shards )
+    {
+        for ( int i = 0; i < server->num_shards; i++ )
+        {
+            struct snapshot_server_t * shard_server = server->shards[i].server;
+            const int client_index = snapshot_server_find_client_index_by_address( shard_server, address );
+            if ( client_index != -1 )
+                return shard_server->shard_client_index_offset + client_index;
+        }
+        return -1;
+    }
+
     if ( address->type == 0 )
         return -1;
 
-    int i;
-    for ( i = 0; i < server->max_clients; ++i )
-    {   
-        if ( server->client_connected[i] && snapshot_address_equal( &server->client_address[i], address ) )
-            return i;
-    }
+    int client_index = snapshot_address_index_find( &server->client_address_index, address );
 
-    return -1;
+    snapshot_assert( client_index == -1 || server->client_connected[client_index] );
+
+    return client_index;
 }
 
-void snapshot_server_process_connection_request_packet( struct snapshot_server_t * server, 
-                                                        const struct snapshot_address_t * from, 
-                                                        struct snapshot_connection_request_packet_t * packet )
+// shards share their parent's connect token table, so a token used on one shard is rejected from an address that hashes to another
+
+static SNAPSHOT_BOOL snapshot_server_connect_token_find_or_add( struct snapshot_server_t * server, const struct snapshot_address_t * from, const uint8_t * connect_token_mac )
 {
     snapshot_assert( server );
 
-    (void) from;
+    if ( !server->shard_parent )
+        return snapshot_connect_token_table_find_or_add( server->connect_token_table, from, connect_token_mac );
 
-    struct snapshot_connect_token_private_t connect_token_private;
-    if ( snapshot_read_connect_token_private( packet->connect_token_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES, &connect_token_private ) != SNAPSHOT_OK )
-    {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. failed to read connect token" );
-        return;
-    }
+    snapshot_platform_mutex_guard( &server->shard_parent->shard_connect_token_mutex );
+
+    return snapshot_connect_token_table_find_or_add( server->connect_token_table, from, connect_token_mac );
+}
+
+// the stateful part of a connection request, once the connect token has been read. when challenge_token_data is NULL
+// the challenge token is encrypted here, otherwise it was already encrypted by a handshake thread with challenge_token_sequence.
+// with a stateless handshake no encryption mapping is added here: the challenge token carries the session keys, and the
+// mapping is added only once the client proves it owns its address by sending the connection response back
+
+static void snapshot_server_apply_connection_request( struct snapshot_server_t * server, 
+                                                      const struct snapshot_address_t * from, 
+                                                      struct snapshot_connect_token_private_t * connect_token_private, 
+                                                      uint64_t connect_token_expire_timestamp, 
+                                                      const uint8_t * connect_token_mac, 
+                                                      int cipher_suite, 
+                                                      const uint8_t * challenge_token_data, 
+                                                      uint64_t challenge_token_sequence )
+{
+    snapshot_assert( server );
+    snapshot_assert( from );
+    snapshot_assert( connect_token_private );
+    snapshot_assert( connect_token_mac );
 
     if ( !server->allow_any_address )
     {
         int found_server_address = 0;
-        for ( int i = 0; i < connect_token_private.num_server_addresses; i++ )
+        for ( int i = 0; i < connect_token_private->num_server_addresses; i++ )
         {
-            if ( snapshot_address_equal( &server->address, &connect_token_private.server_addresses[i] ) )
+            if ( snapshot_address_equal( &server->address, &connect_token_private->server_addresses[i] ) )
             {
                 found_server_address = 1;
             }
@@ -559,22 +1568,33 @@ void snapshot_server_process_connection_request_packet( struct snapshot_server_t
         }
     }
 
+    // the client may always fall back to chacha20-poly1305, otherwise it must use the cipher suite in the connect token
+
+    if ( cipher_suite != SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 && cipher_suite != connect_token_private->cipher_suite )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. cipher suite %s does not match connect token", snapshot_cipher_suite_string( cipher_suite ) );
+        return;
+    }
+
+    if ( cipher_suite == SNAPSHOT_CIPHER_SUITE_AES256GCM && !snapshot_crypto_aes256gcm_available() )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. aes256gcm is not available on this cpu" );
+        return;
+    }
+
     if ( snapshot_server_find_client_index_by_address( server, from ) != -1 )
     {
         snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. a client with this address is already connected" );
         return;
     }
 
-    if ( snapshot_server_find_client_index_by_id( server, connect_token_private.client_id ) != -1 )
+    if ( snapshot_server_client_id_connected( server, connect_token_private->client_id ) )
     {
         snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. a client with this id is already connected" );
         return;
     }
 
-    if ( !snapshot_connect_token_entries_find_or_add( server->connect_token_entries, 
-                                                      from, 
-                                                      packet->connect_token_data + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES - SNAPSHOT_MAC_BYTES, 
-                                                      server->time ) )
+    if ( !snapshot_server_connect_token_find_or_add( server, from, connect_token_mac ) )
     {
         snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. connect token has already been used" );
         return;
@@ -587,53 +1607,93 @@ void snapshot_server_process_connection_request_packet( struct snapshot_server_t
         struct snapshot_connection_denied_packet_t p;
         p.packet_type = SNAPSHOT_CONNECTION_DENIED_PACKET;
         
-        snapshot_server_send_global_packet( server, &p, from, connect_token_private.server_to_client_key );
+        snapshot_server_send_global_packet( server, &p, from, connect_token_private->server_to_client_key, cipher_suite );
 
         server->counters[SNAPSHOT_SERVER_COUNTER_CONNECTION_DENIED_PACKETS_SENT]++;
 
         return;
     }
 
-    double expire_time = ( connect_token_private.timeout_seconds >= 0 ) ? server->time + connect_token_private.timeout_seconds : -1.0;
-
-    if ( !snapshot_encryption_manager_add_encryption_mapping( &server->encryption_manager, 
-                                                              from, 
-                                                              connect_token_private.server_to_client_key, 
-                                                              connect_token_private.client_to_server_key, 
-                                                              server->time, 
-                                                              expire_time,
-                                                              connect_token_private.timeout_seconds ) )
+    if ( !server->config.stateless_handshake )
     {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. failed to add encryption mapping" );
-        return;
-    }
+        double expire_time = ( connect_token_private->timeout_seconds >= 0 ) ? server->time + connect_token_private->timeout_seconds : -1.0;
+
+        if ( !snapshot_encryption_manager_add_encryption_mapping( server->encryption_manager, 
+                                                                  from, 
+                                                                  connect_token_private->server_to_client_key, 
+                                                                  connect_token_private->client_to_server_key, 
+                                                                  server->time, 
+                                                                  expire_time,
+                                                                  connect_token_private->timeout_seconds ) )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. failed to add encryption mapping" );
+            return;
+        }
 
-    struct snapshot_challenge_token_t challenge_token;
-    challenge_token.client_id = connect_token_private.client_id;
-    memcpy( challenge_token.user_data, connect_token_private.user_data, SNAPSHOT_USER_DATA_BYTES );
+        snapshot_encryption_manager_set_cipher_suite( server->encryption_manager, 
+                                                      snapshot_encryption_manager_find_encryption_mapping( server->encryption_manager, from, server->time ), 
+                                                      cipher_suite );
+
+        server->counters[SNAPSHOT_SERVER_COUNTER_ENCRYPTION_MAPPINGS_ADDED]++;
+    }
 
     struct snapshot_connection_challenge_packet_t challenge_packet;
     challenge_packet.packet_type = SNAPSHOT_CONNECTION_CHALLENGE_PACKET;
-    challenge_packet.challenge_token_sequence = server->challenge_sequence;
-    snapshot_write_challenge_token( &challenge_token, challenge_packet.challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
-    if ( snapshot_encrypt_challenge_token( challenge_packet.challenge_token_data, 
-                                           SNAPSHOT_CHALLENGE_TOKEN_BYTES, 
-                                           server->challenge_sequence, 
-                                           server->challenge_key ) != SNAPSHOT_OK )
-    {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. failed to encrypt challenge token" );
-        return;
+
+    if ( challenge_token_data )
+    {
+        challenge_packet.challenge_token_sequence = challenge_token_sequence;
+        memcpy( challenge_packet.challenge_token_data, challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
     }
+    else
+    {
+        struct snapshot_challenge_token_t challenge_token;
+        snapshot_generate_challenge_token( &challenge_token, connect_token_private, from, cipher_suite, connect_token_expire_timestamp );
+
+        challenge_packet.challenge_token_sequence = server->challenge_sequence;
+        snapshot_write_challenge_token( &challenge_token, challenge_packet.challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+        if ( snapshot_encrypt_challenge_token( challenge_packet.challenge_token_data, 
+                                               SNAPSHOT_CHALLENGE_TOKEN_BYTES, 
+                                               server->challenge_sequence, 
+                                               server->challenge_key ) != SNAPSHOT_OK )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. failed to encrypt challenge token" );
+            return;
+        }
 
-    server->challenge_sequence++;
+        server->challenge_sequence++;
+    }
 
     snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server sent connection challenge packet" );
 
-    snapshot_server_send_global_packet( server, &challenge_packet, from, connect_token_private.server_to_client_key );
+    snapshot_server_send_global_packet( server, &challenge_packet, from, connect_token_private->server_to_client_key, cipher_suite );
 
     server->counters[SNAPSHOT_SERVER_COUNTER_CONNECTION_CHALLENGE_PACKETS_SENT]++;
 }
 
+void snapshot_server_process_connection_request_packet( struct snapshot_server_t * server, 
+                                                        const struct snapshot_address_t * from, 
+                                                        struct snapshot_connection_request_packet_t * packet )
+{
+    snapshot_assert( server );
+
+    struct snapshot_connect_token_private_t connect_token_private;
+    if ( snapshot_read_connect_token_private( packet->connect_token_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES, &connect_token_private ) != SNAPSHOT_OK )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection request. failed to read connect token" );
+        return;
+    }
+
+    snapshot_server_apply_connection_request( server, 
+                                              from, 
+                                              &connect_token_private, 
+                                              packet->connect_token_expire_timestamp, 
+                                              packet->connect_token_data + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES - SNAPSHOT_MAC_BYTES, 
+                                              packet->cipher_suite, 
+                                              NULL, 
+                                              0 );
+}
+
 int snapshot_server_find_free_client_index( struct snapshot_server_t * server )
 {
     snapshot_assert( server );
@@ -662,24 +1722,26 @@ void snapshot_server_connect_client( struct snapshot_server_t * server,
     snapshot_assert( address );
     snapshot_assert( encryption_index != -1 );
     snapshot_assert( user_data );
-    snapshot_assert( server->encryption_manager.client_index[encryption_index] == -1 );
+    snapshot_assert( server->encryption_manager->client_index[encryption_index] == -1 );
 
     server->num_connected_clients++;
 
     snapshot_assert( server->num_connected_clients <= server->max_clients );
 
-    snapshot_assert( server->client_connected[client_index] == 0 );
+    // the slot was already claimed for this client id by snapshot_server_claim_client_slot
 
-    snapshot_encryption_manager_set_expire_time( &server->encryption_manager, encryption_index, -1.0 );
+    snapshot_assert( server->client_connected[client_index] );
+    snapshot_assert( server->client_id[client_index] == client_id );
+
+    snapshot_encryption_manager_set_expire_time( server->encryption_manager, encryption_index, -1.0 );
     
-    server->encryption_manager.client_index[encryption_index] = client_index;
+    server->encryption_manager->client_index[encryption_index] = client_index;
 
-    server->client_connected[client_index] = 1;
     server->client_timeout[client_index] = timeout_seconds;
     server->client_encryption_index[client_index] = encryption_index;
-    server->client_id[client_index] = client_id;
     server->client_sequence[client_index] = 0;
     server->client_address[client_index] = *address;
+    snapshot_address_index_insert( &server->client_address_index, client_index );
     server->client_last_internal_packet_send_time[client_index] = server->time;
     server->client_last_packet_receive_time[client_index] = server->time;
     memcpy( server->client_user_data[client_index], user_data, SNAPSHOT_USER_DATA_BYTES );
@@ -690,8 +1752,8 @@ void snapshot_server_connect_client( struct snapshot_server_t * server,
 
     struct snapshot_keep_alive_packet_t packet;
     packet.packet_type = SNAPSHOT_KEEP_ALIVE_PACKET;
-    packet.client_index = client_index;
-    packet.max_clients = server->max_clients;
+    packet.client_index = server->shard_client_index_offset + client_index;
+    packet.max_clients = server->shard_max_clients;
 
     snapshot_server_send_packet_to_client( server, client_index, &packet );
 
@@ -699,54 +1761,62 @@ void snapshot_server_connect_client( struct snapshot_server_t * server,
 
     server->client_last_internal_packet_send_time[client_index] = server->time;
 
-    if ( server->config.connect_disconnect_callback )
-    {
-        server->config.connect_disconnect_callback( server->config.context, client_index, 1 );
-    }
+    snapshot_server_connect_disconnect_callback( server, client_index, 1 );
 
     server->counters[SNAPSHOT_SERVER_COUNTER_CLIENT_CONNECTS]++;
 }
 
-void snapshot_server_process_connection_response_packet( struct snapshot_server_t * server, 
-                                                         const struct snapshot_address_t * from, 
-                                                         struct snapshot_connection_response_packet_t * packet, 
-                                                         int encryption_index )
+// the stateful part of a connection response, once the challenge token has been opened and the response mac checked.
+// with a stateless handshake the encryption mapping is added here, from the session keys carried in the challenge token
+
+// each challenge token connects at most one client. without this a connection response replayed from the same address after the
+// client disconnects would connect a ghost client, since with a stateless handshake the response alone adds the encryption mapping.
+// responses that arrive more than SNAPSHOT_SERVER_CHALLENGE_WINDOW_BITS challenges behind the most recent one used are ignored too
+
+static void snapshot_server_apply_connection_response( struct snapshot_server_t * server, 
+                                                       const struct snapshot_address_t * from, 
+                                                       struct snapshot_challenge_token_t * challenge_token, 
+                                                       uint64_t challenge_token_sequence )
 {
     snapshot_assert( server );
+    snapshot_assert( from );
+    snapshot_assert( challenge_token );
+
+    struct snapshot_replay_protection_t * challenge_replay_protection = (struct snapshot_replay_protection_t*) server->challenge_replay_protection;
 
-    if ( snapshot_decrypt_challenge_token( packet->challenge_token_data, 
-                                           SNAPSHOT_CHALLENGE_TOKEN_BYTES, 
-                                           packet->challenge_token_sequence, 
-                                           server->challenge_key ) != SNAPSHOT_OK )
+    if ( snapshot_server_find_client_index_by_address( server, from ) != -1 )
     {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. failed to decrypt challenge token" );
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. a client with this address is already connected" );
         return;
     }
 
-    struct snapshot_challenge_token_t challenge_token;
-    if ( snapshot_read_challenge_token( packet->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES, &challenge_token ) != SNAPSHOT_OK )
+    if ( snapshot_server_client_id_connected( server, challenge_token->client_id ) )
     {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. failed to read challenge token" );
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. a client with this id is already connected" );
         return;
     }
 
-    uint8_t * packet_send_key = snapshot_encryption_manager_get_send_key( &server->encryption_manager, encryption_index );
-
-    if ( !packet_send_key )
+    if ( snapshot_replay_protection_already_received( challenge_replay_protection, challenge_token_sequence ) )
     {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. no packet send key" );
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. challenge token has already been used" );
         return;
     }
 
-    if ( snapshot_server_find_client_index_by_address( server, from ) != -1 )
+    int encryption_index = snapshot_encryption_manager_find_encryption_mapping( server->encryption_manager, from, server->time );
+
+    if ( encryption_index != -1 )
     {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. a client with this address is already connected" );
-        return;
-    }
+        uint8_t * packet_receive_key = snapshot_encryption_manager_get_receive_key( server->encryption_manager, encryption_index );
 
-    if ( snapshot_server_find_client_index_by_id( server, challenge_token.client_id ) != -1 )
+        if ( !packet_receive_key || memcmp( packet_receive_key, challenge_token->client_to_server_key, SNAPSHOT_KEY_BYTES ) != 0 )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. encryption mapping does not match challenge token" );
+            return;
+        }
+    }
+    else if ( !server->config.stateless_handshake )
     {
-        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. a client with this id is already connected" );
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. no encryption mapping" );
         return;
     }
 
@@ -757,7 +1827,7 @@ void snapshot_server_process_connection_response_packet( struct snapshot_server_
         struct snapshot_connection_denied_packet_t p;
         p.packet_type = SNAPSHOT_CONNECTION_DENIED_PACKET;
 
-        snapshot_server_send_global_packet( server, &p, from, packet_send_key );
+        snapshot_server_send_global_packet( server, &p, from, challenge_token->server_to_client_key, challenge_token->cipher_suite );
 
         return;
     }
@@ -766,9 +1836,54 @@ void snapshot_server_process_connection_response_packet( struct snapshot_server_
 
     snapshot_assert( client_index != -1 );
 
-    int timeout_seconds = snapshot_encryption_manager_get_timeout( &server->encryption_manager, encryption_index );
+    // the client id check above is an early out. another shard may connect the same id in the meantime, so it is repeated as the slot is claimed
+
+    if ( !snapshot_server_claim_client_slot( server, client_index, challenge_token->client_id ) )
+    {
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. a client with this id is already connected" );
+        return;
+    }
+
+    if ( encryption_index == -1 )
+    {
+        if ( !snapshot_encryption_manager_add_encryption_mapping( server->encryption_manager, 
+                                                                  from, 
+                                                                  challenge_token->server_to_client_key, 
+                                                                  challenge_token->client_to_server_key, 
+                                                                  server->time, 
+                                                                  -1.0,
+                                                                  challenge_token->timeout_seconds ) )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server ignored connection response. failed to add encryption mapping" );
+            snapshot_server_release_client_slot( server, client_index );
+            return;
+        }
+
+        encryption_index = snapshot_encryption_manager_find_encryption_mapping( server->encryption_manager, from, server->time );
+
+        snapshot_assert( encryption_index != -1 );
+
+        snapshot_encryption_manager_set_cipher_suite( server->encryption_manager, encryption_index, challenge_token->cipher_suite );
+
+        server->counters[SNAPSHOT_SERVER_COUNTER_ENCRYPTION_MAPPINGS_ADDED]++;
+    }
+
+    snapshot_replay_protection_advance_sequence( challenge_replay_protection, challenge_token_sequence );
+
+    snapshot_server_connect_client( server, client_index, from, challenge_token->client_id, encryption_index, challenge_token->timeout_seconds, challenge_token->user_data );
+}
+
+void snapshot_server_process_connection_response_packet( struct snapshot_server_t * server, 
+                                                         const struct snapshot_address_t * from, 
+                                                         struct snapshot_connection_response_packet_t * packet )
+{
+    snapshot_assert( server );
+
+    struct snapshot_challenge_token_t challenge_token;
+    if ( snapshot_open_connection_response_packet( packet, from, server->config.protocol_id, time( NULL ), server->challenge_key, &challenge_token ) != SNAPSHOT_OK )
+        return;
 
-    snapshot_server_connect_client( server, client_index, from, challenge_token.client_id, encryption_index, timeout_seconds, challenge_token.user_data );
+    snapshot_server_apply_connection_response( server, from, &challenge_token, packet->challenge_token_sequence );
 }
 
 int snapshot_server_process_payload( struct snapshot_server_t * server, int client_index, uint8_t * payload_data, int payload_bytes )
@@ -817,11 +1932,107 @@ void snapshot_server_process_passthrough( struct snapshot_server_t * server, con
 
     if ( server->config.process_passthrough_callback != NULL )
     {
-        server->config.process_passthrough_callback( server->config.context, client_address, client_index, passthrough_data, passthrough_bytes );
+        if ( server->shard_parent )
+        {
+            snapshot_platform_mutex_acquire( &server->shard_parent->shard_callback_mutex );
+        }
+
+        server->config.process_passthrough_callback( server->config.context, client_address, server->shard_client_index_offset + client_index, passthrough_data, passthrough_bytes );
+
+        if ( server->shard_parent )
+        {
+            snapshot_platform_mutex_release( &server->shard_parent->shard_callback_mutex );
+        }
     }
 }
 
-SNAPSHOT_BOOL snapshot_server_process_packet( struct snapshot_server_t * server, const struct snapshot_address_t * from, uint8_t * packet_data, int packet_bytes )
+static SNAPSHOT_BOOL snapshot_server_queue_handshake( struct snapshot_server_t * server, 
+                                                      int type, 
+                                                      const struct snapshot_address_t * from, 
+                                                      const uint8_t * packet_data, 
+                                                      int packet_bytes, 
+                                                      uint64_t challenge_token_sequence )
+{
+    snapshot_assert( server );
+    snapshot_assert( server->handshake_pool );
+    snapshot_assert( from );
+    snapshot_assert( packet_data );
+
+    if ( packet_bytes <= 0 || packet_bytes > SNAPSHOT_HANDSHAKE_MAX_PACKET_BYTES )
+        return SNAPSHOT_FALSE;
+
+    struct snapshot_handshake_t * handshake = snapshot_handshake_pool_begin_job( server->handshake_pool );
+    if ( !handshake )
+    {
+        char address_string[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server dropped handshake from %s. handshake queue is full", snapshot_address_to_string( from, address_string ) );
+        return SNAPSHOT_FALSE;
+    }
+
+    handshake->type = type;
+    handshake->from = *from;
+    handshake->current_timestamp = time( NULL );
+    handshake->challenge_token_sequence = challenge_token_sequence;
+    handshake->packet_bytes = packet_bytes;
+    memcpy( handshake->packet_data, packet_data, packet_bytes );
+
+    snapshot_handshake_pool_commit_job( server->handshake_pool );
+
+    return SNAPSHOT_TRUE;
+}
+
+static void snapshot_server_process_handshakes( struct snapshot_server_t * server )
+{
+    snapshot_assert( server );
+
+    if ( !server->handshake_pool )
+        return;
+
+    // apply completed handshakes in the order each worker finished them. everything stateful happens here, on the server thread
+
+    struct snapshot_handshake_t * handshake;
+    while ( ( handshake = snapshot_handshake_pool_next_completed_job( server->handshake_pool ) ) != NULL )
+    {
+        if ( handshake->result == SNAPSHOT_OK )
+        {
+            char from_address_string[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
+
+            if ( handshake->type == SNAPSHOT_HANDSHAKE_CONNECTION_REQUEST )
+            {
+                server->counters[SNAPSHOT_SERVER_COUNTER_CONNECTION_REQUEST_PACKETS_RECEIVED]++;
+
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server received connection request from %s", snapshot_address_to_string( &handshake->from, from_address_string ) );
+
+                snapshot_server_apply_connection_request( server, 
+                                                          &handshake->from, 
+                                                          &handshake->connect_token, 
+                                                          handshake->connect_token_expire_timestamp, 
+                                                          handshake->connect_token_mac, 
+                                                          handshake->cipher_suite, 
+                                                          handshake->challenge_token_data, 
+                                                          handshake->challenge_token_sequence );
+            }
+            else
+            {
+                server->counters[SNAPSHOT_SERVER_COUNTER_CONNECTION_RESPONSE_PACKETS_RECEIVED]++;
+
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server received connection response from %s", snapshot_address_to_string( &handshake->from, from_address_string ) );
+
+                snapshot_server_apply_connection_response( server, &handshake->from, &handshake->challenge_token, handshake->challenge_token_sequence );
+            }
+        }
+
+        snapshot_handshake_pool_release_job( server->handshake_pool );
+    }
+
+    uint64_t handshake_counters[SNAPSHOT_HANDSHAKE_NUM_COUNTERS];
+    snapshot_handshake_pool_counters( server->handshake_pool, handshake_counters );
+    server->counters[SNAPSHOT_SERVER_COUNTER_HANDSHAKE_QUEUE_DEPTH] = snapshot_handshake_pool_queue_depth( server->handshake_pool );
+    server->counters[SNAPSHOT_SERVER_COUNTER_HANDSHAKE_QUEUE_DROPS] = handshake_counters[SNAPSHOT_HANDSHAKE_COUNTER_QUEUE_DROPS];
+    server->counters[SNAPSHOT_SERVER_COUNTER_HANDSHAKE_JOBS_FAILED] = handshake_counters[SNAPSHOT_HANDSHAKE_COUNTER_JOBS_FAILED];
+}
+
+static SNAPSHOT_BOOL snapshot_server_process_packet_internal( struct snapshot_server_t * server, const struct snapshot_address_t * from, uint8_t * packet_data, int packet_bytes, SNAPSHOT_BOOL decrypted )
 {
     snapshot_assert( server );
     snapshot_assert( from );
@@ -834,6 +2045,24 @@ SNAPSHOT_BOOL snapshot_server_process_packet( struct snapshot_server_t * server,
 
     server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_PROCESSED]++;
 
+    // connection requests and responses aren't encrypted with a packet key, so with handshake threads they are queued as they arrive.
+    // each request reserves a challenge token sequence here so the worker can encrypt the challenge token it sends back
+
+    if ( server->handshake_pool && packet_data[0] == SNAPSHOT_CONNECTION_REQUEST_PACKET && ( server->flags & SNAPSHOT_SERVER_FLAG_IGNORE_CONNECTION_REQUEST_PACKETS ) == 0 )
+    {
+        if ( !snapshot_server_queue_handshake( server, SNAPSHOT_HANDSHAKE_CONNECTION_REQUEST, from, packet_data, packet_bytes, server->challenge_sequence ) )
+            return SNAPSHOT_FALSE;
+
+        server->challenge_sequence++;
+
+        return SNAPSHOT_TRUE;
+    }
+
+    if ( server->handshake_pool && packet_data[0] == SNAPSHOT_CONNECTION_RESPONSE_PACKET && ( server->flags & SNAPSHOT_SERVER_FLAG_IGNORE_CONNECTION_RESPONSE_PACKETS ) == 0 )
+    {
+        return snapshot_server_queue_handshake( server, SNAPSHOT_HANDSHAKE_CONNECTION_RESPONSE, from, packet_data, packet_bytes, 0 );
+    }
+
     uint64_t sequence;
 
     int encryption_index = -1;
@@ -846,12 +2075,14 @@ SNAPSHOT_BOOL snapshot_server_process_packet( struct snapshot_server_t * server,
     }
     else
     {
-        encryption_index = snapshot_encryption_manager_find_encryption_mapping( &server->encryption_manager, from, server->time );
+        encryption_index = snapshot_encryption_manager_find_encryption_mapping( server->encryption_manager, from, server->time );
     }
     
-    uint8_t * read_packet_key = snapshot_encryption_manager_get_receive_key( &server->encryption_manager, encryption_index );
+    // packets already decrypted in a batch are read without a key, so they aren't decrypted a second time
 
-    if ( !read_packet_key && packet_data[0] != 0 )
+    uint8_t * read_packet_key = decrypted ? NULL : snapshot_encryption_manager_get_receive_key( server->encryption_manager, encryption_index );
+
+    if ( !read_packet_key && !decrypted && packet_data[0] != SNAPSHOT_CONNECTION_REQUEST_PACKET && packet_data[0] != SNAPSHOT_CONNECTION_RESPONSE_PACKET )
     {
         char address_string[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
         snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server could not process packet because no encryption mapping exists for %s", snapshot_address_to_string( from, address_string ) );
@@ -866,12 +2097,13 @@ SNAPSHOT_BOOL snapshot_server_process_packet( struct snapshot_server_t * server,
                                           packet_bytes, 
                                           &sequence, 
                                           read_packet_key, 
+                                          snapshot_encryption_manager_get_cipher_suite( server->encryption_manager, encryption_index ), 
                                           server->config.protocol_id, 
                                           current_timestamp, 
                                           server->config.private_key, 
                                           server->allowed_packets,
                                           out_packet_data,
-                                          ( client_index != -1 ) ? &server->client_replay_protection[client_index] : NULL );
+                                          ( client_index != -1 ) ? snapshot_server_client_replay_protection( server, client_index ) : NULL );
 
     if ( !packet )
     {
@@ -905,7 +2137,7 @@ SNAPSHOT_BOOL snapshot_server_process_packet( struct snapshot_server_t * server,
             {
                 char from_address_string[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
                 snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server received connection response from %s", snapshot_address_to_string( from, from_address_string ) );
-                snapshot_server_process_connection_response_packet( server, from, (struct snapshot_connection_response_packet_t*) packet, encryption_index );
+                snapshot_server_process_connection_response_packet( server, from, (struct snapshot_connection_response_packet_t*) packet );
                 return SNAPSHOT_TRUE;
             }
         }
@@ -942,22 +2174,17 @@ SNAPSHOT_BOOL snapshot_server_process_packet( struct snapshot_server_t * server,
                     snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server confirmed connection with client %d", client_index );
                     server->client_confirmed[client_index] = 1;
                 }
-                struct snapshot_payload_packet_t * payload_packet = (struct snapshot_payload_packet_t*) packet;
-                uint8_t * payload_packet_data = payload_packet->payload_data;
-                int payload_packet_bytes = payload_packet->payload_bytes;
-                uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
-                uint8_t * payload_data = NULL;
-                int payload_bytes = 0;
-                uint16_t payload_sequence = 0;
-                uint16_t payload_ack = 0;
-                uint32_t payload_ack_bits = 0;
-                snapshot_endpoint_process_packet( server->client_endpoint[client_index], payload_packet_data, payload_packet_bytes, buffer, &payload_data, &payload_bytes, &payload_sequence, &payload_ack, &payload_ack_bits );
-                if ( payload_data )
+                uint8_t * payload_packet_data = snapshot_payload_packet_data( packet );
+                int payload_packet_bytes = snapshot_payload_packet_bytes( packet );
+                struct snapshot_endpoint_payload_t payload;
+                snapshot_endpoint_receive_packet( server->client_endpoint[client_index], payload_packet_data, payload_packet_bytes, &payload );
+                if ( payload.data )
                 {
-                    if ( snapshot_server_process_payload( server, client_index, payload_data, payload_bytes ) == SNAPSHOT_OK )
+                    if ( snapshot_server_process_payload( server, client_index, payload.data, payload.bytes ) == SNAPSHOT_OK )
                     {
-                        snapshot_endpoint_mark_payload_processed( server->client_endpoint[client_index], payload_sequence, payload_ack, payload_ack_bits, payload_packet_bytes );
+                        snapshot_endpoint_mark_payload_processed_ack_words( server->client_endpoint[client_index], payload.sequence, payload.ack, payload.ack_bits, payload.num_ack_words, payload_packet_bytes );
                     }
+                    snapshot_endpoint_release_payload( server->client_endpoint[client_index], &payload );
                 }
                 return SNAPSHOT_TRUE;
             }
@@ -968,40 +2195,152 @@ SNAPSHOT_BOOL snapshot_server_process_packet( struct snapshot_server_t * server,
         {
             server->counters[SNAPSHOT_SERVER_COUNTER_PASSTHROUGH_PACKETS_RECEIVED]++;
 
-            if ( client_index != -1 )
-            {
-                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server received passthrough packet from client %d", client_index );
-                server->client_last_packet_receive_time[client_index] = server->time;
-                if ( !server->client_confirmed[client_index] )
-                {
-                    snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server confirmed connection with client %d", client_index );
-                    server->client_confirmed[client_index] = 1;
-                }
-                struct snapshot_passthrough_packet_t * passthrough_packet = (struct snapshot_passthrough_packet_t*) packet;
-                snapshot_server_process_passthrough( server, &server->client_address[client_index], client_index, passthrough_packet->passthrough_data, passthrough_packet->passthrough_bytes );
-                return SNAPSHOT_TRUE;
-            }
-        }
-        break;
+            if ( client_index != -1 )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server received passthrough packet from client %d", client_index );
+                server->client_last_packet_receive_time[client_index] = server->time;
+                if ( !server->client_confirmed[client_index] )
+                {
+                    snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server confirmed connection with client %d", client_index );
+                    server->client_confirmed[client_index] = 1;
+                }
+                struct snapshot_passthrough_packet_t * passthrough_packet = (struct snapshot_passthrough_packet_t*) packet;
+                snapshot_server_process_passthrough( server, &server->client_address[client_index], client_index, passthrough_packet->passthrough_data, passthrough_packet->passthrough_bytes );
+                return SNAPSHOT_TRUE;
+            }
+        }
+        break;
+
+        case SNAPSHOT_DISCONNECT_PACKET:
+        {
+            server->counters[SNAPSHOT_SERVER_COUNTER_DISCONNECT_PACKETS_RECEIVED]++;
+
+            if ( client_index != -1 )
+            {
+                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server received disconnect packet from client %d", client_index );
+                snapshot_server_disconnect_client_internal( server, client_index, 0 );
+                return SNAPSHOT_TRUE;
+           }
+        }
+        break;
+
+        default:
+            break;
+    }
+
+    return SNAPSHOT_FALSE;
+}
+
+static void snapshot_server_admit_packets( struct snapshot_server_t * server, const struct snapshot_address_t * from, uint8_t ** packet_data, int * packet_bytes, int num_packets )
+{
+    snapshot_assert( server );
+
+    // cheap admission ahead of any encryption mapping lookup or crypto. packets with a prefix byte or length that can't
+    // be valid are dropped, then packets from addresses that aren't connected clients spend a token from the bucket for
+    // their ip. connected clients are already known by address, so they are never rate limited. dropped packets are
+    // marked by setting their length to zero
+
+    for ( int i = 0; i < num_packets; ++i )
+    {
+        if ( packet_bytes[i] <= 0 )
+            continue;
+
+        if ( !snapshot_packet_prefix_valid( packet_data[i], packet_bytes[i], server->allowed_packets ) )
+        {
+            server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_DROPPED_INVALID]++;
+            packet_bytes[i] = 0;
+            continue;
+        }
+
+        if ( server->rate_limiter && snapshot_server_find_client_index_by_address( server, &from[i] ) == -1 )
+        {
+            if ( !snapshot_rate_limiter_allow( server->rate_limiter, &from[i], server->time ) )
+            {
+                server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_DROPPED_RATE_LIMITED]++;
+                packet_bytes[i] = 0;
+            }
+        }
+    }
+}
+
+SNAPSHOT_BOOL snapshot_server_process_packet( struct snapshot_server_t * server, const struct snapshot_address_t * from, uint8_t * packet_data, int packet_bytes )
+{
+    snapshot_assert( server );
+
+    // on a sharded server, packets passed in directly go to the shard the sender is connected to, or the first shard
+
+    if ( server->shards )
+    {
+        int client_index = snapshot_server_find_client_index_by_address( server, from );
+        if ( client_index == -1 )
+            return snapshot_server_process_packet( server->shards[0].server, from, packet_data, packet_bytes );
+        server = snapshot_server_find_shard( server, &client_index );
+        return snapshot_server_process_packet( server, from, packet_data, packet_bytes );
+    }
+
+    // packets passed in directly go through the same admission as packets received from the socket
+
+    snapshot_server_admit_packets( server, from, &packet_data, &packet_bytes, 1 );
+
+    if ( packet_bytes == 0 )
+        return SNAPSHOT_FALSE;
+
+    return snapshot_server_process_packet_internal( server, from, packet_data, packet_bytes, SNAPSHOT_FALSE );
+}
+
+static void snapshot_server_decrypt_packets( struct snapshot_server_t * server, const struct snapshot_address_t * from, uint8_t ** packet_data, int * packet_bytes, int num_packets )
+{
+    snapshot_assert( server );
+    snapshot_assert( num_packets <= SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE );
+
+    // decrypt every packet from an address with an encryption mapping in one batch, ahead of processing them.
+    // anything that isn't decrypted here (no mapping yet, mapping changed by an earlier packet in the batch) takes the regular path
+
+    int num_items = 0;
+
+    for ( int i = 0; i < num_packets; ++i )
+    {
+        server->receive_decrypted[i] = 0;
+
+        if ( packet_bytes[i] <= 0 || packet_data[i][0] == SNAPSHOT_CONNECTION_REQUEST_PACKET || packet_data[i][0] == SNAPSHOT_CONNECTION_RESPONSE_PACKET )
+            continue;
 
-        case SNAPSHOT_DISCONNECT_PACKET:
+        int encryption_index = -1;
+        const int client_index = snapshot_server_find_client_index_by_address( server, &from[i] );
+        if ( client_index != -1 )
         {
-            server->counters[SNAPSHOT_SERVER_COUNTER_DISCONNECT_PACKETS_RECEIVED]++;
-
-            if ( client_index != -1 )
-            {
-                snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server received disconnect packet from client %d", client_index );
-                snapshot_server_disconnect_client_internal( server, client_index, 0 );
-                return SNAPSHOT_TRUE;
-           }
+            encryption_index = server->client_encryption_index[client_index];
+        }
+        else
+        {
+            encryption_index = snapshot_encryption_manager_find_encryption_mapping( server->encryption_manager, &from[i], server->time );
         }
-        break;
 
-        default:
-            break;
+        const uint8_t * key = snapshot_encryption_manager_get_receive_key( server->encryption_manager, encryption_index );
+        if ( !key || snapshot_encryption_manager_get_cipher_suite( server->encryption_manager, encryption_index ) != SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 )
+            continue;
+
+        if ( snapshot_packet_crypto_setup( packet_data[i], packet_bytes[i], key, server->config.protocol_id, 0, &server->receive_crypto[num_items], &server->receive_crypto_items[num_items] ) != SNAPSHOT_OK )
+            continue;
+
+        server->receive_crypto_packet_index[num_items] = i;
+
+        num_items++;
     }
 
-    return SNAPSHOT_FALSE;
+    if ( num_items == 0 )
+        return;
+
+    snapshot_crypto_decrypt_aead_batch( server->receive_crypto_items, num_items );
+
+    for ( int i = 0; i < num_items; ++i )
+    {
+        if ( server->receive_crypto_items[i].result == SNAPSHOT_OK )
+        {
+            server->receive_decrypted[server->receive_crypto_packet_index[i]] = 1;
+            server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_DECRYPTED_BATCH]++;
+        }
+    }
 }
 
 void snapshot_server_receive_packets( struct snapshot_server_t * server )
@@ -1015,44 +2354,101 @@ void snapshot_server_receive_packets( struct snapshot_server_t * server )
 
         int num_packets_received = snapshot_network_simulator_receive_packets( server->config.network_simulator, 
                                                                                &server->address, 
-                                                                               SNAPSHOT_SERVER_MAX_SIM_RECEIVE_PACKETS, 
+                                                                               server->max_sim_receive_packets, 
                                                                                server->sim_receive_packet_data, 
                                                                                server->sim_receive_packet_bytes, 
                                                                                server->sim_receive_from );
 
-        int i;
-        for ( i = 0; i < num_packets_received; ++i )
+        for ( int base = 0; base < num_packets_received; base += SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE )
         {
-            server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_RECEIVED_SIMULATOR]++;
-            snapshot_server_process_packet( server, &server->sim_receive_from[i], server->sim_receive_packet_data[i], server->sim_receive_packet_bytes[i] );
-            snapshot_destroy_packet( server->config.context, server->sim_receive_packet_data[i] );
+            const int num_packets = ( num_packets_received - base < SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE ) ? num_packets_received - base : SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE;
+
+            snapshot_server_admit_packets( server, &server->sim_receive_from[base], &server->sim_receive_packet_data[base], &server->sim_receive_packet_bytes[base], num_packets );
+
+            snapshot_server_decrypt_packets( server, &server->sim_receive_from[base], &server->sim_receive_packet_data[base], &server->sim_receive_packet_bytes[base], num_packets );
+
+            for ( int i = 0; i < num_packets; ++i )
+            {
+                if ( server->sim_receive_packet_bytes[base+i] > 0 )
+                {
+                    server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_RECEIVED_SIMULATOR]++;
+                    snapshot_server_process_packet_internal( server, &server->sim_receive_from[base+i], server->sim_receive_packet_data[base+i], server->sim_receive_packet_bytes[base+i], server->receive_decrypted[i] );
+                }
+                snapshot_destroy_packet( server->config.context, server->sim_receive_packet_data[base+i] );
+            }
         }
     }
     else
 #endif // #if SNAPSHOT_DEVELOPMENT
+    if ( server->io_thread )
     {
-        // process packets received from socket
+        // process packets the io thread has already received. only drain what is queued now, so a flood can't stall the update
 
-        while ( 1 )
+        const int queue_depth = snapshot_io_thread_receive_queue_depth( server->io_thread );
+
+        server->counters[SNAPSHOT_SERVER_COUNTER_IO_RECEIVE_QUEUE_DEPTH] = queue_depth;
+
+        int num_packets_remaining = queue_depth;
+
+        while ( num_packets_remaining > 0 )
         {
-            struct snapshot_address_t from;
-            
-            uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
-            uint8_t* packet_data = buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+            const int max_packets = ( num_packets_remaining < SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE ) ? num_packets_remaining : SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE;
+
+            uint8_t * packet_data[SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE];
+
+            const int num_packets = snapshot_io_thread_receive_packets( server->io_thread, server->receive_from, packet_data, server->receive_packet_bytes, max_packets );
+
+            snapshot_server_admit_packets( server, server->receive_from, packet_data, server->receive_packet_bytes, num_packets );
 
-            int packet_bytes = 0;
-            
-            if ( server->socket != NULL )
+            snapshot_server_decrypt_packets( server, server->receive_from, packet_data, server->receive_packet_bytes, num_packets );
+
+            for ( int i = 0; i < num_packets; ++i )
             {
-                packet_bytes = snapshot_platform_socket_receive_packet( server->socket, &from, packet_data + SNAPSHOT_PACKET_PREFIX_BYTES, SNAPSHOT_MAX_PACKET_BYTES );
+                if ( server->receive_packet_bytes[i] == 0 )
+                    continue;
+
+                server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_RECEIVED]++;
+
+                snapshot_server_process_packet_internal( server, &server->receive_from[i], packet_data[i], server->receive_packet_bytes[i], server->receive_decrypted[i] );
             }
 
-            if ( packet_bytes == 0 )
-                break;
+            snapshot_io_thread_release_packets( server->io_thread, num_packets );
+
+            num_packets_remaining -= num_packets;
+        }
+    }
+    else
+    {
+        // process packets received from socket, draining it in batches
+
+        if ( server->socket == NULL )
+            return;
+
+        while ( 1 )
+        {
+            int num_packets = snapshot_platform_socket_receive_packets( server->socket, 
+                                                                        server->receive_from, 
+                                                                        server->receive_packet_data, 
+                                                                        server->receive_packet_bytes, 
+                                                                        SNAPSHOT_MAX_PACKET_BYTES, 
+                                                                        SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE );
+
+            snapshot_server_admit_packets( server, server->receive_from, server->receive_packet_data, server->receive_packet_bytes, num_packets );
+
+            snapshot_server_decrypt_packets( server, server->receive_from, server->receive_packet_data, server->receive_packet_bytes, num_packets );
 
-            server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_RECEIVED]++;
+            for ( int i = 0; i < num_packets; ++i )
+            {
+                if ( server->receive_packet_bytes[i] == 0 )
+                    continue;
+
+                server->counters[SNAPSHOT_SERVER_COUNTER_PACKETS_RECEIVED]++;
+
+                snapshot_server_process_packet_internal( server, &server->receive_from[i], server->receive_packet_data[i], server->receive_packet_bytes[i], server->receive_decrypted[i] );
+            }
 
-            snapshot_server_process_packet( server, &from, packet_data + SNAPSHOT_PACKET_PREFIX_BYTES, packet_bytes );
+            if ( num_packets < SNAPSHOT_SERVER_RECEIVE_BATCH_SIZE )
+                break;
         }
     }
 }
@@ -1070,8 +2466,8 @@ void snapshot_server_send_packets( struct snapshot_server_t * server )
             snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server sent keep alive packet to client %d", i );
             struct snapshot_keep_alive_packet_t packet;
             packet.packet_type = SNAPSHOT_KEEP_ALIVE_PACKET;
-            packet.client_index = i;
-            packet.max_clients = server->max_clients;
+            packet.client_index = server->shard_client_index_offset + i;
+            packet.max_clients = server->shard_max_clients;
             snapshot_server_send_packet_to_client( server, i, &packet );
             server->counters[SNAPSHOT_SERVER_COUNTER_KEEP_ALIVE_PACKETS_SENT]++;
             server->client_last_internal_packet_send_time[i] = server->time;
@@ -1099,6 +2495,11 @@ int snapshot_server_client_connected( struct snapshot_server_t * server, int cli
 {
     snapshot_assert( server );
 
+    if ( server->shards && client_index >= 0 && client_index < server->max_clients )
+    {
+        server = snapshot_server_find_shard( server, &client_index );
+    }
+
     if ( client_index < 0 || client_index >= server->max_clients )
         return 0;
 
@@ -1109,6 +2510,11 @@ uint64_t snapshot_server_client_id( struct snapshot_server_t * server, int clien
 {
     snapshot_assert( server );
 
+    if ( server->shards && client_index >= 0 && client_index < server->max_clients )
+    {
+        server = snapshot_server_find_shard( server, &client_index );
+    }
+
     if ( client_index < 0 || client_index >= server->max_clients )
         return 0;
 
@@ -1119,6 +2525,11 @@ struct snapshot_address_t * snapshot_server_client_address( struct snapshot_serv
 {
     snapshot_assert( server );
 
+    if ( server->shards && client_index >= 0 && client_index < server->max_clients )
+    {
+        server = snapshot_server_find_shard( server, &client_index );
+    }
+
     if (client_index < 0 || client_index >= server->max_clients)
         return NULL;
 
@@ -1128,6 +2539,17 @@ struct snapshot_address_t * snapshot_server_client_address( struct snapshot_serv
 int snapshot_server_num_connected_clients( struct snapshot_server_t * server )
 {
     snapshot_assert( server );
+
+    if ( server->shards )
+    {
+        int num_connected_clients = 0;
+        for ( int i = 0; i < server->num_shards; i++ )
+        {
+            num_connected_clients += server->shards[i].server->num_connected_clients;
+        }
+        return num_connected_clients;
+    }
+
     return server->num_connected_clients;
 }
 
@@ -1136,12 +2558,15 @@ void * snapshot_server_client_user_data( struct snapshot_server_t * server, int
     snapshot_assert( server );
     snapshot_assert( client_index >= 0 );
     snapshot_assert( client_index < server->max_clients );
+
+    server = snapshot_server_find_shard( server, &client_index );
+
     return server->client_user_data[client_index];
 }
 
 int snapshot_server_connected_clients( struct snapshot_server_t * server )
 {
-    return server->num_connected_clients;
+    return snapshot_server_num_connected_clients( server );
 }
 
 int snapshot_server_max_clients( struct snapshot_server_t * server )
@@ -1149,6 +2574,98 @@ int snapshot_server_max_clients( struct snapshot_server_t * server )
     return server->max_clients;
 }
 
+size_t snapshot_server_memory_bytes( struct snapshot_server_t * server )
+{
+    snapshot_assert( server );
+
+    size_t memory_bytes = server->memory_bytes;
+
+    // the packet pool grows with traffic, so it's read at call time rather than added up front
+
+    if ( server->packet_pool )
+    {
+        memory_bytes += snapshot_packet_pool_memory_bytes( server->packet_pool );
+    }
+
+    if ( server->shards )
+    {
+        for ( int i = 0; i < server->num_shards; i++ )
+        {
+            memory_bytes += snapshot_server_memory_bytes( server->shards[i].server );
+        }
+    }
+
+    return memory_bytes;
+}
+
+static size_t snapshot_server_client_memory_bytes( struct snapshot_server_t * server )
+{
+    snapshot_assert( server );
+
+    size_t client_memory_bytes = server->client_memory_bytes;
+
+    if ( server->shards )
+    {
+        for ( int i = 0; i < server->num_shards; i++ )
+        {
+            client_memory_bytes += snapshot_server_client_memory_bytes( server->shards[i].server );
+        }
+    }
+
+    return client_memory_bytes;
+}
+
+size_t snapshot_server_memory_bytes_fixed( struct snapshot_server_t * server )
+{
+    snapshot_assert( server );
+
+    return snapshot_server_memory_bytes( server ) - snapshot_server_client_memory_bytes( server );
+}
+
+size_t snapshot_server_memory_bytes_per_client( struct snapshot_server_t * server )
+{
+    snapshot_assert( server );
+
+    if ( server->max_clients <= 0 )
+        return 0;
+
+    return snapshot_server_client_memory_bytes( server ) / server->max_clients;
+}
+
+static void snapshot_server_send_payload_fragments( struct snapshot_server_t * server, int client_index, uint8_t * payload_data, int payload_bytes )
+{
+    // fragments are written in place inside the payload, one after the other, so no fragment buffers are allocated. each
+    // datagram is still copied once when it is queued, into the send queue or the io thread ring. fragments overlap in
+    // place, and queued packets are only batch encrypted when the queue is flushed, so the slices can't be sent from here
+
+    int num_fragments = 0;
+    struct snapshot_endpoint_fragment_t fragments[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+    snapshot_endpoint_write_fragments( server->client_endpoint[client_index], payload_data, payload_bytes, &num_fragments, &fragments[0] );
+
+    if ( num_fragments > 1 )
+    {
+        snapshot_server_reserve_packets( server, num_fragments );
+    }
+
+    for ( int i = 0; i < num_fragments; i++ )
+    {
+        int packet_bytes = 0;
+
+        uint8_t * packet_data = snapshot_endpoint_fragment_begin( &fragments[i], &packet_bytes );
+
+        void * packet = snapshot_wrap_payload_packet( packet_data, packet_bytes );
+
+        snapshot_server_send_packet_to_client( server, client_index, packet );
+
+        snapshot_endpoint_fragment_end( &fragments[i] );
+
+        server->counters[SNAPSHOT_SERVER_COUNTER_PAYLOAD_PACKETS_SENT]++;
+    }
+
+    server->counters[SNAPSHOT_SERVER_COUNTER_PAYLOADS_SENT]++;
+}
+
 void snapshot_server_send_payload_to_client( struct snapshot_server_t * server, int client_index )
 {
     snapshot_assert( server );
@@ -1164,53 +2681,89 @@ void snapshot_server_send_payload_to_client( struct snapshot_server_t * server,
 
     if ( server->development_flags & SNAPSHOT_DEVELOPMENT_FLAG_VALIDATE_PAYLOAD )
     {
-        uint8_t * payload_data = snapshot_create_packet( server->config.context, SNAPSHOT_MAX_PAYLOAD_BYTES );
+        uint8_t * payload_data = snapshot_create_pooled_packet( server->config.context, server->packet_pool, SNAPSHOT_MAX_PAYLOAD_BYTES );
+        if ( !payload_data )
+        {
+            snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server could not allocate test payload for client %d", client_index );
+            return;
+        }
 
         int payload_bytes = 0;
 
         snapshot_generate_packet_data( payload_data, &payload_bytes, SNAPSHOT_MAX_PAYLOAD_BYTES );
 
-        int num_packets = 0;
-        uint8_t * packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
-        int packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        snapshot_server_send_payload_fragments( server, client_index, payload_data, payload_bytes );
 
-        snapshot_endpoint_write_packets( server->client_endpoint[client_index], payload_data, payload_bytes, &num_packets, &packet_data[0], &packet_bytes[0] );
+        snapshot_destroy_packet( server->config.context, payload_data );
 
-        if ( num_packets == 1 )
-        {
-            // send whole packet
+        return;
+    }
+#endif // #if SNAPSHOT_DEVELOPMENT
 
-            struct snapshot_payload_packet_t * packet = snapshot_wrap_payload_packet( packet_data[0], packet_bytes[0] );
+    if ( !server->client_delta_encoder || !server->has_snapshot )
+        return;
 
-            snapshot_server_send_packet_to_client( server, client_index, packet );
+    // the newest snapshot the client acked since the last send becomes the baseline for this one
 
-            server->counters[SNAPSHOT_SERVER_COUNTER_PAYLOAD_PACKETS_SENT]++;
-        }
-        else
-        {
-            // send fragments
+    struct snapshot_endpoint_t * endpoint = server->client_endpoint[client_index];
+    struct snapshot_delta_encoder_t * delta_encoder = server->client_delta_encoder[client_index];
 
-            for ( int i = 0; i < num_packets; i++ )
-            {
-                struct snapshot_payload_packet_t * packet = snapshot_wrap_payload_packet( packet_data[i], packet_bytes[i] );
+    int num_acks = 0;
+    uint16_t * acks = snapshot_endpoint_get_acks( endpoint, &num_acks );
+    snapshot_delta_encoder_process_acks( delta_encoder, acks, num_acks );
 
-                snapshot_server_send_packet_to_client( server, client_index, packet );
+    struct snapshot_range_encoder_t * range_encoder = server->client_range_encoder ? server->client_range_encoder[client_index] : NULL;
+    if ( range_encoder )
+    {
+        snapshot_range_encoder_process_acks( range_encoder, acks, num_acks );
+    }
 
-                server->counters[SNAPSHOT_SERVER_COUNTER_PAYLOAD_PACKETS_SENT]++;
+    snapshot_endpoint_clear_acks( endpoint );
 
-                snapshot_destroy_packet( server->config.context, packet_data[i] );
-            }
-        }
+    const uint16_t sequence = snapshot_endpoint_sequence( endpoint );
 
-        snapshot_destroy_packet( server->config.context, payload_data );
+    int delta_bytes = 0;
+    int delta_encoding = 0;
+    const uint8_t * delta_data = snapshot_delta_encoder_write( delta_encoder, sequence, server->snapshot_data, &delta_bytes, &delta_encoding );
 
-        server->counters[SNAPSHOT_SERVER_COUNTER_PAYLOADS_SENT]++;
+    // entropy code the delta before it is split into fragments, so fewer bytes means fewer packets to encrypt
+
+    const uint8_t * snapshot_data = delta_data;
+    int snapshot_bytes = delta_bytes;
+
+    if ( range_encoder )
+    {
+        snapshot_data = snapshot_range_encoder_write( range_encoder, sequence, delta_data, delta_bytes, &snapshot_bytes );
+        if ( snapshot_bytes < delta_bytes )
+        {
+            server->counters[SNAPSHOT_SERVER_COUNTER_SNAPSHOT_RANGE_CODER_BYTES_SAVED] += delta_bytes - snapshot_bytes;
+        }
+    }
+
+    uint8_t * payload_data = snapshot_create_pooled_packet( server->config.context, server->packet_pool, snapshot_bytes );
+    if ( !payload_data )
+    {
+        // the delta encoder only remembers this snapshot under the endpoint sequence, which does not advance
+        // until something is sent, so the next send overwrites it and dropping the snapshot here is safe
 
+        snapshot_printf( SNAPSHOT_LOG_LEVEL_DEBUG, "server dropped snapshot for client %d. could not allocate payload", client_index );
         return;
     }
-#endif // #if SNAPSHOT_DEVELOPMENT
 
-    // todo: generate real payload
+    memcpy( payload_data, snapshot_data, snapshot_bytes );
+
+    snapshot_server_send_payload_fragments( server, client_index, payload_data, snapshot_bytes );
+
+    snapshot_destroy_packet( server->config.context, payload_data );
+
+    if ( delta_encoding == SNAPSHOT_DELTA_ENCODING_DELTA )
+    {
+        server->counters[SNAPSHOT_SERVER_COUNTER_SNAPSHOT_DELTAS_SENT]++;
+    }
+    else
+    {
+        server->counters[SNAPSHOT_SERVER_COUNTER_SNAPSHOT_KEYFRAMES_SENT]++;
+    }
 }
 
 void snapshot_server_send_payloads( struct snapshot_server_t * server )
@@ -1225,10 +2778,28 @@ void snapshot_server_send_payloads( struct snapshot_server_t * server )
 void snapshot_server_update( struct snapshot_server_t * server, double time )
 {
     snapshot_assert( server );
+    if ( server->shards )
+    {
+        snapshot_server_update_shards( server, time );
+        return;
+    }
     server->time = time;
     snapshot_server_receive_packets( server );
+    snapshot_server_process_handshakes( server );
     snapshot_server_send_payloads( server );
     snapshot_server_send_packets( server );
+    if ( server->io_thread )
+    {
+        uint64_t io_counters[SNAPSHOT_IO_THREAD_NUM_COUNTERS];
+        snapshot_io_thread_counters( server->io_thread, io_counters );
+        server->counters[SNAPSHOT_SERVER_COUNTER_IO_SEND_QUEUE_DEPTH] = snapshot_io_thread_send_queue_depth( server->io_thread );
+        server->counters[SNAPSHOT_SERVER_COUNTER_IO_RECEIVE_QUEUE_DROPS] = io_counters[SNAPSHOT_IO_THREAD_COUNTER_RECEIVE_QUEUE_DROPS];
+        server->counters[SNAPSHOT_SERVER_COUNTER_IO_SEND_QUEUE_DROPS] = io_counters[SNAPSHOT_IO_THREAD_COUNTER_SEND_QUEUE_DROPS];
+    }
+    else
+    {
+        snapshot_server_flush_packets( server );
+    }
     snapshot_server_check_for_timeouts( server );
 }
 
@@ -1237,17 +2808,23 @@ void snapshot_server_connect_loopback_client( struct snapshot_server_t * server,
     snapshot_assert( server );
     snapshot_assert( client_index >= 0 );
     snapshot_assert( client_index < server->max_clients );
+
+    server = snapshot_server_find_shard( server, &client_index );
+
     snapshot_assert( !server->client_connected[client_index] );
 
     server->num_connected_clients++;
 
     snapshot_assert( server->num_connected_clients <= server->max_clients );
 
+    snapshot_server_lock_client_ids( server );
     server->client_connected[client_index] = 1;
+    server->client_id[client_index] = client_id;
+    snapshot_server_unlock_client_ids( server );
+
     server->client_loopback[client_index] = 1;
     server->client_confirmed[client_index] = 1;
     server->client_encryption_index[client_index] = -1;
-    server->client_id[client_index] = client_id;
     server->client_sequence[client_index] = 0;
     memset( &server->client_address[client_index], 0, sizeof( struct snapshot_address_t ) );
     server->client_last_internal_packet_send_time[client_index] = server->time - 1.0;
@@ -1264,10 +2841,7 @@ void snapshot_server_connect_loopback_client( struct snapshot_server_t * server,
 
     snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server connected loopback client [%.16" PRIx64 "] in slot %d", client_id, client_index );
 
-    if ( server->config.connect_disconnect_callback )
-    {
-        server->config.connect_disconnect_callback( server->config.context, client_index, 1 );
-    }
+    snapshot_server_connect_disconnect_callback( server, client_index, 1 );
 
     server->counters[SNAPSHOT_SERVER_COUNTER_CLIENT_LOOPBACK_CONNECTS]++;
 }
@@ -1277,20 +2851,20 @@ void snapshot_server_disconnect_loopback_client( struct snapshot_server_t * serv
     snapshot_assert( server );
     snapshot_assert( client_index >= 0 );
     snapshot_assert( client_index < server->max_clients );
+
+    server = snapshot_server_find_shard( server, &client_index );
+
     snapshot_assert( server->client_connected[client_index] );
     snapshot_assert( server->client_loopback[client_index] );
 
     snapshot_printf( SNAPSHOT_LOG_LEVEL_INFO, "server disconnected loopback client %d", client_index );
 
-    if ( server->config.connect_disconnect_callback )
-    {
-        server->config.connect_disconnect_callback( server->config.context, client_index, 0 );
-    }
+    snapshot_server_connect_disconnect_callback( server, client_index, 0 );
+
+    snapshot_server_release_client_slot( server, client_index );
 
-    server->client_connected[client_index] = 0;
     server->client_loopback[client_index] = 0;
     server->client_confirmed[client_index] = 0;
-    server->client_id[client_index] = 0;
     server->client_sequence[client_index] = 0;
     server->client_last_internal_packet_send_time[client_index] = 0.0;
     server->client_last_packet_receive_time[client_index] = 0.0;
@@ -1310,6 +2884,9 @@ void snapshot_server_send_passthrough_packet( struct snapshot_server_t * server,
     snapshot_assert( server );
     snapshot_assert( client_index >= 0 );
     snapshot_assert( client_index < server->max_clients );
+
+    server = snapshot_server_find_shard( server, &client_index );
+
     snapshot_assert( passthrough_data );
     snapshot_assert( passthrough_bytes > 0 );
 
@@ -1331,6 +2908,9 @@ int snapshot_server_client_loopback( struct snapshot_server_t * server, int clie
     snapshot_assert( server );
     snapshot_assert( client_index >= 0 );
     snapshot_assert( client_index < server->max_clients );
+
+    server = snapshot_server_find_shard( server, &client_index );
+
     return server->client_loopback[client_index];
 }
 
@@ -1344,6 +2924,34 @@ void snapshot_server_set_flags( struct snapshot_server_t * server, uint64_t flag
 {
     snapshot_assert( server );
     server->flags = flags;
+    for ( int i = 0; server->shards && i < server->num_shards; i++ )
+    {
+        snapshot_server_set_flags( server->shards[i].server, flags );
+    }
+}
+
+void snapshot_server_set_snapshot( struct snapshot_server_t * server, const uint8_t * snapshot_data, int snapshot_bytes )
+{
+    snapshot_assert( server );
+
+    if ( server->shards )
+    {
+        for ( int i = 0; i < server->num_shards; i++ )
+        {
+            snapshot_server_set_snapshot( server->shards[i].server, snapshot_data, snapshot_bytes );
+        }
+        return;
+    }
+    snapshot_assert( snapshot_data );
+    snapshot_assert( server->snapshot_data );
+    snapshot_assert( snapshot_bytes == server->config.snapshot_bytes );
+
+    if ( !server->snapshot_data || snapshot_bytes != server->config.snapshot_bytes )
+        return;
+
+    memcpy( server->snapshot_data, snapshot_data, snapshot_bytes );
+
+    server->has_snapshot = SNAPSHOT_TRUE;
 }
 
 #if SNAPSHOT_DEVELOPMENT
@@ -1352,6 +2960,10 @@ void snapshot_server_set_development_flags( struct snapshot_server_t * server, u
 {
     snapshot_assert( server );
     server->development_flags = flags;
+    for ( int i = 0; server->shards && i < server->num_shards; i++ )
+    {
+        snapshot_server_set_development_flags( server->shards[i].server, flags );
+    }
 }
 
 #endif // #if SNAPSHOT_DEVELOPMENT
@@ -1359,5 +2971,50 @@ void snapshot_server_set_development_flags( struct snapshot_server_t * server, u
 const uint64_t * snapshot_server_counters( struct snapshot_server_t * server )
 {
     snapshot_assert( server );
+
+    if ( server->shards )
+    {
+        memset( server->counters, 0, sizeof( server->counters ) );
+
+        for ( int i = 0; i < server->num_shards; i++ )
+        {
+            const uint64_t * shard_counters = server->shards[i].server->counters;
+            for ( int j = 0; j < SNAPSHOT_SERVER_NUM_COUNTERS; j++ )
+            {
+                server->counters[j] += shard_counters[j];
+            }
+        }
+
+        // every shard reports the same isa, so it doesn't sum
+
+        server->counters[SNAPSHOT_SERVER_COUNTER_CRYPTO_ISA] = (uint64_t) snapshot_crypto_isa();
+    }
+
     return server->counters;
 }
+
+const uint64_t * snapshot_server_packet_pool_counters( struct snapshot_server_t * server )
+{
+    snapshot_assert( server );
+
+    if ( server->shards )
+    {
+        if ( !server->config.packet_pool )
+            return NULL;
+
+        memset( server->shard_packet_pool_counters, 0, sizeof( server->shard_packet_pool_counters ) );
+
+        for ( int i = 0; i < server->num_shards; i++ )
+        {
+            const uint64_t * shard_counters = snapshot_server_packet_pool_counters( server->shards[i].server );
+            for ( int j = 0; shard_counters && j < SNAPSHOT_PACKET_POOL_NUM_COUNTERS; j++ )
+            {
+                server->shard_packet_pool_counters[j] += shard_counters[j];
+            }
+        }
+
+        return server->shard_packet_pool_counters;
+    }
+
+    return server->packet_pool ? snapshot_packet_pool_counters( server->packet_pool ) : NULL;
+}
@@ -15,6 +15,7 @@
 #include "snapshot_crypto.h"
 #include "snapshot_platform.h"
 #include "snapshot_address.h"
+#include "snapshot_address_index.h"
 #include "snapshot_read_write.h"
 #include "snapshot_bitpacker.h"
 #include "snapshot_connect_token.h"
@@ -27,9 +28,18 @@
 #include "snapshot_encryption_manager.h"
 #include "snapshot_replay_protection.h"
 #include "snapshot_sequence_buffer.h"
+#include "snapshot_packed_sequence_buffer.h"
+#include "snapshot_delta.h"
+#include "snapshot_range_coder.h"
+#include "snapshot_schema.h"
 #include "snapshot_packet_header.h"
 #include "snapshot_endpoint.h"
 #include "snapshot_base64.h"
+#include "snapshot_io_thread.h"
+#include "snapshot_packet_pool.h"
+#include "snapshot_handshake.h"
+#include "snapshot_connect_token_table.h"
+#include "snapshot_rate_limiter.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -256,6 +266,104 @@ void test_address()
 #endif // #if SNAPSHOT_PLATFORM_HAS_IPV6
 }
 
+void test_address_index()
+{
+    const int NumKeys = 200;
+    const int NumSlots = 512;
+
+    struct snapshot_address_t keys[NumKeys];
+    int slots[NumSlots];
+    SNAPSHOT_BOOL present[NumKeys];
+
+    memset( keys, 0, sizeof( keys ) );
+    memset( present, 0, sizeof( present ) );
+
+    for ( int i = 0; i < NumKeys; i++ )
+    {
+        if ( i % 2 )
+        {
+            keys[i].type = SNAPSHOT_ADDRESS_IPV4;
+            keys[i].data.ipv4[0] = 10;
+            keys[i].data.ipv4[3] = (uint8_t) ( i % 4 );
+        }
+        else
+        {
+            keys[i].type = SNAPSHOT_ADDRESS_IPV6;
+            keys[i].data.ipv6[0] = 0xfe80;
+            keys[i].data.ipv6[7] = (uint16_t) ( i % 4 );
+        }
+        keys[i].port = (uint16_t) ( 30000 + i / 4 );
+    }
+
+    struct snapshot_address_index_t index;
+    snapshot_address_index_init( &index, slots, NumSlots, keys );
+
+    for ( int i = 0; i < NumKeys; i++ )
+    {
+        snapshot_check( snapshot_address_index_find( &index, &keys[i] ) == -1 );
+    }
+
+    // randomly add and remove keys, and make sure every lookup agrees with a linear scan
+
+    for ( int iteration = 0; iteration < 10000; iteration++ )
+    {
+        const int key_index = rand() % NumKeys;
+
+        if ( present[key_index] )
+        {
+            snapshot_check( snapshot_address_index_remove( &index, key_index ) );
+            present[key_index] = SNAPSHOT_FALSE;
+            snapshot_check( !snapshot_address_index_remove( &index, key_index ) );
+        }
+        else
+        {
+            snapshot_address_index_insert( &index, key_index );
+            present[key_index] = SNAPSHOT_TRUE;
+        }
+
+        if ( ( iteration % 100 ) == 0 )
+        {
+            int num_present = 0;
+            for ( int i = 0; i < NumKeys; i++ )
+            {
+                const int result = snapshot_address_index_find( &index, &keys[i] );
+                snapshot_check( result == ( present[i] ? i : -1 ) );
+                num_present += present[i] ? 1 : 0;
+            }
+            snapshot_check( index.num_entries == num_present );
+        }
+    }
+
+    // duplicate addresses are allowed, and can be walked with find next
+
+    snapshot_address_index_clear( &index );
+
+    keys[1] = keys[0];
+    keys[2] = keys[0];
+
+    snapshot_address_index_insert( &index, 0 );
+    snapshot_address_index_insert( &index, 1 );
+    snapshot_address_index_insert( &index, 2 );
+
+    int found = 0;
+    int iterator = -1;
+    int key_index;
+    while ( ( key_index = snapshot_address_index_find_next( &index, &keys[0], &iterator ) ) != -1 )
+    {
+        snapshot_check( key_index >= 0 && key_index <= 2 );
+        found |= 1 << key_index;
+    }
+    snapshot_check( found == 7 );
+
+    snapshot_check( snapshot_address_index_remove( &index, 1 ) );
+    snapshot_check( snapshot_address_index_find( &index, &keys[0] ) != 1 );
+    snapshot_check( snapshot_address_index_find( &index, &keys[0] ) != -1 );
+
+    struct snapshot_address_t none;
+    memset( &none, 0, sizeof( none ) );
+    snapshot_check( snapshot_address_index_find( &index, &none ) == -1 );
+}
+
 void test_read_and_write()
 {
     uint8_t buffer[1024];
@@ -362,6 +470,116 @@ void test_bitpacker()
     snapshot_check( g == 9999999 );
 }
 
+void test_bitpacker_array()
+{
+    const int BufferSize = 1024;
+
+    uint8_t buffer[BufferSize];
+    uint8_t expected[BufferSize];
+
+    uint32_t values[100];
+    uint32_t output[100];
+
+    const int counts[] = { 0, 5, 32, 100 };
+    const int lead_bits[] = { 0, 3, 8, 17 };
+
+    for ( int bits = 1; bits <= 32; bits++ )
+    {
+        for ( int i = 0; i < (int) ( sizeof(counts) / sizeof(int) ); i++ )
+        {
+            for ( int j = 0; j < (int) ( sizeof(lead_bits) / sizeof(int) ); j++ )
+            {
+                const int count = counts[i];
+
+                for ( int k = 0; k < count; k++ )
+                {
+                    values[k] = ( (uint32_t) rand() ^ ( (uint32_t) rand() << 16 ) ) & (uint32_t) ( ( 1ULL << bits ) - 1 );
+                }
+
+                // the array must come out bit for bit the same as writing the values one at a time
+
+                memset( buffer, 0, sizeof(buffer) );
+                memset( expected, 0, sizeof(expected) );
+
+                struct snapshot_bitwriter_t writer;
+                snapshot_bitwriter_init( &writer, buffer, BufferSize );
+                if ( lead_bits[j] )
+                {
+                    snapshot_bitwriter_write_bits( &writer, 1, lead_bits[j] );
+                }
+                snapshot_bitwriter_write_array( &writer, values, count, bits );
+                snapshot_bitwriter_write_bits( &writer, 0x5, 3 );
+                snapshot_bitwriter_flush_bits( &writer );
+
+                struct snapshot_bitwriter_t expected_writer;
+                snapshot_bitwriter_init( &expected_writer, expected, BufferSize );
+                if ( lead_bits[j] )
+                {
+                    snapshot_bitwriter_write_bits( &expected_writer, 1, lead_bits[j] );
+                }
+                for ( int k = 0; k < count; k++ )
+                {
+                    snapshot_bitwriter_write_bits( &expected_writer, values[k], bits );
+                }
+                snapshot_bitwriter_write_bits( &expected_writer, 0x5, 3 );
+                snapshot_bitwriter_flush_bits( &expected_writer );
+
+                const int bytes_written = snapshot_bitwriter_get_bytes_written( &writer );
+
+                snapshot_check( bytes_written == snapshot_bitwriter_get_bytes_written( &expected_writer ) );
+                snapshot_check( memcmp( buffer, expected, bytes_written ) == 0 );
+
+                struct snapshot_bitreader_t reader;
+                snapshot_bitreader_init( &reader, buffer, bytes_written );
+                if ( lead_bits[j] )
+                {
+                    snapshot_check( snapshot_bitreader_read_bits( &reader, lead_bits[j] ) == 1 );
+                }
+                snapshot_check( !snapshot_bitreader_would_read_past_end( &reader, count * bits ) );
+                memset( output, 0, sizeof(output) );
+                snapshot_bitreader_read_array( &reader, output, count, bits );
+                snapshot_check( memcmp( output, values, count * sizeof(uint32_t) ) == 0 );
+                snapshot_check( snapshot_bitreader_read_bits( &reader, 3 ) == 0x5 );
+            }
+        }
+    }
+
+    // byte runs with unaligned heads and tails
+
+    for ( int head = 0; head < 4; head++ )
+    {
+        for ( int bytes = 0; bytes < 12; bytes++ )
+        {
+            uint8_t data[12];
+            uint8_t data_output[12];
+            for ( int i = 0; i < bytes; i++ )
+            {
+                data[i] = (uint8_t) rand();
+            }
+
+            struct snapshot_bitwriter_t writer;
+            snapshot_bitwriter_init( &writer, buffer, BufferSize );
+            for ( int i = 0; i < head; i++ )
+            {
+                snapshot_bitwriter_write_bits( &writer, i, 8 );
+            }
+            snapshot_bitwriter_write_bytes( &writer, data, bytes );
+            snapshot_bitwriter_write_bits( &writer, 0xFF, 8 );
+            snapshot_bitwriter_flush_bits( &writer );
+
+            struct snapshot_bitreader_t reader;
+            snapshot_bitreader_init( &reader, buffer, snapshot_bitwriter_get_bytes_written( &writer ) );
+            for ( int i = 0; i < head; i++ )
+            {
+                snapshot_check( snapshot_bitreader_read_bits( &reader, 8 ) == (uint32_t) i );
+            }
+            snapshot_bitreader_read_bytes( &reader, data_output, bytes );
+            snapshot_check( memcmp( data, data_output, bytes ) == 0 );
+            snapshot_check( snapshot_bitreader_read_bits( &reader, 8 ) == 0xFF );
+        }
+    }
+}
+
 void test_bits_required()
 {
     snapshot_check( snapshot_bits_required( 0, 0 ) == 0 );
@@ -378,6 +596,122 @@ void test_bits_required()
     snapshot_check( snapshot_bits_required( 0, 4294967295U ) == 32 );
 }
 
+#define TEST_SCHEMA_PLAYER( FIELD, OPTIONAL )                                                   \
+    FIELD( INT, health, ( 0, 100 ) )                                                            \
+    FIELD( INT, team, ( -1, 6 ) )                                                               \
+    FIELD( FLOAT, position_x, ( -1000.0f, 1000.0f, 0.01f ) )                                    \
+    FIELD( FLOAT, position_y, ( -1000.0f, 1000.0f, 0.01f ) )                                    \
+    FIELD( FLOAT, position_z, ( -100.0f, 100.0f, 0.01f ) )                                      \
+    FIELD( QUATERNION, orientation, ( 9 ) )                                                     \
+    FIELD( BOOL, crouching, () )                                                                \
+    OPTIONAL( INT, weapon, ( 0, 15 ) )                                                          \
+    OPTIONAL( FLOAT, aim, ( 0.0f, 1.0f, 0.001f ) )
+
+SNAPSHOT_SCHEMA_STRUCT( test_schema_player, TEST_SCHEMA_PLAYER )
+SNAPSHOT_SCHEMA_FUNCTIONS( test_schema_player, TEST_SCHEMA_PLAYER )
+
+void test_schema()
+{
+    snapshot_check( SNAPSHOT_SCHEMA_BITS_REQUIRED( 0 ) == 0 );
+    snapshot_check( SNAPSHOT_SCHEMA_BITS_REQUIRED( 1 ) == 1 );
+    snapshot_check( SNAPSHOT_SCHEMA_BITS_REQUIRED( 100 ) == snapshot_bits_required( 0, 100 ) );
+    snapshot_check( SNAPSHOT_SCHEMA_BITS_REQUIRED( 65535 ) == 16 );
+    snapshot_check( SNAPSHOT_SCHEMA_BITS_REQUIRED( 4294967295U ) == 32 );
+
+    // 7 + 3 + 18 + 18 + 15 + 29 + 1 + ( 1 + 4 ) + ( 1 + 10 )
+
+    snapshot_check( test_schema_player_max_bits == 107 );
+    snapshot_check( test_schema_player_max_bytes == 14 );
+    snapshot_check( test_schema_player_buffer_bytes == 16 );
+
+    uint8_t buffer[test_schema_player_buffer_bytes];
+
+    for ( int i = 0; i < 1000; i++ )
+    {
+        struct test_schema_player_t input;
+        memset( &input, 0, sizeof(input) );
+        input.health = rand() % 101;
+        input.team = rand() % 8 - 1;
+        input.position_x = ( rand() % 200000 - 100000 ) * 0.01f;
+        input.position_y = ( rand() % 200000 - 100000 ) * 0.01f;
+        input.position_z = ( rand() % 20000 - 10000 ) * 0.01f;
+        float length = 0.0f;
+        for ( int j = 0; j < 4; j++ )
+        {
+            input.orientation[j] = ( rand() % 2001 - 1000 ) / 1000.0f;
+            length += input.orientation[j] * input.orientation[j];
+        }
+        length = sqrtf( length );
+        if ( length < 0.001f )
+        {
+            input.orientation[0] = 1.0f;
+            length = 1.0f;
+        }
+        for ( int j = 0; j < 4; j++ )
+        {
+            input.orientation[j] /= length;
+        }
+        input.crouching = rand() % 2;
+        input.has_weapon = rand() % 2;
+        input.weapon = input.has_weapon ? rand() % 16 : 0;
+        input.has_aim = rand() % 2;
+        input.aim = input.has_aim ? ( rand() % 1001 ) / 1000.0f : 0.0f;
+
+        const int bytes = test_schema_player_write( &input, buffer, sizeof(buffer) );
+
+        snapshot_check( bytes > 0 );
+        snapshot_check( bytes <= test_schema_player_max_bytes );
+
+        struct test_schema_player_t output;
+        memset( &output, 0, sizeof(output) );
+        snapshot_check( test_schema_player_read( &output, buffer, bytes ) == SNAPSHOT_OK );
+
+        snapshot_check( output.health == input.health );
+        snapshot_check( output.team == input.team );
+        snapshot_check( fabsf( output.position_x - input.position_x ) <= 0.01f );
+        snapshot_check( fabsf( output.position_y - input.position_y ) <= 0.01f );
+        snapshot_check( fabsf( output.position_z - input.position_z ) <= 0.01f );
+        snapshot_check( output.crouching == input.crouching );
+        snapshot_check( output.has_weapon == input.has_weapon );
+        snapshot_check( output.weapon == input.weapon );
+        snapshot_check( output.has_aim == input.has_aim );
+        snapshot_check( fabsf( output.aim - input.aim ) <= 0.001f );
+
+        // q and -q are the same rotation, so compare with the dot product
+
+        float dot = 0.0f;
+        for ( int j = 0; j < 4; j++ )
+        {
+            dot += output.orientation[j] * input.orientation[j];
+        }
+        snapshot_check( fabsf( dot ) >= 0.999f );
+
+        // truncated data must fail to read
+
+        snapshot_check( test_schema_player_read( &output, buffer, bytes - 1 ) == SNAPSHOT_ERROR );
+    }
+
+    // a buffer too small for the largest encoding fails the write, in release builds too
+
+    {
+        struct test_schema_player_t input;
+        memset( &input, 0, sizeof(input) );
+        input.orientation[0] = 1.0f;
+        memset( buffer, 0xAB, sizeof(buffer) );
+        snapshot_check( test_schema_player_write( &input, buffer, test_schema_player_max_bytes - 1 ) == SNAPSHOT_ERROR );
+        snapshot_check( buffer[0] == 0xAB );
+    }
+
+    // values out of range on the wire must fail to read
+
+    memset( buffer, 0xFF, sizeof(buffer) );
+
+    struct test_schema_player_t output;
+    snapshot_check( test_schema_player_read( &output, buffer, test_schema_player_max_bytes ) == SNAPSHOT_ERROR );
+
+    snapshot_check( test_schema_player_read( &output, buffer, test_schema_player_max_bytes + 1 ) == SNAPSHOT_ERROR );
+}
+
 void test_crypto_random_bytes()
 {
     const int BufferSize = 64;
@@ -487,6 +821,229 @@ void test_crypto_aead_ietf()
     snapshot_check( snapshot_crypto_aead_chacha20poly1305_ietf_decrypt( decrypted, &decrypted_len, NULL, ciphertext, ciphertext_len, CRYPTO_AEAD_IETF_ADDITIONAL_DATA, CRYPTO_AEAD_IETF_ADDITIONAL_DATA_LEN, nonce, key ) == 0 );
 }
 
+void test_crypto_isa()
+{
+    const int isa = snapshot_crypto_isa();
+
+    snapshot_check( isa >= SNAPSHOT_CRYPTO_ISA_REF );
+    snapshot_check( isa <= SNAPSHOT_CRYPTO_ISA_AVX2 );
+    snapshot_check( strcmp( snapshot_crypto_isa_string( isa ), "???" ) != 0 );
+    snapshot_check( strcmp( snapshot_crypto_isa_string( -1 ), "???" ) == 0 );
+}
+
+static void test_crypto_aead_batch_isa( int isa )
+{
+    #define CRYPTO_AEAD_BATCH_NUM_ITEMS 77
+    #define CRYPTO_AEAD_BATCH_MAX_MESSAGE_BYTES 4200
+
+    static uint8_t messages[CRYPTO_AEAD_BATCH_NUM_ITEMS][CRYPTO_AEAD_BATCH_MAX_MESSAGE_BYTES + SNAPSHOT_MAC_BYTES];
+    static uint8_t expected[CRYPTO_AEAD_BATCH_NUM_ITEMS][CRYPTO_AEAD_BATCH_MAX_MESSAGE_BYTES + SNAPSHOT_MAC_BYTES];
+    static uint8_t plaintext[CRYPTO_AEAD_BATCH_NUM_ITEMS][CRYPTO_AEAD_BATCH_MAX_MESSAGE_BYTES];
+
+    uint8_t keys[CRYPTO_AEAD_BATCH_NUM_ITEMS][SNAPSHOT_CRYPTO_AEAD_CHACHA20POLY1305_IETF_KEYBYTES];
+    uint8_t nonces[CRYPTO_AEAD_BATCH_NUM_ITEMS][SNAPSHOT_CRYPTO_AEAD_CHACHA20POLY1305_IETF_NPUBBYTES];
+    uint8_t additional[CRYPTO_AEAD_BATCH_NUM_ITEMS][32];
+
+    struct snapshot_crypto_aead_batch_item_t items[CRYPTO_AEAD_BATCH_NUM_ITEMS];
+
+    snapshot_crypto_force_batch_isa( isa );
+
+    // mix of sizes around block boundaries, plus a few big ones that span many lanes on their own
+
+    for ( int i = 0; i < CRYPTO_AEAD_BATCH_NUM_ITEMS; i++ )
+    {
+        int message_bytes = i;
+        if ( i % 7 == 3 )
+            message_bytes = 64 * ( i % 5 ) + 1;
+        if ( i % 11 == 5 )
+            message_bytes = CRYPTO_AEAD_BATCH_MAX_MESSAGE_BYTES - i;
+
+        snapshot_crypto_random_bytes( keys[i], sizeof( keys[i] ) );
+        snapshot_crypto_random_bytes( nonces[i], sizeof( nonces[i] ) );
+        snapshot_crypto_random_bytes( additional[i], sizeof( additional[i] ) );
+        snapshot_crypto_random_bytes( plaintext[i], CRYPTO_AEAD_BATCH_MAX_MESSAGE_BYTES );
+
+        memcpy( messages[i], plaintext[i], message_bytes );
+        memcpy( expected[i], plaintext[i], message_bytes );
+
+        items[i].message = messages[i];
+        items[i].message_length = message_bytes;
+        items[i].additional = additional[i];
+        items[i].additional_length = i % sizeof( additional[i] );
+        items[i].nonce = nonces[i];
+        items[i].key = keys[i];
+        items[i].result = -1;
+
+        snapshot_check( snapshot_crypto_encrypt_aead( expected[i], message_bytes, additional[i], items[i].additional_length, nonces[i], keys[i] ) == SNAPSHOT_OK );
+    }
+
+    // batch encrypt must match encrypting one at a time, byte for byte
+
+    snapshot_crypto_encrypt_aead_batch( items, CRYPTO_AEAD_BATCH_NUM_ITEMS );
+
+    for ( int i = 0; i < CRYPTO_AEAD_BATCH_NUM_ITEMS; i++ )
+    {
+        snapshot_check( items[i].result == SNAPSHOT_OK );
+        snapshot_check( memcmp( messages[i], expected[i], items[i].message_length + SNAPSHOT_MAC_BYTES ) == 0 );
+    }
+
+    // batch decrypt gets the plaintext back, and rejects tampered packets without touching them
+
+    for ( int i = 0; i < CRYPTO_AEAD_BATCH_NUM_ITEMS; i++ )
+    {
+        items[i].message_length += SNAPSHOT_MAC_BYTES;
+
+        if ( i % 3 == 1 )
+        {
+            messages[i][ i % items[i].message_length ] ^= 1;
+            memcpy( expected[i], messages[i], items[i].message_length );
+        }
+    }
+
+    snapshot_crypto_decrypt_aead_batch( items, CRYPTO_AEAD_BATCH_NUM_ITEMS );
+
+    for ( int i = 0; i < CRYPTO_AEAD_BATCH_NUM_ITEMS; i++ )
+    {
+        if ( i % 3 == 1 )
+        {
+            snapshot_check( items[i].result == SNAPSHOT_ERROR );
+            snapshot_check( memcmp( messages[i], expected[i], items[i].message_length ) == 0 );
+        }
+        else
+        {
+            snapshot_check( items[i].result == SNAPSHOT_OK );
+            snapshot_check( memcmp( messages[i], plaintext[i], items[i].message_length - SNAPSHOT_MAC_BYTES ) == 0 );
+        }
+    }
+
+    // packets encrypted one at a time decrypt in a batch too
+
+    for ( int i = 0; i < CRYPTO_AEAD_BATCH_NUM_ITEMS; i++ )
+    {
+        memcpy( messages[i], plaintext[i], items[i].message_length - SNAPSHOT_MAC_BYTES );
+        snapshot_check( snapshot_crypto_encrypt_aead( messages[i], items[i].message_length - SNAPSHOT_MAC_BYTES, additional[i], items[i].additional_length, nonces[i], keys[i] ) == SNAPSHOT_OK );
+    }
+
+    snapshot_crypto_decrypt_aead_batch( items, CRYPTO_AEAD_BATCH_NUM_ITEMS );
+
+    for ( int i = 0; i < CRYPTO_AEAD_BATCH_NUM_ITEMS; i++ )
+    {
+        snapshot_check( items[i].result == SNAPSHOT_OK );
+        snapshot_check( memcmp( messages[i], plaintext[i], items[i].message_length - SNAPSHOT_MAC_BYTES ) == 0 );
+    }
+}
+
+void test_crypto_aead_batch()
+{
+    // every batch kernel this cpu can run must agree with sodium
+
+    for ( int isa = SNAPSHOT_CRYPTO_ISA_REF; isa <= snapshot_crypto_isa(); isa++ )
+    {
+        test_crypto_aead_batch_isa( isa );
+    }
+
+    snapshot_crypto_force_batch_isa( snapshot_crypto_isa() );
+}
+
+void test_crypto_aead_aes256gcm()
+{
+    // aes256gcm is only used when the cpu has aes-ni, otherwise everything falls back to chacha20-poly1305
+
+    snapshot_check( snapshot_crypto_select_cipher_suite( SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 ) == SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 );
+
+    if ( !snapshot_crypto_aes256gcm_available() )
+    {
+        snapshot_check( snapshot_crypto_select_cipher_suite( SNAPSHOT_CIPHER_SUITE_AES256GCM ) == SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 );
+        return;
+    }
+
+    snapshot_check( snapshot_crypto_select_cipher_suite( SNAPSHOT_CIPHER_SUITE_AES256GCM ) == SNAPSHOT_CIPHER_SUITE_AES256GCM );
+
+    // gcm spec test case 16: 256 bit key, 96 bit iv, partial final block and additional data
+
+    static const uint8_t key[] = 
+    {
+        0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 0x6d, 0x6a, 0x8f, 0x94,
+        0x67, 0x30, 0x83, 0x08, 0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c,
+        0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08
+    };
+
+    static const uint8_t nonce[] = 
+    {
+        0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88
+    };
+
+    static const uint8_t plaintext[] = 
+    {
+        0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5,
+        0xaf, 0xf5, 0x26, 0x9a, 0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda,
+        0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72, 0x1c, 0x3c, 0x0c, 0x95,
+        0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+        0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39
+    };
+
+    static const uint8_t additional[] = 
+    {
+        0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce,
+        0xde, 0xad, 0xbe, 0xef, 0xab, 0xad, 0xda, 0xd2
+    };
+
+    static const uint8_t ciphertext[] = 
+    {
+        0x52, 0x2d, 0xc1, 0xf0, 0x99, 0x56, 0x7d, 0x07, 0xf4, 0x7f, 0x37, 0xa3,
+        0x2a, 0x84, 0x42, 0x7d, 0x64, 0x3a, 0x8c, 0xdc, 0xbf, 0xe5, 0xc0, 0xc9,
+        0x75, 0x98, 0xa2, 0xbd, 0x25, 0x55, 0xd1, 0xaa, 0x8c, 0xb0, 0x8e, 0x48,
+        0x59, 0x0d, 0xbb, 0x3d, 0xa7, 0xb0, 0x8b, 0x10, 0x56, 0x82, 0x88, 0x38,
+        0xc5, 0xf6, 0x1e, 0x63, 0x93, 0xba, 0x7a, 0x0a, 0xbc, 0xc9, 0xf6, 0x62
+    };
+
+    static const uint8_t tag[] = 
+    {
+        0x76, 0xfc, 0x6e, 0xce, 0x0f, 0x4e, 0x17, 0x68, 0xcd, 0xdf, 0x88, 0x53,
+        0xbb, 0x2d, 0x55, 0x1b
+    };
+
+    uint8_t message[sizeof( plaintext ) + SNAPSHOT_MAC_BYTES];
+    memcpy( message, plaintext, sizeof( plaintext ) );
+
+    snapshot_check( snapshot_crypto_encrypt_aead_aes256gcm( message, sizeof( plaintext ), additional, sizeof( additional ), nonce, key ) == SNAPSHOT_OK );
+    snapshot_check( memcmp( message, ciphertext, sizeof( ciphertext ) ) == 0 );
+    snapshot_check( memcmp( message + sizeof( plaintext ), tag, sizeof( tag ) ) == 0 );
+
+    snapshot_check( snapshot_crypto_decrypt_aead_aes256gcm( message, sizeof( message ), additional, sizeof( additional ), nonce, key ) == SNAPSHOT_OK );
+    snapshot_check( memcmp( message, plaintext, sizeof( plaintext ) ) == 0 );
+
+    // round trip every size around the block boundaries, and reject tampered messages without touching them
+
+    #define CRYPTO_AEAD_AES256GCM_MAX_MESSAGE_BYTES 300
+
+    uint8_t random_key[SNAPSHOT_KEY_BYTES];
+    uint8_t random_nonce[SNAPSHOT_PACKET_NONCE_BYTES];
+    uint8_t random_plaintext[CRYPTO_AEAD_AES256GCM_MAX_MESSAGE_BYTES];
+    uint8_t random_message[CRYPTO_AEAD_AES256GCM_MAX_MESSAGE_BYTES + SNAPSHOT_MAC_BYTES];
+    uint8_t tampered[CRYPTO_AEAD_AES256GCM_MAX_MESSAGE_BYTES + SNAPSHOT_MAC_BYTES];
+
+    snapshot_crypto_random_bytes( random_key, sizeof( random_key ) );
+    snapshot_crypto_random_bytes( random_nonce, sizeof( random_nonce ) );
+    snapshot_crypto_random_bytes( random_plaintext, sizeof( random_plaintext ) );
+
+    for ( int message_bytes = 0; message_bytes <= CRYPTO_AEAD_AES256GCM_MAX_MESSAGE_BYTES; message_bytes++ )
+    {
+        memcpy( random_message, random_plaintext, message_bytes );
+
+        snapshot_check( snapshot_crypto_encrypt_aead_aes256gcm( random_message, message_bytes, additional, message_bytes % sizeof( additional ), random_nonce, random_key ) == SNAPSHOT_OK );
+
+        memcpy( tampered, random_message, message_bytes + SNAPSHOT_MAC_BYTES );
+        tampered[ message_bytes % ( message_bytes + SNAPSHOT_MAC_BYTES ) ] ^= 1;
+        snapshot_check( snapshot_crypto_decrypt_aead_aes256gcm( tampered, message_bytes + SNAPSHOT_MAC_BYTES, additional, message_bytes % sizeof( additional ), random_nonce, random_key ) == SNAPSHOT_ERROR );
+        tampered[ message_bytes % ( message_bytes + SNAPSHOT_MAC_BYTES ) ] ^= 1;
+        snapshot_check( memcmp( tampered, random_message, message_bytes + SNAPSHOT_MAC_BYTES ) == 0 );
+
+        snapshot_check( snapshot_crypto_decrypt_aead_aes256gcm( random_message, message_bytes + SNAPSHOT_MAC_BYTES, additional, message_bytes % sizeof( additional ), random_nonce, random_key ) == SNAPSHOT_OK );
+        snapshot_check( memcmp( random_message, random_plaintext, message_bytes ) == 0 );
+    }
+}
+
 void test_crypto_sign_detached()
 {
     #define MESSAGE_PART1 ((const unsigned char *) "Arbitrary data to hash")
@@ -659,6 +1216,166 @@ void test_platform_socket()
 #endif
 }
 
+void test_platform_socket_receive_packets()
+{
+    struct snapshot_address_t bind_address;
+    struct snapshot_address_t local_address;
+    snapshot_address_parse( &bind_address, "0.0.0.0" );
+    snapshot_address_parse( &local_address, "127.0.0.1" );
+    struct snapshot_platform_socket_t * socket = snapshot_platform_socket_create( NULL, &bind_address, SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING, 0, 64*1024, 64*1024 );
+    local_address.port = bind_address.port;
+    snapshot_check( socket );
+
+    const int NumPackets = 10;
+    const int BatchSize = 4;
+
+    uint8_t packet[256];
+    for ( int i = 0; i < NumPackets; i++ )
+    {
+        memset( packet, i, sizeof(packet) );
+        snapshot_platform_socket_send_packet( socket, &local_address, packet, 100 + i );
+    }
+
+    uint8_t buffer[BatchSize][256];
+    uint8_t * packet_data[BatchSize];
+    int packet_bytes[BatchSize];
+    struct snapshot_address_t from[BatchSize];
+    for ( int i = 0; i < BatchSize; i++ )
+    {
+        packet_data[i] = buffer[i];
+    }
+
+    // every packet sent over loopback must come back, in order, across several batches
+
+    int num_packets_received = 0;
+    const double start_time = snapshot_platform_time();
+    while ( num_packets_received < NumPackets && snapshot_platform_time() - start_time < 1.0 )
+    {
+        int num_packets = snapshot_platform_socket_receive_packets( socket, from, packet_data, packet_bytes, sizeof(buffer[0]), BatchSize );
+        snapshot_check( num_packets >= 0 );
+        snapshot_check( num_packets <= BatchSize );
+        for ( int i = 0; i < num_packets; i++ )
+        {
+            snapshot_check( snapshot_address_equal( &from[i], &local_address ) );
+            snapshot_check( packet_bytes[i] == 100 + num_packets_received );
+            snapshot_check( packet_data[i][0] == num_packets_received );
+            num_packets_received++;
+        }
+        if ( num_packets == 0 )
+        {
+            snapshot_platform_sleep( 0.001 );
+        }
+    }
+
+    snapshot_check( num_packets_received == NumPackets );
+
+    snapshot_platform_socket_destroy( socket );
+}
+
+void test_platform_socket_gso_gro()
+{
+    struct snapshot_address_t bind_address;
+    struct snapshot_address_t local_address;
+    snapshot_address_parse( &bind_address, "0.0.0.0" );
+    snapshot_address_parse( &local_address, "127.0.0.1" );
+    struct snapshot_platform_socket_t * socket = snapshot_platform_socket_create( NULL, &bind_address, SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING, 0, 256*1024, 256*1024 );
+    local_address.port = bind_address.port;
+    snapshot_check( socket );
+
+    // gso and gro are optional. when they are not available, the regular send and receive path must still work
+
+    snapshot_platform_socket_enable_gso( socket );
+    snapshot_platform_socket_enable_gro( socket );
+
+    const int NumPackets = 6;
+    const int SegmentBytes = 1000;
+    const int LastPacketBytes = 300;
+
+    uint8_t send_buffer[NumPackets][SegmentBytes];
+    uint8_t * send_packet_data[NumPackets];
+    int send_packet_bytes[NumPackets];
+    struct snapshot_address_t to[NumPackets];
+    for ( int i = 0; i < NumPackets; i++ )
+    {
+        memset( send_buffer[i], i + 1, SegmentBytes );
+        send_packet_data[i] = send_buffer[i];
+        send_packet_bytes[i] = ( i == NumPackets - 1 ) ? LastPacketBytes : SegmentBytes;
+        to[i] = local_address;
+    }
+
+    snapshot_platform_socket_send_packets( socket, to, send_packet_data, send_packet_bytes, NumPackets );
+
+    const int BatchSize = 4;
+
+    uint8_t buffer[BatchSize][SegmentBytes];
+    uint8_t * packet_data[BatchSize];
+    int packet_bytes[BatchSize];
+    struct snapshot_address_t from[BatchSize];
+    for ( int i = 0; i < BatchSize; i++ )
+    {
+        packet_data[i] = buffer[i];
+    }
+
+    int num_packets_received = 0;
+    for ( int iteration = 0; iteration < 100 && num_packets_received < NumPackets; iteration++ )
+    {
+        int num_packets = snapshot_platform_socket_receive_packets( socket, from, packet_data, packet_bytes, sizeof(buffer[0]), BatchSize );
+        snapshot_check( num_packets >= 0 );
+        snapshot_check( num_packets <= BatchSize );
+        for ( int i = 0; i < num_packets; i++ )
+        {
+            snapshot_check( num_packets_received < NumPackets );
+            snapshot_check( snapshot_address_equal( &from[i], &local_address ) );
+            snapshot_check( packet_bytes[i] == send_packet_bytes[num_packets_received] );
+            snapshot_check( packet_data[i][0] == num_packets_received + 1 );
+            snapshot_check( packet_data[i][packet_bytes[i]-1] == num_packets_received + 1 );
+            num_packets_received++;
+        }
+        if ( num_packets == 0 )
+        {
+            snapshot_platform_sleep( 0.01 );
+        }
+    }
+
+    snapshot_check( num_packets_received == NumPackets );
+
+    // packets that grow in size can't be coalesced, so each one lands in its own gro buffer and one receive call reads several buffers
+
+    const int NumSinglePackets = 12;
+
+    for ( int i = 0; i < NumSinglePackets; i++ )
+    {
+        uint8_t packet[SegmentBytes];
+        memset( packet, i + 1, sizeof(packet) );
+        snapshot_platform_socket_send_packet( socket, &local_address, packet, 200 + i * 10 );
+    }
+
+    num_packets_received = 0;
+    for ( int iteration = 0; iteration < 100 && num_packets_received < NumSinglePackets; iteration++ )
+    {
+        int num_packets = snapshot_platform_socket_receive_packets( socket, from, packet_data, packet_bytes, sizeof(buffer[0]), BatchSize );
+        snapshot_check( num_packets >= 0 );
+        snapshot_check( num_packets <= BatchSize );
+        for ( int i = 0; i < num_packets; i++ )
+        {
+            snapshot_check( num_packets_received < NumSinglePackets );
+            snapshot_check( snapshot_address_equal( &from[i], &local_address ) );
+            snapshot_check( packet_bytes[i] == 200 + num_packets_received * 10 );
+            snapshot_check( packet_data[i][0] == num_packets_received + 1 );
+            snapshot_check( packet_data[i][packet_bytes[i]-1] == num_packets_received + 1 );
+            num_packets_received++;
+        }
+        if ( num_packets == 0 )
+        {
+            snapshot_platform_sleep( 0.01 );
+        }
+    }
+
+    snapshot_check( num_packets_received == NumSinglePackets );
+
+    snapshot_platform_socket_destroy( socket );
+}
+
 static SNAPSHOT_BOOL threads_work;
 
 void test_thread_function( void * dummy )
@@ -686,28 +1403,140 @@ void test_platform_mutex()
     snapshot_platform_mutex_destroy( &mutex );
 }
 
-void test_sequence()
+void test_io_thread()
 {
-    snapshot_check( snapshot_sequence_number_bytes_required( 0 ) == 1 );
-    snapshot_check( snapshot_sequence_number_bytes_required( 0x11 ) == 1 );
-    snapshot_check( snapshot_sequence_number_bytes_required( 0x1122 ) == 2 );
-    snapshot_check( snapshot_sequence_number_bytes_required( 0x112233 ) == 3 );
-    snapshot_check( snapshot_sequence_number_bytes_required( 0x11223344 ) == 4 );
-    snapshot_check( snapshot_sequence_number_bytes_required( 0x1122334455 ) == 5 );
-    snapshot_check( snapshot_sequence_number_bytes_required( 0x112233445566 ) == 6 );
-    snapshot_check( snapshot_sequence_number_bytes_required( 0x11223344556677 ) == 7 );
-    snapshot_check( snapshot_sequence_number_bytes_required( 0x1122334455667788 ) == 8 );
-}
+    struct snapshot_address_t io_address;
+    struct snapshot_address_t sender_address;
+    snapshot_address_parse( &io_address, "127.0.0.1" );
+    snapshot_address_parse( &sender_address, "127.0.0.1" );
 
-#define TEST_PROTOCOL_ID            0x1122334455667788ULL
-#define TEST_CLIENT_ID              0x1ULL
-#define TEST_SERVER_PORT            40000
-#define TEST_CONNECT_TOKEN_EXPIRY   30
-#define TEST_TIMEOUT_SECONDS        15
+    struct snapshot_platform_socket_t * io_socket = snapshot_platform_socket_create( NULL, &io_address, SNAPSHOT_PLATFORM_SOCKET_BLOCKING, SNAPSHOT_IO_THREAD_RECEIVE_TIMEOUT, 256*1024, 256*1024 );
+    struct snapshot_platform_socket_t * sender_socket = snapshot_platform_socket_create( NULL, &sender_address, SNAPSHOT_PLATFORM_SOCKET_NON_BLOCKING, 0.0f, 256*1024, 256*1024 );
+    snapshot_check( io_socket );
+    snapshot_check( sender_socket );
 
-void test_connect_token_private()
-{
-    // generate a private connect token
+    const int QueueSize = 8;
+
+    snapshot_check( snapshot_io_thread_create( NULL, io_socket, 7 ) == NULL );
+
+    struct snapshot_io_thread_t * io_thread = snapshot_io_thread_create( NULL, io_socket, QueueSize );
+    snapshot_check( io_thread );
+
+    // packets sent to the io thread socket show up in its receive queue, in order
+
+    const int NumPackets = 4;
+
+    uint8_t packet[256];
+    for ( int i = 0; i < NumPackets; i++ )
+    {
+        memset( packet, i + 1, sizeof(packet) );
+        snapshot_platform_socket_send_packet( sender_socket, &io_address, packet, 100 + i );
+    }
+
+    for ( int iteration = 0; iteration < 1000 && snapshot_io_thread_receive_queue_depth( io_thread ) < NumPackets; iteration++ )
+    {
+        snapshot_platform_sleep( 0.001 );
+    }
+
+    struct snapshot_address_t from[QueueSize];
+    uint8_t * packet_data[QueueSize];
+    int packet_bytes[QueueSize];
+
+    snapshot_check( snapshot_io_thread_receive_packets( io_thread, from, packet_data, packet_bytes, QueueSize ) == NumPackets );
+
+    for ( int i = 0; i < NumPackets; i++ )
+    {
+        snapshot_check( snapshot_address_equal( &from[i], &sender_address ) );
+        snapshot_check( packet_bytes[i] == 100 + i );
+        snapshot_check( packet_data[i][0] == i + 1 );
+        snapshot_check( packet_data[i][packet_bytes[i]-1] == i + 1 );
+    }
+
+    snapshot_io_thread_release_packets( io_thread, NumPackets );
+
+    snapshot_check( snapshot_io_thread_receive_queue_depth( io_thread ) == 0 );
+
+    // packets queued on the game thread are sent by the io thread
+
+    for ( int i = 0; i < NumPackets; i++ )
+    {
+        memset( packet, i + 1, sizeof(packet) );
+        snapshot_check( snapshot_io_thread_send_packet( io_thread, &sender_address, packet, 200 + i ) );
+    }
+
+    int num_packets_received = 0;
+    for ( int iteration = 0; iteration < 1000 && num_packets_received < NumPackets; iteration++ )
+    {
+        struct snapshot_address_t receive_from;
+        uint8_t receive_buffer[256];
+        const int receive_bytes = snapshot_platform_socket_receive_packet( sender_socket, &receive_from, receive_buffer, sizeof(receive_buffer) );
+        if ( receive_bytes == 0 )
+        {
+            snapshot_platform_sleep( 0.001 );
+            continue;
+        }
+        snapshot_check( snapshot_address_equal( &receive_from, &io_address ) );
+        snapshot_check( receive_bytes == 200 + num_packets_received );
+        snapshot_check( receive_buffer[0] == num_packets_received + 1 );
+        num_packets_received++;
+    }
+
+    snapshot_check( num_packets_received == NumPackets );
+
+    // when the game thread falls behind, the io thread drops packets instead of blocking
+
+    for ( int i = 0; i < QueueSize * 4; i++ )
+    {
+        snapshot_platform_socket_send_packet( sender_socket, &io_address, packet, 100 );
+    }
+
+    uint64_t counters[SNAPSHOT_IO_THREAD_NUM_COUNTERS];
+
+    for ( int iteration = 0; iteration < 1000; iteration++ )
+    {
+        snapshot_io_thread_counters( io_thread, counters );
+        if ( counters[SNAPSHOT_IO_THREAD_COUNTER_RECEIVE_QUEUE_DROPS] > 0 )
+            break;
+        snapshot_platform_sleep( 0.001 );
+    }
+
+    snapshot_io_thread_counters( io_thread, counters );
+
+    snapshot_check( snapshot_io_thread_receive_queue_depth( io_thread ) == QueueSize );
+    snapshot_check( counters[SNAPSHOT_IO_THREAD_COUNTER_RECEIVE_QUEUE_DROPS] > 0 );
+    snapshot_check( counters[SNAPSHOT_IO_THREAD_COUNTER_RECEIVE_QUEUE_MAX_DEPTH] == (uint64_t) QueueSize );
+    snapshot_check( counters[SNAPSHOT_IO_THREAD_COUNTER_PACKETS_RECEIVED] == (uint64_t) NumPackets + QueueSize );
+    snapshot_check( counters[SNAPSHOT_IO_THREAD_COUNTER_PACKETS_SENT] == (uint64_t) NumPackets );
+    snapshot_check( counters[SNAPSHOT_IO_THREAD_COUNTER_SEND_QUEUE_DROPS] == 0 );
+
+    snapshot_io_thread_destroy( io_thread );
+
+    snapshot_platform_socket_destroy( io_socket );
+    snapshot_platform_socket_destroy( sender_socket );
+}
+
+void test_sequence()
+{
+    snapshot_check( snapshot_sequence_number_bytes_required( 0 ) == 1 );
+    snapshot_check( snapshot_sequence_number_bytes_required( 0x11 ) == 1 );
+    snapshot_check( snapshot_sequence_number_bytes_required( 0x1122 ) == 2 );
+    snapshot_check( snapshot_sequence_number_bytes_required( 0x112233 ) == 3 );
+    snapshot_check( snapshot_sequence_number_bytes_required( 0x11223344 ) == 4 );
+    snapshot_check( snapshot_sequence_number_bytes_required( 0x1122334455 ) == 5 );
+    snapshot_check( snapshot_sequence_number_bytes_required( 0x112233445566 ) == 6 );
+    snapshot_check( snapshot_sequence_number_bytes_required( 0x11223344556677 ) == 7 );
+    snapshot_check( snapshot_sequence_number_bytes_required( 0x1122334455667788 ) == 8 );
+}
+
+#define TEST_PROTOCOL_ID            0x1122334455667788ULL
+#define TEST_CLIENT_ID              0x1ULL
+#define TEST_SERVER_PORT            40000
+#define TEST_CONNECT_TOKEN_EXPIRY   30
+#define TEST_TIMEOUT_SECONDS        15
+
+void test_connect_token_private()
+{
+    // generate a private connect token
 
     struct snapshot_address_t server_address;
     server_address.type = SNAPSHOT_ADDRESS_IPV4;
@@ -728,6 +1557,9 @@ void test_connect_token_private()
     snapshot_check( input_token.num_server_addresses == 1 );
     snapshot_check( memcmp( input_token.user_data, user_data, SNAPSHOT_USER_DATA_BYTES ) == 0 );
     snapshot_check( snapshot_address_equal( &input_token.server_addresses[0], &server_address ) );
+    snapshot_check( input_token.cipher_suite == SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 );
+
+    input_token.cipher_suite = SNAPSHOT_CIPHER_SUITE_AES256GCM;
 
     // write it to a buffer
 
@@ -776,6 +1608,7 @@ void test_connect_token_private()
     snapshot_check( snapshot_address_equal( &output_token.server_addresses[0], &input_token.server_addresses[0] ) );
     snapshot_check( memcmp( output_token.client_to_server_key, input_token.client_to_server_key, SNAPSHOT_KEY_BYTES ) == 0 );
     snapshot_check( memcmp( output_token.server_to_client_key, input_token.server_to_client_key, SNAPSHOT_KEY_BYTES ) == 0 );
+    snapshot_check( output_token.cipher_suite == input_token.cipher_suite );
     snapshot_check( memcmp( output_token.user_data, input_token.user_data, SNAPSHOT_USER_DATA_BYTES ) == 0 );
 }
 
@@ -838,6 +1671,7 @@ void test_connect_token_public()
     input_connect_token.server_addresses[0] = server_address;
     memcpy( input_connect_token.client_to_server_key, connect_token_private.client_to_server_key, SNAPSHOT_KEY_BYTES );
     memcpy( input_connect_token.server_to_client_key, connect_token_private.server_to_client_key, SNAPSHOT_KEY_BYTES );
+    input_connect_token.cipher_suite = SNAPSHOT_CIPHER_SUITE_AES256GCM;
     input_connect_token.timeout_seconds = (int) TEST_TIMEOUT_SECONDS;
 
     // write the connect token to a buffer
@@ -863,17 +1697,35 @@ void test_connect_token_public()
     snapshot_check( snapshot_address_equal( &output_connect_token.server_addresses[0], &input_connect_token.server_addresses[0] ) );
     snapshot_check( memcmp( output_connect_token.client_to_server_key, input_connect_token.client_to_server_key, SNAPSHOT_KEY_BYTES ) == 0 );
     snapshot_check( memcmp( output_connect_token.server_to_client_key, input_connect_token.server_to_client_key, SNAPSHOT_KEY_BYTES ) == 0 );
+    snapshot_check( output_connect_token.cipher_suite == input_connect_token.cipher_suite );
     snapshot_check( output_connect_token.timeout_seconds == input_connect_token.timeout_seconds );
+
+    // a token from before the cipher suite was added has a different layout, and must be rejected by its version info
+
+    memcpy( buffer, "SNAPSHOT", 9 );
+    snapshot_check( snapshot_read_connect_token( buffer, SNAPSHOT_CONNECT_TOKEN_BYTES, &output_connect_token ) == SNAPSHOT_ERROR );
 }
 
 void test_challenge_token()
 {
-    // generate a challenge token
+    // generate a challenge token from a connect token
 
-    struct snapshot_challenge_token_t input_token;
+    struct snapshot_address_t server_address;
+    snapshot_address_parse( &server_address, "127.0.0.1:40000" );
+
+    struct snapshot_address_t client_address;
+    snapshot_address_parse( &client_address, "[::1]:50000" );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
+
+    struct snapshot_connect_token_private_t connect_token;
+    snapshot_generate_connect_token_private( &connect_token, TEST_CLIENT_ID, TEST_TIMEOUT_SECONDS, 1, &server_address, user_data );
 
-    input_token.client_id = TEST_CLIENT_ID;
-    snapshot_crypto_random_bytes( input_token.user_data, SNAPSHOT_USER_DATA_BYTES );
+    const uint64_t expire_timestamp = time( NULL ) + 30;
+
+    struct snapshot_challenge_token_t input_token;
+    snapshot_generate_challenge_token( &input_token, &connect_token, &client_address, SNAPSHOT_CIPHER_SUITE_AES256GCM, expire_timestamp );
 
     // write it to a buffer
 
@@ -901,8 +1753,14 @@ void test_challenge_token()
 
     // make sure that everything matches the original challenge token
 
-    snapshot_check( output_token.client_id == input_token.client_id );
-    snapshot_check( memcmp( output_token.user_data, input_token.user_data, SNAPSHOT_USER_DATA_BYTES ) == 0 );
+    snapshot_check( output_token.client_id == TEST_CLIENT_ID );
+    snapshot_check( memcmp( output_token.user_data, user_data, SNAPSHOT_USER_DATA_BYTES ) == 0 );
+    snapshot_check( memcmp( output_token.client_to_server_key, connect_token.client_to_server_key, SNAPSHOT_KEY_BYTES ) == 0 );
+    snapshot_check( memcmp( output_token.server_to_client_key, connect_token.server_to_client_key, SNAPSHOT_KEY_BYTES ) == 0 );
+    snapshot_check( output_token.timeout_seconds == TEST_TIMEOUT_SECONDS );
+    snapshot_check( output_token.cipher_suite == SNAPSHOT_CIPHER_SUITE_AES256GCM );
+    snapshot_check( snapshot_address_equal( &output_token.address, &client_address ) );
+    snapshot_check( output_token.expire_timestamp == expire_timestamp );
 }
 
 void test_create_and_destroy_packet()
@@ -971,6 +1829,7 @@ void test_connection_request_packet()
     input_packet.protocol_id = TEST_PROTOCOL_ID;
     input_packet.connect_token_expire_timestamp = connect_token_expire_timestamp;
     memcpy( input_packet.connect_token_nonce, connect_token_nonce, SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES );
+    input_packet.cipher_suite = SNAPSHOT_CIPHER_SUITE_AES256GCM;
     memcpy( input_packet.connect_token_data, encrypted_connect_token_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
 
     // write the connection request packet to a buffer
@@ -982,7 +1841,7 @@ void test_connection_request_packet()
 
     int packet_bytes = 0;
 
-    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, TEST_PROTOCOL_ID, &packet_bytes );
+    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
 
     snapshot_check( packet_data == buffer );
     snapshot_check( packet_bytes > 0 );
@@ -996,7 +1855,7 @@ void test_connection_request_packet()
 
     uint8_t out_packet_data[2048];
 
-    struct snapshot_connection_request_packet_t * output_packet = (struct snapshot_connection_request_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, TEST_PROTOCOL_ID, time( NULL ), connect_token_key, allowed_packets, out_packet_data, NULL );
+    struct snapshot_connection_request_packet_t * output_packet = (struct snapshot_connection_request_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, time( NULL ), connect_token_key, allowed_packets, out_packet_data, NULL );
 
     snapshot_check( output_packet );
 
@@ -1007,7 +1866,17 @@ void test_connection_request_packet()
     snapshot_check( output_packet->protocol_id == input_packet.protocol_id );
     snapshot_check( output_packet->connect_token_expire_timestamp == input_packet.connect_token_expire_timestamp );
     snapshot_check( memcmp( output_packet->connect_token_nonce, input_packet.connect_token_nonce, SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES ) == 0 );
+    snapshot_check( output_packet->cipher_suite == SNAPSHOT_CIPHER_SUITE_AES256GCM );
     snapshot_check( memcmp( output_packet->connect_token_data, connect_token_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES - SNAPSHOT_MAC_BYTES ) == 0 );
+
+    // a connection request from a peer without the cipher suite byte has older version info and must be ignored
+
+    memset( input_packet.version_info, 0, SNAPSHOT_VERSION_INFO_BYTES );
+    memcpy( input_packet.version_info, "SNAPSHOT", 9 );
+
+    packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
+
+    snapshot_check( snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, time( NULL ), connect_token_key, allowed_packets, out_packet_data, NULL ) == NULL );
 }
 
 void test_connection_denied_packet()
@@ -1027,7 +1896,7 @@ void test_connection_denied_packet()
 
     int packet_bytes = 0;
 
-    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, TEST_PROTOCOL_ID, &packet_bytes );
+    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
 
     snapshot_check( packet_data == buffer );
     snapshot_check( packet_bytes > 0 );
@@ -1041,7 +1910,7 @@ void test_connection_denied_packet()
 
     uint8_t out_packet_data[2048];
 
-    struct snapshot_connection_denied_packet_t * output_packet = (struct snapshot_connection_denied_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
+    struct snapshot_connection_denied_packet_t * output_packet = (struct snapshot_connection_denied_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
 
     snapshot_check( output_packet );
 
@@ -1069,7 +1938,7 @@ void test_connection_challenge_packet()
 
     int packet_bytes = 0;
 
-    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, TEST_PROTOCOL_ID, &packet_bytes );
+    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
 
     snapshot_check( packet_data == buffer );
     snapshot_check( packet_bytes > 0 );
@@ -1083,7 +1952,7 @@ void test_connection_challenge_packet()
 
     uint8_t out_packet_data[2048];
 
-    struct snapshot_connection_challenge_packet_t * output_packet = (struct snapshot_connection_challenge_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
+    struct snapshot_connection_challenge_packet_t * output_packet = (struct snapshot_connection_challenge_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
 
     snapshot_check( output_packet );
 
@@ -1096,29 +1965,52 @@ void test_connection_challenge_packet()
 
 void test_connection_response_packet()
 {
+    // seal a challenge token the same way the server does
+
+    struct snapshot_address_t server_address;
+    snapshot_address_parse( &server_address, "127.0.0.1:40000" );
+
+    struct snapshot_address_t client_address;
+    snapshot_address_parse( &client_address, "127.0.0.1:50000" );
+
+    struct snapshot_address_t other_address;
+    snapshot_address_parse( &other_address, "127.0.0.1:50001" );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
+
+    struct snapshot_connect_token_private_t connect_token;
+    snapshot_generate_connect_token_private( &connect_token, TEST_CLIENT_ID, TEST_TIMEOUT_SECONDS, 1, &server_address, user_data );
+
+    const uint64_t current_timestamp = time( NULL );
+
+    struct snapshot_challenge_token_t challenge_token;
+    snapshot_generate_challenge_token( &challenge_token, &connect_token, &client_address, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, current_timestamp + 30 );
+
+    uint8_t challenge_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( challenge_key, SNAPSHOT_KEY_BYTES );
+
     // setup a connection response packet
 
     struct snapshot_connection_response_packet_t input_packet;
 
     input_packet.packet_type = SNAPSHOT_CONNECTION_RESPONSE_PACKET;
-    input_packet.challenge_token_sequence = 0;
-    snapshot_crypto_random_bytes( input_packet.challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+    input_packet.challenge_token_sequence = 1000;
+    snapshot_write_challenge_token( &challenge_token, input_packet.challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+    snapshot_check( snapshot_encrypt_challenge_token( input_packet.challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES, input_packet.challenge_token_sequence, challenge_key ) == SNAPSHOT_OK );
 
-    // write the packet to a buffer
+    // write the packet to a buffer. the response is sent in the clear, with a mac keyed by the client to server key
 
     uint8_t buffer[SNAPSHOT_MAX_PACKET_BYTES];
 
-    uint8_t packet_key[SNAPSHOT_KEY_BYTES];
-    snapshot_crypto_random_bytes( packet_key, SNAPSHOT_KEY_BYTES );
-    
     int packet_bytes = 0; 
 
-    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, TEST_PROTOCOL_ID, &packet_bytes );
+    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 0, connect_token.client_to_server_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
 
     snapshot_check( packet_data == buffer );
-    snapshot_check( packet_bytes > 0 );
+    snapshot_check( packet_bytes == SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES );
 
-    // read the packet back in from the buffer
+    // read the packet back in from the buffer without any key
 
     uint64_t sequence;
 
@@ -1127,7 +2019,7 @@ void test_connection_response_packet()
 
     uint8_t out_packet_data[2048];
 
-    struct snapshot_connection_response_packet_t * output_packet = (struct snapshot_connection_response_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
+    struct snapshot_connection_response_packet_t * output_packet = (struct snapshot_connection_response_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, NULL, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, current_timestamp, NULL, allowed_packet_types, out_packet_data, NULL );
 
     snapshot_check( output_packet );
 
@@ -1136,6 +2028,37 @@ void test_connection_response_packet()
     snapshot_check( output_packet->packet_type == SNAPSHOT_CONNECTION_RESPONSE_PACKET );
     snapshot_check( output_packet->challenge_token_sequence == input_packet.challenge_token_sequence );
     snapshot_check( memcmp( output_packet->challenge_token_data, input_packet.challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES ) == 0 );
+    snapshot_check( sequence == input_packet.challenge_token_sequence );
+
+    // open the challenge token and check the mac
+
+    struct snapshot_challenge_token_t output_token;
+
+    snapshot_check( snapshot_open_connection_response_packet( output_packet, &client_address, TEST_PROTOCOL_ID, current_timestamp, challenge_key, &output_token ) == SNAPSHOT_OK );
+    snapshot_check( output_token.client_id == TEST_CLIENT_ID );
+    snapshot_check( memcmp( output_token.client_to_server_key, connect_token.client_to_server_key, SNAPSHOT_KEY_BYTES ) == 0 );
+    snapshot_check( memcmp( output_token.server_to_client_key, connect_token.server_to_client_key, SNAPSHOT_KEY_BYTES ) == 0 );
+
+    // it can't be opened from another address, once the challenge token has expired, or with a bad mac
+
+    snapshot_check( snapshot_open_connection_response_packet( output_packet, &other_address, TEST_PROTOCOL_ID, current_timestamp, challenge_key, &output_token ) != SNAPSHOT_OK );
+    snapshot_check( snapshot_open_connection_response_packet( output_packet, &client_address, TEST_PROTOCOL_ID, current_timestamp + 30, challenge_key, &output_token ) != SNAPSHOT_OK );
+    snapshot_check( snapshot_open_connection_response_packet( output_packet, &client_address, TEST_PROTOCOL_ID + 1, current_timestamp, challenge_key, &output_token ) != SNAPSHOT_OK );
+
+    output_packet->mac[0] ^= 1;
+    snapshot_check( snapshot_open_connection_response_packet( output_packet, &client_address, TEST_PROTOCOL_ID, current_timestamp, challenge_key, &output_token ) != SNAPSHOT_OK );
+
+    // a response written without the client to server key doesn't open either
+
+    packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 0, NULL, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
+    snapshot_check( packet_data );
+    output_packet = (struct snapshot_connection_response_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, NULL, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, current_timestamp, NULL, allowed_packet_types, out_packet_data, NULL );
+    snapshot_check( output_packet );
+    snapshot_check( snapshot_open_connection_response_packet( output_packet, &client_address, TEST_PROTOCOL_ID, current_timestamp, challenge_key, &output_token ) != SNAPSHOT_OK );
+
+    // a truncated response is rejected before anything is opened
+
+    snapshot_check( snapshot_read_packet( packet_data, packet_bytes - 1, &sequence, NULL, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, current_timestamp, NULL, allowed_packet_types, out_packet_data, NULL ) == NULL );
 }
 
 void test_keep_alive_packet()
@@ -1157,7 +2080,7 @@ void test_keep_alive_packet()
 
     int packet_bytes = 0;
 
-    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, TEST_PROTOCOL_ID, &packet_bytes );
+    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
 
     snapshot_check( packet_data == buffer );
     snapshot_check( packet_bytes > 0 );
@@ -1171,7 +2094,7 @@ void test_keep_alive_packet()
 
     uint8_t out_packet_data[2048];
     
-    struct snapshot_keep_alive_packet_t * output_packet = (struct snapshot_keep_alive_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
+    struct snapshot_keep_alive_packet_t * output_packet = (struct snapshot_keep_alive_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
 
     snapshot_check( output_packet );
 
@@ -1182,24 +2105,29 @@ void test_keep_alive_packet()
     snapshot_check( output_packet->max_clients == input_packet.max_clients );
 }
 
-void test_payload_packet()
+static void test_payload_packet_cipher_suite( int cipher_suite )
 {
     // setup a payload packet
 
     uint8_t input_packet_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + sizeof(struct snapshot_payload_packet_t) + SNAPSHOT_MAX_PAYLOAD_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
 
-    struct snapshot_payload_packet_t * input_packet = (struct snapshot_payload_packet_t*) ( input_packet_buffer + SNAPSHOT_PACKET_PREFIX_BYTES );
+    // start the payload at an odd offset, as payloads written in place behind a packet header do
+
+    uint8_t * input_payload = input_packet_buffer + SNAPSHOT_PACKET_PREFIX_BYTES + sizeof(struct snapshot_payload_packet_t) - 1;
 
-    input_packet->packet_type = SNAPSHOT_PAYLOAD_PACKET;
-    input_packet->payload_bytes = SNAPSHOT_MAX_PAYLOAD_BYTES;
+    snapshot_crypto_random_bytes( input_payload, SNAPSHOT_MAX_PAYLOAD_BYTES );
 
-    snapshot_crypto_random_bytes( input_packet->payload_data, SNAPSHOT_MAX_PAYLOAD_BYTES );
+    void * input_packet = snapshot_wrap_payload_packet( input_payload, SNAPSHOT_MAX_PAYLOAD_BYTES );
+
+    snapshot_check( ( (uint8_t*) input_packet )[0] == SNAPSHOT_PAYLOAD_PACKET );
+    snapshot_check( snapshot_payload_packet_data( input_packet ) == input_payload );
+    snapshot_check( snapshot_payload_packet_bytes( input_packet ) == SNAPSHOT_MAX_PAYLOAD_BYTES );
     
     // save the input packet data somewhere else, since it is zero copy, the input packet will get trashed
 
-    uint32_t input_payload_bytes = input_packet->payload_bytes;
+    int input_payload_bytes = snapshot_payload_packet_bytes( input_packet );
     uint8_t input_payload_data[SNAPSHOT_MAX_PAYLOAD_BYTES];
-    memcpy( input_payload_data, input_packet->payload_data, input_payload_bytes );
+    memcpy( input_payload_data, input_payload, input_payload_bytes );
 
     // write the packet to a buffer
 
@@ -1210,7 +2138,7 @@ void test_payload_packet()
 
     int packet_bytes = 0;
 
-    uint8_t * packet_data = snapshot_write_packet( input_packet, buffer, sizeof( buffer ), 1000, packet_key, TEST_PROTOCOL_ID, &packet_bytes );
+    uint8_t * packet_data = snapshot_write_packet( input_packet, buffer, sizeof( buffer ), 1000, packet_key, cipher_suite, TEST_PROTOCOL_ID, &packet_bytes );
 
     snapshot_check( packet_data != buffer );
     snapshot_check( packet_bytes > 0 );
@@ -1224,15 +2152,25 @@ void test_payload_packet()
 
     uint8_t out_packet_data[SNAPSHOT_MAX_PAYLOAD_BYTES * 2];
 
-    struct snapshot_payload_packet_t * output_packet = (struct snapshot_payload_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
+    void * output_packet = snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, cipher_suite, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
 
     snapshot_check( output_packet );
 
     // make sure the read packet matches what was written
     
-    snapshot_check( output_packet->packet_type == SNAPSHOT_PAYLOAD_PACKET );
-    snapshot_check( output_packet->payload_bytes == input_payload_bytes );
-    snapshot_check( memcmp( output_packet->payload_data, input_payload_data, SNAPSHOT_MAX_PAYLOAD_BYTES ) == 0 );
+    snapshot_check( ( (uint8_t*) output_packet )[0] == SNAPSHOT_PAYLOAD_PACKET );
+    snapshot_check( snapshot_payload_packet_bytes( output_packet ) == input_payload_bytes );
+    snapshot_check( memcmp( snapshot_payload_packet_data( output_packet ), input_payload_data, SNAPSHOT_MAX_PAYLOAD_BYTES ) == 0 );
+}
+
+void test_payload_packet()
+{
+    test_payload_packet_cipher_suite( SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 );
+
+    if ( snapshot_crypto_aes256gcm_available() )
+    {
+        test_payload_packet_cipher_suite( SNAPSHOT_CIPHER_SUITE_AES256GCM );
+    }
 }
 
 void test_passthrough_packet()
@@ -1263,7 +2201,7 @@ void test_passthrough_packet()
 
     int packet_bytes = 0;
 
-    uint8_t * packet_data = snapshot_write_packet( input_packet, buffer, sizeof( buffer ), 1000, packet_key, TEST_PROTOCOL_ID, &packet_bytes );
+    uint8_t * packet_data = snapshot_write_packet( input_packet, buffer, sizeof( buffer ), 1000, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
 
     snapshot_check( packet_data != buffer );
     snapshot_check( packet_bytes > 0 );
@@ -1277,7 +2215,7 @@ void test_passthrough_packet()
 
     uint8_t out_packet_data[2048];
 
-    struct snapshot_passthrough_packet_t * output_packet = (struct snapshot_passthrough_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
+    struct snapshot_passthrough_packet_t * output_packet = (struct snapshot_passthrough_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
 
     snapshot_check( output_packet );
 
@@ -1305,7 +2243,7 @@ void test_disconnect_packet()
 
     int packet_bytes = 0;
 
-    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, TEST_PROTOCOL_ID, &packet_bytes );
+    uint8_t * packet_data = snapshot_write_packet( &input_packet, buffer, sizeof( buffer ), 1000, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
 
     snapshot_check( packet_data == buffer );
     snapshot_check( packet_bytes > 0 );
@@ -1319,7 +2257,7 @@ void test_disconnect_packet()
 
     uint8_t out_packet_data[2048];
 
-    struct snapshot_disconnect_packet_t * output_packet = (struct snapshot_disconnect_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
+    struct snapshot_disconnect_packet_t * output_packet = (struct snapshot_disconnect_packet_t*) snapshot_read_packet( packet_data, packet_bytes, &sequence, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, time( NULL ), NULL, allowed_packet_types, out_packet_data, NULL );
 
     snapshot_check( output_packet );
 
@@ -1328,11 +2266,237 @@ void test_disconnect_packet()
     snapshot_check( output_packet->packet_type == SNAPSHOT_DISCONNECT_PACKET );
 }
 
+void test_packet_prefix_valid()
+{
+    uint8_t allowed_packets[SNAPSHOT_NUM_PACKETS];
+    memset( allowed_packets, 1, sizeof( allowed_packets ) );
+
+    uint8_t packet_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( packet_key, SNAPSHOT_KEY_BYTES );
+
+    uint8_t buffer[SNAPSHOT_MAX_PACKET_BYTES];
+    memset( buffer, 0, sizeof( buffer ) );
+
+    // packets written the regular way are valid, at any sequence size
+
+    struct snapshot_keep_alive_packet_t keep_alive_packet;
+    keep_alive_packet.packet_type = SNAPSHOT_KEEP_ALIVE_PACKET;
+    keep_alive_packet.client_index = 0;
+    keep_alive_packet.max_clients = 1;
+
+    int packet_bytes = 0;
+
+    snapshot_check( snapshot_write_packet( &keep_alive_packet, buffer, sizeof( buffer ), 1, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes ) );
+    snapshot_check( snapshot_packet_prefix_valid( buffer, packet_bytes, allowed_packets ) );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, packet_bytes - 1, allowed_packets ) );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, packet_bytes + 1, allowed_packets ) );
+
+    snapshot_check( snapshot_write_packet( &keep_alive_packet, buffer, sizeof( buffer ), 0xFFFFFFFFFFFFULL, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes ) );
+    snapshot_check( snapshot_packet_prefix_valid( buffer, packet_bytes, allowed_packets ) );
+
+    struct snapshot_disconnect_packet_t disconnect_packet;
+    disconnect_packet.packet_type = SNAPSHOT_DISCONNECT_PACKET;
+
+    snapshot_check( snapshot_write_packet( &disconnect_packet, buffer, sizeof( buffer ), 1000, packet_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes ) );
+    snapshot_check( snapshot_packet_prefix_valid( buffer, packet_bytes, allowed_packets ) );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, packet_bytes + 1, allowed_packets ) );
+
+    // packet types that aren't allowed are rejected
+
+    allowed_packets[SNAPSHOT_DISCONNECT_PACKET] = 0;
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, packet_bytes, allowed_packets ) );
+    allowed_packets[SNAPSHOT_DISCONNECT_PACKET] = 1;
+
+    // payload packets may be any size up to the max payload
+
+    buffer[0] = SNAPSHOT_PAYLOAD_PACKET | ( 1 << 4 );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, 1 + 1 + SNAPSHOT_MAC_BYTES, allowed_packets ) );
+    snapshot_check( snapshot_packet_prefix_valid( buffer, 1 + 1 + SNAPSHOT_MAC_BYTES + 1, allowed_packets ) );
+    snapshot_check( snapshot_packet_prefix_valid( buffer, 1 + 1 + SNAPSHOT_MAC_BYTES + SNAPSHOT_MAX_PAYLOAD_BYTES, allowed_packets ) );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, 1 + 1 + SNAPSHOT_MAC_BYTES + SNAPSHOT_MAX_PAYLOAD_BYTES + 1, allowed_packets ) );
+
+    // bad sequence bytes and bad packet types are rejected
+
+    buffer[0] = SNAPSHOT_PAYLOAD_PACKET;
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, 100, allowed_packets ) );
+
+    buffer[0] = SNAPSHOT_PAYLOAD_PACKET | ( 9 << 4 );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, 100, allowed_packets ) );
+
+    buffer[0] = SNAPSHOT_NUM_PACKETS | ( 1 << 4 );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, 100, allowed_packets ) );
+
+    buffer[0] = SNAPSHOT_CONNECTION_REQUEST_PACKET | ( 1 << 4 );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, 100, allowed_packets ) );
+
+    // connection requests and responses are only valid at their exact size
+
+    buffer[0] = SNAPSHOT_CONNECTION_REQUEST_PACKET;
+    snapshot_check( snapshot_packet_prefix_valid( buffer, SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES, allowed_packets ) );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES - 1, allowed_packets ) );
+
+    buffer[0] = SNAPSHOT_CONNECTION_RESPONSE_PACKET;
+    snapshot_check( snapshot_packet_prefix_valid( buffer, SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES, allowed_packets ) );
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES + 1, allowed_packets ) );
+
+    snapshot_check( !snapshot_packet_prefix_valid( buffer, 0, allowed_packets ) );
+}
+
+void test_connect_token_table()
+{
+    const int MaxEntries = 4;
+
+    struct snapshot_connect_token_table_t * table = snapshot_connect_token_table_create( NULL, MaxEntries );
+
+    snapshot_check( table );
+
+    struct snapshot_address_t address_a;
+    struct snapshot_address_t address_b;
+    snapshot_address_parse( &address_a, "10.0.0.1:50000" );
+    snapshot_address_parse( &address_b, "10.0.0.2:50000" );
+
+    const int NumMacs = 6;
+
+    uint8_t mac[NumMacs][SNAPSHOT_MAC_BYTES];
+    for ( int i = 0; i < NumMacs; i++ )
+    {
+        snapshot_crypto_random_bytes( mac[i], SNAPSHOT_MAC_BYTES );
+    }
+
+    // a connect token may be used again from the address that first used it, but not from any other address
+
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_a, mac[0] ) );
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_a, mac[0] ) );
+    snapshot_check( !snapshot_connect_token_table_find_or_add( table, &address_b, mac[0] ) );
+
+    // fill the table, use the first token again, then add one more. the least recently used token is evicted
+
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_a, mac[1] ) );
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_a, mac[2] ) );
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_a, mac[3] ) );
+    snapshot_check( table->num_entries == MaxEntries );
+
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_a, mac[0] ) );
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_a, mac[4] ) );
+    snapshot_check( table->num_entries == MaxEntries );
+
+    snapshot_check( !snapshot_connect_token_table_find_or_add( table, &address_b, mac[0] ) );
+    snapshot_check( !snapshot_connect_token_table_find_or_add( table, &address_b, mac[2] ) );
+    snapshot_check( !snapshot_connect_token_table_find_or_add( table, &address_b, mac[3] ) );
+    snapshot_check( !snapshot_connect_token_table_find_or_add( table, &address_b, mac[4] ) );
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_b, mac[1] ) );
+
+    // after a reset every token is new again
+
+    snapshot_connect_token_table_reset( table );
+
+    snapshot_check( table->num_entries == 0 );
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_b, mac[0] ) );
+
+    snapshot_connect_token_table_destroy( table );
+
+    // churn through many more tokens than the table holds. exactly the most recent ones must still be found
+
+    const int ChurnEntries = 64;
+    const int ChurnTokens = 1000;
+
+    table = snapshot_connect_token_table_create( NULL, ChurnEntries );
+
+    snapshot_check( table );
+
+    uint8_t (*churn_mac)[SNAPSHOT_MAC_BYTES] = (uint8_t(*)[SNAPSHOT_MAC_BYTES]) malloc( ChurnTokens * SNAPSHOT_MAC_BYTES );
+
+    for ( int i = 0; i < ChurnTokens; i++ )
+    {
+        snapshot_crypto_random_bytes( churn_mac[i], SNAPSHOT_MAC_BYTES );
+        snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_a, churn_mac[i] ) );
+    }
+
+    for ( int i = ChurnTokens - ChurnEntries; i < ChurnTokens; i++ )
+    {
+        snapshot_check( !snapshot_connect_token_table_find_or_add( table, &address_b, churn_mac[i] ) );
+    }
+
+    snapshot_check( snapshot_connect_token_table_find_or_add( table, &address_b, churn_mac[0] ) );
+
+    free( churn_mac );
+
+    snapshot_connect_token_table_destroy( table );
+}
+
+void test_rate_limiter()
+{
+    const double PacketsPerSecond = 10.0;
+    const double Burst = 5.0;
+
+    struct snapshot_rate_limiter_t * limiter = snapshot_rate_limiter_create( NULL, 16, PacketsPerSecond, Burst );
+
+    snapshot_check( limiter );
+
+    struct snapshot_address_t address_a;
+    struct snapshot_address_t address_a_other_port;
+    struct snapshot_address_t address_b;
+    snapshot_address_parse( &address_a, "10.0.0.1:50000" );
+    snapshot_address_parse( &address_a_other_port, "10.0.0.1:50001" );
+    snapshot_address_parse( &address_b, "10.0.0.2:50000" );
+
+    // a new source gets a full bucket. the bucket is per ip, so changing the port doesn't help
+
+    for ( int i = 0; i < (int) Burst; i++ )
+    {
+        snapshot_check( snapshot_rate_limiter_allow( limiter, &address_a, 0.0 ) );
+    }
+
+    snapshot_check( !snapshot_rate_limiter_allow( limiter, &address_a, 0.0 ) );
+    snapshot_check( !snapshot_rate_limiter_allow( limiter, &address_a_other_port, 0.0 ) );
+    snapshot_check( snapshot_rate_limiter_allow( limiter, &address_b, 0.0 ) );
+
+    // tokens refill at the configured rate, up to the burst
+
+    snapshot_check( snapshot_rate_limiter_allow( limiter, &address_a, 0.1 ) );
+    snapshot_check( !snapshot_rate_limiter_allow( limiter, &address_a, 0.1 ) );
+
+    int allowed = 0;
+    for ( int i = 0; i < 100; i++ )
+    {
+        allowed += snapshot_rate_limiter_allow( limiter, &address_a, 100.0 ) ? 1 : 0;
+    }
+    snapshot_check( allowed == (int) Burst );
+
+    snapshot_check( limiter->num_entries == 2 );
+
+    // many more sources than the table holds. the table never grows and every new source still gets a bucket
+
+    for ( int i = 0; i < 1000; i++ )
+    {
+        struct snapshot_address_t address;
+        memset( &address, 0, sizeof( address ) );
+        address.type = SNAPSHOT_ADDRESS_IPV4;
+        address.data.ipv4[0] = 192;
+        address.data.ipv4[1] = 168;
+        address.data.ipv4[2] = (uint8_t) ( i >> 8 );
+        address.data.ipv4[3] = (uint8_t) i;
+        address.port = 40000;
+        snapshot_check( snapshot_rate_limiter_allow( limiter, &address, 200.0 + i ) );
+    }
+
+    snapshot_check( limiter->num_entries <= limiter->num_slots );
+
+    // after a reset every source starts over
+
+    snapshot_rate_limiter_reset( limiter );
+
+    snapshot_check( limiter->num_entries == 0 );
+    snapshot_check( snapshot_rate_limiter_allow( limiter, &address_a, 0.0 ) );
+
+    snapshot_rate_limiter_destroy( limiter );
+}
+
 void test_encryption_manager()
 {
-    struct snapshot_encryption_manager_t encryption_manager;
+    struct snapshot_encryption_manager_t * encryption_manager = snapshot_encryption_manager_create( NULL, SNAPSHOT_MAX_CLIENTS * SNAPSHOT_ENCRYPTION_MAPPINGS_PER_CLIENT );
 
-    snapshot_encryption_manager_reset( &encryption_manager );
+    snapshot_check( encryption_manager );
 
     double time = 100.0;
 
@@ -1362,14 +2526,14 @@ void test_encryption_manager()
 
     for ( int i = 0; i < NUM_ENCRYPTION_MAPPINGS; i++ )
     {
-        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[i].address, time );
+        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[i].address, time );
 
         snapshot_check( encryption_index == -1 );
 
-        snapshot_check( snapshot_encryption_manager_get_send_key( &encryption_manager, encryption_index ) == NULL );
-        snapshot_check( snapshot_encryption_manager_get_receive_key( &encryption_manager, encryption_index ) == NULL );
+        snapshot_check( snapshot_encryption_manager_get_send_key( encryption_manager, encryption_index ) == NULL );
+        snapshot_check( snapshot_encryption_manager_get_receive_key( encryption_manager, encryption_index ) == NULL );
 
-        snapshot_check( snapshot_encryption_manager_add_encryption_mapping( &encryption_manager, 
+        snapshot_check( snapshot_encryption_manager_add_encryption_mapping( encryption_manager, 
                                                                   &encryption_mapping[i].address, 
                                                                   encryption_mapping[i].send_key, 
                                                                   encryption_mapping[i].receive_key, 
@@ -1377,10 +2541,10 @@ void test_encryption_manager()
                                                                   -1.0,
                                                                   TEST_TIMEOUT_SECONDS ) );
 
-        encryption_index = snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[i].address, time );
+        encryption_index = snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[i].address, time );
 
-        uint8_t * send_key = snapshot_encryption_manager_get_send_key( &encryption_manager, encryption_index );
-        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( &encryption_manager, encryption_index );
+        uint8_t * send_key = snapshot_encryption_manager_get_send_key( encryption_manager, encryption_index );
+        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( encryption_manager, encryption_index );
 
         snapshot_check( send_key );
         snapshot_check( receive_key );
@@ -1396,23 +2560,23 @@ void test_encryption_manager()
         address.data.ipv6[7] = 1;
         address.port = 50000;
 
-        snapshot_check( snapshot_encryption_manager_remove_encryption_mapping( &encryption_manager, &address, time ) == 0 );
+        snapshot_check( snapshot_encryption_manager_remove_encryption_mapping( encryption_manager, &address, time ) == 0 );
     }
 
     // remove the first and last encryption mappings
 
-    snapshot_check( snapshot_encryption_manager_remove_encryption_mapping( &encryption_manager, &encryption_mapping[0].address, time ) == 1 );
+    snapshot_check( snapshot_encryption_manager_remove_encryption_mapping( encryption_manager, &encryption_mapping[0].address, time ) == 1 );
 
-    snapshot_check( snapshot_encryption_manager_remove_encryption_mapping( &encryption_manager, &encryption_mapping[NUM_ENCRYPTION_MAPPINGS-1].address, time ) == 1 );
+    snapshot_check( snapshot_encryption_manager_remove_encryption_mapping( encryption_manager, &encryption_mapping[NUM_ENCRYPTION_MAPPINGS-1].address, time ) == 1 );
 
     // make sure the encryption mappings that were removed can no longer be looked up by address
 
     for ( int i = 0; i < NUM_ENCRYPTION_MAPPINGS; i++ )
     {
-        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[i].address, time );
+        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[i].address, time );
 
-        uint8_t * send_key = snapshot_encryption_manager_get_send_key( &encryption_manager, encryption_index );
-        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( &encryption_manager, encryption_index );
+        uint8_t * send_key = snapshot_encryption_manager_get_send_key( encryption_manager, encryption_index );
+        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( encryption_manager, encryption_index );
 
         if ( i != 0 && i != NUM_ENCRYPTION_MAPPINGS - 1 )
         {
@@ -1431,7 +2595,7 @@ void test_encryption_manager()
 
     // add the encryption mappings back in
     
-    snapshot_check( snapshot_encryption_manager_add_encryption_mapping( &encryption_manager, 
+    snapshot_check( snapshot_encryption_manager_add_encryption_mapping( encryption_manager, 
                                                                         &encryption_mapping[0].address, 
                                                                         encryption_mapping[0].send_key, 
                                                                         encryption_mapping[0].receive_key, 
@@ -1439,7 +2603,7 @@ void test_encryption_manager()
                                                                         -1.0,
                                                                         TEST_TIMEOUT_SECONDS ) );
     
-    snapshot_check( snapshot_encryption_manager_add_encryption_mapping( &encryption_manager, 
+    snapshot_check( snapshot_encryption_manager_add_encryption_mapping( encryption_manager, 
                                                                         &encryption_mapping[NUM_ENCRYPTION_MAPPINGS-1].address, 
                                                                         encryption_mapping[NUM_ENCRYPTION_MAPPINGS-1].send_key, 
                                                                         encryption_mapping[NUM_ENCRYPTION_MAPPINGS-1].receive_key, 
@@ -1451,10 +2615,10 @@ void test_encryption_manager()
 
     for ( int i = 0; i < NUM_ENCRYPTION_MAPPINGS; i++ )
     {
-        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[i].address, time );
+        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[i].address, time );
 
-        uint8_t * send_key = snapshot_encryption_manager_get_send_key( &encryption_manager, encryption_index );
-        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( &encryption_manager, encryption_index );
+        uint8_t * send_key = snapshot_encryption_manager_get_send_key( encryption_manager, encryption_index );
+        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( encryption_manager, encryption_index );
 
         snapshot_check( send_key );
         snapshot_check( receive_key );
@@ -1469,10 +2633,10 @@ void test_encryption_manager()
 
     for ( int i = 0; i < NUM_ENCRYPTION_MAPPINGS; i++ )
     {
-        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[i].address, time );
+        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[i].address, time );
 
-        uint8_t * send_key = snapshot_encryption_manager_get_send_key( &encryption_manager, encryption_index );
-        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( &encryption_manager, encryption_index );
+        uint8_t * send_key = snapshot_encryption_manager_get_send_key( encryption_manager, encryption_index );
+        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( encryption_manager, encryption_index );
 
         snapshot_check( !send_key );
         snapshot_check( !receive_key );
@@ -1482,14 +2646,14 @@ void test_encryption_manager()
 
     for ( int i = 0; i < NUM_ENCRYPTION_MAPPINGS; i++ )
     {
-        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[i].address, time );
+        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[i].address, time );
 
         snapshot_check( encryption_index == -1 );
 
-        snapshot_check( snapshot_encryption_manager_get_send_key( &encryption_manager, encryption_index ) == NULL );
-        snapshot_check( snapshot_encryption_manager_get_receive_key( &encryption_manager, encryption_index ) == NULL );
+        snapshot_check( snapshot_encryption_manager_get_send_key( encryption_manager, encryption_index ) == NULL );
+        snapshot_check( snapshot_encryption_manager_get_receive_key( encryption_manager, encryption_index ) == NULL );
 
-        snapshot_check( snapshot_encryption_manager_add_encryption_mapping( &encryption_manager, 
+        snapshot_check( snapshot_encryption_manager_add_encryption_mapping( encryption_manager, 
                                                                   &encryption_mapping[i].address, 
                                                                   encryption_mapping[i].send_key, 
                                                                   encryption_mapping[i].receive_key, 
@@ -1497,10 +2661,10 @@ void test_encryption_manager()
                                                                   -1.0,
                                                                   TEST_TIMEOUT_SECONDS ) );
 
-        encryption_index = snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[i].address, time );
+        encryption_index = snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[i].address, time );
 
-        uint8_t * send_key = snapshot_encryption_manager_get_send_key( &encryption_manager, encryption_index );
-        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( &encryption_manager, encryption_index );
+        uint8_t * send_key = snapshot_encryption_manager_get_send_key( encryption_manager, encryption_index );
+        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( encryption_manager, encryption_index );
 
         snapshot_check( send_key );
         snapshot_check( receive_key );
@@ -1511,14 +2675,14 @@ void test_encryption_manager()
 
     // reset the encryption mapping and verify that all encryption mappings have been removed
 
-    snapshot_encryption_manager_reset( &encryption_manager );
+    snapshot_encryption_manager_reset( encryption_manager );
 
     for ( int i = 0; i < NUM_ENCRYPTION_MAPPINGS; i++ )
     {
-        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[i].address, time );
+        int encryption_index = snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[i].address, time );
 
-        uint8_t * send_key = snapshot_encryption_manager_get_send_key( &encryption_manager, encryption_index );
-        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( &encryption_manager, encryption_index );
+        uint8_t * send_key = snapshot_encryption_manager_get_send_key( encryption_manager, encryption_index );
+        uint8_t * receive_key = snapshot_encryption_manager_get_receive_key( encryption_manager, encryption_index );
 
         snapshot_check( !send_key );
         snapshot_check( !receive_key );
@@ -1526,7 +2690,7 @@ void test_encryption_manager()
 
     // test the expire time for encryption mapping works as expected
 
-    snapshot_check( snapshot_encryption_manager_add_encryption_mapping( &encryption_manager, 
+    snapshot_check( snapshot_encryption_manager_add_encryption_mapping( encryption_manager, 
                                                                         &encryption_mapping[0].address, 
                                                                         encryption_mapping[0].send_key, 
                                                                         encryption_mapping[0].receive_key, 
@@ -1534,26 +2698,32 @@ void test_encryption_manager()
                                                                         time + 1.0,
                                                                         TEST_TIMEOUT_SECONDS ) );
 
-    int encryption_index = snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[0].address, time );
+    int encryption_index = snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[0].address, time );
 
     snapshot_check( encryption_index != -1 );
 
-    snapshot_check( snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[0].address, time + 1.1f ) == -1 );
+    snapshot_check( snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[0].address, time + 1.1f ) == -1 );
+
+    snapshot_encryption_manager_set_expire_time( encryption_manager, encryption_index, -1.0 );
 
-    snapshot_encryption_manager_set_expire_time( &encryption_manager, encryption_index, -1.0 );
+    snapshot_check( snapshot_encryption_manager_find_encryption_mapping( encryption_manager, &encryption_mapping[0].address, time ) == encryption_index );
 
-    snapshot_check( snapshot_encryption_manager_find_encryption_mapping( &encryption_manager, &encryption_mapping[0].address, time ) == encryption_index );
+    snapshot_encryption_manager_destroy( encryption_manager );
 }
 
 void test_replay_protection()
 {
-    struct snapshot_replay_protection_t replay_protection;
+    uint64_t replay_protection_data[SNAPSHOT_REPLAY_PROTECTION_MAX_BYTES / sizeof(uint64_t)];
+
+    struct snapshot_replay_protection_t * replay_protection = (struct snapshot_replay_protection_t*) replay_protection_data;
+
+    snapshot_replay_protection_init( replay_protection, SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE );
 
     for ( int i = 0; i < 2; i++ )
     {
-        snapshot_replay_protection_reset( &replay_protection );
+        snapshot_replay_protection_reset( replay_protection );
 
-        snapshot_check( replay_protection.most_recent_sequence == 0 );
+        snapshot_check( replay_protection->most_recent_sequence == 0 );
 
         // the first time we receive packets, they should not be already received
 
@@ -1562,81 +2732,367 @@ void test_replay_protection()
         uint64_t sequence;
         for ( sequence = 0; sequence < MAX_SEQUENCE; ++sequence )
         {
-            snapshot_check( snapshot_replay_protection_already_received( &replay_protection, sequence ) == 0 );
-            snapshot_replay_protection_advance_sequence( &replay_protection, sequence );
+            snapshot_check( snapshot_replay_protection_already_received( replay_protection, sequence ) == 0 );
+            snapshot_replay_protection_advance_sequence( replay_protection, sequence );
         }
 
         // old packets outside buffer should be considered already received
 
-        snapshot_check( snapshot_replay_protection_already_received( &replay_protection, 0 ) == 1 );
+        snapshot_check( snapshot_replay_protection_already_received( replay_protection, 0 ) == 1 );
 
         // packets received a second time should be flagged already received
 
         for ( sequence = MAX_SEQUENCE - 10; sequence < MAX_SEQUENCE; ++sequence )
         {
-            snapshot_check( snapshot_replay_protection_already_received( &replay_protection, sequence ) == 1 );
+            snapshot_check( snapshot_replay_protection_already_received( replay_protection, sequence ) == 1 );
         }
 
         // jumping ahead to a much higher sequence should be considered not already received
 
-        snapshot_check( snapshot_replay_protection_already_received( &replay_protection, MAX_SEQUENCE + SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE ) == 0 );
+        snapshot_check( snapshot_replay_protection_already_received( replay_protection, MAX_SEQUENCE + SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE ) == 0 );
 
         // old packets should be considered already received
 
         for ( sequence = 0; sequence < MAX_SEQUENCE; ++sequence )
         {
-            snapshot_check( snapshot_replay_protection_already_received( &replay_protection, sequence ) == 1 );
+            snapshot_check( snapshot_replay_protection_already_received( replay_protection, sequence ) == 1 );
         }
     }
 }
 
-void test_ipv4_client_create_any_port()
+void test_replay_protection_window()
 {
-    struct snapshot_client_config_t client_config;
-    snapshot_default_client_config( &client_config );
+    const int window_bits[] = { 1024, 2048 };
 
-    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:0", &client_config, 0.0 );
+    for ( int i = 0; i < (int) ( sizeof(window_bits) / sizeof(int) ); ++i )
+    {
+        const int WindowBits = window_bits[i];
 
-    snapshot_check( client );
-    snapshot_check( snapshot_client_port( client ) != 0 );
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
+        snapshot_check( snapshot_replay_protection_bytes( WindowBits ) < snapshot_replay_protection_bytes( SNAPSHOT_REPLAY_PROTECTION_BUFFER_SIZE ) );
 
-    snapshot_client_destroy( client );
-}
+        // the window must work when only the bytes for its bitmap are allocated
 
-void test_ipv4_client_create_specific_port()
-{
-    struct snapshot_client_config_t client_config;
-    snapshot_default_client_config( &client_config );
+        struct snapshot_replay_protection_t * replay_protection = (struct snapshot_replay_protection_t*) malloc( snapshot_replay_protection_bytes( WindowBits ) );
+        snapshot_check( replay_protection );
 
-    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, 0.0 );
+        snapshot_replay_protection_init( replay_protection, WindowBits );
 
-    snapshot_check( client );
-    snapshot_check( snapshot_client_port( client ) == 30000 );
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
+        snapshot_check( replay_protection->most_recent_sequence == 0 );
 
-    snapshot_client_destroy( client );
-}
+        // every sequence is accepted exactly once
 
-void test_ipv4_client_server_connect()
-{
-    double time = 0.0;
-    double delta_time = 1.0 / 10.0;
+        const uint64_t MaxSequence = WindowBits * 4;
 
-    struct snapshot_client_config_t client_config;
-    snapshot_default_client_config( &client_config );
+        for ( uint64_t sequence = 0; sequence < MaxSequence; ++sequence )
+        {
+            snapshot_check( snapshot_replay_protection_already_received( replay_protection, sequence ) == 0 );
+            snapshot_replay_protection_advance_sequence( replay_protection, sequence );
+            snapshot_check( snapshot_replay_protection_already_received( replay_protection, sequence ) == 1 );
+        }
 
-    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:50000", &client_config, time );
+        // packets behind the window are considered already received
 
-    snapshot_check( client );
+        snapshot_check( snapshot_replay_protection_already_received( replay_protection, 0 ) == 1 );
+        snapshot_check( snapshot_replay_protection_already_received( replay_protection, MaxSequence - WindowBits - 1 ) == 1 );
 
-    uint8_t private_key[SNAPSHOT_KEY_BYTES];
-    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+        // skip ahead, leaving holes. the holes are accepted once, as long as they are within window bits - 64 of the most recent sequence
 
-    struct snapshot_server_config_t server_config;
-    snapshot_default_server_config( &server_config );
-    server_config.max_clients = 1;
-    server_config.protocol_id = TEST_PROTOCOL_ID;
+        uint64_t base = MaxSequence + 100;
+
+        for ( uint64_t sequence = base; sequence < base + WindowBits - 64; sequence += 2 )
+        {
+            snapshot_replay_protection_advance_sequence( replay_protection, sequence );
+        }
+
+        const uint64_t most_recent = replay_protection->most_recent_sequence;
+
+        for ( uint64_t sequence = base + 1; sequence < base + WindowBits - 64; sequence += 2 )
+        {
+            if ( most_recent - sequence > (uint64_t) ( WindowBits - 64 ) )
+                continue;
+            snapshot_check( snapshot_replay_protection_already_received( replay_protection, sequence ) == 0 );
+            snapshot_replay_protection_advance_sequence( replay_protection, sequence );
+            snapshot_check( snapshot_replay_protection_already_received( replay_protection, sequence ) == 1 );
+        }
+
+        // a jump further than the window clears it
+
+        base = most_recent + WindowBits * 3;
+
+        snapshot_replay_protection_advance_sequence( replay_protection, base );
+
+        for ( uint64_t sequence = base - WindowBits + 64; sequence < base; ++sequence )
+        {
+            snapshot_check( snapshot_replay_protection_already_received( replay_protection, sequence ) == 0 );
+        }
+
+        snapshot_check( snapshot_replay_protection_already_received( replay_protection, base ) == 1 );
+
+        // random reordering within the window must never accept the same sequence twice, and never reject a new one
+
+        snapshot_replay_protection_reset( replay_protection );
+
+        const int NumSequences = WindowBits * 8;
+
+        uint8_t * received = (uint8_t*) malloc( NumSequences );
+        snapshot_check( received );
+        memset( received, 0, NumSequences );
+
+        uint64_t highest = 0;
+
+        for ( int j = 0; j < NumSequences * 4; ++j )
+        {
+            const uint64_t offset = (uint64_t) ( rand() % ( WindowBits - 64 ) );
+            uint64_t sequence = highest + 16 - ( offset < highest + 16 ? offset : highest + 16 );
+            if ( sequence >= (uint64_t) NumSequences )
+                break;
+
+            const int already_received = snapshot_replay_protection_already_received( replay_protection, sequence );
+
+            snapshot_check( already_received == received[sequence] );
+
+            if ( !already_received )
+            {
+                snapshot_replay_protection_advance_sequence( replay_protection, sequence );
+                received[sequence] = 1;
+                if ( sequence > highest )
+                    highest = sequence;
+            }
+        }
+
+        free( received );
+
+        free( replay_protection );
+    }
+}
+
+void test_handshake_pool()
+{
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    uint8_t challenge_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( challenge_key, SNAPSHOT_KEY_BYTES );
+
+    snapshot_check( snapshot_handshake_pool_create( NULL, 0, 8, TEST_PROTOCOL_ID, private_key, challenge_key ) == NULL );
+    snapshot_check( snapshot_handshake_pool_create( NULL, SNAPSHOT_HANDSHAKE_MAX_THREADS + 1, 8, TEST_PROTOCOL_ID, private_key, challenge_key ) == NULL );
+    snapshot_check( snapshot_handshake_pool_create( NULL, 2, 7, TEST_PROTOCOL_ID, private_key, challenge_key ) == NULL );
+
+    const int NumThreads = 2;
+    const int QueueSize = 8;
+    const int NumJobs = NumThreads * QueueSize;
+    const int NumDrops = 10;
+
+    struct snapshot_handshake_pool_t * pool = snapshot_handshake_pool_create( NULL, NumThreads, QueueSize, TEST_PROTOCOL_ID, private_key, challenge_key );
+    snapshot_check( pool );
+
+    // write a connection request packet the same way the client does
+
+    struct snapshot_address_t server_address;
+    snapshot_address_parse( &server_address, "127.0.0.1:40000" );
+
+    struct snapshot_address_t client_address;
+    snapshot_address_parse( &client_address, "127.0.0.1:50000" );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
+
+    struct snapshot_connect_token_private_t connect_token;
+    snapshot_generate_connect_token_private( &connect_token, TEST_CLIENT_ID, TEST_TIMEOUT_SECONDS, 1, &server_address, user_data );
+
+    uint8_t connect_token_data[SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES];
+    snapshot_write_connect_token_private( &connect_token, connect_token_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
+
+    const uint64_t connect_token_expire_timestamp = time( NULL ) + 30;
+    uint8_t connect_token_nonce[SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES];
+    snapshot_crypto_random_bytes( connect_token_nonce, SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES );
+
+    snapshot_check( snapshot_encrypt_connect_token_private( connect_token_data, 
+                                                            SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES, 
+                                                            SNAPSHOT_VERSION_INFO, 
+                                                            TEST_PROTOCOL_ID, 
+                                                            connect_token_expire_timestamp, 
+                                                            connect_token_nonce, 
+                                                            private_key ) == SNAPSHOT_OK );
+
+    struct snapshot_connection_request_packet_t request_packet;
+    request_packet.packet_type = SNAPSHOT_CONNECTION_REQUEST_PACKET;
+    memcpy( request_packet.version_info, SNAPSHOT_VERSION_INFO, SNAPSHOT_VERSION_INFO_BYTES );
+    request_packet.protocol_id = TEST_PROTOCOL_ID;
+    request_packet.connect_token_expire_timestamp = connect_token_expire_timestamp;
+    memcpy( request_packet.connect_token_nonce, connect_token_nonce, SNAPSHOT_CONNECT_TOKEN_NONCE_BYTES );
+    request_packet.cipher_suite = SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305;
+    memcpy( request_packet.connect_token_data, connect_token_data, SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES );
+
+    uint8_t buffer[SNAPSHOT_MAX_PACKET_BYTES];
+    int packet_bytes = 0;
+    uint8_t * packet_data = snapshot_write_packet( &request_packet, buffer, sizeof( buffer ), 0, NULL, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
+    snapshot_check( packet_data );
+    snapshot_check( packet_bytes <= SNAPSHOT_HANDSHAKE_MAX_PACKET_BYTES );
+
+    // queue more jobs than the rings hold without taking any results. jobs hold their slots until released, so exactly the overflow is dropped
+
+    for ( int i = 0; i < NumJobs + NumDrops; i++ )
+    {
+        struct snapshot_handshake_t * handshake = snapshot_handshake_pool_begin_job( pool );
+        if ( !handshake )
+            continue;
+        handshake->type = SNAPSHOT_HANDSHAKE_CONNECTION_REQUEST;
+        handshake->from = client_address;
+        handshake->current_timestamp = time( NULL );
+        handshake->challenge_token_sequence = i;
+        handshake->packet_bytes = packet_bytes;
+        memcpy( handshake->packet_data, packet_data, packet_bytes );
+        if ( i == 0 )
+        {
+            handshake->packet_data[packet_bytes-1] ^= 1;
+        }
+        snapshot_handshake_pool_commit_job( pool );
+    }
+
+    uint64_t counters[SNAPSHOT_HANDSHAKE_NUM_COUNTERS];
+    snapshot_handshake_pool_counters( pool, counters );
+
+    snapshot_check( snapshot_handshake_pool_queue_depth( pool ) == NumJobs );
+    snapshot_check( counters[SNAPSHOT_HANDSHAKE_COUNTER_JOBS_QUEUED] == (uint64_t) NumJobs );
+    snapshot_check( counters[SNAPSHOT_HANDSHAKE_COUNTER_QUEUE_DROPS] == (uint64_t) NumDrops );
+    snapshot_check( counters[SNAPSHOT_HANDSHAKE_COUNTER_QUEUE_MAX_DEPTH] == (uint64_t) NumJobs );
+
+    for ( int iteration = 0; iteration < 5000; iteration++ )
+    {
+        snapshot_handshake_pool_counters( pool, counters );
+        if ( counters[SNAPSHOT_HANDSHAKE_COUNTER_JOBS_COMPLETED] + counters[SNAPSHOT_HANDSHAKE_COUNTER_JOBS_FAILED] == (uint64_t) NumJobs )
+            break;
+        snapshot_platform_sleep( 0.001 );
+    }
+
+    snapshot_check( counters[SNAPSHOT_HANDSHAKE_COUNTER_JOBS_COMPLETED] == (uint64_t) NumJobs - 1 );
+    snapshot_check( counters[SNAPSHOT_HANDSHAKE_COUNTER_JOBS_FAILED] == 1 );
+
+    // every completed request has the connect token and an encrypted challenge token for its reserved sequence
+
+    uint8_t challenge_token_data[SNAPSHOT_CHALLENGE_TOKEN_BYTES];
+    uint64_t challenge_token_sequence = 0;
+
+    int num_completed = 0;
+    int num_failed = 0;
+    struct snapshot_handshake_t * handshake;
+    while ( ( handshake = snapshot_handshake_pool_next_completed_job( pool ) ) != NULL )
+    {
+        if ( handshake->result == SNAPSHOT_OK )
+        {
+            snapshot_check( snapshot_address_equal( &handshake->from, &client_address ) );
+            snapshot_check( handshake->cipher_suite == SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305 );
+            snapshot_check( handshake->connect_token.client_id == TEST_CLIENT_ID );
+            snapshot_check( handshake->connect_token_expire_timestamp == connect_token_expire_timestamp );
+            snapshot_check( memcmp( handshake->connect_token.user_data, user_data, SNAPSHOT_USER_DATA_BYTES ) == 0 );
+            snapshot_check( memcmp( handshake->connect_token_mac, connect_token_data + SNAPSHOT_CONNECT_TOKEN_PRIVATE_BYTES - SNAPSHOT_MAC_BYTES, SNAPSHOT_MAC_BYTES ) == 0 );
+            memcpy( challenge_token_data, handshake->challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+            challenge_token_sequence = handshake->challenge_token_sequence;
+            num_completed++;
+        }
+        else
+        {
+            snapshot_check( handshake->challenge_token_sequence == 0 );
+            num_failed++;
+        }
+        snapshot_handshake_pool_release_job( pool );
+    }
+
+    snapshot_check( num_completed == NumJobs - 1 );
+    snapshot_check( num_failed == 1 );
+    snapshot_check( snapshot_handshake_pool_queue_depth( pool ) == 0 );
+
+    // a connection response echoing one of those challenge tokens opens back to the client id, user data and session keys
+
+    struct snapshot_connection_response_packet_t response_packet;
+    response_packet.packet_type = SNAPSHOT_CONNECTION_RESPONSE_PACKET;
+    response_packet.challenge_token_sequence = challenge_token_sequence;
+    memcpy( response_packet.challenge_token_data, challenge_token_data, SNAPSHOT_CHALLENGE_TOKEN_BYTES );
+
+    packet_data = snapshot_write_packet( &response_packet, buffer, sizeof( buffer ), 0, connect_token.client_to_server_key, SNAPSHOT_CIPHER_SUITE_CHACHA20POLY1305, TEST_PROTOCOL_ID, &packet_bytes );
+    snapshot_check( packet_data );
+    snapshot_check( packet_bytes <= SNAPSHOT_HANDSHAKE_MAX_PACKET_BYTES );
+
+    handshake = snapshot_handshake_pool_begin_job( pool );
+    snapshot_check( handshake );
+    handshake->type = SNAPSHOT_HANDSHAKE_CONNECTION_RESPONSE;
+    handshake->from = client_address;
+    handshake->current_timestamp = time( NULL );
+    handshake->challenge_token_sequence = 0;
+    handshake->packet_bytes = packet_bytes;
+    memcpy( handshake->packet_data, packet_data, packet_bytes );
+    snapshot_handshake_pool_commit_job( pool );
+
+    handshake = NULL;
+    for ( int iteration = 0; iteration < 5000 && !handshake; iteration++ )
+    {
+        handshake = snapshot_handshake_pool_next_completed_job( pool );
+        if ( !handshake )
+        {
+            snapshot_platform_sleep( 0.001 );
+        }
+    }
+
+    snapshot_check( handshake );
+    snapshot_check( handshake->result == SNAPSHOT_OK );
+    snapshot_check( handshake->challenge_token.client_id == TEST_CLIENT_ID );
+    snapshot_check( memcmp( handshake->challenge_token.user_data, user_data, SNAPSHOT_USER_DATA_BYTES ) == 0 );
+    snapshot_check( memcmp( handshake->challenge_token.client_to_server_key, connect_token.client_to_server_key, SNAPSHOT_KEY_BYTES ) == 0 );
+    snapshot_check( snapshot_address_equal( &handshake->challenge_token.address, &client_address ) );
+
+    snapshot_handshake_pool_release_job( pool );
+
+    snapshot_handshake_pool_destroy( pool );
+}
+
+void test_ipv4_client_create_any_port()
+{
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:0", &client_config, 0.0 );
+
+    snapshot_check( client );
+    snapshot_check( snapshot_client_port( client ) != 0 );
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
+
+    snapshot_client_destroy( client );
+}
+
+void test_ipv4_client_create_specific_port()
+{
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, 0.0 );
+
+    snapshot_check( client );
+    snapshot_check( snapshot_client_port( client ) == 30000 );
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
+
+    snapshot_client_destroy( client );
+}
+
+void test_ipv4_client_server_connect()
+{
+    double time = 0.0;
+    double delta_time = 1.0 / 10.0;
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:50000", &client_config, time );
+
+    snapshot_check( client );
+
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.max_clients = 1;
+    server_config.protocol_id = TEST_PROTOCOL_ID;
     memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
 
     const char * server_address = "127.0.0.1:40000";
@@ -1679,6 +3135,101 @@ void test_ipv4_client_server_connect()
     snapshot_client_destroy( client );
 }
 
+static void test_client_server_aes256gcm_available( SNAPSHOT_BOOL aes256gcm_available )
+{
+    snapshot_crypto_force_aes256gcm_available( aes256gcm_available );
+
+    double time = 0.0;
+    double delta_time = 1.0 / 10.0;
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:50000", &client_config, time );
+
+    snapshot_check( client );
+
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.max_clients = 1;
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    const char * server_address = "127.0.0.1:40000";
+
+    struct snapshot_server_t * server = snapshot_server_create( server_address, &server_config, time );
+
+    snapshot_check( server );
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+    uint64_t client_id = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+
+    snapshot_check( snapshot_generate_connect_token_with_cipher_suite( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, SNAPSHOT_CIPHER_SUITE_AES256GCM, connect_token ) == SNAPSHOT_OK );
+
+    snapshot_client_connect( client, connect_token );
+
+    while ( 1 )
+    {
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+
+    // keep alives flow both ways without errors once connected
+
+    for ( int i = 0; i < 20; i++ )
+    {
+        time += delta_time;
+
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+    snapshot_check( snapshot_server_client_connected( server, 0 ) );
+    snapshot_check( snapshot_client_counters( client )[SNAPSHOT_CLIENT_COUNTER_READ_PACKET_FAILURES] == 0 );
+    snapshot_check( snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_READ_PACKET_FAILURES] == 0 );
+
+    snapshot_server_destroy( server );
+
+    snapshot_client_destroy( client );
+}
+
+void test_client_server_aes256gcm()
+{
+    // a connect token asking for aes256gcm connects either way: with aes-ni it is used, without it the client falls back to chacha20-poly1305
+
+    const SNAPSHOT_BOOL aes256gcm_available = snapshot_crypto_aes256gcm_available();
+
+    if ( aes256gcm_available )
+    {
+        test_client_server_aes256gcm_available( SNAPSHOT_TRUE );
+    }
+
+    test_client_server_aes256gcm_available( SNAPSHOT_FALSE );
+
+    snapshot_crypto_force_aes256gcm_available( aes256gcm_available );
+}
+
 void generate_passthrough_packet( uint8_t * packet_data, int * packet_bytes )
 {
     *packet_bytes = 1 + rand() % SNAPSHOT_MAX_PASSTHROUGH_BYTES;
@@ -2159,7 +3710,7 @@ void test_client_server_loopback()
 
 void test_client_server_network_simulator()
 {
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
 
     snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
 
@@ -2230,7 +3781,7 @@ void test_client_server_network_simulator()
 
 void test_client_server_keep_alive()
 {
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
 
     snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
 
@@ -2329,7 +3880,7 @@ void test_client_server_keep_alive()
 
 void test_client_server_multiple_clients()
 {
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 32 );
 
     snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
 
@@ -2453,7 +4004,7 @@ void test_client_server_multiple_clients()
 
 void test_client_server_multiple_servers()
 {
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
 
     snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
 
@@ -2525,21 +4076,29 @@ void test_client_server_multiple_servers()
     snapshot_network_simulator_destroy( network_simulator );
 }
 
-void test_client_error_connect_token_expired()
+void test_client_server_io_thread()
 {
     uint8_t private_key[SNAPSHOT_KEY_BYTES];
     snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
 
-    double time = 0.0;
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    server_config.max_clients = 4;
+    server_config.io_thread = SNAPSHOT_TRUE;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+
+    snapshot_check( server );
 
     struct snapshot_client_config_t client_config;
     snapshot_default_client_config( &client_config );
-    
-    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+    client_config.io_thread = SNAPSHOT_TRUE;
 
-    snapshot_check( client );
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:50000", &client_config, 0.0 );
 
-    const char * server_address = "127.0.0.1:40000";
+    snapshot_check( client );
 
     uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
 
@@ -2547,276 +4106,401 @@ void test_client_error_connect_token_expired()
     snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
 
     uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
-    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+    snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
 
-    snapshot_check( snapshot_generate_connect_token( 1, &server_address, 0, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+    const char * server_address = "127.0.0.1:40000";
+
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
 
     snapshot_client_connect( client, connect_token );
 
-    snapshot_client_update( client, time );
+    // sockets are serviced on the io threads, so run in real time
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECT_TOKEN_EXPIRED );
+    const double start_time = snapshot_platform_time();
 
-    snapshot_client_destroy( client );
-}
+    while ( snapshot_platform_time() - start_time < 5.0 )
+    {
+        const double time = snapshot_platform_time() - start_time;
 
-void test_client_error_invalid_connect_token()
-{
-    uint8_t private_key[SNAPSHOT_KEY_BYTES];
-    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+        snapshot_client_update( client, time );
 
-    double time = 0.0;
+        snapshot_server_update( server, time );
 
-    struct snapshot_client_config_t client_config;
-    snapshot_default_client_config( &client_config );
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
 
-    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED && snapshot_server_num_connected_clients( server ) == 1 )
+            break;
 
-    snapshot_check( client );
+        snapshot_platform_sleep( 0.01 );
+    }
 
-    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
-    snapshot_crypto_random_bytes( connect_token, SNAPSHOT_CONNECT_TOKEN_BYTES );
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
+    snapshot_check( snapshot_server_client_id( server, 0 ) == client_id );
 
-    uint64_t client_id = 0;
-    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+    const uint64_t * client_counters = snapshot_client_counters( client );
+    const uint64_t * server_counters = snapshot_server_counters( server );
 
-    snapshot_client_connect( client, connect_token );
+    snapshot_check( client_counters[SNAPSHOT_CLIENT_COUNTER_PACKETS_RECEIVED] > 0 );
+    snapshot_check( client_counters[SNAPSHOT_CLIENT_COUNTER_IO_RECEIVE_QUEUE_DROPS] == 0 );
+    snapshot_check( client_counters[SNAPSHOT_CLIENT_COUNTER_IO_SEND_QUEUE_DROPS] == 0 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PACKETS_RECEIVED] > 0 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_IO_RECEIVE_QUEUE_DROPS] == 0 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_IO_SEND_QUEUE_DROPS] == 0 );
+    snapshot_check( client_counters[SNAPSHOT_CLIENT_COUNTER_CRYPTO_ISA] == (uint64_t) snapshot_crypto_isa() );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_CRYPTO_ISA] == (uint64_t) snapshot_crypto_isa() );
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_INVALID_CONNECT_TOKEN );
+    // disconnect packets queued on the client are flushed by its io thread on destroy
 
     snapshot_client_destroy( client );
-}
-
-void test_client_error_connection_timed_out()
-{
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
 
-    snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
-
-    uint8_t private_key[SNAPSHOT_KEY_BYTES];
-    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+    const double disconnect_time = snapshot_platform_time();
 
-    double time = 0.0;
-    double delta_time = 1.0 / 10.0;
+    while ( snapshot_platform_time() - disconnect_time < 5.0 && snapshot_server_num_connected_clients( server ) > 0 )
+    {
+        snapshot_server_update( server, snapshot_platform_time() - start_time );
+        snapshot_platform_sleep( 0.01 );
+    }
 
-    // connect a client to the server
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_DISCONNECT_PACKETS_RECEIVED] > 0 );
 
-    struct snapshot_client_config_t client_config;
-    snapshot_default_client_config( &client_config );
-    client_config.network_simulator = network_simulator;
+    snapshot_server_destroy( server );
+}
 
-    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+void test_client_server_handshake_threads()
+{
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
 
-    snapshot_check( client );
+    const int NumClients = 4;
 
     struct snapshot_server_config_t server_config;
     snapshot_default_server_config( &server_config );
-    server_config.max_clients = 1;
     server_config.protocol_id = TEST_PROTOCOL_ID;
-    server_config.network_simulator = network_simulator;
+    server_config.max_clients = NumClients;
+    server_config.handshake_threads = 2;
     memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
 
-    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, time );
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
 
     snapshot_check( server );
 
     const char * server_address = "127.0.0.1:40000";
 
-    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
-
-    uint64_t client_id = 0;
-    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+    struct snapshot_client_t * client[NumClients];
+    uint64_t client_id[NumClients];
 
-    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
-    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+    for ( int i = 0; i < NumClients; i++ )
+    {
+        struct snapshot_client_config_t client_config;
+        snapshot_default_client_config( &client_config );
 
-    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+        char client_address[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
+        snprintf( client_address, sizeof(client_address), "0.0.0.0:%d", 50000 + i );
 
-    snapshot_client_connect( client, connect_token );
+        client[i] = snapshot_client_create( client_address, &client_config, 0.0 );
 
-    while ( 1 )
-    {
-        snapshot_network_simulator_update( network_simulator, time );
+        snapshot_check( client[i] );
 
-        snapshot_client_update( client, time );
+        client_id[i] = i + 1;
 
-        snapshot_server_update( server, time );
+        uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+        snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
 
-        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
-            break;
+        uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
 
-        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
-            break;
+        snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id[i], TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
 
-        time += delta_time;
+        snapshot_client_connect( client[i], connect_token );
     }
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
-    snapshot_check( snapshot_client_index( client ) == 0 );
-    snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
-    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
+    // handshake jobs complete on the handshake threads, so run in real time
 
-    // now disable updating the server and verify that the client times out
+    const double start_time = snapshot_platform_time();
 
-    while ( 1 )
+    while ( snapshot_platform_time() - start_time < 5.0 )
     {
-        snapshot_network_simulator_update( network_simulator, time );
+        const double time = snapshot_platform_time() - start_time;
 
-        snapshot_client_update( client, time );
+        int num_connected_clients = 0;
 
-        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+        for ( int i = 0; i < NumClients; i++ )
+        {
+            snapshot_client_update( client[i], time );
+
+            if ( snapshot_client_state( client[i] ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+                num_connected_clients++;
+        }
+
+        snapshot_server_update( server, time );
+
+        if ( num_connected_clients == NumClients && snapshot_server_num_connected_clients( server ) == NumClients )
             break;
 
-        time += delta_time;
+        snapshot_platform_sleep( 0.01 );
     }
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTION_TIMED_OUT );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == NumClients );
 
-    snapshot_server_destroy( server );
+    for ( int i = 0; i < NumClients; i++ )
+    {
+        snapshot_check( snapshot_client_state( client[i] ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+        snapshot_check( snapshot_server_client_id( server, snapshot_client_index( client[i] ) ) == client_id[i] );
+    }
 
-    snapshot_client_destroy( client );
+    const uint64_t * server_counters = snapshot_server_counters( server );
 
-    snapshot_network_simulator_destroy( network_simulator );
-}
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_CONNECTION_REQUEST_PACKETS_RECEIVED] >= (uint64_t) NumClients );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_CONNECTION_CHALLENGE_PACKETS_SENT] >= (uint64_t) NumClients );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_CLIENT_CONNECTS] == (uint64_t) NumClients );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_HANDSHAKE_QUEUE_DROPS] == 0 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_HANDSHAKE_JOBS_FAILED] == 0 );
 
-void test_client_error_connection_response_timeout()
-{
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+    for ( int i = 0; i < NumClients; i++ )
+    {
+        snapshot_client_destroy( client[i] );
+    }
 
-    snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
+    snapshot_server_destroy( server );
+}
 
+void test_client_server_stateless_handshake()
+{
     uint8_t private_key[SNAPSHOT_KEY_BYTES];
     snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
 
-    double time = 0.0;
-    double delta_time = 1.0 / 10.0;
+    const int NumClients = 4;
 
-    struct snapshot_client_config_t client_config;
-    snapshot_default_client_config( &client_config );
-    client_config.network_simulator = network_simulator;
+    // run the stateless handshake inline and on handshake threads
 
-    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+    for ( int handshake_threads = 0; handshake_threads <= 2; handshake_threads += 2 )
+    {
+        struct snapshot_server_config_t server_config;
+        snapshot_default_server_config( &server_config );
+        server_config.protocol_id = TEST_PROTOCOL_ID;
+        server_config.max_clients = NumClients;
+        server_config.handshake_threads = handshake_threads;
+        server_config.stateless_handshake = SNAPSHOT_TRUE;
+        memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
 
-    snapshot_check( client );
+        struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
 
-    struct snapshot_server_config_t server_config;
-    snapshot_default_server_config( &server_config );
-    server_config.max_clients = 1;
-    server_config.protocol_id = TEST_PROTOCOL_ID;
-    server_config.network_simulator = network_simulator;
-    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+        snapshot_check( server );
 
-    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, time );
+        const char * server_address = "127.0.0.1:40000";
 
-    snapshot_check( server );
+        struct snapshot_client_t * client[NumClients];
+        uint64_t client_id[NumClients];
 
-    snapshot_server_set_flags( server, SNAPSHOT_SERVER_FLAG_IGNORE_CONNECTION_RESPONSE_PACKETS );
+        for ( int i = 0; i < NumClients; i++ )
+        {
+            struct snapshot_client_config_t client_config;
+            snapshot_default_client_config( &client_config );
 
-    const char * server_address = "127.0.0.1:40000";
+            char client_address[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
+            snprintf( client_address, sizeof(client_address), "0.0.0.0:%d", 50000 + i );
 
-    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+            client[i] = snapshot_client_create( client_address, &client_config, 0.0 );
 
-    uint64_t client_id = 0;
-    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+            snapshot_check( client[i] );
 
-    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
-    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+            client_id[i] = i + 1;
 
-    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+            uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+            snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
 
-    snapshot_client_connect( client, connect_token );
+            uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
 
-    while ( 1 )
-    {
-        snapshot_network_simulator_update( network_simulator, time );
+            snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id[i], TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
 
-        snapshot_client_update( client, time );
+            snapshot_client_connect( client[i], connect_token );
+        }
 
-        snapshot_server_update( server, time );
+        // while connection responses are ignored, every client is challenged but no encryption mapping is added
 
-        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
-            break;
+        snapshot_server_set_flags( server, SNAPSHOT_SERVER_FLAG_IGNORE_CONNECTION_RESPONSE_PACKETS );
 
-        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED  )
-            break;
+        const uint64_t * server_counters = snapshot_server_counters( server );
 
-        time += delta_time;
-    }
+        const double start_time = snapshot_platform_time();
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTION_RESPONSE_TIMED_OUT );
+        while ( snapshot_platform_time() - start_time < 5.0 )
+        {
+            const double time = snapshot_platform_time() - start_time;
 
-    snapshot_server_destroy( server );
+            for ( int i = 0; i < NumClients; i++ )
+            {
+                snapshot_client_update( client[i], time );
+            }
 
-    snapshot_client_destroy( client );
+            snapshot_server_update( server, time );
 
-    snapshot_network_simulator_destroy( network_simulator );
-}
+            if ( server_counters[SNAPSHOT_SERVER_COUNTER_CONNECTION_CHALLENGE_PACKETS_SENT] >= (uint64_t) NumClients )
+                break;
 
-void test_client_error_connection_request_timeout()
-{
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+            snapshot_platform_sleep( 0.01 );
+        }
 
-    snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
+        snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_CONNECTION_CHALLENGE_PACKETS_SENT] >= (uint64_t) NumClients );
+        snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_ENCRYPTION_MAPPINGS_ADDED] == 0 );
+        snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
 
-    uint8_t private_key[SNAPSHOT_KEY_BYTES];
-    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+        // once responses are processed, each client gets exactly one encryption mapping as it connects
+
+        snapshot_server_set_flags( server, 0 );
+
+        while ( snapshot_platform_time() - start_time < 10.0 )
+        {
+            const double time = snapshot_platform_time() - start_time;
+
+            int num_connected_clients = 0;
+
+            for ( int i = 0; i < NumClients; i++ )
+            {
+                snapshot_client_update( client[i], time );
+
+                if ( snapshot_client_state( client[i] ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+                    num_connected_clients++;
+            }
+
+            snapshot_server_update( server, time );
+
+            if ( num_connected_clients == NumClients && snapshot_server_num_connected_clients( server ) == NumClients )
+                break;
+
+            snapshot_platform_sleep( 0.01 );
+        }
+
+        snapshot_check( snapshot_server_num_connected_clients( server ) == NumClients );
+
+        for ( int i = 0; i < NumClients; i++ )
+        {
+            snapshot_check( snapshot_client_state( client[i] ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+            snapshot_check( snapshot_server_client_id( server, snapshot_client_index( client[i] ) ) == client_id[i] );
+        }
+
+        snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_CLIENT_CONNECTS] == (uint64_t) NumClients );
+        snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_ENCRYPTION_MAPPINGS_ADDED] == (uint64_t) NumClients );
+
+        for ( int i = 0; i < NumClients; i++ )
+        {
+            snapshot_client_destroy( client[i] );
+        }
+
+        snapshot_server_destroy( server );
+    }
+}
+
+void test_client_server_stateless_handshake_replay()
+{
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
 
     double time = 0.0;
-    double delta_time = 1.0 / 60.0;
+    double delta_time = 1.0 / 10.0;
 
     struct snapshot_client_config_t client_config;
     snapshot_default_client_config( &client_config );
     client_config.network_simulator = network_simulator;
 
-    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:50000", &client_config, time );
 
     snapshot_check( client );
 
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
     struct snapshot_server_config_t server_config;
     snapshot_default_server_config( &server_config );
     server_config.max_clients = 1;
     server_config.protocol_id = TEST_PROTOCOL_ID;
     server_config.network_simulator = network_simulator;
+    server_config.stateless_handshake = SNAPSHOT_TRUE;
     memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
 
-    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, time );
+    const char * server_address_string = "127.0.0.1:40000";
 
-    snapshot_check( server );
+    struct snapshot_address_t server_address;
+    snapshot_check( snapshot_address_parse( &server_address, server_address_string ) == SNAPSHOT_OK );
 
-    snapshot_server_set_flags( server, SNAPSHOT_SERVER_FLAG_IGNORE_CONNECTION_REQUEST_PACKETS );
+    struct snapshot_server_t * server = snapshot_server_create( server_address_string, &server_config, time );
 
-    const char * server_address = "[::1]:40000";
+    snapshot_check( server );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
 
     uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
 
-    uint64_t client_id = 0;
-    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address_string, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, TEST_CLIENT_ID, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
 
-    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
-    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+    snapshot_client_connect( client, connect_token );
 
-    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+    // pass packets to the server by hand so the connection response can be kept and replayed later
 
-    snapshot_client_connect( client, connect_token );
+    uint8_t response_packet_data[SNAPSHOT_MAX_PACKET_BYTES];
+    int response_packet_bytes = 0;
+    struct snapshot_address_t response_from;
+    memset( &response_from, 0, sizeof( response_from ) );
 
-    while ( 1 )
+    for ( int i = 0; i < 100; i++ )
     {
         snapshot_network_simulator_update( network_simulator, time );
 
         snapshot_client_update( client, time );
 
-        snapshot_server_update( server, time );
+        uint8_t * packet_data[16];
+        int packet_bytes[16];
+        struct snapshot_address_t from[16];
 
-        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
-            break;
+        const int num_packets = snapshot_network_simulator_receive_packets( network_simulator, &server_address, 16, packet_data, packet_bytes, from );
 
-        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED  )
+        for ( int j = 0; j < num_packets; j++ )
+        {
+            if ( packet_data[j][0] == SNAPSHOT_CONNECTION_RESPONSE_PACKET && response_packet_bytes == 0 )
+            {
+                memcpy( response_packet_data, packet_data[j], packet_bytes[j] );
+                response_packet_bytes = packet_bytes[j];
+                response_from = from[j];
+            }
+
+            snapshot_server_process_packet( server, &from[j], packet_data[j], packet_bytes[j] );
+
+            snapshot_destroy_packet( NULL, packet_data[j] );
+        }
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
             break;
 
         time += delta_time;
     }
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTION_REQUEST_TIMED_OUT );
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
+    snapshot_check( response_packet_bytes == SNAPSHOT_CONNECTION_RESPONSE_PACKET_BYTES );
+
+    // once the client is gone, replaying its connection response from the same address must not connect a client in its slot
+
+    snapshot_server_disconnect_client( server, 0 );
+
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+
+    snapshot_server_process_packet( server, &response_from, response_packet_data, response_packet_bytes );
+
+    time += delta_time;
+
+    snapshot_server_update( server, time );
+
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+    snapshot_check( !snapshot_server_client_connected( server, 0 ) );
+
+    const uint64_t * server_counters = snapshot_server_counters( server );
+
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_CLIENT_CONNECTS] == 1 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_ENCRYPTION_MAPPINGS_ADDED] == 1 );
 
     snapshot_server_destroy( server );
 
@@ -2825,23 +4509,85 @@ void test_client_error_connection_request_timeout()
     snapshot_network_simulator_destroy( network_simulator );
 }
 
-void test_client_error_connection_denied()
+void test_client_error_connect_token_expired()
 {
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
-
-    snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
-
     uint8_t private_key[SNAPSHOT_KEY_BYTES];
     snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
 
-    // start a server and connect one client
-
     double time = 0.0;
-    double delta_time = 1.0 / 10.0;
 
     struct snapshot_client_config_t client_config;
     snapshot_default_client_config( &client_config );
-    client_config.network_simulator = network_simulator;
+    
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+
+    snapshot_check( client );
+
+    const char * server_address = "127.0.0.1:40000";
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+    uint64_t client_id = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, 0, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+    snapshot_client_connect( client, connect_token );
+
+    snapshot_client_update( client, time );
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECT_TOKEN_EXPIRED );
+
+    snapshot_client_destroy( client );
+}
+
+void test_client_error_invalid_connect_token()
+{
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    double time = 0.0;
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+
+    snapshot_check( client );
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+    snapshot_crypto_random_bytes( connect_token, SNAPSHOT_CONNECT_TOKEN_BYTES );
+
+    uint64_t client_id = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+
+    snapshot_client_connect( client, connect_token );
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_INVALID_CONNECT_TOKEN );
+
+    snapshot_client_destroy( client );
+}
+
+void test_client_error_connection_timed_out()
+{
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
+
+    snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
+
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    double time = 0.0;
+    double delta_time = 1.0 / 10.0;
+
+    // connect a client to the server
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+    client_config.network_simulator = network_simulator;
 
     struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
 
@@ -2858,6 +4604,8 @@ void test_client_error_connection_denied()
 
     snapshot_check( server );
 
+    const char * server_address = "127.0.0.1:40000";
+
     uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
 
     uint64_t client_id = 0;
@@ -2866,8 +4614,6 @@ void test_client_error_connection_denied()
     uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
     snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
 
-    const char * server_address = "127.0.0.1:40000";
-
     snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
 
     snapshot_client_connect( client, connect_token );
@@ -2894,23 +4640,7 @@ void test_client_error_connection_denied()
     snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
     snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
 
-    // now attempt to connect a second client. the connection should be denied.
-
-    struct snapshot_client_t * client2 = snapshot_client_create( "0.0.0.0:30001", &client_config, time );
-
-    snapshot_check( client2 );
-
-    uint8_t connect_token2[SNAPSHOT_CONNECT_TOKEN_BYTES];
-
-    uint64_t client_id2 = 0;
-    snapshot_crypto_random_bytes( (uint8_t*) &client_id2, 8 );
-
-    uint8_t user_data2[SNAPSHOT_USER_DATA_BYTES];
-    snapshot_crypto_random_bytes(user_data2, SNAPSHOT_USER_DATA_BYTES);
-
-    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id2, TEST_PROTOCOL_ID, private_key, user_data2, connect_token2 ) == SNAPSHOT_OK );
-
-    snapshot_client_connect( client2, connect_token2 );
+    // now disable updating the server and verify that the client times out
 
     while ( 1 )
     {
@@ -2918,44 +4648,30 @@ void test_client_error_connection_denied()
 
         snapshot_client_update( client, time );
 
-        snapshot_client_update( client2, time );
-
-        snapshot_server_update( server, time );
-
         if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
             break;
 
-        if ( snapshot_client_state( client2 ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
-            break;
-
         time += delta_time;
     }
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
-    snapshot_check( snapshot_client_state( client2 ) == SNAPSHOT_CLIENT_STATE_CONNECTION_DENIED );
-    snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
-    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTION_TIMED_OUT );
 
     snapshot_server_destroy( server );
 
     snapshot_client_destroy( client );
-    
-    snapshot_client_destroy( client2 );
 
     snapshot_network_simulator_destroy( network_simulator );
 }
 
-void test_client_side_disconnect()
+void test_client_error_connection_response_timeout()
 {
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
 
     snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
 
     uint8_t private_key[SNAPSHOT_KEY_BYTES];
     snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
 
-    // start a server and connect one client
-
     double time = 0.0;
     double delta_time = 1.0 / 10.0;
 
@@ -2978,6 +4694,8 @@ void test_client_side_disconnect()
 
     snapshot_check( server );
 
+    snapshot_server_set_flags( server, SNAPSHOT_SERVER_FLAG_IGNORE_CONNECTION_RESPONSE_PACKETS );
+
     const char * server_address = "127.0.0.1:40000";
 
     uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
@@ -3003,37 +4721,13 @@ void test_client_side_disconnect()
         if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
             break;
 
-        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
-            break;
-
-        time += delta_time;
-    }
-
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
-    snapshot_check( snapshot_client_index( client ) == 0 );
-    snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
-    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
-
-    // disconnect client side and verify that the server sees that client disconnect cleanly, rather than timing out.
-
-    snapshot_client_disconnect( client );
-
-    for ( int i = 0; i < 10; i++ )
-    {
-        snapshot_network_simulator_update( network_simulator, time );
-
-        snapshot_client_update( client, time );
-
-        snapshot_server_update( server, time );
-
-        if ( snapshot_server_client_connected( server, 0 ) == 0 )
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED  )
             break;
 
         time += delta_time;
     }
 
-    snapshot_check( snapshot_server_client_connected( server, 0 ) == 0 );
-    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTION_RESPONSE_TIMED_OUT );
 
     snapshot_server_destroy( server );
 
@@ -3042,19 +4736,17 @@ void test_client_side_disconnect()
     snapshot_network_simulator_destroy( network_simulator );
 }
 
-void test_server_side_disconnect()
+void test_client_error_connection_request_timeout()
 {
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
 
-    snapshot_network_simulator_set( network_simulator, 100, 100, 1, 1 );
+    snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
 
     uint8_t private_key[SNAPSHOT_KEY_BYTES];
     snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
 
-    // start a server and connect one client
-
     double time = 0.0;
-    double delta_time = 1.0 / 10.0;
+    double delta_time = 1.0 / 60.0;
 
     struct snapshot_client_config_t client_config;
     snapshot_default_client_config( &client_config );
@@ -3075,7 +4767,9 @@ void test_server_side_disconnect()
 
     snapshot_check( server );
 
-    const char * server_address = "127.0.0.1:40000";
+    snapshot_server_set_flags( server, SNAPSHOT_SERVER_FLAG_IGNORE_CONNECTION_REQUEST_PACKETS );
+
+    const char * server_address = "[::1]:40000";
 
     uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
 
@@ -3100,38 +4794,13 @@ void test_server_side_disconnect()
         if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
             break;
 
-        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
-            break;
-
-        time += delta_time;
-    }
-
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
-    snapshot_check( snapshot_client_index( client ) == 0 );
-    snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
-    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
-
-    // disconnect server side and verify that the client disconnects cleanly, rather than timing out.
-
-    snapshot_server_disconnect_client( server, 0 );
-
-    for ( int i = 0; i < 10; i++ )
-    {
-        snapshot_network_simulator_update( network_simulator, time );
-
-        snapshot_client_update( client, time );
-
-        snapshot_server_update( server, time );
-
-        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED  )
             break;
 
         time += delta_time;
     }
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
-    snapshot_check( snapshot_server_client_connected( server, 0 ) == 0 );
-    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTION_REQUEST_TIMED_OUT );
 
     snapshot_server_destroy( server );
 
@@ -3140,9 +4809,9 @@ void test_server_side_disconnect()
     snapshot_network_simulator_destroy( network_simulator );
 }
 
-void test_client_reconnect()
+void test_client_error_connection_denied()
 {
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
 
     snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
 
@@ -3173,8 +4842,6 @@ void test_client_reconnect()
 
     snapshot_check( server );
 
-    const char * server_address = "127.0.0.1:40000";
-
     uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
 
     uint64_t client_id = 0;
@@ -3183,6 +4850,8 @@ void test_client_reconnect()
     uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
     snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
 
+    const char * server_address = "127.0.0.1:40000";
+
     snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
 
     snapshot_client_connect( client, connect_token );
@@ -3209,43 +4878,23 @@ void test_client_reconnect()
     snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
     snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
 
-    // wait for a bit, so any packets on the wire go away (otherwise, we sometimes have connection request packets in flight which break the test...)
-
-    time += 10.0;
-
-    snapshot_network_simulator_update( network_simulator, time );
-
-    snapshot_client_update( client, time );
-
-    snapshot_server_update( server, time );
-
-    // disconnect client on the server-side and wait until client sees the disconnect
-
-    snapshot_server_disconnect_client( server, 0 );
-
-    while ( 1 )
-    {
-        snapshot_network_simulator_update( network_simulator, time );
-
-        snapshot_client_update( client, time );
+    // now attempt to connect a second client. the connection should be denied.
 
-        snapshot_server_update( server, time );
+    struct snapshot_client_t * client2 = snapshot_client_create( "0.0.0.0:30001", &client_config, time );
 
-        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
-            break;
+    snapshot_check( client2 );
 
-        time += delta_time;
-    }
+    uint8_t connect_token2[SNAPSHOT_CONNECT_TOKEN_BYTES];
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
-    snapshot_check( snapshot_server_client_connected( server, 0 ) == 0 );
-    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+    uint64_t client_id2 = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id2, 8 );
 
-    // now reconnect the client and verify they connect
+    uint8_t user_data2[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes(user_data2, SNAPSHOT_USER_DATA_BYTES);
 
-    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id2, TEST_PROTOCOL_ID, private_key, user_data2, connect_token2 ) == SNAPSHOT_OK );
 
-    snapshot_client_connect( client, connect_token );
+    snapshot_client_connect( client2, connect_token2 );
 
     while ( 1 )
     {
@@ -3253,38 +4902,44 @@ void test_client_reconnect()
 
         snapshot_client_update( client, time );
 
+        snapshot_client_update( client2, time );
+
         snapshot_server_update( server, time );
 
         if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
             break;
 
-        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+        if ( snapshot_client_state( client2 ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
             break;
 
         time += delta_time;
     }
 
     snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
-    snapshot_check( snapshot_client_index( client ) == 0 );
+    snapshot_check( snapshot_client_state( client2 ) == SNAPSHOT_CLIENT_STATE_CONNECTION_DENIED );
     snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
     snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
 
     snapshot_server_destroy( server );
 
     snapshot_client_destroy( client );
+    
+    snapshot_client_destroy( client2 );
 
     snapshot_network_simulator_destroy( network_simulator );
 }
 
-void test_disable_timeout()
+void test_client_side_disconnect()
 {
-    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL );
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
 
     snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
 
     uint8_t private_key[SNAPSHOT_KEY_BYTES];
     snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
 
+    // start a server and connect one client
+
     double time = 0.0;
     double delta_time = 1.0 / 10.0;
 
@@ -3317,8 +4972,7 @@ void test_disable_timeout()
     uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
     snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
 
-    // IMPORTANT: passing in -1 timeout in connect token disables timeout for that client. This is useful for testing!
-    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, -1, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
 
     snapshot_client_connect( client, connect_token );
 
@@ -3344,7 +4998,11 @@ void test_disable_timeout()
     snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
     snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
 
-    for ( int i = 0; i < 100; i++ )
+    // disconnect client side and verify that the server sees that client disconnect cleanly, rather than timing out.
+
+    snapshot_client_disconnect( client );
+
+    for ( int i = 0; i < 10; i++ )
     {
         snapshot_network_simulator_update( network_simulator, time );
 
@@ -3352,13 +5010,14 @@ void test_disable_timeout()
 
         snapshot_server_update( server, time );
 
-        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+        if ( snapshot_server_client_connected( server, 0 ) == 0 )
             break;
 
-        time += 1000.0f;        // normally this would timeout the client
+        time += delta_time;
     }
 
-    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+    snapshot_check( snapshot_server_client_connected( server, 0 ) == 0 );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
 
     snapshot_server_destroy( server );
 
@@ -3367,191 +5026,2579 @@ void test_disable_timeout()
     snapshot_network_simulator_destroy( network_simulator );
 }
 
-struct test_sequence_data_t
+void test_server_side_disconnect()
+{
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
+
+    snapshot_network_simulator_set( network_simulator, 100, 100, 1, 1 );
+
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    // start a server and connect one client
+
+    double time = 0.0;
+    double delta_time = 1.0 / 10.0;
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+    client_config.network_simulator = network_simulator;
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+
+    snapshot_check( client );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.max_clients = 1;
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    server_config.network_simulator = network_simulator;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, time );
+
+    snapshot_check( server );
+
+    const char * server_address = "127.0.0.1:40000";
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+    uint64_t client_id = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+    snapshot_client_connect( client, connect_token );
+
+    while ( 1 )
+    {
+        snapshot_network_simulator_update( network_simulator, time );
+
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+    snapshot_check( snapshot_client_index( client ) == 0 );
+    snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
+
+    // disconnect server side and verify that the client disconnects cleanly, rather than timing out.
+
+    snapshot_server_disconnect_client( server, 0 );
+
+    for ( int i = 0; i < 10; i++ )
+    {
+        snapshot_network_simulator_update( network_simulator, time );
+
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
+    snapshot_check( snapshot_server_client_connected( server, 0 ) == 0 );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+
+    snapshot_server_destroy( server );
+
+    snapshot_client_destroy( client );
+
+    snapshot_network_simulator_destroy( network_simulator );
+}
+
+static void test_server_send_batching_with_address( const char * client_bind_address, const char * server_address )
+{
+    double time = 0.0;
+    double delta_time = 1.0 / 10.0;
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    struct snapshot_client_t * client = snapshot_client_create( client_bind_address, &client_config, time );
+
+    snapshot_check( client );
+
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.max_clients = 1;
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_t * server = snapshot_server_create( server_address, &server_config, time );
+
+    snapshot_check( server );
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+    uint64_t client_id = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+    snapshot_client_connect( client, connect_token );
+
+    while ( 1 )
+    {
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+
+    // connection responses are sent in the clear, so exchange some keep alives before checking the batch counters
+
+    for ( int i = 0; i < 10; i++ )
+    {
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+
+    // packets through the socket are decrypted and encrypted in batches
+
+    snapshot_check( snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_PACKETS_DECRYPTED_BATCH] > 0 );
+    snapshot_check( snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_PACKETS_ENCRYPTED_BATCH] > 0 );
+
+    // the disconnect packet burst should go out in a single batch
+
+    const uint64_t packets_encrypted = snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_PACKETS_ENCRYPTED_BATCH];
+    const uint64_t send_batches = snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_SEND_BATCHES];
+    const uint64_t packets_sent = snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_PACKETS_SENT];
+
+    snapshot_server_disconnect_client( server, 0 );
+
+    snapshot_check( snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_SEND_BATCHES] == send_batches + 1 );
+    snapshot_check( snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_PACKETS_SENT] == packets_sent + SNAPSHOT_NUM_DISCONNECT_PACKETS );
+    snapshot_check( snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_PACKETS_ENCRYPTED_BATCH] == packets_encrypted + SNAPSHOT_NUM_DISCONNECT_PACKETS );
+
+    for ( int i = 0; i < 10; i++ )
+    {
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
+
+    snapshot_server_destroy( server );
+
+    snapshot_client_destroy( client );
+}
+
+void test_server_send_batching()
+{
+    test_server_send_batching_with_address( "0.0.0.0:50000", "127.0.0.1:40000" );
+#if SNAPSHOT_PLATFORM_HAS_IPV6
+    test_server_send_batching_with_address( "[::]:50000", "[::1]:40000" );
+#endif // #if SNAPSHOT_PLATFORM_HAS_IPV6
+}
+
+void test_server_max_clients()
+{
+    double time = 0.0;
+    double delta_time = 1.0 / 10.0;
+
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    // a server needs at least one client slot
+
+    server_config.max_clients = 0;
+    snapshot_check( snapshot_server_create( "127.0.0.1:40000", &server_config, time ) == NULL );
+
+    // ack bits are checked up front instead of asserting in every client endpoint
+
+    server_config.max_clients = 8;
+    server_config.ack_bits = 0;
+    snapshot_check( snapshot_server_create( "127.0.0.1:40000", &server_config, time ) == NULL );
+    server_config.ack_bits = 96;
+    snapshot_check( snapshot_server_create( "127.0.0.1:40000", &server_config, time ) == NULL );
+    server_config.ack_bits = 32;
+
+    // memory scales with the number of client slots
+
+    server_config.max_clients = 8;
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, time );
+    snapshot_check( server );
+    snapshot_check( snapshot_server_max_clients( server ) == 8 );
+    const size_t small_server_bytes = snapshot_server_memory_bytes( server );
+    snapshot_check( snapshot_server_memory_bytes_per_client( server ) > 0 );
+    snapshot_server_destroy( server );
+
+    const int MaxClients = SNAPSHOT_MAX_CLIENTS * 4;
+
+    server_config.max_clients = MaxClients;
+    server = snapshot_server_create( "127.0.0.1:40000", &server_config, time );
+    snapshot_check( server );
+    snapshot_check( snapshot_server_max_clients( server ) == MaxClients );
+    snapshot_check( snapshot_server_memory_bytes( server ) > small_server_bytes );
+
+    // slots past the old compile time limit work
+
+    snapshot_server_connect_loopback_client( server, 0, 1, NULL );
+    snapshot_server_connect_loopback_client( server, MaxClients - 1, 2, NULL );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 2 );
+    snapshot_check( snapshot_server_client_loopback( server, MaxClients - 1 ) );
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:50000", &client_config, time );
+
+    snapshot_check( client );
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+    uint64_t client_id = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+
+    const char * server_address = "127.0.0.1:40000";
+
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+    snapshot_client_connect( client, connect_token );
+
+    while ( 1 )
+    {
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+    snapshot_check( snapshot_client_max_clients( client ) == MaxClients );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 3 );
+
+    snapshot_server_disconnect_loopback_client( server, 0 );
+    snapshot_server_disconnect_loopback_client( server, MaxClients - 1 );
+
+    snapshot_server_destroy( server );
+
+    snapshot_client_destroy( client );
+}
+
+void server_memory_send_loopback_packet_callback( void * context, const struct snapshot_address_t * from, uint8_t * packet_data, int packet_bytes )
+{
+    (void) context;
+    (void) from;
+    (void) packet_data;
+    (void) packet_bytes;
+}
+
+void test_server_memory_bytes()
+{
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    server_config.replay_protection_window_bits = 1024;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    // fixed overhead doesn't depend on max clients, and the per slot cost barely moves as the tables round up
+
+    server_config.max_clients = 8;
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+    snapshot_check( server );
+    const size_t fixed_bytes = snapshot_server_memory_bytes_fixed( server );
+    const size_t per_client_bytes = snapshot_server_memory_bytes_per_client( server );
+    snapshot_check( fixed_bytes > 0 );
+    snapshot_check( per_client_bytes > 0 );
+    snapshot_check( snapshot_server_memory_bytes( server ) == fixed_bytes + per_client_bytes * 8 );
+    snapshot_server_destroy( server );
+
+    server_config.max_clients = 64;
+    server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+    snapshot_check( server );
+    snapshot_check( snapshot_server_memory_bytes_fixed( server ) == fixed_bytes );
+    snapshot_check( snapshot_server_memory_bytes_per_client( server ) <= per_client_bytes );
+    snapshot_check( snapshot_server_memory_bytes_per_client( server ) + 64 > per_client_bytes );
+    snapshot_server_destroy( server );
+
+    // replay protection is per client, so a bigger window moves only the per slot cost, by exactly its size
+
+    server_config.max_clients = 8;
+    server_config.replay_protection_window_bits = 2048;
+    server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+    snapshot_check( server );
+    snapshot_check( snapshot_server_memory_bytes_fixed( server ) == fixed_bytes );
+    snapshot_check( snapshot_server_memory_bytes_per_client( server ) == per_client_bytes + snapshot_replay_protection_bytes( 2048 ) - snapshot_replay_protection_bytes( 1024 ) );
+    snapshot_server_destroy( server );
+    server_config.replay_protection_window_bits = 1024;
+
+    // io thread rings are fixed overhead, shared by every client slot
+
+    server_config.io_thread = SNAPSHOT_TRUE;
+    server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+    snapshot_check( server );
+    snapshot_check( snapshot_server_memory_bytes_fixed( server ) >= fixed_bytes + 2 * SNAPSHOT_SERVER_IO_THREAD_QUEUE_SIZE * SNAPSHOT_MAX_PACKET_BYTES );
+    snapshot_check( snapshot_server_memory_bytes_per_client( server ) == per_client_bytes );
+    snapshot_server_destroy( server );
+    server_config.io_thread = SNAPSHOT_FALSE;
+
+    // the packet pool is fixed overhead too, and grows as traffic pulls blocks into it
+
+    server_config.packet_pool = SNAPSHOT_TRUE;
+    server_config.send_loopback_packet_callback = server_memory_send_loopback_packet_callback;
+    server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+    snapshot_check( server );
+    const size_t pool_fixed_bytes = snapshot_server_memory_bytes_fixed( server );
+    snapshot_check( pool_fixed_bytes > fixed_bytes );
+    snapshot_check( snapshot_server_memory_bytes_per_client( server ) == per_client_bytes );
+
+    snapshot_server_connect_loopback_client( server, 0, 1, NULL );
+    snapshot_server_set_development_flags( server, SNAPSHOT_DEVELOPMENT_FLAG_VALIDATE_PAYLOAD );
+    snapshot_server_update( server, 0.1 );
+
+    const uint64_t * pool_counters = snapshot_server_packet_pool_counters( server );
+    snapshot_check( pool_counters );
+    snapshot_check( pool_counters[SNAPSHOT_PACKET_POOL_COUNTER_BYTES_ALLOCATED] > 0 );
+    snapshot_check( snapshot_server_memory_bytes_fixed( server ) == pool_fixed_bytes + pool_counters[SNAPSHOT_PACKET_POOL_COUNTER_BYTES_ALLOCATED] );
+    snapshot_check( snapshot_server_memory_bytes_per_client( server ) == per_client_bytes );
+
+    snapshot_server_disconnect_loopback_client( server, 0 );
+    snapshot_server_destroy( server );
+}
+
+#if SNAPSHOT_PLATFORM == SNAPSHOT_PLATFORM_LINUX
+
+void test_sharded_server()
+{
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    // each shard needs at least one client slot
+
+    server_config.max_clients = 1;
+    server_config.num_shards = 2;
+    snapshot_check( snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 ) == NULL );
+
+    server_config.max_clients = 2;
+    server_config.num_shards = SNAPSHOT_SERVER_MAX_SHARDS + 1;
+    snapshot_check( snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 ) == NULL );
+
+    // client slots are split across shards. size them so every client fits whichever shard the kernel picks
+
+    const int NumClients = 4;
+
+    server_config.max_clients = NumClients * 2;
+    server_config.num_shards = 2;
+
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+
+    snapshot_check( server );
+    snapshot_check( snapshot_server_max_clients( server ) == NumClients * 2 );
+    snapshot_check( snapshot_server_port( server ) == 40000 );
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    struct snapshot_client_t * client[NumClients];
+    uint64_t client_id[NumClients];
+
+    const char * server_address = "127.0.0.1:40000";
+
+    for ( int i = 0; i < NumClients; i++ )
+    {
+        char client_address[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
+        snprintf( client_address, sizeof(client_address), "0.0.0.0:%d", 50000 + i );
+
+        client[i] = snapshot_client_create( client_address, &client_config, 0.0 );
+
+        snapshot_check( client[i] );
+
+        client_id[i] = i + 1;
+
+        uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+        snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
+
+        uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+        snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id[i], TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+        snapshot_client_connect( client[i], connect_token );
+    }
+
+    // the shards update in parallel on their own threads, but only inside snapshot_server_update
+
+    const double start_time = snapshot_platform_time();
+
+    while ( snapshot_platform_time() - start_time < 5.0 )
+    {
+        const double time = snapshot_platform_time() - start_time;
+
+        snapshot_server_update( server, time );
+
+        int num_connected = 0;
+        for ( int i = 0; i < NumClients; i++ )
+        {
+            snapshot_client_update( client[i], time );
+            snapshot_check( snapshot_client_state( client[i] ) > SNAPSHOT_CLIENT_STATE_DISCONNECTED );
+            if ( snapshot_client_state( client[i] ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+                num_connected++;
+        }
+
+        if ( num_connected == NumClients && snapshot_server_num_connected_clients( server ) == NumClients )
+            break;
+
+        snapshot_platform_sleep( 0.01 );
+    }
+
+    snapshot_check( snapshot_server_num_connected_clients( server ) == NumClients );
+
+    // client indices are global across shards and unique
+
+    SNAPSHOT_BOOL index_used[NumClients*2];
+    memset( index_used, 0, sizeof(index_used) );
+
+    for ( int i = 0; i < NumClients; i++ )
+    {
+        snapshot_check( snapshot_client_state( client[i] ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+        snapshot_check( snapshot_client_max_clients( client[i] ) == NumClients * 2 );
+
+        const int client_index = snapshot_client_index( client[i] );
+        snapshot_check( client_index >= 0 );
+        snapshot_check( client_index < NumClients * 2 );
+        snapshot_check( !index_used[client_index] );
+        index_used[client_index] = SNAPSHOT_TRUE;
+
+        snapshot_check( snapshot_server_client_connected( server, client_index ) );
+        snapshot_check( snapshot_server_client_id( server, client_index ) == client_id[i] );
+        snapshot_check( snapshot_server_client_address( server, client_index )->port == 50000 + i );
+        snapshot_check( snapshot_server_find_client_index_by_address( server, snapshot_server_client_address( server, client_index ) ) == client_index );
+    }
+
+    // disconnecting by global index reaches the right shard
+
+    snapshot_server_disconnect_client( server, snapshot_client_index( client[0] ) );
+
+    const double disconnect_time = snapshot_platform_time();
+
+    while ( snapshot_platform_time() - disconnect_time < 5.0 )
+    {
+        const double time = snapshot_platform_time() - start_time;
+
+        snapshot_server_update( server, time );
+
+        for ( int i = 0; i < NumClients; i++ )
+        {
+            snapshot_client_update( client[i], time );
+        }
+
+        if ( snapshot_client_state( client[0] ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        snapshot_platform_sleep( 0.01 );
+    }
+
+    snapshot_check( snapshot_client_state( client[0] ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == NumClients - 1 );
+
+    const uint64_t * counters = snapshot_server_counters( server );
+    snapshot_check( counters[SNAPSHOT_SERVER_COUNTER_CLIENT_CONNECTS] == (uint64_t) NumClients );
+
+    snapshot_server_destroy( server );
+
+    for ( int i = 0; i < NumClients; i++ )
+    {
+        snapshot_client_destroy( client[i] );
+    }
+}
+
+void test_sharded_server_connect_token_reuse()
+{
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+    server_config.max_clients = 4;
+    server_config.num_shards = 2;
+
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+
+    snapshot_check( server );
+
+    const char * server_address = "127.0.0.1:40000";
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, TEST_CLIENT_ID, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:50000", &client_config, 0.0 );
+
+    snapshot_check( client );
+
+    snapshot_client_connect( client, connect_token );
+
+    const double start_time = snapshot_platform_time();
+
+    while ( snapshot_platform_time() - start_time < 5.0 )
+    {
+        const double time = snapshot_platform_time() - start_time;
+
+        snapshot_server_update( server, time );
+        snapshot_client_update( client, time );
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            break;
+
+        snapshot_platform_sleep( 0.01 );
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+
+    // once the first client is gone the client id is free again, so only the connect token table stops the token from
+    // being used again. clients on several ports land on both shards, and the shared table rejects the token on either
+
+    snapshot_server_disconnect_all_clients( server );
+
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+
+    snapshot_client_destroy( client );
+
+    const uint64_t challenges_sent = snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_CONNECTION_CHALLENGE_PACKETS_SENT];
+
+    const int NumReuseClients = 8;
+
+    struct snapshot_client_t * reuse_client[NumReuseClients];
+
+    for ( int i = 0; i < NumReuseClients; i++ )
+    {
+        char client_address[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
+        snprintf( client_address, sizeof(client_address), "0.0.0.0:%d", 50001 + i );
+
+        reuse_client[i] = snapshot_client_create( client_address, &client_config, 0.0 );
+
+        snapshot_check( reuse_client[i] );
+
+        snapshot_client_connect( reuse_client[i], connect_token );
+    }
+
+    const double reuse_time = snapshot_platform_time();
+
+    while ( snapshot_platform_time() - reuse_time < 1.0 )
+    {
+        const double time = snapshot_platform_time() - start_time;
+
+        snapshot_server_update( server, time );
+
+        for ( int i = 0; i < NumReuseClients; i++ )
+        {
+            snapshot_client_update( reuse_client[i], time );
+            snapshot_check( snapshot_client_state( reuse_client[i] ) != SNAPSHOT_CLIENT_STATE_CONNECTED );
+        }
+
+        snapshot_platform_sleep( 0.01 );
+    }
+
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+    snapshot_check( snapshot_server_counters( server )[SNAPSHOT_SERVER_COUNTER_CONNECTION_CHALLENGE_PACKETS_SENT] == challenges_sent );
+
+    for ( int i = 0; i < NumReuseClients; i++ )
+    {
+        snapshot_client_destroy( reuse_client[i] );
+    }
+
+    snapshot_server_destroy( server );
+}
+
+void test_sharded_server_duplicate_client_id()
+{
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+    server_config.max_clients = 16;
+    server_config.num_shards = 2;
+
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+
+    snapshot_check( server );
+
+    const char * server_address = "127.0.0.1:40000";
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes( user_data, SNAPSHOT_USER_DATA_BYTES );
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+
+    // every client has its own connect token, so only the client id check can stop them. clients on several ports
+    // land on both shards, and whichever shard sees the id first gets it
+
+    const int NumClients = 8;
+
+    struct snapshot_client_t * client[NumClients];
+
+    for ( int i = 0; i < NumClients; i++ )
+    {
+        uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+        snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, TEST_CLIENT_ID, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+        char client_address[SNAPSHOT_MAX_ADDRESS_STRING_LENGTH];
+        snprintf( client_address, sizeof(client_address), "0.0.0.0:%d", 50001 + i );
+
+        client[i] = snapshot_client_create( client_address, &client_config, 0.0 );
+
+        snapshot_check( client[i] );
+
+        snapshot_client_connect( client[i], connect_token );
+    }
+
+    const double start_time = snapshot_platform_time();
+
+    while ( snapshot_platform_time() - start_time < 1.0 )
+    {
+        const double time = snapshot_platform_time() - start_time;
+
+        snapshot_server_update( server, time );
+
+        for ( int i = 0; i < NumClients; i++ )
+        {
+            snapshot_client_update( client[i], time );
+        }
+
+        snapshot_platform_sleep( 0.01 );
+    }
+
+    int num_connected = 0;
+    for ( int i = 0; i < NumClients; i++ )
+    {
+        if ( snapshot_client_state( client[i] ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            num_connected++;
+    }
+
+    snapshot_check( num_connected == 1 );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
+
+    for ( int i = 0; i < NumClients; i++ )
+    {
+        snapshot_client_destroy( client[i] );
+    }
+
+    snapshot_server_destroy( server );
+}
+
+#endif // #if SNAPSHOT_PLATFORM == SNAPSHOT_PLATFORM_LINUX
+
+void test_server_admission()
+{
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    const int PacketsPerSecond = 10;
+    const int Burst = 5;
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    server_config.max_clients = 1;
+    server_config.rate_limit_packets_per_second = PacketsPerSecond;
+    server_config.rate_limit_burst = Burst;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, 0.0 );
+
+    snapshot_check( server );
+
+    const uint64_t * server_counters = snapshot_server_counters( server );
+
+    struct snapshot_address_t from;
+    snapshot_address_parse( &from, "10.0.0.1:50000" );
+
+    uint8_t packet_data[SNAPSHOT_MAX_PACKET_BYTES];
+    snapshot_crypto_random_bytes( packet_data, sizeof( packet_data ) );
+
+    // junk that no valid packet could look like is dropped before anything else, and doesn't spend rate limit tokens
+
+    packet_data[0] = SNAPSHOT_CONNECTION_REQUEST_PACKET;
+    for ( int i = 0; i < 100; i++ )
+    {
+        snapshot_check( !snapshot_server_process_packet( server, &from, packet_data, 100 ) );
+    }
+
+    packet_data[0] = 0xFF;
+    snapshot_check( !snapshot_server_process_packet( server, &from, packet_data, 100 ) );
+
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PACKETS_DROPPED_INVALID] == 101 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PACKETS_DROPPED_RATE_LIMITED] == 0 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PACKETS_PROCESSED] == 0 );
+
+    // a flood of well formed connection requests from one ip only reaches the connect token decrypt for the burst
+
+    const int NumRequests = 100;
+
+    packet_data[0] = SNAPSHOT_CONNECTION_REQUEST_PACKET;
+    for ( int i = 0; i < NumRequests; i++ )
+    {
+        from.port = (uint16_t) ( 50000 + i );
+        snapshot_check( !snapshot_server_process_packet( server, &from, packet_data, SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES ) );
+    }
+
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PACKETS_DROPPED_RATE_LIMITED] == (uint64_t) ( NumRequests - Burst ) );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PACKETS_PROCESSED] == (uint64_t) Burst );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_READ_PACKET_FAILURES] == (uint64_t) Burst );
+
+    // other ips have their own buckets
+
+    snapshot_address_parse( &from, "10.0.0.2:50000" );
+    snapshot_check( !snapshot_server_process_packet( server, &from, packet_data, SNAPSHOT_CONNECTION_REQUEST_PACKET_BYTES ) );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PACKETS_PROCESSED] == (uint64_t) Burst + 1 );
+
+    snapshot_server_destroy( server );
+}
+
+void test_client_reconnect()
+{
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
+
+    snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
+
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    // start a server and connect one client
+
+    double time = 0.0;
+    double delta_time = 1.0 / 10.0;
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+    client_config.network_simulator = network_simulator;
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+
+    snapshot_check( client );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.max_clients = 1;
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    server_config.network_simulator = network_simulator;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, time );
+
+    snapshot_check( server );
+
+    const char * server_address = "127.0.0.1:40000";
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+    uint64_t client_id = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+    snapshot_client_connect( client, connect_token );
+
+    while ( 1 )
+    {
+        snapshot_network_simulator_update( network_simulator, time );
+
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+    snapshot_check( snapshot_client_index( client ) == 0 );
+    snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
+
+    // wait for a bit, so any packets on the wire go away (otherwise, we sometimes have connection request packets in flight which break the test...)
+
+    time += 10.0;
+
+    snapshot_network_simulator_update( network_simulator, time );
+
+    snapshot_client_update( client, time );
+
+    snapshot_server_update( server, time );
+
+    // disconnect client on the server-side and wait until client sees the disconnect
+
+    snapshot_server_disconnect_client( server, 0 );
+
+    while ( 1 )
+    {
+        snapshot_network_simulator_update( network_simulator, time );
+
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_DISCONNECTED );
+    snapshot_check( snapshot_server_client_connected( server, 0 ) == 0 );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 0 );
+
+    // now reconnect the client and verify they connect
+
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+    snapshot_client_connect( client, connect_token );
+
+    while ( 1 )
+    {
+        snapshot_network_simulator_update( network_simulator, time );
+
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+    snapshot_check( snapshot_client_index( client ) == 0 );
+    snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
+
+    snapshot_server_destroy( server );
+
+    snapshot_client_destroy( client );
+
+    snapshot_network_simulator_destroy( network_simulator );
+}
+
+void test_disable_timeout()
+{
+    struct snapshot_network_simulator_t * network_simulator = snapshot_network_simulator_create( NULL, 1 );
+
+    snapshot_network_simulator_set( network_simulator, 250, 250, 5, 10 );
+
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
+
+    double time = 0.0;
+    double delta_time = 1.0 / 10.0;
+
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
+    client_config.network_simulator = network_simulator;
+
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:30000", &client_config, time );
+
+    snapshot_check( client );
+
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.max_clients = 1;
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    server_config.network_simulator = network_simulator;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
+
+    struct snapshot_server_t * server = snapshot_server_create( "127.0.0.1:40000", &server_config, time );
+
+    snapshot_check( server );
+
+    const char * server_address = "127.0.0.1:40000";
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+    uint64_t client_id = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+
+    // IMPORTANT: passing in -1 timeout in connect token disables timeout for that client. This is useful for testing!
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, -1, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+    snapshot_client_connect( client, connect_token );
+
+    while ( 1 )
+    {
+        snapshot_network_simulator_update( network_simulator, time );
+
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            break;
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+    snapshot_check( snapshot_client_index( client ) == 0 );
+    snapshot_check( snapshot_server_client_connected( server, 0 ) == 1 );
+    snapshot_check( snapshot_server_num_connected_clients( server ) == 1 );
+
+    for ( int i = 0; i < 100; i++ )
+    {
+        snapshot_network_simulator_update( network_simulator, time );
+
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        time += 1000.0f;        // normally this would timeout the client
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+
+    snapshot_server_destroy( server );
+
+    snapshot_client_destroy( client );
+
+    snapshot_network_simulator_destroy( network_simulator );
+}
+
+struct test_sequence_data_t
 {
     uint16_t sequence;
 };
 
-#define TEST_SEQUENCE_BUFFER_SIZE 256
+#define TEST_SEQUENCE_BUFFER_SIZE 256
+
+void test_sequence_buffer()
+{
+    struct snapshot_sequence_buffer_t * sequence_buffer = snapshot_sequence_buffer_create( NULL, TEST_SEQUENCE_BUFFER_SIZE, sizeof( struct test_sequence_data_t ) );
+
+    snapshot_check( sequence_buffer );
+    snapshot_check( sequence_buffer->sequence == 0 );
+    snapshot_check( sequence_buffer->num_entries == TEST_SEQUENCE_BUFFER_SIZE );
+    snapshot_check( sequence_buffer->entry_stride == sizeof( struct test_sequence_data_t ) );
+
+    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        snapshot_check( snapshot_sequence_buffer_find( sequence_buffer, ((uint16_t)i) ) == NULL );
+    }                                                                      
+
+    for ( int i = 0; i <= TEST_SEQUENCE_BUFFER_SIZE*4; i++ )
+    {
+        struct test_sequence_data_t * entry = (struct test_sequence_data_t*) snapshot_sequence_buffer_insert( sequence_buffer, ((uint16_t)i) );
+        snapshot_check( entry );
+        entry->sequence = (uint16_t) i;
+        snapshot_check( sequence_buffer->sequence == i + 1 );
+    }
+
+    for ( int i = 0; i <= TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        struct test_sequence_data_t * entry = (struct test_sequence_data_t*) snapshot_sequence_buffer_insert( sequence_buffer, ((uint16_t)i) );
+        snapshot_check( entry == NULL );
+    }    
+
+    int index = TEST_SEQUENCE_BUFFER_SIZE * 4;
+    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        struct test_sequence_data_t * entry = (struct test_sequence_data_t*) snapshot_sequence_buffer_find( sequence_buffer, (uint16_t) index );
+        snapshot_check( entry );
+        snapshot_check( entry->sequence == (uint32_t) index );
+        index--;
+    }
+
+    snapshot_sequence_buffer_reset( sequence_buffer );
+
+    snapshot_check( sequence_buffer );
+    snapshot_check( sequence_buffer->sequence == 0 );
+    snapshot_check( sequence_buffer->num_entries == TEST_SEQUENCE_BUFFER_SIZE );
+    snapshot_check( sequence_buffer->entry_stride == sizeof( struct test_sequence_data_t ) );
+
+    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        snapshot_check( snapshot_sequence_buffer_find( sequence_buffer, (uint16_t) i ) == NULL );
+    }
+
+    snapshot_sequence_buffer_destroy( sequence_buffer );
+}
+
+void test_generate_ack_bits()
+{
+    struct snapshot_sequence_buffer_t * sequence_buffer = snapshot_sequence_buffer_create( NULL, TEST_SEQUENCE_BUFFER_SIZE, sizeof( struct test_sequence_data_t ) );
+
+    uint16_t ack = 0;
+    uint32_t ack_bits = 0xFFFFFFFF;
+
+    snapshot_sequence_buffer_generate_ack_bits( sequence_buffer, &ack, &ack_bits );
+    snapshot_check( ack == 0xFFFF );
+    snapshot_check( ack_bits == 0 );
+
+    for ( int i = 0; i <= TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        snapshot_sequence_buffer_insert( sequence_buffer, (uint16_t) i );
+    }
+
+    snapshot_sequence_buffer_generate_ack_bits( sequence_buffer, &ack, &ack_bits );
+    snapshot_check( ack == TEST_SEQUENCE_BUFFER_SIZE );
+    snapshot_check( ack_bits == 0xFFFFFFFF );
+
+    snapshot_sequence_buffer_reset( sequence_buffer );
+
+    uint16_t input_acks[] = { 1, 5, 9, 11 };
+    int input_num_acks = sizeof( input_acks ) / sizeof( uint16_t );
+    for ( int i = 0; i < input_num_acks; i++ )
+    {
+        snapshot_sequence_buffer_insert( sequence_buffer, input_acks[i] );
+    }
+
+    snapshot_sequence_buffer_generate_ack_bits( sequence_buffer, &ack, &ack_bits );
+
+    snapshot_check( ack == 11 );
+    snapshot_check( ack_bits == ( 1 | (1<<(11-9)) | (1<<(11-5)) | (1<<(11-1)) ) );
+
+    snapshot_sequence_buffer_destroy( sequence_buffer );
+}
+
+static int test_packed_sequence_buffer_num_cleanups;
+
+static void test_packed_sequence_buffer_cleanup( void * context, void * data )
+{
+    (void) context;
+    (void) data;
+    test_packed_sequence_buffer_num_cleanups++;
+}
+
+void test_packed_sequence_buffer()
+{
+    struct snapshot_packed_sequence_buffer_t * sequence_buffer = snapshot_packed_sequence_buffer_create( NULL, TEST_SEQUENCE_BUFFER_SIZE, sizeof( struct test_sequence_data_t ) );
+
+    snapshot_check( sequence_buffer );
+    snapshot_check( sequence_buffer->sequence == 0 );
+    snapshot_check( sequence_buffer->num_entries == TEST_SEQUENCE_BUFFER_SIZE );
+    snapshot_check( sequence_buffer->entry_stride == sizeof( struct test_sequence_data_t ) );
+    snapshot_check( sequence_buffer->slot_stride == 8 );
+
+    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        snapshot_check( snapshot_packed_sequence_buffer_find( sequence_buffer, ((uint16_t)i) ) == NULL );
+    }
+
+    for ( int i = 0; i <= TEST_SEQUENCE_BUFFER_SIZE*4; i++ )
+    {
+        struct test_sequence_data_t * entry = (struct test_sequence_data_t*) snapshot_packed_sequence_buffer_insert( sequence_buffer, ((uint16_t)i) );
+        snapshot_check( entry );
+        entry->sequence = (uint16_t) i;
+        snapshot_check( sequence_buffer->sequence == i + 1 );
+    }
+
+    for ( int i = 0; i <= TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        struct test_sequence_data_t * entry = (struct test_sequence_data_t*) snapshot_packed_sequence_buffer_insert( sequence_buffer, ((uint16_t)i) );
+        snapshot_check( entry == NULL );
+    }
+
+    int index = TEST_SEQUENCE_BUFFER_SIZE * 4;
+    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        struct test_sequence_data_t * entry = (struct test_sequence_data_t*) snapshot_packed_sequence_buffer_find( sequence_buffer, (uint16_t) index );
+        snapshot_check( entry );
+        snapshot_check( entry->sequence == (uint32_t) index );
+        index--;
+    }
+
+    snapshot_packed_sequence_buffer_reset( sequence_buffer );
+
+    snapshot_check( sequence_buffer->sequence == 0 );
+
+    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        snapshot_check( snapshot_packed_sequence_buffer_find( sequence_buffer, (uint16_t) i ) == NULL );
+        snapshot_check( snapshot_packed_sequence_buffer_at_index( sequence_buffer, i ) == NULL );
+    }
+
+    // advancing clears only the slots that are reused, cleaning up the ones that were occupied
+
+    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i += 2 )
+    {
+        snapshot_check( snapshot_packed_sequence_buffer_insert_with_cleanup( sequence_buffer, (uint16_t) i, test_packed_sequence_buffer_cleanup ) );
+    }
+
+    test_packed_sequence_buffer_num_cleanups = 0;
+
+    snapshot_packed_sequence_buffer_advance_with_cleanup( sequence_buffer, (uint16_t) ( TEST_SEQUENCE_BUFFER_SIZE + 99 ), test_packed_sequence_buffer_cleanup );
+
+    snapshot_check( test_packed_sequence_buffer_num_cleanups == 50 );
+
+    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        const int expected = ( i >= 100 && ( i % 2 ) == 0 ) ? 1 : 0;
+        snapshot_check( snapshot_packed_sequence_buffer_exists( sequence_buffer, (uint16_t) i ) == expected );
+    }
+
+    // jumping past the whole buffer clears everything
+
+    test_packed_sequence_buffer_num_cleanups = 0;
+
+    snapshot_packed_sequence_buffer_advance_with_cleanup( sequence_buffer, 30000, test_packed_sequence_buffer_cleanup );
+
+    snapshot_check( test_packed_sequence_buffer_num_cleanups == ( TEST_SEQUENCE_BUFFER_SIZE - 100 ) / 2 );
+
+    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    {
+        snapshot_check( snapshot_packed_sequence_buffer_at_index( sequence_buffer, i ) == NULL );
+    }
+
+    snapshot_packed_sequence_buffer_destroy( sequence_buffer );
+
+    // the packed buffer agrees with the regular sequence buffer under random inserts, advances and removes, across sequence wrap
+
+    struct snapshot_sequence_buffer_t * reference = snapshot_sequence_buffer_create( NULL, 64, sizeof( struct test_sequence_data_t ) );
+    sequence_buffer = snapshot_packed_sequence_buffer_create( NULL, 64, sizeof( struct test_sequence_data_t ) );
+
+    uint16_t sequence = 65000;
+    for ( int i = 0; i < 10000; i++ )
+    {
+        const int action = rand() % 10;
+        if ( action < 6 )
+        {
+            const uint16_t insert_sequence = sequence - (uint16_t) ( rand() % 80 );
+            struct test_sequence_data_t * a = (struct test_sequence_data_t*) snapshot_sequence_buffer_insert( reference, insert_sequence );
+            struct test_sequence_data_t * b = (struct test_sequence_data_t*) snapshot_packed_sequence_buffer_insert( sequence_buffer, insert_sequence );
+            snapshot_check( ( a == NULL ) == ( b == NULL ) );
+            if ( a )
+            {
+                a->sequence = insert_sequence;
+                b->sequence = insert_sequence;
+            }
+        }
+        else if ( action < 9 )
+        {
+            sequence += (uint16_t) ( rand() % ( ( action == 8 ) ? 200 : 4 ) );
+            snapshot_sequence_buffer_advance( reference, sequence );
+            snapshot_packed_sequence_buffer_advance( sequence_buffer, sequence );
+        }
+        else
+        {
+            const uint16_t remove_sequence = sequence - (uint16_t) ( rand() % 64 );
+            snapshot_sequence_buffer_remove( reference, remove_sequence );
+            snapshot_packed_sequence_buffer_remove( sequence_buffer, remove_sequence );
+        }
+
+        snapshot_check( reference->sequence == sequence_buffer->sequence );
+
+        for ( int j = 0; j < 64; j++ )
+        {
+            const uint16_t s = reference->sequence - 1 - (uint16_t) j;
+            struct test_sequence_data_t * a = (struct test_sequence_data_t*) snapshot_sequence_buffer_find( reference, s );
+            struct test_sequence_data_t * b = (struct test_sequence_data_t*) snapshot_packed_sequence_buffer_find( sequence_buffer, s );
+            snapshot_check( ( a == NULL ) == ( b == NULL ) );
+            if ( a )
+            {
+                snapshot_check( a->sequence == b->sequence );
+            }
+        }
+
+        uint16_t reference_ack, ack;
+        uint32_t reference_ack_bits, ack_bits;
+        snapshot_sequence_buffer_generate_ack_bits( reference, &reference_ack, &reference_ack_bits );
+        snapshot_packed_sequence_buffer_generate_ack_bits( sequence_buffer, &ack, &ack_bits );
+        snapshot_check( reference_ack == ack );
+        snapshot_check( reference_ack_bits == ack_bits );
+    }
+
+    snapshot_sequence_buffer_destroy( reference );
+    snapshot_packed_sequence_buffer_destroy( sequence_buffer );
+}
+
+void test_packet_header()
+{
+    uint16_t write_sequence;
+    uint16_t write_ack;
+    uint32_t write_ack_bits;
+
+    uint16_t read_sequence;
+    uint16_t read_ack;
+    uint32_t read_ack_bits;
+
+    uint8_t packet_data[SNAPSHOT_MAX_PACKET_HEADER_BYTES];
+
+    // worst case, sequence and ack are far apart, no packets acked.
+
+    write_sequence = 10000;
+    write_ack = 100;
+    write_ack_bits = 0;
+
+    int bytes_written = snapshot_write_packet_header( packet_data, write_sequence, write_ack, write_ack_bits );
+
+    snapshot_check( bytes_written == 1 + 2 + 2 + 4 );
+
+    int bytes_read = snapshot_read_packet_header( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, &read_ack_bits );
+
+    snapshot_check( bytes_read == bytes_written );
+
+    snapshot_check( read_sequence == write_sequence );
+    snapshot_check( read_ack == write_ack );
+    snapshot_check( read_ack_bits == write_ack_bits );
+
+    // rare case. sequence and ack are far apart, significant # of acks are missing
+
+    write_sequence = 10000;
+    write_ack = 100;
+    write_ack_bits = 0xFEFEFFFE;
+
+    bytes_written = snapshot_write_packet_header( packet_data, write_sequence, write_ack, write_ack_bits );
+
+    snapshot_check( bytes_written == 1 + 2 + 2 + 3 );
+
+    bytes_read = snapshot_read_packet_header( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, &read_ack_bits );
+
+    snapshot_check( bytes_read == bytes_written );
+
+    snapshot_check( read_sequence == write_sequence );
+    snapshot_check( read_ack == write_ack );
+    snapshot_check( read_ack_bits == write_ack_bits );
+
+    // common case under packet loss. sequence and ack are close together, some acks are missing
+
+    write_sequence = 200;
+    write_ack = 100;
+    write_ack_bits = 0xFFFEFFFF;
+
+    bytes_written = snapshot_write_packet_header( packet_data, write_sequence, write_ack, write_ack_bits );
+
+    snapshot_check( bytes_written == 1 + 2 + 1 + 1 );
+
+    bytes_read = snapshot_read_packet_header( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, &read_ack_bits );
+
+    snapshot_check( bytes_read == bytes_written );
+
+    snapshot_check( read_sequence == write_sequence );
+    snapshot_check( read_ack == write_ack );
+    snapshot_check( read_ack_bits == write_ack_bits );
+
+    // ideal case. no packet loss.
+
+    write_sequence = 200;
+    write_ack = 100;
+    write_ack_bits = 0xFFFFFFFF;
+
+    bytes_written = snapshot_write_packet_header( packet_data, write_sequence, write_ack, write_ack_bits );
+
+    snapshot_check( bytes_written == 1 + 2 + 1 );
+
+    bytes_read = snapshot_read_packet_header( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, &read_ack_bits );
+
+    snapshot_check( bytes_read == bytes_written );
+
+    snapshot_check( read_sequence == write_sequence );
+    snapshot_check( read_ack == write_ack );
+    snapshot_check( read_ack_bits == write_ack_bits );
+
+    // worst case with 128 ack bits. sequence and ack are far apart, no packets acked.
+
+    uint32_t write_ack_words[SNAPSHOT_MAX_ACK_WORDS];
+    uint32_t read_ack_words[SNAPSHOT_MAX_ACK_WORDS];
+    int read_num_ack_words = 0;
+
+    write_sequence = 10000;
+    write_ack = 100;
+    memset( write_ack_words, 0, sizeof( write_ack_words ) );
+
+    bytes_written = snapshot_write_packet_header_ack_words( packet_data, write_sequence, write_ack, write_ack_words, SNAPSHOT_MAX_ACK_WORDS );
+
+    snapshot_check( bytes_written == SNAPSHOT_MAX_PACKET_HEADER_BYTES );
+
+    bytes_read = snapshot_read_packet_header_ack_words( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, read_ack_words, &read_num_ack_words );
+
+    snapshot_check( bytes_read == bytes_written );
+
+    snapshot_check( read_sequence == write_sequence );
+    snapshot_check( read_ack == write_ack );
+    snapshot_check( read_num_ack_words == SNAPSHOT_MAX_ACK_WORDS );
+    snapshot_check( memcmp( read_ack_words, write_ack_words, sizeof( write_ack_words ) ) == 0 );
+
+    // 64 ack bits with a few losses in the older word
+
+    write_sequence = 200;
+    write_ack = 100;
+    write_ack_words[0] = 0xFFFFFFFF;
+    write_ack_words[1] = 0xFFFEFFFF;
+
+    bytes_written = snapshot_write_packet_header_ack_words( packet_data, write_sequence, write_ack, write_ack_words, 2 );
+
+    snapshot_check( bytes_written == 1 + 2 + 1 + 1 + 1 + 1 );
+
+    bytes_read = snapshot_read_packet_header_ack_words( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, read_ack_words, &read_num_ack_words );
+
+    snapshot_check( bytes_read == bytes_written );
+
+    snapshot_check( read_sequence == write_sequence );
+    snapshot_check( read_ack == write_ack );
+    snapshot_check( read_num_ack_words == 2 );
+    snapshot_check( read_ack_words[0] == write_ack_words[0] );
+    snapshot_check( read_ack_words[1] == write_ack_words[1] );
+
+    // a reader that only wants 32 ack bits skips over the rest
+
+    bytes_read = snapshot_read_packet_header( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, &read_ack_bits );
+
+    snapshot_check( bytes_read == bytes_written );
+    snapshot_check( read_ack_bits == write_ack_words[0] );
+
+    // truncated wide headers are rejected
+
+    for ( int i = 1; i < bytes_written; i++ )
+    {
+        snapshot_check( snapshot_read_packet_header_ack_words( "test_packet_header", packet_data, i, &read_sequence, &read_ack, read_ack_words, &read_num_ack_words ) < 0 );
+    }
+
+    // so are unused bits in the prefix byte or an ack word mask. the mask for the second word follows the word count
+
+    packet_data[0] |= (1<<7);
+    snapshot_check( snapshot_read_packet_header_ack_words( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, read_ack_words, &read_num_ack_words ) < 0 );
+    packet_data[0] &= ~(1<<7);
+
+    packet_data[5] |= 0x10;
+    snapshot_check( snapshot_read_packet_header_ack_words( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, read_ack_words, &read_num_ack_words ) < 0 );
+    packet_data[5] &= 0x0F;
+
+    snapshot_check( snapshot_read_packet_header_ack_words( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, read_ack_words, &read_num_ack_words ) == bytes_written );
+
+    // and word counts that don't match 32, 64 or 128 ack bits. make a 96 bit header by dropping the last word from a 128 bit one
+
+    memset( write_ack_words, 0, sizeof( write_ack_words ) );
+
+    bytes_written = snapshot_write_packet_header_ack_words( packet_data, write_sequence, write_ack, write_ack_words, SNAPSHOT_MAX_ACK_WORDS );
+
+    const int word_count_offset = 1 + 2 + 1 + 4;
+
+    snapshot_check( packet_data[word_count_offset] == SNAPSHOT_MAX_ACK_WORDS - 1 );
+
+    packet_data[word_count_offset] = 2;
+
+    snapshot_check( snapshot_read_packet_header_ack_words( "test_packet_header", packet_data, bytes_written - 5, &read_sequence, &read_ack, read_ack_words, &read_num_ack_words ) < 0 );
+}
+
+#define TEST_ACKS_NUM_ITERATIONS 256
+
+void test_acks()
+{
+    double time = 100.0;
+
+    struct snapshot_endpoint_config_t sender_config;
+    struct snapshot_endpoint_config_t receiver_config;
+
+    snapshot_endpoint_default_config( &sender_config );
+    snapshot_endpoint_default_config( &receiver_config );
+
+    snapshot_copy_string( sender_config.name, "sender", sizeof(sender_config.name) );
+    snapshot_copy_string( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+
+    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
+    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
+
+    double delta_time = 0.01;
+
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
+    {
+        uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + 8 + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+        uint8_t * dummy_payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+
+        int dummy_payload_bytes = 8;
+
+        memset( dummy_payload_data, 0, dummy_payload_bytes );
+
+        // sender write packet
+
+        int num_sender_packets = 0;
+        uint8_t * sender_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int sender_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+        snapshot_endpoint_write_packets( sender, dummy_payload_data, dummy_payload_bytes, &num_sender_packets, &sender_packet_data[0], &sender_packet_bytes[0] );
+
+        snapshot_check( num_sender_packets == 1 );
+
+        // receiver process packet
+
+        uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+        uint8_t * receiver_payload_data = NULL;
+        int receiver_payload_bytes = 0;
+        uint16_t receiver_payload_sequence = 0;
+        uint16_t receiver_payload_ack = 0;
+        uint32_t receiver_payload_ack_bits = 0;
+
+        snapshot_endpoint_process_packet( receiver, sender_packet_data[0], sender_packet_bytes[0], buffer, &receiver_payload_data, &receiver_payload_bytes, &receiver_payload_sequence, &receiver_payload_ack, &receiver_payload_ack_bits );
+
+        snapshot_check( receiver_payload_data );
+        snapshot_check( receiver_payload_bytes == dummy_payload_bytes );
+        for ( int j = 0; j < dummy_payload_bytes; j++ )
+        {
+            snapshot_check( receiver_payload_data[j] == 0 );
+        }
+
+        snapshot_endpoint_mark_payload_processed( receiver, receiver_payload_sequence, receiver_payload_ack, receiver_payload_ack_bits, receiver_payload_bytes );
+
+        // receiver write packet
+
+        int num_receiver_packets = 0;
+        uint8_t * receiver_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int receiver_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+        snapshot_endpoint_write_packets( receiver, dummy_payload_data, dummy_payload_bytes, &num_receiver_packets, &receiver_packet_data[0], &receiver_packet_bytes[0] );
+
+        snapshot_check( num_receiver_packets == 1 );
+
+        // sender process packet
+
+        uint8_t * sender_payload_data = NULL;
+        int sender_payload_bytes = 0;
+        uint16_t sender_payload_sequence = 0;
+        uint16_t sender_payload_ack = 0;
+        uint32_t sender_payload_ack_bits = 0;
+
+        snapshot_endpoint_process_packet( receiver, receiver_packet_data[0], receiver_packet_bytes[0], buffer, &sender_payload_data, &sender_payload_bytes, &sender_payload_sequence, &sender_payload_ack, &sender_payload_ack_bits );
+
+        snapshot_check( sender_payload_data );
+        snapshot_check( sender_payload_bytes == dummy_payload_bytes );
+        for ( int j = 0; j < dummy_payload_bytes; j++ )
+        {
+            snapshot_check( sender_payload_data[j] == 0 );
+        }
+
+        snapshot_endpoint_mark_payload_processed( sender, sender_payload_sequence, sender_payload_ack, sender_payload_ack_bits, sender_payload_bytes );
+
+        // update endpoints
+
+        snapshot_endpoint_update( sender, time );
+
+        snapshot_endpoint_update( receiver, time );
+
+        time += delta_time;
+    }
+
+    // check sender acks
+
+    uint8_t sender_acked_packet[TEST_ACKS_NUM_ITERATIONS];
+    memset( sender_acked_packet, 0, sizeof( sender_acked_packet ) );
+    int sender_num_acks;
+    uint16_t * sender_acks = snapshot_endpoint_get_acks( sender, &sender_num_acks );
+    for ( int i = 0; i < sender_num_acks; i++ )
+    {
+        if ( sender_acks[i] < TEST_ACKS_NUM_ITERATIONS )
+        {
+            sender_acked_packet[sender_acks[i]] = 1;
+        }
+    }
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
+    {
+        snapshot_check( sender_acked_packet[i] == 1 );
+    }
+
+    // check receiver acks
+
+    uint8_t receiver_acked_packet[TEST_ACKS_NUM_ITERATIONS];
+    memset( receiver_acked_packet, 0, sizeof( receiver_acked_packet ) );
+    int receiver_num_acks;
+    uint16_t * receiver_acks = snapshot_endpoint_get_acks( receiver, &receiver_num_acks );
+    for ( int i = 0; i < receiver_num_acks; i++ )
+    {
+        if ( receiver_acks[i] < TEST_ACKS_NUM_ITERATIONS )
+        {
+            receiver_acked_packet[receiver_acks[i]] = 1;
+        }
+    }
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
+    {
+        snapshot_check( receiver_acked_packet[i] == 1 );
+    }
+
+    // clean up
+
+    snapshot_endpoint_destroy( sender );
+    snapshot_endpoint_destroy( receiver );
+}
+
+void test_acks_packet_loss()
+{
+    double time = 100.0;
+
+    struct snapshot_endpoint_config_t sender_config;
+    struct snapshot_endpoint_config_t receiver_config;
+
+    snapshot_endpoint_default_config( &sender_config );
+    snapshot_endpoint_default_config( &receiver_config );
+
+    strncpy( sender_config.name, "sender", sizeof(sender_config.name) );
+    strncpy( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+
+    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
+    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
+
+    double delta_time = 0.01;
+
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
+    {
+        uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + 8 + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+        uint8_t * dummy_payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+
+        int dummy_payload_bytes = 8;
+
+        memset( dummy_payload_data, 0, dummy_payload_bytes );
+
+        // sender write packet
+
+        int num_sender_packets = 0;
+        uint8_t * sender_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int sender_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+        snapshot_endpoint_write_packets( sender, dummy_payload_data, dummy_payload_bytes, &num_sender_packets, &sender_packet_data[0], &sender_packet_bytes[0] );
+
+        snapshot_check( num_sender_packets == 1 );
+
+        // receiver process packet
+
+        SNAPSHOT_BOOL drop = ( i % 2 ) != 0;
+
+        uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+        uint8_t * receiver_payload_data = NULL;
+        int receiver_payload_bytes = 0;
+        uint16_t receiver_payload_sequence = 0;
+        uint16_t receiver_payload_ack = 0;
+        uint32_t receiver_payload_ack_bits = 0;
+
+        if ( !drop )
+        {
+            snapshot_endpoint_process_packet( receiver, sender_packet_data[0], sender_packet_bytes[0], buffer, &receiver_payload_data, &receiver_payload_bytes, &receiver_payload_sequence, &receiver_payload_ack, &receiver_payload_ack_bits );
+
+            snapshot_check( receiver_payload_data );
+            snapshot_check( receiver_payload_bytes == dummy_payload_bytes );
+            for ( int j = 0; j < dummy_payload_bytes; j++ )
+            {
+                snapshot_check( receiver_payload_data[j] == 0 );
+            }
+
+            snapshot_endpoint_mark_payload_processed( receiver, receiver_payload_sequence, receiver_payload_ack, receiver_payload_ack_bits, receiver_payload_bytes );
+        }
+
+        // receiver write packet
+
+        int num_receiver_packets = 0;
+        uint8_t * receiver_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int receiver_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+        snapshot_endpoint_write_packets( receiver, dummy_payload_data, dummy_payload_bytes, &num_receiver_packets, &receiver_packet_data[0], &receiver_packet_bytes[0] );
+
+        snapshot_check( num_receiver_packets == 1 );
+
+        // sender process packet
+
+        if ( !drop )
+        {
+            uint8_t * sender_payload_data = NULL;
+            int sender_payload_bytes = 0;
+            uint16_t sender_payload_sequence = 0;
+            uint16_t sender_payload_ack = 0;
+            uint32_t sender_payload_ack_bits = 0;
+
+            snapshot_endpoint_process_packet( receiver, receiver_packet_data[0], receiver_packet_bytes[0], buffer, &sender_payload_data, &sender_payload_bytes, &sender_payload_sequence, &sender_payload_ack, &sender_payload_ack_bits );
+
+            snapshot_check( sender_payload_data );
+            snapshot_check( sender_payload_bytes == dummy_payload_bytes );
+            for ( int j = 0; j < dummy_payload_bytes; j++ )
+            {
+                snapshot_check( sender_payload_data[j] == 0 );
+            }
+
+            snapshot_endpoint_mark_payload_processed( sender, sender_payload_sequence, sender_payload_ack, sender_payload_ack_bits, sender_payload_bytes );
+        }
+
+        // update endpoints
+
+        snapshot_endpoint_update( sender, time );
+
+        snapshot_endpoint_update( receiver, time );
+
+        time += delta_time;
+    }
+
+    // check sender acks
+
+    uint8_t sender_acked_packet[TEST_ACKS_NUM_ITERATIONS];
+    memset( sender_acked_packet, 0, sizeof( sender_acked_packet ) );
+    int sender_num_acks;
+    uint16_t * sender_acks = snapshot_endpoint_get_acks( sender, &sender_num_acks );
+    for ( int i = 0; i < sender_num_acks; i++ )
+    {
+        if ( sender_acks[i] < TEST_ACKS_NUM_ITERATIONS )
+        {
+            sender_acked_packet[sender_acks[i]] = 1;
+        }
+    }
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
+    {
+        snapshot_check( sender_acked_packet[i] == (i+1) % 2 );
+    }
+
+    // check receiver acks
+
+    uint8_t receiver_acked_packet[TEST_ACKS_NUM_ITERATIONS];
+    memset( receiver_acked_packet, 0, sizeof( receiver_acked_packet ) );
+    int receiver_num_acks;
+    uint16_t * receiver_acks = snapshot_endpoint_get_acks( receiver, &receiver_num_acks );
+    for ( int i = 0; i < receiver_num_acks; i++ )
+    {
+        if ( receiver_acks[i] < TEST_ACKS_NUM_ITERATIONS )
+        {
+            receiver_acked_packet[receiver_acks[i]] = 1;
+        }
+    }
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
+    {
+        snapshot_check( receiver_acked_packet[i] == (i+1) % 2 );
+    }
+
+    // clean up
+
+    snapshot_endpoint_destroy( sender );
+    snapshot_endpoint_destroy( receiver );
+}
+
+#define TEST_ENDPOINT_STATS_NUM_ITERATIONS 1024
+
+void test_endpoint_create()
+{
+    struct snapshot_endpoint_config_t config;
+    snapshot_endpoint_default_config( &config );
+
+    struct snapshot_endpoint_t * endpoint = snapshot_endpoint_create( &config, 0.0 );
+    snapshot_check( endpoint );
+    snapshot_endpoint_destroy( endpoint );
+
+    // sequence buffer sizes must be powers of two, or entries would alias. bad sizes fail create in every build
+
+    snapshot_endpoint_default_config( &config );
+    config.sent_packets_buffer_size = 300;
+    snapshot_check( snapshot_endpoint_create( &config, 0.0 ) == NULL );
+
+    snapshot_endpoint_default_config( &config );
+    config.received_packets_buffer_size = 0;
+    snapshot_check( snapshot_endpoint_create( &config, 0.0 ) == NULL );
+
+    snapshot_endpoint_default_config( &config );
+    config.fragment_reassembly_buffer_size = 65536;
+    snapshot_check( snapshot_endpoint_create( &config, 0.0 ) == NULL );
+
+    snapshot_endpoint_default_config( &config );
+    config.ack_bits = 96;
+    snapshot_check( snapshot_endpoint_create( &config, 0.0 ) == NULL );
+
+    snapshot_endpoint_default_config( &config );
+    config.ack_bits = 128;
+    config.received_packets_buffer_size = 64;
+    snapshot_check( snapshot_endpoint_create( &config, 0.0 ) == NULL );
+}
+
+void test_endpoint_packet_loss_and_bandwidth()
+{
+    double time = 100.0;
+
+    struct snapshot_endpoint_config_t sender_config;
+    struct snapshot_endpoint_config_t receiver_config;
+
+    snapshot_endpoint_default_config( &sender_config );
+    snapshot_endpoint_default_config( &receiver_config );
+
+    strncpy( sender_config.name, "sender", sizeof(sender_config.name) );
+    strncpy( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+
+    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
+    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
+
+    const double delta_time = 0.01;
+
+    const int payload_bytes = 100;
+
+    uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + 100 + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+    uint8_t * payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+
+    memset( payload_data, 0, payload_bytes );
+
+    uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+    for ( int i = 0; i < TEST_ENDPOINT_STATS_NUM_ITERATIONS; i++ )
+    {
+        // sender sends a packet every iteration and the receiver drops every fourth one
+
+        int num_packets = 0;
+        uint8_t * packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+        snapshot_endpoint_write_packets( sender, payload_data, payload_bytes, &num_packets, &packet_data[0], &packet_bytes[0] );
+
+        snapshot_check( num_packets == 1 );
+
+        if ( ( i % 4 ) != 0 )
+        {
+            uint8_t * received_payload_data = NULL;
+            int received_payload_bytes = 0;
+            uint16_t received_sequence = 0;
+            uint16_t received_ack = 0;
+            uint32_t received_ack_bits = 0;
+
+            snapshot_endpoint_process_packet( receiver, packet_data[0], packet_bytes[0], buffer, &received_payload_data, &received_payload_bytes, &received_sequence, &received_ack, &received_ack_bits );
+
+            snapshot_check( received_payload_data );
+            snapshot_check( received_payload_bytes == payload_bytes );
+
+            snapshot_endpoint_mark_payload_processed( receiver, received_sequence, received_ack, received_ack_bits, received_payload_bytes );
+        }
+
+        // receiver acks everything it has received back to the sender
+
+        uint16_t ack;
+        uint32_t ack_bits;
+        snapshot_packed_sequence_buffer_generate_ack_bits( receiver->received_packets, &ack, &ack_bits );
+        snapshot_endpoint_mark_payload_processed( sender, (uint16_t) i, ack, ack_bits, payload_bytes );
+
+        snapshot_endpoint_clear_acks( sender );
+        snapshot_endpoint_clear_acks( receiver );
+
+        snapshot_endpoint_update( sender, time );
+        snapshot_endpoint_update( receiver, time );
+
+        time += delta_time;
+    }
+
+    const float packet_kbps = (float) ( ( sender_config.packet_header_size + payload_bytes ) * 8.0 / 1000.0 / delta_time );
+
+    float sent_bandwidth_kbps, received_bandwidth_kbps, acked_bandwidth_kbps;
+
+    snapshot_endpoint_bandwidth( sender, &sent_bandwidth_kbps, &received_bandwidth_kbps, &acked_bandwidth_kbps );
+
+    snapshot_check( fabs( snapshot_endpoint_packet_loss( sender ) - 25.0f ) < 1.0f );
+    snapshot_check( fabs( sent_bandwidth_kbps - packet_kbps ) < packet_kbps * 0.05f );
+    snapshot_check( fabs( acked_bandwidth_kbps - packet_kbps * 0.75f ) < packet_kbps * 0.05f );
+    snapshot_check( fabs( received_bandwidth_kbps - packet_kbps ) < packet_kbps * 0.05f );
+
+    snapshot_endpoint_bandwidth( receiver, &sent_bandwidth_kbps, &received_bandwidth_kbps, &acked_bandwidth_kbps );
+
+    snapshot_check( fabs( received_bandwidth_kbps - packet_kbps * 0.75f ) < packet_kbps * 0.05f );
+
+    // after a reset the windows are empty and start over from sequence zero
+
+    snapshot_endpoint_reset( sender );
+
+    snapshot_check( sender->sent_window.num_packets == 0 );
+    snapshot_check( sender->received_window.num_packets == 0 );
+
+    snapshot_endpoint_destroy( sender );
+    snapshot_endpoint_destroy( receiver );
+}
+
+void test_endpoint_bandwidth_gap()
+{
+    double time = 100.0;
+
+    struct snapshot_endpoint_config_t sender_config;
+    struct snapshot_endpoint_config_t receiver_config;
+
+    snapshot_endpoint_default_config( &sender_config );
+    snapshot_endpoint_default_config( &receiver_config );
+
+    strncpy( sender_config.name, "sender", sizeof(sender_config.name) );
+    strncpy( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+
+    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
+    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
+
+    const double delta_time = 0.01;
+
+    const int payload_bytes = 100;
+
+    uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + 100 + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+    uint8_t * payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+
+    memset( payload_data, 0, payload_bytes );
+
+    uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+    // the receiver gets packets 0..199, then nothing for 64 packets sent over a long pause, then packets again.
+    // stop while the start of the received window is inside the gap but the window holds packets from after it
+
+    const int gap_start = 200;
+    const int gap_end = gap_start + 64;
+    const int window_size = receiver_config.received_packets_buffer_size / 2;
+    const int num_packets_sent = gap_start + window_size * 2 + 10;
+
+    snapshot_check( num_packets_sent - receiver_config.received_packets_buffer_size < gap_end );
+
+    double first_time_after_gap = 0.0;
+
+    double * receive_time = (double*) malloc( num_packets_sent * sizeof(double) );
+
+    for ( int i = 0; i < num_packets_sent; i++ )
+    {
+        snapshot_endpoint_update( sender, time );
+        snapshot_endpoint_update( receiver, time );
+
+        int num_packets = 0;
+        uint8_t * packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+        snapshot_endpoint_write_packets( sender, payload_data, payload_bytes, &num_packets, &packet_data[0], &packet_bytes[0] );
+
+        snapshot_check( num_packets == 1 );
+
+        if ( i < gap_start || i >= gap_end )
+        {
+            if ( i == gap_end )
+            {
+                first_time_after_gap = time;
+            }
+
+            uint8_t * received_payload_data = NULL;
+            int received_payload_bytes = 0;
+            uint16_t received_sequence = 0;
+            uint16_t received_ack = 0;
+            uint32_t received_ack_bits = 0;
+
+            snapshot_endpoint_process_packet( receiver, packet_data[0], packet_bytes[0], buffer, &received_payload_data, &received_payload_bytes, &received_sequence, &received_ack, &received_ack_bits );
+
+            snapshot_check( received_payload_data );
+            snapshot_check( received_payload_bytes == payload_bytes );
+
+            snapshot_endpoint_mark_payload_processed( receiver, received_sequence, received_ack, received_ack_bits, received_payload_bytes );
+
+            receive_time[i] = receiver->time;
+        }
+        else
+        {
+            receive_time[i] = -1.0;
+        }
+
+        // the start time tracks the oldest sample in the window after every packet, all the way through the gap
+
+        const struct snapshot_endpoint_window_t * received_window = &receiver->received_window;
+
+        if ( received_window->num_packets > 0 )
+        {
+            double oldest_time = -1.0;
+            for ( int j = 0; j < window_size; j++ )
+            {
+                const int sequence = (uint16_t) ( received_window->start_sequence + j );
+                if ( sequence <= i && receive_time[sequence] >= 0.0 )
+                {
+                    oldest_time = receive_time[sequence];
+                    break;
+                }
+            }
+            snapshot_check( received_window->start_time == oldest_time );
+        }
+
+        time += ( i >= gap_start && i < gap_end ) ? 1.0 : delta_time;
+    }
+
+    // the received window now starts inside the gap, so its start time must be the first packet after the gap
+
+    snapshot_check( receiver->received_window.num_packets > 0 );
+    snapshot_check( receiver->received_window.start_time == first_time_after_gap );
+
+    const float packet_kbps = (float) ( ( receiver_config.packet_header_size + payload_bytes ) * 8.0 / 1000.0 / delta_time );
+
+    const struct snapshot_endpoint_window_t * window = &receiver->received_window;
+
+    const float window_kbps = (float) ( ( (double) window->bytes ) / ( window->finish_time - window->start_time ) * 8.0 / 1000.0 );
+
+    snapshot_check( fabs( window_kbps - packet_kbps ) < packet_kbps * 0.05f );
+
+    free( receive_time );
+
+    snapshot_endpoint_destroy( sender );
+    snapshot_endpoint_destroy( receiver );
+}
+
+void test_endpoint_ack_bits()
+{
+    struct snapshot_endpoint_config_t sender_config;
+    struct snapshot_endpoint_config_t receiver_config;
+
+    snapshot_endpoint_default_config( &sender_config );
+    snapshot_endpoint_default_config( &receiver_config );
+
+    strncpy( sender_config.name, "sender", sizeof(sender_config.name) );
+    strncpy( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+
+    receiver_config.ack_bits = 128;
+
+    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, 100.0 );
+    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, 100.0 );
+
+    uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + 8 + SNAPSHOT_PACKET_POSTFIX_BYTES];
+    uint8_t * payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+    memset( payload_data, 0, 8 );
+
+    // the receiver sees a random subset of packets, some out of order. its running ack bits must match the received packets buffer
+
+    uint16_t sequences[TEST_ACKS_NUM_ITERATIONS];
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
+    {
+        sequences[i] = (uint16_t) i;
+    }
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS - 1; i += 2 )
+    {
+        if ( rand() % 3 == 0 )
+        {
+            uint16_t temp = sequences[i];
+            sequences[i] = sequences[i+1];
+            sequences[i+1] = temp;
+        }
+    }
+
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
+    {
+        if ( rand() % 4 == 0 )
+            continue;
+
+        snapshot_endpoint_mark_payload_processed( receiver, sequences[i], 0, 0, 8 );
+
+        uint16_t ack;
+        uint32_t ack_bits;
+        snapshot_packed_sequence_buffer_generate_ack_bits( receiver->received_packets, &ack, &ack_bits );
+        snapshot_check( ack_bits == receiver->received_ack_bits[0] );
+
+        for ( int j = 0; j < SNAPSHOT_MAX_ACK_BITS; j++ )
+        {
+            const SNAPSHOT_BOOL exists = snapshot_packed_sequence_buffer_exists( receiver->received_packets, (uint16_t) ( ack - j ) ) ? SNAPSHOT_TRUE : SNAPSHOT_FALSE;
+            const SNAPSHOT_BOOL acked = ( receiver->received_ack_bits[j/32] & ( 1U << ( j % 32 ) ) ) ? SNAPSHOT_TRUE : SNAPSHOT_FALSE;
+            snapshot_check( exists == acked );
+        }
+    }
+
+    // 128 ack bits reach the sender through the packet header, so it learns about packets more than 32 behind the latest
+
+    for ( int i = 0; i < 100; i++ )
+    {
+        int num_packets = 0;
+        uint8_t * packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        snapshot_endpoint_write_packets( sender, payload_data, 8, &num_packets, &packet_data[0], &packet_bytes[0] );
+        snapshot_check( num_packets == 1 );
+    }
+
+    snapshot_endpoint_reset( receiver );
+
+    for ( int i = 0; i < 100; i++ )
+    {
+        snapshot_endpoint_mark_payload_processed( receiver, (uint16_t) i, 0, 0, 8 );
+    }
+
+    int num_packets = 0;
+    uint8_t * packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+    int packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+    snapshot_endpoint_write_packets( receiver, payload_data, 8, &num_packets, &packet_data[0], &packet_bytes[0] );
+    snapshot_check( num_packets == 1 );
+
+    struct snapshot_endpoint_payload_t payload;
+    snapshot_endpoint_receive_packet( sender, packet_data[0], packet_bytes[0], &payload );
+    snapshot_check( payload.data );
+    snapshot_check( payload.ack == 99 );
+    snapshot_check( payload.num_ack_words == SNAPSHOT_MAX_ACK_WORDS );
+
+    snapshot_endpoint_mark_payload_processed_ack_words( sender, payload.sequence, payload.ack, payload.ack_bits, payload.num_ack_words, payload.bytes );
+    snapshot_endpoint_release_payload( sender, &payload );
+
+    int num_acks = 0;
+    snapshot_endpoint_get_acks( sender, &num_acks );
+    snapshot_check( num_acks == 100 );
+
+    snapshot_endpoint_destroy( sender );
+    snapshot_endpoint_destroy( receiver );
+}
+
+void test_endpoint_payload()
+{
+    double time = 100.0;
+
+    struct snapshot_endpoint_config_t sender_config;
+    struct snapshot_endpoint_config_t receiver_config;
+
+    snapshot_endpoint_default_config( &sender_config );
+    snapshot_endpoint_default_config( &receiver_config );
+
+    strncpy( sender_config.name, "sender", sizeof(sender_config.name) );
+    strncpy( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+
+    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
+    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
+
+    double delta_time = 0.01;
+
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
+    {
+        uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PAYLOAD_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+        int dummy_payload_bytes = 0;
+        uint8_t * dummy_payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+        snapshot_generate_packet_data( dummy_payload_data, &dummy_payload_bytes, SNAPSHOT_MAX_PAYLOAD_BYTES );
+
+        // sender write packet(s)
+
+        int num_sender_packets = 0;
+        uint8_t * sender_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int sender_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+        snapshot_endpoint_write_packets( sender, dummy_payload_data, dummy_payload_bytes, &num_sender_packets, &sender_packet_data[0], &sender_packet_bytes[0] );
+
+        // receiver process packet(s)
+
+        uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+        uint8_t * receiver_payload_data = NULL;
+        int receiver_payload_bytes = 0;
+        uint16_t receiver_payload_sequence = 0;
+        uint16_t receiver_payload_ack = 0;
+        uint32_t receiver_payload_ack_bits = 0;
+
+        for ( int j = 0; j < num_sender_packets; j++ )
+        {
+            snapshot_endpoint_process_packet( receiver, sender_packet_data[j], sender_packet_bytes[j], buffer, &receiver_payload_data, &receiver_payload_bytes, &receiver_payload_sequence, &receiver_payload_ack, &receiver_payload_ack_bits );
+
+            if ( receiver_payload_data )
+            {
+                snapshot_check( receiver_payload_data );
+                snapshot_check( receiver_payload_bytes == dummy_payload_bytes );
+
+                snapshot_verify_packet_data( receiver_payload_data, receiver_payload_bytes );
+
+                snapshot_endpoint_mark_payload_processed( receiver, receiver_payload_sequence, receiver_payload_ack, receiver_payload_ack_bits, receiver_payload_bytes );
+            }
+        }
+
+        if ( num_sender_packets > 1 )
+        {
+            for ( int j = 0; j < num_sender_packets; j++ )
+            {
+                snapshot_destroy_packet( NULL, sender_packet_data[j] );
+            }
+        }
 
-void test_sequence_buffer()
-{
-    struct snapshot_sequence_buffer_t * sequence_buffer = snapshot_sequence_buffer_create( NULL, TEST_SEQUENCE_BUFFER_SIZE, sizeof( struct test_sequence_data_t ) );
+        // receiver write packet
 
-    snapshot_check( sequence_buffer );
-    snapshot_check( sequence_buffer->sequence == 0 );
-    snapshot_check( sequence_buffer->num_entries == TEST_SEQUENCE_BUFFER_SIZE );
-    snapshot_check( sequence_buffer->entry_stride == sizeof( struct test_sequence_data_t ) );
+        int num_receiver_packets = 0;
+        uint8_t * receiver_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int receiver_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
 
-    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
-    {
-        snapshot_check( snapshot_sequence_buffer_find( sequence_buffer, ((uint16_t)i) ) == NULL );
-    }                                                                      
+        snapshot_endpoint_write_packets( receiver, dummy_payload_data, dummy_payload_bytes, &num_receiver_packets, &receiver_packet_data[0], &receiver_packet_bytes[0] );
 
-    for ( int i = 0; i <= TEST_SEQUENCE_BUFFER_SIZE*4; i++ )
-    {
-        struct test_sequence_data_t * entry = (struct test_sequence_data_t*) snapshot_sequence_buffer_insert( sequence_buffer, ((uint16_t)i) );
-        snapshot_check( entry );
-        entry->sequence = (uint16_t) i;
-        snapshot_check( sequence_buffer->sequence == i + 1 );
+        // sender process packet
+
+        uint8_t * sender_payload_data = NULL;
+        int sender_payload_bytes = 0;
+        uint16_t sender_payload_sequence = 0;
+        uint16_t sender_payload_ack = 0;
+        uint32_t sender_payload_ack_bits = 0;
+
+        for ( int j = 0; j < num_receiver_packets; j++ )
+        {
+            snapshot_endpoint_process_packet( sender, receiver_packet_data[j], receiver_packet_bytes[j], buffer, &sender_payload_data, &sender_payload_bytes, &sender_payload_sequence, &sender_payload_ack, &sender_payload_ack_bits );
+
+            if ( sender_payload_data )
+            {
+                snapshot_check( sender_payload_data );
+                snapshot_check( sender_payload_bytes == dummy_payload_bytes );
+
+                snapshot_verify_packet_data( sender_payload_data, sender_payload_bytes );
+
+                snapshot_endpoint_mark_payload_processed( sender, sender_payload_sequence, sender_payload_ack, sender_payload_ack_bits, sender_payload_bytes );
+            }
+        }
+
+        if ( num_receiver_packets > 1 )
+        {
+            for ( int j = 0; j < num_receiver_packets; j++ )
+            {
+                snapshot_destroy_packet( NULL, receiver_packet_data[j] );
+            }
+        }
+
+        // update endpoints
+
+        snapshot_endpoint_update( sender, time );
+
+        snapshot_endpoint_update( receiver, time );
+
+        time += delta_time;
     }
 
-    for ( int i = 0; i <= TEST_SEQUENCE_BUFFER_SIZE; i++ )
-    {
-        struct test_sequence_data_t * entry = (struct test_sequence_data_t*) snapshot_sequence_buffer_insert( sequence_buffer, ((uint16_t)i) );
-        snapshot_check( entry == NULL );
-    }    
+    // check sender acks
 
-    int index = TEST_SEQUENCE_BUFFER_SIZE * 4;
-    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    uint8_t sender_acked_packet[TEST_ACKS_NUM_ITERATIONS];
+    memset( sender_acked_packet, 0, sizeof( sender_acked_packet ) );
+    int sender_num_acks;
+    uint16_t * sender_acks = snapshot_endpoint_get_acks( sender, &sender_num_acks );
+    for ( int i = 0; i < sender_num_acks; i++ )
     {
-        struct test_sequence_data_t * entry = (struct test_sequence_data_t*) snapshot_sequence_buffer_find( sequence_buffer, (uint16_t) index );
-        snapshot_check( entry );
-        snapshot_check( entry->sequence == (uint32_t) index );
-        index--;
+        if ( sender_acks[i] < TEST_ACKS_NUM_ITERATIONS )
+        {
+            sender_acked_packet[sender_acks[i]] = 1;
+        }
+    }
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
+    {
+        snapshot_check( sender_acked_packet[i] == 1 );
     }
 
-    snapshot_sequence_buffer_reset( sequence_buffer );
-
-    snapshot_check( sequence_buffer );
-    snapshot_check( sequence_buffer->sequence == 0 );
-    snapshot_check( sequence_buffer->num_entries == TEST_SEQUENCE_BUFFER_SIZE );
-    snapshot_check( sequence_buffer->entry_stride == sizeof( struct test_sequence_data_t ) );
+    // check receiver acks
 
-    for ( int i = 0; i < TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    uint8_t receiver_acked_packet[TEST_ACKS_NUM_ITERATIONS];
+    memset( receiver_acked_packet, 0, sizeof( receiver_acked_packet ) );
+    int receiver_num_acks;
+    uint16_t * receiver_acks = snapshot_endpoint_get_acks( receiver, &receiver_num_acks );
+    for ( int i = 0; i < receiver_num_acks; i++ )
     {
-        snapshot_check( snapshot_sequence_buffer_find( sequence_buffer, (uint16_t) i ) == NULL );
+        if ( receiver_acks[i] < TEST_ACKS_NUM_ITERATIONS )
+        {
+            receiver_acked_packet[receiver_acks[i]] = 1;
+        }
+    }
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
+    {
+        snapshot_check( receiver_acked_packet[i] == 1 );
     }
 
-    snapshot_sequence_buffer_destroy( sequence_buffer );
+    // clean up
+
+    snapshot_endpoint_destroy( sender );
+    snapshot_endpoint_destroy( receiver );
 }
 
-void test_generate_ack_bits()
+void test_endpoint_fragments()
 {
-    struct snapshot_sequence_buffer_t * sequence_buffer = snapshot_sequence_buffer_create( NULL, TEST_SEQUENCE_BUFFER_SIZE, sizeof( struct test_sequence_data_t ) );
+    double time = 100.0;
 
-    uint16_t ack = 0;
-    uint32_t ack_bits = 0xFFFFFFFF;
+    struct snapshot_endpoint_config_t sender_config;
+    struct snapshot_endpoint_config_t receiver_config;
 
-    snapshot_sequence_buffer_generate_ack_bits( sequence_buffer, &ack, &ack_bits );
-    snapshot_check( ack == 0xFFFF );
-    snapshot_check( ack_bits == 0 );
+    snapshot_endpoint_default_config( &sender_config );
+    snapshot_endpoint_default_config( &receiver_config );
 
-    for ( int i = 0; i <= TEST_SEQUENCE_BUFFER_SIZE; i++ )
+    strncpy( sender_config.name, "sender", sizeof(sender_config.name) );
+    strncpy( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+
+    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
+    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
+
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
     {
-        snapshot_sequence_buffer_insert( sequence_buffer, (uint16_t) i );
+        uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PAYLOAD_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+        int payload_bytes = 0;
+        uint8_t * payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+        snapshot_generate_packet_data( payload_data, &payload_bytes, SNAPSHOT_MAX_PAYLOAD_BYTES );
+
+        int num_fragments = 0;
+        struct snapshot_endpoint_fragment_t fragments[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+        snapshot_endpoint_write_fragments( sender, payload_data, payload_bytes, &num_fragments, &fragments[0] );
+
+        snapshot_check( num_fragments >= 1 );
+        snapshot_check( ( num_fragments > 1 ) == ( payload_bytes > sender_config.fragment_above ) );
+
+        uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+        int num_payloads_received = 0;
+
+        for ( int j = 0; j < num_fragments; j++ )
+        {
+            snapshot_check( fragments[j].payload_data >= payload_data );
+            snapshot_check( fragments[j].payload_data + fragments[j].payload_bytes <= payload_data + payload_bytes );
+
+            int packet_bytes = 0;
+            uint8_t * packet_data = snapshot_endpoint_fragment_begin( &fragments[j], &packet_bytes );
+
+            snapshot_check( packet_data >= payload_buffer );
+            snapshot_check( packet_bytes == fragments[j].header_bytes + fragments[j].payload_bytes );
+
+            // copy the packet out, like the send queue would, then trash it in place and write over the mac bytes past the end, like encryption would
+
+            uint8_t sent_packet_data[SNAPSHOT_MAX_PACKET_BYTES];
+            memcpy( sent_packet_data, packet_data, packet_bytes );
+            memset( packet_data, 0xFF, packet_bytes + SNAPSHOT_MAC_BYTES );
+
+            snapshot_endpoint_fragment_end( &fragments[j] );
+
+            uint8_t * receiver_payload_data = NULL;
+            int receiver_payload_bytes = 0;
+            uint16_t receiver_payload_sequence = 0;
+            uint16_t receiver_payload_ack = 0;
+            uint32_t receiver_payload_ack_bits = 0;
+
+            snapshot_endpoint_process_packet( receiver, sent_packet_data, packet_bytes, buffer, &receiver_payload_data, &receiver_payload_bytes, &receiver_payload_sequence, &receiver_payload_ack, &receiver_payload_ack_bits );
+
+            if ( receiver_payload_data )
+            {
+                snapshot_check( receiver_payload_bytes == payload_bytes );
+
+                snapshot_verify_packet_data( receiver_payload_data, receiver_payload_bytes );
+
+                snapshot_endpoint_mark_payload_processed( receiver, receiver_payload_sequence, receiver_payload_ack, receiver_payload_ack_bits, receiver_payload_bytes );
+
+                num_payloads_received++;
+            }
+        }
+
+        snapshot_check( num_payloads_received == 1 );
+
+        time += 0.01;
+
+        snapshot_endpoint_update( sender, time );
+        snapshot_endpoint_update( receiver, time );
     }
 
-    snapshot_sequence_buffer_generate_ack_bits( sequence_buffer, &ack, &ack_bits );
-    snapshot_check( ack == TEST_SEQUENCE_BUFFER_SIZE );
-    snapshot_check( ack_bits == 0xFFFFFFFF );
+    snapshot_check( sender->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_PACKETS_SENT] == TEST_ACKS_NUM_ITERATIONS );
+    snapshot_check( receiver->counters[SNAPSHOT_ENDPOINT_COUNTER_NUM_PACKETS_RECEIVED] == TEST_ACKS_NUM_ITERATIONS );
 
-    snapshot_sequence_buffer_reset( sequence_buffer );
+    snapshot_endpoint_destroy( sender );
+    snapshot_endpoint_destroy( receiver );
+}
 
-    uint16_t input_acks[] = { 1, 5, 9, 11 };
-    int input_num_acks = sizeof( input_acks ) / sizeof( uint16_t );
-    for ( int i = 0; i < input_num_acks; i++ )
+void test_endpoint_receive_payload()
+{
+    struct snapshot_packet_pool_t * pool = snapshot_packet_pool_create( NULL );
+
+    const uint64_t * counters = snapshot_packet_pool_counters( pool );
+
+    double time = 100.0;
+
+    struct snapshot_endpoint_config_t sender_config;
+    struct snapshot_endpoint_config_t receiver_config;
+
+    snapshot_endpoint_default_config( &sender_config );
+    snapshot_endpoint_default_config( &receiver_config );
+
+    receiver_config.packet_pool = pool;
+
+    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
+    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
+
+    int num_regular_payloads = 0;
+    int num_reassembled_payloads = 0;
+
+    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
     {
-        snapshot_sequence_buffer_insert( sequence_buffer, input_acks[i] );
+        uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PAYLOAD_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+
+        int payload_bytes = 0;
+        uint8_t * payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+        snapshot_generate_packet_data( payload_data, &payload_bytes, SNAPSHOT_MAX_PAYLOAD_BYTES );
+
+        int num_packets = 0;
+        uint8_t * packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+
+        snapshot_endpoint_write_packets( sender, payload_data, payload_bytes, &num_packets, &packet_data[0], &packet_bytes[0] );
+
+        int num_payloads_received = 0;
+
+        for ( int j = 0; j < num_packets; j++ )
+        {
+            struct snapshot_endpoint_payload_t payload;
+
+            snapshot_endpoint_receive_packet( receiver, packet_data[j], packet_bytes[j], &payload );
+
+            if ( payload.data )
+            {
+                snapshot_check( payload.bytes == payload_bytes );
+
+                snapshot_verify_packet_data( payload.data, payload.bytes );
+
+                if ( num_packets == 1 )
+                {
+                    // regular payloads are read in place, straight out of the packet
+
+                    snapshot_check( payload.reassembly_buffer == NULL );
+                    snapshot_check( payload.data > packet_data[0] );
+                    snapshot_check( payload.data < packet_data[0] + packet_bytes[0] );
+                    num_regular_payloads++;
+                }
+                else
+                {
+                    // reassembled payloads are the reassembly buffer itself, held until released
+
+                    snapshot_check( payload.reassembly_buffer );
+                    snapshot_check( payload.data == payload.reassembly_buffer );
+                    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == 1 );
+                    num_reassembled_payloads++;
+                }
+
+                snapshot_endpoint_mark_payload_processed_ack_words( receiver, payload.sequence, payload.ack, payload.ack_bits, payload.num_ack_words, payload.bytes );
+
+                snapshot_endpoint_release_payload( receiver, &payload );
+
+                snapshot_check( payload.data == NULL );
+                snapshot_check( payload.reassembly_buffer == NULL );
+
+                num_payloads_received++;
+            }
+        }
+
+        snapshot_check( num_payloads_received == 1 );
+
+        snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == 0 );
+
+        if ( num_packets > 1 )
+        {
+            for ( int j = 0; j < num_packets; j++ )
+            {
+                snapshot_destroy_packet( NULL, packet_data[j] );
+            }
+        }
+
+        time += 0.01;
+
+        snapshot_endpoint_update( sender, time );
+        snapshot_endpoint_update( receiver, time );
     }
 
-    snapshot_sequence_buffer_generate_ack_bits( sequence_buffer, &ack, &ack_bits );
+    snapshot_check( num_regular_payloads > 0 );
+    snapshot_check( num_reassembled_payloads > 0 );
 
-    snapshot_check( ack == 11 );
-    snapshot_check( ack_bits == ( 1 | (1<<(11-9)) | (1<<(11-5)) | (1<<(11-1)) ) );
+    snapshot_endpoint_destroy( sender );
+    snapshot_endpoint_destroy( receiver );
 
-    snapshot_sequence_buffer_destroy( sequence_buffer );
+    snapshot_packet_pool_destroy( pool );
 }
 
-void test_packet_header()
+struct packet_pool_allocator_context_t
 {
-    uint16_t write_sequence;
-    uint16_t write_ack;
-    uint32_t write_ack_bits;
+    int allocations_remaining;
+};
+
+void * packet_pool_test_malloc( void * context, size_t bytes )
+{
+    struct packet_pool_allocator_context_t * allocator_context = (struct packet_pool_allocator_context_t*) context;
+    if ( allocator_context )
+    {
+        if ( allocator_context->allocations_remaining == 0 )
+            return NULL;
+        allocator_context->allocations_remaining--;
+    }
+    return malloc( bytes );
+}
+
+void packet_pool_test_free( void * context, void * p )
+{
+    (void) context;
+    free( p );
+}
+
+void test_packet_pool()
+{
+    struct snapshot_packet_pool_t * pool = snapshot_packet_pool_create( NULL );
+
+    snapshot_check( pool );
+
+    const uint64_t * counters = snapshot_packet_pool_counters( pool );
+
+    // freed packets go back on the free list for their size class and are reused
 
-    uint16_t read_sequence;
-    uint16_t read_ack;
-    uint32_t read_ack_bits;
+    uint8_t * a = snapshot_packet_pool_create_packet( pool, 100 );
+    uint8_t * b = snapshot_packet_pool_create_packet( pool, 1000 );
+    snapshot_check( a );
+    snapshot_check( b );
+    memset( a - SNAPSHOT_PACKET_PREFIX_BYTES, 0, SNAPSHOT_PACKET_PREFIX_BYTES + 100 + SNAPSHOT_PACKET_POSTFIX_BYTES );
+    memset( b - SNAPSHOT_PACKET_PREFIX_BYTES, 0, SNAPSHOT_PACKET_PREFIX_BYTES + 1000 + SNAPSHOT_PACKET_POSTFIX_BYTES );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_MISSES] == 2 );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == 2 );
 
-    uint8_t packet_data[SNAPSHOT_MAX_PACKET_HEADER_BYTES];
+    snapshot_destroy_packet( NULL, a );
+    snapshot_destroy_packet( NULL, b );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == 0 );
 
-    // worst case, sequence and ack are far apart, no packets acked.
+    snapshot_check( snapshot_packet_pool_create_packet( pool, 128 ) == a );
+    snapshot_check( snapshot_packet_pool_create_packet( pool, 1024 ) == b );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_HITS] == 2 );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_MISSES] == 2 );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_HIGH_WATER] == 2 );
 
-    write_sequence = 10000;
-    write_ack = 100;
-    write_ack_bits = 0;
+    snapshot_destroy_packet( NULL, a );
+    snapshot_destroy_packet( NULL, b );
 
-    int bytes_written = snapshot_write_packet_header( packet_data, write_sequence, write_ack, write_ack_bits );
+    // packets too large for any size class fall back to the allocator
 
-    snapshot_check( bytes_written == SNAPSHOT_MAX_PACKET_HEADER_BYTES );
+    uint8_t * c = snapshot_packet_pool_create_packet( pool, ( 1 << SNAPSHOT_PACKET_POOL_MAX_SIZE_CLASS_BITS ) + 1 );
+    snapshot_check( c );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_OVERSIZE] == 1 );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == 0 );
+    snapshot_destroy_packet( NULL, c );
 
-    int bytes_read = snapshot_read_packet_header( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, &read_ack_bits );
+    snapshot_packet_pool_destroy( pool );
 
-    snapshot_check( bytes_read == bytes_written );
+    // the pool can only grow as far as the allocator lets it. once the allocator is exhausted, creating a packet
+    // returns NULL, and a freed packet can be created again from the free list without touching the allocator
 
-    snapshot_check( read_sequence == write_sequence );
-    snapshot_check( read_ack == write_ack );
-    snapshot_check( read_ack_bits == write_ack_bits );
+    {
+        #define TEST_PACKET_POOL_CAPACITY 8
 
-    // rare case. sequence and ack are far apart, significant # of acks are missing
+        snapshot_allocator( packet_pool_test_malloc, packet_pool_test_free );
 
-    write_sequence = 10000;
-    write_ack = 100;
-    write_ack_bits = 0xFEFEFFFE;
+        struct packet_pool_allocator_context_t allocator_context;
+        allocator_context.allocations_remaining = 1;
 
-    bytes_written = snapshot_write_packet_header( packet_data, write_sequence, write_ack, write_ack_bits );
+        pool = snapshot_packet_pool_create( &allocator_context );
 
-    snapshot_check( bytes_written == 1 + 2 + 2 + 3 );
+        snapshot_check( pool );
 
-    bytes_read = snapshot_read_packet_header( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, &read_ack_bits );
+        counters = snapshot_packet_pool_counters( pool );
 
-    snapshot_check( bytes_read == bytes_written );
+        allocator_context.allocations_remaining = TEST_PACKET_POOL_CAPACITY;
 
-    snapshot_check( read_sequence == write_sequence );
-    snapshot_check( read_ack == write_ack );
-    snapshot_check( read_ack_bits == write_ack_bits );
+        uint8_t * packets[TEST_PACKET_POOL_CAPACITY];
+        for ( int i = 0; i < TEST_PACKET_POOL_CAPACITY; i++ )
+        {
+            packets[i] = snapshot_packet_pool_create_packet( pool, 1000 );
+            snapshot_check( packets[i] );
+            memset( packets[i] - SNAPSHOT_PACKET_PREFIX_BYTES, 0, SNAPSHOT_PACKET_PREFIX_BYTES + 1000 + SNAPSHOT_PACKET_POSTFIX_BYTES );
+        }
 
-    // common case under packet loss. sequence and ack are close together, some acks are missing
+        snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_MISSES] == TEST_PACKET_POOL_CAPACITY );
+        snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == TEST_PACKET_POOL_CAPACITY );
 
-    write_sequence = 200;
-    write_ack = 100;
-    write_ack_bits = 0xFFFEFFFF;
+        snapshot_check( snapshot_packet_pool_create_packet( pool, 1000 ) == NULL );
+        snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == TEST_PACKET_POOL_CAPACITY );
 
-    bytes_written = snapshot_write_packet_header( packet_data, write_sequence, write_ack, write_ack_bits );
+        snapshot_destroy_packet( &allocator_context, packets[3] );
+        snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == TEST_PACKET_POOL_CAPACITY - 1 );
 
-    snapshot_check( bytes_written == 1 + 2 + 1 + 1 );
+        packets[3] = snapshot_packet_pool_create_packet( pool, 1000 );
+        snapshot_check( packets[3] );
+        snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_HITS] == 1 );
+        snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == TEST_PACKET_POOL_CAPACITY );
+        snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_HIGH_WATER] == TEST_PACKET_POOL_CAPACITY );
 
-    bytes_read = snapshot_read_packet_header( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, &read_ack_bits );
+        snapshot_check( snapshot_packet_pool_create_packet( pool, 1000 ) == NULL );
 
-    snapshot_check( bytes_read == bytes_written );
+        for ( int i = 0; i < TEST_PACKET_POOL_CAPACITY; i++ )
+        {
+            snapshot_destroy_packet( &allocator_context, packets[i] );
+        }
 
-    snapshot_check( read_sequence == write_sequence );
-    snapshot_check( read_ack == write_ack );
-    snapshot_check( read_ack_bits == write_ack_bits );
+        snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == 0 );
 
-    // ideal case. no packet loss.
+        snapshot_packet_pool_destroy( pool );
 
-    write_sequence = 200;
-    write_ack = 100;
-    write_ack_bits = 0xFFFFFFFF;
+        // put the default allocator back, so the exhausted test allocator doesn't leak into later tests
 
-    bytes_written = snapshot_write_packet_header( packet_data, write_sequence, write_ack, write_ack_bits );
+        snapshot_allocator( NULL, NULL );
 
-    snapshot_check( bytes_written == 1 + 2 + 1 );
+        allocator_context.allocations_remaining = 0;
 
-    bytes_read = snapshot_read_packet_header( "test_packet_header", packet_data, bytes_written, &read_sequence, &read_ack, &read_ack_bits );
+        void * p = snapshot_malloc( &allocator_context, 16 );
+        snapshot_check( p );
+        snapshot_free( &allocator_context, p );
+    }
 
-    snapshot_check( bytes_read == bytes_written );
+    // endpoints sending and reassembling fragmented payloads stop allocating once the pool is warm
 
-    snapshot_check( read_sequence == write_sequence );
-    snapshot_check( read_ack == write_ack );
-    snapshot_check( read_ack_bits == write_ack_bits );
-}
+    pool = snapshot_packet_pool_create( NULL );
 
-#define TEST_ACKS_NUM_ITERATIONS 256
+    counters = snapshot_packet_pool_counters( pool );
 
-void test_acks()
-{
     double time = 100.0;
 
     struct snapshot_endpoint_config_t sender_config;
@@ -3560,446 +7607,495 @@ void test_acks()
     snapshot_endpoint_default_config( &sender_config );
     snapshot_endpoint_default_config( &receiver_config );
 
-    snapshot_copy_string( sender_config.name, "sender", sizeof(sender_config.name) );
-    snapshot_copy_string( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+    sender_config.packet_pool = pool;
+    receiver_config.packet_pool = pool;
 
     struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
     struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
 
-    double delta_time = 0.01;
+    const int NumIterations = receiver_config.fragment_reassembly_buffer_size * 4;
 
-    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
-    {
-        uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + 8 + SNAPSHOT_PACKET_POSTFIX_BYTES];
+    uint64_t warm_misses = 0;
 
-        uint8_t * dummy_payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+    for ( int i = 0; i < NumIterations; i++ )
+    {
+        if ( i == NumIterations / 2 )
+        {
+            warm_misses = counters[SNAPSHOT_PACKET_POOL_COUNTER_MISSES];
+        }
 
-        int dummy_payload_bytes = 8;
+        uint8_t * payload_data = snapshot_packet_pool_create_packet( pool, SNAPSHOT_MAX_PAYLOAD_BYTES );
+        int payload_bytes = 0;
+        snapshot_generate_packet_data( payload_data, &payload_bytes, SNAPSHOT_MAX_PAYLOAD_BYTES );
 
-        memset( dummy_payload_data, 0, dummy_payload_bytes );
+        if ( payload_bytes <= sender_config.fragment_above )
+        {
+            payload_bytes = sender_config.fragment_above + 1;
+        }
 
-        // sender write packet
+        int num_packets = 0;
+        uint8_t * packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
 
-        int num_sender_packets = 0;
-        uint8_t * sender_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
-        int sender_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        snapshot_endpoint_write_packets( sender, payload_data, payload_bytes, &num_packets, &packet_data[0], &packet_bytes[0] );
 
-        snapshot_endpoint_write_packets( sender, dummy_payload_data, dummy_payload_bytes, &num_sender_packets, &sender_packet_data[0], &sender_packet_bytes[0] );
+        snapshot_check( num_packets > 1 );
 
-        snapshot_check( num_sender_packets == 1 );
+        uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
 
-        // receiver process packet
+        int num_payloads_received = 0;
 
-        uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+        for ( int j = 0; j < num_packets; j++ )
+        {
+            uint8_t * receiver_payload_data = NULL;
+            int receiver_payload_bytes = 0;
+            uint16_t receiver_payload_sequence = 0;
+            uint16_t receiver_payload_ack = 0;
+            uint32_t receiver_payload_ack_bits = 0;
 
-        uint8_t * receiver_payload_data = NULL;
-        int receiver_payload_bytes = 0;
-        uint16_t receiver_payload_sequence = 0;
-        uint16_t receiver_payload_ack = 0;
-        uint32_t receiver_payload_ack_bits = 0;
+            snapshot_endpoint_process_packet( receiver, packet_data[j], packet_bytes[j], buffer, &receiver_payload_data, &receiver_payload_bytes, &receiver_payload_sequence, &receiver_payload_ack, &receiver_payload_ack_bits );
 
-        snapshot_endpoint_process_packet( receiver, sender_packet_data[0], sender_packet_bytes[0], buffer, &receiver_payload_data, &receiver_payload_bytes, &receiver_payload_sequence, &receiver_payload_ack, &receiver_payload_ack_bits );
+            if ( receiver_payload_data )
+            {
+                snapshot_check( receiver_payload_bytes == payload_bytes );
+                snapshot_endpoint_mark_payload_processed( receiver, receiver_payload_sequence, receiver_payload_ack, receiver_payload_ack_bits, receiver_payload_bytes );
+                num_payloads_received++;
+            }
 
-        snapshot_check( receiver_payload_data );
-        snapshot_check( receiver_payload_bytes == dummy_payload_bytes );
-        for ( int j = 0; j < dummy_payload_bytes; j++ )
-        {
-            snapshot_check( receiver_payload_data[j] == 0 );
+            snapshot_destroy_packet( NULL, packet_data[j] );
         }
 
-        snapshot_endpoint_mark_payload_processed( receiver, receiver_payload_sequence, receiver_payload_ack, receiver_payload_ack_bits, receiver_payload_bytes );
+        snapshot_check( num_payloads_received == 1 );
 
-        // receiver write packet
+        snapshot_destroy_packet( NULL, payload_data );
 
-        int num_receiver_packets = 0;
-        uint8_t * receiver_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
-        int receiver_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        time += 0.01;
 
-        snapshot_endpoint_write_packets( receiver, dummy_payload_data, dummy_payload_bytes, &num_receiver_packets, &receiver_packet_data[0], &receiver_packet_bytes[0] );
+        snapshot_endpoint_update( sender, time );
+        snapshot_endpoint_update( receiver, time );
+    }
 
-        snapshot_check( num_receiver_packets == 1 );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_MISSES] == warm_misses );
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_HITS] > 0 );
 
-        // sender process packet
+    snapshot_endpoint_destroy( sender );
+    snapshot_endpoint_destroy( receiver );
 
-        uint8_t * sender_payload_data = NULL;
-        int sender_payload_bytes = 0;
-        uint16_t sender_payload_sequence = 0;
-        uint16_t sender_payload_ack = 0;
-        uint32_t sender_payload_ack_bits = 0;
+    snapshot_check( counters[SNAPSHOT_PACKET_POOL_COUNTER_IN_USE] == 0 );
 
-        snapshot_endpoint_process_packet( receiver, receiver_packet_data[0], receiver_packet_bytes[0], buffer, &sender_payload_data, &sender_payload_bytes, &sender_payload_sequence, &sender_payload_ack, &sender_payload_ack_bits );
+    snapshot_packet_pool_destroy( pool );
+}
 
-        snapshot_check( sender_payload_data );
-        snapshot_check( sender_payload_bytes == dummy_payload_bytes );
-        for ( int j = 0; j < dummy_payload_bytes; j++ )
-        {
-            snapshot_check( sender_payload_data[j] == 0 );
-        }
+void test_client_server_payload()
+{
+    double time = 0.0;
+    double delta_time = 1.0 / 10.0;
 
-        snapshot_endpoint_mark_payload_processed( sender, sender_payload_sequence, sender_payload_ack, sender_payload_ack_bits, sender_payload_bytes );
+    struct snapshot_client_config_t client_config;
+    snapshot_default_client_config( &client_config );
 
-        // update endpoints
+    // connect client to server
 
-        snapshot_endpoint_update( sender, time );
+    struct snapshot_client_t * client = snapshot_client_create( "0.0.0.0:50000", &client_config, time );
 
-        snapshot_endpoint_update( receiver, time );
+    snapshot_check( client );
 
-        time += delta_time;
-    }
+    uint8_t private_key[SNAPSHOT_KEY_BYTES];
+    snapshot_crypto_random_bytes( private_key, SNAPSHOT_KEY_BYTES );
 
-    // check sender acks
+    struct snapshot_server_config_t server_config;
+    snapshot_default_server_config( &server_config );
+    server_config.max_clients = 1;
+    server_config.protocol_id = TEST_PROTOCOL_ID;
+    memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
 
-    uint8_t sender_acked_packet[TEST_ACKS_NUM_ITERATIONS];
-    memset( sender_acked_packet, 0, sizeof( sender_acked_packet ) );
-    int sender_num_acks;
-    uint16_t * sender_acks = snapshot_endpoint_get_acks( sender, &sender_num_acks );
-    for ( int i = 0; i < sender_num_acks; i++ )
-    {
-        if ( sender_acks[i] < TEST_ACKS_NUM_ITERATIONS )
-        {
-            sender_acked_packet[sender_acks[i]] = 1;
-        }
-    }
-    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
-    {
-        snapshot_check( sender_acked_packet[i] == 1 );
-    }
+    const char * server_address = "127.0.0.1:40000";
 
-    // check receiver acks
+    struct snapshot_server_t * server = snapshot_server_create( server_address, &server_config, time );
 
-    uint8_t receiver_acked_packet[TEST_ACKS_NUM_ITERATIONS];
-    memset( receiver_acked_packet, 0, sizeof( receiver_acked_packet ) );
-    int receiver_num_acks;
-    uint16_t * receiver_acks = snapshot_endpoint_get_acks( receiver, &receiver_num_acks );
-    for ( int i = 0; i < receiver_num_acks; i++ )
-    {
-        if ( receiver_acks[i] < TEST_ACKS_NUM_ITERATIONS )
-        {
-            receiver_acked_packet[receiver_acks[i]] = 1;
-        }
-    }
-    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
+    snapshot_check( server );
+
+    uint8_t connect_token[SNAPSHOT_CONNECT_TOKEN_BYTES];
+
+    uint64_t client_id = 0;
+    snapshot_crypto_random_bytes( (uint8_t*) &client_id, 8 );
+
+    uint8_t user_data[SNAPSHOT_USER_DATA_BYTES];
+    snapshot_crypto_random_bytes(user_data, SNAPSHOT_USER_DATA_BYTES);
+
+    snapshot_check( snapshot_generate_connect_token( 1, &server_address, TEST_CONNECT_TOKEN_EXPIRY, TEST_TIMEOUT_SECONDS, client_id, TEST_PROTOCOL_ID, private_key, user_data, connect_token ) == SNAPSHOT_OK );
+
+    snapshot_client_connect( client, connect_token );
+
+    while ( 1 )
     {
-        snapshot_check( receiver_acked_packet[i] == 1 );
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
+
+        if ( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED )
+            break;
+
+        time += delta_time;
     }
 
-    // clean up
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
 
-    snapshot_endpoint_destroy( sender );
-    snapshot_endpoint_destroy( receiver );
-}
+    // exchange payload packets
 
-void test_acks_packet_loss()
-{
-    double time = 100.0;
+    snapshot_client_set_development_flags( client, SNAPSHOT_DEVELOPMENT_FLAG_VALIDATE_PAYLOAD );
+    snapshot_server_set_development_flags( server, SNAPSHOT_DEVELOPMENT_FLAG_VALIDATE_PAYLOAD );
 
-    struct snapshot_endpoint_config_t sender_config;
-    struct snapshot_endpoint_config_t receiver_config;
+    for ( int i = 0; i < 256; i++ )
+    {
+        snapshot_client_update( client, time );
 
-    snapshot_endpoint_default_config( &sender_config );
-    snapshot_endpoint_default_config( &receiver_config );
+        snapshot_server_update( server, time );
 
-    strncpy( sender_config.name, "sender", sizeof(sender_config.name) );
-    strncpy( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+        if ( snapshot_client_state( client ) <= SNAPSHOT_CLIENT_STATE_DISCONNECTED )
+            break;
 
-    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
-    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
+        time += delta_time;
+    }
 
-    double delta_time = 0.01;
+    // check client counters
 
-    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
-    {
-        uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + 8 + SNAPSHOT_PACKET_POSTFIX_BYTES];
+    const uint64_t * client_counters = snapshot_client_counters( client );
 
-        uint8_t * dummy_payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
+    snapshot_check( client_counters[SNAPSHOT_CLIENT_COUNTER_PAYLOADS_SENT] > 0 );
+    snapshot_check( client_counters[SNAPSHOT_CLIENT_COUNTER_PAYLOADS_RECEIVED] > 0 );
 
-        int dummy_payload_bytes = 8;
+    // check server counters
 
-        memset( dummy_payload_data, 0, dummy_payload_bytes );
+    const uint64_t * server_counters = snapshot_server_counters( server );
 
-        // sender write packet
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PAYLOADS_SENT] > 0 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PAYLOADS_RECEIVED] > 0 );
 
-        int num_sender_packets = 0;
-        uint8_t * sender_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
-        int sender_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+    // clean up
+
+    snapshot_server_destroy( server );
+
+    snapshot_client_destroy( client );
+}
+
+void test_delta_encoder()
+{
+    const int SnapshotBytes = 256;
+    const int NumFields = SnapshotBytes / 4;
+    const int HistorySize = 32;
+    const int NumTicks = 2000;
 
-        snapshot_endpoint_write_packets( sender, dummy_payload_data, dummy_payload_bytes, &num_sender_packets, &sender_packet_data[0], &sender_packet_bytes[0] );
+    struct snapshot_delta_encoder_t * encoder = snapshot_delta_encoder_create( NULL, SnapshotBytes, HistorySize );
+    struct snapshot_delta_decoder_t * decoder = snapshot_delta_decoder_create( NULL, SnapshotBytes, HistorySize );
 
-        snapshot_check( num_sender_packets == 1 );
+    snapshot_check( encoder );
+    snapshot_check( decoder );
 
-        // receiver process packet
+    uint32_t fields[SnapshotBytes / 4];
+    memset( fields, 0, sizeof(fields) );
 
-        SNAPSHOT_BOOL drop = ( i % 2 ) != 0;
+    uint8_t snapshot_data[SnapshotBytes];
 
-        uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+    int num_keyframes = 0;
+    int num_deltas = 0;
+    int num_received = 0;
+    int delta_bytes = 0;
 
-        uint8_t * receiver_payload_data = NULL;
-        int receiver_payload_bytes = 0;
-        uint16_t receiver_payload_sequence = 0;
-        uint16_t receiver_payload_ack = 0;
-        uint32_t receiver_payload_ack_bits = 0;
+    uint16_t pending_ack = 0;
+    SNAPSHOT_BOOL has_pending_ack = SNAPSHOT_FALSE;
 
-        if ( !drop )
-        {
-            snapshot_endpoint_process_packet( receiver, sender_packet_data[0], sender_packet_bytes[0], buffer, &receiver_payload_data, &receiver_payload_bytes, &receiver_payload_sequence, &receiver_payload_ack, &receiver_payload_ack_bits );
+    for ( int i = 0; i < NumTicks; i++ )
+    {
+        // move a few fields a small amount and flip a few bits, the way game state changes between ticks
 
-            snapshot_check( receiver_payload_data );
-            snapshot_check( receiver_payload_bytes == dummy_payload_bytes );
-            for ( int j = 0; j < dummy_payload_bytes; j++ )
+        for ( int j = 0; j < 4; j++ )
+        {
+            const int index = rand() % NumFields;
+            if ( rand() % 2 )
             {
-                snapshot_check( receiver_payload_data[j] == 0 );
+                fields[index] += (uint32_t) ( rand() % 200 ) - 100;
             }
+            else
+            {
+                fields[index] ^= 1U << ( rand() % 32 );
+            }
+        }
 
-            snapshot_endpoint_mark_payload_processed( receiver, receiver_payload_sequence, receiver_payload_ack, receiver_payload_ack_bits, receiver_payload_bytes );
+        uint8_t * p = snapshot_data;
+        for ( int j = 0; j < NumFields; j++ )
+        {
+            snapshot_write_uint32( &p, fields[j] );
         }
 
-        // receiver write packet
+        // acks arrive a tick after the snapshot they ack
 
-        int num_receiver_packets = 0;
-        uint8_t * receiver_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
-        int receiver_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        if ( has_pending_ack )
+        {
+            snapshot_delta_encoder_process_acks( encoder, &pending_ack, 1 );
+            has_pending_ack = SNAPSHOT_FALSE;
+        }
 
-        snapshot_endpoint_write_packets( receiver, dummy_payload_data, dummy_payload_bytes, &num_receiver_packets, &receiver_packet_data[0], &receiver_packet_bytes[0] );
+        const uint16_t sequence = (uint16_t) i;
 
-        snapshot_check( num_receiver_packets == 1 );
+        int bytes = 0;
+        int encoding = -1;
+        const uint8_t * data = snapshot_delta_encoder_write( encoder, sequence, snapshot_data, &bytes, &encoding );
 
-        // sender process packet
+        snapshot_check( data );
+        snapshot_check( bytes > 0 );
+        snapshot_check( bytes <= snapshot_delta_max_bytes( SnapshotBytes ) );
 
-        if ( !drop )
+        if ( i == 0 )
         {
-            uint8_t * sender_payload_data = NULL;
-            int sender_payload_bytes = 0;
-            uint16_t sender_payload_sequence = 0;
-            uint16_t sender_payload_ack = 0;
-            uint32_t sender_payload_ack_bits = 0;
+            snapshot_check( encoding == SNAPSHOT_DELTA_ENCODING_KEYFRAME );
+        }
 
-            snapshot_endpoint_process_packet( receiver, receiver_packet_data[0], receiver_packet_bytes[0], buffer, &sender_payload_data, &sender_payload_bytes, &sender_payload_sequence, &sender_payload_ack, &sender_payload_ack_bits );
+        if ( encoding == SNAPSHOT_DELTA_ENCODING_DELTA )
+        {
+            num_deltas++;
+            delta_bytes += bytes;
+        }
+        else
+        {
+            num_keyframes++;
+        }
 
-            snapshot_check( sender_payload_data );
-            snapshot_check( sender_payload_bytes == dummy_payload_bytes );
-            for ( int j = 0; j < dummy_payload_bytes; j++ )
-            {
-                snapshot_check( sender_payload_data[j] == 0 );
-            }
+        // drop a quarter of the snapshots
 
-            snapshot_endpoint_mark_payload_processed( sender, sender_payload_sequence, sender_payload_ack, sender_payload_ack_bits, sender_payload_bytes );
-        }
+        if ( ( rand() % 4 ) == 0 )
+            continue;
 
-        // update endpoints
+        snapshot_check( snapshot_delta_decoder_read( decoder, sequence, data, bytes ) == SNAPSHOT_OK );
 
-        snapshot_endpoint_update( sender, time );
+        const uint8_t * decoded = snapshot_delta_decoder_find( decoder, sequence );
+        snapshot_check( decoded );
+        snapshot_check( memcmp( decoded, snapshot_data, SnapshotBytes ) == 0 );
 
-        snapshot_endpoint_update( receiver, time );
+        num_received++;
 
-        time += delta_time;
+        pending_ack = sequence;
+        has_pending_ack = SNAPSHOT_TRUE;
     }
 
-    // check sender acks
+    snapshot_check( num_received > 0 );
+    snapshot_check( num_deltas > num_keyframes );
+    snapshot_check( delta_bytes / num_deltas < SnapshotBytes / 4 );
 
-    uint8_t sender_acked_packet[TEST_ACKS_NUM_ITERATIONS];
-    memset( sender_acked_packet, 0, sizeof( sender_acked_packet ) );
-    int sender_num_acks;
-    uint16_t * sender_acks = snapshot_endpoint_get_acks( sender, &sender_num_acks );
-    for ( int i = 0; i < sender_num_acks; i++ )
-    {
-        if ( sender_acks[i] < TEST_ACKS_NUM_ITERATIONS )
-        {
-            sender_acked_packet[sender_acks[i]] = 1;
-        }
-    }
-    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
-    {
-        snapshot_check( sender_acked_packet[i] == (i+1) % 2 );
-    }
+    // a delta against a baseline the decoder does not have is rejected
 
-    // check receiver acks
+    struct snapshot_delta_decoder_t * empty_decoder = snapshot_delta_decoder_create( NULL, SnapshotBytes, HistorySize );
+    snapshot_check( empty_decoder );
 
-    uint8_t receiver_acked_packet[TEST_ACKS_NUM_ITERATIONS];
-    memset( receiver_acked_packet, 0, sizeof( receiver_acked_packet ) );
-    int receiver_num_acks;
-    uint16_t * receiver_acks = snapshot_endpoint_get_acks( receiver, &receiver_num_acks );
-    for ( int i = 0; i < receiver_num_acks; i++ )
-    {
-        if ( receiver_acks[i] < TEST_ACKS_NUM_ITERATIONS )
-        {
-            receiver_acked_packet[receiver_acks[i]] = 1;
-        }
-    }
-    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
     {
-        snapshot_check( receiver_acked_packet[i] == (i+1) % 2 );
+        int bytes = 0;
+        int encoding = -1;
+        const uint8_t * data = snapshot_delta_encoder_write( encoder, (uint16_t) NumTicks, snapshot_data, &bytes, &encoding );
+        snapshot_check( encoding == SNAPSHOT_DELTA_ENCODING_DELTA );
+        snapshot_check( snapshot_delta_decoder_read( empty_decoder, (uint16_t) NumTicks, data, bytes ) == SNAPSHOT_ERROR );
+
+        // truncated data is rejected too
+
+        snapshot_check( snapshot_delta_decoder_read( decoder, (uint16_t) NumTicks, data, 1 ) == SNAPSHOT_ERROR );
     }
 
-    // clean up
+    // a snapshot with every field changed falls back to raw bytes, and a reset encoder starts over with a keyframe
 
-    snapshot_endpoint_destroy( sender );
-    snapshot_endpoint_destroy( receiver );
-}
+    snapshot_delta_encoder_reset( encoder );
 
-void test_endpoint_payload()
-{
-    double time = 100.0;
+    snapshot_crypto_random_bytes( snapshot_data, SnapshotBytes );
 
-    struct snapshot_endpoint_config_t sender_config;
-    struct snapshot_endpoint_config_t receiver_config;
+    {
+        int bytes = 0;
+        int encoding = -1;
+        const uint8_t * data = snapshot_delta_encoder_write( encoder, 0, snapshot_data, &bytes, &encoding );
+        snapshot_check( encoding == SNAPSHOT_DELTA_ENCODING_RAW );
+        snapshot_check( bytes == snapshot_delta_max_bytes( SnapshotBytes ) );
+        snapshot_check( snapshot_delta_decoder_read( empty_decoder, 0, data, bytes ) == SNAPSHOT_OK );
+        snapshot_check( memcmp( snapshot_delta_decoder_find( empty_decoder, 0 ), snapshot_data, SnapshotBytes ) == 0 );
+    }
 
-    snapshot_endpoint_default_config( &sender_config );
-    snapshot_endpoint_default_config( &receiver_config );
+    snapshot_delta_decoder_destroy( empty_decoder );
+    snapshot_delta_decoder_destroy( decoder );
+    snapshot_delta_encoder_destroy( encoder );
+}
 
-    strncpy( sender_config.name, "sender", sizeof(sender_config.name) );
-    strncpy( receiver_config.name, "receiver", sizeof(receiver_config.name) );
+void test_range_coder()
+{
+    const int MaxBytes = 1024;
+    const int HistorySize = 32;
+    const int NumTicks = 1000;
 
-    struct snapshot_endpoint_t * sender = snapshot_endpoint_create( &sender_config, time );
-    struct snapshot_endpoint_t * receiver = snapshot_endpoint_create( &receiver_config, time );
+    uint8_t payload_data[MaxBytes];
 
-    double delta_time = 0.01;
+    // incompressible bytes go out uncoded with a single byte of overhead, and still decode
 
-    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS; i++ )
     {
-        uint8_t payload_buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PAYLOAD_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+        struct snapshot_range_encoder_t * encoder = snapshot_range_encoder_create( NULL, MaxBytes, SNAPSHOT_RANGE_CODER_STATIC, NULL, 0 );
+        struct snapshot_range_decoder_t * decoder = snapshot_range_decoder_create( NULL, MaxBytes, SNAPSHOT_RANGE_CODER_STATIC, NULL, 0 );
 
-        int dummy_payload_bytes = 0;
-        uint8_t * dummy_payload_data = payload_buffer + SNAPSHOT_PACKET_PREFIX_BYTES;
-        snapshot_generate_packet_data( dummy_payload_data, &dummy_payload_bytes, SNAPSHOT_MAX_PAYLOAD_BYTES );
+        snapshot_check( encoder );
+        snapshot_check( decoder );
 
-        // sender write packet(s)
+        snapshot_crypto_random_bytes( payload_data, MaxBytes );
 
-        int num_sender_packets = 0;
-        uint8_t * sender_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
-        int sender_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+        int bytes = 0;
+        const uint8_t * data = snapshot_range_encoder_write( encoder, 0, payload_data, MaxBytes, &bytes );
+        snapshot_check( bytes == MaxBytes + 1 );
 
-        snapshot_endpoint_write_packets( sender, dummy_payload_data, dummy_payload_bytes, &num_sender_packets, &sender_packet_data[0], &sender_packet_bytes[0] );
+        int decoded_bytes = 0;
+        const uint8_t * decoded = snapshot_range_decoder_read( decoder, 0, data, bytes, &decoded_bytes );
+        snapshot_check( decoded );
+        snapshot_check( decoded_bytes == MaxBytes );
+        snapshot_check( memcmp( decoded, payload_data, MaxBytes ) == 0 );
 
-        // receiver process packet(s)
+        // empty payloads work too
 
-        uint8_t buffer[SNAPSHOT_PACKET_PREFIX_BYTES + SNAPSHOT_MAX_PACKET_BYTES + SNAPSHOT_PACKET_POSTFIX_BYTES];
+        data = snapshot_range_encoder_write( encoder, 1, payload_data, 0, &bytes );
+        snapshot_check( snapshot_range_decoder_read( decoder, 1, data, bytes, &decoded_bytes ) );
+        snapshot_check( decoded_bytes == 0 );
 
-        uint8_t * receiver_payload_data = NULL;
-        int receiver_payload_bytes = 0;
-        uint16_t receiver_payload_sequence = 0;
-        uint16_t receiver_payload_ack = 0;
-        uint32_t receiver_payload_ack_bits = 0;
+        snapshot_range_decoder_destroy( decoder );
+        snapshot_range_encoder_destroy( encoder );
+    }
 
-        for ( int j = 0; j < num_sender_packets; j++ )
-        {
-            snapshot_endpoint_process_packet( receiver, sender_packet_data[j], sender_packet_bytes[j], buffer, &receiver_payload_data, &receiver_payload_bytes, &receiver_payload_sequence, &receiver_payload_ack, &receiver_payload_ack_bits );
+    // mostly small values compress with both models. the adaptive coder carries what it learned across packets
+    // through acks, while a quarter of the packets are lost, and ends up smaller than the static one
 
-            if ( receiver_payload_data )
-            {
-                snapshot_check( receiver_payload_data );
-                snapshot_check( receiver_payload_bytes == dummy_payload_bytes );
+    int total_bytes[2] = { 0, 0 };
 
-                snapshot_verify_packet_data( receiver_payload_data, receiver_payload_bytes );
+    for ( int mode = SNAPSHOT_RANGE_CODER_STATIC; mode <= SNAPSHOT_RANGE_CODER_ADAPTIVE; mode++ )
+    {
+        struct snapshot_range_encoder_t * encoder = snapshot_range_encoder_create( NULL, MaxBytes, mode, NULL, HistorySize );
+        struct snapshot_range_decoder_t * decoder = snapshot_range_decoder_create( NULL, MaxBytes, mode, NULL, HistorySize );
 
-                snapshot_endpoint_mark_payload_processed( receiver, receiver_payload_sequence, receiver_payload_ack, receiver_payload_ack_bits, receiver_payload_bytes );
-            }
-        }
+        snapshot_check( encoder );
+        snapshot_check( decoder );
 
-        if ( num_sender_packets > 1 )
+        uint16_t pending_ack = 0;
+        SNAPSHOT_BOOL has_pending_ack = SNAPSHOT_FALSE;
+
+        for ( int i = 0; i < NumTicks; i++ )
         {
-            for ( int j = 0; j < num_sender_packets; j++ )
+            const int payload_bytes = 100 + rand() % 100;
+            for ( int j = 0; j < payload_bytes; j++ )
             {
-                snapshot_destroy_packet( NULL, sender_packet_data[j] );
+                payload_data[j] = ( rand() % 4 ) == 0 ? (uint8_t) ( rand() % 16 ) : 0;
             }
-        }
-
-        // receiver write packet
 
-        int num_receiver_packets = 0;
-        uint8_t * receiver_packet_data[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
-        int receiver_packet_bytes[SNAPSHOT_ENDPOINT_MAX_WRITE_PACKETS];
+            if ( has_pending_ack )
+            {
+                snapshot_range_encoder_process_acks( encoder, &pending_ack, 1 );
+                has_pending_ack = SNAPSHOT_FALSE;
+            }
 
-        snapshot_endpoint_write_packets( receiver, dummy_payload_data, dummy_payload_bytes, &num_receiver_packets, &receiver_packet_data[0], &receiver_packet_bytes[0] );
+            const uint16_t sequence = (uint16_t) i;
 
-        // sender process packet
+            int bytes = 0;
+            const uint8_t * data = snapshot_range_encoder_write( encoder, sequence, payload_data, payload_bytes, &bytes );
 
-        uint8_t * sender_payload_data = NULL;
-        int sender_payload_bytes = 0;
-        uint16_t sender_payload_sequence = 0;
-        uint16_t sender_payload_ack = 0;
-        uint32_t sender_payload_ack_bits = 0;
+            snapshot_check( data );
+            snapshot_check( bytes > 0 );
+            snapshot_check( bytes <= snapshot_range_coder_max_bytes( payload_bytes ) );
 
-        for ( int j = 0; j < num_receiver_packets; j++ )
-        {
-            snapshot_endpoint_process_packet( sender, receiver_packet_data[j], receiver_packet_bytes[j], buffer, &sender_payload_data, &sender_payload_bytes, &sender_payload_sequence, &sender_payload_ack, &sender_payload_ack_bits );
+            total_bytes[mode-SNAPSHOT_RANGE_CODER_STATIC] += bytes;
 
-            if ( sender_payload_data )
-            {
-                snapshot_check( sender_payload_data );
-                snapshot_check( sender_payload_bytes == dummy_payload_bytes );
+            if ( ( rand() % 4 ) == 0 )
+                continue;
 
-                snapshot_verify_packet_data( sender_payload_data, sender_payload_bytes );
+            int decoded_bytes = 0;
+            const uint8_t * decoded = snapshot_range_decoder_read( decoder, sequence, data, bytes, &decoded_bytes );
+            snapshot_check( decoded );
+            snapshot_check( decoded_bytes == payload_bytes );
+            snapshot_check( memcmp( decoded, payload_data, payload_bytes ) == 0 );
 
-                snapshot_endpoint_mark_payload_processed( sender, sender_payload_sequence, sender_payload_ack, sender_payload_ack_bits, sender_payload_bytes );
-            }
+            pending_ack = sequence;
+            has_pending_ack = SNAPSHOT_TRUE;
         }
 
-        if ( num_receiver_packets > 1 )
+        if ( mode == SNAPSHOT_RANGE_CODER_ADAPTIVE )
         {
-            for ( int j = 0; j < num_receiver_packets; j++ )
-            {
-                snapshot_destroy_packet( NULL, receiver_packet_data[j] );
-            }
-        }
+            // a packet coded against a model the decoder does not have is rejected, as are bad flags and truncated data
 
-        // update endpoints
+            struct snapshot_range_decoder_t * empty_decoder = snapshot_range_decoder_create( NULL, MaxBytes, mode, NULL, HistorySize );
+            snapshot_check( empty_decoder );
 
-        snapshot_endpoint_update( sender, time );
+            snapshot_range_encoder_process_acks( encoder, &pending_ack, 1 );
 
-        snapshot_endpoint_update( receiver, time );
+            int bytes = 0;
+            const uint8_t * data = snapshot_range_encoder_write( encoder, (uint16_t) NumTicks, payload_data, 100, &bytes );
 
-        time += delta_time;
-    }
+            int decoded_bytes = 0;
+            snapshot_check( snapshot_range_decoder_read( empty_decoder, (uint16_t) NumTicks, data, bytes, &decoded_bytes ) == NULL );
+            snapshot_check( snapshot_range_decoder_read( decoder, (uint16_t) NumTicks, data, 2, &decoded_bytes ) == NULL );
 
-    // check sender acks
+            uint8_t bad_flags = 0xFF;
+            snapshot_check( snapshot_range_decoder_read( decoder, (uint16_t) NumTicks, &bad_flags, 1, &decoded_bytes ) == NULL );
 
-    uint8_t sender_acked_packet[TEST_ACKS_NUM_ITERATIONS];
-    memset( sender_acked_packet, 0, sizeof( sender_acked_packet ) );
-    int sender_num_acks;
-    uint16_t * sender_acks = snapshot_endpoint_get_acks( sender, &sender_num_acks );
-    for ( int i = 0; i < sender_num_acks; i++ )
-    {
-        if ( sender_acks[i] < TEST_ACKS_NUM_ITERATIONS )
-        {
-            sender_acked_packet[sender_acks[i]] = 1;
+            snapshot_range_decoder_destroy( empty_decoder );
         }
-    }
-    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
-    {
-        snapshot_check( sender_acked_packet[i] == 1 );
+
+        snapshot_range_decoder_destroy( decoder );
+        snapshot_range_encoder_destroy( encoder );
     }
 
-    // check receiver acks
+    snapshot_check( total_bytes[0] < NumTicks * 150 / 2 );
+    snapshot_check( total_bytes[1] < total_bytes[0] );
 
-    uint8_t receiver_acked_packet[TEST_ACKS_NUM_ITERATIONS];
-    memset( receiver_acked_packet, 0, sizeof( receiver_acked_packet ) );
-    int receiver_num_acks;
-    uint16_t * receiver_acks = snapshot_endpoint_get_acks( receiver, &receiver_num_acks );
-    for ( int i = 0; i < receiver_num_acks; i++ )
+    // a static model trained on similar data beats the default one
+
+    struct snapshot_range_model_t model;
+    snapshot_range_model_init( &model );
+    for ( int i = 0; i < MaxBytes; i++ )
     {
-        if ( receiver_acks[i] < TEST_ACKS_NUM_ITERATIONS )
-        {
-            receiver_acked_packet[receiver_acks[i]] = 1;
-        }
+        payload_data[i] = ( rand() % 4 ) == 0 ? (uint8_t) ( rand() % 16 ) : 0;
     }
-    for ( int i = 0; i < TEST_ACKS_NUM_ITERATIONS / 2; i++ )
+    snapshot_range_model_train( &model, payload_data, MaxBytes );
+
+    struct snapshot_range_encoder_t * default_encoder = snapshot_range_encoder_create( NULL, MaxBytes, SNAPSHOT_RANGE_CODER_STATIC, NULL, 0 );
+    struct snapshot_range_encoder_t * trained_encoder = snapshot_range_encoder_create( NULL, MaxBytes, SNAPSHOT_RANGE_CODER_STATIC, &model, 0 );
+    struct snapshot_range_decoder_t * trained_decoder = snapshot_range_decoder_create( NULL, MaxBytes, SNAPSHOT_RANGE_CODER_STATIC, &model, 0 );
+
+    snapshot_check( default_encoder );
+    snapshot_check( trained_encoder );
+    snapshot_check( trained_decoder );
+
+    for ( int i = 0; i < 64; i++ )
     {
-        snapshot_check( receiver_acked_packet[i] == 1 );
+        payload_data[i] = ( rand() % 4 ) == 0 ? (uint8_t) ( rand() % 16 ) : 0;
     }
 
-    // clean up
-
-    snapshot_endpoint_destroy( sender );
-    snapshot_endpoint_destroy( receiver );
+    int default_bytes = 0;
+    int trained_bytes = 0;
+    snapshot_range_encoder_write( default_encoder, 0, payload_data, 64, &default_bytes );
+    const uint8_t * data = snapshot_range_encoder_write( trained_encoder, 0, payload_data, 64, &trained_bytes );
+    snapshot_check( trained_bytes < default_bytes );
+
+    int decoded_bytes = 0;
+    const uint8_t * decoded = snapshot_range_decoder_read( trained_decoder, 0, data, trained_bytes, &decoded_bytes );
+    snapshot_check( decoded );
+    snapshot_check( decoded_bytes == 64 );
+    snapshot_check( memcmp( decoded, payload_data, 64 ) == 0 );
+
+    snapshot_range_decoder_destroy( trained_decoder );
+    snapshot_range_encoder_destroy( trained_encoder );
+    snapshot_range_encoder_destroy( default_encoder );
 }
 
-void test_client_server_payload()
+static void test_client_server_snapshot_range_coder_mode( int range_coder )
 {
     double time = 0.0;
     double delta_time = 1.0 / 10.0;
 
+    const int SnapshotBytes = 1024;
+
     struct snapshot_client_config_t client_config;
     snapshot_default_client_config( &client_config );
+    client_config.snapshot_bytes = SnapshotBytes;
+    client_config.snapshot_range_coder = range_coder;
 
     // connect client to server
 
@@ -4014,6 +8110,8 @@ void test_client_server_payload()
     snapshot_default_server_config( &server_config );
     server_config.max_clients = 1;
     server_config.protocol_id = TEST_PROTOCOL_ID;
+    server_config.snapshot_bytes = SnapshotBytes;
+    server_config.snapshot_range_coder = range_coder;
     memcpy( &server_config.private_key, private_key, SNAPSHOT_KEY_BYTES );
 
     const char * server_address = "127.0.0.1:40000";
@@ -4051,13 +8149,24 @@ void test_client_server_payload()
 
     snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
 
-    // exchange payload packets
+    snapshot_check( snapshot_client_snapshot( client, NULL ) == NULL );
 
-    snapshot_client_set_development_flags( client, SNAPSHOT_DEVELOPMENT_FLAG_VALIDATE_PAYLOAD );
-    snapshot_server_set_development_flags( server, SNAPSHOT_DEVELOPMENT_FLAG_VALIDATE_PAYLOAD );
+    // change a few bytes of the snapshot each tick. the server sends it delta encoded against what the client acked
+
+    uint8_t snapshot_data[SnapshotBytes];
+    memset( snapshot_data, 0, sizeof(snapshot_data) );
+
+    const int changes_per_tick = ( range_coder != SNAPSHOT_RANGE_CODER_NONE ) ? 32 : 1;
 
     for ( int i = 0; i < 256; i++ )
     {
+        for ( int j = 0; j < changes_per_tick; j++ )
+        {
+            snapshot_data[rand() % SnapshotBytes]++;
+        }
+
+        snapshot_server_set_snapshot( server, snapshot_data, SnapshotBytes );
+
         snapshot_client_update( client, time );
 
         snapshot_server_update( server, time );
@@ -4068,19 +8177,41 @@ void test_client_server_payload()
         time += delta_time;
     }
 
-    // check client counters
+    // once the snapshot stops changing the client catches up with it
+
+    for ( int i = 0; i < 10; i++ )
+    {
+        snapshot_client_update( client, time );
+
+        snapshot_server_update( server, time );
+
+        time += delta_time;
+    }
+
+    snapshot_check( snapshot_client_state( client ) == SNAPSHOT_CLIENT_STATE_CONNECTED );
+
+    uint16_t snapshot_sequence = 0;
+    const uint8_t * client_snapshot = snapshot_client_snapshot( client, &snapshot_sequence );
+    snapshot_check( client_snapshot );
+    snapshot_check( memcmp( client_snapshot, snapshot_data, SnapshotBytes ) == 0 );
 
     const uint64_t * client_counters = snapshot_client_counters( client );
 
-    snapshot_check( client_counters[SNAPSHOT_CLIENT_COUNTER_PAYLOADS_SENT] > 0 );
     snapshot_check( client_counters[SNAPSHOT_CLIENT_COUNTER_PAYLOADS_RECEIVED] > 0 );
 
-    // check server counters
-
     const uint64_t * server_counters = snapshot_server_counters( server );
 
-    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PAYLOADS_SENT] > 0 );
-    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_PAYLOADS_RECEIVED] > 0 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_SNAPSHOT_KEYFRAMES_SENT] > 0 );
+    snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_SNAPSHOT_DELTAS_SENT] > server_counters[SNAPSHOT_SERVER_COUNTER_SNAPSHOT_KEYFRAMES_SENT] );
+
+    if ( range_coder != SNAPSHOT_RANGE_CODER_NONE )
+    {
+        snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_SNAPSHOT_RANGE_CODER_BYTES_SAVED] > 0 );
+    }
+    else
+    {
+        snapshot_check( server_counters[SNAPSHOT_SERVER_COUNTER_SNAPSHOT_RANGE_CODER_BYTES_SAVED] == 0 );
+    }
 
     // clean up
 
@@ -4089,6 +8220,17 @@ void test_client_server_payload()
     snapshot_client_destroy( client );
 }
 
+void test_client_server_snapshot()
+{
+    test_client_server_snapshot_range_coder_mode( SNAPSHOT_RANGE_CODER_NONE );
+}
+
+void test_client_server_snapshot_range_coder()
+{
+    test_client_server_snapshot_range_coder_mode( SNAPSHOT_RANGE_CODER_STATIC );
+    test_client_server_snapshot_range_coder_mode( SNAPSHOT_RANGE_CODER_ADAPTIVE );
+}
+
 void test_base64()
 {
     const char * input = "a test string. let's see if it works properly";
@@ -4129,18 +8271,27 @@ void snapshot_run_tests()
         RUN_TEST( test_time );
         RUN_TEST( test_endian );
         RUN_TEST( test_address );
+        RUN_TEST( test_address_index );
         RUN_TEST( test_read_and_write );
         RUN_TEST( test_bitpacker );
+        RUN_TEST( test_bitpacker_array );
+        RUN_TEST( test_schema );
+        RUN_TEST( test_crypto_isa );
         RUN_TEST( test_crypto_random_bytes );
         RUN_TEST( test_crypto_box );
         RUN_TEST( test_crypto_secret_box );
         RUN_TEST( test_crypto_aead );
         RUN_TEST( test_crypto_aead_ietf );
+        RUN_TEST( test_crypto_aead_batch );
+        RUN_TEST( test_crypto_aead_aes256gcm );
         RUN_TEST( test_crypto_sign_detached );
         RUN_TEST( test_crypto_key_exchange );
         RUN_TEST( test_platform_socket );
+        RUN_TEST( test_platform_socket_receive_packets );
+        RUN_TEST( test_platform_socket_gso_gro );
         RUN_TEST( test_platform_thread );
         RUN_TEST( test_platform_mutex );
+        RUN_TEST( test_io_thread );
         RUN_TEST( test_sequence );
         RUN_TEST( test_connect_token_private );
         RUN_TEST( test_connect_token_public );
@@ -4153,11 +8304,17 @@ void snapshot_run_tests()
         RUN_TEST( test_payload_packet );
         RUN_TEST( test_passthrough_packet );
         RUN_TEST( test_disconnect_packet );        
+        RUN_TEST( test_packet_prefix_valid );
+        RUN_TEST( test_connect_token_table );
+        RUN_TEST( test_rate_limiter );
         RUN_TEST( test_encryption_manager );
         RUN_TEST( test_replay_protection );
+        RUN_TEST( test_replay_protection_window );
+        RUN_TEST( test_handshake_pool );
         RUN_TEST( test_ipv4_client_create_any_port );
         RUN_TEST( test_ipv4_client_create_specific_port );
         RUN_TEST( test_ipv4_client_server_connect );
+        RUN_TEST( test_client_server_aes256gcm );
         RUN_TEST( test_ipv4_client_server_passthrough );
 #if SNAPSHOT_PLATFORM_HAS_IPV6
         RUN_TEST( test_ipv6_client_create_any_port );
@@ -4170,6 +8327,10 @@ void snapshot_run_tests()
         RUN_TEST( test_client_server_keep_alive );
         RUN_TEST( test_client_server_multiple_clients );
         RUN_TEST( test_client_server_multiple_servers );
+        RUN_TEST( test_client_server_io_thread );
+        RUN_TEST( test_client_server_handshake_threads );
+        RUN_TEST( test_client_server_stateless_handshake );
+        RUN_TEST( test_client_server_stateless_handshake_replay );
         RUN_TEST( test_client_error_connect_token_expired );
         RUN_TEST( test_client_error_invalid_connect_token );
         RUN_TEST( test_client_error_connection_timed_out );
@@ -4178,15 +8339,36 @@ void snapshot_run_tests()
         RUN_TEST( test_client_error_connection_denied );
         RUN_TEST( test_client_side_disconnect );
         RUN_TEST( test_server_side_disconnect );
+        RUN_TEST( test_server_send_batching );
+        RUN_TEST( test_server_max_clients );
+        RUN_TEST( test_server_memory_bytes );
+        RUN_TEST( test_server_admission );
+#if SNAPSHOT_PLATFORM == SNAPSHOT_PLATFORM_LINUX
+        RUN_TEST( test_sharded_server );
+        RUN_TEST( test_sharded_server_connect_token_reuse );
+        RUN_TEST( test_sharded_server_duplicate_client_id );
+#endif // #if SNAPSHOT_PLATFORM == SNAPSHOT_PLATFORM_LINUX
         RUN_TEST( test_client_reconnect );
         RUN_TEST( test_disable_timeout );
         RUN_TEST( test_sequence_buffer );
         RUN_TEST( test_generate_ack_bits );
+        RUN_TEST( test_packed_sequence_buffer );
         RUN_TEST( test_packet_header );
         RUN_TEST( test_acks );
         RUN_TEST( test_acks_packet_loss );
+        RUN_TEST( test_endpoint_create );
+        RUN_TEST( test_endpoint_packet_loss_and_bandwidth );
+        RUN_TEST( test_endpoint_bandwidth_gap );
+        RUN_TEST( test_endpoint_ack_bits );
         RUN_TEST( test_endpoint_payload );
+        RUN_TEST( test_endpoint_fragments );
+        RUN_TEST( test_endpoint_receive_payload );
+        RUN_TEST( test_packet_pool );
         RUN_TEST( test_client_server_payload );
+        RUN_TEST( test_delta_encoder );
+        RUN_TEST( test_range_coder );
+        RUN_TEST( test_client_server_snapshot );
+        RUN_TEST( test_client_server_snapshot_range_coder );
         RUN_TEST( test_base64 );
     }
 